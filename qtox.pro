@@ -79,8 +79,31 @@ contains(JENKINS,YES) {
 }
 
 contains(DEFINES, QTOX_FILTER_AUDIO) {
-    HEADERS += src/audio/audiofilterer.h
-    SOURCES += src/audio/audiofilterer.cpp
+    HEADERS += src/audio/audiofilterer.h \
+               src/audio/echoreference.h
+    SOURCES += src/audio/audiofilterer.cpp \
+               src/audio/echoreference.cpp
+}
+
+# QOpenGLWidget is only available since Qt 5.4
+greaterThan(QT_MINOR_VERSION, 3):!contains(DISABLE_GL_VIDEO, YES) {
+    DEFINES += QTOX_GL_VIDEO
+}
+
+contains(DEFINES, QTOX_GL_VIDEO) {
+    HEADERS += src/video/glvideorenderer.h
+    SOURCES += src/video/glvideorenderer.cpp
+}
+
+HEADERS += src/platform/threadpriority.h
+SOURCES += src/platform/threadpriority_osx.cpp \
+           src/platform/threadpriority_win.cpp \
+           src/platform/threadpriority_unix.cpp
+
+# rtkit grants real-time thread priority on Linux desktops, over D-Bus
+unix:!macx:!contains(DISABLE_RTKIT, YES) {
+    QT += dbus
+    DEFINES += QTOX_RTKIT
 }
 
 contains(DEFINES, QTOX_PLATFORM_EXT) {
@@ -103,6 +126,8 @@ win32 {
     LIBS += -lqrencode -lsqlcipher -lcrypto
     LIBS += -lopengl32 -lole32 -loleaut32 -lvfw32 -lws2_32 -liphlpapi -lgdi32 -lshlwapi -luuid
     LIBS += -lstrmiids # For DirectShow
+    LIBS += -lmf -lmfplat -lmfreadwrite -lmfuuid # For Media Foundation
+    LIBS += -lavrt # For MMCSS
     contains(DEFINES, QTOX_FILTER_AUDIO) {
         contains(STATICPKG, YES) {
             LIBS += -Wl,-Bstatic -lfilteraudio
@@ -118,6 +143,7 @@ win32 {
         QMAKE_MACOSX_DEPLOYMENT_TARGET = 10.7
         LIBS += -L$$PWD/libs/lib/ -ltoxcore -ltoxav -ltoxencryptsave -ltoxdns -lsodium -lvpx -lopus -framework OpenAL -lavformat -lavdevice -lavcodec -lavutil -lswscale -mmacosx-version-min=10.7
         LIBS += -framework AVFoundation -framework Foundation -framework CoreMedia -framework ApplicationServices
+        LIBS += -framework CoreVideo -framework IOSurface -framework OpenGL
         LIBS += -lqrencode -lsqlcipher
         contains(DEFINES, QTOX_PLATFORM_EXT) { LIBS += -framework IOKit -framework CoreFoundation }
         contains(DEFINES, QTOX_FILTER_AUDIO) { LIBS += -lfilteraudio }
@@ -126,6 +152,10 @@ win32 {
         APP_RESOURCE.files = img/icons/qtox_profile.icns OSX-Migrater.sh
         APP_RESOURCE.path = Contents/Resources
         QMAKE_BUNDLE_DATA += APP_RESOURCE
+        SMILEY_RESOURCE.files = $$OUT_PWD/smileys/Basic.rcc $$OUT_PWD/smileys/Classic.rcc \
+            $$OUT_PWD/smileys/Universe.rcc $$OUT_PWD/smileys/ASCII+Universe.rcc
+        SMILEY_RESOURCE.path = Contents/Resources/smileys
+        QMAKE_BUNDLE_DATA += SMILEY_RESOURCE
         #Dynamic versioning for Info.plist
         INFO_PLIST_PATH = $$shell_quote($${OUT_PWD}/$${TARGET}.app/Contents/Info.plist)
         QMAKE_POST_LINK += /usr/libexec/PlistBuddy -c \"Set :CFBundleShortVersionString $${GIT_DESCRIBE}\" $${INFO_PLIST_PATH}
@@ -152,6 +182,11 @@ win32 {
         icon_scalable.path = $$DATADIR/icons/hicolor/scalable/apps
         INSTALLS += icon_scalable
 
+        smileys.files = $$OUT_PWD/smileys/*.rcc
+        smileys.path = $$DATADIR/qtox/smileys
+        smileys.CONFIG += no_check_exist
+        INSTALLS += smileys
+
         # If we're building a package, static link libtox[core,av] and libsodium, since they are not provided by any package
         contains(STATICPKG, YES) {
             LIBS += -L$$PWD/libs/lib/ -lopus -lvpx -lopenal -Wl,-Bstatic -ltoxcore -ltoxav -ltoxencryptsave -ltoxdns -lsodium -lavformat -lavdevice -lavcodec -lavutil -lswscale -lz -Wl,-Bdynamic
@@ -227,10 +262,12 @@ unix:!macx {
 
 win32 {
     HEADERS += \
-        src/platform/camera/directshow.h
+        src/platform/camera/directshow.h \
+        src/platform/camera/mediafoundation.h
 
     SOURCES += \
-        src/platform/camera/directshow.cpp
+        src/platform/camera/directshow.cpp \
+        src/platform/camera/mediafoundation.cpp
 }
 
 unix:!macx {
@@ -253,17 +290,42 @@ macx {
         src/platform/camera/avfoundation.mm
 }
 
-RESOURCES += res.qrc \
-    smileys/smileys.qrc
+RESOURCES += res.qrc
+
+# The smiley packs are external resource bundles, SmileyPack maps only the one in use
+SMILEY_PACKS = \
+    smileys/Basic.qrc \
+    smileys/Classic.qrc \
+    smileys/Universe.qrc \
+    smileys/ASCII+Universe.qrc
+
+smileyrcc.input = SMILEY_PACKS
+smileyrcc.output = $$OUT_PWD/smileys/${QMAKE_FILE_IN_BASE}.rcc
+smileyrcc.commands = $$shell_path($$[QT_INSTALL_BINS]/rcc) -binary ${QMAKE_FILE_IN} -o ${QMAKE_FILE_OUT}
+smileyrcc.depend_command = $$shell_path($$[QT_INSTALL_BINS]/rcc) -list ${QMAKE_FILE_IN}
+smileyrcc.CONFIG += no_link target_predeps
+QMAKE_EXTRA_COMPILERS += smileyrcc
 
 HEADERS  += \
     src/friend.h \
     src/friendlist.h \
+    src/friendsearchindex.h \
     src/group.h \
     src/grouplist.h \
     src/ipc.h \
     src/nexus.h \
+    src/headless.h \
+    src/trace.h \
+    src/captureclock.h \
+    src/memorystats.h \
+    src/logwriter.h \
     src/audio/audio.h \
+    src/audio/audiojitterbuffer.h \
+    src/audio/audioresampler.h \
+    src/audio/groupaudiomixer.h \
+    src/audio/audioringbuffer.h \
+    src/audio/samplekernels.h \
+    src/audio/voicedetector.h \
     src/chatlog/chatlog.h \
     src/chatlog/chatline.h \
     src/chatlog/chatlinecontent.h \
@@ -273,20 +335,31 @@ HEADERS  += \
     src/chatlog/content/filetransferwidget.h \
     src/chatlog/chatmessage.h \
     src/chatlog/content/image.h \
+    src/chatlog/content/imagepreview.h \
     src/chatlog/customtextdocument.h \
+    src/chatlog/messageformatter.h \
+    src/chatlog/mentionmatcher.h \
+    src/chatlog/messagecache.h \
     src/chatlog/content/notificationicon.h \
     src/chatlog/content/timestamp.h \
     src/chatlog/documentcache.h \
     src/chatlog/pixmapcache.h \
     src/core/core.h \
+    src/core/callstats.h \
     src/core/coreav.h \
     src/core/coredefines.h \
+    src/core/coreevents.h \
     src/core/corefile.h \
     src/core/corestructs.h \
+    src/core/fileprefetcher.h \
+    src/core/filescheduler.h \
+    src/core/filewriter.h \
     src/core/cdata.h \
     src/core/cstring.h \
     src/core/toxid.h \
+    src/core/toxpk.h \
     src/core/indexedlist.h \
+    src/core/messagequeue.h \
     src/core/toxcall.h \
     src/net/toxuri.h \
     src/net/toxdns.h \
@@ -299,9 +372,12 @@ HEADERS  += \
     src/persistence/offlinemsgengine.h \
     src/persistence/profilelocker.h \
     src/persistence/profile.h \
+    src/persistence/passkeycache.h \
     src/persistence/settingsserializer.h \
     src/persistence/db/rawdatabase.h \
     src/persistence/history.h \
+    src/persistence/chatexporter.h \
+    src/persistence/peeridregistry.h \
     src/persistence/historykeeper.h \
     src/persistence/settings.h \
     src/persistence/db/genericddinterface.h \
@@ -310,13 +386,17 @@ HEADERS  += \
     src/video/videosurface.h \
     src/video/netcamview.h \
     src/video/videoframe.h \
+    src/video/framebufferpool.h \
+    src/video/planekernels.h \
     src/video/videosource.h \
     src/video/cameradevice.h \
+    src/video/cameradiscovery.h \
     src/video/camerasource.h \
     src/video/corevideosource.h \
     src/video/videomode.h \
     src/video/genericnetcamview.h \
     src/video/groupnetcamview.h \
+    src/video/grouppeergrid.h \
     src/widget/emoticonswidget.h \
     src/widget/style.h \
     src/widget/tool/croppinglabel.h \
@@ -343,6 +423,7 @@ HEADERS  += \
     src/widget/form/genericchatform.h \
     src/widget/tool/adjustingscrollarea.h \
     src/widget/form/loadhistorydialog.h \
+    src/widget/form/searchhistorydialog.h \
     src/widget/form/setpassworddialog.h \
     src/widget/form/tabcompleter.h \
     src/widget/tool/callconfirmwidget.h \
@@ -363,6 +444,8 @@ HEADERS  += \
     src/widget/circlewidget.h \
     src/widget/genericchatitemwidget.h \
     src/widget/friendlistlayout.h \
+    src/widget/friendlistmodel.h \
+    src/widget/friendlistview.h \
     src/widget/genericchatitemlayout.h \
     src/widget/categorywidget.h \
     src/widget/contentlayout.h \
@@ -379,19 +462,37 @@ SOURCES += \
     src/ipc.cpp \
     src/friend.cpp \
     src/friendlist.cpp \
+    src/friendsearchindex.cpp \
     src/group.cpp \
     src/grouplist.cpp \
     src/main.cpp \
     src/nexus.cpp \
+    src/headless.cpp \
+    src/trace.cpp \
+    src/memorystats.cpp \
+    src/logwriter.cpp \
     src/audio/audio.cpp \
+    src/audio/audiojitterbuffer.cpp \
+    src/audio/audioresampler.cpp \
+    src/audio/groupaudiomixer.cpp \
+    src/audio/audioringbuffer.cpp \
+    src/audio/samplekernels.cpp \
+    src/audio/voicedetector.cpp \
     src/core/cdata.cpp \
     src/core/cstring.cpp \
     src/core/core.cpp \
+    src/core/callstats.cpp \
     src/core/coreav.cpp \
     src/core/coreencryption.cpp \
+    src/core/coreevents.cpp \
     src/core/corefile.cpp \
     src/core/corestructs.cpp \
+    src/core/fileprefetcher.cpp \
+    src/core/filescheduler.cpp \
+    src/core/filewriter.cpp \
+    src/core/messagequeue.cpp \
     src/core/toxid.cpp \
+    src/core/toxpk.cpp \
     src/core/toxcall.cpp \
     src/chatlog/chatlog.cpp \
     src/chatlog/chatline.cpp \
@@ -402,7 +503,11 @@ SOURCES += \
     src/chatlog/content/filetransferwidget.cpp \
     src/chatlog/chatmessage.cpp \
     src/chatlog/content/image.cpp \
+    src/chatlog/content/imagepreview.cpp \
     src/chatlog/customtextdocument.cpp\
+    src/chatlog/messageformatter.cpp \
+    src/chatlog/mentionmatcher.cpp \
+    src/chatlog/messagecache.cpp \
     src/chatlog/content/notificationicon.cpp \
     src/chatlog/content/timestamp.cpp \
     src/chatlog/documentcache.cpp \
@@ -418,6 +523,7 @@ SOURCES += \
     src/persistence/db/plaindb.cpp \
     src/persistence/db/encrypteddb.cpp \
     src/persistence/profile.cpp \
+    src/persistence/passkeycache.cpp \
     src/persistence/settingsserializer.cpp \
     src/persistence/smileypack.cpp \
     src/persistence/toxsave.cpp \
@@ -426,12 +532,19 @@ SOURCES += \
     src/persistence/profilelocker.cpp \
     src/persistence/db/rawdatabase.cpp \
     src/persistence/history.cpp \
+    src/persistence/chatexporter.cpp \
+    src/persistence/peeridregistry.cpp \
     src/video/videoframe.cpp \
+    src/video/videosource.cpp \
+    src/video/framebufferpool.cpp \
+    src/video/planekernels.cpp \
     src/video/cameradevice.cpp \
+    src/video/cameradiscovery.cpp \
     src/video/camerasource.cpp \
     src/video/corevideosource.cpp \
     src/video/genericnetcamview.cpp \
     src/video/groupnetcamview.cpp \
+    src/video/grouppeergrid.cpp \
     src/video/netcamview.cpp \
     src/video/videosurface.cpp \
     src/widget/form/addfriendform.cpp \
@@ -447,6 +560,7 @@ SOURCES += \
     src/widget/friendlistwidget.cpp \
     src/widget/tool/adjustingscrollarea.cpp \
     src/widget/form/loadhistorydialog.cpp \
+    src/widget/form/searchhistorydialog.cpp \
     src/widget/form/setpassworddialog.cpp \
     src/widget/form/tabcompleter.cpp \
     src/widget/flowlayout.cpp \
@@ -479,6 +593,8 @@ SOURCES += \
     src/widget/circlewidget.cpp \
     src/widget/genericchatitemwidget.cpp \
     src/widget/friendlistlayout.cpp \
+    src/widget/friendlistmodel.cpp \
+    src/widget/friendlistview.cpp \
     src/widget/genericchatitemlayout.cpp \
     src/widget/categorywidget.cpp \
     src/widget/contentlayout.cpp \
@@ -18,11 +18,18 @@
 */
 
 #include "audio.h"
+#include "audioresampler.h"
+#include "audioringbuffer.h"
+#include "samplekernels.h"
 #include "src/core/core.h"
 #include "src/core/coreav.h"
 #include "src/persistence/settings.h"
+#include "src/platform/threadpriority.h"
+#include "src/captureclock.h"
+#include "src/trace.h"
 
 #include <QDebug>
+#include <QElapsedTimer>
 #include <QFile>
 #include <QMutexLocker>
 #include <QPointer>
@@ -31,6 +38,8 @@
 #include <QWaitCondition>
 
 #include <cassert>
+#include <cstring>
+#include <functional>
 
 #ifdef QTOX_FILTER_AUDIO
 #include "audiofilterer.h"
@@ -79,6 +88,43 @@ private:
     qreal   gainFactor;
 };
 
+namespace
+{
+
+/// A few frames are enough for a sender that's late once, more would only add latency
+const int maxCapturedFrames = 8;
+const int maxCaptureSamples = AUDIO_MAX_FRAME_SAMPLE_COUNT * AUDIO_CHANNELS;
+/// Each captured frame goes to the sendThread as its sample count, its capture time, the samples
+/// and the mono echo reference that was played meanwhile, sized for the longest frame
+const int captureHeaderSamples = 1 + sizeof(qint64) / sizeof(int16_t);
+const int captureSlotSamples = captureHeaderSamples + maxCaptureSamples + AUDIO_MAX_FRAME_SAMPLE_COUNT;
+/// The Opus frame durations we can time, 2.5ms is below what our timers can do
+const int frameDurations[] = {5, 10, 20, 40, 60};
+/// Frames each output source can have queued, beyond that we drop them
+const int outBufferCount = 16;
+/// Notification sounds that can play at the same time, the oldest one is cut beyond that
+const int mainSourceCount = 4;
+
+class AudioSendThread : public QThread
+{
+public:
+    explicit AudioSendThread(std::function<void()> send)
+        : send{send}
+    {
+    }
+
+protected:
+    virtual void run() final override
+    {
+        send();
+    }
+
+private:
+    std::function<void()> send;
+};
+
+}
+
 /**
 Returns the singleton instance.
 */
@@ -93,10 +139,26 @@ Audio::Audio()
     , audioThread{new QThread}
     , alInDev{nullptr}
     , inSubscriptions{0}
+    , inputOpening{false}
+    , capturedFrames{new AudioRingBuffer{maxCapturedFrames, captureSlotSamples}}
+    , sendThread{new AudioSendThread{std::bind(&Audio::sendFrames, this)}}
+    , sending{true}
+    , capturedLevels{0}
+    , silentFrameSamples{0}
+    , silentFrameTime{0}
+    , haveSilentFrame{false}
+    , captureRestarted{false}
+    , captureFrameDuration{AUDIO_FRAME_DURATION}
+    , framesCaptured{0}
+    , framesDropped{0}
+    , framesSent{0}
+    , framesSilent{0}
+    , processingTime{0}
+    , maxProcessingTime{0}
     , alOutDev{nullptr}
     , alOutContext{nullptr}
-    , alMainSource{0}
-    , alMainBuffer{0}
+    , nextMainSourceIndex{0}
+    , loopNextSound{false}
     , outputInitialized{false}
 {
     // initialize OpenAL error stack
@@ -110,20 +172,33 @@ Audio::Audio()
 
 #ifdef QTOX_FILTER_AUDIO
     filterer.startFilter(AUDIO_SAMPLE_RATE);
+    echoDelay = 0;
 #endif
 
     connect(&captureTimer, &QTimer::timeout, this, &Audio::doCapture);
-    captureTimer.setInterval(AUDIO_FRAME_DURATION/2);
+    captureTimer.setInterval(captureFrameDuration / 2);
     captureTimer.setSingleShot(false);
-    captureTimer.start();
-    connect(&playMono16Timer, &QTimer::timeout, this, &Audio::playMono16SoundCleanup);
-    playMono16Timer.setSingleShot(true);
 
+    connect(&inputReleaseTimer, &QTimer::timeout, this, &Audio::releaseInput);
+    inputReleaseTimer.setSingleShot(true);
+
+    // runs in the new thread, which captures and plays
+    connect(audioThread, &QThread::started, []()
+    {
+        if (Settings::getInstance().getRealtimeThreads())
+            Platform::setThreadRealtime(Platform::ThreadClass::Audio);
+    });
     audioThread->start();
+    sendThread->setObjectName("qTox Audio Sender");
+    sendThread->start();
 }
 
 Audio::~Audio()
 {
+    sending = false;
+    capturedFrameCount.release();
+    sendThread->wait();
+    delete sendThread;
     audioThread->exit();
     audioThread->wait();
     cleanupInput();
@@ -131,6 +206,7 @@ Audio::~Audio()
 #ifdef QTOX_FILTER_AUDIO
     filterer.closeFilter();
 #endif
+    delete capturedFrames;
     delete d;
 }
 
@@ -245,6 +321,103 @@ void Audio::setInputGain(qreal dB)
     d->setInputGain(dB);
 }
 
+/**
+Get the levels metered on the last captured frame, after the gain was applied.
+Doesn't lock, so meters can poll it as often as they like.
+*/
+void Audio::inputLevels(qreal& peak, qreal& rms) const
+{
+    quint32 levels = capturedLevels;
+    peak = (levels >> 16) / 65535.0;
+    rms = (levels & 0xffff) / 65535.0;
+}
+
+/**
+Returns the duration of the frames we capture, in milliseconds.
+*/
+int Audio::frameDuration() const
+{
+    return captureFrameDuration;
+}
+
+/**
+Returns the number of samples per channel in the frames we capture.
+*/
+int Audio::frameSampleCount() const
+{
+    return captureFrameDuration * static_cast<int>(AUDIO_SAMPLE_RATE) / 1000;
+}
+
+/**
+@brief Changes the duration of the frames we capture from now on.
+@return False if Opus doesn't take frames of that duration, nothing changes then.
+
+The frames already captured keep their size, so the switch doesn't drop audio.
+*/
+bool Audio::setFrameDuration(int ms)
+{
+    if (!isValidFrameDuration(ms))
+    {
+        qWarning() << "Unsupported audio frame duration" << ms << "ms";
+        return false;
+    }
+
+    QMutexLocker locker(&audioLock);
+    applyFrameDuration(ms);
+    return true;
+}
+
+bool Audio::isValidFrameDuration(int ms)
+{
+    for (int duration : frameDurations)
+        if (duration == ms)
+            return true;
+
+    return false;
+}
+
+QVector<int> Audio::validFrameDurations()
+{
+    QVector<int> durations;
+    for (int duration : frameDurations)
+        durations.append(duration);
+
+    return durations;
+}
+
+/**
+@brief Captures frames of ms from now on, the caller holds the audioLock.
+*/
+void Audio::applyFrameDuration(int ms)
+{
+    if (captureFrameDuration == ms)
+        return;
+
+    captureFrameDuration = ms;
+    if (alInDev && inSubscriptions)
+        QMetaObject::invokeMethod(&captureTimer, "start", Q_ARG(int, qMax(1, ms / 2)));
+}
+
+/**
+@brief Returns the counters of the capture pipeline since the input was opened.
+
+Meant to track the cost of our capture DSP and how often the sendThread falls behind,
+in the logs or from a debugger, without having to be in a call.
+*/
+Audio::CaptureStats Audio::getCaptureStats() const
+{
+    CaptureStats stats;
+    stats.captured = framesCaptured;
+    stats.dropped = framesDropped;
+    stats.sent = framesSent;
+    stats.silent = framesSilent;
+    const quint64 processed = stats.sent + stats.silent;
+    if (processed)
+        stats.meanProcessing = static_cast<quint32>(processingTime / processed / 1000);
+    stats.maxProcessing = maxProcessingTime;
+    return stats;
+}
+
 void Audio::reinitInput(const QString& inDevDesc)
 {
     QMutexLocker locker(&audioLock);
@@ -260,28 +433,36 @@ bool Audio::reinitOutput(const QString& outDevDesc)
 }
 
 /**
-@brief Subscribe to capture sound from the opened input device.
+@brief Subscribe to capture sound from the input device.
 
-If the input device is not open, it will be opened before capturing.
+A device kept warm since the last call starts capturing right away, otherwise it is opened
+on the audio thread, so starting a call or the mic test doesn't wait for slow devices.
 */
 void Audio::subscribeInput()
 {
     QMutexLocker locker(&audioLock);
 
-    if (!autoInitInput())
-    {
-        qWarning("Failed to subscribe to audio input device.");
-        return;
-    }
-
     inSubscriptions++;
     qDebug() << "Subscribed to audio input device [" << inSubscriptions << "subscriptions ]";
+
+    QMetaObject::invokeMethod(&inputReleaseTimer, "stop");
+    if (alInDev)
+    {
+        if (inSubscriptions == 1)
+            startCapture();
+    }
+    else if (!inputOpening)
+    {
+        inputOpening = true;
+        QMetaObject::invokeMethod(this, "openInput", Qt::QueuedConnection);
+    }
 }
 
 /**
 @brief Unsubscribe from capturing from an opened input device.
 
-If the input device has no more subscriptions, it will be closed.
+If the input device has no more subscriptions, it stops capturing and is closed
+once it's been unused for the keep warm time.
 */
 void Audio::unsubscribeInput()
 {
@@ -293,18 +474,52 @@ void Audio::unsubscribeInput()
     inSubscriptions--;
     qDebug() << "Unsubscribed from audio input device [" << inSubscriptions << "subscriptions left ]";
 
-    if (!inSubscriptions)
-        cleanupInput();
+    if (!inSubscriptions && alInDev)
+        idleInput();
 }
 
-/**
-Initialize audio input device, if not initialized.
+void Audio::openInput()
+{
+    {
+        QMutexLocker locker(&audioLock);
+        if (alInDev || !inSubscriptions)
+        {
+            inputOpening = false;
+            return;
+        }
+    }
 
-@return true, if device was initialized; false otherwise
-*/
-bool Audio::autoInitInput()
+    const QString inDevDescr = Settings::getInstance().getInDev();
+    qDebug() << "Opening audio input" << inDevDescr;
+    ALCdevice* device = inDevDescr == "none" ? nullptr : openInputDevice(inDevDescr);
+
+    QMutexLocker locker(&audioLock);
+    inputOpening = false;
+    if (inDevDescr == "none")
+        return;
+
+    if (!device)
+    {
+        qWarning("Failed to subscribe to audio input device.");
+        return;
+    }
+
+    // reinitInput opened another one meanwhile
+    if (alInDev)
+    {
+        alcCaptureCloseDevice(device);
+        return;
+    }
+
+    alInDev = device;
+    setupInput();
+}
+
+void Audio::releaseInput()
 {
-    return alInDev ? true : initInput(Settings::getInstance().getInDev());
+    QMutexLocker locker(&audioLock);
+    if (!inSubscriptions)
+        cleanupInput();
 }
 
 /**
@@ -325,11 +540,26 @@ bool Audio::initInput(QString inDevDescr)
         return true;
 
     assert(!alInDev);
+    alInDev = openInputDevice(inDevDescr);
+    if (!alInDev)
+        return false;
 
+    setupInput();
+    return true;
+}
+
+/**
+@internal
+
+Opens a capture device, doesn't touch our state so it can run without the audioLock
+*/
+ALCdevice* Audio::openInputDevice(QString inDevDescr)
+{
     /// TODO: Try to actually detect if our audio source is stereo
     int stereoFlag = AUDIO_CHANNELS == 1 ? AL_FORMAT_MONO16 : AL_FORMAT_STEREO16;
     const uint32_t sampleRate = AUDIO_SAMPLE_RATE;
-    const uint16_t frameDuration = AUDIO_FRAME_DURATION;
+    // the device buffer must hold a few of our longest frames, whatever the setting
+    const uint16_t frameDuration = AUDIO_MAX_FRAME_DURATION;
     const uint32_t chnls = AUDIO_CHANNELS;
     const ALCsizei bufSize = (frameDuration * sampleRate * 4) / 1000 * chnls;
     if (inDevDescr.isEmpty())
@@ -339,23 +569,71 @@ bool Audio::initInput(QString inDevDescr)
             inDevDescr = QString::fromUtf8(pDeviceList, strlen(pDeviceList));
     }
 
+    ALCdevice* device = nullptr;
     if (!inDevDescr.isEmpty())
-        alInDev = alcCaptureOpenDevice(inDevDescr.toUtf8().constData(),
-                                       sampleRate, stereoFlag, bufSize);
+        device = alcCaptureOpenDevice(inDevDescr.toUtf8().constData(),
+                                      sampleRate, stereoFlag, bufSize);
 
-    // Restart the capture if necessary
-    if (!alInDev)
-    {
+    if (!device)
         qWarning() << "Failed to initialize audio input device:" << inDevDescr;
-        return false;
-    }
+    else
+        qDebug() << "Opened audio input" << inDevDescr;
+
+    return device;
+}
 
+void Audio::setupInput()
+{
     d->setInputGain(Settings::getInstance().getAudioInGain());
+    int duration = Settings::getInstance().getAudioFrameDuration();
+    applyFrameDuration(isValidFrameDuration(duration) ? duration : static_cast<int>(AUDIO_FRAME_DURATION));
 
-    qDebug() << "Opened audio input" << inDevDescr;
+    if (inSubscriptions)
+        startCapture();
+    else
+        idleInput();
+}
+
+/**
+@internal
+
+Starts capturing on the open input, the caller holds the audioLock
+*/
+void Audio::startCapture()
+{
+    captureRestarted = true;
     alcCaptureStart(alInDev);
+    // polling twice a frame keeps the capture latency under half a frame
+    QMetaObject::invokeMethod(&captureTimer, "start", Q_ARG(int, qMax(1, captureFrameDuration / 2)));
+}
 
-    return true;
+/**
+@internal
+
+Stops capturing but keeps the input open for a while, the next call may well come soon
+*/
+void Audio::idleInput()
+{
+    QMetaObject::invokeMethod(&captureTimer, "stop");
+    alcCaptureStop(alInDev);
+    capturedLevels = 0;
+
+    // what's left in the device buffer would be stale once we capture again
+    ALint leftSamples = 0;
+    alcGetIntegerv(alInDev, ALC_CAPTURE_SAMPLES, sizeof(leftSamples), &leftSamples);
+    int16_t discard[maxCaptureSamples];
+    while (leftSamples > 0)
+    {
+        const ALint samples = qMin(leftSamples, static_cast<ALint>(AUDIO_MAX_FRAME_SAMPLE_COUNT));
+        alcCaptureSamples(alInDev, discard, samples);
+        leftSamples -= samples;
+    }
+
+    const int keepWarm = Settings::getInstance().getAudioInputKeepWarm();
+    if (keepWarm <= 0)
+        cleanupInput();
+    else
+        QMetaObject::invokeMethod(&inputReleaseTimer, "start", Q_ARG(int, keepWarm * 1000));
 }
 
 /**
@@ -401,7 +679,8 @@ bool Audio::initOutput(QString outDevDescr)
         return false;
     }
 
-    alGenSources(1, &alMainSource);
+    alMainSources.resize(mainSourceCount);
+    alGenSources(mainSourceCount, alMainSources.data());
     checkAlError();
 
     // init master volume
@@ -421,41 +700,82 @@ bool Audio::initOutput(QString outDevDescr)
 
 /**
 Play a 44100Hz mono 16bit PCM sound from a file
+
+A sound that is still playing keeps playing, the new one starts on another source.
 */
 void Audio::playMono16Sound(const QString& path)
 {
-    QFile sndFile(path);
-    sndFile.open(QIODevice::ReadOnly);
-    playMono16Sound(QByteArray(sndFile.readAll()));
+    QMutexLocker locker(&audioLock);
+
+    if (!autoInitOutput() || alMainSources.isEmpty())
+        return;
+
+    ALuint buffer = soundBuffer(path);
+    if (!buffer)
+        return;
+
+    ALuint source = nextMainSource();
+    alSourceStop(source);
+    alSourcei(source, AL_LOOPING, loopNextSound ? AL_TRUE : AL_FALSE);
+    alSourcei(source, AL_BUFFER, static_cast<ALint>(buffer));
+    alSourcePlay(source);
+    checkAlError();
+    loopNextSound = false;
 }
 
 /**
-Play a 44100Hz mono 16bit PCM sound
+@internal
+
+Returns the AL buffer of a sound file, read and uploaded the first time it's played
 */
-void Audio::playMono16Sound(const QByteArray& data)
+ALuint Audio::soundBuffer(const QString& path)
 {
-    QMutexLocker locker(&audioLock);
+    ALuint buffer = soundBuffers.value(path);
+    if (buffer)
+        return buffer;
 
-    if (!autoInitOutput())
-        return;
+    QFile sndFile(path);
+    if (!sndFile.open(QIODevice::ReadOnly))
+    {
+        qWarning() << "Can't open sound" << path;
+        return 0;
+    }
 
-    if (!alMainBuffer)
-        alGenBuffers(1, &alMainBuffer);
+    const QByteArray data = sndFile.readAll();
+    alGenBuffers(1, &buffer);
+    alBufferData(buffer, AL_FORMAT_MONO16, data.constData(), data.size(), 44100);
+    checkAlError();
+    soundBuffers.insert(path, buffer);
+    return buffer;
+}
 
-    ALint state;
-    alGetSourcei(alMainSource, AL_SOURCE_STATE, &state);
-    if (state == AL_PLAYING)
+/**
+@internal
+
+Returns an idle main source, or the next one round-robin that isn't looping a ringtone
+*/
+ALuint Audio::nextMainSource()
+{
+    for (ALuint source : alMainSources)
     {
-        alSourceStop(alMainSource);
-        alSourcei(alMainSource, AL_BUFFER, AL_NONE);
+        ALint state;
+        alGetSourcei(source, AL_SOURCE_STATE, &state);
+        if (state != AL_PLAYING)
+            return source;
     }
 
-    alBufferData(alMainBuffer, AL_FORMAT_MONO16, data.constData(), data.size(), 44100);
-    alSourcei(alMainSource, AL_BUFFER, static_cast<ALint>(alMainBuffer));
-    alSourcePlay(alMainSource);
+    for (int i = 0; i < alMainSources.size(); ++i)
+    {
+        ALuint source = alMainSources[nextMainSourceIndex];
+        nextMainSourceIndex = (nextMainSourceIndex + 1) % alMainSources.size();
+
+        ALint looping;
+        alGetSourcei(source, AL_LOOPING, &looping);
+        if (!looping)
+            return source;
+    }
 
-    int durationMs = data.size() * 1000 / 2 / 44100;
-    playMono16Timer.start(durationMs + 50);
+    return alMainSources[0];
 }
 
 void Audio::playAudioBuffer(ALuint alSource, const int16_t *data, int samples, unsigned channels, int sampleRate)
@@ -466,36 +786,97 @@ void Audio::playAudioBuffer(ALuint alSource, const int16_t *data, int samples, u
     if (!(alOutDev && outputInitialized))
         return;
 
-    ALuint bufid;
-    ALint processed = 0, queued = 16;
+    auto it = outBuffers.find(alSource);
+    if (it == outBuffers.end())
+    {
+        qWarning() << "Trying to play on unknown audio source" << alSource;
+        return;
+    }
+    OutputBuffers& buffers = *it;
+
+    ALint processed = 0;
     alGetSourcei(alSource, AL_BUFFERS_PROCESSED, &processed);
-    alGetSourcei(alSource, AL_BUFFERS_QUEUED, &queued);
     alSourcei(alSource, AL_LOOPING, AL_FALSE);
 
-    if (processed)
+    if (processed > 0)
     {
-        ALuint bufids[processed];
+        ALuint bufids[outBufferCount];
+        processed = qMin(processed, outBufferCount);
         alSourceUnqueueBuffers(alSource, processed, bufids);
-        alDeleteBuffers(processed - 1, bufids + 1);
-        bufid = bufids[0];
+        for (int i = 0; i < processed; ++i)
+            buffers.free << bufids[i];
     }
-    else if (queued < 16)
+
+    if (buffers.free.isEmpty())
+        return;
+
+    // we resample ourselves rather than trusting whatever the OpenAL implementation does
+    if (sampleRate != static_cast<int>(AUDIO_SAMPLE_RATE))
     {
-        alGenBuffers(1, &bufid);
+        if (!buffers.resampler || buffers.resampler->getInRate() != sampleRate
+                || buffers.resampler->getChannels() != static_cast<int>(channels))
+        {
+            buffers.resampler = std::make_shared<AudioResampler>(channels, sampleRate, AUDIO_SAMPLE_RATE);
+        }
+
+        samples = buffers.resampler->process(data, samples, buffers.resampled);
+        data = buffers.resampled.constData();
+        sampleRate = AUDIO_SAMPLE_RATE;
+        if (!samples)
+            return;
     }
-    else
+    else if (buffers.resampler)
     {
-        return;
+        buffers.resampler.reset();
     }
 
+    ALuint bufid = buffers.free.takeLast();
     alBufferData(bufid, (channels == 1) ? AL_FORMAT_MONO16 : AL_FORMAT_STEREO16, data,
                     samples * 2 * channels, sampleRate);
     alSourceQueueBuffers(alSource, 1, &bufid);
 
+#ifdef QTOX_FILTER_AUDIO
+    echoReference.add(alSource, data, samples, channels);
+    ALint queued = 0;
+    alGetSourcei(alSource, AL_BUFFERS_QUEUED, &queued);
+    echoDelay = queued * samples * 1000 / sampleRate;
+#endif
+
     ALint state;
     alGetSourcei(alSource, AL_SOURCE_STATE, &state);
     if (state != AL_PLAYING)
+    {
+        // A stopped source with buffers it already played means we fed it too slowly
+        if (state == AL_STOPPED)
+            ++buffers.underruns;
+
         alSourcePlay(alSource);
+    }
+}
+
+/**
+@brief Number of buffers waiting to be played on an output source, for diagnostics.
+*/
+int Audio::queuedBuffers(ALuint alSource) const
+{
+    QMutexLocker locker(&audioLock);
+
+    if (!(alOutDev && outputInitialized) || !outBuffers.contains(alSource))
+        return 0;
+
+    ALint queued = 0, processed = 0;
+    alGetSourcei(alSource, AL_BUFFERS_QUEUED, &queued);
+    alGetSourcei(alSource, AL_BUFFERS_PROCESSED, &processed);
+    return queued - processed;
+}
+
+/**
+@brief Number of times an output source ran out of audio to play, for diagnostics.
+*/
+quint32 Audio::underruns(ALuint alSource) const
+{
+    QMutexLocker locker(&audioLock);
+    return outBuffers.value(alSource).underruns;
 }
 
 /**
@@ -508,7 +889,17 @@ void Audio::cleanupInput()
     if (!alInDev)
         return;
 
-    qDebug() << "Closing audio input";
+    const CaptureStats stats = getCaptureStats();
+    qDebug() << "Closing audio input after" << stats.captured << "frames," << stats.dropped << "dropped,"
+             << stats.sent << "sent," << stats.silent << "silent, processing took"
+             << stats.meanProcessing << "us on average and" << stats.maxProcessing << "us at most";
+    framesCaptured = framesDropped = framesSent = framesSilent = processingTime = 0;
+    maxProcessingTime = 0;
+
+    capturedLevels = 0;
+    captureRestarted = true;
+    QMetaObject::invokeMethod(&captureTimer, "stop");
+    QMetaObject::invokeMethod(&inputReleaseTimer, "stop");
     alcCaptureStop(alInDev);
     if (alcCaptureCloseDevice(alInDev) == ALC_TRUE)
         alInDev = nullptr;
@@ -527,15 +918,17 @@ void Audio::cleanupOutput()
 
     if (alOutDev)
     {
-        alSourcei(alMainSource, AL_LOOPING, AL_FALSE);
-        alSourceStop(alMainSource);
-        alDeleteSources(1, &alMainSource);
+        alSourceStopv(alMainSources.size(), alMainSources.data());
+        alDeleteSources(alMainSources.size(), alMainSources.data());
+        alMainSources.clear();
+        nextMainSourceIndex = 0;
 
-        if (alMainBuffer)
-        {
-            alDeleteBuffers(1, &alMainBuffer);
-            alMainBuffer = 0;
-        }
+        for (ALuint buffer : soundBuffers)
+            alDeleteBuffers(1, &buffer);
+        soundBuffers.clear();
+
+        // The buffers go away with the device, the sources get recreated
+        outBuffers.clear();
 
         if (!alcMakeContextCurrent(nullptr))
             qWarning("Failed to clear audio context.");
@@ -551,58 +944,149 @@ void Audio::cleanupOutput()
     }
 }
 
-void Audio::playMono16SoundCleanup()
-{
-    QMutexLocker locker(&audioLock);
-
-    ALint state;
-    alGetSourcei(alMainSource, AL_SOURCE_STATE, &state);
-    if (state == AL_STOPPED)
-    {
-        alSourcei(alMainSource, AL_BUFFER, AL_NONE);
-        alDeleteBuffers(1, &alMainBuffer);
-        alMainBuffer = 0;
-    }
-}
-
 void Audio::doCapture()
 {
+    TraceSpan span{"Audio::doCapture"};
     QMutexLocker lock(&audioLock);
 
     if (!alInDev || !inSubscriptions)
         return;
 
+    const ALint frameSamples = frameSampleCount();
     ALint curSamples = 0;
     alcGetIntegerv(alInDev, ALC_CAPTURE_SAMPLES, sizeof(curSamples), &curSamples);
-    if (curSamples < AUDIO_FRAME_SAMPLE_COUNT)
+    if (curSamples < frameSamples)
         return;
 
-    int16_t buf[AUDIO_FRAME_SAMPLE_COUNT * AUDIO_CHANNELS];
-    alcCaptureSamples(alInDev, buf, AUDIO_FRAME_SAMPLE_COUNT);
+    // the first sample of the frame is the oldest the device has buffered
+    const qint64 captureTime = CaptureClock::now() - curSamples * 1000000LL / AUDIO_SAMPLE_RATE;
+
+    int16_t buf[captureSlotSamples];
+    buf[0] = static_cast<int16_t>(frameSamples);
+    memcpy(buf + 1, &captureTime, sizeof(captureTime));
+    alcCaptureSamples(alInDev, buf + captureHeaderSamples, frameSamples);
 
 #ifdef QTOX_FILTER_AUDIO
-    if (Settings::getInstance().getFilterAudio())
-    {
-#ifdef ALC_LOOPBACK_CAPTURE_SAMPLES
-        // compatibility with older versions of OpenAL
-        getEchoesToFilter(filterer, AUDIO_FRAME_SAMPLE_COUNT * AUDIO_CHANNELS);
+    // what was queued to play while this frame was recorded, its echo comes back after echoDelay
+    echoReference.take(buf + captureHeaderSamples + maxCaptureSamples, frameSamples);
 #endif
-        filterer.filterAudio(buf, AUDIO_FRAME_SAMPLE_COUNT * AUDIO_CHANNELS);
+
+    ++framesCaptured;
+    if (capturedFrames->push(buf))
+    {
+        capturedFrameCount.release();
     }
-#endif
+    else
+    {
+        ++framesDropped;
+        qDebug() << "Audio sender is behind, dropping a captured frame";
+    }
+}
 
-    for (quint32 i = 0; i < AUDIO_FRAME_SAMPLE_COUNT * AUDIO_CHANNELS; ++i)
+void Audio::sendFrames()
+{
+    int16_t frame[maxCaptureSamples];
+    QElapsedTimer processing;
+
+    if (Settings::getInstance().getRealtimeThreads())
+        Platform::setThreadRealtime(Platform::ThreadClass::Audio);
+
+    while (sending)
     {
-        // gain amplification with clipping to 16-bit boundaries
-        int ampPCM = qBound<int>(std::numeric_limits<int16_t>::min(),
-                                 qRound(buf[i] * d->inputGainFactor()),
-                                 std::numeric_limits<int16_t>::max());
+        if (!capturedFrameCount.tryAcquire(1, AUDIO_MAX_FRAME_DURATION * 2))
+            continue;
+
+        const int16_t* slot = capturedFrames->pop();
+        if (!slot)
+            continue;
+
+        if (captureRestarted.exchange(false))
+        {
+            voiceDetector.reset();
+            haveSilentFrame = false;
+        }
+
+        processing.start();
+        const int frameSamples = slot[0];
+        const int captureSamples = frameSamples * AUDIO_CHANNELS;
+        qint64 captureTime;
+        memcpy(&captureTime, slot + 1, sizeof(captureTime));
+        memcpy(frame, slot + captureHeaderSamples, captureSamples * sizeof(int16_t));
 
-        buf[i] = static_cast<int16_t>(ampPCM);
+#ifdef QTOX_FILTER_AUDIO
+        if (Settings::getInstance().getFilterAudio())
+            cancelEcho(frame, slot + captureHeaderSamples + maxCaptureSamples, frameSamples);
+#endif
+
+        qreal gain;
+        {
+            QMutexLocker locker(&audioLock);
+            gain = d->inputGainFactor();
+        }
+
+        int peak;
+        uint64_t sumSquares;
+        SampleKernels::applyGain(frame, captureSamples, gain, peak, sumSquares);
+
+        quint32 rms = qMin(0xffffu, static_cast<quint32>(std::sqrt(double(sumSquares) / captureSamples) * 2));
+        capturedLevels = (qMin(0xffffu, static_cast<quint32>(peak) * 2) << 16) | rms;
+
+        // the levels are still metered on silence, we just don't send it
+        const int duration = frameSamples * 1000 / static_cast<int>(AUDIO_SAMPLE_RATE);
+        const bool voice = voiceDetector.isVoice(frame, captureSamples, sumSquares, duration);
+
+        // what the consumers of frameAvailable take to encode isn't ours
+        const qint64 elapsed = processing.nsecsElapsed();
+        processingTime += static_cast<quint64>(elapsed);
+        const quint32 elapsedUs = static_cast<quint32>(elapsed / 1000);
+        if (elapsedUs > maxProcessingTime)
+            maxProcessingTime = elapsedUs;
+
+        if (!voice)
+        {
+            ++framesSilent;
+            memcpy(silentFrame, frame, captureSamples * sizeof(int16_t));
+            silentFrameSamples = frameSamples;
+            silentFrameTime = captureTime;
+            haveSilentFrame = true;
+            continue;
+        }
+
+        // the frame before speech often has its soft start
+        if (haveSilentFrame)
+        {
+            emit frameAvailable(silentFrame, silentFrameSamples, AUDIO_CHANNELS, AUDIO_SAMPLE_RATE, silentFrameTime);
+            haveSilentFrame = false;
+            --framesSilent;
+            ++framesSent;
+        }
+        emit frameAvailable(frame, frameSamples, AUDIO_CHANNELS, AUDIO_SAMPLE_RATE, captureTime);
+        ++framesSent;
+    }
+}
+
+#ifdef QTOX_FILTER_AUDIO
+void Audio::cancelEcho(int16_t* frame, const int16_t* reference, int samples)
+{
+    // filter_audio works on mono, our input is the same on every channel anyway
+    int16_t mono[AUDIO_MAX_FRAME_SAMPLE_COUNT];
+    for (int i = 0; i < samples; ++i)
+    {
+        int sum = 0;
+        for (quint32 c = 0; c < AUDIO_CHANNELS; ++c)
+            sum += frame[i * AUDIO_CHANNELS + c];
+        mono[i] = static_cast<int16_t>(sum / static_cast<int>(AUDIO_CHANNELS));
     }
 
-    emit frameAvailable(buf, AUDIO_FRAME_SAMPLE_COUNT, AUDIO_CHANNELS, AUDIO_SAMPLE_RATE);
+    filterer.passAudioOutput(reference, samples);
+    filterer.setEchoDelayMs(static_cast<int16_t>(echoDelay.load()));
+    filterer.filterAudio(mono, samples);
+
+    for (int i = 0; i < samples; ++i)
+        for (quint32 c = 0; c < AUDIO_CHANNELS; ++c)
+            frame[i * AUDIO_CHANNELS + c] = mono[i];
 }
+#endif
 
 /**
 Returns true if the input device is open and suscribed to
@@ -658,6 +1142,13 @@ void Audio::subscribeOutput(ALuint& sid)
     assert(sid);
     outSources << sid;
 
+    OutputBuffers buffers;
+    buffers.all.resize(outBufferCount);
+    alGenBuffers(outBufferCount, buffers.all.data());
+    checkAlError();
+    buffers.free = buffers.all;
+    outBuffers[sid] = buffers;
+
     qDebug() << "Audio source" << sid << "created. Sources active:"
              << outSources.size();
 }
@@ -672,11 +1163,22 @@ void Audio::unsubscribeOutput(ALuint &sid)
     {
         if (alIsSource(sid))
         {
+            alSourceStop(sid);
+            alSourcei(sid, AL_BUFFER, AL_NONE);
             alDeleteSources(1, &sid);
+
+#ifdef QTOX_FILTER_AUDIO
+            echoReference.removeSource(sid);
+#endif
+            const OutputBuffers buffers = outBuffers.take(sid);
+            if (!buffers.all.isEmpty())
+                alDeleteBuffers(buffers.all.size(), buffers.all.data());
+
             qDebug() << "Audio source" << sid << "deleted. Sources active:"
                      << outSources.size();
         } else {
             qWarning() << "Trying to delete invalid audio source" << sid;
+            outBuffers.remove(sid);
         }
 
         sid = 0;
@@ -689,27 +1191,22 @@ void Audio::unsubscribeOutput(ALuint &sid)
 void Audio::startLoop()
 {
     QMutexLocker locker(&audioLock);
-    alSourcei(alMainSource, AL_LOOPING, AL_TRUE);
+    loopNextSound = true;
 }
 
 void Audio::stopLoop()
 {
     QMutexLocker locker(&audioLock);
-    alSourcei(alMainSource, AL_LOOPING, AL_FALSE);
-    alSourceStop(alMainSource);
-}
+    loopNextSound = false;
 
-#if defined(QTOX_FILTER_AUDIO) && defined(ALC_LOOPBACK_CAPTURE_SAMPLES)
-void Audio::getEchoesToFilter(AudioFilterer* filterer, int samples)
-{
-    ALint samples;
-    alcGetIntegerv(&alOutDev, ALC_LOOPBACK_CAPTURE_SAMPLES, sizeof(samples), &samples);
-    if (samples >= samples)
+    for (ALuint source : alMainSources)
     {
-        int16_t buf[samples];
-        alcCaptureSamplesLoopback(&alOutDev, buf, samples);
-        filterer->passAudioOutput(buf, samples);
-        filterer->setEchoDelayMs(5); // This 5ms is configurable I believe
+        ALint looping;
+        alGetSourcei(source, AL_LOOPING, &looping);
+        if (looping)
+        {
+            alSourcei(source, AL_LOOPING, AL_FALSE);
+            alSourceStop(source);
+        }
     }
 }
-#endif
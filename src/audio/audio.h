@@ -23,10 +23,14 @@
 
 #include <atomic>
 #include <cmath>
+#include <memory>
 
+#include <QHash>
 #include <QObject>
 #include <QMutex>
+#include <QSemaphore>
 #include <QTimer>
+#include <QVector>
 
 #if defined(__APPLE__) && defined(__MACH__)
  #include <OpenAL/al.h>
@@ -44,12 +48,20 @@
 
 #ifdef QTOX_FILTER_AUDIO
 #include "audiofilterer.h"
+#include "echoreference.h"
 #endif
 
+#include "voicedetector.h"
+
+class AudioResampler;
+class AudioRingBuffer;
+
 // Public default audio settings
 static constexpr uint32_t AUDIO_SAMPLE_RATE = 48000; ///< The next best Opus would take is 24k
-static constexpr uint32_t AUDIO_FRAME_DURATION = 20; ///< In milliseconds
+static constexpr uint32_t AUDIO_FRAME_DURATION = 20; ///< In milliseconds, the default for what we capture
 static constexpr ALint AUDIO_FRAME_SAMPLE_COUNT = AUDIO_FRAME_DURATION * AUDIO_SAMPLE_RATE/1000;
+static constexpr uint32_t AUDIO_MAX_FRAME_DURATION = 60; ///< The longest frame Opus takes, in milliseconds
+static constexpr ALint AUDIO_MAX_FRAME_SAMPLE_COUNT = AUDIO_MAX_FRAME_DURATION * AUDIO_SAMPLE_RATE/1000;
 static constexpr uint32_t AUDIO_CHANNELS = 2; ///< Ideally, we'd auto-detect, but that's a sane default
 
 class Audio : public QObject
@@ -58,6 +70,18 @@ class Audio : public QObject
 
     class Private;
 
+public:
+    /// Counters of the capture pipeline since the input was opened
+    struct CaptureStats
+    {
+        quint64 captured = 0;
+        quint64 dropped = 0;    ///< The sendThread was too late to take them
+        quint64 sent = 0;
+        quint64 silent = 0;     ///< Not sent, the voice detector found nothing
+        quint32 meanProcessing = 0; ///< In µs, echo cancelling, gain, levels and voice detection of a frame
+        quint32 maxProcessing = 0;
+    };
+
 public:
     static Audio& getInstance();
 
@@ -70,6 +94,18 @@ public:
     void setMaxInputGain(qreal dB);
     qreal inputGain() const;
     void setInputGain(qreal dB);
+    /// Peak and RMS of the last captured frame after gain, from 0 to 1
+    void inputLevels(qreal& peak, qreal& rms) const;
+
+    /// Duration of the frames we capture and send, in milliseconds
+    int frameDuration() const;
+    int frameSampleCount() const;
+    /// Shorter frames lower the latency but cost more CPU and bandwidth, returns false if Opus can't take it
+    bool setFrameDuration(int ms);
+    static bool isValidFrameDuration(int ms);
+    static QVector<int> validFrameDurations();
+
+    CaptureStats getCaptureStats() const;
 
     void reinitInput(const QString& inDevDesc);
     bool reinitOutput(const QString& outDevDesc);
@@ -81,22 +117,36 @@ public:
     static const char* inDeviceNames();
     void subscribeOutput(ALuint& sid);
     void unsubscribeOutput(ALuint& sid);
+    /// Opens the input device in the background if needed, frames come once it's open
     void subscribeInput();
+    /// The last unsubscribe keeps the device open but idle for the keep warm time of the settings
     void unsubscribeInput();
 
+    /// Makes the next sound played loop, until stopLoop
     void startLoop();
     void stopLoop();
-    void playMono16Sound(const QByteArray& data);
+    /// Plays a 44100Hz mono 16bit PCM sound file, each file is only read and uploaded once per output device
     void playMono16Sound(const QString& path);
 
     void playAudioBuffer(ALuint alSource, const int16_t *data, int samples,
                          unsigned channels, int sampleRate);
+    int queuedBuffers(ALuint alSource) const;
+    quint32 underruns(ALuint alSource) const;
 
 signals:
-    void groupAudioPlayed(int group, int peer, unsigned short volume);
     /// When there are input subscribers, we regularly emit captured audio frames with this signal
+    /// It's emitted from the audio sending thread, never with the audio lock held
+    /// Silence isn't emitted, there's no point encoding and sending it
     /// Always connect with a blocking queued connection or a lambda, or the behavior is undefined
-    void frameAvailable(const int16_t *pcm, size_t sample_count, uint8_t channels, uint32_t sampling_rate);
+    /// captureTime is when the first sample was recorded, in µs of the CaptureClock
+    void frameAvailable(const int16_t *pcm, size_t sample_count, uint8_t channels, uint32_t sampling_rate,
+                        qint64 captureTime);
+
+private slots:
+    /// Opens the input device without holding the audioLock, some take hundreds of milliseconds
+    void openInput();
+    /// Closes the input if nobody subscribed again while it was kept warm
+    void releaseInput();
 
 private:
     Audio();
@@ -105,20 +155,40 @@ private:
     static void checkAlError() noexcept;
     static void checkAlcError(ALCdevice *device) noexcept;
 
-    bool autoInitInput();
     bool autoInitOutput();
     bool initInput(QString inDevDescr);
     bool initOutput(QString outDevDescr);
+    static ALCdevice* openInputDevice(QString inDevDescr);
+    /// Sets up the freshly opened alInDev, capturing if there are subscribers or keeping it warm otherwise
+    void setupInput();
+    void startCapture();
+    /// Stops capturing and starts the countdown to closing the input
+    void idleInput();
     void cleanupInput();
     void cleanupOutput();
-    /// Called after a mono16 sound stopped playing
-    void playMono16SoundCleanup();
+    void applyFrameDuration(int ms);
+    ALuint soundBuffer(const QString& path);
+    ALuint nextMainSource();
     /// Called on the captureTimer events to capture audio
     void doCapture();
-#if defined(QTOX_FILTER_AUDIO) && defined(ALC_LOOPBACK_CAPTURE_SAMPLES)
-    void getEchoesToFilter(AudioFilterer* filter, int samples);
+    /// Runs in the sendThread, filters the captured frames, applies the gain and emits them
+    void sendFrames();
+#ifdef QTOX_FILTER_AUDIO
+    /// Removes the echo of what we played, reference is the mono mix played while frame was captured
+    void cancelEcho(int16_t* frame, const int16_t* reference, int samples);
 #endif
 
+private:
+    /// The fixed set of AL buffers an output source plays from
+    struct OutputBuffers
+    {
+        QVector<ALuint> all;
+        QVector<ALuint> free;   ///< Not queued on the source
+        quint32 underruns = 0;  ///< Times the source ran dry while we were playing on it
+        std::shared_ptr<AudioResampler> resampler; ///< Only while the source gets another rate than ours
+        QVector<int16_t> resampled;
+    };
+
 private:
     Private* d;
 
@@ -128,17 +198,39 @@ private:
 
     ALCdevice*          alInDev;
     quint32             inSubscriptions;
-    QTimer              captureTimer, playMono16Timer;
+    QTimer              captureTimer; ///< Only runs while we capture for subscribers
+    QTimer              inputReleaseTimer;
+    bool                inputOpening; ///< openInput is queued or running
+    AudioRingBuffer*    capturedFrames; ///< From doCapture to sendFrames, so the DSP and slow consumers don't hold the audioLock
+    QSemaphore          capturedFrameCount;
+    QThread*            sendThread;
+    std::atomic_bool    sending;
+    std::atomic<quint32> capturedLevels; ///< Peak in the high 16 bits, RMS in the low ones
+    VoiceDetector       voiceDetector; ///< Only used by the sendThread, like the silentFrame
+    int16_t             silentFrame[AUDIO_MAX_FRAME_SAMPLE_COUNT * AUDIO_CHANNELS]; ///< Not sent, unless speech starts right after it
+    int                 silentFrameSamples;
+    qint64              silentFrameTime; ///< Capture time of the silentFrame
+    bool                haveSilentFrame;
+    std::atomic_bool    captureRestarted; ///< Tells the sendThread to forget about the previous input
+    std::atomic_int     captureFrameDuration; ///< In ms, each captured frame carries its own sample count
+    std::atomic<quint64> framesCaptured, framesDropped, framesSent, framesSilent;
+    std::atomic<quint64> processingTime; ///< In ns, for every frame the sendThread processed
+    std::atomic<quint32> maxProcessingTime; ///< In µs
 
     ALCdevice*          alOutDev;
     ALCcontext*         alOutContext;
-    ALuint              alMainSource;
-    ALuint              alMainBuffer;
+    QVector<ALuint>     alMainSources; ///< Play the notification sounds, so they can overlap
+    int                 nextMainSourceIndex;
+    bool                loopNextSound;
+    QHash<QString, ALuint> soundBuffers; ///< The sounds already uploaded to the output device, by path
     bool                outputInitialized;
 
     QList<ALuint>       outSources;
+    QHash<ALuint, OutputBuffers> outBuffers;
 #ifdef QTOX_FILTER_AUDIO
-    AudioFilterer filterer;
+    AudioFilterer filterer; ///< Only used by the sendThread
+    EchoReference echoReference;
+    std::atomic_int echoDelay; ///< In ms, how long what we queue to play takes to come out
 #endif
 };
 
@@ -0,0 +1,213 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "audiojitterbuffer.h"
+
+#include <cstring>
+#include <QtMath>
+
+namespace
+{
+const int minDepth = 1;
+/// 200ms at the usual frame duration, more than that and the call feels laggy
+const int maxDepth = 10;
+/// We drop frames from the head beyond that, whatever the target
+const int depthLimit = 2 * maxDepth;
+/// Only used until we know the duration of the peer's frames
+const int defaultFrameDuration = 20;
+/// We don't lower the target again before that long (ms), jitter comes in bursts
+const qint64 targetDecreaseDelay = 2000;
+/// After that many made up frames in a row, we fall silent and buffer up again
+const int maxConcealedFrames = 5;
+/// Frames are made 1/stretchRatio shorter or longer to correct the depth
+const int stretchRatio = 50;
+}
+
+AudioJitterBuffer::AudioJitterBuffer()
+    : lastArrival{-1}
+    , lastTargetDecrease{0}
+    , jitter{0}
+    , smoothedDepth{0}
+    , targetDepth{minDepth}
+    , concealedInARow{0}
+    , playing{false}
+{
+    clock.start();
+}
+
+void AudioJitterBuffer::push(const int16_t* pcm, size_t sampleCount, uint8_t channels, uint32_t samplingRate)
+{
+    Frame frame;
+    frame.pcm.resize(sampleCount * channels);
+    memcpy(frame.pcm.data(), pcm, sampleCount * channels * sizeof(int16_t));
+    frame.sampleCount = sampleCount;
+    frame.channels = channels;
+    frame.samplingRate = samplingRate;
+
+    QMutexLocker locker{&lock};
+
+    // running estimate of the interarrival jitter, as RTP does it
+    qint64 now = clock.elapsed();
+    if (lastArrival >= 0)
+    {
+        double deviation = qAbs(now - lastArrival - frameDuration(frame));
+        jitter += (deviation - jitter) / 16.0;
+    }
+    lastArrival = now;
+
+    frames.enqueue(frame);
+    updateTarget(now);
+
+    while (frames.size() > depthLimit)
+    {
+        frames.dequeue();
+        ++stats.dropped;
+    }
+}
+
+bool AudioJitterBuffer::pop(Frame& frame)
+{
+    QMutexLocker locker{&lock};
+
+    if (!playing)
+    {
+        if (frames.size() < targetDepth)
+            return false;
+
+        playing = true;
+        smoothedDepth = frames.size();
+    }
+
+    if (frames.isEmpty())
+    {
+        if (lastFrame.pcm.isEmpty() || concealedInARow >= maxConcealedFrames)
+        {
+            // The sender doesn't send its silence, so the gap until the next talk spurt isn't jitter
+            playing = false;
+            concealedInARow = 0;
+            lastFrame = Frame();
+            lastArrival = -1;
+            return false;
+        }
+
+        // repeat the last frame, fading out so a long gap doesn't buzz
+        for (int16_t& sample : lastFrame.pcm)
+            sample /= 2;
+
+        ++concealedInARow;
+        ++stats.concealed;
+        frame = lastFrame;
+        return true;
+    }
+
+    concealedInARow = 0;
+    smoothedDepth += (frames.size() - smoothedDepth) / 32.0;
+    frame = frames.dequeue();
+
+    // the sender's clock runs faster or slower than our output device, catch up slowly
+    int delta = static_cast<int>(frame.sampleCount) / stretchRatio;
+    if (smoothedDepth > targetDepth + 1)
+    {
+        resample(frame, -delta);
+        ++stats.stretched;
+    }
+    else if (smoothedDepth < targetDepth - 1)
+    {
+        resample(frame, delta);
+        ++stats.stretched;
+    }
+
+    lastFrame = frame;
+    return true;
+}
+
+AudioJitterBuffer::Stats AudioJitterBuffer::getStats() const
+{
+    QMutexLocker locker{&lock};
+
+    Stats current = stats;
+    current.depth = frames.size();
+    current.targetDepth = targetDepth;
+    current.jitter = qRound(jitter);
+    for (const Frame& frame : frames)
+        current.latency += frameDuration(frame);
+
+    return current;
+}
+
+/**
+@brief Follows the jitter up right away, but only goes down slowly.
+*/
+void AudioJitterBuffer::updateTarget(qint64 now)
+{
+    int duration = frames.isEmpty() ? defaultFrameDuration : frameDuration(frames.last());
+    int wanted = qBound(minDepth, 1 + qCeil(2 * jitter / duration), maxDepth);
+
+    if (wanted > targetDepth)
+    {
+        targetDepth = wanted;
+        lastTargetDecrease = now;
+    }
+    else if (wanted < targetDepth && now - lastTargetDecrease > targetDecreaseDelay)
+    {
+        --targetDepth;
+        lastTargetDecrease = now;
+    }
+}
+
+/**
+@brief Linearly resamples a frame to delta more samples per channel.
+*/
+void AudioJitterBuffer::resample(Frame& frame, int delta) const
+{
+    const size_t oldCount = frame.sampleCount;
+    const size_t newCount = oldCount + delta;
+    if (!delta || oldCount < 2 || newCount < 2)
+        return;
+
+    const uint8_t channels = frame.channels;
+    const QVector<int16_t> in = frame.pcm;
+    frame.pcm.resize(newCount * channels);
+    int16_t* out = frame.pcm.data();
+
+    for (size_t i = 0; i < newCount; ++i)
+    {
+        double pos = static_cast<double>(i) * (oldCount - 1) / (newCount - 1);
+        size_t j = static_cast<size_t>(pos);
+        size_t k = qMin(j + 1, oldCount - 1);
+        double frac = pos - j;
+
+        for (uint8_t c = 0; c < channels; ++c)
+            out[i * channels + c] = static_cast<int16_t>(qRound(in[j * channels + c] * (1 - frac)
+                                                                + in[k * channels + c] * frac));
+    }
+
+    frame.sampleCount = newCount;
+}
+
+/**
+@brief Duration of a frame in milliseconds.
+*/
+int AudioJitterBuffer::frameDuration(const Frame& frame) const
+{
+    if (!frame.samplingRate)
+        return defaultFrameDuration;
+
+    return qMax(1, static_cast<int>(frame.sampleCount * 1000 / frame.samplingRate));
+}
@@ -0,0 +1,87 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef AUDIOJITTERBUFFER_H
+#define AUDIOJITTERBUFFER_H
+
+#include <cstdint>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QQueue>
+#include <QVector>
+
+/**
+@brief Smooths out the irregular arrival of a call's decoded audio frames before they're played.
+
+Frames are pushed as toxav decodes them and pulled at the pace the output device plays them.
+The target depth follows the measured arrival jitter, missing frames are concealed by fading
+out the last one, and a depth that drifts away from the target is corrected by slightly
+shortening or stretching frames.
+*/
+class AudioJitterBuffer
+{
+public:
+    struct Stats
+    {
+        int depth = 0;           ///< Frames waiting to be played
+        int targetDepth = 0;     ///< Frames we try to keep buffered
+        int latency = 0;         ///< In milliseconds, of the frames waiting to be played
+        int jitter = 0;          ///< In milliseconds, smoothed deviation of the arrival times
+        quint32 concealed = 0;   ///< Frames made up because none had arrived in time
+        quint32 dropped = 0;     ///< Frames thrown away because we were too far behind
+        quint32 stretched = 0;   ///< Frames played shorter or longer to correct the drift
+    };
+
+    struct Frame
+    {
+        QVector<int16_t> pcm;
+        size_t sampleCount = 0; ///< Per channel
+        uint8_t channels = 0;
+        uint32_t samplingRate = 0;
+    };
+
+public:
+    AudioJitterBuffer();
+
+    void push(const int16_t* pcm, size_t sampleCount, uint8_t channels, uint32_t samplingRate);
+    /// Returns false if there's nothing to play yet, otherwise the next frame, real or concealed
+    bool pop(Frame& frame);
+    Stats getStats() const;
+
+private:
+    void updateTarget(qint64 now);
+    void resample(Frame& frame, int delta) const;
+    int frameDuration(const Frame& frame) const;
+
+private:
+    mutable QMutex lock;
+    QQueue<Frame> frames;
+    Frame lastFrame;
+    QElapsedTimer clock;
+    qint64 lastArrival; ///< -1 until the first frame of a talk spurt
+    qint64 lastTargetDecrease;
+    double jitter; ///< In milliseconds
+    double smoothedDepth;
+    int targetDepth;
+    int concealedInARow;
+    bool playing; ///< False while we fill up to the target depth before playing
+    Stats stats;
+};
+
+#endif // AUDIOJITTERBUFFER_H
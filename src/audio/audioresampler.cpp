@@ -0,0 +1,204 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "audioresampler.h"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <QtGlobal>
+#include <QtMath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define AUDIORESAMPLER_SSE
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define AUDIORESAMPLER_NEON
+#include <arm_neon.h>
+#endif
+
+namespace
+{
+/// Taps on each side of the center when not downsampling, good enough for speech and music
+const int baseHalfLength = 16;
+/// Above that, we round to the nearest of that many phases
+const int maxPhases = 1024;
+/// Keeps the transition band below the new Nyquist frequency
+const double cutoffMargin = 0.92;
+
+int gcd(int a, int b)
+{
+    while (b)
+    {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/// Blackman window over [-1, 1]
+double window(double x)
+{
+    if (x <= -1 || x >= 1)
+        return 0;
+
+    return 0.42 + 0.5 * std::cos(M_PI * x) + 0.08 * std::cos(2 * M_PI * x);
+}
+
+double sinc(double x)
+{
+    return std::fabs(x) < 1e-9 ? 1 : std::sin(M_PI * x) / (M_PI * x);
+}
+}
+
+AudioResampler::AudioResampler(int channels, int inRate, int outRate)
+    : channels{channels}
+    , inRate{inRate}
+    , outRate{outRate}
+    , phase{0}
+{
+    int divisor = gcd(inRate, outRate);
+    up = outRate / divisor;
+    down = inRate / divisor;
+    phases = qMin(up, maxPhases);
+
+    // when downsampling the filter gets wider, to cut at the lower frequency sharply enough
+    double ratio = qMin(1.0, static_cast<double>(outRate) / inRate);
+    double cutoff = ratio * cutoffMargin;
+    halfLength = qMin(4 * baseHalfLength, static_cast<int>(std::ceil(baseHalfLength / ratio)));
+    halfLength += halfLength % 2; // keeps tapCount a multiple of 4 for the vector loop
+    tapCount = 2 * halfLength;
+
+    filters.resize(phases * tapCount);
+    for (int p = 0; p < phases; ++p)
+    {
+        double offset = static_cast<double>(p) / phases;
+        float* row = filters.data() + p * tapCount;
+        for (int k = 0; k < tapCount; ++k)
+        {
+            double x = k - (halfLength - 1) - offset;
+            row[k] = static_cast<float>(cutoff * sinc(cutoff * x) * window(x / halfLength));
+        }
+    }
+
+    // start centered on silence, that's halfLength samples of delay
+    history.resize(channels);
+    for (QVector<float>& samples : history)
+        samples.fill(0.f, tapCount - 1);
+}
+
+int AudioResampler::getChannels() const
+{
+    return channels;
+}
+
+int AudioResampler::getInRate() const
+{
+    return inRate;
+}
+
+int AudioResampler::getOutRate() const
+{
+    return outRate;
+}
+
+int AudioResampler::process(const int16_t* in, int inFrames, QVector<int16_t>& out)
+{
+    if (inRate == outRate)
+    {
+        out.resize(inFrames * channels);
+        memcpy(out.data(), in, inFrames * channels * sizeof(int16_t));
+        return inFrames;
+    }
+
+    // the center of the next output is always at halfLength - 1 in the history
+    const int center = halfLength - 1;
+    const int available = history[0].size() + inFrames;
+    const int maxFrames = static_cast<int>((static_cast<qint64>(available) * up) / down) + 2;
+    out.resize(maxFrames * channels);
+
+    int written = 0;
+    int consumed = 0;
+    for (int c = 0; c < channels; ++c)
+    {
+        QVector<float>& samples = history[c];
+        const int kept = samples.size();
+        samples.resize(kept + inFrames);
+        float* data = samples.data();
+        for (int i = 0; i < inFrames; ++i)
+            data[kept + i] = in[i * channels + c];
+
+        int position = center;
+        int frac = phase;
+        int frames = 0;
+        while (position + halfLength < samples.size() && frames < maxFrames)
+        {
+            int row = (phases == up) ? frac : static_cast<int>(static_cast<qint64>(frac) * phases / up);
+            float value = dot(data + position - center, filters.constData() + row * tapCount);
+            out[frames * channels + c] = static_cast<int16_t>(qBound<float>(std::numeric_limits<int16_t>::min(),
+                                                           std::round(value),
+                                                           std::numeric_limits<int16_t>::max()));
+            ++frames;
+
+            frac += down;
+            position += frac / up;
+            frac %= up;
+        }
+
+        // every channel advances the same, the last one tells where we stopped
+        written = frames;
+        consumed = position - center;
+        if (c == channels - 1)
+            phase = frac;
+    }
+
+    for (QVector<float>& samples : history)
+        samples.remove(0, consumed);
+
+    out.resize(written * channels);
+    return written;
+}
+
+float AudioResampler::dot(const float* samples, const float* taps) const
+{
+    int k = 0;
+    float sum = 0.f;
+#if defined(AUDIORESAMPLER_SSE)
+    __m128 acc = _mm_setzero_ps();
+    for (; k + 4 <= tapCount; k += 4)
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(samples + k), _mm_loadu_ps(taps + k)));
+
+    alignas(16) float lanes[4];
+    _mm_store_ps(lanes, acc);
+    sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#elif defined(AUDIORESAMPLER_NEON)
+    float32x4_t acc = vdupq_n_f32(0.f);
+    for (; k + 4 <= tapCount; k += 4)
+        acc = vmlaq_f32(acc, vld1q_f32(samples + k), vld1q_f32(taps + k));
+
+    float lanes[4];
+    vst1q_f32(lanes, acc);
+    sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+    for (; k < tapCount; ++k)
+        sum += samples[k] * taps[k];
+
+    return sum;
+}
@@ -0,0 +1,60 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef AUDIORESAMPLER_H
+#define AUDIORESAMPLER_H
+
+#include <cstdint>
+#include <QVector>
+
+/**
+@brief Windowed-sinc resampler for interleaved int16 audio.
+
+Keeps the end of each frame so consecutive frames are resampled as one stream,
+use one resampler per stream. Converting between the same rates is a plain copy.
+*/
+class AudioResampler
+{
+public:
+    AudioResampler(int channels, int inRate, int outRate);
+
+    int getChannels() const;
+    int getInRate() const;
+    int getOutRate() const;
+
+    /// Resamples inFrames frames of interleaved samples, replacing the content of out.
+    /// Returns how many frames were written, a few are held back for the next call.
+    int process(const int16_t* in, int inFrames, QVector<int16_t>& out);
+
+private:
+    float dot(const float* samples, const float* taps) const;
+
+private:
+    int channels;
+    int inRate, outRate;
+    int up, down; ///< outRate/inRate as a reduced fraction
+    int phases; ///< Rows of the filter table, up unless that would be too big
+    int tapCount;
+    int halfLength;
+    QVector<float> filters; ///< One row of tapCount taps per phase
+    QVector<QVector<float>> history; ///< Per channel, the input still needed by the next outputs
+    int phase; ///< Position between two input samples, from 0 to up
+};
+
+#endif // AUDIORESAMPLER_H
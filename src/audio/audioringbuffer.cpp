@@ -0,0 +1,67 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "audioringbuffer.h"
+
+#include <cstring>
+
+AudioRingBuffer::AudioRingBuffer(int frameCount, size_t frameSamples)
+    : samples{new int16_t[(frameCount + 1) * frameSamples]}
+    , frameSamples{frameSamples}
+    , slots{frameCount + 1}
+{
+}
+
+bool AudioRingBuffer::push(const int16_t* frame)
+{
+    int h = head.load(std::memory_order_relaxed);
+    int next = (h + 1) % slots;
+    // the slot being read still counts as taken until the next pop
+    if (next == tail.load(std::memory_order_acquire))
+        return false;
+
+    memcpy(samples.get() + h * frameSamples, frame, frameSamples * sizeof(int16_t));
+    head.store(next, std::memory_order_release);
+    return true;
+}
+
+const int16_t* AudioRingBuffer::pop()
+{
+    int t = tail.load(std::memory_order_relaxed);
+    if (reading != -1)
+    {
+        // we're done with the previous frame, give its slot back
+        t = (t + 1) % slots;
+        tail.store(t, std::memory_order_release);
+        reading = -1;
+    }
+
+    if (t == head.load(std::memory_order_acquire))
+        return nullptr;
+
+    reading = t;
+    return samples.get() + t * frameSamples;
+}
+
+void AudioRingBuffer::clear()
+{
+    while (pop())
+    {
+    }
+}
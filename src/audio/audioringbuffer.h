@@ -0,0 +1,54 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef AUDIORINGBUFFER_H
+#define AUDIORINGBUFFER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+/**
+@brief Fixed-size audio frames passed from one producer thread to one consumer thread, without locks.
+
+When the consumer falls behind, new frames are dropped rather than overwriting the ones it's reading.
+*/
+class AudioRingBuffer
+{
+public:
+    AudioRingBuffer(int frameCount, size_t frameSamples);
+
+    /// Producer side, returns false if the buffer is full and the frame was dropped
+    bool push(const int16_t* frame);
+    /// Consumer side, returns nullptr if the buffer is empty. The frame stays valid until pop() is called again
+    const int16_t* pop();
+    /// Consumer side, drops every queued frame
+    void clear();
+
+private:
+    std::unique_ptr<int16_t[]> samples;
+    const size_t frameSamples;
+    const int slots; ///< One more than the capacity, so full and empty differ
+    std::atomic_int head{0}; ///< Next slot to write, only written by the producer
+    std::atomic_int tail{0}; ///< Next slot to read, only written by the consumer
+    int reading = -1; ///< The slot the consumer was given last, released on the next pop
+};
+
+#endif // AUDIORINGBUFFER_H
@@ -0,0 +1,74 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "echoreference.h"
+#include "audio.h"
+
+#include <limits>
+
+namespace
+{
+/// One second, a source that's further ahead is queueing way more than we play
+const int capacity = AUDIO_SAMPLE_RATE;
+}
+
+EchoReference::EchoReference()
+    : mix(capacity, 0)
+    , readPos{0}
+{
+}
+
+void EchoReference::add(unsigned source, const int16_t* pcm, int samples, int channels)
+{
+    // a source that was starved starts again from what's being captured now
+    qint64 pos = qMax(writePos.value(source, readPos), readPos);
+    if (pos + samples > readPos + capacity)
+        return;
+
+    int32_t* data = mix.data();
+    for (int i = 0; i < samples; ++i)
+    {
+        int32_t sample = pcm[i * channels];
+        if (channels == 2)
+            sample = (sample + pcm[i * channels + 1]) / 2;
+
+        data[(pos + i) % capacity] += sample;
+    }
+
+    writePos[source] = pos + samples;
+}
+
+void EchoReference::take(int16_t* out, int samples)
+{
+    int32_t* data = mix.data();
+    for (int i = 0; i < samples; ++i)
+    {
+        int32_t& sample = data[(readPos + i) % capacity];
+        out[i] = static_cast<int16_t>(qBound<int32_t>(std::numeric_limits<int16_t>::min(), sample,
+                                                      std::numeric_limits<int16_t>::max()));
+        sample = 0;
+    }
+
+    readPos += samples;
+}
+
+void EchoReference::removeSource(unsigned source)
+{
+    writePos.remove(source);
+}
@@ -0,0 +1,50 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ECHOREFERENCE_H
+#define ECHOREFERENCE_H
+
+#include <cstdint>
+#include <QHash>
+#include <QVector>
+
+/**
+@brief Mixes everything we play into one mono stream, for the echo canceller to know what to remove.
+
+Each output source writes where it left off, so frames of one source follow each other and
+frames of different sources add up. The capture side takes the mix one frame at a time.
+Not thread-safe, Audio only uses it with its lock held.
+*/
+class EchoReference
+{
+public:
+    EchoReference();
+
+    /// samples frames of interleaved audio at AUDIO_SAMPLE_RATE
+    void add(unsigned source, const int16_t* pcm, int samples, int channels);
+    void take(int16_t* out, int samples);
+    void removeSource(unsigned source);
+
+private:
+    QVector<int32_t> mix;
+    qint64 readPos;
+    QHash<unsigned, qint64> writePos;
+};
+
+#endif // ECHOREFERENCE_H
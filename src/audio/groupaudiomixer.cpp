@@ -0,0 +1,274 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "groupaudiomixer.h"
+#include "audioresampler.h"
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <QThread>
+
+namespace
+{
+const int outputChannels = 2;
+const int frameSamples = AUDIO_FRAME_SAMPLE_COUNT * outputChannels;
+/// Frames we keep queued on the output device
+const int outputLeadFrames = 3;
+/// A peer further behind than this loses its oldest samples, so latency can't creep
+const int maxPeerBacklog = 6 * frameSamples;
+/// The group chat highlights a speaking peer for 500ms, telling it twice as often is enough
+const qint64 activityReportInterval = 250;
+/// Peers that didn't send anything for that long (ms) are forgotten
+const qint64 peerTimeout = 5000;
+/// How much of a peer's energy is kept each frame, about 200ms of memory with 20ms frames
+const float energyDecay = 0.9f;
+/// Mean square below which a peer isn't speaking, about -40dBFS
+const float speakingEnergy = 1e-4f;
+/// A peer must be that much louder than the active speaker to take over, about 3dB
+const float speakerSwitchRatio = 2.f;
+/// The active speaker is kept at least that long (ms)
+const qint64 minSpeakerTime = 500;
+
+class MixerThread : public QThread
+{
+public:
+    explicit MixerThread(std::function<void()> mix)
+        : mix{mix}
+    {
+    }
+
+protected:
+    virtual void run() final override
+    {
+        mix();
+    }
+
+private:
+    std::function<void()> mix;
+};
+
+}
+
+GroupAudioMixer::GroupAudioMixer(ALuint source, std::function<void(int)> speakerChanged)
+    : mixerThread{new MixerThread{std::bind(&GroupAudioMixer::run, this)}}
+    , running{true}
+    , sourceInvalid{false}
+    , source{source}
+    , mixBuffer(frameSamples)
+    , speakerChanged{speakerChanged}
+{
+    clock.start();
+    mixerThread->setObjectName("qTox Group Audio Mixer");
+    mixerThread->start();
+}
+
+GroupAudioMixer::~GroupAudioMixer()
+{
+    {
+        QMutexLocker locker{&lock};
+        running = false;
+        stopCondition.wakeAll();
+    }
+    mixerThread->wait();
+    delete mixerThread;
+
+    Audio::getInstance().unsubscribeOutput(source);
+}
+
+void GroupAudioMixer::push(int peer, const int16_t* data, unsigned samples, uint8_t channels, unsigned sampleRate)
+{
+    if (!samples || !sampleRate || (channels != 1 && channels != 2))
+        return;
+
+    QMutexLocker locker{&lock};
+
+    PeerStream& stream = peers[peer];
+    qint64 now = clock.elapsed();
+    stream.lastPush = now;
+
+    // everyone gets converted to our output format, most peers already send it
+    if (sampleRate != AUDIO_SAMPLE_RATE)
+    {
+        if (!stream.resampler || stream.resampler->getInRate() != static_cast<int>(sampleRate)
+                || stream.resampler->getChannels() != channels)
+        {
+            stream.resampler = std::make_shared<AudioResampler>(channels, sampleRate, AUDIO_SAMPLE_RATE);
+        }
+
+        samples = stream.resampler->process(data, samples, stream.resampled);
+        data = stream.resampled.constData();
+    }
+    else if (stream.resampler)
+    {
+        stream.resampler.reset();
+    }
+
+    int start = stream.pending.size();
+    stream.pending.resize(start + samples * outputChannels);
+    int16_t* out = stream.pending.data() + start;
+    for (unsigned i = 0; i < samples; ++i)
+    {
+        out[2 * i] = data[i * channels];
+        out[2 * i + 1] = data[i * channels + channels - 1];
+    }
+
+    int backlog = stream.pending.size() - stream.readPos;
+    if (backlog > maxPeerBacklog)
+        stream.readPos += backlog - maxPeerBacklog;
+}
+
+bool GroupAudioMixer::reportActivity(int peer)
+{
+    QMutexLocker locker{&lock};
+
+    qint64 now = clock.elapsed();
+    auto it = lastReports.find(peer);
+    if (it != lastReports.end() && now - *it < activityReportInterval)
+        return false;
+
+    lastReports[peer] = now;
+    return true;
+}
+
+void GroupAudioMixer::invalidateSource()
+{
+    sourceInvalid = true;
+}
+
+void GroupAudioMixer::run()
+{
+    Audio& audio = Audio::getInstance();
+    QVector<int16_t> frame(frameSamples);
+
+    while (running)
+    {
+        if (sourceInvalid.exchange(false))
+            source = 0;
+
+        while (audio.queuedBuffers(source) < outputLeadFrames && mixFrame(frame.data()))
+        {
+            if (!source)
+            {
+                audio.subscribeOutput(source);
+                // opening the output device invalidates every source, but not the one we just got
+                sourceInvalid = false;
+            }
+
+            audio.playAudioBuffer(source, frame.constData(), AUDIO_FRAME_SAMPLE_COUNT,
+                                  outputChannels, AUDIO_SAMPLE_RATE);
+        }
+
+        QMutexLocker locker{&lock};
+        if (running)
+            stopCondition.wait(&lock, AUDIO_FRAME_DURATION / 2);
+    }
+}
+
+bool GroupAudioMixer::mixFrame(int16_t* out)
+{
+    QMutexLocker locker{&lock};
+
+    int32_t* mix = mixBuffer.data();
+    std::fill(mix, mix + frameSamples, 0);
+    bool mixed = false;
+    qint64 now = clock.elapsed();
+
+    for (auto it = peers.begin(); it != peers.end();)
+    {
+        PeerStream& stream = *it;
+        float frameEnergy = 0;
+        if (stream.pending.size() - stream.readPos >= frameSamples)
+        {
+            const int16_t* in = stream.pending.constData() + stream.readPos;
+            int64_t squares = 0;
+            for (int i = 0; i < frameSamples; ++i)
+            {
+                mix[i] += in[i];
+                squares += in[i] * in[i];
+            }
+            frameEnergy = squares / (static_cast<float>(frameSamples) * 32768.f * 32768.f);
+
+            stream.readPos += frameSamples;
+            mixed = true;
+        }
+        // peers with nothing to mix fade out, at the pace we're called
+        stream.energy = stream.energy * energyDecay + frameEnergy * (1.f - energyDecay);
+
+        // drop what we've read once it's the bigger part
+        if (stream.readPos > stream.pending.size() / 2)
+        {
+            stream.pending.remove(0, stream.readPos);
+            stream.readPos = 0;
+        }
+
+        if (stream.pending.isEmpty() && now - stream.lastPush > peerTimeout)
+        {
+            lastReports.remove(it.key());
+            it = peers.erase(it);
+        }
+        else
+            ++it;
+    }
+
+    updateSpeaker(now);
+
+    if (!mixed)
+        return false;
+
+    for (int i = 0; i < frameSamples; ++i)
+        out[i] = static_cast<int16_t>(qBound<int32_t>(std::numeric_limits<int16_t>::min(), mix[i],
+                                                      std::numeric_limits<int16_t>::max()));
+
+    return true;
+}
+
+void GroupAudioMixer::updateSpeaker(qint64 now)
+{
+    int loudest = -1;
+    float loudestEnergy = speakingEnergy;
+    for (auto it = peers.constBegin(); it != peers.constEnd(); ++it)
+    {
+        if (it->energy > loudestEnergy)
+        {
+            loudest = it.key();
+            loudestEnergy = it->energy;
+        }
+    }
+
+    auto active = peers.constFind(activeSpeaker);
+    if (active == peers.constEnd())
+    {
+        // The speaker left, anyone speaking replaces it right away
+        if (activeSpeaker == -1 && loudest == -1)
+            return;
+    }
+    else
+    {
+        // The last speaker stays on screen through silences, until somebody else clearly speaks
+        if (loudest == -1 || loudest == activeSpeaker || now - lastSpeakerChange < minSpeakerTime
+                || loudestEnergy < active->energy * speakerSwitchRatio)
+            return;
+    }
+
+    activeSpeaker = loudest;
+    lastSpeakerChange = now;
+    if (speakerChanged)
+        speakerChanged(activeSpeaker);
+}
@@ -0,0 +1,94 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GROUPAUDIOMIXER_H
+#define GROUPAUDIOMIXER_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+#include <QVector>
+#include <QWaitCondition>
+
+#include "audio.h"
+
+class AudioResampler;
+class QThread;
+
+/**
+@brief Mixes the audio of every peer of a group call into a single output source.
+
+The peers' frames are pushed from the toxcore thread, and a thread of our own sums them,
+clipping to 16 bits, at the pace the output device plays the result.
+While mixing, it follows the smoothed energy of each peer to tell who is speaking.
+*/
+class GroupAudioMixer
+{
+public:
+    /// Takes over an output source that was already subscribed, and unsubscribes it when done
+    /// speakerChanged is called from the mixer thread with the new active speaker, -1 if none is left
+    GroupAudioMixer(ALuint source, std::function<void(int)> speakerChanged);
+    ~GroupAudioMixer();
+
+    /// Queues a peer's frame to be played
+    void push(int peer, const int16_t* data, unsigned samples, uint8_t channels, unsigned sampleRate);
+    /// The peer just sent audio, returns true if that's worth reporting again
+    bool reportActivity(int peer);
+    /// Our output source is gone with the output device, get a new one
+    void invalidateSource();
+
+private:
+    struct PeerStream
+    {
+        QVector<int16_t> pending; ///< Interleaved stereo at AUDIO_SAMPLE_RATE
+        int readPos = 0;
+        qint64 lastPush = 0;
+        std::shared_ptr<AudioResampler> resampler; ///< Only if the peer sends at another rate
+        QVector<int16_t> resampled;
+        float energy = 0; ///< Smoothed mean square of the mixed samples, from 0 to 1
+    };
+
+private:
+    void run();
+    /// Sums a frame's worth of each peer that has one, returns false if none had
+    bool mixFrame(int16_t* out);
+    /// Picks the active speaker from the peers' energy, with hysteresis so it doesn't flicker
+    void updateSpeaker(qint64 now);
+
+private:
+    QThread* mixerThread;
+    std::atomic_bool running;
+    std::atomic_bool sourceInvalid;
+    ALuint source; ///< Only touched by the mixer thread once it runs
+    QMutex lock;
+    QWaitCondition stopCondition;
+    QHash<int, PeerStream> peers;
+    QHash<int, qint64> lastReports;
+    QVector<int32_t> mixBuffer;
+    QElapsedTimer clock;
+    std::function<void(int)> speakerChanged;
+    int activeSpeaker = -1;
+    qint64 lastSpeakerChange = 0;
+};
+
+#endif // GROUPAUDIOMIXER_H
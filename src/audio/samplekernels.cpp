@@ -0,0 +1,151 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "samplekernels.h"
+
+#include <cmath>
+#include <limits>
+#include <QtGlobal>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SAMPLEKERNELS_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define SAMPLEKERNELS_NEON
+#include <arm_neon.h>
+#endif
+
+namespace
+{
+
+/// The gain as gainQ / 2^shift, with gainQ as precise as an int16 allows
+void toFixedPoint(double gain, int& gainQ, int& shift)
+{
+    shift = 14;
+    while (shift > 0 && gain * (1 << shift) >= std::numeric_limits<int16_t>::max())
+        --shift;
+
+    gainQ = qBound(0, static_cast<int>(std::lround(gain * (1 << shift))),
+                   static_cast<int>(std::numeric_limits<int16_t>::max()));
+}
+
+int16_t scaleSample(int16_t sample, int gainQ, int shift)
+{
+    int rounding = shift ? 1 << (shift - 1) : 0;
+    int scaled = (sample * gainQ + rounding) >> shift;
+    return static_cast<int16_t>(qBound<int>(std::numeric_limits<int16_t>::min(), scaled,
+                                            std::numeric_limits<int16_t>::max()));
+}
+
+/// Does as many samples as the vector loop can, returns how many
+int applyGainSimd(int16_t* samples, int count, int gainQ, int shift, int& peak, uint64_t& sumSquares)
+{
+    int i = 0;
+#if defined(SAMPLEKERNELS_SSE2)
+    const __m128i gain = _mm_set1_epi16(static_cast<int16_t>(gainQ));
+    const __m128i rounding = _mm_set1_epi32(shift ? 1 << (shift - 1) : 0);
+    const __m128i shiftCount = _mm_cvtsi32_si128(shift);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i maxes = zero, mins = zero, sums = zero;
+
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i* p = reinterpret_cast<__m128i*>(samples + i);
+        __m128i x = _mm_loadu_si128(p);
+
+        // full 32 bit products from the low and high halves
+        __m128i lo = _mm_mullo_epi16(x, gain);
+        __m128i hi = _mm_mulhi_epi16(x, gain);
+        __m128i a = _mm_sra_epi32(_mm_add_epi32(_mm_unpacklo_epi16(lo, hi), rounding), shiftCount);
+        __m128i b = _mm_sra_epi32(_mm_add_epi32(_mm_unpackhi_epi16(lo, hi), rounding), shiftCount);
+        __m128i r = _mm_packs_epi32(a, b);
+        _mm_storeu_si128(p, r);
+
+        maxes = _mm_max_epi16(maxes, r);
+        mins = _mm_min_epi16(mins, r);
+        // madd's sums only overflow into the sign bit, so they're fine as unsigned
+        __m128i squares = _mm_madd_epi16(r, r);
+        sums = _mm_add_epi64(sums, _mm_unpacklo_epi32(squares, zero));
+        sums = _mm_add_epi64(sums, _mm_unpackhi_epi32(squares, zero));
+    }
+
+    alignas(16) int16_t maxLanes[8], minLanes[8];
+    alignas(16) uint64_t sumLanes[2];
+    _mm_store_si128(reinterpret_cast<__m128i*>(maxLanes), maxes);
+    _mm_store_si128(reinterpret_cast<__m128i*>(minLanes), mins);
+    _mm_store_si128(reinterpret_cast<__m128i*>(sumLanes), sums);
+    for (int lane = 0; lane < 8; ++lane)
+        peak = qMax(peak, qMax<int>(maxLanes[lane], -minLanes[lane]));
+    sumSquares += sumLanes[0] + sumLanes[1];
+#elif defined(SAMPLEKERNELS_NEON)
+    const int16x4_t gain = vdup_n_s16(static_cast<int16_t>(gainQ));
+    const int32x4_t shiftRight = vdupq_n_s32(-shift);
+    int16x8_t maxes = vdupq_n_s16(0);
+    uint64x2_t sums = vdupq_n_u64(0);
+
+    for (; i + 8 <= count; i += 8)
+    {
+        int16x8_t x = vld1q_s16(samples + i);
+        int32x4_t a = vrshlq_s32(vmull_s16(vget_low_s16(x), gain), shiftRight);
+        int32x4_t b = vrshlq_s32(vmull_s16(vget_high_s16(x), gain), shiftRight);
+        int16x8_t r = vcombine_s16(vqmovn_s32(a), vqmovn_s32(b));
+        vst1q_s16(samples + i, r);
+
+        maxes = vmaxq_s16(maxes, vqabsq_s16(r));
+        uint32x4_t lowSquares = vreinterpretq_u32_s32(vmull_s16(vget_low_s16(r), vget_low_s16(r)));
+        uint32x4_t highSquares = vreinterpretq_u32_s32(vmull_s16(vget_high_s16(r), vget_high_s16(r)));
+        sums = vpadalq_u32(sums, lowSquares);
+        sums = vpadalq_u32(sums, highSquares);
+    }
+
+    int16_t maxLanes[8];
+    vst1q_s16(maxLanes, maxes);
+    for (int lane = 0; lane < 8; ++lane)
+        peak = qMax<int>(peak, maxLanes[lane]);
+    sumSquares += vgetq_lane_u64(sums, 0) + vgetq_lane_u64(sums, 1);
+#else
+    Q_UNUSED(samples);
+    Q_UNUSED(count);
+    Q_UNUSED(gainQ);
+    Q_UNUSED(shift);
+    Q_UNUSED(peak);
+    Q_UNUSED(sumSquares);
+#endif
+    return i;
+}
+
+}
+
+void SampleKernels::applyGain(int16_t* samples, int count, double gain, int& peak, uint64_t& sumSquares)
+{
+    int gainQ, shift;
+    toFixedPoint(gain, gainQ, shift);
+
+    peak = 0;
+    sumSquares = 0;
+    int i = applyGainSimd(samples, count, gainQ, shift, peak, sumSquares);
+
+    for (; i < count; ++i)
+    {
+        int16_t r = scaleSample(samples[i], gainQ, shift);
+        samples[i] = r;
+        peak = qMax(peak, qAbs<int>(r));
+        sumSquares += static_cast<uint64_t>(r * r);
+    }
+}
@@ -0,0 +1,33 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SAMPLEKERNELS_H
+#define SAMPLEKERNELS_H
+
+#include <cstdint>
+
+/// Hand-written loops for the per-sample work on captured audio
+namespace SampleKernels
+{
+    /// Multiplies the samples by gain, saturating to the int16 range, and measures the result
+    /// in the same pass. peak is the largest absolute sample, sumSquares the sum of their squares.
+    void applyGain(int16_t* samples, int count, double gain, int& peak, uint64_t& sumSquares);
+}
+
+#endif // SAMPLEKERNELS_H
@@ -0,0 +1,92 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "voicedetector.h"
+
+#include <cmath>
+#include <QtGlobal>
+
+namespace
+{
+/// About -50dBFS, anything quieter is silence whatever the noise floor
+const double minVoiceRms = 100;
+/// Above the noise floor times this, it's voice
+const double loudFactor = 6;
+/// Between the noise floor times this and loudFactor, it's voice unless it sounds like hiss
+const double quietFactor = 3;
+/// Hiss crosses zero much more often than voiced speech does
+const double maxVoiceCrossingRate = 0.25;
+/// In ms, whatever the frame size
+const int hangoverTime = 300;
+/// How fast the floor goes up in noise, it drops right away when it gets quieter
+const double floorRise = 0.02;
+}
+
+VoiceDetector::VoiceDetector()
+{
+    reset();
+}
+
+bool VoiceDetector::isVoice(const int16_t* samples, int count, uint64_t sumSquares, int duration)
+{
+    if (count <= 1)
+        return true;
+
+    double rms = std::sqrt(static_cast<double>(sumSquares) / count);
+
+    int crossings = 0;
+    for (int i = 1; i < count; ++i)
+        crossings += (samples[i - 1] < 0) != (samples[i] < 0);
+    double crossingRate = static_cast<double>(crossings) / (count - 1);
+
+    bool voice = false;
+    if (rms >= minVoiceRms)
+    {
+        if (rms > noiseFloor * loudFactor)
+            voice = true;
+        else if (rms > noiseFloor * quietFactor)
+            voice = crossingRate < maxVoiceCrossingRate;
+    }
+
+    // only learn the floor from what isn't speech
+    if (rms < noiseFloor)
+        noiseFloor = qMax(1.0, rms);
+    else if (!voice)
+        noiseFloor += (rms - noiseFloor) * floorRise;
+
+    if (voice)
+    {
+        hangover = hangoverTime;
+        return true;
+    }
+
+    if (hangover > 0)
+    {
+        hangover -= duration;
+        return true;
+    }
+
+    return false;
+}
+
+void VoiceDetector::reset()
+{
+    noiseFloor = minVoiceRms / quietFactor;
+    hangover = hangoverTime;
+}
@@ -0,0 +1,45 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef VOICEDETECTOR_H
+#define VOICEDETECTOR_H
+
+#include <cstdint>
+
+/**
+@brief Cheap voice activity detection on captured frames, from their energy and zero crossings.
+
+The noise floor adapts to the room, and frames keep counting as voice for a while after
+speech stopped, so the ends of words aren't cut.
+*/
+class VoiceDetector
+{
+public:
+    VoiceDetector();
+
+    /// sumSquares is the frame's energy, the caller usually already has it, duration is in ms
+    bool isVoice(const int16_t* samples, int count, uint64_t sumSquares, int duration);
+    void reset();
+
+private:
+    double noiseFloor; ///< RMS of the background noise
+    int hangover; ///< Milliseconds left that still count as voice
+};
+
+#endif // VOICEDETECTOR_H
@@ -0,0 +1,37 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CAPTURECLOCK_H
+#define CAPTURECLOCK_H
+
+#include <QtGlobal>
+#include <chrono>
+
+/// The monotonic clock our audio and video capture times are read from, so they can be compared
+namespace CaptureClock
+{
+    /// In µs, from an arbitrary start that's the same in every thread
+    inline qint64 now()
+    {
+        using namespace std::chrono;
+        return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+    }
+}
+
+#endif // CAPTURECLOCK_H
@@ -19,17 +19,20 @@
 
 #include "chatline.h"
 #include "chatlinecontent.h"
+#include "src/memorystats.h"
 
 #include <QDebug>
 #include <QGraphicsScene>
 
 ChatLine::ChatLine()
 {
-
+    MemoryStats::allocated(MemoryStats::ChatLines, sizeof(ChatLine));
 }
 
 ChatLine::~ChatLine()
 {
+    MemoryStats::freed(MemoryStats::ChatLines, sizeof(ChatLine));
+
     for (ChatLineContent* c : content)
     {
         if (c->scene())
@@ -51,8 +54,19 @@ void ChatLine::visibilityChanged(bool visible)
 {
     if (isVisible != visible)
     {
+        bool resized = false;
         for (ChatLineContent* c : content)
+        {
+            QSizeF oldSize = c->boundingRect().size();
             c->visibilityChanged(visible);
+            resized |= c->boundingRect().size() != oldSize;
+        }
+
+        isVisible = visible;
+
+        // content that was only estimated until now, see Text::setDeferredText
+        if (resized)
+            layout(width, bbox.topLeft());
     }
 
     isVisible = visible;
@@ -71,6 +85,12 @@ ChatLineContent *ChatLine::getContent(int col) const
     return nullptr;
 }
 
+ChatLineContent *ChatLine::getContent(int col)
+{
+    ensureMaterialized();
+    return static_cast<const ChatLine*>(this)->getContent(col);
+}
+
 ChatLineContent *ChatLine::getContent(QPointF scenePos) const
 {
     for (ChatLineContent* c: content)
@@ -82,6 +102,12 @@ ChatLineContent *ChatLine::getContent(QPointF scenePos) const
     return nullptr;
 }
 
+QString ChatLine::getColumnText(int col) const
+{
+    ChatLineContent* c = getContent(col);
+    return c ? c->getText() : QString();
+}
+
 void ChatLine::removeFromScene()
 {
     for (ChatLineContent* c : content)
@@ -89,6 +115,8 @@ void ChatLine::removeFromScene()
         if (c->scene())
             c->scene()->removeItem(c);
     }
+
+    scene = nullptr;
 }
 
 void ChatLine::addToScene(QGraphicsScene *scene)
@@ -96,10 +124,67 @@ void ChatLine::addToScene(QGraphicsScene *scene)
     if (!scene)
         return;
 
+    this->scene = scene;
     for (ChatLineContent* c : content)
         scene->addItem(c);
 }
 
+bool ChatLine::isMaterialized() const
+{
+    return materialized;
+}
+
+void ChatLine::dematerialize()
+{
+    if (!materialized || !canDematerialize())
+        return;
+
+    for (ChatLineContent* c : content)
+    {
+        if (c->scene())
+            c->scene()->removeItem(c);
+
+        delete c;
+    }
+
+    content.clear();
+    format.clear();
+    materialized = false;
+}
+
+void ChatLine::ensureMaterialized()
+{
+    if (materialized)
+        return;
+
+    materialized = true;
+    createContent();
+    setRow(row);
+
+    if (scene)
+    {
+        for (ChatLineContent* c : content)
+            scene->addItem(c);
+    }
+
+    layout(width, bbox.topLeft());
+
+    if (isVisible)
+    {
+        for (ChatLineContent* c : content)
+            c->visibilityChanged(true);
+    }
+}
+
+bool ChatLine::canDematerialize() const
+{
+    return false;
+}
+
+void ChatLine::createContent()
+{
+}
+
 void ChatLine::setVisible(bool visible)
 {
     for (ChatLineContent* c : content)
@@ -167,27 +252,29 @@ void ChatLine::replaceContent(int col, ChatLineContent *lineContent)
 
 void ChatLine::layout(qreal w, QPointF scenePos)
 {
+    if (!materialized)
+    {
+        // At the same width only our position changes, otherwise we need the content to get our new height
+        if (w == width)
+        {
+            bbox.moveTopLeft(scenePos);
+            return;
+        }
+
+        materialized = true;
+        createContent();
+        layout(w, scenePos);
+        dematerialize();
+        return;
+    }
+
     if (!content.size())
         return;
 
     width = w;
     bbox.setTopLeft(scenePos);
 
-    qreal fixedWidth = (content.size()-1) * columnSpacing;
-    qreal varWidth = 0.0; // used for normalisation
-
-    for (size_t i = 0; i < format.size(); ++i)
-    {
-        if (format[i].policy == ColumnFormat::FixedSize)
-            fixedWidth += format[i].size;
-        else
-            varWidth += format[i].size;
-    }
-
-    if (varWidth == 0.0)
-        varWidth = 1.0;
-
-    qreal leftover = qMax(0.0, width - fixedWidth);
+    const std::vector<qreal> widths = columnWidths(width);
 
     qreal maxVOffset = 0.0;
     qreal xOffset = 0.0;
@@ -195,12 +282,8 @@ void ChatLine::layout(qreal w, QPointF scenePos)
 
     for (size_t i = 0; i < content.size(); ++i)
     {
-        // calculate the effective width of the current column
-        qreal width;
-        if (format[i].policy == ColumnFormat::FixedSize)
-            width = format[i].size;
-        else
-            width = format[i].size / varWidth * leftover;
+        // the effective width of the current column
+        qreal width = widths[i];
 
         // set the width of the current column
         content[i]->setWidth(width);
@@ -240,6 +323,39 @@ void ChatLine::layout(qreal w, QPointF scenePos)
     updateBBox();
 }
 
+std::vector<qreal> ChatLine::columnWidths(qreal w) const
+{
+    if (format.empty())
+        return std::vector<qreal>();
+
+    qreal fixedWidth = (format.size()-1) * columnSpacing;
+    qreal varWidth = 0.0; // used for normalisation
+
+    for (size_t i = 0; i < format.size(); ++i)
+    {
+        if (format[i].policy == ColumnFormat::FixedSize)
+            fixedWidth += format[i].size;
+        else
+            varWidth += format[i].size;
+    }
+
+    if (varWidth == 0.0)
+        varWidth = 1.0;
+
+    qreal leftover = qMax(0.0, w - fixedWidth);
+
+    std::vector<qreal> widths(format.size());
+    for (size_t i = 0; i < format.size(); ++i)
+    {
+        if (format[i].policy == ColumnFormat::FixedSize)
+            widths[i] = format[i].size;
+        else
+            widths[i] = format[i].size / varWidth * leftover;
+    }
+
+    return widths;
+}
+
 void ChatLine::moveBy(qreal deltaY)
 {
     // reposition only
@@ -69,6 +69,8 @@ public:
 
     void replaceContent(int col, ChatLineContent* lineContent);
     void layout(qreal width, QPointF scenePos);
+    /// Returns the width each column gets when the line is laid out at the given width
+    std::vector<qreal> columnWidths(qreal width) const;
     void moveBy(qreal deltaY);
     void removeFromScene();
     void addToScene(QGraphicsScene* scene);
@@ -80,7 +82,14 @@ public:
     int getRow() const;
 
     ChatLineContent* getContent(int col) const;
+    /// Same, but recreates the content first if the line was dematerialized
+    ChatLineContent* getContent(int col);
     ChatLineContent* getContent(QPointF scenePos) const;
+    /// Returns the text of a column, without recreating the content of a dematerialized line
+    virtual QString getColumnText(int col) const;
+
+    /// Returns false while the content of the line is freed, see dematerialize
+    bool isMaterialized() const;
 
     bool isOverSelection(QPointF scenePos);
 
@@ -97,8 +106,18 @@ protected:
     void addColumn(ChatLineContent* item, ColumnFormat fmt);
     void updateBBox();
     void setRow(int idx);
+    /// Lays the line out again if its content changed size, the log moves the other lines
     void visibilityChanged(bool visible);
 
+    /// Frees the content of the line while keeping its geometry, if createContent can recreate it
+    void dematerialize();
+    /// Recreates the content freed by dematerialize, in place
+    void ensureMaterialized();
+    /// Returns true if createContent can recreate the content of this line
+    virtual bool canDematerialize() const;
+    /// Adds the columns of the line again, only called on dematerialized lines if canDematerialize()
+    virtual void createContent();
+
 private:
     int row = -1;
     std::vector<ChatLineContent*> content;
@@ -107,6 +126,8 @@ private:
     qreal columnSpacing = 15.0;
     QRectF bbox;
     bool isVisible = false;
+    bool materialized = true;
+    QGraphicsScene* scene = nullptr; ///< The scene we were added to, for the recreated content
 
 };
 
@@ -18,6 +18,17 @@
 */
 
 #include "chatlinecontent.h"
+#include "src/memorystats.h"
+
+ChatLineContent::ChatLineContent()
+{
+    MemoryStats::allocated(MemoryStats::ChatLineContents);
+}
+
+ChatLineContent::~ChatLineContent()
+{
+    MemoryStats::freed(MemoryStats::ChatLineContents);
+}
 
 void ChatLineContent::setIndex(int r, int c)
 {
@@ -32,6 +32,9 @@ public:
         ChatLineContentType = QGraphicsItem::UserType + 1,
     };
 
+    ChatLineContent();
+    virtual ~ChatLineContent();
+
     int getColumn() const;
     int getRow() const;
 
@@ -61,6 +61,12 @@ qreal ChatLineContentProxy::getAscent() const
     return 7.0;
 }
 
+void ChatLineContentProxy::visibilityChanged(bool visible)
+{
+    if (widgetType == FileTransferWidgetType)
+        static_cast<FileTransferWidget*>(proxy->widget())->visibilityChanged(visible);
+}
+
 QWidget *ChatLineContentProxy::getWidget() const
 {
     return proxy->widget();
@@ -32,7 +32,7 @@ public:
     enum ChatLineContentProxyType
     {
         GenericType,
-        FileTransferWidgetType=0,
+        FileTransferWidgetType,
     };
 
 public:
@@ -43,6 +43,7 @@ public:
     void setWidth(qreal width) override;
     void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget) override;
     qreal getAscent() const override;
+    void visibilityChanged(bool visible) override;
 
     QWidget* getWidget() const;
     ChatLineContentProxyType getWidgetType() const;
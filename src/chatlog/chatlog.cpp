@@ -20,7 +20,12 @@
 #include "chatlog.h"
 #include "chatmessage.h"
 #include "chatlinecontent.h"
+#include "customtextdocument.h"
+#include "documentcache.h"
+#include "content/text.h"
+#include "src/persistence/settings.h"
 #include "src/widget/translator.h"
+#include "src/trace.h"
 
 #include <QDebug>
 #include <QScrollBar>
@@ -29,7 +34,10 @@
 #include <QAction>
 #include <QTimer>
 #include <QMouseEvent>
+#include <QPaintEvent>
 #include <QShortcut>
+#include <QRunnable>
+#include <atomic>
 
 template<class T>
 T clamp(T x, T min, T max)
@@ -41,6 +49,64 @@ T clamp(T x, T min, T max)
     return x;
 }
 
+/// A Text of a line, laid out at its column width by the layout pool
+struct LayoutJob
+{
+    std::weak_ptr<ChatLine> line;
+    const Text* text;
+    int col;
+    Text::LayoutInput input;
+    Text::Layout result;
+};
+
+/// The text layouts of a resize, shared between the GUI thread and the layout pool
+struct LayoutBatch
+{
+    std::vector<LayoutJob> jobs; // each runnable only writes the results of its own range
+    QString css;
+    int emojiSize = 0;
+    std::atomic_int remaining{0}; ///< Runnables that haven't finished yet
+    std::atomic_bool cancelled{false};
+};
+
+namespace
+{
+
+// below this many lines the resize worker lays out the text itself
+const int backgroundLayoutLines = 200;
+
+// jobs per runnable, one document is created for each of them
+const int layoutChunkSize = 100;
+
+class LayoutRunnable : public QRunnable
+{
+public:
+    LayoutRunnable(std::shared_ptr<LayoutBatch> batch, int begin, int end, ChatLog* log)
+        : batch{batch}, begin{begin}, end{end}, log{log}
+    {
+    }
+
+    virtual void run() final override
+    {
+        LayoutTextDocument doc(batch->css, batch->emojiSize);
+
+        for (int i = begin; i < end && !batch->cancelled; ++i)
+            batch->jobs[i].result = Text::computeLayout(batch->jobs[i].input, &doc);
+
+        // the log cancels its batch and waits for the pool before it is deleted
+        if (--batch->remaining == 0 && !batch->cancelled)
+            QMetaObject::invokeMethod(log, "onLayoutBatchDone", Qt::QueuedConnection);
+    }
+
+private:
+    std::shared_ptr<LayoutBatch> batch;
+    int begin;
+    int end;
+    ChatLog* log;
+};
+
+}
+
 ChatLog::ChatLog(QWidget* parent)
     : QGraphicsView(parent)
 {
@@ -56,9 +122,12 @@ ChatLog::ChatLog(QWidget* parent)
     setAlignment(Qt::AlignTop | Qt::AlignLeft);
     setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
     setDragMode(QGraphicsView::NoDrag);
+    // only repaint the bounding rects of what changed, the items clip to them anyway
     setViewportUpdateMode(MinimalViewportUpdate);
+    setOptimizationFlag(QGraphicsView::DontAdjustForAntialiasing);
     setContextMenuPolicy(Qt::CustomContextMenu);
     setBackgroundBrush(QBrush(Qt::white, Qt::SolidPattern));
+    setBackgroundCached(true);
 
     // The selection rect for multi-line selection
     selGraphItem = scene->addRect(0,0,0,0,selectionRectColor.darker(120),selectionRectColor);
@@ -100,6 +169,13 @@ ChatLog::ChatLog(QWidget* parent)
     workerTimer->setInterval(5);
     connect(workerTimer, &QTimer::timeout, this, &ChatLog::onWorkerTimeout);
 
+    // Lines inserted at the bottom are laid out together the next time the event loop runs,
+    // so a burst of messages only costs one layout and scroll pass
+    insertTimer = new QTimer(this);
+    insertTimer->setSingleShot(true);
+    insertTimer->setInterval(0);
+    connect(insertTimer, &QTimer::timeout, this, &ChatLog::flushPendingLines);
+
     // selection
     connect(this, &ChatLog::selectionChanged, this, [this]() {
         copyAction->setEnabled(hasTextToBeCopied());
@@ -116,6 +192,9 @@ ChatLog::~ChatLog()
 {
     Translator::unregister(this);
 
+    cancelLayoutBatch();
+    layoutPool.waitForDone();
+
     // Remove chatlines from scene
     for (ChatLine::Ptr l : lines)
         l->removeFromScene();
@@ -158,6 +237,7 @@ void ChatLog::updateSceneRect()
 
 void ChatLog::layout(int start, int end, qreal width)
 {
+    TraceSpan span{"ChatLog::layout"};
     if (lines.empty())
         return;
 
@@ -358,15 +438,40 @@ void ChatLog::insertChatlineAtBottom(ChatLine::Ptr l)
     if (!l.get())
         return;
 
+    pendingLines.append(l);
+
+    if (!insertTimer->isActive())
+        insertTimer->start();
+}
+
+/**
+ * @brief Inserts the lines queued by insertChatlineAtBottom.
+ *
+ * Called before anything that needs all the lines, so the queue stays invisible to the rest of the log.
+ */
+void ChatLog::flushPendingLines()
+{
+    insertTimer->stop();
+
+    if (pendingLines.isEmpty())
+        return;
+
     bool stickToBtm = stickToBottom();
 
     //insert
-    l->setRow(lines.size());
-    l->addToScene(scene);
-    lines.append(l);
+    int first = lines.size();
+    for (ChatLine::Ptr l : pendingLines)
+    {
+        l->setRow(lines.size());
+        l->addToScene(scene);
+        lines.append(l);
+    }
+
+    pendingLines.clear();
+    materializedFirst = -1;
 
     //partial refresh
-    layout(lines.last()->getRow(), lines.size(), useableWidth());
+    layout(first, lines.size(), useableWidth());
     updateSceneRect();
 
     if (stickToBtm)
@@ -374,6 +479,7 @@ void ChatLog::insertChatlineAtBottom(ChatLine::Ptr l)
 
     checkVisibility();
     updateTypingNotification();
+    trimLines();
 }
 
 void ChatLog::insertChatlineOnTop(ChatLine::Ptr l)
@@ -389,6 +495,8 @@ void ChatLog::insertChatlineOnTop(const QList<ChatLine::Ptr>& newLines)
     if (newLines.isEmpty())
         return;
 
+    flushPendingLines();
+
     QGraphicsScene::ItemIndexMethod oldIndexMeth = scene->itemIndexMethod();
     scene->setItemIndexMethod(QGraphicsScene::NoIndex);
 
@@ -414,11 +522,49 @@ void ChatLog::insertChatlineOnTop(const QList<ChatLine::Ptr>& newLines)
     }
 
     lines = combLines;
+    materializedFirst = -1;
+
+    // the rows of the visible and selected lines moved down
+    visibleFirst += newLines.size();
+    visibleLast += newLines.size();
+
+    if (selectionMode != None)
+    {
+        selClickedRow += newLines.size();
+        selFirstRow += newLines.size();
+        selLastRow += newLines.size();
+    }
+
+    // a running worker lays out every line from the top anyway
+    if (workerTimer->isActive() || layoutBatch)
+    {
+        scene->setItemIndexMethod(oldIndexMeth);
+        startResizeWorker();
+        return;
+    }
+
+    // Stack the new lines above the old ones, the scene simply grows upwards.
+    // None of the old lines move, and since the scrollbar values are scene coordinates
+    // the view keeps showing the same lines.
+    const qreal width = useableWidth();
+    qreal bottom = 0.0;
+    if (newLines.size() < lines.size())
+        bottom = lines[newLines.size()]->sceneBoundingRect().top() - lineSpacing;
+
+    for (int row = newLines.size() - 1; row >= 0; --row)
+    {
+        ChatLine* l = lines[row].get();
+
+        l->layout(width, QPointF(0.0, 0.0));
+        l->moveBy(bottom - l->sceneBoundingRect().height());
+        bottom = l->sceneBoundingRect().top() - lineSpacing;
+    }
 
     scene->setItemIndexMethod(oldIndexMeth);
 
-    // redo layout
-    startResizeWorker();
+    updateSceneRect();
+    checkVisibility();
+    updateMultiSelectionRect();
 }
 
 bool ChatLog::stickToBottom() const
@@ -434,19 +580,38 @@ void ChatLog::scrollToBottom()
 
 void ChatLog::startResizeWorker()
 {
+    flushPendingLines();
+    workerWidth = useableWidth();
+
     if (lines.empty())
         return;
 
     // (re)start the worker
-    if (!workerTimer->isActive())
+    if (!workerTimer->isActive() && !layoutBatch)
     {
         // these values must not be reevaluated while the worker is running
         workerStb = stickToBottom();
 
-        if (!visibleLines.empty())
-            workerAnchorLine = visibleLines.first();
+        if (visibleFirst < visibleLast)
+            workerAnchorLine = lines[visibleFirst];
     }
 
+    workerTimer->stop();
+    cancelLayoutBatch();
+
+    // let the layout pool compute the text geometry of large logs,
+    // the worker then only has to apply it
+    if (lines.size() >= backgroundLayoutLines && startLayoutBatch())
+    {
+        // an earlier run of the worker may have switched to the busy scene
+        if (!busy)
+            setScene(scene);
+
+        return;
+    }
+
+    workerPrecomputed = false;
+
     // switch to busy scene displaying the busy notification if there is a lot
     // of text to be resized
     int txt = 0;
@@ -466,6 +631,64 @@ void ChatLog::startResizeWorker()
     verticalScrollBar()->hide();
 }
 
+bool ChatLog::startLayoutBatch()
+{
+    const qreal width = useableWidth();
+
+    std::shared_ptr<LayoutBatch> batch = std::make_shared<LayoutBatch>();
+    batch->css = CustomTextDocument::getStylesheet();
+    batch->emojiSize = Settings::getInstance().getEmojiFontPointSize();
+
+    for (const ChatLine::Ptr& line : lines)
+    {
+        // dematerialized lines have no text to lay out
+        if (!line->isMaterialized())
+            continue;
+
+        const std::vector<qreal> widths = line->columnWidths(width);
+        for (int col = 0; col < static_cast<int>(widths.size()); ++col)
+        {
+            // deferred text only has an estimated size until it is shown
+            const Text* text = dynamic_cast<const Text*>(line->content[col]);
+            if (!text || text->isDeferred())
+                continue;
+
+            LayoutJob job;
+            job.line = line;
+            job.text = text;
+            job.col = col;
+            job.input = text->getLayoutInput(widths[col]);
+            batch->jobs.push_back(job);
+        }
+    }
+
+    if (batch->jobs.empty())
+        return false;
+
+    const int jobCount = batch->jobs.size();
+    const int chunks = (jobCount + layoutChunkSize - 1) / layoutChunkSize;
+    batch->remaining = chunks;
+    layoutBatch = batch;
+
+    for (int i = 0; i < chunks; ++i)
+    {
+        const int begin = i * layoutChunkSize;
+        layoutPool.start(new LayoutRunnable(batch, begin, qMin(begin + layoutChunkSize, jobCount), this));
+    }
+
+    return true;
+}
+
+void ChatLog::cancelLayoutBatch()
+{
+    if (!layoutBatch)
+        return;
+
+    // the runnables still hold the batch, they stop at their next job
+    layoutBatch->cancelled = true;
+    layoutBatch.reset();
+}
+
 void ChatLog::mouseDoubleClickEvent(QMouseEvent *ev)
 {
     QPointF scenePos = mapToScene(ev->pos());
@@ -492,19 +715,41 @@ QString ChatLog::getSelectedText() const
     }
     else if (selectionMode == Multi)
     {
-        // build a nicely formatted message
-        QString out;
+        // Build a nicely formatted message. The lines are fully selected, so their stored texts are used,
+        // dematerialized lines aren't recreated. The texts are shared, collecting them first lets us
+        // put the message together in a single allocation.
+        QVector<QString> parts;
+        parts.reserve((selLastRow - selFirstRow + 1) * 3);
+        int size = 0;
 
         for (int i=selFirstRow; i<=selLastRow; ++i)
         {
-            if (lines[i]->content[1]->getText().isEmpty())
+            QString msg = lines[i]->getColumnText(1);
+            if (msg.isEmpty())
                 continue;
 
-            QString timestamp = lines[i]->content[2]->getText().isEmpty() ? tr("pending") : lines[i]->content[2]->getText();
-            QString author = lines[i]->content[0]->getText();
-            QString msg = lines[i]->content[1]->getText();
+            QString timestamp = lines[i]->getColumnText(2);
+            if (timestamp.isEmpty())
+                timestamp = tr("pending");
 
-            out += QString(out.isEmpty() ? "[%2] %1: %3" : "\n[%2] %1: %3").arg(author, timestamp, msg);
+            parts << lines[i]->getColumnText(0) << timestamp << msg;
+            size += parts[parts.size() - 3].size() + timestamp.size() + msg.size() + 6; // "\n[] : "
+        }
+
+        QString out;
+        out.reserve(size);
+
+        for (int i = 0; i < parts.size(); i += 3)
+        {
+            if (i > 0)
+                out += QLatin1Char('\n');
+
+            out += QLatin1Char('[');
+            out += parts[i + 1];
+            out += QLatin1String("] ");
+            out += parts[i];
+            out += QLatin1String(": ");
+            out += parts[i + 2];
         }
 
         return out;
@@ -515,7 +760,7 @@ QString ChatLog::getSelectedText() const
 
 bool ChatLog::isEmpty() const
 {
-    return lines.isEmpty();
+    return lines.isEmpty() && pendingLines.isEmpty();
 }
 
 bool ChatLog::hasTextToBeCopied() const
@@ -530,11 +775,47 @@ ChatLine::Ptr ChatLog::getTypingNotification() const
 
 QVector<ChatLine::Ptr> ChatLog::getLines()
 {
+    flushPendingLines();
     return lines;
 }
 
+ChatLog::Statistics ChatLog::getStatistics() const
+{
+    Statistics stats;
+    stats.lines = lines.size() + pendingLines.size();
+    stats.repaints = repaints;
+    stats.repaintedPixels = repaintedPixels;
+    for (const QVector<ChatLine::Ptr>* list : {&lines, &pendingLines})
+    {
+        for (const ChatLine::Ptr& line : *list)
+        {
+            if (!line->isMaterialized())
+                continue;
+
+            ++stats.materialized;
+            for (const ChatLineContent* c : line->content)
+                stats.textBytes += c->getText().size() * static_cast<qint64>(sizeof(QChar));
+        }
+    }
+    return stats;
+}
+
+/**
+ * @brief Keeps the background in a pixmap of the viewport, so small updates don't repaint it.
+ *
+ * The animated items invalidate the item layer only, so the cache is kept while they animate.
+ */
+void ChatLog::setBackgroundCached(bool enable)
+{
+    setCacheMode(enable ? QGraphicsView::CacheBackground : QGraphicsView::CacheNone);
+    resetCachedContent();
+}
+
 ChatLine::Ptr ChatLog::getLatestLine() const
 {
+    if (!pendingLines.empty())
+        return pendingLines.last();
+
     if (!lines.empty())
     {
         return lines.last();
@@ -546,11 +827,18 @@ void ChatLog::clear()
 {
     clearSelection();
 
+    pendingLines.clear();
+    insertTimer->stop();
+
     for (ChatLine::Ptr l : lines)
         l->removeFromScene();
 
+    cancelLayoutBatch();
+
     lines.clear();
-    visibleLines.clear();
+    visibleFirst = 0;
+    visibleLast = 0;
+    materializedFirst = -1;
 
     updateSceneRect();
 }
@@ -564,6 +852,26 @@ void ChatLog::copySelectedText(bool toSelectionBuffer) const
         clipboard->setText(text, toSelectionBuffer ? QClipboard::Selection : QClipboard::Clipboard);
 }
 
+void ChatLog::setBusy(bool newBusy)
+{
+    if (busy == newBusy)
+        return;
+
+    busy = newBusy;
+    if (busy)
+    {
+        setScene(busyScene);
+        updateBusyNotification();
+        verticalScrollBar()->hide();
+    }
+    else if (!workerTimer->isActive())
+    {
+        // otherwise the resize worker switches back when it's done
+        setScene(scene);
+        verticalScrollBar()->show();
+    }
+}
+
 void ChatLog::setBusyNotification(ChatLine::Ptr notification)
 {
     if (!notification.get())
@@ -580,7 +888,7 @@ void ChatLog::setTypingNotification(ChatLine::Ptr notification)
     typingNotification->visibilityChanged(true);
     typingNotification->setVisible(false);
     typingNotification->addToScene(scene);
-    updateTypingNotification();
+    updateTypingNotification(true);
 }
 
 void ChatLog::setTypingNotificationVisible(bool visible)
@@ -597,12 +905,15 @@ void ChatLog::scrollToLine(ChatLine::Ptr line)
     if (!line.get())
         return;
 
+    flushPendingLines();
     updateSceneRect();
     verticalScrollBar()->setValue(line->sceneBoundingRect().top());
 }
 
 void ChatLog::selectAll()
 {
+    flushPendingLines();
+
     if (lines.empty())
         return;
 
@@ -621,53 +932,211 @@ void ChatLog::forceRelayout()
     startResizeWorker();
 }
 
+bool ChatLog::isLayingOut() const
+{
+    return workerTimer->isActive() || layoutBatch;
+}
+
+void ChatLog::setVirtualized(bool enable)
+{
+    virtualized = enable;
+    materializedFirst = -1;
+
+    if (!virtualized)
+    {
+        for (ChatLine::Ptr line : lines)
+            line->ensureMaterialized();
+    }
+
+    checkVisibility();
+}
+
+void ChatLog::setMaxLines(int newMaxLines)
+{
+    maxLines = newMaxLines;
+    trimLines();
+}
+
+/**
+ * @brief Drops the lines above the maximum from the top of the log.
+ *
+ * The visible and selected lines are kept, and since the other lines don't move
+ * the view keeps showing the same thing.
+ */
+void ChatLog::trimLines()
+{
+    if (maxLines <= 0 || lines.size() <= maxLines)
+        return;
+
+    // the worker lays out the lines by row, we'll trim after the next insertion
+    if (workerTimer->isActive() || layoutBatch)
+        return;
+
+    int count = qMin(lines.size() - maxLines, visibleFirst);
+    if (selectionMode != None)
+        count = qMin(count, qMin(selFirstRow, selClickedRow));
+
+    removeTopLines(count);
+}
+
+/**
+ * @brief Drops all but the last keep lines of a log that isn't shown, the selection is cleared.
+ *
+ * Like trimLines, this emits linesTrimmed so the owner knows where to reload the dropped lines from.
+ */
+void ChatLog::releaseLines(int keep)
+{
+    if (isVisible() || lines.size() <= keep)
+        return;
+
+    if (!pendingLines.isEmpty() || workerTimer->isActive() || layoutBatch)
+        return;
+
+    clearSelection();
+    removeTopLines(lines.size() - keep);
+}
+
+void ChatLog::removeTopLines(int count)
+{
+    if (count <= 0)
+        return;
+
+    for (int i = 0; i < count; ++i)
+        lines[i]->removeFromScene();
+
+    lines.remove(0, count);
+
+    for (int i = 0; i < lines.size(); ++i)
+        lines[i]->setRow(i);
+
+    visibleFirst = qMax(0, visibleFirst - count);
+    visibleLast = qMax(0, visibleLast - count);
+    materializedFirst = -1;
+
+    if (selectionMode != None)
+    {
+        selClickedRow -= count;
+        selFirstRow -= count;
+        selLastRow -= count;
+    }
+
+    updateSceneRect();
+    emit linesTrimmed();
+}
+
+void ChatLog::updateMaterializedLines()
+{
+    // Keep a viewport worth of lines materialized above and below the visible ones, for smooth scrolling
+    QRect visibleRect = getVisibleRect();
+    qreal margin = visibleRect.height();
+    auto first = std::lower_bound(lines.cbegin(), lines.cend(), visibleRect.top() - margin, ChatLine::lessThanBSRectBottom);
+    auto last = std::lower_bound(first, lines.cend(), visibleRect.bottom() + margin, ChatLine::lessThanBSRectTop);
+
+    int firstRow = first - lines.cbegin();
+    int lastRow = last - lines.cbegin();
+    if (firstRow == materializedFirst && lastRow == materializedLast)
+        return;
+
+    materializedFirst = firstRow;
+    materializedLast = lastRow;
+
+    for (int i = 0; i < lines.size(); ++i)
+    {
+        if (i >= firstRow && i < lastRow)
+            lines[i]->ensureMaterialized();
+        else if (selectionMode != Precise || i != selClickedRow) // the selection lives in the content
+            lines[i]->dematerialize();
+    }
+}
+
 void ChatLog::checkVisibility()
 {
     if (lines.empty())
         return;
 
+    if (virtualized)
+        updateMaterializedLines();
+
     // find first visible line
     auto lowerBound = std::lower_bound(lines.cbegin(), lines.cend(), getVisibleRect().top(), ChatLine::lessThanBSRectBottom);
 
     // find last visible line
     auto upperBound = std::lower_bound(lowerBound, lines.cend(), getVisibleRect().bottom(), ChatLine::lessThanBSRectTop);
 
-    // set visibilty
-    QList<ChatLine::Ptr> newVisibleLines;
-    for (auto itr = lowerBound; itr != upperBound; ++itr)
-    {
-        newVisibleLines.append(*itr);
+    int first = lowerBound - lines.cbegin();
+    int last = upperBound - lines.cbegin();
+
+    // only the lines that left or entered the visible range change,
+    // those that left go first so their resources can be reused
+    for (int i = visibleFirst; i < qMin(visibleLast, first); ++i)
+        lines[i]->visibilityChanged(false);
+
+    for (int i = qMax(visibleFirst, last); i < visibleLast; ++i)
+        lines[i]->visibilityChanged(false);
+
+    bool resized = false;
+    for (int i = first; i < qMin(last, visibleFirst); ++i)
+        resized |= showLine(i);
 
-        if (!visibleLines.contains(*itr))
-            (*itr)->visibilityChanged(true);
+    for (int i = qMax(first, visibleLast); i < last; ++i)
+        resized |= showLine(i);
 
-        visibleLines.removeOne(*itr);
+    visibleFirst = first;
+    visibleLast = last;
+
+    // lines moved, so other lines may have become visible
+    if (resized)
+    {
+        updateSceneRect();
+        updateTypingNotification();
+        updateMultiSelectionRect();
+        checkVisibility();
+        return;
     }
 
-    // these lines are no longer visible
-    for (ChatLine::Ptr line : visibleLines)
-        line->visibilityChanged(false);
+    //qDebug() << "visible from " << visibleFirst << "to " << visibleLast - 1 << " total " << visibleLast - visibleFirst;
+}
+
+/**
+ * @brief Makes the line visible, moving the other lines if its height changed.
+ * @return True if other lines were moved.
+ */
+bool ChatLog::showLine(int row)
+{
+    ChatLine* line = lines[row].get();
 
-    visibleLines = newVisibleLines;
+    qreal oldHeight = line->sceneBoundingRect().height();
+    line->visibilityChanged(true);
+    qreal delta = line->sceneBoundingRect().height() - oldHeight;
 
-    // enforce order
-    std::sort(visibleLines.begin(), visibleLines.end(), ChatLine::lessThanRowIndex);
+    if (delta == 0.0)
+        return false;
 
-    //if (!visibleLines.empty())
-    //  qDebug() << "visible from " << visibleLines.first()->getRow() << "to " << visibleLines.last()->getRow() << " total " << visibleLines.size();
+    // move the smaller part of the log, growing the scene upwards is fine
+    if (row < lines.size() / 2)
+        reposition(0, row, -delta);
+    else if (row + 1 < lines.size())
+        reposition(row + 1, lines.size() - 1, delta);
+
+    return true;
 }
 
 void ChatLog::scrollContentsBy(int dx, int dy)
 {
     QGraphicsView::scrollContentsBy(dx, dy);
     checkVisibility();
+
+    // A positive dy means the user scrolled up
+    if (dy > 0 && verticalScrollBar()->value() == verticalScrollBar()->minimum())
+        emit topReached();
 }
 
 void ChatLog::resizeEvent(QResizeEvent* ev)
 {
     bool stb = stickToBottom();
 
-    if (ev->size().width() != ev->oldSize().width())
+    // The resize we get when shown again has no old size, the lines may already have the right width
+    if (ev->size().width() != ev->oldSize().width() && useableWidth() != workerWidth)
     {
         startResizeWorker();
         stb = false; // let the resize worker handle it
@@ -690,7 +1159,7 @@ void ChatLog::updateMultiSelectionRect()
         selBBox = selBBox.united(lines[selLastRow]->sceneBoundingRect());
 
         if (selGraphItem->rect() != selBBox)
-            scene->invalidate(selGraphItem->rect());
+            scene->invalidate(selGraphItem->rect(), QGraphicsScene::ItemLayer);
 
         selGraphItem->setRect(selBBox);
         selGraphItem->show();
@@ -701,7 +1170,11 @@ void ChatLog::updateMultiSelectionRect()
     }
 }
 
-void ChatLog::updateTypingNotification()
+/**
+ * @brief Moves the typing notification below the last line.
+ * @param relayout Lays it out even if it didn't move, after the lines were laid out again.
+ */
+void ChatLog::updateTypingNotification(bool relayout)
 {
     ChatLine* notification = typingNotification.get();
     if (!notification)
@@ -712,7 +1185,12 @@ void ChatLog::updateTypingNotification()
     if (!lines.empty())
         posY = lines.last()->sceneBoundingRect().bottom() + lineSpacing;
 
-    notification->layout(useableWidth(), QPointF(0.0, posY));
+    // every layout repaints the old and the new rect of the notification, even if they're the same
+    const QPointF pos(0.0, posY);
+    if (!relayout && notification->width == useableWidth() && notification->bbox.topLeft() == pos)
+        return;
+
+    notification->layout(useableWidth(), pos);
 }
 
 void ChatLog::updateBusyNotification()
@@ -720,7 +1198,11 @@ void ChatLog::updateBusyNotification()
     if (busyNotification.get())
     {
         //repoisition the busy notification (centered)
-        busyNotification->layout(useableWidth(), getVisibleRect().topLeft() + QPointF(0, getVisibleRect().height()/2.0));
+        const QPointF pos = getVisibleRect().topLeft() + QPointF(0, getVisibleRect().height()/2.0);
+        if (busyNotification->width == useableWidth() && busyNotification->bbox.topLeft() == pos)
+            return;
+
+        busyNotification->layout(useableWidth(), pos);
     }
 }
 
@@ -736,12 +1218,14 @@ ChatLine::Ptr ChatLog::findLineByPosY(qreal yPos) const
 
 QRectF ChatLog::calculateSceneRect() const
 {
+    // lines inserted on top are above the origin
+    qreal top = (lines.empty() ? 0.0 : lines.first()->sceneBoundingRect().top());
     qreal bottom = (lines.empty() ? 0.0 : lines.last()->sceneBoundingRect().bottom());
 
     if (typingNotification.get() != nullptr)
         bottom += typingNotification->sceneBoundingRect().height() + lineSpacing;
 
-    return QRectF(-margins.left(), -margins.top(), useableWidth(), bottom + margins.bottom() + margins.top());
+    return QRectF(-margins.left(), top - margins.top(), useableWidth(), bottom - top + margins.bottom() + margins.top());
 }
 
 void ChatLog::onSelectionTimerTimeout()
@@ -765,7 +1249,8 @@ void ChatLog::onWorkerTimeout()
 {
     // Fairly arbitrary but
     // large values will make the UI unresponsive
-    const int stepSize = 50;
+    // Precomputed text only needs its geometry applied, so we can do more at once
+    const int stepSize = workerPrecomputed ? 500 : 50;
 
     layout(workerLastIndex, workerLastIndex+stepSize, useableWidth());
     workerLastIndex += stepSize;
@@ -775,13 +1260,14 @@ void ChatLog::onWorkerTimeout()
     {
         workerTimer->stop();
 
-        // switch back to the scene containing the chat messages
-        setScene(scene);
+        // switch back to the scene containing the chat messages, unless we are still busy
+        if (!busy)
+            setScene(scene);
 
         // make sure everything gets updated
         updateSceneRect();
         checkVisibility();
-        updateTypingNotification();
+        updateTypingNotification(true);
         updateMultiSelectionRect();
 
         // scroll
@@ -794,10 +1280,38 @@ void ChatLog::onWorkerTimeout()
         workerAnchorLine = ChatLine::Ptr();
 
         // hidden during busy screen
-        verticalScrollBar()->show();
+        if (!busy)
+            verticalScrollBar()->show();
     }
 }
 
+void ChatLog::onLayoutBatchDone()
+{
+    // the batch that finished was cancelled since
+    if (!layoutBatch || layoutBatch->remaining > 0)
+        return;
+
+    for (const LayoutJob& job : layoutBatch->jobs)
+    {
+        ChatLine::Ptr line = job.line.lock();
+
+        // the content of the line changed while we were computing, the worker lays it out itself
+        if (!line || !line->isMaterialized() || job.col >= line->getColumnCount() ||
+                line->content[job.col] != job.text)
+            continue;
+
+        static_cast<Text*>(line->content[job.col])->setPrecomputedLayout(job.input, job.result);
+    }
+
+    layoutBatch.reset();
+
+    workerPrecomputed = true;
+    workerLastIndex = 0;
+    workerTimer->start();
+
+    verticalScrollBar()->hide();
+}
+
 void ChatLog::showEvent(QShowEvent*)
 {
     // Empty.
@@ -805,6 +1319,29 @@ void ChatLog::showEvent(QShowEvent*)
     // the scrollbar to move.
 }
 
+void ChatLog::hideEvent(QHideEvent* event)
+{
+    QGraphicsView::hideEvent(event);
+
+    // the documents of our lines won't be needed until we're shown again
+    DocumentCache::getInstance().trim();
+}
+
+void ChatLog::paintEvent(QPaintEvent* ev)
+{
+    TraceSpan span{"ChatLog::paint"};
+
+    qint64 pixels = 0;
+    for (const QRect& rect : ev->region().rects())
+        pixels += static_cast<qint64>(rect.width()) * rect.height();
+
+    ++repaints;
+    repaintedPixels += pixels;
+    Trace::count("ChatLog repainted pixels", pixels);
+
+    QGraphicsView::paintEvent(ev);
+}
+
 void ChatLog::focusInEvent(QFocusEvent* ev)
 {
     QGraphicsView::focusInEvent(ev);
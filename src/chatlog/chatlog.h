@@ -23,6 +23,8 @@
 #include <QGraphicsView>
 #include <QDateTime>
 #include <QMargins>
+#include <QThreadPool>
+#include <memory>
 
 #include "chatline.h"
 #include "chatmessage.h"
@@ -33,10 +35,21 @@ class QMouseEvent;
 class QTimer;
 class ChatLineContent;
 struct ToxFile;
+struct LayoutBatch;
 
 class ChatLog : public QGraphicsView
 {
     Q_OBJECT
+public:
+    struct Statistics
+    {
+        int lines = 0;          ///< Including the ones not laid out yet
+        int materialized = 0;   ///< Lines whose content is allocated, see setVirtualized
+        qint64 textBytes = 0;   ///< Size of the text of the materialized lines, a lower bound of their memory use
+        int repaints = 0;       ///< Paint events of the viewport since the log was created
+        qint64 repaintedPixels = 0; ///< Area they repainted, a spinner should only cost its own few pixels
+    };
+
 public:
     explicit ChatLog(QWidget* parent = 0);
     virtual ~ChatLog();
@@ -48,11 +61,23 @@ public:
     void clear();
     void copySelectedText(bool toSelectionBuffer = false) const;
     void setBusyNotification(ChatLine::Ptr notification);
+    /// Shows the busy notification instead of the chat lines, for example while loading history
+    void setBusy(bool newBusy);
     void setTypingNotification(ChatLine::Ptr notification);
     void setTypingNotificationVisible(bool visible);
     void scrollToLine(ChatLine::Ptr line);
     void selectAll();
     void forceRelayout();
+    /// The lines are still being laid out in the background, after a resize or forceRelayout
+    bool isLayingOut() const;
+    /// Frees the content of the lines far from the viewport, so memory stays flat in long-lived chats
+    void setVirtualized(bool enable);
+    /// Drops the oldest lines once there are more than maxLines, 0 keeps all of them
+    void setMaxLines(int maxLines);
+    /// Drops all but the newest keep lines, does nothing while the log is visible
+    void releaseLines(int keep);
+    /// Keeps the background in a pixmap, so small updates don't repaint it, enabled by default
+    void setBackgroundCached(bool enable);
 
     QString getSelectedText() const;
 
@@ -61,12 +86,15 @@ public:
 
     ChatLine::Ptr getTypingNotification() const;
     QVector<ChatLine::Ptr> getLines();
+    Statistics getStatistics() const;
     ChatLine::Ptr getLatestLine() const;
     // repetition interval sender name (sec)
     const uint repNameAfter = 5*60;
 
 signals:
     void selectionChanged();
+    void topReached(); ///< The view was scrolled up to its very first line
+    void linesTrimmed(); ///< The oldest lines were dropped to stay below the maximum
 
 protected:
     QRectF calculateSceneRect() const;
@@ -82,8 +110,14 @@ protected:
     void reposition(int start, int end, qreal deltaY);
     void updateSceneRect();
     void checkVisibility();
+    bool showLine(int row);
+    void updateMaterializedLines();
+    void trimLines();
+    void removeTopLines(int count);
     void scrollToBottom();
     void startResizeWorker();
+    bool startLayoutBatch();
+    void cancelLayoutBatch();
 
     virtual void mouseDoubleClickEvent(QMouseEvent* ev) final override;
     virtual void mousePressEvent(QMouseEvent* ev) final override;
@@ -92,11 +126,13 @@ protected:
     virtual void scrollContentsBy(int dx, int dy) final override;
     virtual void resizeEvent(QResizeEvent* ev) final override;
     virtual void showEvent(QShowEvent*) final override;
+    virtual void hideEvent(QHideEvent* event) final override;
     virtual void focusInEvent(QFocusEvent* ev) final override;
     virtual void focusOutEvent(QFocusEvent* ev) final override;
+    virtual void paintEvent(QPaintEvent* ev) final override;
 
     void updateMultiSelectionRect();
-    void updateTypingNotification();
+    void updateTypingNotification(bool relayout = false);
     void updateBusyNotification();
 
     ChatLine::Ptr findLineByPosY(qreal yPos) const;
@@ -104,6 +140,8 @@ protected:
 private slots:
     void onSelectionTimerTimeout();
     void onWorkerTimeout();
+    void onLayoutBatchDone();
+    void flushPendingLines();
 
 private:
     void retranslateUi();
@@ -126,7 +164,9 @@ private:
     QGraphicsScene* scene = nullptr;
     QGraphicsScene* busyScene = nullptr;
     QVector<ChatLine::Ptr> lines;
-    QList<ChatLine::Ptr> visibleLines;
+    QVector<ChatLine::Ptr> pendingLines; ///< Inserted at the bottom, but not laid out yet
+    int visibleFirst = 0; ///< The visible lines are the rows [visibleFirst, visibleLast)
+    int visibleLast = 0;
     ChatLine::Ptr typingNotification;
     ChatLine::Ptr busyNotification;
 
@@ -141,12 +181,33 @@ private:
     QGraphicsRectItem* selGraphItem = nullptr;
     QTimer* selectionTimer = nullptr;
     QTimer* workerTimer = nullptr;
+    QTimer* insertTimer = nullptr;
     AutoScrollDirection selectionScrollDir = NoDirection;
 
     //worker vars
     int workerLastIndex = 0;
     bool workerStb = false;
     ChatLine::Ptr workerAnchorLine;
+    bool workerPrecomputed = false; ///< Text geometry was computed by the layout pool beforehand
+    qreal workerWidth = -1; ///< Useable width of the last relayout, a resize to the same width doesn't need one
+
+    // lays out the text of large logs on other threads before the resize worker runs
+    QThreadPool layoutPool;
+    std::shared_ptr<LayoutBatch> layoutBatch;
+
+    // true while setBusy keeps the busy scene displayed
+    bool busy = false;
+
+    // virtualization, rows [materializedFirst, materializedLast) were materialized by the last update
+    bool virtualized = false;
+    int materializedFirst = -1;
+    int materializedLast = -1;
+
+    int maxLines = 0;
+
+    // repaint statistics
+    int repaints = 0;
+    qint64 repaintedPixels = 0;
 
     // layout
     QMargins margins = QMargins(10,10,10,10);
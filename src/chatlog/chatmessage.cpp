@@ -19,11 +19,14 @@
 
 #include "chatmessage.h"
 #include "chatlinecontentproxy.h"
+#include "messagecache.h"
+#include "messageformatter.h"
 #include "content/text.h"
 #include "content/timestamp.h"
 #include "content/spinner.h"
 #include "content/filetransferwidget.h"
 #include "content/image.h"
+#include "content/imagepreview.h"
 #include "content/notificationicon.h"
 
 #include <QDebug>
@@ -40,49 +43,85 @@ ChatMessage::ChatMessage()
 
 }
 
-ChatMessage::Ptr ChatMessage::createChatMessage(const QString &sender, const QString &rawMessage, MessageType type, bool isMe, const QDateTime &date)
+ChatMessage::Ptr ChatMessage::createChatMessage(const QString &sender, const QString &rawMessage, MessageType type, bool isMe, const QDateTime &date, qint64 historyId)
 {
     ChatMessage::Ptr msg = ChatMessage::Ptr(new ChatMessage);
+    msg->recipe.reset(new Recipe{sender, rawMessage, type, isMe, date, historyId});
+    msg->addMessageColumns(sender, rawMessage, type, isMe, date, historyId);
 
-    QString text = rawMessage.toHtmlEscaped();
-    QString senderText = sender;
+    if (type == ACTION)
+        msg->setAsAction();
+
+    return msg;
+}
+
+void ChatMessage::addMessageColumns(const QString &sender, const QString &rawMessage, MessageType type, bool isMe, const QDateTime &date, qint64 historyId)
+{
+    QString senderText = type == ACTION ? QString("*") : sender;
 
     const QColor actionColor = QColor("#1818FF"); // has to match the color in innerStyle.css (div.action)
 
-    //smileys
-    if (Settings::getInstance().getUseEmoticons())
-        text = SmileyPack::getInstance().smileyfied(text);
+    Text* messageText = new Text(QString(), Style::getFont(Style::Big), false, ((type == ACTION) && isMe) ? QString("%1 %2").arg(sender, rawMessage) : rawMessage);
+
+    // history messages are only formatted once they're shown, unless we did it before
+    if (historyId >= 0 && MessageCache::getInstance().find(historyId, rawMessage).isNull())
+        messageText->setDeferredText([sender, rawMessage, type, historyId]() { return formatMessage(sender, rawMessage, type, historyId); });
+    else
+        messageText->setText(formatMessage(sender, rawMessage, type, historyId));
 
-    //quotes (green text)
-    text = detectQuotes(detectAnchors(text), type);
+    // Note: Eliding cannot be enabled for RichText items. (QTBUG-17207)
+    addColumn(new Text(senderText, isMe ? Style::getFont(Style::BigBold) : Style::getFont(Style::Big), true, sender, type == ACTION ? actionColor : Qt::black), ColumnFormat(NAME_COL_WIDTH, ColumnFormat::FixedSize, ColumnFormat::Right));
+    addColumn(messageText, ColumnFormat(1.0, ColumnFormat::VariableSize));
+
+    // Pending messages show a spinner until markAsSent
+    if (date.isNull())
+        addColumn(new Spinner(":/ui/chatArea/spinner.svg", QSize(16, 16), 360.0/1.6), ColumnFormat(TIME_COL_WIDTH, ColumnFormat::FixedSize, ColumnFormat::Right));
+    else
+        addColumn(new Timestamp(date, Settings::getInstance().getTimestampFormat(), Style::getFont(Style::Big)), ColumnFormat(TIME_COL_WIDTH, ColumnFormat::FixedSize, ColumnFormat::Right));
+}
+
+QString ChatMessage::formatMessage(const QString& sender, const QString& rawMessage, MessageType type, qint64 historyId)
+{
+    QString text;
+    if (historyId >= 0)
+        text = MessageCache::getInstance().find(historyId, rawMessage);
 
-    //markdown
-    if (Settings::getInstance().getMarkdownPreference() != NONE)
-        text = detectMarkdown(text);
+    if (text.isNull())
+    {
+        // don't quote the first line of actions, it starts with the sender's name
+        MessageFormatter formatter(Settings::getInstance().getUseEmoticons(), Settings::getInstance().getMarkdownPreference());
+        text = formatter.format(rawMessage, type != ACTION);
+
+        // without the smileys of a pack that is still loading, the text would stay wrong
+        if (historyId >= 0 && formatter.isComplete())
+            MessageCache::getInstance().insert(historyId, rawMessage, text);
+    }
 
     switch(type)
     {
     case ACTION:
-        senderText = "*";
-        text = wrapDiv(QString("%1 %2").arg(sender.toHtmlEscaped(), text), "action");
-        msg->setAsAction();
-        break;
+        return wrapDiv(QString("%1 %2").arg(sender.toHtmlEscaped(), text), "action");
     case ALERT:
-        text = wrapDiv(text, "alert");
-        break;
+        return wrapDiv(text, "alert");
     default:
-        text = wrapDiv(text, "msg");
+        return wrapDiv(text, "msg");
     }
+}
 
-    // Note: Eliding cannot be enabled for RichText items. (QTBUG-17207)
-    msg->addColumn(new Text(senderText, isMe ? Style::getFont(Style::BigBold) : Style::getFont(Style::Big), true, sender, type == ACTION ? actionColor : Qt::black), ColumnFormat(NAME_COL_WIDTH, ColumnFormat::FixedSize, ColumnFormat::Right));
-    msg->addColumn(new Text(text, Style::getFont(Style::Big), false, ((type == ACTION) && isMe) ? QString("%1 %2").arg(sender, rawMessage) : rawMessage), ColumnFormat(1.0, ColumnFormat::VariableSize));
-    msg->addColumn(new Spinner(":/ui/chatArea/spinner.svg", QSize(16, 16), 360.0/1.6), ColumnFormat(TIME_COL_WIDTH, ColumnFormat::FixedSize, ColumnFormat::Right));
+bool ChatMessage::canDematerialize() const
+{
+    // A pending message still needs its spinner
+    return recipe && !recipe->date.isNull();
+}
 
-    if (!date.isNull())
-        msg->markAsSent(date);
+void ChatMessage::createContent()
+{
+    addMessageColumns(recipe->sender, recipe->rawMessage, recipe->type, recipe->isMe, recipe->date, recipe->historyId);
 
-    return msg;
+    if (senderHidden)
+        getContent(0)->hide();
+    if (dateHidden)
+        getContent(2)->hide();
 }
 
 ChatMessage::Ptr ChatMessage::createChatInfoMessage(const QString &rawMessage, SystemMessageType type, const QDateTime &date)
@@ -116,6 +155,16 @@ ChatMessage::Ptr ChatMessage::createFileTransferMessage(const QString& sender, T
     return msg;
 }
 
+ChatMessage::Ptr ChatMessage::createImagePreviewMessage(const QString& filePath)
+{
+    ChatMessage::Ptr msg = ChatMessage::Ptr(new ChatMessage);
+
+    msg->addColumn(new Text("", Style::getFont(Style::Big), true), ColumnFormat(NAME_COL_WIDTH, ColumnFormat::FixedSize, ColumnFormat::Right));
+    msg->addColumn(new ImagePreview(filePath), ColumnFormat(1.0, ColumnFormat::VariableSize, ColumnFormat::Left));
+
+    return msg;
+}
+
 ChatMessage::Ptr ChatMessage::createTypingNotification()
 {
     ChatMessage::Ptr msg = ChatMessage::Ptr(new ChatMessage);
@@ -144,12 +193,48 @@ ChatMessage::Ptr ChatMessage::createBusyNotification()
 
 void ChatMessage::markAsSent(const QDateTime &time)
 {
+    if (recipe)
+        recipe->date = time;
+
     // remove the spinner and replace it by $time
     replaceContent(2, new Timestamp(time, Settings::getInstance().getTimestampFormat(), Style::getFont(Style::Big)));
 }
 
+QDateTime ChatMessage::getDate() const
+{
+    return recipe ? recipe->date : QDateTime();
+}
+
+qint64 ChatMessage::getHistoryId() const
+{
+    return recipe ? recipe->historyId : -1;
+}
+
+QString ChatMessage::getColumnText(int col) const
+{
+    if (isMaterialized())
+        return ChatLine::getColumnText(col);
+
+    // the same texts as the columns made by addMessageColumns
+    switch (col)
+    {
+    case 0:
+        return recipe->sender;
+    case 1:
+        return toString();
+    case 2:
+        return recipe->date.toString(Settings::getInstance().getTimestampFormat());
+    default:
+        return QString();
+    }
+}
+
 QString ChatMessage::toString() const
 {
+    if (!isMaterialized())
+        return recipe->type == ACTION && recipe->isMe ? QString("%1 %2").arg(recipe->sender, recipe->rawMessage)
+                                                      : recipe->rawMessage;
+
     ChatLineContent* c = getContent(1);
     if (c)
         return c->getText();
@@ -169,6 +254,10 @@ void ChatMessage::setAsAction()
 
 void ChatMessage::hideSender()
 {
+    senderHidden = true;
+    if (!isMaterialized())
+        return;
+
     ChatLineContent* c = getContent(0);
     if (c)
         c->hide();
@@ -176,136 +265,15 @@ void ChatMessage::hideSender()
 
 void ChatMessage::hideDate()
 {
+    dateHidden = true;
+    if (!isMaterialized())
+        return;
+
     ChatLineContent* c = getContent(2);
     if (c)
         c->hide();
 }
 
-QString ChatMessage::detectMarkdown(const QString &str)
-{
-    QString out = str;
-
-    // Create regex for certain markdown syntax
-    QRegExp exp("(\\*\\*)([^\\*\\*]{2,})(\\*\\*)"   // Bold    **text**
-                "|(\\*)([^\\*]{2,})(\\*)"           // Italics *text*
-                "|(\\_)([^\\_]{2,})(\\_)"           // Italics _text_
-                "|(\\_\\_)([^\\_\\_]{2,})(\\_\\_)"  // Bold    __text__
-                "|(\\-)([^\\-]{2,})(\\-)"           // Underline  -text-
-                "|(\\~)([^\\~]{2,})(\\~)"           // Strike  ~text~
-                "|(\\~~)([^\\~\\~]{2,})(\\~~)"      // Strike  ~~text~~
-                "|(\\`)([^\\`]{2,})(\\`)"           // Codeblock  `text`
-                );
-
-    int offset = 0;
-    while ((offset = exp.indexIn(out, offset)) != -1)
-    {
-        QString snipCheck = out.mid(offset-1,exp.cap(0).length()+2);
-        QString snippet = exp.cap(0).trimmed();
-        QString htmledSnippet;
-
-        // Only parse if surrounded by spaces, newline(s) and/or beginning/end of line
-        if ((snipCheck.startsWith(' ') || snipCheck.startsWith('>') || offset == 0)
-            && ((snipCheck.endsWith(' ') || snipCheck.endsWith('<')) || offset + snippet.length() == out.length()))
-        {
-            int mul = 0; // Determines how many characters to strip from markdown text
-            // Set mul depending on markdownPreference
-            if (Settings::getInstance().getMarkdownPreference() == WITHOUT_CHARS)
-                mul = 2;
-
-            // Match captured string to corresponding md format
-            if (exp.cap(1) == "**") // Bold **text**
-                htmledSnippet = QString(" <b>%1</b> ").arg(snippet.mid(mul,snippet.length()-2*mul));
-            else if (exp.cap(4) == "*" && snippet.length() > 2) // Italics *text*
-                htmledSnippet = QString(" <i>%1</i> ").arg(snippet.mid(mul/2,snippet.length()-mul));
-            else if (exp.cap(7) == "_" && snippet.length() > 2) // Italics _text_
-                htmledSnippet = QString(" <i>%1</i> ").arg(snippet.mid(mul/2,snippet.length()-mul));
-            else if (exp.cap(10) == "__"&& snippet.length() > 4) // Bold __text__
-                htmledSnippet = QString(" <b>%1</b> ").arg(snippet.mid(mul,snippet.length()-2*mul));
-            else if (exp.cap(13) == "-" && snippet.length() > 2) // Underline -text-
-                htmledSnippet = QString(" <u>%1</u> ").arg(snippet.mid(mul/2,snippet.length()-mul));
-            else if (exp.cap(16) == "~" && snippet.length() > 2) // Strikethrough ~text~
-                htmledSnippet = QString(" <s>%1</s> ").arg(snippet.mid(mul/2,snippet.length()-mul));
-            else if (exp.cap(19) == "~~" && snippet.length() > 4) // Strikethrough ~~text~~
-                htmledSnippet = QString(" <s>%1</s> ").arg(snippet.mid(mul,snippet.length()-2*mul));
-            else if (exp.cap(22) == "`" && snippet.length() > 2) // Codeblock `text`
-                htmledSnippet = QString("<font color=#595959><code>%1</code></font>").arg(snippet.mid(mul/2,snippet.length()-mul));
-            else
-                htmledSnippet = snippet;
-            out.replace(offset, exp.cap().length(), htmledSnippet);
-            offset += htmledSnippet.length();
-        } else
-            offset += snippet.length();
-    }
-
-    return out;
-}
-
-QString ChatMessage::detectAnchors(const QString &str)
-{
-    QString out = str;
-
-    // detect URIs
-    QRegExp exp("("
-                "(?:\\b)((www\\.)|(http[s]?|ftp)://)" // (protocol)://(printable - non-special character)
-                // http://ONEORMOREALHPA-DIGIT
-                "\\w+\\S+)" // any other character, lets domains and other
-                // ↓ link to a file, or samba share
-                //   https://en.wikipedia.org/wiki/File_URI_scheme
-                "|(?:\\b)((file|smb)://)([\\S| ]*)"
-                "|(?:\\b)(tox:[a-zA-Z\\d]{76})" //link with full user address
-                "|(?:\\b)(mailto:\\S+@\\S+\\.\\S+)" //@mail link
-                "|(?:\\b)(tox:\\S+@\\S+)"); // starts with `tox` then : and only alpha-digits till the end
-                // also accepts tox:agilob@net as simplified TOX ID
-
-    int offset = 0;
-    while ((offset = exp.indexIn(out, offset)) != -1)
-    {
-        QString url = exp.cap();
-        // If there's a trailing " it's a HTML attribute, e.g. a smiley img's title=":tox:"
-        if (url == "tox:\"")
-        {
-            offset += url.length();
-            continue;
-        }
-        QString htmledUrl;
-        // add scheme if not specified
-        if (exp.cap(2) == "www.")
-            htmledUrl = QString("<a href=\"http://%1\">%1</a>").arg(url);
-        else
-            htmledUrl = QString("<a href=\"%1\">%1</a>").arg(url);
-        out.replace(offset, exp.cap().length(), htmledUrl);
-        offset += htmledUrl.length();
-    }
-
-    return out;
-}
-
-QString ChatMessage::detectQuotes(const QString& str, MessageType type)
-{
-    // detect text quotes
-    QStringList messageLines = str.split("\n");
-    QString quotedText;
-    for (int i = 0; i < messageLines.size(); ++i)
-    {
-        // don't quote first line in action message. This makes co-existence of
-        // quotes and action messages possible, since only first line can cause
-        // problems in case where there is quote in it used.
-        if (QRegExp("^(&gt;|＞).*").exactMatch(messageLines[i])) {
-            if (i > 0 || type != ACTION)
-                quotedText += "<span class=quote>" + messageLines[i] + "</span>";
-            else
-                quotedText += messageLines[i];
-        } else {
-            quotedText += messageLines[i];
-        }
-
-        if (i < messageLines.size() - 1)
-            quotedText += "<br/>";
-    }
-
-    return quotedText;
-}
-
 QString ChatMessage::wrapDiv(const QString &str, const QString &div)
 {
     return QString("<p class=%1>%2</p>").arg(div, /*QChar(0x200E) + */QString(str));
@@ -47,9 +47,12 @@ public:
 
     ChatMessage();
 
-    static ChatMessage::Ptr createChatMessage(const QString& sender, const QString& rawMessage, MessageType type, bool isMe, const QDateTime& date = QDateTime());
+    /// historyId is the id of the message in the history, if it has one, to reuse its formatted text
+    static ChatMessage::Ptr createChatMessage(const QString& sender, const QString& rawMessage, MessageType type, bool isMe, const QDateTime& date = QDateTime(), qint64 historyId = -1);
     static ChatMessage::Ptr createChatInfoMessage(const QString& rawMessage, SystemMessageType type, const QDateTime& date);
     static ChatMessage::Ptr createFileTransferMessage(const QString& sender, ToxFile file, bool isMe, const QDateTime& date);
+    /// Shows a transferred image inline, it's only decoded when it scrolls into view
+    static ChatMessage::Ptr createImagePreviewMessage(const QString& filePath);
     static ChatMessage::Ptr createTypingNotification();
     static ChatMessage::Ptr createBusyNotification();
 
@@ -59,15 +62,39 @@ public:
     void setAsAction();
     void hideSender();
     void hideDate();
+    /// Of a message made by createChatMessage, null while it's being sent
+    QDateTime getDate() const;
+    /// The historyId given to createChatMessage, or -1
+    qint64 getHistoryId() const;
+    virtual QString getColumnText(int col) const final override;
 
 protected:
-    static QString detectMarkdown(const QString& str);
-    static QString detectAnchors(const QString& str);
-    static QString detectQuotes(const QString& str, MessageType type);
+    /// Messages created by createChatMessage can be dematerialized once they're sent
+    virtual bool canDematerialize() const final override;
+    virtual void createContent() final override;
+    void addMessageColumns(const QString& sender, const QString& rawMessage, MessageType type, bool isMe,
+                           const QDateTime& date, qint64 historyId);
+
     static QString wrapDiv(const QString& str, const QString& div);
+    /// Returns the rich text of a message, from the MessageCache if historyId is in it
+    static QString formatMessage(const QString& sender, const QString& rawMessage, MessageType type, qint64 historyId);
 
 private:
+    /// What createContent needs to recreate the columns of a message made by createChatMessage
+    struct Recipe
+    {
+        QString sender;
+        QString rawMessage;
+        MessageType type;
+        bool isMe;
+        QDateTime date;
+        qint64 historyId;
+    };
+
     bool action = false;
+    bool senderHidden = false;
+    bool dateHidden = false;
+    std::unique_ptr<Recipe> recipe;
 };
 
 #endif // CHATMESSAGE_H
@@ -18,10 +18,12 @@
 */
 
 #include "filetransferwidget.h"
+#include "imagepreview.h"
 #include "ui_filetransferwidget.h"
 
 #include "src/nexus.h"
 #include "src/core/core.h"
+#include "src/persistence/profile.h"
 #include "src/widget/gui.h"
 #include "src/widget/style.h"
 #include "src/widget/widget.h"
@@ -31,11 +33,15 @@
 #include <QFileDialog>
 #include <QFile>
 #include <QBuffer>
+#include <QCursor>
 #include <QMessageBox>
 #include <QDesktopServices>
 #include <QDesktopWidget>
+#include <QFutureWatcher>
 #include <QPainter>
+#include <QToolTip>
 #include <QVariantAnimation>
+#include <QtConcurrent/QtConcurrentRun>
 #include <QDebug>
 
 #include <math.h>
@@ -44,7 +50,6 @@ FileTransferWidget::FileTransferWidget(QWidget *parent, ToxFile file)
     : QWidget(parent)
     , ui(new Ui::FileTransferWidget)
     , fileInfo(file)
-    , lastTick(QTime::currentTime())
     , backgroundColor(Style::getColor(Style::LightGrey))
     , buttonColor(Style::getColor(Style::Yellow))
 {
@@ -87,6 +92,7 @@ FileTransferWidget::FileTransferWidget(QWidget *parent, ToxFile file)
     connect(ui->topButton, &QPushButton::clicked, this, &FileTransferWidget::onTopButtonClicked);
     connect(ui->bottomButton, &QPushButton::clicked, this, &FileTransferWidget::onBottomButtonClicked);
     connect(ui->previewButton, &QPushButton::clicked, this, &FileTransferWidget::onPreviewButtonClicked);
+    ui->previewButton->installEventFilter(this);
 
     setupButtons();
 
@@ -215,83 +221,58 @@ void FileTransferWidget::paintEvent(QPaintEvent *)
     }
 }
 
-void FileTransferWidget::onFileTransferInfo(ToxFile file)
+void FileTransferWidget::onFileTransferInfo(const ToxFile::Ptr& file)
 {
-    QTime now = QTime::currentTime();
-    qint64 dt = lastTick.msecsTo(now); //ms
-
-    if (fileInfo != file || dt < 1000)
+    if (fileInfo != *file)
         return;
 
-    fileInfo = file;
-
-    if (fileInfo.status == ToxFile::TRANSMITTING)
-    {
-        // update progress
-        qreal progress = static_cast<qreal>(file.bytesSent) / static_cast<qreal>(file.filesize);
-        ui->progressBar->setValue(static_cast<int>(progress * 100.0));
-
-        // ETA, speed
-        qreal deltaSecs = dt / 1000.0;
-
-        // (can't use ::abs or ::max on unsigned types substraction, they'd just overflow)
-        quint64 deltaBytes = file.bytesSent > lastBytesSent
-                                    ? file.bytesSent - lastBytesSent
-                                    : lastBytesSent - file.bytesSent;
-        qreal bytesPerSec = static_cast<int>(static_cast<qreal>(deltaBytes) / deltaSecs);
+    fileInfo = *file;
 
-        // calculate mean
-        meanIndex = meanIndex % TRANSFER_ROLLING_AVG_COUNT;
-        meanData[meanIndex++] = bytesPerSec;
-
-        qreal meanBytesPerSec = 0.0;
-        for (size_t i = 0; i < TRANSFER_ROLLING_AVG_COUNT; ++i)
-            meanBytesPerSec += meanData[i];
+    if (fileInfo.status != ToxFile::TRANSMITTING)
+        return;
 
-        meanBytesPerSec /= static_cast<qreal>(TRANSFER_ROLLING_AVG_COUNT);
+    // Core sends a smoothed rate twice a second, only repaint when what we show changes
+    int progress = static_cast<int>(static_cast<qreal>(file->bytesSent) / static_cast<qreal>(file->filesize) * 100.0);
 
-        // update UI
-        if (meanBytesPerSec > 0)
-        {
-            // ETA
-            QTime toGo = QTime(0,0).addSecs((file.filesize - file.bytesSent) / meanBytesPerSec);
-            QString format = toGo.hour() > 0 ? "hh:mm:ss" : "mm:ss";
-            ui->etaLabel->setText(toGo.toString(format));
-        }
-        else
-        {
-            ui->etaLabel->setText("");
-        }
+    QString eta;
+    if (file->bytesPerSec > 0)
+    {
+        QTime toGo = QTime(0,0).addSecs((file->filesize - file->bytesSent) / file->bytesPerSec);
+        QString format = toGo.hour() > 0 ? "hh:mm:ss" : "mm:ss";
+        eta = toGo.toString(format);
+    }
 
-        ui->progressLabel->setText(getHumanReadableSize(meanBytesPerSec) + "/s");
+    QString speed = getHumanReadableSize(static_cast<qint64>(file->bytesPerSec)) + "/s";
 
-        lastBytesSent = file.bytesSent;
-    }
+    if (progress == ui->progressBar->value() && eta == ui->etaLabel->text()
+            && speed == ui->progressLabel->text())
+        return;
 
-    lastTick = now;
+    ui->progressBar->setValue(progress);
+    ui->etaLabel->setText(eta);
+    ui->progressLabel->setText(speed);
 
-    // trigger repaint
     update();
 }
 
-void FileTransferWidget::onFileTransferAccepted(ToxFile file)
+void FileTransferWidget::onFileTransferAccepted(const ToxFile::Ptr& file)
 {
-    if (fileInfo != file)
+    if (fileInfo != *file)
         return;
 
-    fileInfo = file;
+    fileInfo = *file;
 
     setBackgroundColor(Style::getColor(Style::LightGrey), false);
 
     setupButtons();
 }
 
-void FileTransferWidget::onFileTransferCancelled(ToxFile file)
+void FileTransferWidget::onFileTransferCancelled(const ToxFile::Ptr& file)
 {
-    if (fileInfo != file)
+    if (fileInfo != *file)
         return;
 
-    fileInfo = file;
+    fileInfo = *file;
 
     setBackgroundColor(Style::getColor(Style::Red), true);
 
@@ -301,52 +282,42 @@ void FileTransferWidget::onFileTransferCancelled(ToxFile file)
     disconnect(Core::getInstance(), 0, this, 0);
 }
 
-void FileTransferWidget::onFileTransferPaused(ToxFile file)
+void FileTransferWidget::onFileTransferPaused(const ToxFile::Ptr& file)
 {
-    if (fileInfo != file)
+    if (fileInfo != *file)
         return;
 
-    fileInfo = file;
+    fileInfo = *file;
 
     ui->etaLabel->setText("");
     ui->progressLabel->setText(tr("Paused", "file transfer widget"));
 
-    // reset mean
-    meanIndex = 0;
-    for (size_t i=0; i<TRANSFER_ROLLING_AVG_COUNT; ++i)
-        meanData[i] = 0.0;
-
     setBackgroundColor(Style::getColor(Style::LightGrey), false);
 
     setupButtons();
 }
 
-void FileTransferWidget::onFileTransferResumed(ToxFile file)
+void FileTransferWidget::onFileTransferResumed(const ToxFile::Ptr& file)
 {
-    if (fileInfo != file)
+    if (fileInfo != *file)
         return;
 
-    fileInfo = file;
+    fileInfo = *file;
 
     ui->etaLabel->setText("");
     ui->progressLabel->setText(tr("Resuming...", "file transfer widget"));
 
-    // reset mean
-    meanIndex = 0;
-    for (size_t i=0; i<TRANSFER_ROLLING_AVG_COUNT; ++i)
-        meanData[i] = 0.0;
-
     setBackgroundColor(Style::getColor(Style::LightGrey), false);
 
     setupButtons();
 }
 
-void FileTransferWidget::onFileTransferFinished(ToxFile file)
+void FileTransferWidget::onFileTransferFinished(const ToxFile::Ptr& file)
 {
-    if (fileInfo != file)
+    if (fileInfo != *file)
         return;
 
-    fileInfo = file;
+    fileInfo = *file;
 
     setBackgroundColor(Style::getColor(Style::Green), true);
 
@@ -363,6 +334,14 @@ void FileTransferWidget::onFileTransferFinished(ToxFile file)
     ui->bottomButton->setToolTip(tr("Open file directory"));
     ui->bottomButton->show();
 
+    // so both ends can compare what went through
+    if (!fileInfo.hash.isEmpty())
+    {
+        QString hash = QString::fromLatin1(fileInfo.hash.toHex());
+        ui->filenameLabel->setToolTip(tr("BLAKE2b checksum: %1", "file transfer widget").arg(hash));
+        qDebug() << "File transfer of" << fileInfo.filePath << "finished, BLAKE2b" << hash;
+    }
+
     // preview
     if (fileInfo.direction == ToxFile::RECEIVING)
         showPreview(fileInfo.filePath);
@@ -370,7 +349,7 @@ void FileTransferWidget::onFileTransferFinished(ToxFile file)
     disconnect(Core::getInstance(), 0, this, 0);
 }
 
-void FileTransferWidget::fileTransferRemotePausedUnpaused(ToxFile file, bool paused)
+void FileTransferWidget::fileTransferRemotePausedUnpaused(const ToxFile::Ptr& file, bool paused)
 {
     if (paused)
         onFileTransferPaused(file);
@@ -378,11 +357,20 @@ void FileTransferWidget::fileTransferRemotePausedUnpaused(ToxFile file, bool pau
         onFileTransferResumed(file);
 }
 
-void FileTransferWidget::fileTransferBrokenUnbroken(ToxFile file, bool broken)
+void FileTransferWidget::fileTransferBrokenUnbroken(const ToxFile::Ptr& file, bool broken)
 {
-    /// TODO: Handle broken transfer differently once we have resuming code
-    if (broken)
-        onFileTransferCancelled(file);
+    if (fileInfo != *file)
+        return;
+
+    if (!broken)
+    {
+        onFileTransferResumed(file);
+        return;
+    }
+
+    // it carries on when the friend is back, until then it's as good as paused
+    onFileTransferPaused(file);
+    ui->progressLabel->setText(tr("Waiting for friend", "file transfer widget"));
 }
 
 QString FileTransferWidget::getHumanReadableSize(qint64 size)
@@ -433,8 +421,20 @@ void FileTransferWidget::setupButtons()
         setButtonColor(Style::getColor(Style::LightGrey));
         break;
 
-    case ToxFile::STOPPED:
     case ToxFile::BROKEN:
+        // there's nothing to accept or resume until the friend is back
+        ui->topButton->setIcon(QIcon(":/ui/fileTransferInstance/pause.svg"));
+        ui->topButton->setObjectName("pause");
+        ui->topButton->setToolTip(tr("Waiting for friend"));
+
+        ui->bottomButton->setIcon(QIcon(":/ui/fileTransferInstance/no.svg"));
+        ui->bottomButton->setObjectName("cancel");
+        ui->bottomButton->setToolTip(tr("Cancel transfer"));
+
+        setButtonColor(Style::getColor(Style::LightGrey));
+        break;
+
+    case ToxFile::STOPPED:
         ui->bottomButton->setIcon(QIcon(":/ui/fileTransferInstance/no.svg"));
         ui->bottomButton->setObjectName("cancel");
         ui->bottomButton->setToolTip(tr("Cancel transfer"));
@@ -497,32 +497,97 @@ void FileTransferWidget::handleButton(QPushButton *btn)
 
 void FileTransferWidget::showPreview(const QString &filename)
 {
-    static const QStringList previewExtensions = { "png", "jpeg", "jpg", "gif", "svg",
-                                                   "PNG", "JPEG", "JPG", "GIF", "SVG" };
+    if (ImagePreview::canPreview(filename))
+    {
+        previewPath = filename;
+        if (visible)
+            loadPreview();
+    }
+}
+
+void FileTransferWidget::visibilityChanged(bool visible)
+{
+    this->visible = visible;
+    if (visible)
+        loadPreview();
+}
 
-    if (previewExtensions.contains(QFileInfo(filename).suffix()))
+/**
+@brief Shows the preview icon once its thumbnail is decoded in the background.
+*/
+void FileTransferWidget::loadPreview()
+{
+    if (previewPath.isEmpty() || previewLoading || !ui->previewButton->isHidden())
+        return;
+
+    // Subtract to make border visible
+    const int size = qMax(ui->previewButton->width(), ui->previewButton->height()) - 4;
+
+    previewLoading = true;
+    QFutureWatcher<QImage>* watcher = new QFutureWatcher<QImage>(this);
+    connect(watcher, &QFutureWatcher<QImage>::finished, this, [=]()
     {
-        // Subtract to make border visible
-        const int size = qMax(ui->previewButton->width(), ui->previewButton->height()) - 4;
+        previewLoading = false;
+        const QImage image = watcher->result();
+        watcher->deleteLater();
+        if (image.isNull())
+            return;
 
-        const QImage image = QImage(filename);
         const QPixmap iconPixmap = scaleCropIntoSquare(QPixmap::fromImage(image), size);
-
         ui->previewButton->setIcon(QIcon(iconPixmap));
         ui->previewButton->setIconSize(iconPixmap.size());
         ui->previewButton->show();
-        // Show mouseover preview, but make sure it's not larger than 50% of the screen width/height
-        const QRect desktopSize = QApplication::desktop()->screenGeometry();
-        const QImage previewImage = image.scaled(0.5 * desktopSize.width(),
-                                               0.5 * desktopSize.height(),
-                                               Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    });
+    watcher->setFuture(Nexus::getProfile()->loadThumbnailAsync(previewPath, QSize(size, size)));
+}
+
+bool FileTransferWidget::eventFilter(QObject* object, QEvent* event)
+{
+    // the mouseover preview is only decoded when asked for, and not kept afterwards
+    if (object == ui->previewButton && event->type() == QEvent::ToolTip)
+    {
+        showPreviewTooltip();
+        return true;
+    }
+
+    return QWidget::eventFilter(object, event);
+}
+
+void FileTransferWidget::showPreviewTooltip()
+{
+    if (previewPath.isEmpty() || tooltipLoading)
+        return;
+
+    // Show mouseover preview, but make sure it's not larger than 50% of the screen width/height
+    const QRect desktopSize = QApplication::desktop()->screenGeometry();
+    const QSize previewSize(0.5 * desktopSize.width(), 0.5 * desktopSize.height());
+    QFuture<QImage> thumbnail = Nexus::getProfile()->loadThumbnailAsync(previewPath, previewSize,
+                                                                        Qt::KeepAspectRatio);
+
+    tooltipLoading = true;
+    QFutureWatcher<QString>* watcher = new QFutureWatcher<QString>(this);
+    connect(watcher, &QFutureWatcher<QString>::finished, this, [=]()
+    {
+        tooltipLoading = false;
+        const QString tooltip = watcher->result();
+        watcher->deleteLater();
+        if (!tooltip.isEmpty() && ui->previewButton->underMouse())
+            QToolTip::showText(QCursor::pos(), tooltip, ui->previewButton);
+    });
+    // encoding it for the rich text tooltip takes a while too
+    watcher->setFuture(QtConcurrent::run([thumbnail]()
+    {
+        const QImage previewImage = thumbnail.result();
+        if (previewImage.isNull())
+            return QString();
+
         QByteArray imageData;
         QBuffer buffer(&imageData);
         buffer.open(QIODevice::WriteOnly);
         previewImage.save(&buffer, "PNG");
         buffer.close();
-        ui->previewButton->setToolTip("<img src=data:image/png;base64," + imageData.toBase64() + "/>");
-    }
+        return QString("<img src=data:image/png;base64," + imageData.toBase64() + "/>");
+    }));
 }
 
 void FileTransferWidget::onTopButtonClicked()
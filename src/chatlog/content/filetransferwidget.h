@@ -42,19 +42,21 @@ public:
     explicit FileTransferWidget(QWidget *parent, ToxFile file);
     virtual ~FileTransferWidget();
     void autoAcceptTransfer(const QString& path);
+    static QString getHumanReadableSize(qint64 size);
+    /// Called by the chat log as the line scrolls in and out of view, the preview is only loaded once it's seen
+    void visibilityChanged(bool visible);
 
 protected slots:
-    void onFileTransferInfo(ToxFile file);
-    void onFileTransferAccepted(ToxFile file);
-    void onFileTransferCancelled(ToxFile file);
-    void onFileTransferPaused(ToxFile file);
-    void onFileTransferResumed(ToxFile file);
-    void onFileTransferFinished(ToxFile file);
-    void fileTransferRemotePausedUnpaused(ToxFile file, bool paused);
-    void fileTransferBrokenUnbroken(ToxFile file, bool broken);
+    void onFileTransferInfo(const ToxFile::Ptr& file);
+    void onFileTransferAccepted(const ToxFile::Ptr& file);
+    void onFileTransferCancelled(const ToxFile::Ptr& file);
+    void onFileTransferPaused(const ToxFile::Ptr& file);
+    void onFileTransferResumed(const ToxFile::Ptr& file);
+    void onFileTransferFinished(const ToxFile::Ptr& file);
+    void fileTransferRemotePausedUnpaused(const ToxFile::Ptr& file, bool paused);
+    void fileTransferBrokenUnbroken(const ToxFile::Ptr& file, bool broken);
 
 protected:
-    QString getHumanReadableSize(qint64 size);
     void hideWidgets();
     void setupButtons();
     void handleButton(QPushButton* btn);
@@ -66,6 +68,7 @@ protected:
     bool drawButtonAreaNeeded() const;
 
     virtual void paintEvent(QPaintEvent*) final override;
+    bool eventFilter(QObject* object, QEvent* event) final override;
 
 private slots:
     void onTopButtonClicked();
@@ -74,20 +77,20 @@ private slots:
 
 private:
     static QPixmap scaleCropIntoSquare(const QPixmap &source, int targetSize);
+    void loadPreview();
+    void showPreviewTooltip();
 
 private:
     Ui::FileTransferWidget *ui;
     ToxFile fileInfo;
-    QTime lastTick;
-    quint64 lastBytesSent = 0;
     QVariantAnimation* backgroundColorAnimation = nullptr;
     QVariantAnimation* buttonColorAnimation = nullptr;
     QColor backgroundColor;
     QColor buttonColor;
-
-    static const uint8_t TRANSFER_ROLLING_AVG_COUNT = 4;
-    uint8_t meanIndex = 0;
-    qreal meanData[TRANSFER_ROLLING_AVG_COUNT] = {0.0};
+    QString previewPath; ///< The image file to preview, once we're visible
+    bool visible = false;
+    bool previewLoading = false;
+    bool tooltipLoading = false;
 };
 
 #endif // FILETRANSFERWIDGET_H
@@ -0,0 +1,166 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "imagepreview.h"
+#include "src/nexus.h"
+#include "src/persistence/profile.h"
+#include "src/widget/style.h"
+
+#include <QCache>
+#include <QFileInfo>
+#include <QFutureWatcher>
+#include <QGuiApplication>
+#include <QImageReader>
+#include <QPainter>
+
+namespace
+{
+
+/// The largest a preview is shown at, the thumbnail is always decoded for this size
+const QSize maxPreviewSize{400, 300};
+
+/// Images of the previews that aren't visible, by owner, with their size in bytes as cost
+QCache<const ImagePreview*, QImage>& retainedImages()
+{
+    static QCache<const ImagePreview*, QImage> images{48 * 1024 * 1024};
+    return images;
+}
+
+}
+
+ImagePreview::ImagePreview(const QString& filePath)
+    : filePath{filePath}
+{
+    // only the header is read, the image itself waits until we're shown
+    imageSize = QImageReader(filePath).size();
+    if (!imageSize.isValid())
+        imageSize = maxPreviewSize;
+
+    setWidth(maxPreviewSize.width());
+}
+
+ImagePreview::~ImagePreview()
+{
+    retainedImages().remove(this);
+    delete loader;
+}
+
+bool ImagePreview::canPreview(const QString& filePath)
+{
+    static const QStringList previewExtensions = { "png", "jpeg", "jpg", "gif", "svg" };
+    return previewExtensions.contains(QFileInfo(filePath).suffix().toLower());
+}
+
+QRectF ImagePreview::boundingRect() const
+{
+    return QRectF(QPointF(0, 0), displaySize);
+}
+
+void ImagePreview::paint(QPainter* painter, const QStyleOptionGraphicsItem* option, QWidget* widget)
+{
+    Q_UNUSED(option)
+    Q_UNUSED(widget)
+
+    if (image.isNull())
+    {
+        painter->fillRect(boundingRect(), Style::getColor(Style::LightGrey));
+        return;
+    }
+
+    painter->setRenderHint(QPainter::SmoothPixmapTransform);
+    painter->drawImage(boundingRect(), image);
+}
+
+void ImagePreview::setWidth(qreal width)
+{
+    QSize bounds = maxPreviewSize.boundedTo(QSize(qMax(static_cast<int>(width), 1), maxPreviewSize.height()));
+    QSize size = imageSize;
+
+    // small images are shown as they are, the others fit in the bounds
+    if (size.width() > bounds.width() || size.height() > bounds.height())
+        size.scale(bounds, Qt::KeepAspectRatio);
+
+    if (size == displaySize)
+        return;
+
+    prepareGeometryChange();
+    displaySize = size;
+}
+
+qreal ImagePreview::getAscent() const
+{
+    return 0.0;
+}
+
+void ImagePreview::visibilityChanged(bool visible)
+{
+    this->visible = visible;
+
+    if (visible)
+    {
+        if (QImage* retained = retainedImages().take(this))
+        {
+            image = *retained;
+            delete retained;
+            update();
+        }
+
+        load();
+    }
+    else if (!image.isNull())
+    {
+        int cost = image.byteCount();
+        retainedImages().insert(this, new QImage(image), cost);
+        image = QImage();
+    }
+}
+
+/**
+@brief Starts decoding the thumbnail unless we already have it, or it's on its way.
+*/
+void ImagePreview::load()
+{
+    if (!image.isNull() || loader)
+        return;
+
+    Profile* profile = Nexus::getProfile();
+    if (!profile)
+        return;
+
+    loader = new QFutureWatcher<QImage>();
+    QObject::connect(loader, &QFutureWatcher<QImage>::finished, loader, [this]()
+    {
+        QImage loaded = loader->result();
+        loader->deleteLater();
+        loader = nullptr;
+
+        // scrolled away meanwhile, the budget keeps it in case we come back
+        if (!visible)
+        {
+            if (!loaded.isNull())
+                retainedImages().insert(this, new QImage(loaded), loaded.byteCount());
+            return;
+        }
+
+        image = loaded.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+        update();
+    });
+    loader->setFuture(profile->loadThumbnailAsync(filePath, maxPreviewSize * qApp->devicePixelRatio(),
+                                                  Qt::KeepAspectRatio));
+}
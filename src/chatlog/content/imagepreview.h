@@ -0,0 +1,63 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAGEPREVIEW_H
+#define IMAGEPREVIEW_H
+
+#include "../chatlinecontent.h"
+
+#include <QImage>
+
+template <typename T> class QFutureWatcher;
+
+/**
+@brief Inline preview of an image file in the chat log.
+
+Only the file's path and dimensions are kept until the preview becomes visible, the image is then
+decoded at the size it's shown at through the profile's thumbnail cache. Previews that scroll out of
+view hand their image to a shared budget and get it back if they're shown again before it's evicted.
+*/
+class ImagePreview : public ChatLineContent
+{
+public:
+    explicit ImagePreview(const QString& filePath);
+    ~ImagePreview();
+
+    /// Whether the file is an image format we preview
+    static bool canPreview(const QString& filePath);
+
+    QRectF boundingRect() const override;
+    void paint(QPainter* painter, const QStyleOptionGraphicsItem* option, QWidget* widget) override;
+    void setWidth(qreal width) override;
+    qreal getAscent() const override;
+    void visibilityChanged(bool visible) override;
+
+private:
+    void load();
+
+private:
+    QString filePath;
+    QSize imageSize; ///< Of the file, read from its header
+    QSize displaySize;
+    QImage image; ///< Only while visible, or until the budget takes it back
+    QFutureWatcher<QImage>* loader = nullptr;
+    bool visible = false;
+};
+
+#endif // IMAGEPREVIEW_H
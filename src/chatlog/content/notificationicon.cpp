@@ -82,5 +82,5 @@ void NotificationIcon::updateGradient()
     grad.setColorAt(1, Qt::lightGray);
 
     if (scene() && isVisible())
-        scene()->invalidate(sceneBoundingRect());
+        scene()->invalidate(sceneBoundingRect(), QGraphicsScene::ItemLayer);
 }
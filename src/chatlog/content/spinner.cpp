@@ -20,30 +20,89 @@
 #include "spinner.h"
 #include "../pixmapcache.h"
 
-#include <QPainter>
 #include <QGraphicsScene>
+#include <QHash>
+#include <QPainter>
+#include <QSet>
 #include <QTime>
-#include <QVariantAnimation>
+#include <QTimer>
 #include <QDebug>
 
+namespace
+{
+
+/// How long spinners take to blend in, in ms
+const int fadeInDuration = 350;
+
+}
+
+/**
+@brief Repaints every visible spinner from one timer.
+
+After a reconnect there may be hundreds of pending messages, each with a spinner. They're all on
+the same clock, so a single timer invalidates them at once, one region per scene, and it only runs
+while at least one spinner is visible.
+*/
+class SpinnerTicker : public QObject
+{
+public:
+    static SpinnerTicker& getInstance()
+    {
+        static SpinnerTicker ticker;
+        return ticker;
+    }
+
+    void show(Spinner* spinner)
+    {
+        visible.insert(spinner);
+        if (!timer.isActive())
+            timer.start();
+    }
+
+    void hide(Spinner* spinner)
+    {
+        visible.remove(spinner);
+        if (visible.isEmpty())
+            timer.stop();
+    }
+
+private:
+    SpinnerTicker()
+    {
+        timer.setInterval(1000/30); // 30Hz
+        timer.setSingleShot(false);
+        connect(&timer, &QTimer::timeout, this, &SpinnerTicker::tick);
+    }
+
+    void tick()
+    {
+        QHash<QGraphicsScene*, QRectF> dirty;
+        for (Spinner* spinner : visible)
+        {
+            if (QGraphicsScene* scene = spinner->scene())
+                dirty[scene] |= spinner->sceneBoundingRect();
+        }
+
+        for (auto it = dirty.constBegin(); it != dirty.constEnd(); ++it)
+            it.key()->invalidate(it.value(), QGraphicsScene::ItemLayer); // keeps the cached background
+    }
+
+private:
+    QTimer timer;
+    QSet<Spinner*> visible;
+};
+
 Spinner::Spinner(const QString &img, QSize Size, qreal speed)
     : size(Size)
     , rotSpeed(speed)
 {
     pmap = PixmapCache::getInstance().get(img, size);
+    fadeIn.start();
+}
 
-    timer.setInterval(1000/30); // 30Hz
-    timer.setSingleShot(false);
-
-    blendAnimation = new QVariantAnimation(this);
-    blendAnimation->setStartValue(0.0);
-    blendAnimation->setEndValue(1.0);
-    blendAnimation->setDuration(350);
-    blendAnimation->setEasingCurve(QEasingCurve::InCubic);
-    blendAnimation->start(QAbstractAnimation::DeleteWhenStopped);
-    connect(blendAnimation, &QVariantAnimation::valueChanged, this, [this](const QVariant& val) { alpha = val.toDouble(); });
-
-    QObject::connect(&timer, &QTimer::timeout, this, &Spinner::timeout);
+Spinner::~Spinner()
+{
+    SpinnerTicker::getInstance().hide(this);
 }
 
 QRectF Spinner::boundingRect() const
@@ -55,6 +114,10 @@ void Spinner::paint(QPainter* painter, const QStyleOptionGraphicsItem* option, Q
 {
     painter->setClipRect(boundingRect());
 
+    // an InCubic blend
+    qreal progress = qMin(fadeIn.elapsed() / static_cast<qreal>(fadeInDuration), 1.0);
+    qreal alpha = progress * progress * progress;
+
     QTransform trans = QTransform().rotate(QTime::currentTime().msecsSinceStartOfDay() / 1000.0 * rotSpeed)
                                     .translate(-size.width()/2.0, -size.height()/2.0);
     painter->setOpacity(alpha);
@@ -74,18 +137,12 @@ void Spinner::setWidth(qreal width)
 void Spinner::visibilityChanged(bool visible)
 {
     if (visible)
-        timer.start();
+        SpinnerTicker::getInstance().show(this);
     else
-        timer.stop();
+        SpinnerTicker::getInstance().hide(this);
 }
 
 qreal Spinner::getAscent() const
 {
     return 0.0;
 }
-
-void Spinner::timeout()
-{
-    if (scene())
-        scene()->invalidate(sceneBoundingRect());
-}
@@ -22,17 +22,15 @@
 
 #include "../chatlinecontent.h"
 
-#include <QTimer>
-#include <QObject>
+#include <QElapsedTimer>
 #include <QPixmap>
 
-class QVariantAnimation;
-
-class Spinner : public QObject, public ChatLineContent
+/// Spinners are animated by a single shared timer, which only runs while one of them is visible
+class Spinner : public ChatLineContent
 {
-    Q_OBJECT
 public:
     Spinner(const QString& img, QSize size, qreal speed);
+    ~Spinner();
 
     virtual QRectF boundingRect() const override;
     virtual void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget) override;
@@ -40,17 +38,11 @@ public:
     virtual void visibilityChanged(bool visible) override;
     virtual qreal getAscent() const override;
 
-private slots:
-    void timeout();
-
 private:
     QSize size;
     QPixmap pmap;
     qreal rotSpeed;
-    QTimer timer;
-    qreal alpha = 0.0;
-    QVariantAnimation* blendAnimation;
-
+    QElapsedTimer fadeIn; ///< Spinners blend in, so quickly sent messages don't flash one
 };
 
 #endif // SPINNER_H
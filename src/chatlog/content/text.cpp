@@ -21,10 +21,12 @@
 #include "../documentcache.h"
 
 #include <QFontMetrics>
+#include <QtMath>
 #include <QPainter>
 #include <QPalette>
 #include <QDebug>
 #include <QTextBlock>
+#include <QTextLayout>
 #include <QAbstractTextDocumentLayout>
 #include <QApplication>
 #include <QGraphicsSceneMouseEvent>
@@ -46,23 +48,42 @@ Text::~Text()
 {
     if (doc)
         DocumentCache::getInstance().push(doc);
+
+    DocumentCache::getInstance().release(this);
 }
 
 void Text::setText(const QString& txt)
 {
     text = txt;
     dirty = true;
+    layouts.clear();
+}
+
+void Text::setDeferredText(std::function<QString()> format)
+{
+    setText(QString());
+    deferredText = format;
+}
+
+bool Text::isDeferred() const
+{
+    return static_cast<bool>(deferredText);
 }
 
 void Text::setWidth(qreal w)
 {
     width = w;
-    dirty = true;
 
+    // only the elided text depends on the width, otherwise the document just needs a new layout
     if (elide)
     {
         QFontMetrics metrics = QFontMetrics(defFont);
-        elidedText = metrics.elidedText(text, Qt::ElideRight, width);
+        QString newElidedText = metrics.elidedText(text, Qt::ElideRight, width);
+        if (newElidedText != elidedText)
+        {
+            elidedText = newElidedText;
+            dirty = true;
+        }
     }
 
     regenerate();
@@ -186,6 +207,13 @@ void Text::visibilityChanged(bool visible)
 {
     keepInMemory = visible;
 
+    // we might be scrolled back in soon, so keep our laid out document around for a bit
+    if (!visible && doc && !dirty)
+    {
+        DocumentCache::getInstance().retain(this, doc);
+        doc = nullptr;
+    }
+
     regenerate();
     update();
 }
@@ -215,18 +243,31 @@ void Text::mouseReleaseEvent(QGraphicsSceneMouseEvent *event)
 
 void Text::hoverMoveEvent(QGraphicsSceneHoverEvent *event)
 {
-    if (!doc)
-        return;
+    if (!hotSpotsValid)
+    {
+        if (!doc)
+            return;
 
-    QString anchor = doc->documentLayout()->anchorAt(event->pos());
+        updateHotSpots();
+    }
 
-    if (anchor.isEmpty())
-        setCursor(Qt::IBeamCursor);
-    else
-        setCursor(Qt::PointingHandCursor);
+    int hovered = -1;
+    for (int i = 0; i < hotSpots.size(); ++i)
+    {
+        if (hotSpots[i].rect.contains(event->pos()))
+        {
+            hovered = i;
+            break;
+        }
+    }
+
+    if (hovered == hoveredHotSpot)
+        return;
 
-    // tooltip
-    setToolTip(extractImgTooltip(cursorFromPos(event->scenePos(), false)));
+    hoveredHotSpot = hovered;
+    const HotSpot* spot = hovered >= 0 ? &hotSpots[hovered] : nullptr;
+    setCursor(spot && !spot->anchor.isEmpty() ? Qt::PointingHandCursor : Qt::IBeamCursor);
+    setToolTip(spot ? spot->toolTip : QString());
 }
 
 QString Text::getText() const
@@ -234,15 +275,149 @@ QString Text::getText() const
     return rawText;
 }
 
+Text::LayoutInput Text::getLayoutInput(qreal w) const
+{
+    LayoutInput input;
+    input.width = w;
+    input.font = defFont;
+    input.elide = elide;
+
+    if (elide)
+        input.text = QFontMetrics(defFont).elidedText(text, Qt::ElideRight, w);
+    else
+        input.text = text;
+
+    return input;
+}
+
+Text::Layout Text::computeLayout(const LayoutInput& input, QTextDocument* doc)
+{
+    // must match regenerate
+    doc->setDefaultFont(input.font);
+
+    if (!input.elide)
+        doc->setHtml(input.text);
+    else
+        doc->setPlainText(input.text);
+
+    QTextOption opt;
+    opt.setWrapMode(input.elide ? QTextOption::NoWrap : QTextOption::WrapAtWordBoundaryOrAnywhere);
+    doc->setDefaultTextOption(opt);
+
+    doc->setTextWidth(input.width);
+    doc->documentLayout()->update();
+
+    Layout layout;
+    layout.width = input.width;
+    layout.size = QSizeF(qMin(doc->idealWidth(), input.width), doc->size().height());
+
+    if (doc->firstBlock().layout()->lineCount() > 0)
+        layout.ascent = doc->firstBlock().layout()->lineAt(0).ascent();
+
+    return layout;
+}
+
+void Text::setPrecomputedLayout(const LayoutInput& input, const Layout& layout)
+{
+    if (input.font != defFont || input.elide != elide || input.text != getLayoutInput(input.width).text)
+        return;
+
+    cacheLayout(layout);
+}
+
+void Text::cacheLayout(const Layout& layout)
+{
+    for (int i = 0; i < layouts.size(); ++i)
+    {
+        if (layouts[i].width == layout.width)
+        {
+            layouts.remove(i);
+            break;
+        }
+    }
+
+    layouts.prepend(layout);
+
+    if (layouts.size() > maxCachedLayouts)
+        layouts.resize(maxCachedLayouts);
+}
+
+bool Text::applyCachedLayout()
+{
+    for (const Layout& layout : layouts)
+    {
+        if (layout.width != width)
+            continue;
+
+        if (size != layout.size)
+            prepareGeometryChange();
+
+        size = layout.size;
+        ascent = layout.ascent;
+        return true;
+    }
+
+    return false;
+}
+
+void Text::applyEstimatedLayout()
+{
+    // wrap every raw line at the width, like a document with the default margins would
+    const qreal docMargin = 4.0;
+    QFontMetricsF metrics(defFont);
+    qreal lineWidth = qMax(1.0, width - 2 * docMargin);
+    qreal widest = 0.0;
+    int lineCount = 0;
+
+    for (const QString& line : rawText.split('\n'))
+    {
+        qreal textWidth = metrics.width(line);
+        widest = qMax(widest, textWidth);
+        lineCount += qMax(1, qCeil(textWidth / lineWidth));
+    }
+
+    QSizeF estimate(qMin(widest + 2 * docMargin, width), lineCount * metrics.lineSpacing() + 2 * docMargin);
+    if (size != estimate)
+        prepareGeometryChange();
+
+    size = estimate;
+    ascent = metrics.ascent();
+}
+
 void Text::regenerate()
 {
+    if (deferredText)
+    {
+        if (!keepInMemory)
+        {
+            applyEstimatedLayout();
+            return;
+        }
+
+        // our size changes from the estimate, the line takes care of the layout
+        std::function<QString()> format;
+        format.swap(deferredText);
+        setText(format());
+    }
+
+    // we know our geometry at this width already, a document is only needed to display us
+    if (!doc && !keepInMemory && applyCachedLayout())
+        return;
+
+    bool fill = dirty;
+
     if (!doc)
     {
-        doc = DocumentCache::getInstance().pop();
-        dirty = true;
+        doc = DocumentCache::getInstance().takeRetained(this);
+
+        if (!doc)
+        {
+            doc = DocumentCache::getInstance().pop();
+            fill = true;
+        }
     }
 
-    if (dirty)
+    if (fill)
     {
         doc->setDefaultFont(defFont);
 
@@ -255,6 +430,12 @@ void Text::regenerate()
         QTextOption opt;
         opt.setWrapMode(elide ? QTextOption::NoWrap : QTextOption::WrapAtWordBoundaryOrAnywhere);
         doc->setDefaultTextOption(opt);
+    }
+
+    if (fill || doc->textWidth() != width)
+    {
+        hotSpotsValid = false;
+        hoveredHotSpot = -2;
 
         // width
         doc->setTextWidth(width);
@@ -271,9 +452,15 @@ void Text::regenerate()
         // get the new width and height
         size = idealSize();
 
-        dirty = false;
+        Layout layout;
+        layout.width = width;
+        layout.size = size;
+        layout.ascent = ascent;
+        cacheLayout(layout);
     }
 
+    dirty = false;
+
     // if we are not visible -> free mem
     if (!keepInMemory)
         freeResources();
@@ -322,6 +509,7 @@ QString Text::extractSanitizedText(int from, int to) const
         return "";
 
     QString txt;
+    txt.reserve(qMax(to - from, 0));
     QTextBlock block = doc->firstBlock();
 
     for (QTextBlock::Iterator itr = block.begin(); itr!=block.end(); ++itr)
@@ -355,16 +543,43 @@ QString Text::extractSanitizedText(int from, int to) const
     return txt;
 }
 
-QString Text::extractImgTooltip(int pos) const
+void Text::updateHotSpots()
 {
-    for (QTextBlock::Iterator itr = doc->firstBlock().begin(); itr!=doc->firstBlock().end(); ++itr)
+    hotSpots.clear();
+
+    for (QTextBlock block = doc->firstBlock(); block.isValid(); block = block.next())
     {
-        if (itr.fragment().contains(pos) && itr.fragment().charFormat().isImageFormat())
+        const QTextLayout* layout = block.layout();
+        const QPointF origin = layout->position();
+
+        for (QTextBlock::Iterator itr = block.begin(); itr != block.end(); ++itr)
         {
-            QTextImageFormat imgFmt = itr.fragment().charFormat().toImageFormat();
-            return imgFmt.toolTip();
+            const QTextFragment fragment = itr.fragment();
+            const QTextCharFormat format = fragment.charFormat();
+            const QString anchor = format.isAnchor() ? format.anchorHref() : QString();
+            const QString toolTip = format.isImageFormat() ? format.toImageFormat().toolTip() : QString();
+            if (anchor.isEmpty() && toolTip.isEmpty())
+                continue;
+
+            // a fragment can wrap over several lines, each gets its own rect
+            const int begin = fragment.position() - block.position();
+            const int end = begin + fragment.length();
+            for (int i = 0; i < layout->lineCount(); ++i)
+            {
+                const QTextLine line = layout->lineAt(i);
+                const int lineBegin = qMax(begin, line.textStart());
+                const int lineEnd = qMin(end, line.textStart() + line.textLength());
+                if (lineBegin >= lineEnd)
+                    continue;
+
+                const qreal left = line.cursorToX(lineBegin);
+                const qreal right = line.cursorToX(lineEnd);
+                const QRectF rect(qMin(left, right), line.y(), qAbs(right - left), line.height());
+                hotSpots.append({rect.translated(origin), anchor, toolTip});
+            }
         }
     }
 
-    return QString();
+    hotSpotsValid = true;
+    hoveredHotSpot = -2;
 }
@@ -23,18 +23,41 @@
 #include "../chatlinecontent.h"
 
 #include <QFont>
+#include <QVector>
+#include <functional>
 
 class QTextDocument;
 
 class Text : public ChatLineContent
 {
 public:
+    /// Everything computeLayout needs, copied so it can be used from another thread
+    struct LayoutInput
+    {
+        QString text;
+        QFont font;
+        qreal width = 0.0;
+        bool elide = false;
+    };
+
+    /// Geometry of a Text at a given width, see computeLayout
+    struct Layout
+    {
+        qreal width = -1.0;
+        QSizeF size;
+        qreal ascent = 0.0;
+    };
+
     // txt: may contain html code
     // rawText: does not contain html code
     Text(const QString& txt = "", QFont font = QFont(), bool enableElide = false, const QString& rawText = QString(), const QColor c = Qt::black);
     virtual ~Text();
 
     void setText(const QString& txt);
+    /// Calls format for our text the first time we become visible.
+    /// Until then our size is estimated from the raw text.
+    void setDeferredText(std::function<QString()> format);
+    bool isDeferred() const;
 
     virtual void setWidth(qreal width) final;
 
@@ -58,10 +81,26 @@ public:
 
     virtual QString getText() const final;
 
+    /// Returns the input to lay out our text at the given width, only call this from the GUI thread
+    LayoutInput getLayoutInput(qreal width) const;
+    /// Lays out input in doc and returns the resulting geometry, can be called from any thread
+    /// as long as doc belongs to it, see LayoutTextDocument
+    static Layout computeLayout(const LayoutInput& input, QTextDocument* doc);
+    /// Caches a layout computed by computeLayout, so that setWidth at the same width only
+    /// applies the geometry instead of laying out the document again.
+    /// Ignored if our text changed since getLayoutInput.
+    void setPrecomputedLayout(const LayoutInput& input, const Layout& layout);
+
 protected:
     // dynamic resource management
     void regenerate();
     void freeResources();
+    /// Remembers our geometry at layout.width, forgetting the least recently used width if needed
+    void cacheLayout(const Layout& layout);
+    /// Applies the cached geometry for the current width, returns false if there is none
+    bool applyCachedLayout();
+    /// Approximates our geometry from the raw text, while the text is deferred
+    void applyEstimatedLayout();
 
     QSizeF idealSize();
     int cursorFromPos(QPointF scenePos, bool fuzzy = true) const;
@@ -69,9 +108,20 @@ protected:
     int getSelectionStart() const;
     bool hasSelection() const;
     QString extractSanitizedText(int from, int to) const;
-    QString extractImgTooltip(int pos) const;
+    /// Finds the links and images with a tooltip in our document, once per layout
+    void updateHotSpots();
 
 private:
+    /// Where a link or an image tooltip is, in our coordinates
+    struct HotSpot
+    {
+        QRectF rect;
+        QString anchor;
+        QString toolTip;
+    };
+
+    static constexpr int maxCachedLayouts = 4;
+
     QTextDocument* doc = nullptr;
     QString text;
     QString rawText;
@@ -86,6 +136,11 @@ private:
     int selectionAnchor = -1;
     qreal ascent = 0.0;
     qreal width = 0.0;
+    QVector<Layout> layouts; ///< Our geometry at the last widths we were laid out at, most recent first
+    QVector<HotSpot> hotSpots; ///< Valid until our text or width changes, they don't need the document
+    bool hotSpotsValid = false;
+    int hoveredHotSpot = -2; ///< Index in hotSpots, -1 over plain text, -2 if the cursor must be set again
+    std::function<QString()> deferredText;
     QFont defFont;
     QColor color;
 
@@ -29,13 +29,17 @@
 CustomTextDocument::CustomTextDocument(QObject *parent)
     : QTextDocument(parent)
 {
-    static QString css = Style::getStylesheet(":ui/chatArea/innerStyle.css");
-
-    setDefaultStyleSheet(css);
+    setDefaultStyleSheet(getStylesheet());
     setUndoRedoEnabled(false);
     setUseDesignMetrics(false);
 }
 
+QString CustomTextDocument::getStylesheet()
+{
+    static QString css = Style::getStylesheet(":ui/chatArea/innerStyle.css");
+    return css;
+}
+
 QVariant CustomTextDocument::loadResource(int type, const QUrl &name)
 {
     if (type == QTextDocument::ImageResource && name.scheme() == "key")
@@ -43,8 +47,26 @@ QVariant CustomTextDocument::loadResource(int type, const QUrl &name)
         QSize size = QSize(Settings::getInstance().getEmojiFontPointSize(),Settings::getInstance().getEmojiFontPointSize());
         QString fileName = QUrl::fromPercentEncoding(name.toEncoded()).mid(4).toHtmlEscaped();
 
-        return SmileyPack::getInstance().getAsIcon(fileName).pixmap(size);
+        return SmileyPack::getInstance().getAsPixmap(fileName, size);
     }
 
     return QTextDocument::loadResource(type, name);
 }
+
+LayoutTextDocument::LayoutTextDocument(const QString& css, int emojiSize)
+    : emptyEmoji(emojiSize, emojiSize, QImage::Format_ARGB32_Premultiplied)
+{
+    emptyEmoji.fill(Qt::transparent);
+
+    setDefaultStyleSheet(css);
+    setUndoRedoEnabled(false);
+    setUseDesignMetrics(false);
+}
+
+QVariant LayoutTextDocument::loadResource(int type, const QUrl &name)
+{
+    if (type == QTextDocument::ImageResource && name.scheme() == "key")
+        return emptyEmoji;
+
+    return QTextDocument::loadResource(type, name);
+}
@@ -20,6 +20,7 @@
 #ifndef CUSTOMTEXTDOCUMENT_H
 #define CUSTOMTEXTDOCUMENT_H
 
+#include <QImage>
 #include <QTextDocument>
 
 class CustomTextDocument : public QTextDocument
@@ -28,8 +29,26 @@ class CustomTextDocument : public QTextDocument
 public:
     explicit CustomTextDocument(QObject *parent = 0);
 
+    /// The default stylesheet of the chat documents, only call this from the GUI thread
+    static QString getStylesheet();
+
 protected:
     virtual QVariant loadResource(int type, const QUrl &name);
 };
 
+/// Same layout as a CustomTextDocument, but usable from any thread.
+/// Smileys are replaced with blank images of the same size, since icons and pixmaps
+/// can't be created outside of the GUI thread.
+class LayoutTextDocument : public QTextDocument
+{
+public:
+    LayoutTextDocument(const QString& css, int emojiSize);
+
+protected:
+    virtual QVariant loadResource(int type, const QUrl &name) final override;
+
+private:
+    QImage emptyEmoji;
+};
+
 #endif // CUSTOMTEXTDOCUMENT_H
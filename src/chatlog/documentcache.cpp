@@ -24,23 +24,89 @@ DocumentCache::~DocumentCache()
 {
     while (!documents.isEmpty())
         delete documents.pop();
+
+    qDeleteAll(retained);
 }
 
 QTextDocument* DocumentCache::pop()
 {
     if (documents.empty())
-        documents.push(new CustomTextDocument);
+    {
+        ++stats.misses;
+        return new CustomTextDocument;
+    }
 
+    ++stats.hits;
     return documents.pop();
 }
 
 void DocumentCache::push(QTextDocument *doc)
 {
+    if (!doc)
+        return;
+
+    if (documents.size() >= highWatermark)
+    {
+        ++stats.evictions;
+        delete doc;
+        return;
+    }
+
+    doc->clear();
+    documents.push(doc);
+}
+
+void DocumentCache::retain(const void* owner, QTextDocument* doc)
+{
+    if (!doc)
+        return;
+
+    release(owner);
+
+    retained.insert(owner, doc);
+    retainOrder.append(owner);
+
+    if (retainOrder.size() > maxRetained)
+        push(retained.take(retainOrder.takeFirst()));
+}
+
+QTextDocument* DocumentCache::takeRetained(const void* owner)
+{
+    QTextDocument* doc = retained.take(owner);
     if (doc)
     {
-        doc->clear();
-        documents.push(doc);
+        ++stats.retainedHits;
+        retainOrder.removeOne(owner);
     }
+
+    return doc;
+}
+
+void DocumentCache::release(const void* owner)
+{
+    push(takeRetained(owner));
+}
+
+void DocumentCache::trim()
+{
+    stats.evictions += retained.size();
+    qDeleteAll(retained);
+    retained.clear();
+    retainOrder.clear();
+
+    while (documents.size() > lowWatermark)
+    {
+        ++stats.evictions;
+        delete documents.pop();
+    }
+}
+
+DocumentCache::Statistics DocumentCache::getStatistics() const
+{
+    Statistics current = stats;
+    current.free = documents.size();
+    current.retained = retained.size();
+    return current;
 }
 
 DocumentCache &DocumentCache::getInstance()
@@ -20,6 +20,8 @@
 #ifndef DOCUMENTCACHE_H
 #define DOCUMENTCACHE_H
 
+#include <QHash>
+#include <QList>
 #include <QStack>
 
 class QTextDocument;
@@ -27,19 +29,50 @@ class QTextDocument;
 class DocumentCache
 {
 public:
+    struct Statistics
+    {
+        quint64 hits = 0; ///< pop reused a free document
+        quint64 misses = 0; ///< pop had to create a document
+        quint64 retainedHits = 0; ///< takeRetained returned a laid out document
+        quint64 evictions = 0; ///< Documents deleted to stay under the watermarks
+        int free = 0; ///< Documents currently waiting to be reused
+        int retained = 0; ///< Laid out documents currently kept for their owner
+    };
+
     ~DocumentCache();
     static DocumentCache& getInstance();
 
     QTextDocument* pop();
+    /// Keeps the document for reuse, or deletes it if there are already enough free documents
     void push(QTextDocument* doc);
 
+    /// Keeps the laid out document of an item that stopped being visible, so it can get it back
+    /// without another layout. Only the most recently retained documents are kept.
+    void retain(const void* owner, QTextDocument* doc);
+    /// Returns the document retained for owner with its content and layout, or nullptr if it was recycled
+    QTextDocument* takeRetained(const void* owner);
+    /// Recycles the document retained for owner, if any
+    void release(const void* owner);
+
+    /// Frees the retained documents and the free ones above the low watermark,
+    /// called when a chat log is hidden and its documents won't be needed soon
+    void trim();
+    Statistics getStatistics() const;
+
 protected:
     DocumentCache() {}
     DocumentCache(DocumentCache&) = delete;
     DocumentCache& operator=(const DocumentCache&) = delete;
 
 private:
+    static constexpr int maxRetained = 128;
+    static constexpr int highWatermark = 256; ///< Free documents beyond this are deleted by push
+    static constexpr int lowWatermark = 32; ///< Free documents kept by trim
+
     QStack<QTextDocument*> documents;
+    QHash<const void*, QTextDocument*> retained;
+    QList<const void*> retainOrder; ///< Owners of the retained documents, oldest first
+    Statistics stats;
 };
 
 #endif // DOCUMENTCACHE_H
@@ -0,0 +1,163 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "mentionmatcher.h"
+
+/**
+@class MentionMatcher
+@brief An Aho-Corasick automaton over the case-folded keywords.
+
+Every character of a message is read once, following fail links when the
+current match can't be extended, so the cost doesn't grow with the number
+or length of keywords, and nothing backtracks like a regex would.
+*/
+
+MentionMatcher::MentionMatcher()
+    : nodes(1)
+{
+}
+
+void MentionMatcher::setKeywords(const QStringList& keywords)
+{
+    nodes.clear();
+    nodes.emplace_back();
+
+    for (const QString& keyword : keywords)
+    {
+        if (!keyword.isEmpty())
+            insert(keyword);
+    }
+
+    buildFailLinks();
+}
+
+bool MentionMatcher::matches(const QString& text) const
+{
+    if (isEmpty())
+        return false;
+
+    int node = 0;
+    for (int i = 0; i < text.size(); ++i)
+    {
+        ushort c = text[i].toCaseFolded().unicode();
+        int next = child(node, c);
+        while (next < 0 && node != 0)
+        {
+            node = nodes[node].fail;
+            next = child(node, c);
+        }
+
+        node = next < 0 ? 0 : next;
+        for (const Keyword& keyword : nodes[node].keywords)
+        {
+            if (isWholeWord(text, i + 1 - keyword.length, i + 1, keyword))
+                return true;
+        }
+    }
+
+    return false;
+}
+
+bool MentionMatcher::isEmpty() const
+{
+    return nodes.size() == 1;
+}
+
+void MentionMatcher::insert(const QString& keyword)
+{
+    int node = 0;
+    for (QChar c : keyword)
+    {
+        ushort folded = c.toCaseFolded().unicode();
+        int next = child(node, folded);
+        if (next < 0)
+        {
+            next = nodes.size();
+            nodes[node].children.push_back({folded, next});
+            nodes.emplace_back();
+        }
+
+        node = next;
+    }
+
+    if (nodes[node].keywords.empty())
+        nodes[node].keywords.push_back({keyword.size(), isWordChar(keyword[0]), isWordChar(keyword[keyword.size() - 1])});
+}
+
+/**
+@brief Links every node to its longest proper suffix in the trie, breadth first.
+Suffixes are always shallower, so their own keywords are complete by the time they're copied.
+*/
+void MentionMatcher::buildFailLinks()
+{
+    std::vector<int> queue;
+    for (const std::pair<ushort, int>& c : nodes[0].children)
+        queue.push_back(c.second);
+
+    for (size_t i = 0; i < queue.size(); ++i)
+    {
+        int node = queue[i];
+        const Node& suffix = nodes[nodes[node].fail];
+        nodes[node].keywords.insert(nodes[node].keywords.end(), suffix.keywords.begin(), suffix.keywords.end());
+
+        for (const std::pair<ushort, int>& c : nodes[node].children)
+        {
+            int fail = nodes[node].fail;
+            int next = child(fail, c.first);
+            while (next < 0 && fail != 0)
+            {
+                fail = nodes[fail].fail;
+                next = child(fail, c.first);
+            }
+
+            nodes[c.second].fail = next < 0 ? 0 : next;
+            queue.push_back(c.second);
+        }
+    }
+}
+
+int MentionMatcher::child(int node, ushort c) const
+{
+    for (const std::pair<ushort, int>& child : nodes[node].children)
+    {
+        if (child.first == c)
+            return child.second;
+    }
+
+    return -1;
+}
+
+bool MentionMatcher::isWholeWord(const QString& text, int begin, int end, const Keyword& keyword) const
+{
+    if (keyword.wordStart && begin > 0 && isWordChar(text[begin - 1]))
+        return false;
+
+    if (keyword.wordEnd && end < text.size() && isWordChar(text[end]))
+        return false;
+
+    return true;
+}
+
+/**
+@brief Word characters as a regex \b sees them with Unicode properties.
+*/
+bool MentionMatcher::isWordChar(QChar c)
+{
+    return c.isLetterOrNumber() || c.isMark() || c == QLatin1Char('_');
+}
@@ -0,0 +1,65 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MENTIONMATCHER_H
+#define MENTIONMATCHER_H
+
+#include <QString>
+#include <QStringList>
+#include <vector>
+
+/// Finds any of a set of keywords in a message, ignoring case, in one pass over the message.
+/// Keywords only match as whole words, they may not be the middle of a longer word.
+class MentionMatcher
+{
+public:
+    MentionMatcher();
+
+    /// Replaces the keywords, empty ones are ignored
+    void setKeywords(const QStringList& keywords);
+    /// Returns true if text contains one of the keywords, in time linear in the length of text
+    bool matches(const QString& text) const;
+    bool isEmpty() const;
+
+private:
+    struct Keyword
+    {
+        int length;
+        bool wordStart; ///< If it starts with a word character, which must not follow another one
+        bool wordEnd;
+    };
+
+    struct Node
+    {
+        std::vector<std::pair<ushort, int>> children; ///< Case-folded character and index of the child node
+        int fail = 0; ///< Node of the longest proper suffix that is also in the trie
+        std::vector<Keyword> keywords; ///< Keywords ending here, including those of suffixes
+    };
+
+    void insert(const QString& keyword);
+    void buildFailLinks();
+    int child(int node, ushort c) const;
+    bool isWholeWord(const QString& text, int begin, int end, const Keyword& keyword) const;
+
+    static bool isWordChar(QChar c);
+
+    std::vector<Node> nodes;
+};
+
+#endif // MENTIONMATCHER_H
@@ -0,0 +1,56 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "messagecache.h"
+#include "src/persistence/settings.h"
+
+// In characters, takes a few MB for a few thousand messages
+static const int maxCachedCharacters = 2 * 1024 * 1024;
+
+MessageCache::MessageCache()
+    : cache(maxCachedCharacters)
+{
+    QObject::connect(&Settings::getInstance(), &Settings::messageFormattingChanged, [this]() { clear(); });
+    QObject::connect(&Settings::getInstance(), &Settings::smileyPackChanged, [this]() { clear(); });
+}
+
+MessageCache& MessageCache::getInstance()
+{
+    static MessageCache instance;
+    return instance;
+}
+
+QString MessageCache::find(qint64 historyId, const QString& rawMessage)
+{
+    Entry* entry = cache.object(historyId);
+    if (!entry || entry->rawMessage != rawMessage)
+        return QString();
+
+    return entry->formatted;
+}
+
+void MessageCache::insert(qint64 historyId, const QString& rawMessage, const QString& formatted)
+{
+    cache.insert(historyId, new Entry{rawMessage, formatted}, rawMessage.size() + formatted.size());
+}
+
+void MessageCache::clear()
+{
+    cache.clear();
+}
@@ -0,0 +1,55 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MESSAGECACHE_H
+#define MESSAGECACHE_H
+
+#include <QCache>
+#include <QString>
+
+/// Remembers the formatted text of recently shown history messages, by history id,
+/// so reopening a chat doesn't format them again.
+/// The cache is emptied when the settings that affect formatting change. Ids can be reused
+/// by another profile or after deleting history, so entries are only used for the same raw message.
+class MessageCache
+{
+public:
+    static MessageCache& getInstance();
+
+    /// Returns the formatted text of the history message, or a null string if it isn't cached
+    QString find(qint64 historyId, const QString& rawMessage);
+    void insert(qint64 historyId, const QString& rawMessage, const QString& formatted);
+    void clear();
+
+protected:
+    MessageCache();
+    MessageCache(MessageCache&) = delete;
+    MessageCache& operator=(const MessageCache&) = delete;
+
+private:
+    struct Entry
+    {
+        QString rawMessage;
+        QString formatted;
+    };
+
+    QCache<qint64, Entry> cache; ///< The cost of an entry is its length
+};
+
+#endif // MESSAGECACHE_H
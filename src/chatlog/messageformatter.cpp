@@ -0,0 +1,358 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "messageformatter.h"
+#include "src/persistence/smileypack.h"
+
+namespace
+{
+
+struct MarkdownRule
+{
+    const char* marker;
+    const char* open;
+    const char* close;
+};
+
+// Tried in this order at the start of every word
+const MarkdownRule markdownRules[] =
+{
+    {"**", "<b>", "</b>"},
+    {"*", "<i>", "</i>"},
+    {"_", "<i>", "</i>"},
+    {"__", "<b>", "</b>"},
+    {"-", "<u>", "</u>"},
+    {"~", "<s>", "</s>"},
+    {"~~", "<s>", "</s>"},
+    {"`", "<font color=#595959><code>", "</code></font>"},
+};
+
+bool isWordChar(QChar c)
+{
+    return c.isLetterOrNumber() || c.isMark() || c == '_';
+}
+
+bool startsWith(const QString& str, int pos, int end, QLatin1String prefix)
+{
+    return end - pos >= prefix.size() && str.midRef(pos, prefix.size()) == prefix;
+}
+
+}
+
+MessageFormatter::MessageFormatter(bool useEmoticons, MarkdownType markdown)
+    : useEmoticons{useEmoticons}
+    , markdown{markdown}
+{
+    if (useEmoticons)
+        emoticons = SmileyPack::getInstance().getMatcher();
+}
+
+QString MessageFormatter::format(const QString& message, bool quoteFirstLine)
+{
+    in = &message;
+    out.clear();
+    out.reserve(message.size() + message.size() / 2);
+
+    int begin = 0;
+    for (;;)
+    {
+        int end = message.indexOf('\n', begin);
+        if (end < 0)
+            end = message.size();
+
+        formatLine(begin, end, quoteFirstLine || begin > 0);
+
+        if (end == message.size())
+            break;
+
+        out += QStringLiteral("<br/>");
+        begin = end + 1;
+    }
+
+    in = nullptr;
+    return out;
+}
+
+bool MessageFormatter::isComplete() const
+{
+    return !useEmoticons || emoticons;
+}
+
+void MessageFormatter::formatLine(int begin, int end, bool allowQuote)
+{
+    const QString& str = *in;
+    const bool quote = allowQuote && begin < end && (str[begin] == '>' || str[begin] == QChar(0xFF1E));
+
+    if (quote)
+        out += QStringLiteral("<span class=quote>");
+
+    int pos = begin;
+    while (pos < end)
+    {
+        if (str[pos].isSpace())
+        {
+            out += str[pos++];
+            continue;
+        }
+
+        // markdown spans start at the beginning of the line or after a space
+        if (markdown != NONE && (pos == begin || str[pos - 1] == ' '))
+        {
+            int spanEnd = formatMarkdown(pos, end);
+            if (spanEnd > 0)
+            {
+                pos = spanEnd;
+                continue;
+            }
+        }
+
+        int wordEnd = pos;
+        while (wordEnd < end && !str[wordEnd].isSpace())
+            ++wordEnd;
+
+        pos = formatWord(pos, wordEnd, end);
+    }
+
+    if (quote)
+        out += QStringLiteral("</span>");
+}
+
+/**
+ * @brief Formats the markdown span starting at begin, if there is one.
+ * @return The end of the span, or -1 if there is no span at begin.
+ */
+int MessageFormatter::formatMarkdown(int begin, int lineEnd)
+{
+    const QString& str = *in;
+
+    for (const MarkdownRule& rule : markdownRules)
+    {
+        QLatin1String marker(rule.marker);
+        if (!startsWith(str, begin, lineEnd, marker))
+            continue;
+
+        // the content can't contain the marker character and has at least two characters
+        int contentBegin = begin + marker.size();
+        int contentEnd = contentBegin;
+        while (contentEnd < lineEnd && str[contentEnd] != QLatin1Char(rule.marker[0]))
+            ++contentEnd;
+
+        if (contentEnd - contentBegin < 2 || !startsWith(str, contentEnd, lineEnd, marker))
+            continue;
+
+        // the first rule that matches decides, spans must end before a space or at the end of the line
+        int spanEnd = contentEnd + marker.size();
+        if (spanEnd < lineEnd && str[spanEnd] != ' ')
+            return -1;
+
+        const bool keepMarkers = markdown == WITH_CHARS;
+
+        out += QLatin1String(rule.open);
+        if (keepMarkers)
+            out += marker;
+
+        formatWords(contentBegin, contentEnd);
+
+        if (keepMarkers)
+            out += marker;
+        out += QLatin1String(rule.close);
+
+        return spanEnd;
+    }
+
+    return -1;
+}
+
+void MessageFormatter::formatWords(int begin, int end)
+{
+    const QString& str = *in;
+
+    int pos = begin;
+    while (pos < end)
+    {
+        if (str[pos].isSpace())
+        {
+            out += str[pos++];
+            continue;
+        }
+
+        int wordEnd = pos;
+        while (wordEnd < end && !str[wordEnd].isSpace())
+            ++wordEnd;
+
+        pos = formatWord(pos, wordEnd, end);
+    }
+}
+
+/**
+ * @brief Formats the word [begin, end) as a smiley, or as text that may contain links.
+ * @return Where formatting continues, links to files may extend to lineEnd.
+ */
+int MessageFormatter::formatWord(int begin, int end, int lineEnd)
+{
+    const QString& str = *in;
+
+    if (emoticons)
+    {
+        const QString* key = emoticons->findWord(str, begin, end, true);
+        if (key)
+        {
+            out += SmileyPack::getAsRichText(*key);
+            return end;
+        }
+    }
+
+    int textBegin = begin;
+
+    for (int pos = begin; pos < end; ++pos)
+    {
+        // links start at a word boundary
+        if (pos > begin && isWordChar(str[pos - 1]))
+            continue;
+
+        int linkEnd = findLinkEnd(pos, end, lineEnd);
+        if (linkEnd < 0)
+            continue;
+
+        appendEscaped(textBegin, pos);
+
+        QString url = escaped(pos, linkEnd);
+        if (startsWith(str, pos, linkEnd, QLatin1String("www.")))
+            out += QString("<a href=\"http://%1\">%1</a>").arg(url);
+        else
+            out += QString("<a href=\"%1\">%1</a>").arg(url);
+
+        if (linkEnd > end)
+            return linkEnd;
+
+        textBegin = linkEnd;
+        pos = linkEnd - 1;
+    }
+
+    appendEscaped(textBegin, end);
+    return end;
+}
+
+/**
+ * @brief Finds the end of the link starting at begin.
+ * @return The end of the link, or -1 if there is no link at begin.
+ */
+int MessageFormatter::findLinkEnd(int begin, int wordEnd, int lineEnd) const
+{
+    const QString& str = *in;
+
+    switch (str[begin].unicode())
+    {
+    case 'w':
+    case 'h':
+    case 'f':
+    {
+        int schemeEnd = -1;
+        if (startsWith(str, begin, wordEnd, QLatin1String("www.")))
+            schemeEnd = begin + 4;
+        else if (startsWith(str, begin, wordEnd, QLatin1String("http://")))
+            schemeEnd = begin + 7;
+        else if (startsWith(str, begin, wordEnd, QLatin1String("https://")))
+            schemeEnd = begin + 8;
+        else if (startsWith(str, begin, wordEnd, QLatin1String("ftp://")))
+            schemeEnd = begin + 6;
+        else if (startsWith(str, begin, wordEnd, QLatin1String("file://")))
+            return lineEnd; // paths may contain spaces
+
+        // the rest of the word, if it starts with a word character and has at least two characters
+        if (schemeEnd > 0 && schemeEnd + 1 < wordEnd && isWordChar(str[schemeEnd]))
+            return wordEnd;
+
+        return -1;
+    }
+    case 's':
+        if (startsWith(str, begin, wordEnd, QLatin1String("smb://")))
+            return lineEnd;
+
+        return -1;
+    case 't':
+    {
+        if (!startsWith(str, begin, wordEnd, QLatin1String("tox:")))
+            return -1;
+
+        // full tox address
+        const int idLength = 76;
+        int idEnd = begin + 4;
+        while (idEnd < wordEnd && idEnd - begin - 4 < idLength && str[idEnd].unicode() < 128 && str[idEnd].isLetterOrNumber())
+            ++idEnd;
+
+        if (idEnd - begin - 4 == idLength)
+            return idEnd;
+
+        // simplified address, tox:name@domain
+        int at = str.lastIndexOf('@', wordEnd - 2);
+        if (at >= begin + 5)
+            return wordEnd;
+
+        return -1;
+    }
+    case 'm':
+    {
+        if (!startsWith(str, begin, wordEnd, QLatin1String("mailto:")))
+            return -1;
+
+        // mailto:user@domain.tld
+        int at = str.indexOf('@', begin + 8);
+        int dot = str.lastIndexOf('.', wordEnd - 2);
+        if (at >= 0 && at < wordEnd && dot >= at + 2)
+            return wordEnd;
+
+        return -1;
+    }
+    default:
+        return -1;
+    }
+}
+
+void MessageFormatter::appendEscaped(int begin, int end)
+{
+    const QString& str = *in;
+
+    for (int i = begin; i < end; ++i)
+    {
+        QChar c = str[i];
+        switch (c.unicode())
+        {
+        case '<':
+            out += QLatin1String("&lt;");
+            break;
+        case '>':
+            out += QLatin1String("&gt;");
+            break;
+        case '&':
+            out += QLatin1String("&amp;");
+            break;
+        case '"':
+            out += QLatin1String("&quot;");
+            break;
+        default:
+            out += c;
+        }
+    }
+}
+
+QString MessageFormatter::escaped(int begin, int end) const
+{
+    return in->mid(begin, end - begin).toHtmlEscaped();
+}
@@ -0,0 +1,61 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MESSAGEFORMATTER_H
+#define MESSAGEFORMATTER_H
+
+#include "src/persistence/settings.h"
+
+#include <QString>
+#include <memory>
+
+class EmoticonMatcher;
+
+/// Turns raw messages into the rich text shown by a ChatMessage in a single scan.
+/// Escaping, smileys, links, quotes and markdown are emitted while the message
+/// is read once, instead of running one regex pass per feature over the whole text.
+class MessageFormatter
+{
+public:
+    MessageFormatter(bool useEmoticons, MarkdownType markdown);
+
+    /// Returns the formatted message, without the surrounding paragraph.
+    /// Actions are prefixed with the sender's name, so their first line must not be quoted.
+    QString format(const QString& message, bool quoteFirstLine = true);
+    /// Returns false if emoticons are wanted but no smiley pack is loaded yet
+    bool isComplete() const;
+
+private:
+    void formatLine(int begin, int end, bool allowQuote);
+    int formatMarkdown(int begin, int lineEnd);
+    void formatWords(int begin, int end);
+    int formatWord(int begin, int end, int lineEnd);
+    int findLinkEnd(int begin, int wordEnd, int lineEnd) const;
+    void appendEscaped(int begin, int end);
+    QString escaped(int begin, int end) const;
+
+private:
+    bool useEmoticons;
+    std::shared_ptr<const EmoticonMatcher> emoticons; ///< Null if emoticons are disabled
+    MarkdownType markdown;
+    const QString* in = nullptr; ///< The message being formatted
+    QString out;
+};
+
+#endif // MESSAGEFORMATTER_H
@@ -18,21 +18,127 @@
 */
 
 #include "pixmapcache.h"
+#include "src/trace.h"
+
+#include <QGuiApplication>
+#include <QImageReader>
+#include <QPainter>
+#include <QSvgRenderer>
+
+namespace
+{
+// smileys, icons and avatars placeholders, with room for the sizes a resizing video call goes through
+const int maxCostKiB = 32 * 1024;
+}
+
+PixmapCache::PixmapCache()
+    : pixmaps{maxCostKiB}
+{
+}
+
+bool PixmapCache::Key::operator==(const Key& other) const
+{
+    return filename == other.filename && size == other.size && pixelRatio == other.pixelRatio
+            && stretched == other.stretched;
+}
+
+uint qHash(const PixmapCache::Key& key)
+{
+    return qHash(key.filename) ^ qHash(key.size.width() << 16 | key.size.height())
+            ^ qHash(qRound(key.pixelRatio * 100) << 1 | key.stretched);
+}
 
 QPixmap PixmapCache::get(const QString &filename, QSize size)
 {
-    auto itr = cache.find(filename);
+    const Key key{filename, size, qApp->devicePixelRatio(), false};
+
+    if (const QPixmap* pixmap = find(key))
+        return *pixmap;
 
-    if (itr == cache.end())
+    auto itr = icons.find(filename);
+    if (itr == icons.end())
     {
         QIcon icon;
         icon.addFile(filename);
 
-        cache.insert(filename, icon);
-        return icon.pixmap(size);
+        itr = icons.insert(filename, icon);
     }
 
-    return itr.value().pixmap(size);
+    QPixmap rendered = itr.value().pixmap(size);
+    store(key, rendered);
+    return rendered;
+}
+
+QPixmap PixmapCache::getStretchedSvg(const QString& filename, QSize size, qreal pixelRatio)
+{
+    const Key key{filename, size, pixelRatio, true};
+
+    if (const QPixmap* pixmap = find(key))
+        return *pixmap;
+
+    QSvgRenderer renderer(filename);
+    QPixmap rendered(size * pixelRatio);
+    rendered.fill(Qt::transparent);
+    QPainter painter(&rendered);
+    renderer.render(&painter, rendered.rect());
+    painter.end();
+    rendered.setDevicePixelRatio(pixelRatio);
+
+    store(key, rendered);
+    return rendered;
+}
+
+void PixmapCache::insert(const QString& filename, QSize size, const QImage& image)
+{
+    if (image.isNull())
+        return;
+
+    store(Key{filename, size, image.devicePixelRatio(), false}, QPixmap::fromImage(image));
+}
+
+PixmapCache::Stats PixmapCache::getStats() const
+{
+    Stats current = stats;
+    current.usedKiB = pixmaps.totalCost();
+    return current;
+}
+
+const QPixmap* PixmapCache::find(const Key& key)
+{
+    const QPixmap* pixmap = pixmaps.object(key);
+    if (pixmap)
+    {
+        ++stats.hits;
+        return pixmap;
+    }
+
+    ++stats.misses;
+    Trace::count("PixmapCache misses", static_cast<qint64>(stats.misses));
+    Trace::count("PixmapCache hits", static_cast<qint64>(stats.hits));
+    return nullptr;
+}
+
+void PixmapCache::store(const Key& key, const QPixmap& pixmap)
+{
+    int cost = qMax(1, pixmap.width() * pixmap.height() * pixmap.depth() / 8 / 1024);
+    pixmaps.insert(key, new QPixmap(pixmap), cost);
+}
+
+QImage PixmapCache::render(const QString& filename, QSize size, qreal pixelRatio)
+{
+    QImageReader reader(filename);
+
+    // like QIcon, scalable images fill the size but bitmaps are only ever scaled down
+    QSize target = size * pixelRatio;
+    QSize original = reader.size();
+    if (original.isValid() && (reader.format() == "svg" || original.width() > target.width() || original.height() > target.height()))
+        reader.setScaledSize(original.scaled(target, Qt::KeepAspectRatio));
+    else if (!original.isValid())
+        reader.setScaledSize(target);
+
+    QImage image = reader.read();
+    image.setDevicePixelRatio(pixelRatio);
+    return image;
 }
 
 PixmapCache &PixmapCache::getInstance()
@@ -20,23 +20,58 @@
 #ifndef ICONCACHE_H
 #define ICONCACHE_H
 
+#include <QCache>
 #include <QIcon>
+#include <QImage>
 #include <QPixmap>
 #include <QHash>
 
 class PixmapCache
 {
 public:
+    struct Stats
+    {
+        quint64 hits = 0;
+        quint64 misses = 0;
+        int usedKiB = 0;
+    };
+
+    /// Returns the file rendered at size for the screen's pixel ratio, each size is only rendered once
     QPixmap get(const QString& filename, QSize size);
+    /// Returns the SVG stretched to fill exactly size, in device pixels of the given ratio
+    QPixmap getStretchedSvg(const QString& filename, QSize size, qreal pixelRatio);
+    /// Adds an image made by render, so get doesn't have to render it on the GUI thread
+    void insert(const QString& filename, QSize size, const QImage& image);
+    Stats getStats() const;
     static PixmapCache& getInstance();
 
+    /// Renders the file like QIcon would for get, can be called from any thread
+    static QImage render(const QString& filename, QSize size, qreal pixelRatio);
+
 protected:
-    PixmapCache() {}
+    PixmapCache();
     PixmapCache(PixmapCache&) = delete;
     PixmapCache& operator=(const PixmapCache&) = delete;
 
 private:
-    QHash<QString, QIcon> cache;
+    struct Key
+    {
+        QString filename;
+        QSize size;
+        qreal pixelRatio;
+        bool stretched; ///< Rendered by getStretchedSvg, which ignores the aspect ratio
+
+        bool operator==(const Key& other) const;
+    };
+
+    friend uint qHash(const Key& key);
+
+    const QPixmap* find(const Key& key);
+    void store(const Key& key, const QPixmap& pixmap);
+
+    QHash<QString, QIcon> icons;
+    QCache<Key, QPixmap> pixmaps; ///< Costs are in KiB, the least recently used go first
+    Stats stats;
 };
 
 #endif // ICONCACHE_H
@@ -0,0 +1,63 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "callstats.h"
+#include "src/captureclock.h"
+
+#include <QStringList>
+
+QString CallStats::summary() const
+{
+    QStringList parts;
+    parts << QString("audio sent %1 (%2 errors, %3 retries) received %4 at %5 kb/s")
+             .arg(audioFramesSent.load()).arg(audioSendErrors.load()).arg(audioSendRetries.load())
+             .arg(audioFramesReceived.load()).arg(audioBitrate.load());
+    parts << QString("video sent %1 (%2 errors, %3 retries, %4 dropped, %5 stale) received %6 at %7 kb/s")
+             .arg(videoFramesSent.load()).arg(videoSendErrors.load()).arg(videoSendRetries.load())
+             .arg(videoFramesDropped.load()).arg(videoFramesStale.load())
+             .arg(videoFramesReceived.load()).arg(videoBitrate.load());
+    parts << QString("convert %1 us, encode %2 us").arg(convertTime.load()).arg(encodeTime.load());
+    parts << QString("latency audio %1 us, video %2 us, skew %3 us")
+             .arg(audioLatency.load()).arg(videoLatency.load()).arg(avSkew());
+    return parts.join(", ");
+}
+
+qint32 CallStats::avSkew() const
+{
+    const quint32 video = videoLatency.load();
+    const quint32 audio = audioLatency.load();
+    if (!video || !audio)
+        return 0;
+
+    return static_cast<qint32>(video) - static_cast<qint32>(audio);
+}
+
+quint32 CallStats::sinceSetup() const
+{
+    const qint64 elapsed = (CaptureClock::now() - setupStart.load()) / 1000;
+    return static_cast<quint32>(qMax<qint64>(1, elapsed));
+}
+
+QString CallStats::setupSummary() const
+{
+    return QString("audio opened in %1 ms, camera in %2 ms, answered after %3 ms, "
+                   "first audio after %4 ms, first video after %5 ms")
+            .arg(setupAudioTime.load()).arg(setupCameraTime.load()).arg(answerDelay.load())
+            .arg(firstAudioDelay.load()).arg(firstVideoDelay.load());
+}
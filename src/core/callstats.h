@@ -0,0 +1,70 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CALLSTATS_H
+#define CALLSTATS_H
+
+#include <atomic>
+#include <QString>
+
+/**
+@brief Counters of a call's media, for triaging call quality complaints.
+
+Every member is an atomic updated from the AV hot paths without locking,
+readers can look at them from any thread at any time.
+*/
+struct CallStats
+{
+    std::atomic<quint64> audioFramesSent{0};
+    std::atomic<quint64> audioSendErrors{0};
+    std::atomic<quint64> audioSendRetries{0}; ///< toxav was busy and we tried again
+    std::atomic<quint64> audioFramesReceived{0};
+    std::atomic<quint64> videoFramesSent{0};
+    std::atomic<quint64> videoSendErrors{0};
+    std::atomic<quint64> videoSendRetries{0};
+    std::atomic<quint64> videoFramesDropped{0}; ///< Replaced by a newer frame before we could send them
+    std::atomic<quint64> videoFramesStale{0}; ///< Captured too long ago by the time we could encode them
+    std::atomic<quint64> videoFramesReceived{0};
+    std::atomic<quint32> audioBitrate{0}; ///< In kb/s, as last recommended by toxav
+    std::atomic<quint32> videoBitrate{0};
+    std::atomic<quint32> convertTime{0}; ///< In µs, to get the last frame we sent into the encoder's format
+    std::atomic<quint32> encodeTime{0}; ///< In µs, for toxav to encode and send the last frame
+    std::atomic<quint32> audioLatency{0}; ///< In µs, from the capture of the last audio frame we sent until it was sent
+    std::atomic<quint32> videoLatency{0}; ///< In µs, the same for the last video frame
+
+    std::atomic<qint64> setupStart{0}; ///< In µs of the CaptureClock, when we placed the call or it rang
+    std::atomic<quint32> setupAudioTime{0}; ///< In ms, to open the audio output and subscribe to the input
+    std::atomic<quint32> setupCameraTime{0}; ///< In ms, to open the camera, meanwhile the call rings
+    std::atomic<quint32> answerDelay{0}; ///< In ms since setupStart, until the call was answered
+    std::atomic<quint32> firstAudioDelay{0}; ///< In ms since setupStart, until the peer's first audio frame
+    std::atomic<quint32> firstVideoDelay{0}; ///< In ms since setupStart, until the peer's first video frame
+
+    /// How much later than the audio our video leaves, in µs, negative if it's the audio that's late
+    qint32 avSkew() const;
+
+    /// In ms, at least 1 so it can't be mistaken for a phase that didn't happen
+    quint32 sinceSetup() const;
+
+    /// One line with every counter, for the logs
+    QString summary() const;
+    /// One line with the setup phases, for the logs
+    QString setupSummary() const;
+};
+
+#endif // CALLSTATS_H
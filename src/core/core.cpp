@@ -29,7 +29,9 @@
 #include "src/net/avatarbroadcaster.h"
 #include "src/persistence/profile.h"
 #include "corefile.h"
+#include "coreevents.h"
 #include "src/video/camerasource.h"
+#include "src/trace.h"
 
 #include <tox/tox.h>
 #include <tox/toxav.h>
@@ -38,6 +40,7 @@
 #include <cassert>
 #include <limits>
 #include <functional>
+#include <algorithm>
 
 #include <QDebug>
 #include <QDir>
@@ -49,24 +52,38 @@
 #include <QCoreApplication>
 #include <QDateTime>
 #include <QList>
+#include <QHash>
 #include <QBuffer>
-#include <QMutexLocker>
 
 const QString Core::CONFIG_FILE_NAME = "data";
 const QString Core::TOX_EXT = ".tox";
 QThread* Core::coreThread{nullptr};
 
 #define MAX_GROUP_MESSAGE_LEN 1024
+#define MAX_GROUP_QUEUE_LEN 512 // Pieces of messages queued per group, a relaying bot gets failures past that
+#define MAX_GROUP_SEND_RETRIES 6 // Toxcore refusing a piece that often, over a few seconds, drops its message
+#define TOX_SAVE_DELAY 1000 // How long the save must stay quiet before we write it, in ms
+#define TOX_SAVE_MAX_DELAY 5000 // How long a stream of changes may postpone the write, in ms
 
 Core::Core(QThread *CoreThread, Profile& profile) :
-    tox(nullptr), av(nullptr), profile(profile), ready{false}
+    tox(nullptr), av(nullptr), profile(profile), ready{false}, lastMessageId{0}, groupQueued{0}, maxGroupQueued{0},
+    groupMessagesSent{0}, groupMessagesDropped{0}, friendRequestTotal{0}, friendRequestsSent{0}, nextIteration{0}, iterations{0},
+    iterationLatency{0}, iterationDuration{0}, maxIterationLatency{0}, maxIterationDuration{0}
 {
     coreThread = CoreThread;
 
+    // a coarse timer may wake us up to 5% of the interval late, toxcore wants its deadlines
     toxTimer = new QTimer(this);
     toxTimer->setSingleShot(true);
+    toxTimer->setTimerType(Qt::PreciseTimer);
+    iterationClock.start();
     connect(toxTimer, &QTimer::timeout, this, &Core::process);
+    saveTimer = new QTimer(this);
+    saveTimer->setSingleShot(true);
+    connect(saveTimer, &QTimer::timeout, this, &Core::writeToxSave);
     connect(&Settings::getInstance(), &Settings::dhtServerListChanged, this, &Core::process);
+    connect(&Settings::getInstance(), &Settings::fileTransferLimitsChanged, this, [](){CoreFile::updateRateLimits();});
+    CoreFile::updateRateLimits();
 
 }
 
@@ -82,6 +99,14 @@ void Core::deadifyTox()
         tox_kill(tox);
         tox = nullptr;
     }
+
+    {
+        QMutexLocker locker{&friendKeysLock};
+        friendKeys.clear();
+    }
+
+    QMutexLocker locker{&groupPeersLock};
+    groupPeers.clear();
 }
 
 Core::~Core()
@@ -219,6 +244,8 @@ void Core::makeTox(QByteArray savedata)
 
 void Core::start()
 {
+    QElapsedTimer clock;
+    clock.start();
     bool isNewProfile = profile.isNewProfile();
     if (isNewProfile)
     {
@@ -238,6 +265,7 @@ void Core::start()
         }
         makeTox(savedata);
     }
+    qDebug() << "Started toxcore in" << clock.restart() << "ms";
 
     qsrand(time(nullptr));
 
@@ -267,6 +295,7 @@ void Core::start()
         checkEncryptedHistory();
 
     loadFriends();
+    qDebug() << "Loaded the friends in" << clock.restart() << "ms";
 
     tox_callback_friend_request(tox, onFriendRequest, this);
     tox_callback_friend_message(tox, onFriendMessage, this);
@@ -316,6 +345,10 @@ void Core::start()
     if (isReady())
         GUI::setEnabled(true);
 
+    // don't wait for the tolerance to run out once before the first bootstrap
+    if (tox_self_get_connection_status(tox) == TOX_CONNECTION_NONE)
+        bootstrapDht();
+
     process(); // starts its own timer
     av->start();
 }
@@ -328,9 +361,12 @@ void Core::start()
  * downtime, but lets be conservative for now. Edit: now ~~40~~ 30.
  */
 #define CORE_DISCONNECT_TOLERANCE 30
+// Events for the GUI are sent at most once per frame, in ms
+#define CORE_EVENT_BATCH_INTERVAL 16
 
 void Core::process()
 {
+    TraceSpan span{"Core::process"};
     if (!isReady())
     {
         av->stop();
@@ -338,7 +374,27 @@ void Core::process()
     }
 
     static int tolerance = CORE_DISCONNECT_TOLERANCE;
+    const qint64 iterationStart = iterationClock.nsecsElapsed();
+    if (nextIteration)
+    {
+        // anything else queued on the Core thread delays us, this is how much
+        const qint64 latency = qMax<qint64>(0, iterationStart - nextIteration);
+        iterationLatency += latency;
+        const quint32 latencyUs = static_cast<quint32>(latency / 1000);
+        if (latencyUs > maxIterationLatency)
+            maxIterationLatency = latencyUs;
+    }
+
     tox_iterate(tox);
+    CoreFile::sendScheduledChunks(this);
+    CoreFile::sendQueuedAvatars(this);
+    CoreFile::publishProgress(this);
+    sendQueuedMessages();
+    sendQueuedGroupMessages();
+
+    if (!pendingEvents.isEmpty()
+            && (!lastEventBatch.isValid() || lastEventBatch.elapsed() >= CORE_EVENT_BATCH_INTERVAL))
+        sendEvents();
 
 #ifdef DEBUG
     //we want to see the debug messages immediately
@@ -356,9 +412,67 @@ void Core::process()
     }
 
     unsigned sleeptime = qMin(tox_iteration_interval(tox), CoreFile::corefileIterationInterval());
+    const qint64 messageWait = messageQueue.msecsToNext();
+    if (messageWait >= 0)
+        sleeptime = qMin<unsigned>(sleeptime, messageWait);
+    const qint64 groupMessageWait = groupQueue.msecsToNext();
+    if (groupMessageWait >= 0)
+        sleeptime = qMin<unsigned>(sleeptime, groupMessageWait);
+    if (!pendingEvents.isEmpty())
+        sleeptime = qMin<unsigned>(sleeptime, qMax<qint64>(0, CORE_EVENT_BATCH_INTERVAL - lastEventBatch.elapsed()));
+
+    const qint64 iterationEnd = iterationClock.nsecsElapsed();
+    const qint64 duration = iterationEnd - iterationStart;
+    iterationDuration += duration;
+    const quint32 durationUs = static_cast<quint32>(duration / 1000);
+    if (durationUs > maxIterationDuration)
+        maxIterationDuration = durationUs;
+    ++iterations;
+
+    nextIteration = iterationEnd + static_cast<qint64>(sleeptime) * 1000000;
     toxTimer->start(sleeptime);
 }
 
+/**
+@brief Returns how punctually and how long the Core iterated toxcore since it started.
+
+The latency is what the other work of the Core thread costs the network, file I/O,
+message sending and saving all wait their turn with the iterations.
+*/
+Core::IterationStats Core::getIterationStats() const
+{
+    IterationStats stats;
+    stats.iterations = iterations;
+    if (stats.iterations)
+    {
+        stats.meanLatency = static_cast<quint32>(iterationLatency / stats.iterations / 1000);
+        stats.meanDuration = static_cast<quint32>(iterationDuration / stats.iterations / 1000);
+    }
+    stats.maxLatency = maxIterationLatency;
+    stats.maxDuration = maxIterationDuration;
+    return stats;
+}
+
+Core::GroupQueueStats Core::getGroupQueueStats() const
+{
+    GroupQueueStats stats;
+    stats.queued = groupQueued;
+    stats.maxQueued = maxGroupQueued;
+    stats.sent = groupMessagesSent;
+    stats.dropped = groupMessagesDropped;
+    return stats;
+}
+
+/**
+@brief Sends the events the callbacks gathered since the last batch to the GUI.
+*/
+void Core::sendEvents()
+{
+    emit eventsReceived(pendingEvents);
+    pendingEvents.clear();
+    lastEventBatch.start();
+}
+
 bool Core::checkConnection()
 {
     static bool isConnected = false;
@@ -368,6 +482,7 @@ bool Core::checkConnection()
     if (toxConnected && !isConnected)
     {
         qDebug() << "Connected to the DHT";
+        scoreBootstrap(true);
         emit connected();
         isConnected = true;
         //if (count) qDebug() << "disconnect count:" << count;
@@ -383,6 +498,29 @@ bool Core::checkConnection()
     return isConnected;
 }
 
+namespace
+{
+/// Nodes we bootstrap from at once, the best ranked ones and one other to give it a chance
+const int bootstrapBatchSize = 4;
+/// Past this many attempts on a node, its counters are halved so it can climb back up
+const quint32 maxNodeAttempts = 64;
+/// A batch gets at least this long to get us online, in ms, before we count it as failed
+const qint64 minBootstrapTime = 5000;
+
+/// Higher is better, nodes we don't know yet rank in the middle
+double nodeRank(const DhtNodeScore& score)
+{
+    return (score.successes + 1.0) / (score.successes + score.failures + 2.0);
+}
+}
+
+/**
+@brief Bootstraps from a batch of the best ranked DHT nodes at once.
+
+The nodes rank by how often they got us online, then by how fast. Whether the previous
+batch got us online by now goes on its nodes' scores. Toxcore keeps the DHT peers it
+found in its save, so a restart usually only needs the bootstrap if those went stale.
+*/
 void Core::bootstrapDht()
 {
     const Settings& s = Settings::getInstance();
@@ -394,12 +532,33 @@ void Core::bootstrapDht()
         qWarning() << "no bootstrap list?!?";
         return;
     }
-    static int j = qrand() % listSize;
 
-    int i=0;
-    while (i < 2) // i think the more we bootstrap, the more we jitter because the more we overwrite nodes
+    if (!bootstrapBatch.isEmpty() && bootstrapClock.elapsed() < minBootstrapTime)
+        return;
+    scoreBootstrap(false);
+
+    const QHash<QString, DhtNodeScore> scores = s.getDhtNodeScores();
+    // shuffled first, so that equally ranked nodes take turns
+    std::random_shuffle(dhtServerList.begin(), dhtServerList.end(), [](int n){return qrand() % n;});
+    std::stable_sort(dhtServerList.begin(), dhtServerList.end(), [&](const DhtServer& a, const DhtServer& b)
+    {
+        const DhtNodeScore scoreA = scores.value(a.userId), scoreB = scores.value(b.userId);
+        const double rankA = nodeRank(scoreA), rankB = nodeRank(scoreB);
+        if (rankA != rankB)
+            return rankA > rankB;
+
+        // an unknown connection time goes last
+        if ((scoreA.connectTime == 0) != (scoreB.connectTime == 0))
+            return scoreB.connectTime == 0;
+        return scoreA.connectTime < scoreB.connectTime;
+    });
+
+    if (listSize > bootstrapBatchSize)
+        std::swap(dhtServerList[bootstrapBatchSize - 1], dhtServerList[bootstrapBatchSize - 1 + qrand() % (listSize - bootstrapBatchSize + 1)]);
+
+    for (int i = 0; i < qMin(bootstrapBatchSize, listSize); ++i)
     {
-        const DhtServer& dhtServer = dhtServerList[j % listSize];
+        const DhtServer& dhtServer = dhtServerList[i];
         qDebug() << "Connecting to "+QString(dhtServer.address.toLatin1().data())
                     +':'+QString().setNum(dhtServer.port)+" ("+dhtServer.name+')';
 
@@ -415,9 +574,46 @@ void Core::bootstrapDht()
             qDebug() << "Error adding TCP relay from "+dhtServer.name;
         }
 
-        j++;
-        i++;
+        bootstrapBatch << dhtServer.userId;
     }
+    bootstrapClock.start();
+}
+
+/**
+@brief Scores the nodes of our last bootstrap, on whether they got us online.
+*/
+void Core::scoreBootstrap(bool connected)
+{
+    if (bootstrapBatch.isEmpty())
+        return;
+
+    Settings& s = Settings::getInstance();
+    const QHash<QString, DhtNodeScore> scores = s.getDhtNodeScores();
+    const quint32 elapsed = static_cast<quint32>(bootstrapClock.elapsed());
+    for (const QString& userId : bootstrapBatch)
+    {
+        DhtNodeScore score = scores.value(userId);
+        if (connected)
+        {
+            ++score.successes;
+            score.connectTime = score.connectTime ? (score.connectTime * 3 + elapsed) / 4 : elapsed;
+        }
+        else
+        {
+            ++score.failures;
+        }
+
+        if (score.successes + score.failures > maxNodeAttempts)
+        {
+            score.successes /= 2;
+            score.failures /= 2;
+        }
+        s.setDhtNodeScore(userId, score);
+    }
+
+    if (connected)
+        qDebug() << "Bootstrapped in" << elapsed << "ms";
+    bootstrapBatch.clear();
 }
 
 void Core::onFriendRequest(Tox*/* tox*/, const uint8_t* cUserId,
@@ -431,7 +627,7 @@ void Core::onFriendMessage(Tox*/* tox*/, uint32_t friendId, TOX_MESSAGE_TYPE typ
                            const uint8_t* cMessage, size_t cMessageSize, void* core)
 {
     bool isAction = (type == TOX_MESSAGE_TYPE_ACTION);
-    emit static_cast<Core*>(core)->friendMessageReceived(friendId,CString::toString(cMessage, cMessageSize), isAction);
+    static_cast<Core*>(core)->pendingEvents.addFriendMessage(friendId, CString::toString(cMessage, cMessageSize), isAction);
 }
 
 void Core::onFriendNameChange(Tox*/* tox*/, uint32_t friendId,
@@ -442,7 +638,7 @@ void Core::onFriendNameChange(Tox*/* tox*/, uint32_t friendId,
 
 void Core::onFriendTypingChange(Tox*/* tox*/, uint32_t friendId, bool isTyping, void *core)
 {
-    emit static_cast<Core*>(core)->friendTypingChanged(friendId, isTyping ? true : false);
+    static_cast<Core*>(core)->pendingEvents.addFriendTyping(friendId, isTyping);
 }
 
 void Core::onStatusMessageChanged(Tox*/* tox*/, uint32_t friendId, const uint8_t* cMessage,
@@ -470,22 +666,31 @@ void Core::onUserStatusChanged(Tox*/* tox*/, uint32_t friendId, TOX_USER_STATUS
             break;
     }
 
+    static_cast<Core*>(core)->pendingEvents.addFriendStatus(friendId, status);
     emit static_cast<Core*>(core)->friendStatusChanged(friendId, status);
 }
 
 void Core::onConnectionStatusChanged(Tox*/* tox*/, uint32_t friendId, TOX_CONNECTION status, void* core)
 {
     Status friendStatus = status != TOX_CONNECTION_NONE ? Status::Online : Status::Offline;
+    static_cast<Core*>(core)->pendingEvents.addFriendStatus(friendId, friendStatus);
     emit static_cast<Core*>(core)->friendStatusChanged(friendId, friendStatus);
     if (friendStatus == Status::Offline)
         static_cast<Core*>(core)->checkLastOnline(friendId);
     CoreFile::onConnectionStatusChanged(static_cast<Core*>(core), friendId, friendStatus != Status::Offline);
+
+    // toxcore drops the messages it didn't deliver, they go again once the friend is back
+    MessageQueue& messages = static_cast<Core*>(core)->messageQueue;
+    if (friendStatus == Status::Offline)
+        messages.setOffline(friendId, Settings::getInstance().getFauxOfflineMessaging());
+    else
+        messages.setOnline(friendId);
 }
 
 void Core::onGroupAction(Tox*, int groupnumber, int peernumber, const uint8_t *action, uint16_t length, void* _core)
 {
     Core* core = static_cast<Core*>(_core);
-    emit core->groupMessageReceived(groupnumber, peernumber, CString::toString(action, length), true);
+    core->pendingEvents.addGroupMessage(groupnumber, peernumber, CString::toString(action, length), true);
 }
 
 void Core::onGroupInvite(Tox*, int32_t friendNumber, uint8_t type, const uint8_t *data, uint16_t length,void *core)
@@ -510,13 +715,36 @@ void Core::onGroupInvite(Tox*, int32_t friendNumber, uint8_t type, const uint8_t
 void Core::onGroupMessage(Tox*, int groupnumber, int peernumber, const uint8_t * message, uint16_t length, void *_core)
 {
     Core* core = static_cast<Core*>(_core);
-    emit core->groupMessageReceived(groupnumber, peernumber, CString::toString(message, length), false);
+    core->pendingEvents.addGroupMessage(groupnumber, peernumber, CString::toString(message, length), false);
 }
 
-void Core::onGroupNamelistChange(Tox*, int groupnumber, int peernumber, uint8_t change, void *core)
+void Core::onGroupNamelistChange(Tox*, int groupnumber, int peernumber, uint8_t change, void *_core)
 {
     qDebug() << QString("Group namelist change %1:%2 %3").arg(groupnumber).arg(peernumber).arg(change);
-    emit static_cast<Core*>(core)->groupNamelistChanged(groupnumber, peernumber, change);
+    Core* core = static_cast<Core*>(_core);
+
+    // toxcore may renumber the other peers when one joins or leaves, so we read the group again,
+    // but a new name only changes that peer
+    if (change == TOX_CHAT_CHANGE_PEER_NAME)
+    {
+        QMutexLocker locker{&core->groupPeersLock};
+        auto group = core->groupPeers.find(groupnumber);
+        if (group != core->groupPeers.end() && peernumber >= 0 && peernumber < group->size())
+        {
+            uint8_t nameArray[TOX_MAX_NAME_LENGTH];
+            int length = tox_group_peername(core->tox, groupnumber, peernumber, nameArray);
+            if (length >= 0)
+                (*group)[peernumber].name = CString::toString(nameArray, length);
+        }
+    }
+    else
+    {
+        QVector<GroupPeer> peers = core->fetchGroupPeers(groupnumber);
+        QMutexLocker locker{&core->groupPeersLock};
+        core->groupPeers[groupnumber] = peers;
+    }
+
+    core->pendingEvents.addGroupNamelistChange(groupnumber, peernumber, change);
 }
 
 void Core::onGroupTitleChange(Tox*, int groupnumber, int peernumber, const uint8_t* title, uint8_t len, void* _core)
@@ -529,9 +757,12 @@ void Core::onGroupTitleChange(Tox*, int groupnumber, int peernumber, const uint8
     emit core->groupTitleChanged(groupnumber, author, CString::toString(title, len));
 }
 
-void Core::onReadReceiptCallback(Tox*, uint32_t friendnumber, uint32_t receipt, void *core)
+void Core::onReadReceiptCallback(Tox*, uint32_t friendnumber, uint32_t receipt, void *_core)
 {
-     emit static_cast<Core*>(core)->receiptRecieved(friendnumber, receipt);
+    Core* core = static_cast<Core*>(_core);
+    int id = core->messageQueue.receive(friendnumber, receipt);
+    if (id)
+        emit core->receiptRecieved(friendnumber, id);
 }
 
 void Core::acceptFriendRequest(const QString& userId)
@@ -543,7 +774,12 @@ void Core::acceptFriendRequest(const QString& userId)
     }
     else
     {
-        profile.saveToxSave();
+        {
+            QMutexLocker locker{&friendKeysLock};
+            friendKeys.insert(ToxPk(userId));
+        }
+        updateGroupPeerFriend(ToxPk(userId), friendId);
+        saveLater();
         emit friendAdded(friendId, userId);
         emit friendshipChanged(friendId);
     }
@@ -565,54 +801,206 @@ void Core::requestFriendship(const QString& friendAddress, const QString& messag
     {
         emit failedToAddFriend(userId, tr("Friend is already added"));
     }
-    else
+    else if (!addFriendRequest(friendAddress, message))
     {
-        CString cMessage(message);
+        emit failedToAddFriend(userId);
+    }
+    saveLater();
+}
+
+/**
+@brief Sends a friend request to each address, for imports of whole lists.
+
+The addresses are all checked here against the friend keys, ourselves and each other,
+the rejected ones are reported right away. The others are queued and sent a few per turn
+of the Core thread's event loop, so toxcore keeps iterating during a long import,
+and the tox save is written once when the queue is empty.
+*/
+void Core::requestFriendships(const QStringList& friendAddresses, const QString& message)
+{
+    const int total = friendAddresses.size();
+    const ToxPk selfPk(getSelfId().publicKey);
+    QSet<ToxPk> batchKeys;
+    bool wasIdle = friendRequestQueue.isEmpty();
 
-        uint32_t friendId = tox_friend_add(tox, CFriendAddress(friendAddress).data(),
-                                      cMessage.data(), cMessage.size(), nullptr);
-        if (friendId == std::numeric_limits<uint32_t>::max())
+    {
+        QMutexLocker locker{&friendKeysLock};
+        for (int i = 0; i < total; ++i)
         {
-            qDebug() << "Failed to request friendship";
-            emit failedToAddFriend(userId);
+            const QString address = friendAddresses[i].trimmed();
+            const QString userId = address.left(TOX_PUBLIC_KEY_SIZE * 2);
+            QString error;
+            if (message.isEmpty())
+                error = tr("You need to write a message with your request");
+            else if (message.size() > TOX_MAX_FRIEND_REQUEST_LENGTH)
+                error = tr("Your message is too long!");
+            else if (!ToxId::isToxId(address))
+                error = tr("Invalid Tox ID format");
+
+            if (error.isEmpty())
+            {
+                ToxPk key(userId);
+                if (key == selfPk)
+                    error = tr("You can't add yourself as a friend!");
+                else if (friendKeys.contains(key))
+                    error = tr("Friend is already added");
+                else if (batchKeys.contains(key))
+                    error = tr("This Tox ID is already in the list");
+                else
+                    batchKeys.insert(key);
+            }
+
+            if (error.isEmpty())
+                friendRequestQueue.enqueue({i, address, message});
+            else
+                emit friendRequestProgress(i, total, userId, error);
+        }
+    }
+
+    friendRequestTotal += total;
+    if (friendRequestQueue.isEmpty())
+        sendQueuedFriendRequests();
+    else if (wasIdle)
+        QMetaObject::invokeMethod(this, "sendQueuedFriendRequests", Qt::QueuedConnection);
+}
+
+/**
+@brief Sends the next few queued friend requests, then gives the event loop back to toxcore.
+*/
+void Core::sendQueuedFriendRequests()
+{
+    const int batchSize = 16;
+    const int total = friendRequestTotal;
+    for (int i = 0; i < batchSize && !friendRequestQueue.isEmpty(); ++i)
+    {
+        QueuedFriendRequest request = friendRequestQueue.dequeue();
+        const QString userId = request.address.left(TOX_PUBLIC_KEY_SIZE * 2);
+        if (addFriendRequest(request.address, request.message))
+        {
+            ++friendRequestsSent;
+            emit friendRequestProgress(request.index, total, userId, QString());
         }
         else
         {
-            qDebug() << "Requested friendship of "<<friendId;
-            // Update our friendAddresses
-            Settings::getInstance().updateFriendAdress(friendAddress);
-            QString inviteStr = tr("/me offers friendship.");
-            if (message.length())
-                inviteStr = tr("/me offers friendship, \"%1\"").arg(message);
-
-            Profile* profile = Nexus::getProfile();
-            if (profile->isHistoryEnabled())
-                profile->getHistory()->addNewMessage(userId, inviteStr, getSelfId().publicKey, QDateTime::currentDateTime(), true, QString());
-            emit friendAdded(friendId, userId);
-            emit friendshipChanged(friendId);
+            emit friendRequestProgress(request.index, total, userId, tr("Couldn't request friendship"));
         }
     }
-    profile.saveToxSave();
+
+    if (!friendRequestQueue.isEmpty())
+    {
+        QMetaObject::invokeMethod(this, "sendQueuedFriendRequests", Qt::QueuedConnection);
+        return;
+    }
+
+    qDebug() << "Sent" << friendRequestsSent << "of" << total << "friend requests";
+    emit friendRequestsFinished(friendRequestsSent, total);
+    friendRequestTotal = friendRequestsSent = 0;
+    saveLater();
 }
 
-int Core::sendMessage(uint32_t friendId, const QString& message)
+bool Core::addFriendRequest(const QString& friendAddress, const QString& message)
 {
-    QMutexLocker ml(&messageSendMutex);
+    const QString userId = friendAddress.mid(0, TOX_PUBLIC_KEY_SIZE * 2);
     CString cMessage(message);
-    int receipt = tox_friend_send_message(tox, friendId, TOX_MESSAGE_TYPE_NORMAL,
-                                          cMessage.data(), cMessage.size(), nullptr);
-    emit messageSentResult(friendId, message, receipt);
-    return receipt;
+
+    uint32_t friendId = tox_friend_add(tox, CFriendAddress(friendAddress).data(),
+                                  cMessage.data(), cMessage.size(), nullptr);
+    if (friendId == std::numeric_limits<uint32_t>::max())
+    {
+        qDebug() << "Failed to request friendship";
+        return false;
+    }
+
+    qDebug() << "Requested friendship of "<<friendId;
+    {
+        QMutexLocker locker{&friendKeysLock};
+        friendKeys.insert(ToxPk(friendAddress));
+    }
+    updateGroupPeerFriend(ToxPk(friendAddress), friendId);
+    // Update our friendAddresses
+    Settings::getInstance().updateFriendAdress(friendAddress);
+    QString inviteStr = tr("/me offers friendship.");
+    if (message.length())
+        inviteStr = tr("/me offers friendship, \"%1\"").arg(message);
+
+    Profile* profile = Nexus::getProfile();
+    if (profile->isHistoryEnabled())
+        profile->getHistory()->addNewMessage(userId, inviteStr, getSelfId().publicKey, QDateTime::currentDateTime(), true, QString());
+    emit friendAdded(friendId, userId);
+    emit friendshipChanged(friendId);
+    return true;
+}
+
+int Core::sendMessage(uint32_t friendId, const QString& message)
+{
+    return queueMessage(friendId, message, false);
 }
 
 int Core::sendAction(uint32_t friendId, const QString &action)
 {
-    QMutexLocker ml(&messageSendMutex);
-    CString cMessage(action);
-    int receipt = tox_friend_send_message(tox, friendId, TOX_MESSAGE_TYPE_ACTION,
-                                  cMessage.data(), cMessage.size(), nullptr);
-    emit messageSentResult(friendId, action, receipt);
-    return receipt;
+    return queueMessage(friendId, action, true);
+}
+
+/**
+@brief Gives the message an id and queues it on the Core thread.
+
+The receipt the GUI gets back later is that id, whenever toxcore actually took the message.
+*/
+int Core::queueMessage(uint32_t friendId, const QString& message, bool isAction)
+{
+    int id = ++lastMessageId;
+    if (!id) // wrapped around, 0 is for failures
+        id = ++lastMessageId;
+
+    if (QThread::currentThread() == coreThread)
+        pushMessage(friendId, id, message, isAction);
+    else
+        QMetaObject::invokeMethod(this, "pushMessage", Q_ARG(uint32_t, friendId), Q_ARG(int, id),
+                                  Q_ARG(QString, message), Q_ARG(bool, isAction));
+    return id;
+}
+
+void Core::pushMessage(uint32_t friendId, int id, const QString& message, bool isAction)
+{
+    messageQueue.push({friendId, id, message, isAction});
+    sendQueuedMessages();
+}
+
+/**
+@brief Hands the queued messages to toxcore, as long as its send queues have room.
+
+Called on every Core iteration. A friend whose send queue is full waits a bit,
+one that's offline waits for its connection if we send offline messages.
+*/
+void Core::sendQueuedMessages()
+{
+    MessageQueue::Message message;
+    while (messageQueue.next(message))
+    {
+        CString cMessage(message.text);
+        TOX_ERR_FRIEND_SEND_MESSAGE error;
+        uint32_t receipt = tox_friend_send_message(tox, message.friendId,
+                                                   message.isAction ? TOX_MESSAGE_TYPE_ACTION : TOX_MESSAGE_TYPE_NORMAL,
+                                                   cMessage.data(), cMessage.size(), &error);
+        switch (error)
+        {
+        case TOX_ERR_FRIEND_SEND_MESSAGE_OK:
+            messageQueue.sent(message.friendId, receipt);
+            emit messageSentResult(message.friendId, message.text, message.id);
+            break;
+        case TOX_ERR_FRIEND_SEND_MESSAGE_SENDQ:
+            messageQueue.delay(message.friendId);
+            break;
+        case TOX_ERR_FRIEND_SEND_MESSAGE_FRIEND_NOT_CONNECTED:
+            messageQueue.setOffline(message.friendId, Settings::getInstance().getFauxOfflineMessaging());
+            break;
+        default:
+            qWarning() << "sendQueuedMessages: Can't send a message, error" << error;
+            messageQueue.drop(message.friendId);
+            emit messageSentResult(message.friendId, message.text, 0);
+            break;
+        }
+    }
 }
 
 void Core::sendTyping(uint32_t friendId, bool typing)
@@ -624,28 +1012,86 @@ void Core::sendTyping(uint32_t friendId, bool typing)
 
 void Core::sendGroupMessage(int groupId, const QString& message)
 {
-    QList<CString> cMessages = splitMessage(message, MAX_GROUP_MESSAGE_LEN);
+    queueGroupMessage(groupId, message, false);
+}
 
-    for (auto &cMsg :cMessages)
-    {
-        int ret = tox_group_message_send(tox, groupId, cMsg.data(), cMsg.size());
+void Core::sendGroupAction(int groupId, const QString& message)
+{
+    queueGroupMessage(groupId, message, true);
+}
+
+/**
+@brief Splits a group message and queues its pieces, they're sent as toxcore takes them.
 
-        if (ret == -1)
-            emit groupSentResult(groupId, message, ret);
+A message that doesn't fit in the group's queue fails right away, with a single
+groupSentResult, so a bot relaying into the group notices it's going too fast.
+*/
+void Core::queueGroupMessage(int groupId, const QString& message, bool isAction)
+{
+    const QByteArray cMessage = message.toUtf8();
+    const QVector<MessageSpan> spans = splitMessage(cMessage, MAX_GROUP_MESSAGE_LEN);
+    if (groupQueue.pendingCount(groupId) + spans.size() > MAX_GROUP_QUEUE_LEN)
+    {
+        qWarning() << "queueGroupMessage: The queue of group" << groupId << "is full, dropping a message";
+        ++groupMessagesDropped;
+        emit groupSentResult(groupId, message, -1);
+        return;
     }
+
+    // the pieces share an id, they're dropped together
+    int id = ++lastMessageId;
+    if (!id)
+        id = ++lastMessageId;
+
+    for (const MessageSpan& span : spans)
+        groupQueue.push({static_cast<uint32_t>(groupId), id,
+                         QString::fromUtf8(cMessage.constData() + span.offset, span.length), isAction});
+
+    sendQueuedGroupMessages();
 }
 
-void Core::sendGroupAction(int groupId, const QString& message)
-{
-    QList<CString> cMessages = splitMessage(message, MAX_GROUP_MESSAGE_LEN);
+/**
+@brief Hands the queued group messages to toxcore, backing off a group it refuses.
 
-    for (auto &cMsg :cMessages)
+Toxcore doesn't tell why a group send failed, a full send queue to the peers looks the same
+as a group that's gone. A piece refused MAX_GROUP_SEND_RETRIES times in a row drops the rest
+of its message, with a single failure for the GUI.
+*/
+void Core::sendQueuedGroupMessages()
+{
+    MessageQueue::Message message;
+    while (groupQueue.next(message))
     {
-        int ret = tox_group_action_send(tox, groupId, cMsg.data(), cMsg.size());
+        const int groupId = static_cast<int>(message.friendId);
+        CString cMessage(message.text);
+        int ret = message.isAction ? tox_group_action_send(tox, groupId, cMessage.data(), cMessage.size())
+                                   : tox_group_message_send(tox, groupId, cMessage.data(), cMessage.size());
+        if (ret != -1)
+        {
+            if (groupQueue.sent(message.friendId))
+                ++groupMessagesSent;
+            continue;
+        }
+
+        if (groupQueue.delay(message.friendId) < MAX_GROUP_SEND_RETRIES)
+            continue;
 
-        if (ret == -1)
-            emit groupSentResult(groupId, message, ret);
+        qWarning() << "sendQueuedGroupMessages: Toxcore keeps refusing a message for group" << groupId;
+        groupQueue.dropPieces(message.friendId);
+        ++groupMessagesDropped;
+        emit groupSentResult(groupId, message.text, -1);
     }
+
+    const int queued = groupQueue.pendingCount();
+    groupQueued = queued;
+    if (queued > maxGroupQueued)
+        maxGroupQueued = queued;
+    Trace::count("Core group queue", queued);
+}
+
+void Core::removeGroupMessages(int groupId)
+{
+    groupQueue.remove(static_cast<uint32_t>(groupId));
 }
 
 void Core::changeGroupTitle(int groupId, const QString& title)
@@ -658,41 +1104,75 @@ void Core::changeGroupTitle(int groupId, const QString& title)
 
 void Core::sendFile(uint32_t friendId, QString Filename, QString FilePath, long long filesize)
 {
+    // CoreFile's state belongs to the Core thread
+    if (QThread::currentThread() != coreThread)
+        return (void) QMetaObject::invokeMethod(this, "sendFile", Q_ARG(uint32_t, friendId),
+                                                Q_ARG(QString, Filename), Q_ARG(QString, FilePath),
+                                                Q_ARG(long long, filesize));
+
     CoreFile::sendFile(this, friendId, Filename, FilePath, filesize);
 }
 
-void Core::sendAvatarFile(uint32_t friendId, const QByteArray& data)
+void Core::sendAvatarFile(uint32_t friendId, const QByteArray& data, const QByteArray& hash)
 {
-    CoreFile::sendAvatarFile(this, friendId, data);
+    if (QThread::currentThread() != coreThread)
+        return (void) QMetaObject::invokeMethod(this, "sendAvatarFile", Q_ARG(uint32_t, friendId),
+                                                Q_ARG(QByteArray, data), Q_ARG(QByteArray, hash));
+
+    CoreFile::sendAvatarFile(this, friendId, data, hash);
 }
 
 void Core::pauseResumeFileSend(uint32_t friendId, uint32_t fileNum)
 {
+    if (QThread::currentThread() != coreThread)
+        return (void) QMetaObject::invokeMethod(this, "pauseResumeFileSend", Q_ARG(uint32_t, friendId),
+                                                Q_ARG(uint32_t, fileNum));
+
     CoreFile::pauseResumeFileSend(this, friendId, fileNum);
 }
 
 void Core::pauseResumeFileRecv(uint32_t friendId, uint32_t fileNum)
 {
+    if (QThread::currentThread() != coreThread)
+        return (void) QMetaObject::invokeMethod(this, "pauseResumeFileRecv", Q_ARG(uint32_t, friendId),
+                                                Q_ARG(uint32_t, fileNum));
+
     CoreFile::pauseResumeFileRecv(this, friendId, fileNum);
 }
 
 void Core::cancelFileSend(uint32_t friendId, uint32_t fileNum)
 {
+    if (QThread::currentThread() != coreThread)
+        return (void) QMetaObject::invokeMethod(this, "cancelFileSend", Q_ARG(uint32_t, friendId),
+                                                Q_ARG(uint32_t, fileNum));
+
     CoreFile::cancelFileSend(this, friendId, fileNum);
 }
 
 void Core::cancelFileRecv(uint32_t friendId, uint32_t fileNum)
 {
+    if (QThread::currentThread() != coreThread)
+        return (void) QMetaObject::invokeMethod(this, "cancelFileRecv", Q_ARG(uint32_t, friendId),
+                                                Q_ARG(uint32_t, fileNum));
+
     CoreFile::cancelFileRecv(this, friendId, fileNum);
 }
 
 void Core::rejectFileRecvRequest(uint32_t friendId, uint32_t fileNum)
 {
+    if (QThread::currentThread() != coreThread)
+        return (void) QMetaObject::invokeMethod(this, "rejectFileRecvRequest", Q_ARG(uint32_t, friendId),
+                                                Q_ARG(uint32_t, fileNum));
+
     CoreFile::rejectFileRecvRequest(this, friendId, fileNum);
 }
 
 void Core::acceptFileRecvRequest(uint32_t friendId, uint32_t fileNum, QString path)
 {
+    if (QThread::currentThread() != coreThread)
+        return (void) QMetaObject::invokeMethod(this, "acceptFileRecvRequest", Q_ARG(uint32_t, friendId),
+                                                Q_ARG(uint32_t, fileNum), Q_ARG(QString, path));
+
     CoreFile::acceptFileRecvRequest(this, friendId, fileNum, path);
 }
 
@@ -701,13 +1181,25 @@ void Core::removeFriend(uint32_t friendId, bool fake)
     if (!isReady() || fake)
         return;
 
+    uint8_t friendPk[TOX_PUBLIC_KEY_SIZE];
+    bool hasPk = tox_friend_get_public_key(tox, friendId, friendPk, nullptr);
+
     if (tox_friend_delete(tox, friendId, nullptr) == false)
     {
         emit failedToRemoveFriend(friendId);
     }
     else
     {
-        profile.saveToxSave();
+        if (hasPk)
+        {
+            {
+                QMutexLocker locker{&friendKeysLock};
+                friendKeys.remove(ToxPk(friendPk));
+            }
+            updateGroupPeerFriend(ToxPk(friendPk), -1);
+        }
+        messageQueue.remove(friendId);
+        saveLater();
         emit friendRemoved(friendId);
     }
 }
@@ -719,6 +1211,15 @@ void Core::removeGroup(int groupId, bool fake)
 
     tox_del_groupchat(tox, groupId);
     av->leaveGroupCall(groupId);
+
+    // the group number will be reused, its messages mustn't go to the next group
+    if (QThread::currentThread() == coreThread)
+        removeGroupMessages(groupId);
+    else
+        QMetaObject::invokeMethod(this, "removeGroupMessages", Qt::QueuedConnection, Q_ARG(int, groupId));
+
+    QMutexLocker locker{&groupPeersLock};
+    groupPeers.remove(groupId);
 }
 
 QString Core::getUsername() const
@@ -749,7 +1250,7 @@ void Core::setUsername(const QString& username)
     {
         emit usernameSet(username);
         if (ready)
-            profile.saveToxSave();
+            saveLater();
     }
 }
 
@@ -824,7 +1325,7 @@ void Core::setStatusMessage(const QString& message)
     else
     {
         if (ready)
-            profile.saveToxSave();
+            saveLater();
         emit statusMessageSet(message);
     }
 }
@@ -849,7 +1350,7 @@ void Core::setStatus(Status status)
     }
 
     tox_self_set_status(tox, userstatus);
-    profile.saveToxSave();
+    saveLater();
     emit statusSet(status);
 }
 
@@ -870,36 +1371,52 @@ QString Core::sanitize(QString name)
     return name;
 }
 
+/**
+ * @brief Copies the tox state into the save buffer, which is reused when nobody holds the previous copy anymore
+ */
 QByteArray Core::getToxSaveData()
 {
+    QMutexLocker locker{&saveDataLock};
+    saveDirty = false;
     uint32_t fileSize = tox_get_savedata_size(tox);
-    QByteArray data;
-    data.resize(fileSize);
-    tox_get_savedata(tox, (uint8_t*)data.data());
-    return data;
+    saveData.resize(fileSize);
+    tox_get_savedata(tox, reinterpret_cast<uint8_t*>(saveData.data()));
+    return saveData;
+}
+
+bool Core::isToxSaveDirty() const
+{
+    return saveDirty;
 }
 
 void Core::loadFriends()
 {
     const uint32_t friendCount = tox_self_get_friend_list_size(tox);
+    QSet<ToxPk> keys;
+    keys.reserve(friendCount);
     if (friendCount > 0)
     {
         // assuming there are not that many friends to fill up the whole stack
         uint32_t *ids = new uint32_t[friendCount];
         tox_self_get_friend_list(tox, ids);
         uint8_t clientId[TOX_PUBLIC_KEY_SIZE];
+        QVector<FriendSnapshot> friends;
+        friends.reserve(friendCount);
         for (int32_t i = 0; i < static_cast<int32_t>(friendCount); ++i)
         {
             if (tox_friend_get_public_key(tox, ids[i], clientId, nullptr))
             {
-                emit friendAdded(ids[i], CUserId::toString(clientId));
+                FriendSnapshot snapshot;
+                snapshot.friendId = ids[i];
+                snapshot.userId = CUserId::toString(clientId);
+                keys.insert(ToxPk(clientId));
 
                 const size_t nameSize = tox_friend_get_name_size(tox, ids[i], nullptr);
                 if (nameSize && nameSize != SIZE_MAX)
                 {
                     uint8_t *name = new uint8_t[nameSize];
                     if (tox_friend_get_name(tox, ids[i], name, nullptr))
-                        emit friendUsernameChanged(ids[i], CString::toString(name, nameSize));
+                        snapshot.name = CString::toString(name, nameSize);
                     delete[] name;
                 }
 
@@ -908,18 +1425,21 @@ void Core::loadFriends()
                 {
                     uint8_t *statusMessage = new uint8_t[statusMessageSize];
                     if (tox_friend_get_status_message(tox, ids[i], statusMessage, nullptr))
-                    {
-                        emit friendStatusMessageChanged(ids[i], CString::toString(statusMessage, statusMessageSize));
-                    }
+                        snapshot.statusMessage = CString::toString(statusMessage, statusMessageSize);
                     delete[] statusMessage;
                 }
 
+                friends.append(snapshot);
                 checkLastOnline(ids[i]);
             }
 
         }
         delete[] ids;
+        emit friendsLoaded(friends);
     }
+
+    QMutexLocker locker{&friendKeysLock};
+    friendKeys.swap(keys);
 }
 
 void Core::checkLastOnline(uint32_t friendId) {
@@ -938,11 +1458,25 @@ QVector<uint32_t> Core::getFriendList() const
 
 int Core::getGroupNumberPeers(int groupId) const
 {
+    {
+        QMutexLocker locker{&groupPeersLock};
+        auto group = groupPeers.constFind(groupId);
+        if (group != groupPeers.constEnd())
+            return group->size();
+    }
+
     return tox_group_number_peers(tox, groupId);
 }
 
 QString Core::getGroupPeerName(int groupId, int peerId) const
 {
+    {
+        QMutexLocker locker{&groupPeersLock};
+        auto group = groupPeers.constFind(groupId);
+        if (group != groupPeers.constEnd() && peerId >= 0 && peerId < group->size())
+            return group->at(peerId).name;
+    }
+
     QString name;
     uint8_t nameArray[TOX_MAX_NAME_LENGTH];
     int length = tox_group_peername(tox, groupId, peerId, nameArray);
@@ -957,6 +1491,13 @@ QString Core::getGroupPeerName(int groupId, int peerId) const
 
 ToxId Core::getGroupPeerToxId(int groupId, int peerId) const
 {
+    {
+        QMutexLocker locker{&groupPeersLock};
+        auto group = groupPeers.constFind(groupId);
+        if (group != groupPeers.constEnd() && peerId >= 0 && peerId < group->size())
+            return ToxId(group->at(peerId).publicKey.toString());
+    }
+
     ToxId peerToxId;
 
     uint8_t rawID[TOX_PUBLIC_KEY_SIZE];
@@ -974,17 +1515,48 @@ ToxId Core::getGroupPeerToxId(int groupId, int peerId) const
 QList<QString> Core::getGroupPeerNames(int groupId) const
 {
     QList<QString> names;
+    {
+        QMutexLocker locker{&groupPeersLock};
+        auto group = groupPeers.constFind(groupId);
+        if (group != groupPeers.constEnd())
+        {
+            names.reserve(group->size());
+            for (const GroupPeer& peer : *group)
+                names.push_back(peer.name);
+            return names;
+        }
+    }
+
+    for (const GroupPeer& peer : fetchGroupPeers(groupId))
+        names.push_back(peer.name);
+
+    return names;
+}
+
+int Core::getGroupPeerFriendId(int groupId, int peerId) const
+{
+    QMutexLocker locker{&groupPeersLock};
+    auto group = groupPeers.constFind(groupId);
+    if (group != groupPeers.constEnd() && peerId >= 0 && peerId < group->size())
+        return group->at(peerId).friendId;
+
+    return -1;
+}
+
+QVector<Core::GroupPeer> Core::fetchGroupPeers(int groupId) const
+{
+    QVector<GroupPeer> peers;
     if (!tox)
     {
-        qWarning() << "Can't get group peer names, tox is null";
-        return names;
+        qWarning() << "Can't get group peers, tox is null";
+        return peers;
     }
 
-    int result = getGroupNumberPeers(groupId);
+    int result = tox_group_number_peers(tox, groupId);
     if (result < 0)
     {
-        qWarning() << "getGroupPeerNames: Unable to get number of peers";
-        return names;
+        qWarning() << "fetchGroupPeers: Unable to get number of peers";
+        return peers;
     }
     uint16_t nPeers = static_cast<uint16_t>(result);
 
@@ -993,13 +1565,50 @@ QList<QString> Core::getGroupPeerNames(int groupId) const
     result = tox_group_get_names(tox, groupId, namesArray.get(), lengths.get(), nPeers);
     if (result != nPeers)
     {
-        qWarning() << "getGroupPeerNames: Unexpected tox_group_get_names result";
-        return names;
+        qWarning() << "fetchGroupPeers: Unexpected tox_group_get_names result";
+        return peers;
     }
-    for (uint16_t i=0; i<nPeers; i++)
-       names.push_back(CString::toString(namesArray[i], lengths[i]));
 
-    return names;
+    peers.resize(nPeers);
+    for (uint16_t i = 0; i < nPeers; i++)
+    {
+        GroupPeer& peer = peers[i];
+        peer.name = CString::toString(namesArray[i], lengths[i]);
+
+        uint8_t rawId[TOX_PUBLIC_KEY_SIZE];
+        if (tox_group_peer_pubkey(tox, groupId, i, rawId) == -1)
+            continue;
+
+        peer.publicKey = ToxPk(rawId);
+
+        // the index saves toxcore's linear search for the peers that aren't friends
+        bool isFriend;
+        {
+            QMutexLocker locker{&friendKeysLock};
+            isFriend = friendKeys.contains(peer.publicKey);
+        }
+        if (isFriend)
+        {
+            uint32_t friendId = tox_friend_by_public_key(tox, rawId, nullptr);
+            if (friendId != std::numeric_limits<uint32_t>::max())
+                peer.friendId = static_cast<int>(friendId);
+        }
+    }
+
+    return peers;
+}
+
+void Core::updateGroupPeerFriend(const ToxPk& publicKey, int friendId)
+{
+    QMutexLocker locker{&groupPeersLock};
+    for (QVector<GroupPeer>& group : groupPeers)
+    {
+        for (GroupPeer& peer : group)
+        {
+            if (peer.publicKey == publicKey)
+                peer.friendId = friendId;
+        }
+    }
 }
 
 int Core::joinGroupchat(int32_t friendnumber, uint8_t type, const uint8_t* friend_group_public_key,uint16_t length) const
@@ -1078,29 +1687,12 @@ bool Core::hasFriendWithPublicKey(const QString &pubkey) const
     if (pubkey.length() != (TOX_PUBLIC_KEY_SIZE * 2))
         return false;
 
-    bool found = false;
-    const size_t friendCount = tox_self_get_friend_list_size(tox);
-    if (friendCount > 0)
-    {
-        uint32_t *ids = new uint32_t[friendCount];
-        tox_self_get_friend_list(tox, ids);
-        for (int32_t i = 0; i < static_cast<int32_t>(friendCount); ++i)
-        {
-            // getFriendAddress may return either id (public key) or address
-            QString addrOrId = getFriendAddress(ids[i]);
-
-            // Set true if found
-            if (addrOrId.toUpper().startsWith(pubkey.toUpper()))
-            {
-                found = true;
-                break;
-            }
-        }
-
-        delete[] ids;
-    }
+    ToxPk key(pubkey);
+    if (key.isEmpty())
+        return false;
 
-    return found;
+    QMutexLocker locker{&friendKeysLock};
+    return friendKeys.contains(key);
 }
 
 QString Core::getFriendAddress(uint32_t friendNumber) const
@@ -1142,33 +1734,44 @@ QString Core::getFriendUsername(uint32_t friendnumber) const
     return sname;
 }
 
-QList<CString> Core::splitMessage(const QString &message, int maxLen)
+/**
+@brief Splits an UTF-8 message in pieces of at most maxLen bytes, as views into it.
+
+A piece ends after its last space if it has one, else right before the character
+that doesn't fit anymore, never inside a multi-byte character.
+Nothing is copied, so this stays linear in the length of the message.
+*/
+QVector<Core::MessageSpan> Core::splitMessage(const QByteArray &message, int maxLen)
 {
-    QList<CString> splittedMsgs;
-    QByteArray ba_message(message.toUtf8());
+    QVector<MessageSpan> spans;
+    const char* data = message.constData();
+    const int size = message.size();
+    int offset = 0;
 
-    while (ba_message.size() > maxLen)
+    while (size - offset > maxLen)
     {
-        int splitPos = ba_message.lastIndexOf(' ', maxLen - 1);
-        if (splitPos <= 0)
+        int length;
+        int space = message.lastIndexOf(' ', offset + maxLen - 1);
+        if (space > offset)
         {
-            splitPos = maxLen;
-            if (ba_message[splitPos] & 0x80)
-            {
-                do {
-                    splitPos--;
-                } while (!(ba_message[splitPos] & 0x40));
-            }
-            splitPos--;
+            length = space + 1 - offset;
+        }
+        else
+        {
+            // the next piece can't start on a continuation byte
+            length = maxLen;
+            while (length > 0 && (data[offset + length] & 0xC0) == 0x80)
+                --length;
+            if (!length) // not UTF-8 anyway
+                length = maxLen;
         }
 
-        splittedMsgs.push_back(CString(ba_message.left(splitPos + 1)));
-        ba_message = ba_message.mid(splitPos + 1);
+        spans.append({offset, length});
+        offset += length;
     }
 
-    splittedMsgs.push_back(CString(ba_message));
-
-    return splittedMsgs;
+    spans.append({offset, size - offset});
+    return spans;
 }
 
 QString Core::getPeerName(const ToxId& id) const
@@ -1210,6 +1813,7 @@ void Core::setNospam(uint32_t nospam)
     uint8_t *nspm = reinterpret_cast<uint8_t*>(&nospam);
     std::reverse(nspm, nspm + 4);
     tox_self_set_nospam(tox, nospam);
+    saveLater();
 
     emit idSet(getSelfId().toString());
 }
@@ -1217,15 +1821,55 @@ void Core::setNospam(uint32_t nospam)
 void Core::killTimers(bool onlyStop)
 {
     assert(QThread::currentThread() == coreThread);
+    const IterationStats stats = getIterationStats();
+    qDebug() << "Stopping after" << stats.iterations << "iterations, late by" << stats.meanLatency
+             << "us on average and" << stats.maxLatency << "us at most, taking" << stats.meanDuration
+             << "us on average and" << stats.maxDuration << "us at most";
+    nextIteration = 0;
+
     av->stop();
     toxTimer->stop();
+    saveTimer->stop();
     if (!onlyStop)
     {
         delete toxTimer;
         toxTimer = nullptr;
+        delete saveTimer;
+        saveTimer = nullptr;
     }
 }
 
+/**
+ * @brief Schedules a write of the tox save once the changes settle down
+ *
+ * Every call pushes the write back by TOX_SAVE_DELAY, so a burst of changes is saved only once,
+ * but never more than TOX_SAVE_MAX_DELAY after the first change of the burst.
+ */
+void Core::saveLater()
+{
+    // Set right away, a save that runs before our timer doesn't have to be skipped
+    saveDirty = true;
+    if (QThread::currentThread() != coreThread)
+        return (void) QMetaObject::invokeMethod(this, "saveLater");
+
+    if (!saveTimer->isActive())
+        saveClock.start();
+    else if (saveClock.elapsed() + TOX_SAVE_DELAY > TOX_SAVE_MAX_DELAY)
+        return;
+    saveTimer->start(TOX_SAVE_DELAY);
+}
+
+/**
+ * @brief Hands the current tox save to the profile, which encrypts and writes it in the background
+ */
+void Core::writeToxSave()
+{
+    // Somebody else may have saved our changes in the meantime
+    if (!ready || !saveDirty)
+        return;
+    profile.saveToxSaveAsync(getToxSaveData());
+}
+
 void Core::reset()
 {
     assert(QThread::currentThread() == coreThread);
@@ -24,6 +24,8 @@
 #include <cstdint>
 #include <QObject>
 #include <QMutex>
+#include <QSet>
+#include <QQueue>
 
 #include <tox/tox.h>
 #include <tox/toxencryptsave.h>
@@ -31,12 +33,16 @@
 #include "corestructs.h"
 #include "coredefines.h"
 #include "toxid.h"
+#include "coreevents.h"
+#include "messagequeue.h"
+
+#include <QElapsedTimer>
+#include <atomic>
 
 class Profile;
 template <typename T> class QList;
 class QTimer;
 class QString;
-class CString;
 struct ToxAV;
 class CoreAV;
 struct vpx_image;
@@ -44,6 +50,31 @@ struct vpx_image;
 class Core : public QObject
 {
     Q_OBJECT
+public:
+    /// A piece of a message, in bytes of its UTF-8
+    struct MessageSpan
+    {
+        int offset;
+        int length;
+    };
+
+    struct IterationStats
+    {
+        quint64 iterations = 0;
+        quint32 meanLatency = 0; ///< In us, how late tox_iterate ran compared to when toxcore wanted it
+        quint32 maxLatency = 0;
+        quint32 meanDuration = 0; ///< In us, an iteration with the file transfers and GUI events after it
+        quint32 maxDuration = 0;
+    };
+
+    struct GroupQueueStats
+    {
+        int queued = 0;         ///< Pieces of group messages toxcore didn't take yet
+        int maxQueued = 0;
+        quint64 sent = 0;       ///< Messages, however many pieces they were split into
+        quint64 dropped = 0;    ///< Messages that didn't fit in the queue or that toxcore kept refusing
+    };
+
 public:
     explicit Core(QThread* coreThread, Profile& profile);
     static Core* getInstance(); ///< Returns the global widget's Core instance
@@ -53,7 +84,7 @@ public:
     static const QString TOX_EXT;
     static const QString CONFIG_FILE_NAME;
     static QString sanitize(QString name);
-    static QList<CString> splitMessage(const QString &message, int maxLen);
+    static QVector<MessageSpan> splitMessage(const QByteArray& message, int maxLen); ///< Splits UTF-8 without copying it
 
     static QByteArray getSaltFromFile(QString filename);
 
@@ -64,6 +95,7 @@ public:
     QString getGroupPeerName(int groupId, int peerId) const; ///< Get the name of a peer of a group
     ToxId getGroupPeerToxId(int groupId, int peerId) const; ///< Get the public key of a peer of a group
     QList<QString> getGroupPeerNames(int groupId) const; ///< Get the names of the peers of a group
+    int getGroupPeerFriendId(int groupId, int peerId) const; ///< The friendId of a peer of a group, -1 if we aren't friends
     QString getFriendAddress(uint32_t friendNumber) const; ///< Get the full address if known, or public key of a friend
     QString getFriendPublicKey(uint32_t friendNumber) const; ///< Get the public key part of the ToxID only
     QString getFriendUsername(uint32_t friendNumber) const; ///< Get the username of a friend
@@ -86,6 +118,8 @@ public:
     static QByteArray decryptData(const QByteArray& data); ///< Uses the default profile's key
 
     bool isReady(); ///< Most of the API shouldn't be used until Core is ready, call start() first
+    IterationStats getIterationStats() const; ///< Thread-safe, counts since the Core started
+    GroupQueueStats getGroupQueueStats() const; ///< Thread-safe, counts since the Core started
 
 public slots:
     void start(); ///< Initializes the core, must be called before anything else
@@ -93,10 +127,13 @@ public slots:
     void process(); ///< Processes toxcore events and ensure we stay connected, called by its own timer
     void bootstrapDht(); ///< Connects us to the Tox network
 
-    QByteArray getToxSaveData(); ///< Returns the unencrypted tox save data
+    QByteArray getToxSaveData(); ///< Returns the unencrypted tox save data, and marks it as saved
+    bool isToxSaveDirty() const; ///< Thread-safe, whether we changed the tox state since getToxSaveData
 
     void acceptFriendRequest(const QString& userId);
     void requestFriendship(const QString& friendAddress, const QString& message);
+    /// Validates all the addresses in one pass, then sends the requests a few at a time with a single save at the end
+    void requestFriendships(const QStringList& friendAddresses, const QString& message);
     void groupInviteFriend(uint32_t friendId, int groupId);
     int createGroup(uint8_t type = TOX_GROUPCHAT_TYPE_AV);
 
@@ -116,7 +153,8 @@ public slots:
     void sendTyping(uint32_t friendId, bool typing);
 
     void sendFile(uint32_t friendId, QString Filename, QString FilePath, long long filesize);
-    void sendAvatarFile(uint32_t friendId, const QByteArray& data);
+    /// The hash is the tox hash of data, we compute it if it's empty
+    void sendAvatarFile(uint32_t friendId, const QByteArray& data, const QByteArray& hash = QByteArray());
     void cancelFileSend(uint32_t friendId, uint32_t fileNum);
     void cancelFileRecv(uint32_t friendId, uint32_t fileNum);
     void rejectFileRecvRequest(uint32_t friendId, uint32_t fileNum);
@@ -132,15 +170,18 @@ signals:
     void disconnected();
 
     void friendRequestReceived(const QString& userId, const QString& message);
-    void friendMessageReceived(uint32_t friendId, const QString& message, bool isAction);
+    /// Messages, statuses, typing and group peer changes, once per GUI frame at most
+    void eventsReceived(const CoreEvents& events);
 
     void friendAdded(uint32_t friendId, const QString& userId);
+    /// The whole friend list at startup, in one signal instead of a few per friend
+    void friendsLoaded(const QVector<FriendSnapshot>& friends);
     void friendshipChanged(uint32_t friendId);
 
+    /// Emitted on the Core thread, the GUI gets statuses in eventsReceived
     void friendStatusChanged(uint32_t friendId, Status status);
     void friendStatusMessageChanged(uint32_t friendId, const QString& message);
     void friendUsernameChanged(uint32_t friendId, const QString& username);
-    void friendTypingChanged(uint32_t friendId, bool isTyping);
     void friendAvatarChanged(uint32_t friendId, const QPixmap& pic);
     void friendAvatarRemoved(uint32_t friendId);
 
@@ -150,10 +191,10 @@ signals:
 
     void emptyGroupCreated(int groupnumber);
     void groupInviteReceived(uint32_t friendId, uint8_t type, QByteArray publicKey);
-    void groupMessageReceived(int groupnumber, int peernumber, const QString& message, bool isAction);
-    void groupNamelistChanged(int groupnumber, int peernumber, uint8_t change);
     void groupTitleChanged(int groupnumber, const QString& author, const QString& title);
     void groupPeerAudioPlaying(int groupnumber, int peernumber);
+    /// Emitted from the group call's mixer thread, peernumber is -1 once nobody is left to show
+    void groupActiveSpeakerChanged(int groupnumber, int peernumber);
 
     void usernameSet(const QString& username);
     void statusMessageSet(const QString& message);
@@ -168,6 +209,9 @@ signals:
     void receiptRecieved(int friedId, int receipt);
 
     void failedToAddFriend(const QString& userId, const QString& errorInfo = QString());
+    /// One per entry of requestFriendships, in any order, errorInfo is empty if the request was sent
+    void friendRequestProgress(int index, int total, const QString& userId, const QString& errorInfo);
+    void friendRequestsFinished(int sent, int total);
     void failedToRemoveFriend(uint32_t friendId);
     void failedToSetUsername(const QString& username);
     void failedToSetStatusMessage(const QString& message);
@@ -177,17 +221,17 @@ signals:
     void failedToStart();
     void badProxy();
 
-    void fileSendStarted(ToxFile file);
-    void fileReceiveRequested(ToxFile file);
-    void fileTransferAccepted(ToxFile file);
-    void fileTransferCancelled(ToxFile file);
-    void fileTransferFinished(ToxFile file);
+    void fileSendStarted(ToxFile::Ptr file);
+    void fileReceiveRequested(ToxFile::Ptr file);
+    void fileTransferAccepted(ToxFile::Ptr file);
+    void fileTransferCancelled(ToxFile::Ptr file);
+    void fileTransferFinished(ToxFile::Ptr file);
     void fileUploadFinished(const QString& path);
     void fileDownloadFinished(const QString& path);
-    void fileTransferPaused(ToxFile file);
-    void fileTransferInfo(ToxFile file);
-    void fileTransferRemotePausedUnpaused(ToxFile file, bool paused);
-    void fileTransferBrokenUnbroken(ToxFile file, bool broken);
+    void fileTransferPaused(ToxFile::Ptr file);
+    void fileTransferInfo(ToxFile::Ptr file);
+    void fileTransferRemotePausedUnpaused(ToxFile::Ptr file, bool paused);
+    void fileTransferBrokenUnbroken(ToxFile::Ptr file, bool broken);
 
     void fileSendFailed(uint32_t friendId, const QString& fname);
 
@@ -220,20 +264,79 @@ private:
     void makeTox(QByteArray savedata);
     void loadFriends();
 
+    /// What we know of a group peer, so the GUI doesn't ask toxcore for it on every namelist change
+    struct GroupPeer
+    {
+        QString name;
+        ToxPk publicKey;
+        int friendId = -1;
+    };
+    /// Reads all the peers of a group from toxcore, in peer number order, empty on error
+    QVector<GroupPeer> fetchGroupPeers(int groupId) const;
+    /// Keeps the friendId of a public key's group peers in step with our friend list
+    void updateGroupPeerFriend(const ToxPk& publicKey, int friendId);
+
+    /// Adds the friend to toxcore and our lists, the caller checks the address and saves
+    bool addFriendRequest(const QString& friendAddress, const QString& message);
+
     void checkLastOnline(uint32_t friendId);
+    void scoreBootstrap(bool connected);
+    int queueMessage(uint32_t friendId, const QString& message, bool isAction);
+    void sendQueuedMessages();
+    void queueGroupMessage(int groupId, const QString& message, bool isAction);
+    void sendQueuedGroupMessages();
+    void sendEvents();
 
     void deadifyTox();
 
 private slots:
     void killTimers(bool onlyStop); ///< Must only be called from the Core thread
+    void saveLater(); ///< Writes the tox save once we stop changing it for a moment
+    void writeToxSave();
+    void pushMessage(uint32_t friendId, int id, const QString& message, bool isAction);
+    void removeGroupMessages(int groupId);
+    void sendQueuedFriendRequests();
 
 private:
     Tox* tox;
     CoreAV* av;
     QTimer *toxTimer;
+    QTimer *saveTimer; ///< Debounces the writes of the tox save
+    QElapsedTimer saveClock; ///< Started on the first change since the last write
+    /// Set by saveLater, a fresh Core is dirty so its first save always goes through
+    std::atomic_bool saveDirty{true};
+    QByteArray saveData; ///< Reused by getToxSaveData once the previous save has been written
+    QMutex saveDataLock; ///< getToxSaveData is called from the GUI thread too
     Profile& profile;
-    QMutex messageSendMutex;
     bool ready;
+    std::atomic_int lastMessageId; ///< The ids we give the messages we queue
+    MessageQueue messageQueue;
+    MessageQueue groupQueue; ///< The pieces of the group messages, by group number
+    std::atomic_int groupQueued, maxGroupQueued;
+    std::atomic<quint64> groupMessagesSent, groupMessagesDropped;
+    /// Public keys of our friends, kept in step with toxcore's friend list so duplicates are found in a single lookup
+    QSet<ToxPk> friendKeys;
+    mutable QMutex friendKeysLock; ///< hasFriendWithPublicKey is called from the GUI thread too
+    /// Peers of each group we're in, by peer number, updated from the namelist callback
+    struct QueuedFriendRequest
+    {
+        int index;
+        QString address;
+        QString message;
+    };
+    QQueue<QueuedFriendRequest> friendRequestQueue; ///< Validated entries of requestFriendships, not sent yet
+    int friendRequestTotal, friendRequestsSent; ///< Over the bulk requests since the queue was last empty
+    QHash<int, QVector<GroupPeer>> groupPeers;
+    mutable QMutex groupPeersLock; ///< The GUI thread reads the group peers
+    CoreEvents pendingEvents; ///< What the callbacks got for the GUI since the last batch
+    QElapsedTimer lastEventBatch;
+    QElapsedTimer iterationClock;
+    QList<QString> bootstrapBatch; ///< Public keys of the nodes we last bootstrapped from, until we know how it went
+    QElapsedTimer bootstrapClock;
+    qint64 nextIteration; ///< In ns of the iterationClock, when toxcore wants to iterate again
+    std::atomic<quint64> iterations;
+    std::atomic<quint64> iterationLatency, iterationDuration; ///< In ns, summed over all iterations
+    std::atomic<quint32> maxIterationLatency, maxIterationDuration; ///< In us
 
     static QThread *coreThread;
 
@@ -21,7 +21,10 @@
 #include "core.h"
 #include "coreav.h"
 #include "src/audio/audio.h"
+#include "src/audio/groupaudiomixer.h"
 #include "src/persistence/settings.h"
+#include "src/platform/threadpriority.h"
+#include "src/captureclock.h"
 #include "src/video/videoframe.h"
 #include "src/video/corevideosource.h"
 #include <cassert>
@@ -29,6 +32,7 @@
 #include <QTimer>
 #include <QDebug>
 #include <QCoreApplication>
+#include <QDateTime>
 #include <QtConcurrent/QtConcurrentRun>
 
 #ifdef QTOX_FILTER_AUDIO
@@ -40,16 +44,42 @@ IndexedList<ToxGroupCall> CoreAV::groupCalls;
 
 using namespace std;
 
+namespace
+{
+// below these video bitrates (kb/s), we send frames halved once or twice
+const uint32_t halfSizeBitrate = 1024;
+const uint32_t quarterSizeBitrate = 256;
+const int maxVideoScaleDown = 2;
+// we don't send larger frames again until the link was fine for that long (ms)
+const qint64 videoScaleUpDelay = 5000;
+// this many refused frames in a row make us halve the bitrate ourselves
+const int maxVideoSendFailures = 10;
+const uint32_t minVideoBitrate = 64;
+// frames we keep queued on the output device, the jitter buffers hold the rest
+const int outputLeadFrames = 2;
+// upper bounds (ms) of the iteration lateness histogram, the last bucket is everything above
+const qint64 latenessLimits[] = {1, 2, 5, 10, 20};
+}
+
 CoreAV::CoreAV(Tox *tox)
     : coreavThread{new QThread}, iterateTimer{new QTimer{this}},
-      threadSwitchLock{false}
+      playoutTimer{new QTimer{this}}, nextIteration{0}, threadSwitchLock{false}
 {
+    for (std::atomic<quint64>& bucket : iterationLateness)
+        bucket = 0;
+
     coreavThread->setObjectName("qTox CoreAV");
     moveToThread(coreavThread.get());
 
+    // a coarse timer can fire several ms late, which we'd hear as jitter
     iterateTimer->setSingleShot(true);
+    iterateTimer->setTimerType(Qt::PreciseTimer);
     connect(iterateTimer.get(), &QTimer::timeout, this, &CoreAV::process);
 
+    playoutTimer->setTimerType(Qt::PreciseTimer);
+    playoutTimer->setInterval(AUDIO_FRAME_DURATION / 2);
+    connect(playoutTimer.get(), &QTimer::timeout, this, &CoreAV::playAudio);
+
     toxav = toxav_new(tox, nullptr);
 
     toxav_callback_call(toxav, CoreAV::callCallback, this);
@@ -58,6 +88,12 @@ CoreAV::CoreAV(Tox *tox)
     toxav_callback_audio_receive_frame(toxav, CoreAV::audioFrameCallback, this);
     toxav_callback_video_receive_frame(toxav, CoreAV::videoFrameCallback, this);
 
+    // runs in the new thread, toxav iterates audio and video there
+    connect(coreavThread.get(), &QThread::started, []()
+    {
+        if (Settings::getInstance().getRealtimeThreads())
+            Platform::setThreadRealtime(Platform::ThreadClass::Audio);
+    });
     coreavThread->start();
 }
 
@@ -85,7 +121,10 @@ void CoreAV::start()
     // Timers can only be touched from their own thread
     if (QThread::currentThread() != coreavThread.get())
         return (void)QMetaObject::invokeMethod(this, "start", Qt::BlockingQueuedConnection);
+    iterationClock.start();
+    nextIteration = 0;
     iterateTimer->start();
+    playoutTimer->start();
 }
 
 void CoreAV::stop()
@@ -94,6 +133,7 @@ void CoreAV::stop()
     if (QThread::currentThread() != coreavThread.get())
         return (void)QMetaObject::invokeMethod(this, "stop", Qt::BlockingQueuedConnection);
     iterateTimer->stop();
+    playoutTimer->stop();
 }
 
 void CoreAV::killTimerFromThread()
@@ -102,12 +142,59 @@ void CoreAV::killTimerFromThread()
     if (QThread::currentThread() != coreavThread.get())
         return (void)QMetaObject::invokeMethod(this, "killTimerFromThread", Qt::BlockingQueuedConnection);
     iterateTimer.release();
+    playoutTimer.release();
 }
 
 void CoreAV::process()
 {
+    qint64 lateness = (iterationClock.nsecsElapsed() - nextIteration) / 1000000;
+    int bucket = 0;
+    for (qint64 limit : latenessLimits)
+    {
+        if (lateness < limit)
+            break;
+        ++bucket;
+    }
+    ++iterationLateness[bucket];
+
     toxav_iterate(toxav);
-    iterateTimer->start(toxav_iteration_interval(toxav));
+
+    uint32_t interval = toxav_iteration_interval(toxav);
+    nextIteration = iterationClock.nsecsElapsed() + interval * Q_INT64_C(1000000);
+    iterateTimer->start(interval);
+}
+
+QVector<quint64> CoreAV::getIterationLateness() const
+{
+    QVector<quint64> counts;
+    for (const std::atomic<quint64>& bucket : iterationLateness)
+        counts << bucket.load();
+
+    return counts;
+}
+
+void CoreAV::playAudio()
+{
+    Audio& audio = Audio::getInstance();
+    AudioJitterBuffer::Frame frame;
+
+    for (ToxFriendCall& call : calls)
+    {
+        if (!call.jitterBuffer)
+            continue;
+
+        while (audio.queuedBuffers(call.alSource) < outputLeadFrames)
+        {
+            if (!call.jitterBuffer->pop(frame))
+                break;
+
+            if (!call.alSource)
+                audio.subscribeOutput(call.alSource);
+
+            audio.playAudioBuffer(call.alSource, frame.pcm.constData(), frame.sampleCount,
+                                  frame.channels, frame.samplingRate);
+        }
+    }
 }
 
 bool CoreAV::anyActiveCalls()
@@ -145,6 +232,7 @@ bool CoreAV::answerCall(uint32_t friendNum)
     if (toxav_answer(toxav, friendNum, AUDIO_DEFAULT_BITRATE, VIDEO_DEFAULT_BITRATE, &err))
     {
         calls[friendNum].inactive = false;
+        calls[friendNum].stats->answerDelay = calls[friendNum].stats->sinceSetup();
         return true;
     }
     else
@@ -185,7 +273,12 @@ bool CoreAV::startCall(uint32_t friendNum, bool video)
     if (!toxav_call(toxav, friendNum, AUDIO_DEFAULT_BITRATE, videoBitrate, nullptr))
         return false;
 
+    const qint64 setupStart = CaptureClock::now();
+    QElapsedTimer setup;
+    setup.start();
     auto call = calls.insert({friendNum, video, *this});
+    call->stats->setupStart = setupStart;
+    call->stats->setupAudioTime = static_cast<quint32>(setup.elapsed());
     call->startTimeout();
     return true;
 }
@@ -238,12 +331,14 @@ void CoreAV::timeoutCall(uint32_t friendNum)
     emit avEnd(friendNum);
 }
 
-bool CoreAV::sendCallAudio(uint32_t callId, const int16_t *pcm, size_t samples, uint8_t chans, uint32_t rate)
+bool CoreAV::sendCallAudio(uint32_t callId, const int16_t *pcm, size_t samples, uint8_t chans, uint32_t rate,
+                           qint64 captureTime)
 {
-    if (!calls.contains(callId))
+    ToxFriendCall* found = calls.find(callId);
+    if (!found)
         return false;
 
-    ToxFriendCall& call = calls[callId];
+    ToxFriendCall& call = *found;
 
     if (call.muteMic || call.inactive
             || !(call.state & TOXAV_FRIEND_CALL_STATE_ACCEPTING_A))
@@ -251,30 +346,6 @@ bool CoreAV::sendCallAudio(uint32_t callId, const int16_t *pcm, size_t samples,
         return true;
     }
 
-#if 0
-#ifdef QTOX_FILTER_AUDIO
-    if (Settings::getInstance().getFilterAudio())
-    {
-        if (!call.filterer)
-        {
-            call.filterer = new AudioFilterer();
-            call.filterer->startFilter(AUDIO_SAMPLE_RATE);
-        }
-
-#ifdef ALC_LOOPBACK_CAPTURE_SAMPLES
-        // compatibility with older versions of OpenAL
-        Audio::getInstance().getEchoesToFilter(call.filterer, AUDIO_FRAME_SAMPLE_COUNT * AUDIO_CHANNELS);
-#endif
-        call.filterer->filterAudio(buf, AUDIO_FRAME_SAMPLE_COUNT * AUDIO_CHANNELS);
-    }
-    else if (call.filterer)
-    {
-        delete call.filterer;
-        call.filterer = nullptr;
-    }
-#endif
-#endif
-
     // TOXAV_ERR_SEND_FRAME_SYNC means toxav failed to lock, retry 5 times in this case
     TOXAV_ERR_SEND_FRAME err;
     int retries = 0;
@@ -295,48 +366,86 @@ bool CoreAV::sendCallAudio(uint32_t callId, const int16_t *pcm, size_t samples,
     if (err == TOXAV_ERR_SEND_FRAME_SYNC)
         qDebug() << "toxav_audio_send_frame error: Lock busy, dropping frame";
 
+    call.stats->audioSendRetries += retries;
+    if (err == TOXAV_ERR_SEND_FRAME_OK)
+    {
+        ++call.stats->audioFramesSent;
+        call.stats->audioLatency = static_cast<quint32>(CaptureClock::now() - captureTime);
+    }
+    else
+        ++call.stats->audioSendErrors;
+
     return true;
 }
 
 void CoreAV::sendCallVideo(uint32_t callId, shared_ptr<VideoFrame> vframe)
 {
-    // We might be running in the FFmpeg thread and holding the CameraSource lock
-    // So be careful not to deadlock with anything while toxav locks in toxav_video_send_frame
-    if (!calls.contains(callId))
+    // We're running in the call's video send worker, off the camera thread
+    // Still be careful not to deadlock with anything while toxav locks in toxav_video_send_frame
+    ToxFriendCall* found = calls.find(callId);
+    if (!found)
         return;
 
-    ToxFriendCall& call = calls[callId];
+    ToxFriendCall& call = *found;
 
     if (!call.videoEnabled || call.inactive
             || !(call.state & TOXAV_FRIEND_CALL_STATE_ACCEPTING_V))
         return;
 
+    // a frame that waited behind a slow encode or delivery would only add to the latency,
+    // and one that would be too old once converted and encoded isn't worth it if a newer one waits
+    const qint64 captureTime = vframe->getCaptureTime();
+    if (captureTime)
+    {
+        const qint64 age = CaptureClock::now() - captureTime;
+        const qint64 sendTime = call.stats->convertTime + call.stats->encodeTime;
+        if (age > VIDEO_MAX_CAPTURE_AGE
+                || (age + sendTime > VIDEO_MAX_CAPTURE_AGE && call.hasNewerVideoFrame()))
+        {
+            ++call.stats->videoFramesStale;
+            return;
+        }
+    }
+
     if (call.nullVideoBitrate)
     {
         qDebug() << "Restarting video stream to friend"<<callId;
-        toxav_bit_rate_set(toxav, call.callId, -1, VIDEO_DEFAULT_BITRATE, nullptr);
+        toxav_bit_rate_set(toxav, call.callId, -1, call.videoBitrate, nullptr);
         call.nullVideoBitrate = false;
     }
 
     // This frame shares vframe's buffers, we don't call vpx_img_free but just delete it
-    vpx_image* frame = vframe->toVpxImage();
+    QElapsedTimer timer;
+    timer.start();
+    QSize size = vframe->getSize();
+    vpx_image* frame = vframe->toVpxImage(QSize{size.width() >> call.videoScaleDown,
+                                                size.height() >> call.videoScaleDown});
     if (frame->fmt == VPX_IMG_FMT_NONE)
     {
         qWarning() << "Invalid frame";
+        ++call.stats->videoSendErrors;
         delete frame;
         return;
     }
+    call.stats->convertTime = static_cast<quint32>(timer.nsecsElapsed() / 1000);
+    timer.restart();
 
     // TOXAV_ERR_SEND_FRAME_SYNC means toxav failed to lock, retry 5 times in this case
-    // We don't want to be dropping iframes because of some lock held by toxav_iterate
+    // We don't want to be dropping iframes because of some lock held by toxav_iterate,
+    // but waiting is pointless once the frame got too old or a newer one can go instead
     TOXAV_ERR_SEND_FRAME err;
     int retries = 0;
+    bool superseded = false;
     do {
         if (!toxav_video_send_frame(toxav, callId, frame->d_w, frame->d_h,
                                     frame->planes[0], frame->planes[1], frame->planes[2], &err))
         {
             if (err == TOXAV_ERR_SEND_FRAME_SYNC)
             {
+                superseded = call.hasNewerVideoFrame()
+                        || (captureTime && CaptureClock::now() - captureTime > VIDEO_MAX_CAPTURE_AGE);
+                if (superseded)
+                    break;
                 retries++;
                 QThread::usleep(500);
             }
@@ -346,12 +455,103 @@ void CoreAV::sendCallVideo(uint32_t callId, shared_ptr<VideoFrame> vframe)
             }
         }
     } while (err == TOXAV_ERR_SEND_FRAME_SYNC && retries < 5);
+
+    call.stats->videoSendRetries += retries;
+    if (superseded)
+    {
+        // toxav being busy isn't the peer's fault, no need to adapt the video to it
+        ++call.stats->videoFramesStale;
+        delete frame;
+        return;
+    }
+
     if (err == TOXAV_ERR_SEND_FRAME_SYNC)
         qDebug() << "toxav_video_send_frame error: Lock busy, dropping frame";
 
+    call.stats->encodeTime = static_cast<quint32>(timer.nsecsElapsed() / 1000);
+    if (err == TOXAV_ERR_SEND_FRAME_OK)
+    {
+        ++call.stats->videoFramesSent;
+        if (captureTime)
+            call.stats->videoLatency = static_cast<quint32>(CaptureClock::now() - captureTime);
+        onVideoSent(call);
+    }
+    else
+    {
+        ++call.stats->videoSendErrors;
+        onVideoSendFailed(call);
+    }
+
     delete frame;
 }
 
+void CoreAV::adaptVideoScale(ToxFriendCall& call)
+{
+    int scaleDown = 0;
+    if (call.videoBitrate < quarterSizeBitrate)
+        scaleDown = maxVideoScaleDown;
+    else if (call.videoBitrate < halfSizeBitrate)
+        scaleDown = 1;
+
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    if (scaleDown < call.videoScaleDown)
+    {
+        // one step at a time, and only once the link held up for a while
+        if (now - call.lastVideoAdaption < videoScaleUpDelay)
+            return;
+
+        scaleDown = call.videoScaleDown - 1;
+    }
+    else if (scaleDown == call.videoScaleDown)
+    {
+        return;
+    }
+
+    qDebug() << "Sending video to friend" << call.callId << "halved" << scaleDown << "times";
+    call.videoScaleDown = scaleDown;
+    call.lastVideoAdaption = now;
+}
+
+void CoreAV::onVideoSent(ToxFriendCall& call)
+{
+    call.videoSendFailures = 0;
+
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    if (now - call.lastVideoAdaption < videoScaleUpDelay)
+        return;
+
+    // toxav only tells us when the link is saturated, so we probe for more ourselves
+    if (call.videoBitrate < VIDEO_DEFAULT_BITRATE)
+    {
+        uint32_t bitrate = call.videoBitrate + call.videoBitrate / 4;
+        call.videoBitrate = bitrate < VIDEO_DEFAULT_BITRATE ? bitrate : VIDEO_DEFAULT_BITRATE;
+        call.stats->videoBitrate = call.videoBitrate;
+        toxav_bit_rate_set(toxav, call.callId, -1, call.videoBitrate, nullptr);
+    }
+
+    adaptVideoScale(call);
+    call.lastVideoAdaption = now;
+}
+
+void CoreAV::onVideoSendFailed(ToxFriendCall& call)
+{
+    if (++call.videoSendFailures < maxVideoSendFailures)
+        return;
+
+    call.videoSendFailures = 0;
+    call.videoBitrate = qMax(call.videoBitrate / 2, minVideoBitrate);
+    if (call.videoScaleDown < maxVideoScaleDown)
+    {
+        call.videoScaleDown++;
+        call.lastVideoAdaption = QDateTime::currentMSecsSinceEpoch();
+    }
+
+    qDebug() << "Too many dropped video frames to friend" << call.callId
+             << ", lowering the bitrate to" << call.videoBitrate;
+    call.stats->videoBitrate = call.videoBitrate;
+    toxav_bit_rate_set(toxav, call.callId, -1, call.videoBitrate, nullptr);
+}
+
 void CoreAV::micMuteToggle(uint32_t callId)
 {
     if (calls.contains(callId))
@@ -386,24 +586,23 @@ void CoreAV::groupCallCallback(void* tox, int group, int peer,
     Core* c = static_cast<Core*>(core);
     CoreAV* cav = c->getAv();
 
-    if (!cav->groupCalls.contains(group))
-    {
+    ToxGroupCall* found = cav->groupCalls.find(group);
+    if (!found)
         return;
-    }
 
-    ToxGroupCall& call = cav->groupCalls[group];
+    ToxGroupCall& call = *found;
 
-    emit c->groupPeerAudioPlaying(group, peer);
+    if (!call.mixer)
+        return;
+
+    // the GUI only needs to hear about it every once in a while, not on every frame
+    if (call.mixer->reportActivity(peer))
+        emit c->groupPeerAudioPlaying(group, peer);
 
     if (call.muteVol || call.inactive)
         return;
 
-    Audio& audio = Audio::getInstance();
-    if (!call.alSource)
-        audio.subscribeOutput(call.alSource);
-
-    audio.playAudioBuffer(call.alSource, data, samples, channels,
-                          sample_rate);
+    call.mixer->push(peer, data, samples, channels, sample_rate);
 }
 
 VideoSource *CoreAV::getVideoSourceFromCall(int friendNum)
@@ -434,10 +633,11 @@ void CoreAV::leaveGroupCall(int groupId)
 
 bool CoreAV::sendGroupCallAudio(int groupId, const int16_t *pcm, size_t samples, uint8_t chans, uint32_t rate)
 {
-    if (!groupCalls.contains(groupId))
+    ToxGroupCall* found = groupCalls.find(groupId);
+    if (!found)
         return false;
 
-    ToxGroupCall& call = groupCalls[groupId];
+    ToxGroupCall& call = *found;
 
     if (call.inactive || call.muteMic)
         return true;
@@ -483,11 +683,34 @@ bool CoreAV::isGroupAvEnabled(int groupId) const
     return tox_group_get_type(Core::getInstance()->tox, groupId) == TOX_GROUPCHAT_TYPE_AV;
 }
 
+AudioJitterBuffer::Stats CoreAV::getCallAudioStats(uint32_t friendNum)
+{
+    ToxFriendCall* found = calls.find(friendNum);
+    if (!found || !found->jitterBuffer)
+        return AudioJitterBuffer::Stats();
+
+    ToxFriendCall& call = *found;
+    AudioJitterBuffer::Stats stats = call.jitterBuffer->getStats();
+    stats.latency += Audio::getInstance().queuedBuffers(call.alSource) * static_cast<int>(AUDIO_FRAME_DURATION);
+    return stats;
+}
+
+std::shared_ptr<const CallStats> CoreAV::getCallStats(uint32_t friendNum)
+{
+    ToxFriendCall* call = calls.find(friendNum);
+    if (!call)
+        return nullptr;
+
+    return call->stats;
+}
+
 void CoreAV::invalidateCallSources()
 {
     for (ToxGroupCall& call : groupCalls)
     {
         call.alSource = 0;
+        if (call.mixer)
+            call.mixer->invalidateSource();
     }
 
     for (ToxFriendCall& call : calls)
@@ -538,7 +761,12 @@ void CoreAV::callCallback(ToxAV* toxav, uint32_t friendNum, bool audio, bool vid
         return;
     }
     qDebug() << QString("Received call invite from %1").arg(friendNum);
+    const qint64 setupStart = CaptureClock::now();
+    QElapsedTimer setup;
+    setup.start();
     const auto& callIt = self->calls.insert({friendNum, video, *self});
+    callIt->stats->setupStart = setupStart;
+    callIt->stats->setupAudioTime = static_cast<quint32>(setup.elapsed());
 
     // We don't get a state callback when answering, so fill the state ourselves in advance
     int state = 0;
@@ -600,6 +828,7 @@ void CoreAV::stateCallback(ToxAV* toxav, uint32_t friendNum, uint32_t state, voi
         {
             call.stopTimeout();
             call.inactive = false;
+            call.stats->answerDelay = call.stats->sinceSetup();
             emit self->avStart(friendNum, call.videoEnabled);
         }
         else if ((call.state & TOXAV_FRIEND_CALL_STATE_SENDING_V)
@@ -636,39 +865,58 @@ void CoreAV::bitrateCallback(ToxAV* toxav, uint32_t friendNum, uint32_t arate, u
                                                 Q_ARG(uint32_t, arate), Q_ARG(uint32_t, vrate), Q_ARG(void*, _self));
     }
 
-    qDebug() << "Recommended bitrate with"<<friendNum<<" is now "<<arate<<"/"<<vrate<<", ignoring it";
+    qDebug() << "Recommended bitrate with"<<friendNum<<" is now "<<arate<<"/"<<vrate;
+    ToxFriendCall* found = self->calls.find(friendNum);
+    if (!found)
+        return;
+
+    ToxFriendCall& call = *found;
+    if (arate)
+        call.stats->audioBitrate = arate;
+    if (!vrate)
+        return;
+
+    call.stats->videoBitrate = vrate;
+    call.videoBitrate = vrate;
+    if (call.nullVideoBitrate)
+        return;
+
+    toxav_bit_rate_set(toxav, friendNum, -1, vrate, nullptr);
+    self->adaptVideoScale(call);
 }
 
 void CoreAV::audioFrameCallback(ToxAV *, uint32_t friendNum, const int16_t *pcm,
                                 size_t sampleCount, uint8_t channels, uint32_t samplingRate, void *_self)
 {
     CoreAV* self = static_cast<CoreAV*>(_self);
-    if (!self->calls.contains(friendNum))
+    ToxFriendCall* call = self->calls.find(friendNum);
+    if (!call)
         return;
 
-    ToxCall& call = self->calls[friendNum];
-
-    if (call.muteVol)
+    if (!call->stats->audioFramesReceived++)
+        call->stats->firstAudioDelay = call->stats->sinceSetup();
+    if (call->muteVol || !call->jitterBuffer)
         return;
 
-    Audio& audio = Audio::getInstance();
-    if (!call.alSource)
-        audio.subscribeOutput(call.alSource);
-
-    audio.playAudioBuffer(call.alSource, pcm, sampleCount, channels, samplingRate);
+    // played by playAudio, when the output device wants more
+    call->jitterBuffer->push(pcm, sampleCount, channels, samplingRate);
 }
 
 void CoreAV::videoFrameCallback(ToxAV *, uint32_t friendNum, uint16_t w, uint16_t h,
                                 const uint8_t *y, const uint8_t *u, const uint8_t *v,
                                 int32_t ystride, int32_t ustride, int32_t vstride, void *)
 {
-    if (!calls.contains(friendNum))
+    ToxFriendCall* found = calls.find(friendNum);
+    if (!found)
         return;
 
-    ToxFriendCall& call = calls[friendNum];
-    if (!call.videoSource)
+    if (!found->stats->videoFramesReceived++)
+        found->stats->firstVideoDelay = found->stats->sinceSetup();
+    if (!found->videoSource)
         return;
 
+    ToxFriendCall& call = *found;
+
     vpx_image frame;
     frame.d_h = h;
     frame.d_w = w;
@@ -22,8 +22,12 @@
 #define COREAV_H
 
 #include <QObject>
+#include <QElapsedTimer>
+#include <QVector>
 #include <memory>
 #include <atomic>
+#include "src/audio/audiojitterbuffer.h"
+#include "src/core/callstats.h"
 #include "src/core/toxcall.h"
 #include <tox/toxav.h>
 
@@ -53,13 +57,20 @@ public:
     bool anyActiveCalls(); ///< true is any calls are currently active (note: a call about to start is not yet active)
     bool isCallVideoEnabled(uint32_t friendNum);
     /// Returns false only on error, but not if there's nothing to send
-    bool sendCallAudio(uint32_t friendNum, const int16_t *pcm, size_t samples, uint8_t chans, uint32_t rate);
+    bool sendCallAudio(uint32_t friendNum, const int16_t *pcm, size_t samples, uint8_t chans, uint32_t rate,
+                       qint64 captureTime);
     void sendCallVideo(uint32_t friendNum, std::shared_ptr<VideoFrame> frame);
     bool sendGroupCallAudio(int groupNum, const int16_t *pcm, size_t samples, uint8_t chans, uint32_t rate);
 
     VideoSource* getVideoSourceFromCall(int callNumber); ///< Get a call's video source
+    /// How the friend's audio is buffered, the latency includes what the output device has queued
+    AudioJitterBuffer::Stats getCallAudioStats(uint32_t friendNum);
+    /// The call's counters, they stay valid after the call ended. nullptr if there's no such call
+    std::shared_ptr<const CallStats> getCallStats(uint32_t friendNum);
     void invalidateCallSources(); ///< Forces to regenerate each call's audio sources
     void sendNoVideo(); ///< Signal to all peers that we're not sending video anymore. The next frame sent cancels this.
+    /// How many toxav iterations ran late by less than 1, 2, 5, 10, 20 and by 20ms or more, for diagnostics
+    QVector<quint64> getIterationLateness() const;
 
     void joinGroupCall(int groupNum); ///< Starts a call in an existing AV groupchat. Call from the GUI thread.
     void leaveGroupCall(int groupNum); ///< Will not leave the group, just stop the call. Call from the GUI thread.
@@ -102,20 +113,31 @@ private slots:
 
 private:
     void process();
+    /// Feeds each call's output source from its jitter buffer, at the pace the device plays
+    void playAudio();
+    /// Steps the size of the frames we send to the friend down or up to fit the video bitrate
+    void adaptVideoScale(ToxFriendCall& call);
+    void onVideoSent(ToxFriendCall& call);
+    void onVideoSendFailed(ToxFriendCall& call);
     static void audioFrameCallback(ToxAV *toxAV, uint32_t friendNum, const int16_t *pcm, size_t sampleCount,
                                   uint8_t channels, uint32_t samplingRate, void* self);
     static void videoFrameCallback(ToxAV *toxAV, uint32_t friendNum, uint16_t w, uint16_t h,
                                    const uint8_t *y, const uint8_t *u, const uint8_t *v,
                                    int32_t ystride, int32_t ustride, int32_t vstride, void* self);
 
-private:
+public:
     static constexpr uint32_t AUDIO_DEFAULT_BITRATE = 64; ///< In kb/s. More than enough for Opus.
     static constexpr uint32_t VIDEO_DEFAULT_BITRATE = 6144; ///< Picked at random by fair dice roll.
+    static constexpr qint64 VIDEO_MAX_CAPTURE_AGE = 200000; ///< In µs, older frames aren't worth encoding anymore
 
 private:
     ToxAV* toxav;
     std::unique_ptr<QThread> coreavThread;
     std::unique_ptr<QTimer> iterateTimer;
+    std::unique_ptr<QTimer> playoutTimer;
+    QElapsedTimer iterationClock;
+    qint64 nextIteration; ///< When process() should run next, in ns of the iterationClock
+    std::atomic<quint64> iterationLateness[6];
     static IndexedList<ToxFriendCall> calls;
     static IndexedList<ToxGroupCall> groupCalls; // Maps group IDs to ToxGroupCalls
     /**
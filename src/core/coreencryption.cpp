@@ -27,6 +27,7 @@
 #include "src/core/cstring.h"
 #include "src/nexus.h"
 #include "src/persistence/profile.h"
+#include "src/persistence/passkeycache.h"
 #include "src/persistence/historykeeper.h"
 #include <tox/tox.h>
 #include <tox/toxencryptsave.h>
@@ -53,24 +54,37 @@ std::unique_ptr<TOX_PASS_KEY> Core::createPasskey(const QString& password, uint8
 
 QByteArray Core::encryptData(const QByteArray &data)
 {
-    return encryptData(data, Nexus::getProfile()->getPasskey());
+    auto passkey = Nexus::getProfile()->getPasskey();
+    if (!passkey)
+    {
+        qWarning() << "The profile has no key to encrypt with";
+        return QByteArray();
+    }
+    return encryptData(data, *passkey);
 }
 
 QByteArray Core::encryptData(const QByteArray& data, const TOX_PASS_KEY& encryptionKey)
 {
-    uint8_t encrypted[data.size() + TOX_PASS_ENCRYPTION_EXTRA_LENGTH];
+    // Encrypt straight into the result, large saves don't belong on the stack
+    QByteArray encrypted(data.size() + TOX_PASS_ENCRYPTION_EXTRA_LENGTH, Qt::Uninitialized);
     if (!tox_pass_key_encrypt(reinterpret_cast<const uint8_t*>(data.data()), data.size(),
-                            &encryptionKey, encrypted, nullptr))
+                            &encryptionKey, reinterpret_cast<uint8_t*>(encrypted.data()), nullptr))
     {
         qWarning() << "Encryption failed";
         return QByteArray();
     }
-    return QByteArray(reinterpret_cast<char*>(encrypted), data.size() + TOX_PASS_ENCRYPTION_EXTRA_LENGTH);
+    return encrypted;
 }
 
 QByteArray Core::decryptData(const QByteArray &data)
 {
-    return decryptData(data, Nexus::getProfile()->getPasskey());
+    auto passkey = Nexus::getProfile()->getPasskey();
+    if (!passkey)
+    {
+        qWarning() << "The profile has no key to decrypt with";
+        return QByteArray();
+    }
+    return decryptData(data, *passkey);
 }
 
 QByteArray Core::decryptData(const QByteArray& data, const TOX_PASS_KEY& encryptionKey)
@@ -81,14 +95,14 @@ QByteArray Core::decryptData(const QByteArray& data, const TOX_PASS_KEY& encrypt
         return QByteArray();
     }
     int sz = data.size() - TOX_PASS_ENCRYPTION_EXTRA_LENGTH;
-    uint8_t decrypted[sz];
+    QByteArray decrypted(sz, Qt::Uninitialized);
     if (!tox_pass_key_decrypt(reinterpret_cast<const uint8_t*>(data.data()), data.size(),
-                              &encryptionKey, decrypted, nullptr))
+                              &encryptionKey, reinterpret_cast<uint8_t*>(decrypted.data()), nullptr))
     {
         qWarning() << "Decryption failed";
         return QByteArray();
     }
-    return QByteArray(reinterpret_cast<char*>(decrypted), sz);
+    return decrypted;
 }
 
 QByteArray Core::getSaltFromFile(QString filename)
@@ -128,7 +142,7 @@ void Core::checkEncryptedHistory()
         return;
     }
 
-    auto passkey = createPasskey(Nexus::getProfile()->getPassword(), reinterpret_cast<uint8_t*>(salt.data()));
+    auto passkey = PasskeyCache::getKey(Nexus::getProfile()->getPassword(), reinterpret_cast<uint8_t*>(salt.data()));
 
     QString a(tr("Please enter the password for the chat history for the profile \"%1\".", "used in load() when no hist pw set").arg(Nexus::getProfile()->getName()));
     QString b(tr("The previous password is incorrect; please try again:", "used on retries in load()"));
@@ -0,0 +1,80 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "coreevents.h"
+
+#include <tox/tox.h>
+
+void CoreEvents::addFriendStatus(uint32_t friendId, Status status)
+{
+    // the GUI acts on going offline and coming back, those can't be merged away
+    auto it = lastStatus.constFind(friendId);
+    if (it != lastStatus.constEnd())
+    {
+        FriendStatus& last = friendStatuses[*it];
+        if ((last.status == Status::Offline) == (status == Status::Offline))
+        {
+            last.status = status;
+            return;
+        }
+    }
+
+    lastStatus[friendId] = friendStatuses.size();
+    friendStatuses.append({friendId, status});
+}
+
+void CoreEvents::addFriendTyping(uint32_t friendId, bool isTyping)
+{
+    friendTyping[friendId] = isTyping;
+}
+
+void CoreEvents::addFriendMessage(uint32_t friendId, const QString& message, bool isAction)
+{
+    friendMessages.append({friendId, message, isAction});
+}
+
+void CoreEvents::addGroupMessage(int groupId, int peerId, const QString& message, bool isAction)
+{
+    groupMessages.append({groupId, peerId, message, isAction});
+}
+
+void CoreEvents::addGroupNamelistChange(int groupId, int peerId, uint8_t change)
+{
+    if (change == TOX_CHAT_CHANGE_PEER_NAME)
+        groupPeerNames.insert(qMakePair(groupId, peerId));
+    else
+        groupPeerLists.insert(groupId);
+}
+
+bool CoreEvents::isEmpty() const
+{
+    return friendStatuses.isEmpty() && friendTyping.isEmpty() && friendMessages.isEmpty()
+            && groupMessages.isEmpty() && groupPeerLists.isEmpty() && groupPeerNames.isEmpty();
+}
+
+void CoreEvents::clear()
+{
+    friendStatuses.clear();
+    friendTyping.clear();
+    friendMessages.clear();
+    groupMessages.clear();
+    groupPeerLists.clear();
+    groupPeerNames.clear();
+    lastStatus.clear();
+}
@@ -0,0 +1,86 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef COREEVENTS_H
+#define COREEVENTS_H
+
+#include <cstdint>
+
+#include <QHash>
+#include <QPair>
+#include <QSet>
+#include <QString>
+#include <QVector>
+
+#include "corestructs.h"
+
+/**
+@brief The toxcore events of one GUI frame, sent to the GUI at once.
+
+Redundant updates collapse as they're added: the latest status of a friend wins, unless
+it goes offline or comes back online in between, the latest typing state wins, and
+the changes of a group's peers are kept once. Messages are all kept, in order.
+*/
+class CoreEvents
+{
+public:
+    struct FriendStatus
+    {
+        uint32_t friendId;
+        Status status;
+    };
+
+    struct FriendMessage
+    {
+        uint32_t friendId;
+        QString message;
+        bool isAction;
+    };
+
+    struct GroupMessage
+    {
+        int groupId;
+        int peerId;
+        QString message;
+        bool isAction;
+    };
+
+    void addFriendStatus(uint32_t friendId, Status status);
+    void addFriendTyping(uint32_t friendId, bool isTyping);
+    void addFriendMessage(uint32_t friendId, const QString& message, bool isAction);
+    void addGroupMessage(int groupId, int peerId, const QString& message, bool isAction);
+    /// Takes a TOX_CHAT_CHANGE
+    void addGroupNamelistChange(int groupId, int peerId, uint8_t change);
+
+    bool isEmpty() const;
+    void clear();
+
+public:
+    QVector<FriendStatus> friendStatuses;
+    QHash<uint32_t, bool> friendTyping;
+    QVector<FriendMessage> friendMessages;
+    QVector<GroupMessage> groupMessages;
+    QSet<int> groupPeerLists; ///< Groups that peers joined or left, their whole list is regenerated
+    QSet<QPair<int, int>> groupPeerNames; ///< Group and peer of the renamed peers
+
+private:
+    QHash<uint32_t, int> lastStatus; ///< Index of each friend's latest status
+};
+
+#endif // COREEVENTS_H
@@ -21,41 +21,150 @@
 #include "core.h"
 #include "corefile.h"
 #include "corestructs.h"
+#include "fileprefetcher.h"
+#include "filescheduler.h"
+#include "filewriter.h"
 #include "src/core/cstring.h"
 #include "src/persistence/settings.h"
 #include "src/persistence/profile.h"
+#include "src/trace.h"
+#include "src/memorystats.h"
 #include <QDebug>
 #include <QFile>
+#include <QFileInfo>
 #include <QThread>
 #include <QDir>
+#include <QElapsedTimer>
+#include <QFutureWatcher>
 #include <memory>
+#include <sodium.h>
 
-QMutex CoreFile::fileSendMutex;
 QHash<uint64_t, ToxFile> CoreFile::fileMap;
+QMultiHash<uint32_t, uint32_t> CoreFile::friendFiles;
+int CoreFile::transmittingDataFiles = 0;
+int CoreFile::transmittingAvatarFiles = 0;
+int CoreFile::outgoingAvatarFiles = 0;
+QList<CoreFile::QueuedAvatar> CoreFile::avatarQueue;
+FileScheduler CoreFile::scheduler;
 using namespace std;
 
+namespace
+{
+/// Progress is sent to the GUI twice a second, every ToxFile copied there isn't cheap
+const qint64 progressInterval = 500;
+/// Weight of the newest sample in the transfer rates, they settle over a couple of seconds
+const double rateSmoothing = 0.3;
+/// Files up to this size go before the bulk transfers
+const quint64 smallFileSize = 1024 * 1024;
+/// Avatars offered at once, the rest of a broadcast waits in the avatarQueue
+const int maxAvatarSends = 8;
+/// Received avatars are buffered in memory, we don't trust a larger announced size for that
+const quint64 maxAvatarReserve = 4 * 1024 * 1024;
+
+/// Only for files we transfer from the start, a resumed transfer can't be hashed without rereading it
+void startHash(ToxFile& file)
+{
+    void* state = sodium_malloc(crypto_generichash_statebytes());
+    if (!state)
+        return;
+
+    file.hashState.reset(static_cast<crypto_generichash_state*>(state), sodium_free);
+    file.hashedBytes = 0;
+    crypto_generichash_init(file.hashState.get(), nullptr, 0, crypto_generichash_BYTES);
+}
+
+void hashChunk(ToxFile& file, uint64_t pos, const uint8_t* data, size_t length)
+{
+    if (!file.hashState)
+        return;
+
+    // out of order, we'd have to read the file back to hash it
+    if (pos != file.hashedBytes)
+    {
+        file.hashState.reset();
+        return;
+    }
+
+    crypto_generichash_update(file.hashState.get(), data, length);
+    file.hashedBytes += length;
+}
+
+void finishHash(ToxFile& file)
+{
+    if (file.hashState && file.hashedBytes == file.filesize)
+    {
+        file.hash.resize(crypto_generichash_BYTES);
+        crypto_generichash_final(file.hashState.get(), reinterpret_cast<unsigned char*>(file.hash.data()),
+                                 file.hash.size());
+    }
+    file.hashState.reset();
+}
+
+qint64 elapsedMs()
+{
+    static QElapsedTimer clock;
+    if (!clock.isValid())
+        clock.start();
+
+    return clock.elapsed();
+}
+
+/// Starts measuring the rate again from where the file is now
+void resetRate(ToxFile& file)
+{
+    file.bytesPerSec = 0;
+    file.rateBytes = file.bytesSent;
+    file.rateTime = elapsedMs();
+}
+
+void updateRate(ToxFile& file, qint64 now)
+{
+    if (now <= file.rateTime || file.bytesSent < file.rateBytes)
+    {
+        resetRate(file);
+        return;
+    }
+
+    double sample = (file.bytesSent - file.rateBytes) * 1000.0 / (now - file.rateTime);
+    if (file.bytesPerSec > 0)
+        file.bytesPerSec = rateSmoothing * sample + (1 - rateSmoothing) * file.bytesPerSec;
+    else
+        file.bytesPerSec = sample;
+
+    file.rateBytes = file.bytesSent;
+    file.rateTime = now;
+}
+}
+
 unsigned CoreFile::corefileIterationInterval()
 {
     /// Sleep at most 1000ms if we have no FT, 10 for user FTs, 50 for the rest (avatars, ...)
     constexpr unsigned fastFileInterval=10, slowFileInterval=50, idleInterval=1000;
-    unsigned interval = idleInterval;
 
-    for (ToxFile& file : fileMap)
+    // the scheduler has chunks waiting for the rate limits
+    if (transmittingDataFiles || !scheduler.isEmpty())
+        return fastFileInterval;
+    if (transmittingAvatarFiles || !avatarQueue.isEmpty())
+        return slowFileInterval;
+    return idleInterval;
+}
+
+/**
+@brief Queues our avatar for a friend, it's offered once fewer than maxAvatarSends are going out.
+
+The hash, if given, is the tox hash of data, so that a broadcast only hashes it once.
+Data is implicitly shared, all the queued and sending copies are the same buffer.
+*/
+void CoreFile::sendAvatarFile(Core* core, uint32_t friendId, const QByteArray& data, const QByteArray& hash)
+{
+    for (int i = 0; i < avatarQueue.size(); ++i)
     {
-        if (file.status == ToxFile::TRANSMITTING)
+        if (avatarQueue[i].friendId == friendId)
         {
-            if (file.fileKind == TOX_FILE_KIND_DATA)
-                return fastFileInterval;
-            else
-                interval = slowFileInterval;
+            avatarQueue.removeAt(i);
+            break;
         }
     }
-    return interval;
-}
-
-void CoreFile::sendAvatarFile(Core* core, uint32_t friendId, const QByteArray& data)
-{
-    QMutexLocker mlocker(&fileSendMutex);
 
     if (data.isEmpty())
     {
@@ -64,37 +173,59 @@ void CoreFile::sendAvatarFile(Core* core, uint32_t friendId, const QByteArray& d
         return;
     }
 
-    static_assert(TOX_HASH_LENGTH <= TOX_FILE_ID_LENGTH, "TOX_HASH_LENGTH > TOX_FILE_ID_LENGTH!");
-    uint8_t avatarHash[TOX_HASH_LENGTH];
-    tox_hash(avatarHash, (uint8_t*)data.data(), data.size());
-    uint64_t filesize = data.size();
-    TOX_ERR_FILE_SEND err;
-    uint32_t fileNum = tox_file_send(core->tox, friendId, TOX_FILE_KIND_AVATAR, filesize,
-                                         avatarHash, avatarHash, TOX_HASH_LENGTH, &err);
-
-    if (fileNum == std::numeric_limits<uint32_t>::max())
+    QueuedAvatar avatar{friendId, data, hash};
+    if (avatar.hash.size() != TOX_HASH_LENGTH)
     {
-        qWarning() << "sendAvatarFile: Can't create the Tox file sender, error"<<err;
-        return;
+        avatar.hash.resize(TOX_HASH_LENGTH);
+        tox_hash((uint8_t*)avatar.hash.data(), (const uint8_t*)data.constData(), data.size());
     }
-    //qDebug() << QString("sendAvatarFile: Created file sender %1 with friend %2").arg(fileNum).arg(friendId);
-
-    ToxFile file{fileNum, friendId, "", "", ToxFile::SENDING};
-    file.filesize = filesize;
-    file.fileName = QByteArray((char*)avatarHash, TOX_HASH_LENGTH);
-    file.fileKind = TOX_FILE_KIND_AVATAR;
-    file.avatarData = data;
-    file.resumeFileId.resize(TOX_FILE_ID_LENGTH);
-    tox_file_get_file_id(core->tox, friendId, fileNum, (uint8_t*)file.resumeFileId.data(), nullptr);
-    addFile(friendId, fileNum, file);
+    avatarQueue.append(avatar);
+    sendQueuedAvatars(core);
 }
 
-void CoreFile::sendFile(Core* core, uint32_t friendId, QString Filename, QString FilePath, long long filesize)
+/**
+@brief Offers the queued avatars, as long as fewer than maxAvatarSends are going out.
+
+Called on every Core iteration, the avatar transfers themselves go through the scheduler.
+*/
+void CoreFile::sendQueuedAvatars(Core* core)
 {
-    QMutexLocker mlocker(&fileSendMutex);
+    while (!avatarQueue.isEmpty() && outgoingAvatarFiles < maxAvatarSends)
+    {
+        QueuedAvatar avatar = avatarQueue.takeFirst();
+        static_assert(TOX_HASH_LENGTH <= TOX_FILE_ID_LENGTH, "TOX_HASH_LENGTH > TOX_FILE_ID_LENGTH!");
+        const uint8_t* avatarHash = reinterpret_cast<const uint8_t*>(avatar.hash.constData());
+        uint64_t filesize = avatar.data.size();
+        TOX_ERR_FILE_SEND err;
+        uint32_t fileNum = tox_file_send(core->tox, avatar.friendId, TOX_FILE_KIND_AVATAR, filesize,
+                                         avatarHash, avatarHash, TOX_HASH_LENGTH, &err);
+
+        if (fileNum == std::numeric_limits<uint32_t>::max())
+        {
+            qWarning() << "sendAvatarFile: Can't create the Tox file sender, error"<<err;
+            continue;
+        }
+        //qDebug() << QString("sendAvatarFile: Created file sender %1 with friend %2").arg(fileNum).arg(avatar.friendId);
 
+        ToxFile file{fileNum, avatar.friendId, "", "", ToxFile::SENDING};
+        file.filesize = filesize;
+        file.fileName = avatar.hash;
+        file.fileKind = TOX_FILE_KIND_AVATAR;
+        file.avatarData = avatar.data;
+        file.resumeFileId.resize(TOX_FILE_ID_LENGTH);
+        tox_file_get_file_id(core->tox, avatar.friendId, fileNum, (uint8_t*)file.resumeFileId.data(), nullptr);
+        addFile(avatar.friendId, fileNum, file);
+    }
+}
+
+void CoreFile::sendFile(Core* core, uint32_t friendId, QString Filename, QString FilePath, long long filesize,
+                        const QByteArray& resumeFileId)
+{
     QByteArray fileName = Filename.toUtf8();
-    uint32_t fileNum = tox_file_send(core->tox, friendId, TOX_FILE_KIND_DATA, filesize, nullptr,
+    const uint8_t* fileId = nullptr;
+    if (resumeFileId.size() == TOX_FILE_ID_LENGTH)
+        fileId = reinterpret_cast<const uint8_t*>(resumeFileId.constData());
+    uint32_t fileNum = tox_file_send(core->tox, friendId, TOX_FILE_KIND_DATA, filesize, fileId,
                                 (uint8_t*)fileName.data(), fileName.size(), nullptr);
     if (fileNum == std::numeric_limits<uint32_t>::max())
     {
@@ -112,9 +243,25 @@ void CoreFile::sendFile(Core* core, uint32_t friendId, QString Filename, QString
     {
         qWarning() << QString("sendFile: Can't open file, error: %1").arg(file.file->errorString());
     }
+    else
+    {
+        file.prefetcher = std::make_shared<FilePrefetcher>(FilePath, file.filesize);
+        startHash(file);
+
+        // so the transfer can carry on after we restart
+        Settings::ResumableTransfer transfer;
+        transfer.friendPk = core->getFriendPublicKey(friendId);
+        transfer.fileId = file.resumeFileId;
+        transfer.fileName = Filename;
+        transfer.filePath = FilePath;
+        transfer.fileSize = file.filesize;
+        transfer.sending = true;
+        Settings::getInstance().addResumableTransfer(transfer);
+        Settings::getInstance().savePersonal();
+    }
     addFile(friendId, fileNum, file);
 
-    emit core->fileSendStarted(file);
+    emit core->fileSendStarted(file.snapshot());
 }
 
 void CoreFile::pauseResumeFileSend(Core* core, uint32_t friendId, uint32_t fileId)
@@ -127,14 +274,14 @@ void CoreFile::pauseResumeFileSend(Core* core, uint32_t friendId, uint32_t fileI
     }
     if (file->status == ToxFile::TRANSMITTING)
     {
-        file->status = ToxFile::PAUSED;
-        emit core->fileTransferPaused(*file);
+        setStatus(*file, ToxFile::PAUSED);
+        emit core->fileTransferPaused(file->snapshot());
         tox_file_control(core->tox, file->friendId, file->fileNum, TOX_FILE_CONTROL_PAUSE, nullptr);
     }
     else if (file->status == ToxFile::PAUSED)
     {
-        file->status = ToxFile::TRANSMITTING;
-        emit core->fileTransferAccepted(*file);
+        setStatus(*file, ToxFile::TRANSMITTING);
+        emit core->fileTransferAccepted(file->snapshot());
         tox_file_control(core->tox, file->friendId, file->fileNum, TOX_FILE_CONTROL_RESUME, nullptr);
     }
     else
@@ -151,14 +298,14 @@ void CoreFile::pauseResumeFileRecv(Core* core, uint32_t friendId, uint32_t fileI
     }
     if (file->status == ToxFile::TRANSMITTING)
     {
-        file->status = ToxFile::PAUSED;
-        emit core->fileTransferPaused(*file);
+        setStatus(*file, ToxFile::PAUSED);
+        emit core->fileTransferPaused(file->snapshot());
         tox_file_control(core->tox, file->friendId, file->fileNum, TOX_FILE_CONTROL_PAUSE, nullptr);
     }
     else if (file->status == ToxFile::PAUSED)
     {
-        file->status = ToxFile::TRANSMITTING;
-        emit core->fileTransferAccepted(*file);
+        setStatus(*file, ToxFile::TRANSMITTING);
+        emit core->fileTransferAccepted(file->snapshot());
         tox_file_control(core->tox, file->friendId, file->fileNum, TOX_FILE_CONTROL_RESUME, nullptr);
     }
     else
@@ -173,8 +320,8 @@ void CoreFile::cancelFileSend(Core* core, uint32_t friendId, uint32_t fileId)
         qWarning("cancelFileSend: No such file in queue");
         return;
     }
-    file->status = ToxFile::STOPPED;
-    emit core->fileTransferCancelled(*file);
+    setStatus(*file, ToxFile::STOPPED);
+    emit core->fileTransferCancelled(file->snapshot());
     tox_file_control(core->tox, file->friendId, file->fileNum, TOX_FILE_CONTROL_CANCEL, nullptr);
     removeFile(friendId, fileId);
 }
@@ -187,8 +334,8 @@ void CoreFile::cancelFileRecv(Core* core, uint32_t friendId, uint32_t fileId)
         qWarning("cancelFileRecv: No such file in queue");
         return;
     }
-    file->status = ToxFile::STOPPED;
-    emit core->fileTransferCancelled(*file);
+    setStatus(*file, ToxFile::STOPPED);
+    emit core->fileTransferCancelled(file->snapshot());
     tox_file_control(core->tox, file->friendId, file->fileNum, TOX_FILE_CONTROL_CANCEL, nullptr);
     removeFile(friendId, fileId);
 }
@@ -201,8 +348,8 @@ void CoreFile::rejectFileRecvRequest(Core* core, uint32_t friendId, uint32_t fil
         qWarning("rejectFileRecvRequest: No such file in queue");
         return;
     }
-    file->status = ToxFile::STOPPED;
-    emit core->fileTransferCancelled(*file);
+    setStatus(*file, ToxFile::STOPPED);
+    emit core->fileTransferCancelled(file->snapshot());
     tox_file_control(core->tox, file->friendId, file->fileNum, TOX_FILE_CONTROL_CANCEL, nullptr);
     removeFile(friendId, fileId);
 }
@@ -215,14 +362,32 @@ void CoreFile::acceptFileRecvRequest(Core* core, uint32_t friendId, uint32_t fil
         qWarning("acceptFileRecvRequest: No such file in queue");
         return;
     }
+    if (file->writer)
+    {
+        // we resumed it on our own when it came back
+        qDebug() << "acceptFileRecvRequest: Transfer already accepted";
+        return;
+    }
     file->setFilePath(path);
     if (!file->open(true))
     {
         qWarning() << "acceptFileRecvRequest: Unable to open file";
         return;
     }
-    file->status = ToxFile::TRANSMITTING;
-    emit core->fileTransferAccepted(*file);
+    file->writer = std::make_shared<FileWriter>(file->file);
+    startHash(*file);
+
+    Settings::ResumableTransfer transfer;
+    transfer.friendPk = core->getFriendPublicKey(friendId);
+    transfer.fileId = file->resumeFileId;
+    transfer.fileName = QString::fromUtf8(file->fileName);
+    transfer.filePath = path;
+    transfer.fileSize = file->filesize;
+    transfer.sending = false;
+    Settings::getInstance().addResumableTransfer(transfer);
+    Settings::getInstance().savePersonal();
+    setStatus(*file, ToxFile::TRANSMITTING);
+    emit core->fileTransferAccepted(file->snapshot());
     tox_file_control(core->tox, file->friendId, file->fileNum, TOX_FILE_CONTROL_RESUME, nullptr);
 }
 
@@ -242,8 +407,18 @@ void CoreFile::addFile(uint32_t friendId, uint32_t fileId, const ToxFile& file)
 {
     uint64_t key = ((uint64_t)friendId<<32) + (uint64_t)fileId;
     if (fileMap.contains(key))
+    {
         qWarning() << "addFile: Overwriting existing file transfer with same ID "<<friendId<<':'<<fileId;
+        countTransmitting(fileMap[key], -1);
+        if (fileMap[key].fileKind == TOX_FILE_KIND_AVATAR && fileMap[key].direction == ToxFile::SENDING)
+            --outgoingAvatarFiles;
+        friendFiles.remove(friendId, fileId);
+    }
     fileMap.insert(key, file);
+    friendFiles.insert(friendId, fileId);
+    countTransmitting(file, 1);
+    if (file.fileKind == TOX_FILE_KIND_AVATAR && file.direction == ToxFile::SENDING)
+        ++outgoingAvatarFiles;
 }
 
 void CoreFile::removeFile(uint32_t friendId, uint32_t fileId)
@@ -254,13 +429,213 @@ void CoreFile::removeFile(uint32_t friendId, uint32_t fileId)
         qWarning() << "removeFile: No such file in queue";
         return;
     }
+    if (fileMap[key].prefetcher)
+        fileMap[key].prefetcher->close();
+    if (fileMap[key].writer)
+        fileMap[key].writer->finish();
     fileMap[key].file->close();
+    if (fileMap[key].fileKind == TOX_FILE_KIND_DATA
+            && Settings::getInstance().removeResumableTransfer(fileMap[key].resumeFileId))
+        Settings::getInstance().savePersonal();
+    countTransmitting(fileMap[key], -1);
+    if (fileMap[key].fileKind == TOX_FILE_KIND_AVATAR && fileMap[key].direction == ToxFile::SENDING)
+        --outgoingAvatarFiles;
+    if (fileMap[key].fileKind == TOX_FILE_KIND_AVATAR && fileMap[key].direction == ToxFile::RECEIVING)
+        MemoryStats::freed(MemoryStats::AvatarBuffers, fileMap[key].avatarData.capacity());
+    scheduler.remove(friendId, fileId);
     fileMap.remove(key);
+    friendFiles.remove(friendId, fileId);
+}
+
+/**
+@brief Applies the upload rate limits of the settings.
+*/
+void CoreFile::updateRateLimits()
+{
+    const Settings& s = Settings::getInstance();
+    scheduler.setRateLimits(s.getFileUploadLimit() * 1024, s.getFileFriendUploadLimit() * 1024);
+}
+
+/**
+@brief Changes the status of a file in the fileMap, keeping count of what's transmitting.
+*/
+void CoreFile::setStatus(ToxFile& file, ToxFile::FileStatus status)
+{
+    countTransmitting(file, -1);
+    file.status = status;
+    countTransmitting(file, 1);
+    resetRate(file);
+}
+
+void CoreFile::countTransmitting(const ToxFile& file, int change)
+{
+    if (file.status != ToxFile::TRANSMITTING)
+        return;
+
+    if (file.fileKind == TOX_FILE_KIND_DATA)
+        transmittingDataFiles += change;
+    else
+        transmittingAvatarFiles += change;
+}
+
+/**
+@brief Returns the fileIds of the friend's transfers, to look them up in the fileMap.
+*/
+QList<uint32_t> CoreFile::friendFileIds(uint32_t friendId)
+{
+    return friendFiles.values(friendId);
+}
+
+ToxFile* CoreFile::rekeyFile(uint32_t friendId, uint32_t oldFileId, uint32_t newFileId)
+{
+    uint64_t oldKey = ((uint64_t)friendId<<32) + (uint64_t)oldFileId;
+    uint64_t newKey = ((uint64_t)friendId<<32) + (uint64_t)newFileId;
+    ToxFile file = fileMap.take(oldKey);
+    file.fileNum = newFileId;
+    fileMap.insert(newKey, file);
+    friendFiles.remove(friendId, oldFileId);
+    friendFiles.insert(friendId, newFileId);
+    return &fileMap[newKey];
+}
+
+/**
+@brief Sends the friend the files its connection broke while we were sending them.
+
+Toxcore drops the transfers of a friend that goes offline. Sending again with the same
+file ID lets the receiver seek to what it already has, instead of starting over. The
+unfinished transfers of our previous run are sent again the same way.
+*/
+void CoreFile::resumeFileSends(Core* core, uint32_t friendId)
+{
+    for (uint32_t fileId : friendFileIds(friendId))
+    {
+        ToxFile* file = findFile(friendId, fileId);
+        if (file->direction != ToxFile::SENDING || file->status != ToxFile::BROKEN)
+            continue;
+
+        uint32_t fileNum = tox_file_send(core->tox, friendId, TOX_FILE_KIND_DATA, file->filesize,
+                                         (uint8_t*)file->resumeFileId.data(),
+                                         (uint8_t*)file->fileName.data(), file->fileName.size(), nullptr);
+        if (fileNum == std::numeric_limits<uint32_t>::max())
+        {
+            qWarning() << "resumeFileSends: Can't create the Tox file sender";
+            emit core->fileTransferCancelled(file->snapshot());
+            removeFile(friendId, file->fileNum);
+            continue;
+        }
+
+        qDebug() << QString("resumeFileSends: Resumed file sender %1 as %2 with friend %3")
+                    .arg(file->fileNum).arg(fileNum).arg(friendId);
+        file = rekeyFile(friendId, file->fileNum, fileNum);
+        // waiting for the friend to accept it again
+        setStatus(*file, ToxFile::STOPPED);
+        emit core->fileTransferBrokenUnbroken(file->snapshot(), false);
+    }
+
+    const QString friendPk = core->getFriendPublicKey(friendId);
+    for (const Settings::ResumableTransfer& transfer : Settings::getInstance().getResumableTransfers())
+    {
+        if (!transfer.sending || transfer.friendPk != friendPk)
+            continue;
+
+        bool known = false;
+        for (uint32_t fileId : friendFileIds(friendId))
+            known |= findFile(friendId, fileId)->resumeFileId == transfer.fileId;
+        if (known)
+            continue;
+
+        if (!QFile::exists(transfer.filePath)
+                || static_cast<quint64>(QFileInfo(transfer.filePath).size()) != transfer.fileSize)
+        {
+            qDebug() << "resumeFileSends: Dropping unfinished transfer of" << transfer.filePath
+                     << ", the file changed";
+            Settings::getInstance().removeResumableTransfer(transfer.fileId);
+            Settings::getInstance().savePersonal();
+            continue;
+        }
+
+        sendFile(core, friendId, transfer.fileName, transfer.filePath, transfer.fileSize, transfer.fileId);
+    }
+}
+
+/**
+@brief Carries on with a file we were receiving when the friend sends it again.
+@return False if it's not something we were receiving, it's a new request then.
+
+The transfer picks up from what we already wrote, either before the connection broke
+or in our previous run.
+*/
+bool CoreFile::resumeFileRecv(Core* core, uint32_t friendId, uint32_t fileId, const QByteArray& resumeFileId)
+{
+    ToxFile* file = nullptr;
+    for (uint32_t knownId : friendFileIds(friendId))
+    {
+        ToxFile* known = findFile(friendId, knownId);
+        if (known->direction == ToxFile::RECEIVING && known->status == ToxFile::BROKEN
+                && known->resumeFileId == resumeFileId)
+            file = known;
+    }
+
+    if (file)
+    {
+        qDebug() << QString("resumeFileRecv: Resumed file receiver %1 as %2 with friend %3")
+                    .arg(file->fileNum).arg(fileId).arg(friendId);
+        file = rekeyFile(friendId, file->fileNum, fileId);
+        if (!file->writer)
+        {
+            // we hadn't accepted it yet
+            setStatus(*file, ToxFile::STOPPED);
+            emit core->fileTransferBrokenUnbroken(file->snapshot(), false);
+            return true;
+        }
+    }
+    else
+    {
+        const QString friendPk = core->getFriendPublicKey(friendId);
+        for (const Settings::ResumableTransfer& transfer : Settings::getInstance().getResumableTransfers())
+        {
+            if (transfer.sending || transfer.friendPk != friendPk || transfer.fileId != resumeFileId)
+                continue;
+
+            ToxFile resumed{fileId, friendId, transfer.fileName.toUtf8(), transfer.filePath, ToxFile::RECEIVING};
+            resumed.filesize = transfer.fileSize;
+            resumed.resumeFileId = resumeFileId;
+            if (!QFile::exists(transfer.filePath) || !resumed.open(true))
+                break;
+
+            resumed.bytesSent = static_cast<quint64>(resumed.file->size());
+            resumed.writer = std::make_shared<FileWriter>(resumed.file);
+            addFile(friendId, fileId, resumed);
+            file = findFile(friendId, fileId);
+            emit core->fileReceiveRequested(file->snapshot());
+            break;
+        }
+
+        if (!file)
+            return false;
+    }
+
+    if (file->bytesSent > file->filesize
+            || !tox_file_seek(core->tox, friendId, fileId, file->bytesSent, nullptr))
+    {
+        qWarning() << "resumeFileRecv: Can't seek, receiving" << file->filePath << "from the start";
+        file->bytesSent = 0;
+        file->file->resize(0);
+    }
+    file->file->seek(file->bytesSent);
+
+    setStatus(*file, ToxFile::TRANSMITTING);
+    ToxFile::Ptr snapshot = file->snapshot();
+    emit core->fileTransferAccepted(snapshot);
+    emit core->fileTransferBrokenUnbroken(snapshot, false);
+    tox_file_control(core->tox, friendId, fileId, TOX_FILE_CONTROL_RESUME, nullptr);
+    return true;
 }
 
 void CoreFile::onFileReceiveCallback(Tox*, uint32_t friendId, uint32_t fileId, uint32_t kind,
                                  uint64_t filesize, const uint8_t *fname, size_t fnameLen, void *_core)
 {
+    TraceSpan span{"CoreFile::onFileReceiveCallback"};
     Core* core = static_cast<Core*>(_core);
 
     if (kind == TOX_FILE_KIND_AVATAR)
@@ -305,13 +680,22 @@ void CoreFile::onFileReceiveCallback(Tox*, uint32_t friendId, uint32_t fileId, u
     file.fileKind = kind;
     file.resumeFileId.resize(TOX_FILE_ID_LENGTH);
     tox_file_get_file_id(core->tox, friendId, fileId, (uint8_t*)file.resumeFileId.data(), nullptr);
+    if (kind == TOX_FILE_KIND_DATA && resumeFileRecv(core, friendId, fileId, file.resumeFileId))
+        return;
     addFile(friendId, fileId, file);
-    if (kind != TOX_FILE_KIND_AVATAR)
-        emit core->fileReceiveRequested(file);
+    if (kind == TOX_FILE_KIND_AVATAR)
+    {
+        QByteArray& avatarData = findFile(friendId, fileId)->avatarData;
+        avatarData.reserve(static_cast<int>(qMin(filesize, maxAvatarReserve)));
+        MemoryStats::allocated(MemoryStats::AvatarBuffers, avatarData.capacity());
+    }
+    else
+        emit core->fileReceiveRequested(file.snapshot());
 }
 void CoreFile::onFileControlCallback(Tox*, uint32_t friendId, uint32_t fileId,
                                  TOX_FILE_CONTROL control, void *core)
 {
+    TraceSpan span{"CoreFile::onFileControlCallback"};
     ToxFile* file = findFile(friendId, fileId);
     if (!file)
     {
@@ -329,7 +713,7 @@ void CoreFile::onFileControlCallback(Tox*, uint32_t friendId, uint32_t fileId,
     else if (control == TOX_FILE_CONTROL_PAUSE)
     {
         qDebug() << "onFileControlCallback: Received pause for file "<<friendId<<":"<<fileId;
-        file->status = ToxFile::PAUSED;
+        setStatus(*file, ToxFile::PAUSED);
         emit static_cast<Core*>(core)->fileTransferRemotePausedUnpaused(*file, true);
     }
     else if (control == TOX_FILE_CONTROL_RESUME)
@@ -338,7 +722,7 @@ void CoreFile::onFileControlCallback(Tox*, uint32_t friendId, uint32_t fileId,
             qDebug() << "Avatar transfer"<<fileId<<"to friend"<<friendId<<"accepted";
         else
             qDebug() << "onFileControlCallback: Received resume for file "<<friendId<<":"<<fileId;
-        file->status = ToxFile::TRANSMITTING;
+        setStatus(*file, ToxFile::TRANSMITTING);
         emit static_cast<Core*>(core)->fileTransferRemotePausedUnpaused(*file, false);
     }
     else
@@ -347,9 +731,11 @@ void CoreFile::onFileControlCallback(Tox*, uint32_t friendId, uint32_t fileId,
     }
 }
 
-void CoreFile::onFileDataCallback(Tox *tox, uint32_t friendId, uint32_t fileId,
+void CoreFile::onFileDataCallback(Tox*, uint32_t friendId, uint32_t fileId,
                               uint64_t pos, size_t length, void* core)
 {
+    TraceSpan span{"CoreFile::onFileDataCallback"};
+    Trace::count("CoreFile sent chunk", length);
     //qDebug() << "File data req of "<<length<<" at "<<pos<<" for file "<<friendId<<':'<<fileId;
 
     ToxFile* file = findFile(friendId, fileId);
@@ -359,55 +745,137 @@ void CoreFile::onFileDataCallback(Tox *tox, uint32_t friendId, uint32_t fileId,
         return;
     }
 
+    FileScheduler::Priority priority = FileScheduler::BULK;
+    if (file->fileKind == TOX_FILE_KIND_AVATAR)
+        priority = FileScheduler::HIGH;
+    else if (file->filesize <= smallFileSize)
+        priority = FileScheduler::NORMAL;
+
+    scheduler.request({friendId, fileId, pos, length}, priority);
+    sendScheduledChunks(static_cast<Core*>(core));
+}
+
+/**
+@brief Sends the chunks toxcore asked for, as far as the scheduler lets us.
+
+Called for each chunk request, and on every Core iteration for those the rate limits held back.
+*/
+void CoreFile::sendScheduledChunks(Core* core)
+{
+    FileScheduler::Request request;
+    while (scheduler.next(request))
+        serveChunk(core, request.friendId, request.fileId, request.pos, request.length);
+}
+
+/**
+@brief Updates the rates of the transmitting data files and sends their progress to the GUI.
+
+Called on every Core iteration, the progress goes out every progressInterval, not per chunk.
+*/
+void CoreFile::publishProgress(Core* core)
+{
+    static qint64 lastPublish = 0;
+    if (!transmittingDataFiles)
+        return;
+
+    qint64 now = elapsedMs();
+    if (now - lastPublish < progressInterval)
+        return;
+    lastPublish = now;
+
+    for (ToxFile& file : fileMap)
+    {
+        if (file.status != ToxFile::TRANSMITTING || file.fileKind != TOX_FILE_KIND_DATA)
+            continue;
+
+        updateRate(file, now);
+        emit core->fileTransferInfo(file.snapshot());
+    }
+}
+
+/**
+@brief Reads a chunk toxcore asked for and sends it, or ends the transfer at EOF.
+*/
+void CoreFile::serveChunk(Core* core, uint32_t friendId, uint32_t fileId, uint64_t pos, size_t length)
+{
+    ToxFile* file = findFile(friendId, fileId);
+    if (!file)
+    {
+        qWarning("serveChunk: No such file in queue");
+        return;
+    }
+
     // If we reached EOF, ack and cleanup the transfer
     if (!length)
     {
-        //qDebug("onFileDataCallback: File sending completed");
+        //qDebug("serveChunk: File sending completed");
         if (file->fileKind != TOX_FILE_KIND_AVATAR)
         {
-            emit static_cast<Core*>(core)->fileTransferFinished(*file);
-            emit static_cast<Core*>(core)->fileUploadFinished(file->filePath);
+            finishHash(*file);
+            emit core->fileTransferFinished(file->snapshot());
+            emit core->fileUploadFinished(file->filePath);
         }
         removeFile(friendId, fileId);
         return;
     }
 
-    unique_ptr<uint8_t[]> data(new uint8_t[length]);
+    const uint8_t* data;
+    unique_ptr<uint8_t[]> readData;
     int64_t nread;
 
     if (file->fileKind == TOX_FILE_KIND_AVATAR)
     {
-        QByteArray chunk = file->avatarData.mid(pos, length);
-        nread = chunk.size();
-        memcpy(data.get(), chunk.data(), nread);
+        const int avatarSize = file->avatarData.size();
+        nread = pos < static_cast<uint64_t>(avatarSize) ? qMin<int64_t>(length, avatarSize - pos) : 0;
+        data = reinterpret_cast<const uint8_t*>(file->avatarData.constData()) + (nread ? pos : 0);
     }
     else
     {
-        file->file->seek(pos);
-        nread = file->file->read((char*)data.get(), length);
+        // what the prefetcher read ahead, else the disk, on this thread
+        // Not a mapping of the file, that would crash if the file got truncated while we send it
+        data = file->prefetcher ? file->prefetcher->chunk(pos, qMin<quint64>(length, file->filesize - pos)) : nullptr;
+        if (data)
+        {
+            nread = qMin<int64_t>(length, file->filesize - pos);
+        }
+        else
+        {
+            readData.reset(new uint8_t[length]);
+            file->file->seek(pos);
+            nread = file->file->read((char*)readData.get(), length);
+            data = readData.get();
+        }
+
         if (nread <= 0)
         {
-            qWarning("onFileDataCallback: Failed to read from file");
-            emit static_cast<Core*>(core)->fileTransferCancelled(*file);
-            tox_file_send_chunk(tox, friendId, fileId, pos, nullptr, 0, nullptr);
+            qWarning("serveChunk: Failed to read from file");
+            emit core->fileTransferCancelled(file->snapshot());
+            tox_file_send_chunk(core->tox, friendId, fileId, pos, nullptr, 0, nullptr);
             removeFile(friendId, fileId);
             return;
         }
-        file->bytesSent += length;
+        // the receiver may have sought to where it was before a resume
+        if (pos != file->bytesSent)
+        {
+            file->bytesSent = pos;
+            resetRate(*file);
+        }
+        file->bytesSent = pos + nread;
     }
 
-    if (!tox_file_send_chunk(tox, friendId, fileId, pos, data.get(), nread, nullptr))
+    if (!tox_file_send_chunk(core->tox, friendId, fileId, pos, data, nread, nullptr))
     {
-        qWarning("onFileDataCallback: Failed to send data chunk");
+        qWarning("serveChunk: Failed to send data chunk");
         return;
     }
-    if (file->fileKind != TOX_FILE_KIND_AVATAR)
-        emit static_cast<Core*>(core)->fileTransferInfo(*file);
+    hashChunk(*file, pos, data, nread);
 }
 
 void CoreFile::onFileRecvChunkCallback(Tox *tox, uint32_t friendId, uint32_t fileId, uint64_t position,
                                     const uint8_t *data, size_t length, void *_core)
 {
+    TraceSpan span{"CoreFile::onFileRecvChunkCallback"};
+    Trace::count("CoreFile received chunk", length);
     //qDebug() << QString("Received chunk for %1:%2 pos %3 size %4")
     //                    .arg(friendId).arg(fileId).arg(position).arg(length);
 
@@ -424,7 +892,7 @@ void CoreFile::onFileRecvChunkCallback(Tox *tox, uint32_t friendId, uint32_t fil
     {
         qWarning("onFileRecvChunkCallback: Received a chunk out-of-order, aborting transfer");
         if (file->fileKind != TOX_FILE_KIND_AVATAR)
-            emit core->fileTransferCancelled(*file);
+            emit core->fileTransferCancelled(file->snapshot());
         tox_file_control(tox, friendId, fileId, TOX_FILE_CONTROL_CANCEL, nullptr);
         removeFile(friendId, fileId);
         return;
@@ -434,18 +902,27 @@ void CoreFile::onFileRecvChunkCallback(Tox *tox, uint32_t friendId, uint32_t fil
     {
         if (file->fileKind == TOX_FILE_KIND_AVATAR)
         {
-            QPixmap pic;
-            pic.loadFromData(file->avatarData);
-            if (!pic.isNull())
+            // decoding and the encrypted save happen on a worker, Core carries on with the network
+            qDebug() << "Got"<<file->avatarData.size()<<"bytes of avatar data from" <<friendId;
+            QFutureWatcher<QImage>* watcher = new QFutureWatcher<QImage>(core);
+            QObject::connect(watcher, &QFutureWatcher<QImage>::finished, core, [core, watcher, friendId]()
             {
-                qDebug() << "Got"<<file->avatarData.size()<<"bytes of avatar data from" <<friendId;
-                core->profile.saveAvatar(file->avatarData, core->getFriendPublicKey(friendId));
-                emit core->friendAvatarChanged(friendId, pic);
-            }
+                const QImage image = watcher->result();
+                watcher->deleteLater();
+                if (!image.isNull())
+                    emit core->friendAvatarChanged(friendId, QPixmap::fromImage(image));
+            });
+            watcher->setFuture(core->profile.saveAvatarAsync(file->avatarData, core->getFriendPublicKey(friendId)));
+        }
+        else if (file->writer && !file->writer->finish())
+        {
+            qWarning("onFileRecvChunkCallback: Failed to write the end of the file");
+            emit core->fileTransferCancelled(file->snapshot());
         }
         else
         {
-            emit core->fileTransferFinished(*file);
+            finishHash(*file);
+            emit core->fileTransferFinished(file->snapshot());
             emit core->fileDownloadFinished(file->filePath);
         }
         removeFile(friendId, fileId);
@@ -453,29 +930,60 @@ void CoreFile::onFileRecvChunkCallback(Tox *tox, uint32_t friendId, uint32_t fil
     }
 
     if (file->fileKind == TOX_FILE_KIND_AVATAR)
+    {
+        const int capacity = file->avatarData.capacity();
         file->avatarData.append((char*)data, length);
+        MemoryStats::resized(MemoryStats::AvatarBuffers, file->avatarData.capacity() - capacity);
+    }
+    else if (file->writer)
+    {
+        if (!file->writer->write(data, length))
+        {
+            qWarning("onFileRecvChunkCallback: Failed to write to file, aborting transfer");
+            emit core->fileTransferCancelled(file->snapshot());
+            tox_file_control(tox, friendId, fileId, TOX_FILE_CONTROL_CANCEL, nullptr);
+            removeFile(friendId, fileId);
+            return;
+        }
+    }
     else
+    {
         file->file->write((char*)data,length);
+    }
+    hashChunk(*file, position, data, length);
     file->bytesSent += length;
-
-    if (file->fileKind != TOX_FILE_KIND_AVATAR)
-        emit static_cast<Core*>(core)->fileTransferInfo(*file);
 }
 
 void CoreFile::onConnectionStatusChanged(Core* core, uint32_t friendId, bool online)
 {
-    /// TODO: Actually resume broken file transfers
-    /// We need to:
-    /// - Start a new file transfer with the same 32byte file ID with toxcore
-    /// - Seek to the correct position again
-    /// - Update the fileNum in our ToxFile
-    /// - Update the users of our signals to check the 32byte tox file ID, not the uint32_t file_num (fileId)
-    ToxFile::FileStatus status = online ? ToxFile::TRANSMITTING : ToxFile::BROKEN;
-    for (uint64_t key : fileMap.keys())
+    if (online)
     {
-        if (key>>32 != friendId)
+        resumeFileSends(core, friendId);
+        return;
+    }
+
+    for (int i = 0; i < avatarQueue.size(); ++i)
+    {
+        if (avatarQueue[i].friendId == friendId)
+        {
+            avatarQueue.removeAt(i);
+            break;
+        }
+    }
+
+    // toxcore forgot about the friend's transfers, we keep the data ones to resume them
+    for (uint32_t fileId : friendFileIds(friendId))
+    {
+        ToxFile& file = *findFile(friendId, fileId);
+        if (file.fileKind == TOX_FILE_KIND_AVATAR)
+        {
+            removeFile(friendId, file.fileNum);
             continue;
-        fileMap[key].status = status;
-        emit core->fileTransferBrokenUnbroken(fileMap[key], !online);
+        }
+
+        if (file.writer)
+            file.writer->finish();
+        setStatus(file, ToxFile::BROKEN);
+        emit core->fileTransferBrokenUnbroken(file.snapshot(), true);
     }
 }
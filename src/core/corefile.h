@@ -29,14 +29,16 @@
 #include "corestructs.h"
 
 #include <QString>
-#include <QMutex>
 #include <QHash>
+#include <QList>
 
 struct Tox;
 class Core;
+class FileScheduler;
 
 /// Implements Core's file transfer callbacks
 /// Avoids polluting core.h with private internal callbacks
+/// Everything here runs on the Core thread, Core moves its calls there first, so nothing is locked
 class CoreFile
 {
     friend class Core;
@@ -46,8 +48,12 @@ private:
 
     // Internal file sending APIs, used by Core. Public API in core.h
 private:
-    static void sendFile(Core *core, uint32_t friendId, QString Filename, QString FilePath, long long filesize);
-    static void sendAvatarFile(Core* core, uint32_t friendId, const QByteArray& data);
+    /// A resumeFileId from a transfer that didn't complete tells the receiver to carry on with it
+    static void sendFile(Core *core, uint32_t friendId, QString Filename, QString FilePath, long long filesize,
+                         const QByteArray& resumeFileId = QByteArray());
+    static void sendAvatarFile(Core* core, uint32_t friendId, const QByteArray& data,
+                               const QByteArray& hash = QByteArray());
+    static void sendQueuedAvatars(Core* core);
     static void pauseResumeFileSend(Core* core, uint32_t friendId, uint32_t fileId);
     static void pauseResumeFileRecv(Core* core, uint32_t friendId, uint32_t fileId);
     static void cancelFileSend(Core* core, uint32_t friendId, uint32_t fileId);
@@ -57,6 +63,17 @@ private:
     static ToxFile *findFile(uint32_t friendId, uint32_t fileId);
     static void addFile(uint32_t friendId, uint32_t fileId, const ToxFile& file);
     static void removeFile(uint32_t friendId, uint32_t fileId);
+    /// Toxcore gives a transfer a new fileId when it's resumed, we keep our ToxFile
+    static ToxFile* rekeyFile(uint32_t friendId, uint32_t oldFileId, uint32_t newFileId);
+    static void setStatus(ToxFile& file, ToxFile::FileStatus status);
+    static void countTransmitting(const ToxFile& file, int change);
+    static QList<uint32_t> friendFileIds(uint32_t friendId);
+    static void updateRateLimits();
+    static void sendScheduledChunks(Core* core);
+    static void publishProgress(Core* core);
+    static void serveChunk(Core* core, uint32_t friendId, uint32_t fileId, uint64_t pos, size_t length);
+    static void resumeFileSends(Core* core, uint32_t friendId);
+    static bool resumeFileRecv(Core* core, uint32_t friendId, uint32_t fileId, const QByteArray& resumeFileId);
     /// Returns the maximum amount of time in ms that Core should wait between two
     /// tox_iterate calls to get good file transfer performances
     static unsigned corefileIterationInterval();
@@ -73,8 +90,19 @@ private:
     static void onConnectionStatusChanged(Core* core, uint32_t friendId, bool online);
 
 private:
-    static QMutex fileSendMutex;
     static QHash<uint64_t, ToxFile> fileMap;
+    static QMultiHash<uint32_t, uint32_t> friendFiles; ///< The fileIds in the fileMap of each friend
+    static int transmittingDataFiles; ///< Files of the fileMap currently TRANSMITTING, by kind
+    static int transmittingAvatarFiles;
+    static FileScheduler scheduler; ///< Holds the chunk requests we didn't serve yet
+    struct QueuedAvatar
+    {
+        uint32_t friendId;
+        QByteArray data;
+        QByteArray hash;
+    };
+    static int outgoingAvatarFiles; ///< Avatars of the fileMap we offered or are sending
+    static QList<QueuedAvatar> avatarQueue; ///< Avatars waiting for fewer outgoing ones, at most one per friend
 };
 
 #endif // COREFILE_H
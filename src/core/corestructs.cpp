@@ -1,6 +1,7 @@
 #include "src/core/corestructs.h"
 #include "src/core/core.h"
 #include <tox/tox.h>
+#include <QDebug>
 #include <QFile>
 #include <QRegularExpression>
 
@@ -13,9 +14,38 @@ ToxFile::ToxFile(uint32_t FileNum, uint32_t FriendId, QByteArray FileName, QStri
 {
 }
 
+/**
+@brief Copies the transfer state for the signals.
+
+One copy is made per emission and shared by every receiver, instead of each queued
+slot getting its own ToxFile. The file handles, the stream helpers and the received
+avatar bytes stay with Core, so nothing keeps them alive from the GUI.
+*/
+ToxFile::Ptr ToxFile::snapshot() const
+{
+    std::shared_ptr<ToxFile> copy = std::make_shared<ToxFile>(*this);
+    copy->file.reset();
+    copy->prefetcher.reset();
+    copy->writer.reset();
+    copy->hashState.reset();
+    copy->avatarData.clear();
+    return copy;
+}
+
+/**
+@brief Tells if both are the same transfer.
+
+The fileNum of a transfer changes when it's resumed, the 32 byte file ID doesn't.
+*/
 bool ToxFile::operator==(const ToxFile &other) const
 {
-    return (fileNum == other.fileNum) && (friendId == other.friendId) && (direction == other.direction);
+    if (friendId != other.friendId || direction != other.direction)
+        return false;
+
+    if (!resumeFileId.isEmpty() && !other.resumeFileId.isEmpty())
+        return resumeFileId == other.resumeFileId;
+
+    return fileNum == other.fileNum;
 }
 
 bool ToxFile::operator!=(const ToxFile &other) const
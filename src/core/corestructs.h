@@ -8,6 +8,9 @@
 #include <memory>
 class QFile;
 class QTimer;
+class FilePrefetcher;
+class FileWriter;
+struct crypto_generichash_blake2b_state;
 
 enum class Status : int {Online = 0, Away, Busy, Offline};
 
@@ -19,6 +22,23 @@ struct DhtServer
     quint16 port;
 };
 
+/// How well bootstrapping from a DHT node worked for us
+struct DhtNodeScore
+{
+    quint32 successes = 0; ///< Bootstraps that got us online
+    quint32 failures = 0;
+    quint32 connectTime = 0; ///< In ms, smoothed over the successes
+};
+
+/// What Core knows about a friend when it loads the friend list
+struct FriendSnapshot
+{
+    uint32_t friendId;
+    QString userId;
+    QString name;
+    QString statusMessage;
+};
+
 struct ToxFile
 {
     enum FileStatus
@@ -35,6 +55,9 @@ struct ToxFile
         RECEIVING
     };
 
+    /// What Core hands out in its signals, every receiver shares the same immutable copy
+    using Ptr = std::shared_ptr<const ToxFile>;
+
     ToxFile()=default;
     ToxFile(uint32_t FileNum, uint32_t FriendId, QByteArray FileName, QString FilePath, FileDirection Direction);
     ~ToxFile(){}
@@ -44,6 +67,8 @@ struct ToxFile
 
     void setFilePath(QString path);
     bool open(bool write);
+    /// A copy of the transfer state for the GUI, without the handles and buffers only Core uses
+    Ptr snapshot() const;
 
     uint8_t fileKind; ///< Data file (default) or avatar
     uint32_t fileNum;
@@ -57,6 +82,16 @@ struct ToxFile
     FileDirection direction;
     QByteArray avatarData;
     QByteArray resumeFileId;
+    std::shared_ptr<FilePrefetcher> prefetcher; ///< Only for the data files we send
+    std::shared_ptr<FileWriter> writer; ///< Only for the data files we receive
+    /// Smoothed transfer rate, CoreFile updates it each time it sends the progress to the GUI
+    double bytesPerSec = 0;
+    quint64 rateBytes = 0; ///< bytesSent when the rate was last updated
+    qint64 rateTime = 0; ///< When the rate was last updated, in ms
+    /// BLAKE2b of the data files, computed as they stream through
+    std::shared_ptr<crypto_generichash_blake2b_state> hashState;
+    quint64 hashedBytes = 0;
+    QByteArray hash; ///< Once the whole file went through, empty if it couldn't be hashed in order
 };
 
 #endif // CORESTRUCTS_H
@@ -0,0 +1,172 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "fileprefetcher.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QMutexLocker>
+#include <QtConcurrent/QtConcurrentRun>
+
+namespace
+{
+/// Big enough that a slow disk seeks rarely, small enough to stay cheap with many transfers
+const quint64 blockSize = 1024 * 1024;
+const int blockCount = 4;
+}
+
+FilePrefetcher::FilePrefetcher(const QString& path, quint64 size)
+    : path{path}
+    , size{size}
+    , file{nullptr}
+    , blocks(blockCount)
+    , consumed{0}
+    , nextRead{0}
+    , generation{0}
+    , busy{false}
+    , closed{false}
+{
+}
+
+FilePrefetcher::~FilePrefetcher()
+{
+    delete file;
+}
+
+/**
+@brief Looks the chunk at pos up in the blocks read so far.
+
+Asking for a chunk also tells the worker where the transfer is, it frees the blocks
+behind and reads the next ones. A chunk outside of what we read ahead, like after a
+resume, restarts the reading from there.
+*/
+const uint8_t* FilePrefetcher::chunk(quint64 pos, size_t length)
+{
+    QMutexLocker locker{&lock};
+    if (closed)
+        return nullptr;
+
+    // toxcore asks for the chunks in order, anything else is a jump of the transfer
+    const quint64 start = pos / blockSize * blockSize;
+    if (pos < consumed || start > nextRead)
+    {
+        ++generation;
+        nextRead = start;
+        for (Block& block : blocks)
+        {
+            block.ready = false;
+            block.data.clear();
+        }
+    }
+    consumed = pos;
+
+    const uint8_t* data = nullptr;
+    for (const Block& block : blocks)
+    {
+        // a chunk across two blocks is rare, the caller gets it another way
+        if (block.ready && pos >= block.offset && pos + length <= block.offset + block.data.size())
+            data = reinterpret_cast<const uint8_t*>(block.data.constData()) + (pos - block.offset);
+    }
+
+    startReading();
+    return data;
+}
+
+void FilePrefetcher::close()
+{
+    QMutexLocker locker{&lock};
+    closed = true;
+    for (Block& block : blocks)
+        block.data.clear();
+}
+
+/**
+@brief Starts the worker if there's a block to read, the caller holds the lock.
+*/
+void FilePrefetcher::startReading()
+{
+    if (busy || closed || nextRead >= size)
+        return;
+
+    // the worker keeps us alive, the transfer might be gone by the time it's done
+    busy = true;
+    std::shared_ptr<FilePrefetcher> self = shared_from_this();
+    QtConcurrent::run([self](){self->fill();});
+}
+
+void FilePrefetcher::fill()
+{
+    if (!file)
+    {
+        file = new QFile{path};
+        if (!file->open(QIODevice::ReadOnly))
+            qWarning() << "Can't read" << path << "ahead:" << file->errorString();
+    }
+
+    forever
+    {
+        quint64 offset;
+        quint32 readGeneration;
+        int slot = -1;
+        {
+            QMutexLocker locker{&lock};
+            if (closed || !file->isOpen() || nextRead >= size)
+            {
+                busy = false;
+                return;
+            }
+
+            // a block is free once the transfer is past it
+            for (int i = 0; i < blocks.size() && slot < 0; ++i)
+                if (!blocks[i].ready || blocks[i].offset + blocks[i].data.size() <= consumed)
+                    slot = i;
+            if (slot < 0)
+            {
+                busy = false;
+                return;
+            }
+
+            offset = nextRead;
+            readGeneration = generation;
+            blocks[slot].ready = false;
+            blocks[slot].offset = offset;
+            nextRead += blockSize;
+        }
+
+        QByteArray data;
+        if (file->seek(static_cast<qint64>(offset)))
+            data = file->read(static_cast<qint64>(qMin(blockSize, size - offset)));
+
+        QMutexLocker locker{&lock};
+        if (readGeneration != generation || closed)
+            continue;
+
+        if (data.isEmpty())
+        {
+            // the chunks will be read without us, that path reports the error
+            qWarning() << "Failed to read" << path << "ahead at" << offset;
+            closed = true;
+            busy = false;
+            return;
+        }
+
+        blocks[slot].data = data;
+        blocks[slot].ready = true;
+    }
+}
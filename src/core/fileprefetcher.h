@@ -0,0 +1,75 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FILEPREFETCHER_H
+#define FILEPREFETCHER_H
+
+#include <cstdint>
+#include <memory>
+
+#include <QByteArray>
+#include <QMutex>
+#include <QString>
+#include <QVector>
+
+class QFile;
+
+/**
+@brief Reads an outgoing file ahead of its transfer on a worker, in big blocks.
+
+toxcore asks for a small chunk at a time from the Core thread, reading each one from
+disk there stalls tox_iterate on slow disks and network shares. The worker keeps the
+next few blocks in memory, so chunks usually only need to be looked up.
+*/
+class FilePrefetcher : public std::enable_shared_from_this<FilePrefetcher>
+{
+public:
+    FilePrefetcher(const QString& path, quint64 size);
+    ~FilePrefetcher();
+
+    /// Returns the chunk if it's already read, nullptr otherwise. It stays valid until the next call
+    const uint8_t* chunk(quint64 pos, size_t length);
+    /// Stops reading ahead, we don't wait for a block being read
+    void close();
+
+private:
+    struct Block
+    {
+        quint64 offset = 0;
+        QByteArray data;
+        bool ready = false;
+    };
+
+    void startReading();
+    void fill();
+
+private:
+    const QString path;
+    const quint64 size;
+    QFile* file; ///< Only used by the worker
+    QMutex lock;
+    QVector<Block> blocks;
+    quint64 consumed;   ///< Position of the last chunk asked for
+    quint64 nextRead;   ///< Offset of the next block to read
+    quint32 generation; ///< Bumped when the transfer jumps, blocks being read for before are thrown away
+    bool busy;
+    bool closed;
+};
+
+#endif // FILEPREFETCHER_H
@@ -0,0 +1,136 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "filescheduler.h"
+
+#include <QtGlobal>
+
+namespace
+{
+/// A bucket holds this much of its rate, so a limit doesn't turn into bursts
+const double burstTime = 0.1;
+/// Toxcore's chunks are smaller, a full bucket always has room for one
+const double minBurst = 2048;
+}
+
+FileScheduler::FileScheduler()
+    : totalRate{0}
+    , friendRate{0}
+{
+    clock.start();
+}
+
+void FileScheduler::setRateLimits(quint32 total, quint32 perFriend)
+{
+    totalRate = total;
+    friendRate = perFriend;
+}
+
+void FileScheduler::request(const Request& request, Priority priority)
+{
+    const uint64_t k = key(request.friendId, request.fileId);
+    Transfer& transfer = transfers[k];
+    if (transfer.requests.isEmpty())
+    {
+        transfer.priority = priority;
+        rounds[priority].append(k);
+    }
+
+    transfer.requests.enqueue(request);
+}
+
+/**
+@brief Picks the next request, from the first transfer of the highest priority that can send.
+
+A transfer goes to the back of its round once served, so transfers of the same priority
+share the bandwidth. A friend over its limit is skipped, the total limit stops everything.
+*/
+bool FileScheduler::next(Request& request)
+{
+    const qint64 now = clock.elapsed();
+    if (totalRate)
+        refill(totalBucket, totalRate, now);
+
+    for (QList<uint64_t>& round : rounds)
+    {
+        for (int tried = 0; tried < round.size(); ++tried)
+        {
+            const uint64_t k = round.takeFirst();
+            Transfer& transfer = transfers[k];
+            const Request& head = transfer.requests.head();
+
+            if (totalRate && head.length > totalBucket.tokens)
+            {
+                round.prepend(k);
+                return false;
+            }
+
+            Bucket* bucket = nullptr;
+            if (friendRate)
+            {
+                bucket = &friendBuckets[head.friendId];
+                refill(*bucket, friendRate, now);
+                if (head.length > bucket->tokens)
+                {
+                    round.append(k);
+                    continue;
+                }
+                bucket->tokens -= head.length;
+            }
+            if (totalRate)
+                totalBucket.tokens -= head.length;
+
+            request = transfer.requests.dequeue();
+            if (transfer.requests.isEmpty())
+                transfers.remove(k);
+            else
+                round.append(k);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void FileScheduler::remove(uint32_t friendId, uint32_t fileId)
+{
+    const uint64_t k = key(friendId, fileId);
+    if (!transfers.contains(k))
+        return;
+
+    rounds[transfers[k].priority].removeAll(k);
+    transfers.remove(k);
+}
+
+bool FileScheduler::isEmpty() const
+{
+    return transfers.isEmpty();
+}
+
+uint64_t FileScheduler::key(uint32_t friendId, uint32_t fileId)
+{
+    return (static_cast<uint64_t>(friendId) << 32) + fileId;
+}
+
+void FileScheduler::refill(Bucket& bucket, quint32 rate, qint64 now)
+{
+    const double burst = qMax(minBurst, rate * burstTime);
+    bucket.tokens = qMin(burst, bucket.tokens + rate * (now - bucket.lastRefill) / 1000.0);
+    bucket.lastRefill = now;
+}
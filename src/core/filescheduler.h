@@ -0,0 +1,94 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FILESCHEDULER_H
+#define FILESCHEDULER_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+#include <QQueue>
+
+/**
+@brief Decides which of the chunks toxcore asked for we send next.
+
+Toxcore asks for chunks in whatever order suits it. We queue its requests per transfer
+and serve the transfers round robin, the higher priorities first, within the upload
+rate limits. A transfer's requests are always served in order, as toxcore needs.
+*/
+class FileScheduler
+{
+public:
+    enum Priority
+    {
+        HIGH,   ///< Avatars
+        NORMAL, ///< Small files, that a bulk transfer shouldn't make wait
+        BULK,
+        PRIORITY_COUNT
+    };
+
+    struct Request
+    {
+        uint32_t friendId;
+        uint32_t fileId;
+        uint64_t pos;
+        size_t length;
+    };
+
+    FileScheduler();
+
+    /// In bytes per second, 0 for no limit
+    void setRateLimits(quint32 total, quint32 perFriend);
+    void request(const Request& request, Priority priority);
+    /// Gives the next request we may send now, returns false if there's none
+    bool next(Request& request);
+    /// Forgets the queued requests of a transfer
+    void remove(uint32_t friendId, uint32_t fileId);
+    bool isEmpty() const;
+
+private:
+    struct Bucket
+    {
+        double tokens = 0;
+        qint64 lastRefill = 0;
+    };
+
+    struct Transfer
+    {
+        Priority priority;
+        QQueue<Request> requests;
+    };
+
+    static uint64_t key(uint32_t friendId, uint32_t fileId);
+    void refill(Bucket& bucket, quint32 rate, qint64 now);
+
+private:
+    QHash<uint64_t, Transfer> transfers;
+    QList<uint64_t> rounds[PRIORITY_COUNT]; ///< Transfers with queued requests, in the order we serve them
+    QHash<uint32_t, Bucket> friendBuckets;
+    Bucket totalBucket;
+    quint32 totalRate;
+    quint32 friendRate;
+    QElapsedTimer clock;
+};
+
+#endif // FILESCHEDULER_H
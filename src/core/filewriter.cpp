@@ -0,0 +1,125 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "filewriter.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QMutexLocker>
+#include <QtConcurrent/QtConcurrentRun>
+
+namespace
+{
+const int blockSize = 1024 * 1024;
+/// If the disk is slower than the network, the Core thread waits rather than filling the memory
+const int maxPendingSize = 8 * blockSize;
+}
+
+FileWriter::FileWriter(std::shared_ptr<QFile> file)
+    : file{file}
+    , pendingSize{0}
+    , busy{false}
+    , failed{false}
+{
+}
+
+bool FileWriter::write(const uint8_t* data, size_t length)
+{
+    QMutexLocker locker{&lock};
+    if (failed)
+        return false;
+
+    if (current.isEmpty())
+        current.reserve(blockSize);
+    current.append(reinterpret_cast<const char*>(data), static_cast<int>(length));
+    if (current.size() < blockSize)
+        return true;
+
+    while (pendingSize >= maxPendingSize && !failed)
+        drained.wait(&lock);
+
+    pendingSize += current.size();
+    pending.append(current);
+    current = QByteArray();
+    startWriting();
+    return !failed;
+}
+
+bool FileWriter::finish()
+{
+    QMutexLocker locker{&lock};
+    if (!current.isEmpty())
+    {
+        pendingSize += current.size();
+        pending.append(current);
+        current = QByteArray();
+        startWriting();
+    }
+
+    while (busy)
+        drained.wait(&lock);
+
+    return !failed;
+}
+
+/**
+@brief Starts the worker if it isn't running, the caller holds the lock.
+*/
+void FileWriter::startWriting()
+{
+    if (busy || failed)
+        return;
+
+    // the worker keeps us alive, the transfer might be gone by the time it's done
+    busy = true;
+    std::shared_ptr<FileWriter> self = shared_from_this();
+    QtConcurrent::run([self](){self->drain();});
+}
+
+void FileWriter::drain()
+{
+    forever
+    {
+        QByteArray block;
+        {
+            QMutexLocker locker{&lock};
+            if (pending.isEmpty() || failed)
+            {
+                busy = false;
+                drained.wakeAll();
+                return;
+            }
+            block = pending.first();
+        }
+
+        bool written = file->write(block) == block.size();
+
+        QMutexLocker locker{&lock};
+        pending.removeFirst();
+        pendingSize -= block.size();
+        if (!written)
+        {
+            qWarning() << "Failed to write" << file->fileName() << ":" << file->errorString();
+            failed = true;
+            pending.clear();
+            pendingSize = 0;
+        }
+        drained.wakeAll();
+    }
+}
@@ -0,0 +1,65 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FILEWRITER_H
+#define FILEWRITER_H
+
+#include <cstdint>
+#include <memory>
+
+#include <QByteArray>
+#include <QList>
+#include <QMutex>
+#include <QWaitCondition>
+
+class QFile;
+
+/**
+@brief Writes an incoming file on a worker, in big blocks.
+
+toxcore hands us a small chunk at a time on the Core thread, writing each one from
+there stalls tox_iterate on slow disks. The chunks are gathered in memory and the
+worker writes them out a block at a time.
+*/
+class FileWriter : public std::enable_shared_from_this<FileWriter>
+{
+public:
+    explicit FileWriter(std::shared_ptr<QFile> file);
+
+    /// Returns false once a write failed, the transfer can't complete then
+    bool write(const uint8_t* data, size_t length);
+    /// Waits for everything to be written, the file can be closed or used afterwards
+    bool finish();
+
+private:
+    void startWriting();
+    void drain();
+
+private:
+    std::shared_ptr<QFile> file; ///< Only used by the worker until finish() returns
+    QMutex lock;
+    QWaitCondition drained;
+    QByteArray current; ///< Filled by the Core thread
+    QList<QByteArray> pending; ///< Full blocks for the worker
+    int pendingSize;
+    bool busy;
+    bool failed;
+};
+
+#endif // FILEWRITER_H
@@ -3,9 +3,11 @@
 
 #include <vector>
 #include <algorithm>
+#include <unordered_map>
 
 /// More or less a hashmap, indexed by the noexcept move-only value type's operator int
 /// Really nice to store our ToxCall objects.
+/// The values live in a vector, with a side index of their positions so lookups are O(1).
 template <typename T>
 class IndexedList
 {
@@ -14,14 +16,32 @@ public:
 
     // Qt
     inline bool isEmpty() { return v.empty(); }
-    bool contains(int i) { return std::find_if(begin(), end(), [i](T& t){return (int)t == i;}) != end(); }
-    void remove(int i) { v.erase(std::remove_if(begin(), end(), [i](T& t){return (int)t == i;}), end()); }
+    bool contains(int i) { return index.count(i) != 0; }
+    void remove(int i)
+    {
+        if (!contains(i))
+            return;
+
+        v.erase(std::remove_if(begin(), end(), [i](T& t){return (int)t == i;}), end());
+        reindex(0);
+    }
     T& operator[](int i)
     {
-        iterator it = std::find_if(begin(), end(), [i](T& t){return (int)t == i;});
-        if (it == end())
-            it = insert({});
-        return *it;
+        T* value = find(i);
+        if (!value)
+            value = &*insert({});
+        return *value;
+    }
+    /// Returns nullptr if there's no value for i. Only valid until the list is modified
+    T* find(int i)
+    {
+        auto pos = index.find(i);
+        return pos == index.end() ? nullptr : &v[pos->second];
+    }
+    const T* find(int i) const
+    {
+        auto pos = index.find(i);
+        return pos == index.end() ? nullptr : &v[pos->second];
     }
 
     // STL
@@ -34,12 +54,46 @@ public:
     inline iterator end() { return v.end(); }
     inline const_iterator end() const { return v.end(); }
     inline const_iterator cend() const { return v.cend(); }
-    inline iterator erase(iterator pos) { return v.erase(pos); }
-    inline iterator erase(iterator first, iterator last) { return v.erase(first, last); }
-    inline iterator insert(T&& value) { v.push_back(std::move(value)); return --v.end(); }
+    iterator erase(iterator pos)
+    {
+        size_t first = pos - begin();
+        iterator next = v.erase(pos);
+        reindex(first);
+        return next;
+    }
+    iterator erase(iterator first, iterator last)
+    {
+        size_t from = first - begin();
+        iterator next = v.erase(first, last);
+        reindex(from);
+        return next;
+    }
+    iterator insert(T&& value)
+    {
+        v.push_back(std::move(value));
+        index[static_cast<int>(v.back())] = v.size() - 1;
+        return --v.end();
+    }
+
+private:
+    /// The values from the given position on have moved, erasing is rare enough to redo them all
+    void reindex(size_t from)
+    {
+        for (auto it = index.begin(); it != index.end();)
+        {
+            if (it->second >= from)
+                it = index.erase(it);
+            else
+                ++it;
+        }
+
+        for (size_t pos = from; pos < v.size(); ++pos)
+            index[static_cast<int>(v[pos])] = pos;
+    }
 
 private:
     std::vector<T> v;
+    std::unordered_map<int, size_t> index;
 };
 
 #endif // INDEXEDLIST_H
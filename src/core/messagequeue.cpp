@@ -0,0 +1,214 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "messagequeue.h"
+
+#include <QtGlobal>
+
+namespace
+{
+/// Toxcore's send queue usually needs a few iterations to make room
+const qint64 minBackoff = 50;
+const qint64 maxBackoff = 2000;
+}
+
+MessageQueue::MessageQueue()
+{
+    clock.start();
+}
+
+void MessageQueue::push(const Message& message)
+{
+    queues[message.friendId].pending.append(message);
+}
+
+/**
+@brief Picks the first message of a friend that isn't offline or backing off.
+*/
+bool MessageQueue::next(Message& message)
+{
+    const qint64 now = clock.elapsed();
+    for (const Queue& queue : queues)
+    {
+        if (queue.pending.isEmpty() || queue.offline || queue.retryAt > now)
+            continue;
+
+        message = queue.pending.first();
+        return true;
+    }
+
+    return false;
+}
+
+void MessageQueue::sent(uint32_t friendId, uint32_t receipt)
+{
+    Queue& queue = queues[friendId];
+    if (queue.pending.isEmpty())
+        return;
+
+    queue.inFlight.append(qMakePair(receipt, queue.pending.takeFirst()));
+    queue.backoff = 0;
+    queue.delays = 0;
+}
+
+bool MessageQueue::sent(uint32_t friendId)
+{
+    auto it = queues.find(friendId);
+    if (it == queues.end() || it->pending.isEmpty())
+        return true;
+
+    const int id = it->pending.takeFirst().id;
+    it->backoff = 0;
+    it->delays = 0;
+    if (!it->pending.isEmpty())
+        return it->pending.first().id != id;
+
+    if (it->inFlight.isEmpty())
+        queues.erase(it);
+    return true;
+}
+
+void MessageQueue::drop(uint32_t friendId)
+{
+    auto it = queues.find(friendId);
+    if (it == queues.end())
+        return;
+
+    if (!it->pending.isEmpty())
+        it->pending.removeFirst();
+    if (it->pending.isEmpty() && it->inFlight.isEmpty())
+        queues.erase(it);
+}
+
+int MessageQueue::dropPieces(uint32_t friendId)
+{
+    auto it = queues.find(friendId);
+    if (it == queues.end() || it->pending.isEmpty())
+        return 0;
+
+    const int id = it->pending.first().id;
+    int dropped = 0;
+    while (!it->pending.isEmpty() && it->pending.first().id == id)
+    {
+        it->pending.removeFirst();
+        ++dropped;
+    }
+
+    it->backoff = 0;
+    it->delays = 0;
+    if (it->pending.isEmpty() && it->inFlight.isEmpty())
+        queues.erase(it);
+    return dropped;
+}
+
+int MessageQueue::delay(uint32_t friendId)
+{
+    Queue& queue = queues[friendId];
+    queue.backoff = queue.backoff ? qMin(queue.backoff * 2, maxBackoff) : minBackoff;
+    queue.retryAt = clock.elapsed() + queue.backoff;
+    return ++queue.delays;
+}
+
+int MessageQueue::receive(uint32_t friendId, uint32_t receipt)
+{
+    auto it = queues.find(friendId);
+    if (it == queues.end())
+        return 0;
+
+    int id = 0;
+    for (int i = 0; i < it->inFlight.size(); ++i)
+    {
+        if (it->inFlight[i].first == receipt)
+        {
+            id = it->inFlight.takeAt(i).second.id;
+            break;
+        }
+    }
+
+    if (it->pending.isEmpty() && it->inFlight.isEmpty())
+        queues.erase(it);
+    return id;
+}
+
+void MessageQueue::setOffline(uint32_t friendId, bool resend)
+{
+    auto it = queues.find(friendId);
+    if (it == queues.end())
+        return;
+
+    if (!resend)
+    {
+        queues.erase(it);
+        return;
+    }
+
+    for (int i = it->inFlight.size() - 1; i >= 0; --i)
+        it->pending.prepend(it->inFlight[i].second);
+    it->inFlight.clear();
+    it->offline = true;
+}
+
+void MessageQueue::setOnline(uint32_t friendId)
+{
+    auto it = queues.find(friendId);
+    if (it == queues.end())
+        return;
+
+    it->offline = false;
+    it->backoff = 0;
+    it->delays = 0;
+    it->retryAt = 0;
+}
+
+void MessageQueue::remove(uint32_t friendId)
+{
+    queues.remove(friendId);
+}
+
+qint64 MessageQueue::msecsToNext() const
+{
+    const qint64 now = clock.elapsed();
+    qint64 wait = -1;
+    for (const Queue& queue : queues)
+    {
+        if (queue.pending.isEmpty() || queue.offline)
+            continue;
+
+        const qint64 due = qMax<qint64>(0, queue.retryAt - now);
+        if (wait < 0 || due < wait)
+            wait = due;
+    }
+
+    return wait;
+}
+
+int MessageQueue::pendingCount(uint32_t friendId) const
+{
+    auto it = queues.constFind(friendId);
+    return it == queues.constEnd() ? 0 : it->pending.size();
+}
+
+int MessageQueue::pendingCount() const
+{
+    int count = 0;
+    for (const Queue& queue : queues)
+        count += queue.pending.size();
+
+    return count;
+}
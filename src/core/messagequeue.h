@@ -0,0 +1,100 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MESSAGEQUEUE_H
+#define MESSAGEQUEUE_H
+
+#include <cstdint>
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+#include <QString>
+
+/**
+@brief Holds the messages we send to friends until they confirm them.
+
+Messages go out in order, per friend. When toxcore's send queue is full for a friend,
+that friend waits with a growing backoff and the others carry on. A message stays
+in flight until its read receipt comes back, if the friend goes offline before that
+it goes back in front of the queue to be sent again once the friend is back.
+
+Group messages have no receipts, their queues are keyed by group number instead and
+a message is done once toxcore took it.
+*/
+class MessageQueue
+{
+public:
+    struct Message
+    {
+        uint32_t friendId;
+        int id;     ///< Ours, the GUI knows the message by it, never 0
+        QString text;
+        bool isAction;
+    };
+
+    MessageQueue();
+
+    void push(const Message& message);
+    /// Gives the next message that may be sent now, returns false if there's none
+    bool next(Message& message);
+    /// Toxcore took the next message of the friend, under this receipt
+    void sent(uint32_t friendId, uint32_t receipt);
+    /// Toxcore took the next message, no receipt will confirm it
+    /// Returns false if more pieces of the same message are pending
+    bool sent(uint32_t friendId);
+    /// Drops the next message of the friend, toxcore will never take it
+    void drop(uint32_t friendId);
+    /// Drops the next message and the following ones with the same id, the pieces of a split message
+    /// Returns how many were dropped
+    int dropPieces(uint32_t friendId);
+    /// Toxcore's send queue for the friend is full, try again later
+    /// Returns how many times in a row the next message was delayed
+    int delay(uint32_t friendId);
+    /// Returns the id of the message the receipt confirms, 0 if it's not ours
+    int receive(uint32_t friendId, uint32_t receipt);
+
+    /// Toxcore forgets what it didn't deliver, if resend we'll send it again once the friend is back
+    void setOffline(uint32_t friendId, bool resend);
+    void setOnline(uint32_t friendId);
+    void remove(uint32_t friendId);
+
+    /// In ms, when next might give a message, -1 if we're waiting on nothing
+    qint64 msecsToNext() const;
+    /// The messages of the friend that weren't sent yet
+    int pendingCount(uint32_t friendId) const;
+    /// Over all the friends
+    int pendingCount() const;
+
+private:
+    struct Queue
+    {
+        QList<Message> pending;
+        QList<QPair<uint32_t, Message>> inFlight; ///< With their receipts, in the order they were sent
+        qint64 retryAt = 0;
+        qint64 backoff = 0;
+        int delays = 0; ///< Of the next message, in a row
+        bool offline = false;
+    };
+
+    QHash<uint32_t, Queue> queues;
+    QElapsedTimer clock;
+};
+
+#endif // MESSAGEQUEUE_H
@@ -1,9 +1,17 @@
 #include "src/audio/audio.h"
+#include "src/audio/audiojitterbuffer.h"
+#include "src/audio/groupaudiomixer.h"
 #include "src/core/toxcall.h"
+#include "src/core/callstats.h"
+#include "src/core/core.h"
 #include "src/core/coreav.h"
 #include "src/persistence/settings.h"
 #include "src/video/camerasource.h"
 #include "src/video/corevideosource.h"
+#include <functional>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QMutex>
 #include <QTimer>
 #include <QtConcurrent/QtConcurrent>
 
@@ -13,6 +21,85 @@
 
 using namespace std;
 
+/**
+@class ToxFriendCall::VideoSender
+@brief One-frame mailbox between the camera and the worker that converts and sends a call's video.
+
+The camera thread only drops its frame in. A frame that wasn't picked up yet is replaced,
+since a late frame is worth less than the latest one.
+*/
+class ToxFriendCall::VideoSender : public enable_shared_from_this<ToxFriendCall::VideoSender>
+{
+public:
+    VideoSender(function<void(shared_ptr<VideoFrame>)> send, shared_ptr<CallStats> stats)
+        : send{send}, stats{stats}, busy{false}, closed{false}
+    {
+    }
+
+    void post(shared_ptr<VideoFrame> frame)
+    {
+        QMutexLocker locker{&lock};
+        if (closed)
+            return;
+
+        if (pending)
+            ++stats->videoFramesDropped;
+
+        pending = move(frame);
+        if (busy)
+            return;
+
+        // the worker keeps us alive, the call might be gone by the time it's done
+        busy = true;
+        shared_ptr<VideoSender> self = shared_from_this();
+        QtConcurrent::run([self](){self->drain();});
+    }
+
+    /// True if a frame is waiting for the one being sent
+    bool hasPending()
+    {
+        QMutexLocker locker{&lock};
+        return pending && !closed;
+    }
+
+    /// We don't wait for the frame being sent, we might be running in a toxav callback
+    void close()
+    {
+        QMutexLocker locker{&lock};
+        closed = true;
+        pending.reset();
+    }
+
+private:
+    void drain()
+    {
+        forever
+        {
+            shared_ptr<VideoFrame> frame;
+            {
+                QMutexLocker locker{&lock};
+                if (!pending || closed)
+                {
+                    busy = false;
+                    return;
+                }
+                frame = move(pending);
+                pending.reset();
+            }
+
+            send(frame);
+        }
+    }
+
+private:
+    function<void(shared_ptr<VideoFrame>)> send;
+    shared_ptr<CallStats> stats;
+    QMutex lock;
+    shared_ptr<VideoFrame> pending;
+    bool busy;
+    bool closed;
+};
+
 ToxCall::ToxCall(uint32_t CallId)
     : callId{CallId}, alSource{0},
       inactive{true}, muteMic{false}, muteVol{false}
@@ -63,6 +150,11 @@ const ToxCall& ToxCall::operator=(ToxCall&& other) noexcept
     return *this;
 }
 
+bool ToxFriendCall::hasNewerVideoFrame() const
+{
+    return videoSender && videoSender->hasPending();
+}
+
 void ToxFriendCall::startTimeout()
 {
     if (!timeoutTimer)
@@ -92,37 +184,63 @@ void ToxFriendCall::stopTimeout()
 
 ToxFriendCall::ToxFriendCall(uint32_t FriendNum, bool VideoEnabled, CoreAV& av)
     : ToxCall(FriendNum),
-      videoEnabled{VideoEnabled}, nullVideoBitrate{false}, videoSource{nullptr},
+      videoEnabled{VideoEnabled}, nullVideoBitrate{false},
+      videoBitrate{CoreAV::VIDEO_DEFAULT_BITRATE}, videoScaleDown{0},
+      videoSendFailures{0}, lastVideoAdaption{0}, videoSource{nullptr},
+      jitterBuffer{new AudioJitterBuffer}, stats{make_shared<CallStats>()},
       state{static_cast<TOXAV_FRIEND_CALL_STATE>(0)},
       av{&av}, timeoutTimer{nullptr}
 {
     audioInConn = QObject::connect(&Audio::getInstance(), &Audio::frameAvailable,
-                     [&av,FriendNum](const int16_t *pcm, size_t samples, uint8_t chans, uint32_t rate)
+                     [&av,FriendNum](const int16_t *pcm, size_t samples, uint8_t chans, uint32_t rate, qint64 captureTime)
     {
-        av.sendCallAudio(FriendNum, pcm, samples, chans, rate);
+        av.sendCallAudio(FriendNum, pcm, samples, chans, rate, captureTime);
     });
 
     if (videoEnabled)
     {
         videoSource = new CoreVideoSource;
         CameraSource& source = CameraSource::getInstance();
-        if (!source.isOpen())
-            source.open();
-        source.subscribe();
-        QObject::connect(&source, &VideoSource::frameAvailable,
-                [FriendNum,&av](shared_ptr<VideoFrame> frame){av.sendCallVideo(FriendNum,frame);});
+
+        // opening the camera can take a second, it's ready by the time the call is answered
+        shared_ptr<CallStats> callStats = stats;
+        cameraSubscribed = QtConcurrent::run([callStats]()
+        {
+            QElapsedTimer timer;
+            timer.start();
+            CameraSource& source = CameraSource::getInstance();
+            if (!source.isOpen())
+                source.open();
+            source.subscribe();
+            callStats->setupCameraTime = static_cast<quint32>(timer.elapsed());
+        });
+
+        videoSender = make_shared<VideoSender>([FriendNum,&av](shared_ptr<VideoFrame> frame)
+        {
+            av.sendCallVideo(FriendNum, frame);
+        }, stats);
+        shared_ptr<VideoSender> sender = videoSender;
+        videoInConn = QObject::connect(&source, &VideoSource::frameAvailable,
+                [sender](shared_ptr<VideoFrame> frame){sender->post(move(frame));});
     }
 }
 
 ToxFriendCall::ToxFriendCall(ToxFriendCall&& other) noexcept
     : ToxCall(move(other)),
       videoEnabled{other.videoEnabled}, nullVideoBitrate{other.nullVideoBitrate},
-      videoSource{other.videoSource}, state{other.state},
-      av{other.av}, timeoutTimer{other.timeoutTimer}
+      videoBitrate{other.videoBitrate}, videoScaleDown{other.videoScaleDown},
+      videoSendFailures{other.videoSendFailures}, lastVideoAdaption{other.lastVideoAdaption},
+      videoSource{other.videoSource}, jitterBuffer{other.jitterBuffer},
+      stats{move(other.stats)}, state{other.state},
+      av{other.av}, timeoutTimer{other.timeoutTimer},
+      videoSender{move(other.videoSender)}, videoInConn{other.videoInConn},
+      cameraSubscribed{other.cameraSubscribed}
 {
     other.videoEnabled = false;
     other.videoSource = nullptr;
+    other.jitterBuffer = nullptr;
     other.timeoutTimer = nullptr;
+    other.videoInConn = QMetaObject::Connection();
 }
 
 ToxFriendCall::~ToxFriendCall()
@@ -130,12 +248,30 @@ ToxFriendCall::~ToxFriendCall()
     if (timeoutTimer)
         delete timeoutTimer;
 
+    delete jitterBuffer;
+
+    // moved-from calls have no stats, only the real end of a call gets logged
+    if (stats)
+    {
+        qDebug() << "Call setup with friend" << callId << ":" << stats->setupSummary();
+        qDebug() << "Call stats with friend" << callId << ":" << stats->summary();
+    }
+
+    QObject::disconnect(videoInConn);
+    if (videoSender)
+        videoSender->close();
+
     if (videoEnabled)
     {
         // This destructor could be running in a toxav callback while holding toxav locks.
         // If the CameraSource thread calls toxav *_send_frame, we might deadlock the toxav and CameraSource locks,
         // so we unsuscribe asynchronously, it's fine if the webcam takes a couple milliseconds more to poweroff.
-        QtConcurrent::run([](){CameraSource::getInstance().unsubscribe();});
+        QFuture<void> subscribed = cameraSubscribed;
+        QtConcurrent::run([subscribed]() mutable
+        {
+            subscribed.waitForFinished();
+            CameraSource::getInstance().unsubscribe();
+        });
         if (videoSource)
         {
             videoSource->setDeleteOnClose(true);
@@ -151,11 +287,23 @@ const ToxFriendCall& ToxFriendCall::operator=(ToxFriendCall&& other) noexcept
     other.videoEnabled = false;
     videoSource = other.videoSource;
     other.videoSource = nullptr;
+    delete jitterBuffer;
+    jitterBuffer = other.jitterBuffer;
+    other.jitterBuffer = nullptr;
+    stats = move(other.stats);
     state = other.state;
     timeoutTimer = other.timeoutTimer;
     other.timeoutTimer = nullptr;
     av = other.av;
+    videoSender = move(other.videoSender);
+    videoInConn = other.videoInConn;
+    other.videoInConn = QMetaObject::Connection();
+    cameraSubscribed = other.cameraSubscribed;
     nullVideoBitrate = other.nullVideoBitrate;
+    videoBitrate = other.videoBitrate;
+    videoScaleDown = other.videoScaleDown;
+    videoSendFailures = other.videoSendFailures;
+    lastVideoAdaption = other.lastVideoAdaption;
 
     return *this;
 }
@@ -167,20 +315,37 @@ ToxGroupCall::ToxGroupCall(int GroupNum, CoreAV &av)
                   "The callId must be able to represent any group number, change its type if needed");
 
     audioInConn = QObject::connect(&Audio::getInstance(), &Audio::frameAvailable,
-                    [&av,GroupNum](const int16_t *pcm, size_t samples, uint8_t chans, uint32_t rate)
+                    [&av,GroupNum](const int16_t *pcm, size_t samples, uint8_t chans, uint32_t rate, qint64)
     {
         av.sendGroupCallAudio(GroupNum, pcm, samples, chans, rate);
     });
+
+    // the mixer owns our output source from now on
+    Core* core = Core::getInstance();
+    mixer = new GroupAudioMixer{alSource, [core,GroupNum](int peer)
+    {
+        emit core->groupActiveSpeakerChanged(GroupNum, peer);
+    }};
+    alSource = 0;
 }
 
 ToxGroupCall::ToxGroupCall(ToxGroupCall&& other) noexcept
-    : ToxCall(move(other))
+    : ToxCall(move(other)), mixer{other.mixer}
+{
+    other.mixer = nullptr;
+}
+
+ToxGroupCall::~ToxGroupCall()
 {
+    delete mixer;
 }
 
 const ToxGroupCall &ToxGroupCall::operator=(ToxGroupCall &&other) noexcept
 {
     ToxCall::operator =(move(other));
+    delete mixer;
+    mixer = other.mixer;
+    other.mixer = nullptr;
 
     return *this;
 }
@@ -2,7 +2,9 @@
 #define TOXCALL_H
 
 #include <cstdint>
+#include <memory>
 #include <QtGlobal>
+#include <QFuture>
 #include <QMetaObject>
 
 #include "src/core/indexedlist.h"
@@ -11,6 +13,9 @@
 
 class QTimer;
 class AudioFilterer;
+class AudioJitterBuffer;
+class GroupAudioMixer;
+struct CallStats;
 class CoreVideoSource;
 class CoreAV;
 
@@ -50,17 +55,31 @@ struct ToxFriendCall : public ToxCall
 
     bool videoEnabled; ///< True if our user asked for a video call, sending and recving
     bool nullVideoBitrate; ///< True if our video bitrate is zero, i.e. if the device is closed
+    uint32_t videoBitrate; ///< The bitrate we send video at, in kb/s, when it's not null
+    int videoScaleDown; ///< How many times we halve our frames before sending them
+    int videoSendFailures; ///< Frames toxav refused since the last one it accepted
+    qint64 lastVideoAdaption; ///< When videoScaleDown last changed, in ms since the epoch
     CoreVideoSource* videoSource;
+    AudioJitterBuffer* jitterBuffer = nullptr; ///< The peer's audio, waiting to be played
+    std::shared_ptr<CallStats> stats; ///< Shared so the GUI can keep watching them without locking
     TOXAV_FRIEND_CALL_STATE state; ///< State of the peer (not ours!)
 
     void startTimeout();
     void stopTimeout();
+    /// True if the camera gave us another frame while we were sending the last one
+    bool hasNewerVideoFrame() const;
 
 protected:
     CoreAV* av;
     QTimer* timeoutTimer;
 
 private:
+    class VideoSender;
+    /// Converts and sends our frames off the camera thread, so a slow encode doesn't stall capture
+    std::shared_ptr<VideoSender> videoSender;
+    QMetaObject::Connection videoInConn;
+    QFuture<void> cameraSubscribed; ///< The camera opens on the pool while the call rings, we unsubscribe after it
+
     static constexpr int CALL_TIMEOUT = 45000;
 };
 
@@ -69,9 +88,12 @@ struct ToxGroupCall : public ToxCall
     ToxGroupCall() = default;
     ToxGroupCall(int GroupNum, CoreAV& av);
     ToxGroupCall(ToxGroupCall&& other) noexcept;
+    ~ToxGroupCall();
 
     const ToxGroupCall& operator=(ToxGroupCall&& other) noexcept;
 
+    GroupAudioMixer* mixer = nullptr; ///< Plays every peer on a single source, instead of our alSource
+
     // If you add something here, don't forget to override the ctors and move operators!
 };
 
@@ -72,6 +72,11 @@ QString ToxId::toString() const
     return publicKey + noSpam + checkSum;
 }
 
+ToxPk ToxId::getPublicKey() const
+{
+    return ToxPk(publicKey);
+}
+
 void ToxId::clear()
 {
     publicKey.clear();
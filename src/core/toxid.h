@@ -21,6 +21,7 @@
 #ifndef TOXID_H
 #define TOXID_H
 
+#include "src/core/toxpk.h"
 #include <QString>
 
 /*
@@ -50,6 +51,7 @@ public:
     bool isSelf() const; ///< Returns true if this Tox ID is equals to
                                   /// the Tox ID of the currently active profile.
     QString toString() const; ///< Returns the Tox ID as QString.
+    ToxPk getPublicKey() const; ///< Returns the public key in binary, empty if it isn't valid hex.
     void clear(); ///< Clears all elements of the Tox ID.
 
     static bool isToxId(const QString& id); ///< Returns true if id is a valid Tox ID.
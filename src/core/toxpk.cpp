@@ -0,0 +1,114 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "toxpk.h"
+
+#include <cstring>
+
+namespace
+{
+
+/// Value of a hex digit, -1 if it isn't one
+int hexValue(ushort c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+}
+
+ToxPk::ToxPk()
+{
+    memset(key, 0, size);
+}
+
+ToxPk::ToxPk(const uint8_t* rawKey)
+{
+    memcpy(key, rawKey, size);
+}
+
+ToxPk::ToxPk(const QString& hex)
+{
+    memset(key, 0, size);
+    if (hex.size() < hexSize)
+        return;
+
+    // parsed in place, this is called on every lookup by string
+    const QChar* digits = hex.constData();
+    uint8_t parsed[size];
+    for (int i = 0; i < size; ++i)
+    {
+        int high = hexValue(digits[2 * i].unicode());
+        int low = hexValue(digits[2 * i + 1].unicode());
+        if (high < 0 || low < 0)
+            return;
+
+        parsed[i] = static_cast<uint8_t>(high << 4 | low);
+    }
+
+    memcpy(key, parsed, size);
+}
+
+bool ToxPk::operator==(const ToxPk& other) const
+{
+    return memcmp(key, other.key, size) == 0;
+}
+
+bool ToxPk::operator!=(const ToxPk& other) const
+{
+    return !(*this == other);
+}
+
+bool ToxPk::isEmpty() const
+{
+    return *this == ToxPk();
+}
+
+QString ToxPk::toString() const
+{
+    static const char digits[] = "0123456789ABCDEF";
+
+    QString hex(hexSize, Qt::Uninitialized);
+    QChar* out = hex.data();
+    for (int i = 0; i < size; ++i)
+    {
+        out[2 * i] = QLatin1Char(digits[key[i] >> 4]);
+        out[2 * i + 1] = QLatin1Char(digits[key[i] & 0xF]);
+    }
+
+    return hex;
+}
+
+const uint8_t* ToxPk::getBytes() const
+{
+    return key;
+}
+
+uint qHash(const ToxPk& pk, uint seed)
+{
+    // public keys are uniformly random, a few of their bytes are as good a hash as any
+    uint hash;
+    memcpy(&hash, pk.getBytes(), sizeof(hash));
+    return hash ^ seed;
+}
@@ -0,0 +1,52 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TOXPK_H
+#define TOXPK_H
+
+#include <cstdint>
+#include <QString>
+
+/// A friend's public key as its 32 raw bytes, cheap to copy, compare and hash
+/// Use it to key lookup tables, the hex form is only needed to show or store the key
+class ToxPk
+{
+public:
+    static constexpr int size = 32; ///< TOX_PUBLIC_KEY_SIZE
+    static constexpr int hexSize = 2 * size;
+
+    ToxPk(); ///< An empty key, all zeroes
+    explicit ToxPk(const uint8_t* rawKey);
+    /// Parses the public key at the start of a hex key or Tox ID, in any case
+    /// The key is empty if there aren't enough hex digits
+    explicit ToxPk(const QString& hex);
+
+    bool operator==(const ToxPk& other) const;
+    bool operator!=(const ToxPk& other) const;
+    bool isEmpty() const;
+    QString toString() const; ///< In upper case hex, like toxcore prints it
+    const uint8_t* getBytes() const;
+
+private:
+    uint8_t key[size];
+};
+
+uint qHash(const ToxPk& pk, uint seed = 0);
+
+#endif // TOXPK_H
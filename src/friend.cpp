@@ -20,6 +20,7 @@
 
 #include "friend.h"
 #include "friendlist.h"
+#include "friendsearchindex.h"
 #include "widget/friendwidget.h"
 #include "widget/form/chatform.h"
 #include "widget/gui.h"
@@ -42,7 +43,8 @@ Friend::Friend(uint32_t FriendId, const ToxId &UserId)
     userAlias = Settings::getInstance().getFriendAlias(UserId);
 
     widget = new FriendWidget(friendId, getDisplayedName());
-    chatForm = new ChatForm(this);
+    chatForm = nullptr;
+    updateSearchIndex();
 }
 
 Friend::~Friend()
@@ -53,9 +55,9 @@ Friend::~Friend()
 
 void Friend::loadHistory()
 {
-    if (Nexus::getProfile()->isHistoryEnabled())
+    if (chatForm && Nexus::getProfile()->isHistoryEnabled())
     {
-        chatForm->loadHistory(QDateTime::currentDateTime().addDays(-7), true);
+        chatForm->loadHistory(QDateTime::currentDateTime().addDays(-7));
         widget->historyLoaded = true;
     }
 }
@@ -66,10 +68,13 @@ void Friend::setName(QString name)
        name = userID.publicKey;
 
     userName = name;
+    updateSearchIndex();
+
     if (userAlias.size() == 0)
     {
         widget->setName(name);
-        chatForm->setName(name);
+        if (chatForm)
+            chatForm->setName(name);
 
         if (widget->isActive())
             GUI::setWindowTitle(name);
@@ -81,10 +86,12 @@ void Friend::setName(QString name)
 void Friend::setAlias(QString name)
 {
     userAlias = name;
+    updateSearchIndex();
     QString dispName = userAlias.size() == 0 ? userName : userAlias;
 
     widget->setName(dispName);
-    chatForm->setName(dispName);
+    if (chatForm)
+        chatForm->setName(dispName);
 
     if (widget->isActive())
             GUI::setWindowTitle(dispName);
@@ -101,7 +108,16 @@ void Friend::setStatusMessage(QString message)
 {
     statusMessage = message;
     widget->setStatusMsg(message);
-    chatForm->setStatusMessage(message);
+    if (chatForm)
+        chatForm->setStatusMessage(message);
+}
+
+/**
+@brief Lets the friend be found by its alias, user name and public key.
+*/
+void Friend::updateSearchIndex()
+{
+    FriendList::getSearchIndex().setFriend(friendId, {userAlias, userName}, userID.publicKey);
 }
 
 QString Friend::getStatusMessage()
@@ -153,6 +169,19 @@ Status Friend::getStatus() const
 }
 
 ChatForm *Friend::getChatForm()
+{
+    if (chatForm)
+        return chatForm;
+
+    chatForm = new ChatForm(this);
+    if (!statusMessage.isEmpty())
+        chatForm->setStatusMessage(statusMessage);
+    loadHistory();
+    emit chatFormCreated(chatForm);
+    return chatForm;
+}
+
+ChatForm *Friend::findChatForm() const
 {
     return chatForm;
 }
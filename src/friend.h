@@ -37,7 +37,7 @@ public:
     ~Friend();
     Friend& operator=(const Friend& other)=delete;
 
-    /// Loads the friend's chat history if enabled
+    /// Loads the friend's chat history if enabled, a chat form that's created later loads it itself
     void loadHistory();
 
     void setName(QString name);
@@ -57,12 +57,20 @@ public:
     void setStatus(Status s);
     Status getStatus() const;
 
+    /// Creates the chat form the first time, most friends of a large profile are never opened
     ChatForm *getChatForm();
+    /// The chat form if it was created, for the updates that are pointless without one
+    ChatForm *findChatForm() const;
     FriendWidget *getFriendWidget();
     const FriendWidget *getFriendWidget() const;
 
 signals:
     void displayedNameChanged(FriendWidget* widget, Status s, int hasNewEvents);
+    /// Emitted by getChatForm when it creates the chat form, before returning it
+    void chatFormCreated(ChatForm* form);
+
+private:
+    void updateSearchIndex();
 
 private:
     QString userAlias, userName, statusMessage;
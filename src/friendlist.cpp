@@ -19,13 +19,15 @@
 
 #include "friend.h"
 #include "friendlist.h"
+#include "friendsearchindex.h"
 #include "src/persistence/settings.h"
 #include <QMenu>
 #include <QDebug>
 #include <QHash>
 
 QHash<int, Friend*> FriendList::friendList;
-QHash<QString, int> FriendList::tox2id;
+QHash<ToxPk, int> FriendList::tox2id;
+FriendSearchIndex FriendList::searchIndex;
 
 Friend* FriendList::addFriend(int friendId, const ToxId& userId)
 {
@@ -35,7 +37,7 @@ Friend* FriendList::addFriend(int friendId, const ToxId& userId)
 
     Friend* newfriend = new Friend(friendId, userId);
     friendList[friendId] = newfriend;
-    tox2id[userId.publicKey] = friendId;
+    tox2id[userId.getPublicKey()] = friendId;
 
     // Must be done AFTER adding to the friendlist
     // or we won't find the friend and history will have blank names
@@ -60,7 +62,9 @@ void FriendList::removeFriend(int friendId, bool fake)
     {
         if (!fake)
             Settings::getInstance().removeFriendSettings(f_it.value()->getToxId());
+        tox2id.remove(f_it.value()->getToxId().getPublicKey());
         friendList.erase(f_it);
+        searchIndex.removeFriend(friendId);
     }
 }
 
@@ -69,11 +73,21 @@ void FriendList::clear()
     for (auto friendptr : friendList)
         delete friendptr;
     friendList.clear();
+    tox2id.clear();
+    searchIndex.clear();
+}
+
+/**
+@brief Index of the friends' names, kept up to date by Friend.
+*/
+FriendSearchIndex& FriendList::getSearchIndex()
+{
+    return searchIndex;
 }
 
 Friend* FriendList::findFriend(const ToxId& userId)
 {
-    auto id = tox2id.find(userId.publicKey);
+    auto id = tox2id.find(userId.getPublicKey());
     if (id != tox2id.end())
     {
         Friend *f = findFriend(*id);
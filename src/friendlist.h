@@ -25,6 +25,8 @@ template <class A, class B> class QHash;
 class Friend;
 class QString;
 class ToxId;
+class ToxPk;
+class FriendSearchIndex;
 
 class FriendList
 {
@@ -35,10 +37,12 @@ public:
     static QList<Friend*> getAllFriends();
     static void removeFriend(int friendId, bool fake = false);
     static void clear();
+    static FriendSearchIndex& getSearchIndex();
 
 private:
     static QHash<int, Friend*> friendList;
-    static QHash<QString, int> tox2id;
+    static QHash<ToxPk, int> tox2id;
+    static FriendSearchIndex searchIndex;
 };
 
 #endif // FRIENDLIST_H
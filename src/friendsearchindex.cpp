@@ -0,0 +1,265 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "friendsearchindex.h"
+#include <algorithm>
+
+/// Shorter queries would match public keys almost at random
+#define KEY_PREFIX_MIN_LENGTH 8
+/// Longest n-gram kept in the index, longer queries are verified against the names
+#define MAX_GRAM_LENGTH 3
+
+/**
+@class FriendSearchIndex
+@brief Finds friends by name, alias or public key without going through their widgets.
+
+Names are normalized once when they change: case folded and stripped of diacritics,
+so "Élodie" is found with "elo". Every n-gram of up to three characters points to the
+friends whose names contain it, which answers short queries directly and narrows
+longer ones down to a few candidates. Public keys only match by prefix.
+
+When the query is refined, as happens with each key press, only the previous
+matches are checked again.
+*/
+
+namespace
+{
+
+quint64 gramKey(const QChar* gram, int length)
+{
+    quint64 key = static_cast<quint64>(length) << 48;
+    for (int i = 0; i < length; ++i)
+        key |= static_cast<quint64>(gram[i].unicode()) << (16 * (2 - i));
+
+    return key;
+}
+
+void insertSorted(QVector<int>& ids, int id)
+{
+    auto it = std::lower_bound(ids.begin(), ids.end(), id);
+    if (it == ids.end() || *it != id)
+        ids.insert(it, id);
+}
+
+void removeSorted(QVector<int>& ids, int id)
+{
+    auto it = std::lower_bound(ids.begin(), ids.end(), id);
+    if (it != ids.end() && *it == id)
+        ids.erase(it);
+}
+
+}
+
+FriendSearchIndex::FriendSearchIndex()
+    : revision{0}
+    , lastRevision{0}
+{
+}
+
+/**
+@brief Case folds the text and strips its diacritics.
+*/
+QString FriendSearchIndex::normalize(const QString& text)
+{
+    QString decomposed = text.normalized(QString::NormalizationForm_KD);
+    QString stripped;
+    stripped.reserve(decomposed.size());
+
+    for (QChar c : decomposed)
+    {
+        if (c.category() != QChar::Mark_NonSpacing)
+            stripped.append(c);
+    }
+
+    return stripped.toCaseFolded();
+}
+
+/**
+@brief Adds a friend to the index, or replaces what was indexed for it.
+@param names Names the friend can be found with, like the alias and the user name.
+@param publicKey Friend's public key, found by prefix.
+*/
+void FriendSearchIndex::setFriend(int friendId, const QStringList& names, const QString& publicKey)
+{
+    removeFriend(friendId);
+
+    Entry entry;
+    for (const QString& name : names)
+    {
+        if (!name.isEmpty())
+            entry.names.append(normalize(name));
+    }
+    entry.publicKey = normalize(publicKey);
+
+    for (quint64 key : gramsOf(entry.names))
+        insertSorted(grams[key], friendId);
+
+    publicKeys.insert(entry.publicKey, friendId);
+    entries.insert(friendId, entry);
+    ++revision;
+}
+
+void FriendSearchIndex::removeFriend(int friendId)
+{
+    auto it = entries.find(friendId);
+    if (it == entries.end())
+        return;
+
+    for (quint64 key : gramsOf(it->names))
+    {
+        auto gram = grams.find(key);
+        if (gram == grams.end())
+            continue;
+
+        removeSorted(*gram, friendId);
+        if (gram->isEmpty())
+            grams.erase(gram);
+    }
+
+    publicKeys.remove(it->publicKey);
+    entries.erase(it);
+    ++revision;
+}
+
+void FriendSearchIndex::clear()
+{
+    entries.clear();
+    grams.clear();
+    publicKeys.clear();
+    lastQuery.clear();
+    lastResult.clear();
+    ++revision;
+}
+
+/**
+@brief Checks a single friend, with the same rules as find().
+*/
+bool FriendSearchIndex::matches(int friendId, const QString& searchString) const
+{
+    if (searchString.isEmpty())
+        return true;
+
+    auto it = entries.find(friendId);
+    if (it == entries.end())
+        return false;
+
+    return matchesNormalized(*it, normalize(searchString));
+}
+
+/**
+@brief Finds the friends matching a query.
+@return Sorted ids of the matching friends, all friends for an empty query.
+*/
+QVector<int> FriendSearchIndex::find(const QString& searchString)
+{
+    QString query = normalize(searchString);
+    QVector<int> result;
+
+    if (query.isEmpty())
+    {
+        result.reserve(entries.size());
+        for (auto it = entries.constBegin(); it != entries.constEnd(); ++it)
+            result.append(it.key());
+
+        std::sort(result.begin(), result.end());
+    }
+    else if (lastRevision == revision && !lastQuery.isEmpty() && query.contains(lastQuery))
+    {
+        // Refined query: the name matches can only shrink.
+        for (int friendId : lastResult)
+        {
+            if (matchesNormalized(entries.value(friendId), query))
+                result.append(friendId);
+        }
+    }
+    else if (query.size() <= MAX_GRAM_LENGTH)
+    {
+        result = grams.value(gramKey(query.constData(), query.size()));
+    }
+    else
+    {
+        // Every trigram of the query has to be in the name, start from the rarest one.
+        const QVector<int>* candidates = nullptr;
+        static const QVector<int> none;
+
+        for (int i = 0; i + MAX_GRAM_LENGTH <= query.size(); ++i)
+        {
+            auto gram = grams.constFind(gramKey(query.constData() + i, MAX_GRAM_LENGTH));
+            const QVector<int>* ids = gram == grams.constEnd() ? &none : &gram.value();
+
+            if (candidates == nullptr || ids->size() < candidates->size())
+                candidates = ids;
+        }
+
+        for (int friendId : *candidates)
+        {
+            if (matchesNormalized(entries.value(friendId), query))
+                result.append(friendId);
+        }
+    }
+
+    // A key can start with the refined query without starting with the previous one.
+    if (query.size() >= KEY_PREFIX_MIN_LENGTH)
+    {
+        for (auto it = publicKeys.lowerBound(query); it != publicKeys.end() && it.key().startsWith(query); ++it)
+            insertSorted(result, it.value());
+    }
+
+    lastQuery = query;
+    lastResult = result;
+    lastRevision = revision;
+    return result;
+}
+
+/**
+@brief Changes each time a friend is added, removed or renamed.
+*/
+quint64 FriendSearchIndex::getRevision() const
+{
+    return revision;
+}
+
+QVector<quint64> FriendSearchIndex::gramsOf(const QStringList& names)
+{
+    QVector<quint64> keys;
+
+    for (const QString& name : names)
+    {
+        for (int i = 0; i < name.size(); ++i)
+        {
+            for (int length = 1; length <= MAX_GRAM_LENGTH && i + length <= name.size(); ++length)
+                keys.append(gramKey(name.constData() + i, length));
+        }
+    }
+
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    return keys;
+}
+
+bool FriendSearchIndex::matchesNormalized(const Entry& entry, const QString& query) const
+{
+    for (const QString& name : entry.names)
+    {
+        if (name.contains(query))
+            return true;
+    }
+
+    return query.size() >= KEY_PREFIX_MIN_LENGTH && entry.publicKey.startsWith(query);
+}
@@ -0,0 +1,65 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FRIENDSEARCHINDEX_H
+#define FRIENDSEARCHINDEX_H
+
+#include <QHash>
+#include <QMap>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+class FriendSearchIndex
+{
+public:
+    FriendSearchIndex();
+
+    static QString normalize(const QString& text);
+
+    void setFriend(int friendId, const QStringList& names, const QString& publicKey);
+    void removeFriend(int friendId);
+    void clear();
+
+    bool matches(int friendId, const QString& searchString) const;
+    QVector<int> find(const QString& searchString);
+    quint64 getRevision() const;
+
+private:
+    struct Entry
+    {
+        QStringList names;
+        QString publicKey;
+    };
+
+    static QVector<quint64> gramsOf(const QStringList& names);
+    bool matchesNormalized(const Entry& entry, const QString& query) const;
+
+private:
+    QHash<int, Entry> entries;
+    QHash<quint64, QVector<int>> grams; ///< Sorted ids of the friends whose names contain each n-gram
+    QMap<QString, int> publicKeys;      ///< For prefix lookups
+    quint64 revision;
+
+    QString lastQuery;
+    QVector<int> lastResult;
+    quint64 lastRevision;
+};
+
+#endif // FRIENDSEARCHINDEX_H
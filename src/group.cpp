@@ -25,6 +25,7 @@
 #include "src/core/core.h"
 #include "widget/gui.h"
 #include <QDebug>
+#include <QHash>
 #include <QTimer>
 
 Group::Group(int GroupId, QString Name, bool IsAvGroupchat)
@@ -50,6 +51,7 @@ void Group::updatePeer(int peerId, QString name)
 {
     ToxId id = Core::getInstance()->getGroupPeerToxId(groupId, peerId);
     QString toxid = id.publicKey;
+    QString oldName = peers[peerId];
     peers[peerId] = name;
     toxids[toxid] = name;
 
@@ -59,7 +61,11 @@ void Group::updatePeer(int peerId, QString name)
         peers[peerId] = f->getDisplayedName();
         toxids[toxid] = f->getDisplayedName();
     }
-    else
+
+    if (peers[peerId] != oldName)
+        emit peerNamesChanged({oldName}, {peers[peerId]});
+
+    if (f == nullptr || !f->hasAlias())
     {
         widget->onUserListChanged();
         chatForm->onUserListChanged();
@@ -69,7 +75,10 @@ void Group::updatePeer(int peerId, QString name)
 
 void Group::setName(const QString& name)
 {
+    titled = !name.isEmpty();
     chatForm->setName(name);
+    // The history is found by title, this may be the first one we get
+    chatForm->loadHistoryPage();
 
     if (widget->isActive())
         GUI::setWindowTitle(name);
@@ -77,6 +86,11 @@ void Group::setName(const QString& name)
     emit titleChanged(this->getGroupWidget());
 }
 
+bool Group::hasTitle() const
+{
+    return titled;
+}
+
 QString Group::getName() const
 {
     return widget->getName();
@@ -84,28 +98,57 @@ QString Group::getName() const
 
 void Group::regeneratePeerList()
 {
-    peers = Core::getInstance()->getGroupPeerNames(groupId);
+    Core* core = Core::getInstance();
+    const QStringList oldPeers = peers;
+    peers = core->getGroupPeerNames(groupId);
     toxids.clear();
+    peerKeys.clear();
     nPeers = peers.size();
+    peerKeys.reserve(nPeers);
+    const ToxId selfId = core->getSelfId();
+
+    // the peers come from Core's table, only the friends with an alias need a lookup
     for (int i = 0; i < nPeers; i++)
     {
-        ToxId id = Core::getInstance()->getGroupPeerToxId(groupId, i);
-        if (id.isSelf())
+        ToxId id = core->getGroupPeerToxId(groupId, i);
+        if (id == selfId)
             selfPeerNum = i;
 
-        QString toxid = id.publicKey;
-        toxids[toxid] = peers[i];
-        if (toxids[toxid].isEmpty())
-            toxids[toxid] = tr("<Empty>", "Placeholder when someone's name in a group chat is empty");
+        QString name = peers[i];
+        if (name.isEmpty())
+            name = tr("<Empty>", "Placeholder when someone's name in a group chat is empty");
 
-        Friend *f = FriendList::findFriend(id);
+        int friendId = core->getGroupPeerFriendId(groupId, i);
+        Friend *f = friendId >= 0 ? FriendList::findFriend(friendId) : FriendList::findFriend(id);
         if (f != nullptr && f->hasAlias())
         {
             peers[i] = f->getDisplayedName();
-            toxids[toxid] = f->getDisplayedName();
+            name = peers[i];
         }
+
+        peerKeys.append(id.publicKey);
+        toxids.insert(id.publicKey, name);
+    }
+
+    // toxcore renumbers peers when someone leaves, so find what changed by name
+    QHash<QString, int> delta;
+    for (const QString& name : oldPeers)
+        --delta[name];
+    for (const QString& name : peers)
+        ++delta[name];
+
+    QStringList removed, added;
+    for (auto it = delta.constBegin(); it != delta.constEnd(); ++it)
+    {
+        for (int i = it.value(); i < 0; ++i)
+            removed.append(it.key());
+        for (int i = it.value(); i > 0; --i)
+            added.append(it.key());
     }
 
+    if (!removed.isEmpty() || !added.isEmpty())
+        emit peerNamesChanged(removed, added);
+
     widget->onUserListChanged();
     chatForm->onUserListChanged();
     emit userListChanged(getGroupWidget());
@@ -141,6 +184,14 @@ QStringList Group::getPeerList() const
     return peers;
 }
 
+/**
+@brief Public keys of the peers, by peer number like getPeerList().
+*/
+QStringList Group::getPeerKeys() const
+{
+    return peerKeys;
+}
+
 bool Group::isSelfPeerNumber(int num) const
 {
     return num == selfPeerNum;
@@ -43,6 +43,7 @@ public:
     int getPeersCount() const;
     void regeneratePeerList();
     QStringList getPeerList() const;
+    QStringList getPeerKeys() const;
     bool isSelfPeerNumber(int peernumber) const;
 
     GroupChatForm *getChatForm();
@@ -57,23 +58,29 @@ public:
     void updatePeer(int peerId, QString newName);
     void setName(const QString& name);
     QString getName() const;
+    /// The group got a title from toxcore, until then it's named "Groupchat #n" after its number
+    bool hasTitle() const;
 
     QString resolveToxId(const ToxId &id) const;
 
 signals:
     void titleChanged(GroupWidget* widget);
     void userListChanged(GroupWidget* widget);
+    /// The names that left and joined since the last change, a renamed peer is in both
+    void peerNamesChanged(const QStringList& removed, const QStringList& added);
 
 private:
     GroupWidget* widget;
     GroupChatForm* chatForm;
     QStringList peers;
+    QStringList peerKeys;
     QMap<QString, QString> toxids;
     int hasNewMessages, userWasMentioned;
     int groupId;
     int nPeers;
     int selfPeerNum = -1;
     bool avGroupchat;
+    bool titled = false;
 
 };
 
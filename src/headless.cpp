@@ -0,0 +1,353 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "headless.h"
+#include "src/core/core.h"
+#include "src/core/coreav.h"
+#include "src/core/coreevents.h"
+#include "src/persistence/history.h"
+#include "src/persistence/offlinemsgengine.h"
+#include "src/persistence/profile.h"
+#include "src/persistence/settings.h"
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDebug>
+#include <QLocalSocket>
+
+/**
+@class Headless
+@brief The front end of qTox when it runs without a GUI.
+
+It takes the place of Widget: Nexus connects it to the Core like the desktop GUI, and it
+writes the messages to the History the same way the chat forms do, so a profile can be used
+headless and with the GUI in turn. It only reaches the Core through its Profile.
+
+Each client line is a command, answered by "ok" or "error <reason>" after its result lines:
+    send <friend id> <text>       action <friend id> <text>
+    friends                       status <online|away|busy>
+    add <tox id> <text>           accept <public key>
+    quit
+Events come as lines as well, at any time:
+    message <friend id> <text>    action <friend id> <text>
+    request <public key> <text>   friend-status <friend id> <status>
+    receipt <friend id> <receipt> connected, disconnected
+Line breaks and backslashes of the texts are escaped as \n and \\.
+*/
+
+Headless::Headless(Profile* profile)
+    : profile{profile}
+{
+    connect(&server, &QLocalServer::newConnection, this, &Headless::onNewClient);
+}
+
+Headless::~Headless()
+{
+    qDeleteAll(offlineEngines);
+}
+
+bool Headless::listen(const QString &name)
+{
+    QString socketName = name.isEmpty() ? controlSocketName(profile->getName()) : name;
+
+    // A daemon that crashed leaves its socket behind on Unix
+    QLocalServer::removeServer(socketName);
+    server.setSocketOptions(QLocalServer::UserAccessOption);
+    if (!server.listen(socketName))
+    {
+        qCritical() << "Can't listen on the control socket" << socketName << ":" << server.errorString();
+        return false;
+    }
+
+    qDebug() << "Listening for control clients on" << server.fullServerName();
+    return true;
+}
+
+QString Headless::controlSocketName(const QString &profileName)
+{
+    return "qtox-headless-" + profileName;
+}
+
+void Headless::onConnected()
+{
+    // CoreAV only exists once the Core is started
+    CoreAV* av = profile->getCore()->getAv();
+    if (av)
+        connect(av, &CoreAV::avInvite, this, &Headless::onAvInvite, Qt::UniqueConnection);
+
+    broadcast("connected");
+}
+
+void Headless::onDisconnected()
+{
+    broadcast("disconnected");
+}
+
+void Headless::onFailedToStartCore()
+{
+    qCritical() << "toxcore failed to start, quitting";
+    qApp->exit(EXIT_FAILURE);
+}
+
+void Headless::onFriendRequestReceived(const QString &userId, const QString &message)
+{
+    broadcast("request " + userId + " " + escape(message));
+}
+
+void Headless::onCoreEvents(const CoreEvents &events)
+{
+    for (const CoreEvents::FriendStatus& status : events.friendStatuses)
+    {
+        Status oldStatus = friendStatuses.value(status.friendId, Status::Offline);
+        friendStatuses[status.friendId] = status.status;
+        if (oldStatus == status.status)
+            continue;
+
+        broadcast(QString("friend-status %1 %2").arg(status.friendId).arg(statusName(status.status)));
+        if (oldStatus == Status::Offline)
+            sendPendingMessages(status.friendId);
+    }
+
+    Core* core = profile->getCore();
+    for (const CoreEvents::FriendMessage& message : events.friendMessages)
+    {
+        broadcast(QString(message.isAction ? "action %1 " : "message %1 ").arg(message.friendId)
+                  + escape(message.message));
+
+        // Stored like Widget::onFriendMessageReceived does
+        if (profile->isHistoryEnabled())
+        {
+            QString publicKey = core->getFriendPublicKey(message.friendId);
+            QString name = core->getFriendUsername(message.friendId);
+            profile->getHistory()->addNewMessage(publicKey,
+                                                 message.isAction ? "/me " + name + " " + message.message
+                                                                  : message.message,
+                                                 publicKey, QDateTime::currentDateTime(), true, name);
+        }
+    }
+}
+
+void Headless::onReceiptReceived(int friendId, int receipt)
+{
+    getOfflineMsgEngine(friendId)->dischargeReceipt(receipt);
+    broadcast(QString("receipt %1 %2").arg(friendId).arg(receipt));
+}
+
+void Headless::onAvInvite(uint32_t friendId, bool video)
+{
+    qDebug() << "Declining the" << (video ? "video" : "audio") << "call of friend" << friendId;
+    profile->getCore()->getAv()->cancelCall(friendId);
+}
+
+void Headless::onNewClient()
+{
+    while (QLocalSocket* client = server.nextPendingConnection())
+    {
+        clients.append(client);
+        connect(client, &QLocalSocket::readyRead, this, &Headless::onClientReadyRead);
+        connect(client, &QLocalSocket::disconnected, this, [this, client]()
+        {
+            clients.removeOne(client);
+            client->deleteLater();
+        });
+    }
+}
+
+void Headless::onClientReadyRead()
+{
+    QLocalSocket* client = qobject_cast<QLocalSocket*>(sender());
+    if (!client)
+        return;
+
+    while (client->canReadLine())
+    {
+        QString line = QString::fromUtf8(client->readLine()).trimmed();
+        if (line.isEmpty())
+            continue;
+
+        for (const QString& answer : runCommand(line))
+            client->write(answer.toUtf8() + '\n');
+    }
+
+    if (client->bytesAvailable() > maxLineLength)
+    {
+        qWarning() << "Dropping a control client that sent a line of over" << maxLineLength << "bytes";
+        client->abort();
+    }
+}
+
+QStringList Headless::runCommand(const QString &line)
+{
+    QString command = line.section(' ', 0, 0);
+    QString args = line.section(' ', 1);
+    Core* core = profile->getCore();
+
+    if (command == "send" || command == "action")
+    {
+        bool ok;
+        uint32_t friendId = args.section(' ', 0, 0).toUInt(&ok);
+        QString text = unescape(args.section(' ', 1));
+        if (!ok || !core->getFriendList().contains(friendId))
+            return {"error unknown friend"};
+        if (text.isEmpty())
+            return {"error empty message"};
+
+        sendMessage(friendId, text, command == "action");
+        return {"ok"};
+    }
+    else if (command == "friends")
+    {
+        QStringList answer;
+        for (uint32_t friendId : core->getFriendList())
+        {
+            answer << QString("friend %1 %2 %3 %4").arg(friendId)
+                      .arg(statusName(friendStatuses.value(friendId, Status::Offline)))
+                      .arg(core->getFriendPublicKey(friendId), escape(core->getFriendUsername(friendId)));
+        }
+        answer << "ok";
+        return answer;
+    }
+    else if (command == "status")
+    {
+        static const QStringList names = {"online", "away", "busy"};
+        int index = names.indexOf(args.trimmed());
+        if (index < 0)
+            return {"error unknown status"};
+
+        emit statusSet(static_cast<Status>(index));
+        return {"ok"};
+    }
+    else if (command == "add")
+    {
+        emit friendRequested(args.section(' ', 0, 0), unescape(args.section(' ', 1)));
+        return {"ok"};
+    }
+    else if (command == "accept")
+    {
+        emit friendRequestAccepted(args.trimmed());
+        return {"ok"};
+    }
+    else if (command == "quit")
+    {
+        qApp->quit();
+        return {"ok"};
+    }
+
+    return {"error unknown command"};
+}
+
+/**
+@brief Sends and stores a message like ChatForm::SendMessageStr, split in as many as toxcore needs.
+*/
+void Headless::sendMessage(uint32_t friendId, const QString &message, bool isAction)
+{
+    Core* core = profile->getCore();
+    const QByteArray utf8Msg = message.toUtf8();
+    QDateTime timestamp = QDateTime::currentDateTime();
+    bool status = !Settings::getInstance().getFauxOfflineMessaging();
+
+    for (const Core::MessageSpan& span : Core::splitMessage(utf8Msg, TOX_MAX_MESSAGE_LENGTH))
+    {
+        QString text = QString::fromUtf8(utf8Msg.constData() + span.offset, span.length);
+        int rec = isAction ? core->sendAction(friendId, text) : core->sendMessage(friendId, text);
+
+        if (!profile->isHistoryEnabled())
+            continue;
+
+        OfflineMsgEngine* offMsgEngine = getOfflineMsgEngine(friendId);
+        profile->getHistory()->addNewMessage(core->getFriendPublicKey(friendId), isAction ? "/me " + text : text,
+                                             core->getSelfId().publicKey, timestamp, status, core->getUsername(),
+                                             [offMsgEngine, rec](int64_t id)
+        {
+            offMsgEngine->registerReceipt(rec, id, nullptr);
+        });
+    }
+}
+
+void Headless::sendPendingMessages(uint32_t friendId)
+{
+    if (pendingMessagesSent.contains(friendId) || !profile->isHistoryEnabled())
+        return;
+
+    pendingMessagesSent.insert(friendId);
+    Core* core = profile->getCore();
+    QList<History::HistMessage> msgs = profile->getHistory()->getPendingMessages(core->getFriendPublicKey(friendId));
+    for (const History::HistMessage& it : msgs)
+    {
+        bool isAction = it.message.startsWith("/me ", Qt::CaseInsensitive);
+        int rec = isAction ? core->sendAction(friendId, it.message.mid(4)) : core->sendMessage(friendId, it.message);
+        getOfflineMsgEngine(friendId)->registerReceipt(rec, it.id, nullptr);
+    }
+
+    if (!msgs.isEmpty())
+        qDebug() << "Queued" << msgs.size() << "undelivered messages for friend" << friendId;
+}
+
+OfflineMsgEngine* Headless::getOfflineMsgEngine(uint32_t friendId)
+{
+    OfflineMsgEngine*& engine = offlineEngines[friendId];
+    if (!engine)
+        engine = new OfflineMsgEngine(nullptr);
+    return engine;
+}
+
+void Headless::broadcast(const QString &line)
+{
+    QByteArray data = line.toUtf8() + '\n';
+    for (QLocalSocket* client : clients)
+        client->write(data);
+}
+
+QString Headless::escape(const QString &text)
+{
+    QString escaped = text;
+    escaped.replace('\\', "\\\\").replace('\r', "").replace('\n', "\\n");
+    return escaped;
+}
+
+QString Headless::unescape(const QString &text)
+{
+    QString unescaped;
+    unescaped.reserve(text.size());
+    for (int i = 0; i < text.size(); ++i)
+    {
+        if (text[i] != '\\' || i+1 == text.size())
+        {
+            unescaped += text[i];
+            continue;
+        }
+
+        ++i;
+        unescaped += text[i] == 'n' ? QChar('\n') : text[i];
+    }
+    return unescaped;
+}
+
+QString Headless::statusName(Status status)
+{
+    switch (status)
+    {
+    case Status::Online:
+        return "online";
+    case Status::Away:
+        return "away";
+    case Status::Busy:
+        return "busy";
+    default:
+        return "offline";
+    }
+}
@@ -0,0 +1,92 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include "src/core/corestructs.h"
+#include <QHash>
+#include <QList>
+#include <QLocalServer>
+#include <QObject>
+#include <QSet>
+#include <QStringList>
+
+class Profile;
+class CoreEvents;
+class OfflineMsgEngine;
+class QLocalSocket;
+
+/// Runs a profile without any widget, for bots and relays started with --headless
+/// Clients control it with line commands over a local socket, and get the events as lines too
+class Headless : public QObject
+{
+    Q_OBJECT
+public:
+    explicit Headless(Profile* profile);
+    ~Headless();
+
+    /// Opens the control socket, named after the profile unless a name was given
+    bool listen(const QString& name = QString());
+    /// Returns the default name of the control socket of a profile
+    static QString controlSocketName(const QString& profileName);
+
+signals:
+    void statusSet(Status status);
+    void friendRequested(const QString& friendAddress, const QString& message);
+    void friendRequestAccepted(const QString& userId);
+
+public slots:
+    void onConnected();
+    void onDisconnected();
+    void onFailedToStartCore();
+    void onFriendRequestReceived(const QString& userId, const QString& message);
+    void onCoreEvents(const CoreEvents& events);
+    void onReceiptReceived(int friendId, int receipt);
+    void onAvInvite(uint32_t friendId, bool video);
+
+private slots:
+    void onNewClient();
+    void onClientReadyRead();
+
+private:
+    /// Runs a command line of a client, returns the lines of the answer
+    QStringList runCommand(const QString& line);
+    void sendMessage(uint32_t friendId, const QString& message, bool isAction);
+    /// Hands the messages of past sessions that weren't delivered to Core, once per friend
+    void sendPendingMessages(uint32_t friendId);
+    OfflineMsgEngine* getOfflineMsgEngine(uint32_t friendId);
+    /// Sends an event line to every client
+    void broadcast(const QString& line);
+    /// Makes text fit on one line, unescape reverses it
+    static QString escape(const QString& text);
+    static QString unescape(const QString& text);
+    static QString statusName(Status status);
+
+private:
+    Profile* profile;
+    QLocalServer server;
+    QList<QLocalSocket*> clients;
+    QHash<uint32_t, Status> friendStatuses; ///< The last status of each friend we've heard of
+    QHash<uint32_t, OfflineMsgEngine*> offlineEngines; ///< Like the chat forms', so receipts mark the history
+    QSet<uint32_t> pendingMessagesSent; ///< Friends whose undelivered messages were queued this session
+    /// Longest command line we accept, anything longer closes the connection
+    static constexpr int maxLineLength = 64*1024;
+};
+
+#endif // HEADLESS_H
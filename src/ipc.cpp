@@ -21,29 +21,76 @@
 #include "src/persistence/settings.h"
 #include <QCoreApplication>
 #include <QDebug>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QLocalSocket>
 #include <QThread>
 #include <random>
 #include <unistd.h>
 
+namespace
+{
+/**
+@brief State of an event slot, packed with the event id into IPCEvent::seq.
+
+Since ids are never reused, a compare-and-swap on seq can't mistake a recycled slot for the event it saw.
+*/
+enum EventState : uint64_t
+{
+    Free = 0,
+    Writing = 1,
+    Posted = 2,
+    Claimed = 3,
+    Processed = 4,
+};
+
+const int STATE_BITS = 3;
+
+uint64_t makeSeq(uint64_t id, EventState state)
+{
+    return (id << STATE_BITS) | state;
+}
+
+uint64_t seqId(uint64_t seq)
+{
+    return seq >> STATE_BITS;
+}
+
+EventState seqState(uint64_t seq)
+{
+    return static_cast<EventState>(seq & ((1 << STATE_BITS) - 1));
+}
+}
+
 IPC::IPC()
     : globalMemory{"qtox-" IPC_PROTOCOL_VERSION}
 {
     qRegisterMetaType<IPCEventHandler>("IPCEventHandler");
 
-    timer.setInterval(EVENT_TIMER_MS);
+    // Events are only processed when another instance wakes us up, so an idle instance never polls
+    timer.setInterval(0);
     timer.setSingleShot(true);
     connect(&timer, &QTimer::timeout, this, &IPC::processEvents);
+    connect(&wakeupServer, &QLocalServer::newConnection, this, &IPC::onWakeup);
 
     // The first started instance gets to manage the shared memory by taking ownership
-    // Every time it processes events it updates the global shared timestamp "lastProcessed"
-    // If the timestamp isn't updated, that's a timeout and someone else can take ownership
-    // This is a safety measure, in case one of the clients crashes
-    // If the owner exits normally, it can set the timestamp to 0 first to immediately give ownership
+    // Every instance listens on a local socket named after its global ID and registers that ID
+    // in the shared memory. Posting an event connects to the other instances' sockets to wake them,
+    // and processing an event wakes its sender, so nobody has to poll the shared memory
+    // If the owner's socket can't be reached, that's a crash and someone else can take ownership
+    // If the owner exits normally, it sets the owner ID to 0 to immediately give ownership
+    // The global lock only guards the initialization, events are posted and consumed with atomics
 
     std::default_random_engine randEngine((std::random_device())());
     std::uniform_int_distribution<uint64_t> distribution;
     globalId = distribution(randEngine);
     qDebug() << "Our global IPC ID is " << globalId;
+
+    QLocalServer::removeServer(wakeupServerName(globalId));
+    if (!wakeupServer.listen(wakeupServerName(globalId)))
+        qWarning() << "Couldn't listen for IPC wakeups:" << wakeupServer.errorString();
+
+    uint64_t ownerId = globalId;
     if (globalMemory.create(sizeof(IPCMemory)))
     {
         if (globalMemory.lock())
@@ -51,7 +98,7 @@ IPC::IPC()
             IPCMemory* mem = global();
             memset(mem, 0, sizeof(IPCMemory));
             mem->globalId = globalId;
-            mem->lastProcessed = time(0);
+            registerInstance();
             globalMemory.unlock();
         }
         else
@@ -62,6 +109,16 @@ IPC::IPC()
     else if (globalMemory.attach())
     {
         qDebug() << "Attaching to the global shared memory";
+        // Wait for the creator to finish initializing
+        if (globalMemory.lock())
+        {
+            ownerId = global()->globalId;
+            registerInstance();
+            globalMemory.unlock();
+        }
+
+        if (!ownerId || !wakeInstance(ownerId))
+            takeOwnership(ownerId);
     }
     else
     {
@@ -69,19 +126,27 @@ IPC::IPC()
         return; // We won't be able to do any IPC without being attached, let's get outta here
     }
 
-    processEvents();
+    if (!global()->lastEventId.is_lock_free())
+        qWarning() << "64-bit atomics aren't lock-free here, IPC between instances may not work";
+
+    // Pick up the events that were posted before we registered, once the handlers are in
+    timer.start();
 }
 
 IPC::~IPC()
 {
-    if (isCurrentOwner())
+    IPCMemory* mem = global();
+    if (!mem)
+        return;
+
+    for (int i = 0; i < MAX_INSTANCES; ++i)
     {
-        if (globalMemory.lock())
-        {
-            global()->globalId = 0;
-            globalMemory.unlock();
-        }
+        uint64_t self = globalId;
+        mem->instances[i].compare_exchange_strong(self, 0);
     }
+
+    uint64_t owner = globalId;
+    mem->globalId.compare_exchange_strong(owner, 0);
 }
 
 IPC& IPC::getInstance()
@@ -90,7 +155,11 @@ IPC& IPC::getInstance()
     return instance;
 }
 
-time_t IPC::postEvent(const QString &name, const QByteArray& data/*=QByteArray()*/, uint32_t dest/*=0*/)
+/**
+@brief Posts an event to the instance running the dest profile, or to the owner if dest is 0.
+@return The id of the posted event, or 0 if it couldn't be posted.
+*/
+uint64_t IPC::postEvent(const QString &name, const QByteArray& data/*=QByteArray()*/, uint32_t dest/*=0*/)
 {
     QByteArray binName = name.toUtf8();
     if (binName.length() > (int32_t)sizeof(IPCEvent::name))
@@ -99,57 +168,66 @@ time_t IPC::postEvent(const QString &name, const QByteArray& data/*=QByteArray()
     if (data.length() > (int32_t)sizeof(IPCEvent::data))
         return 0;
 
-    if (globalMemory.lock())
+    IPCMemory* mem = global();
+    if (!mem)
     {
-        IPCEvent* evt = 0;
-        IPCMemory* mem = global();
-        time_t result = 0;
-
-        for (uint32_t i = 0; !evt && i < EVENT_QUEUE_SIZE; i++)
-        {
-            if (mem->events[i].posted == 0)
-                evt = &mem->events[i];
-        }
+        qDebug() << "Not attached to the shared memory in postEvent()";
+        return 0;
+    }
 
-        if (evt)
-        {
-            memset(evt, 0, sizeof(IPCEvent));
-            memcpy(evt->name, binName.constData(), binName.length());
-            memcpy(evt->data, data.constData(), data.length());
-            mem->lastEvent = evt->posted = result = qMax(mem->lastEvent + 1, time(0));
-            evt->dest = dest;
-            evt->sender = getpid();
-            qDebug() << "postEvent " << name << "to" << dest;
-        }
-        globalMemory.unlock();
-        return result;
+    const uint64_t id = ++mem->lastEventId;
+    const time_t now = time(0);
+    for (uint32_t i = 0; i < EVENT_QUEUE_SIZE; i++)
+    {
+        IPCEvent* evt = &mem->events[i];
+        uint64_t seq = evt->seq.load(std::memory_order_acquire);
+
+        // Slots of expired events can be reused, so the sending instance had time to react to them
+        // A slot that changed after we looked at it is left to whoever changed it
+        EventState state = seqState(seq);
+        bool reusable = state == Free
+                || (state == Posted && difftime(now, evt->posted) > EVENT_GC_TIMEOUT)
+                || (state == Processed && difftime(now, evt->processed) > EVENT_GC_TIMEOUT);
+        if (!reusable || !evt->seq.compare_exchange_strong(seq, makeSeq(id, Writing), std::memory_order_acquire))
+            continue;
+
+        memset(evt->name, 0, sizeof(evt->name));
+        memcpy(evt->name, binName.constData(), binName.length());
+        memcpy(evt->data, data.constData(), data.length());
+        evt->dataSize = data.length();
+        evt->dest = dest;
+        evt->sender = getpid();
+        evt->senderId = globalId;
+        evt->posted = now;
+        evt->processed = 0;
+        evt->flags = 0;
+        evt->accepted = false;
+        evt->global = false;
+
+        // Fails if a new owner freed the slot because we took too long
+        uint64_t writing = makeSeq(id, Writing);
+        if (!evt->seq.compare_exchange_strong(writing, makeSeq(id, Posted), std::memory_order_release))
+            return 0;
+
+        qDebug() << "postEvent " << name << "to" << dest;
+        wakeInstances(otherInstances());
+        return id;
     }
-    else
-        qDebug() << "Failed to lock in postEvent()";
 
+    qDebug() << "IPC event queue is full in postEvent()";
     return 0;
 }
 
 bool IPC::isCurrentOwner()
 {
-    if (globalMemory.lock())
-    {
-        void* data = globalMemory.data();
-        if (!data)
-        {
-            qWarning() << "isCurrentOwner failed to access the memory, returning false";
-            globalMemory.unlock();
-            return false;
-        }
-        bool isOwner = ((*(uint64_t*)data) == globalId);
-        globalMemory.unlock();
-        return isOwner;
-    }
-    else
+    IPCMemory* mem = global();
+    if (!mem)
     {
-        qWarning() << "isCurrentOwner failed to lock, returning false";
+        qWarning() << "isCurrentOwner failed to access the memory, returning false";
         return false;
     }
+
+    return mem->globalId == globalId;
 }
 
 void IPC::registerEventHandler(const QString &name, IPCEventHandler handler)
@@ -157,65 +235,68 @@ void IPC::registerEventHandler(const QString &name, IPCEventHandler handler)
     eventHandlers[name] = handler;
 }
 
-bool IPC::isEventAccepted(time_t time)
+bool IPC::isEventAccepted(uint64_t id)
 {
-    bool result = false;
-    if (globalMemory.lock())
+    IPCMemory* mem = global();
+    if (!mem || !id)
+        return false;
+
+    for (uint32_t i = 0; i < EVENT_QUEUE_SIZE; i++)
     {
-        if (difftime(global()->lastProcessed, time) > 0)
-        {
-            IPCMemory* mem = global();
-            for (uint32_t i = 0; i < EVENT_QUEUE_SIZE; i++)
-            {
-                if (mem->events[i].posted == time && mem->events[i].processed)
-                {
-                    result = mem->events[i].accepted;
-                    break;
-                }
-            }
-        }
-        globalMemory.unlock();
+        const IPCEvent& evt = mem->events[i];
+        if (evt.seq.load(std::memory_order_acquire) == makeSeq(id, Processed))
+            return evt.accepted;
     }
-    return result;
+    return false;
 }
 
-bool IPC::waitUntilAccepted(time_t postTime, int32_t timeout/*=-1*/)
+/**
+@brief Blocks until the event with the given id was accepted or timeout seconds have passed.
+Sleeps in a local event loop, the instance processing the event wakes us up when it's done.
+*/
+bool IPC::waitUntilAccepted(uint64_t id, int32_t timeout/*=-1*/)
 {
-    bool result = false;
-    time_t start = time(0);
+    QElapsedTimer elapsed;
+    elapsed.start();
+    QEventLoop loop;
+    QTimer deadline;
+    deadline.setSingleShot(true);
+    connect(this, &IPC::woken, &loop, &QEventLoop::quit);
+    connect(&deadline, &QTimer::timeout, &loop, &QEventLoop::quit);
+
     forever
     {
-        result = isEventAccepted(postTime);
-        if (result || (timeout > 0 && difftime(time(0), start) >= timeout))
-            break;
+        if (isEventAccepted(id))
+            return true;
+
+        if (timeout > 0)
+        {
+            qint64 remaining = timeout * 1000ll - elapsed.elapsed();
+            if (remaining <= 0)
+                return false;
 
-        qApp->processEvents();
-        QThread::msleep(0);
+            deadline.start(static_cast<int>(remaining));
+        }
+
+        loop.exec();
     }
-    return result;
 }
 
-IPC::IPCEvent *IPC::fetchEvent()
+bool IPC::claimEvent(IPCEvent* evt, uint64_t& id)
 {
-    IPCMemory* mem = global();
-    for (uint32_t i = 0; i < EVENT_QUEUE_SIZE; i++)
-    {
-        IPCEvent* evt = &mem->events[i];
+    uint64_t seq = evt->seq.load(std::memory_order_acquire);
+    if (seqState(seq) != Posted)
+        return false;
 
-        // Garbage-collect events that were not processed in EVENT_GC_TIMEOUT
-        // and events that were processed and EVENT_GC_TIMEOUT passed after
-        // so sending instance has time to react to those events.
-        if ((evt->processed && difftime(time(0), evt->processed) > EVENT_GC_TIMEOUT) ||
-            (!evt->processed && difftime(time(0), evt->posted) > EVENT_GC_TIMEOUT))
-            memset(evt, 0, sizeof(IPCEvent));
+    // Events that were not processed in EVENT_GC_TIMEOUT are dropped
+    if (difftime(time(0), evt->posted) > EVENT_GC_TIMEOUT || evt->sender == getpid())
+        return false;
 
-        if (evt->posted && !evt->processed && evt->sender != getpid())
-        {
-            if (evt->dest == Settings::getInstance().getCurrentProfileId() || (evt->dest == 0 && isCurrentOwner()))
-                return evt;
-        }
-    }
-    return 0;
+    if (evt->dest != Settings::getInstance().getCurrentProfileId() && (evt->dest != 0 || !isCurrentOwner()))
+        return false;
+
+    id = seqId(seq);
+    return evt->seq.compare_exchange_strong(seq, makeSeq(id, Claimed), std::memory_order_acquire);
 }
 
 bool IPC::runEventHandler(IPCEventHandler handler, const QByteArray& arg)
@@ -239,55 +320,144 @@ bool IPC::runEventHandler(IPCEventHandler handler, const QByteArray& arg)
 
 void IPC::processEvents()
 {
-    if (globalMemory.lock())
-    {
-        IPCMemory* mem = global();
+    IPCMemory* mem = global();
+    if (!mem)
+        return;
 
-        if (mem->globalId == globalId)
+    // Only the owner processes global events. But if the previous owner exited, we can take ownership now
+    // Non-main instance is limited to events destined for specific profile it runs
+    uint64_t noOwner = 0;
+    if (mem->globalId.compare_exchange_strong(noOwner, globalId))
+        qDebug() << "Previous owner exited, taking ownership" << globalId;
+
+    QVector<uint64_t> senderIds;
+    for (uint32_t i = 0; i < EVENT_QUEUE_SIZE; i++)
+    {
+        IPCEvent* evt = &mem->events[i];
+        uint64_t id;
+        if (!claimEvent(evt, id))
+            continue;
+
+        QString name = QString::fromUtf8(evt->name, qstrnlen(evt->name, sizeof(evt->name)));
+        const uint64_t senderId = evt->senderId;
+        bool processed = false;
+        auto it = eventHandlers.find(name);
+        if (it != eventHandlers.end())
         {
-            // We're the owner, let's process those events
-            mem->lastProcessed = time(0);
+            qDebug() << "Processing event: " << name << ":" << id;
+            evt->accepted = runEventHandler(it.value(), QByteArray(evt->data, evt->dataSize));
+            // Global events should be processed only by instance that accepted event. Otherwise global
+            // event would be consumed by very first instance that gets to check it.
+            processed = evt->dest != 0 || evt->accepted;
+            if (processed)
+                evt->processed = time(0);
         }
-        else
+
+        // Unprocessed events go back to the queue for the other instances
+        uint64_t claimed = makeSeq(id, Claimed);
+        if (evt->seq.compare_exchange_strong(claimed, makeSeq(id, processed ? Processed : Posted),
+                                             std::memory_order_release)
+            && processed && !senderIds.contains(senderId))
         {
-            // Only the owner processes events. But if the previous owner's dead, we can take ownership now
-            if (difftime(time(0), mem->lastProcessed) >= OWNERSHIP_TIMEOUT_S)
-            {
-                qDebug() << "Previous owner timed out, taking ownership" << mem->globalId << "->" << globalId;
-                // Ignore events that were not meant for this instance
-                memset(mem, 0, sizeof(IPCMemory));
-                mem->globalId = globalId;
-                mem->lastProcessed = time(0);
-            }
-            // Non-main instance is limited to events destined for specific profile it runs
+            senderIds.append(senderId);
         }
+    }
 
-        while (IPCEvent* evt = fetchEvent())
-        {
-            QString name = QString::fromUtf8(evt->name);
-            auto it = eventHandlers.find(name);
-            if (it != eventHandlers.end())
-            {
-                qDebug() << "Processing event: " << name << ":" << evt->posted << "=" << evt->accepted;
-                evt->accepted = runEventHandler(it.value(), evt->data);
-                if (evt->dest == 0)
-                {
-                    // Global events should be processed only by instance that accepted event. Otherwise global
-                    // event would be consumed by very first instance that gets to check it.
-                    if (evt->accepted)
-                        evt->processed = time(0);
-                }
-                else
-                {
-                    evt->processed = time(0);
-                }
-            }
+    // Let the senders know their events were processed
+    wakeInstances(senderIds);
+}
 
-        }
+void IPC::onWakeup()
+{
+    while (QLocalSocket* socket = wakeupServer.nextPendingConnection())
+        socket->deleteLater();
 
-        globalMemory.unlock();
-    }
     timer.start();
+    emit woken();
+}
+
+void IPC::registerInstance()
+{
+    IPCMemory* mem = global();
+    for (int i = 0; i < MAX_INSTANCES; ++i)
+    {
+        uint64_t freeSlot = 0;
+        if (mem->instances[i].compare_exchange_strong(freeSlot, globalId))
+            return;
+    }
+
+    qWarning() << "Too many running instances, we won't be woken up for events";
+}
+
+QVector<uint64_t> IPC::otherInstances()
+{
+    QVector<uint64_t> ids;
+    IPCMemory* mem = global();
+    for (int i = 0; i < MAX_INSTANCES; ++i)
+    {
+        uint64_t id = mem->instances[i];
+        if (id && id != globalId)
+            ids.append(id);
+    }
+    return ids;
+}
+
+/**
+@brief Takes ownership of the shared memory, unless previousOwner already passed it to someone else.
+*/
+void IPC::takeOwnership(uint64_t previousOwner)
+{
+    IPCMemory* mem = global();
+    if (!mem->globalId.compare_exchange_strong(previousOwner, globalId))
+        return;
+
+    qDebug() << "Previous owner is gone, taking ownership" << previousOwner << "->" << globalId;
+
+    // The previous owner may have crashed while posting or processing, free the slots it left behind
+    for (uint32_t i = 0; i < EVENT_QUEUE_SIZE; i++)
+    {
+        uint64_t seq = mem->events[i].seq.load(std::memory_order_acquire);
+        EventState state = seqState(seq);
+        if (state == Writing || state == Claimed)
+            mem->events[i].seq.compare_exchange_strong(seq, makeSeq(seqId(seq), Free));
+    }
+}
+
+/**
+@brief Wakes up the instance with the given global ID so it processes its events.
+@return False if the instance couldn't be reached, which means it's not running anymore.
+*/
+bool IPC::wakeInstance(uint64_t id)
+{
+    QLocalSocket socket;
+    socket.connectToServer(wakeupServerName(id));
+    bool alive = socket.waitForConnected(WAKEUP_TIMEOUT_MS);
+    socket.abort();
+    return alive;
+}
+
+/**
+@brief Wakes up the given instances and unregisters those that are not running anymore.
+*/
+void IPC::wakeInstances(const QVector<uint64_t>& ids)
+{
+    IPCMemory* mem = global();
+    for (uint64_t id : ids)
+    {
+        if (id == globalId || wakeInstance(id))
+            continue;
+
+        for (int i = 0; i < MAX_INSTANCES; ++i)
+        {
+            uint64_t dead = id;
+            mem->instances[i].compare_exchange_strong(dead, 0);
+        }
+    }
+}
+
+QString IPC::wakeupServerName(uint64_t id)
+{
+    return QStringLiteral("qtox-" IPC_PROTOCOL_VERSION "-") + QString::number(id);
 }
 
 IPC::IPCMemory *IPC::global()
@@ -21,8 +21,10 @@
 #ifndef IPC_H
 #define IPC_H
 
+#include <atomic>
 #include <ctime>
 #include <functional>
+#include <QLocalServer>
 #include <QMap>
 #include <QObject>
 #include <QSharedMemory>
@@ -31,17 +33,18 @@
 
 using IPCEventHandler = std::function<bool (const QByteArray&)>;
 
-#define IPC_PROTOCOL_VERSION "2"
+#define IPC_PROTOCOL_VERSION "4"
 
 class IPC : public QObject
 {
     Q_OBJECT
     IPC();
 protected:
-    static const int EVENT_TIMER_MS = 1000;
     static const int EVENT_GC_TIMEOUT = 5;
     static const int EVENT_QUEUE_SIZE = 32;
-    static const int OWNERSHIP_TIMEOUT_S = 5;
+    static const int EVENT_DATA_SIZE = 4096;
+    static const int MAX_INSTANCES = 16;
+    static const int WAKEUP_TIMEOUT_MS = 500;
 
 public:
     ~IPC();
@@ -50,46 +53,61 @@ public:
 
     struct IPCEvent
     {
+        // Event id and slot state, only changed by compare-and-swap so a slot has a single writer
+        std::atomic<uint64_t> seq;
         uint32_t dest;
         int32_t sender;
+        uint64_t senderId;
         char name[16];
-        char data[128];
         time_t posted;
         time_t processed;
         uint32_t flags;
+        uint32_t dataSize;
         bool accepted;
         bool global;
+        char data[IPC::EVENT_DATA_SIZE];
     };
 
     struct IPCMemory
     {
-        uint64_t globalId;
-        // When last event was posted
-        time_t lastEvent;
-        // When processEvents() ran last time
-        time_t lastProcessed;
+        std::atomic<uint64_t> globalId;
+        // Id of the last posted event, ids are never reused
+        std::atomic<uint64_t> lastEventId;
+        // Global IDs of all running instances, 0 for free slots
+        std::atomic<uint64_t> instances[IPC::MAX_INSTANCES];
         IPCEvent events[IPC::EVENT_QUEUE_SIZE];
     };
 
     // dest: Settings::getCurrentProfileId() or 0 (main instance).
-    time_t postEvent(const QString& name, const QByteArray &data=QByteArray(), uint32_t dest=0);
+    uint64_t postEvent(const QString& name, const QByteArray &data=QByteArray(), uint32_t dest=0);
     bool isCurrentOwner();
     void registerEventHandler(const QString& name, IPCEventHandler handler);
-    bool isEventAccepted(time_t time);
-    bool waitUntilAccepted(time_t time, int32_t timeout=-1);
+    bool isEventAccepted(uint64_t id);
+    bool waitUntilAccepted(uint64_t id, int32_t timeout=-1);
+
+signals:
+    void woken();
 
 protected slots:
     void processEvents();
+    void onWakeup();
 
 protected:
     IPCMemory* global();
     bool runEventHandler(IPCEventHandler handler, const QByteArray& arg);
-    // Only called when global memory IS LOCKED, returns 0 if no evnts present
-    IPCEvent* fetchEvent();
+    // Returns false if the event isn't for us, otherwise the slot is ours until it's released
+    bool claimEvent(IPCEvent* evt, uint64_t& id);
+    void registerInstance();
+    QVector<uint64_t> otherInstances();
+    void takeOwnership(uint64_t previousOwner);
+    bool wakeInstance(uint64_t id);
+    void wakeInstances(const QVector<uint64_t>& ids);
+    static QString wakeupServerName(uint64_t id);
 
     QTimer timer;
     uint64_t globalId;
     QSharedMemory globalMemory;
+    QLocalServer wakeupServer;
     QMap<QString, IPCEventHandler> eventHandlers;
 };
 
@@ -0,0 +1,289 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "logwriter.h"
+#include <QByteArray>
+#include <QList>
+#include <QMutex>
+#include <QSemaphore>
+#include <QTime>
+#include <atomic>
+#include <cstring>
+#include <thread>
+
+/**
+@class LogWriter
+@brief Keeps logging from blocking the Core, AV and camera threads.
+
+The threads that log push the raw message on a lock-free multiple producer, single consumer queue
+(Vyukov's intrusive MPSC queue), the writer thread formats and writes them and only flushes the
+file once per batch. The writer sleeps when the queue is empty, a producer only wakes it up
+when it is actually sleeping, so logging a burst costs no system call per message.
+
+Fatal messages are written directly, since Qt aborts as soon as the handler returns.
+*/
+
+namespace
+{
+struct Entry
+{
+    std::atomic<Entry*> next{nullptr};
+    QtMsgType type;
+    int time; ///< Milliseconds since midnight
+    const char* file; ///< From the QMessageLogContext, a string literal or nullptr
+    int line;
+    QString msg;
+};
+
+Entry stub;
+std::atomic<Entry*> head{&stub}; ///< Last pushed entry, producers swap themselves in
+Entry* tail = &stub; ///< Already written, only the writer thread moves it
+std::atomic_bool running{false};
+std::atomic_bool sleeping{false};
+std::atomic_int minimumSeverity{0};
+QSemaphore wakeUp;
+
+QMutex writeLock; ///< Serializes the writer thread with direct writes, uncontended otherwise
+FILE* logFile = nullptr;
+#ifdef LOG_TO_FILE
+bool fileSet = false;
+#else
+bool fileSet = true; ///< There is no log file to wait for
+#endif
+QList<QByteArray> pending; ///< Written before the log file was opened
+
+int severity(QtMsgType type)
+{
+    switch (type)
+    {
+    case QtDebugMsg: return 0;
+#if QT_VERSION >= QT_VERSION_CHECK(5, 5, 0)
+    case QtInfoMsg: return 1;
+#endif
+    case QtWarningMsg: return 2;
+    case QtCriticalMsg: return 3;
+    case QtFatalMsg: return 4;
+    default: return 0;
+    }
+}
+
+QByteArray format(const Entry& entry)
+{
+    QString level;
+    switch (entry.type)
+    {
+        case QtDebugMsg:
+            level = QStringLiteral("Debug");
+            break;
+#if QT_VERSION >= QT_VERSION_CHECK(5, 5, 0)
+        case QtInfoMsg:
+            level = QStringLiteral("Info");
+            break;
+#endif
+        case QtWarningMsg:
+            level = QStringLiteral("Warning");
+            break;
+        case QtCriticalMsg:
+            level = QStringLiteral("Critical");
+            break;
+        case QtFatalMsg:
+            level = QStringLiteral("Fatal");
+            break;
+        default:
+            break;
+    }
+
+    QString line = QStringLiteral("[") + QTime::fromMSecsSinceStartOfDay(entry.time).toString("HH:mm:ss.zzz")
+                 + QStringLiteral("] ") + QString::fromUtf8(entry.file) + QChar(':') + QString::number(entry.line)
+                 + QStringLiteral(" : ") + level + QStringLiteral(": ") + entry.msg + QChar('\n');
+    return line.toUtf8();
+}
+
+/// Needs the writeLock
+void write(const QByteArray& line)
+{
+    fwrite(line.constData(), 1, line.size(), stderr);
+
+    if (!logFile)
+    {
+        if (!fileSet)
+            pending.append(line);
+
+        return;
+    }
+
+    fwrite(line.constData(), 1, line.size(), logFile);
+}
+
+/// Needs the writeLock
+void flushFile()
+{
+    if (logFile)
+        fflush(logFile);
+}
+
+void push(Entry* entry)
+{
+    Entry* previous = head.exchange(entry, std::memory_order_acq_rel);
+    previous->next.store(entry, std::memory_order_release);
+
+    if (sleeping.exchange(false))
+        wakeUp.release();
+}
+
+/// Only called by the writer thread, the returned entry stays the tail until the next pop
+Entry* pop()
+{
+    Entry* next = tail->next.load(std::memory_order_acquire);
+    if (!next)
+        return nullptr;
+
+    if (tail != &stub)
+        delete tail;
+
+    tail = next;
+    return next;
+}
+
+void run()
+{
+    while (true)
+    {
+        {
+            QMutexLocker locker{&writeLock};
+            bool wrote = false;
+            while (Entry* entry = pop())
+            {
+                write(format(*entry));
+                entry->msg = QString();
+                wrote = true;
+            }
+
+            if (wrote)
+                flushFile();
+        }
+
+        if (!running.load(std::memory_order_acquire) && !tail->next.load(std::memory_order_acquire))
+            break;
+
+        sleeping.store(true);
+        if (!tail->next.load(std::memory_order_acquire) && running.load(std::memory_order_acquire))
+            wakeUp.tryAcquire(1, 100);
+        sleeping.store(false);
+    }
+}
+
+/// Stops the thread if main() returned early, before the std::thread is destroyed
+struct WriterThread
+{
+    std::thread thread;
+
+    ~WriterThread()
+    {
+        LogWriter::stop();
+        qInstallMessageHandler(nullptr);
+    }
+} writer;
+}
+
+void LogWriter::start()
+{
+    if (running.exchange(true))
+        return;
+
+    writer.thread = std::thread(run);
+}
+
+void LogWriter::stop()
+{
+    if (!running.exchange(false))
+        return;
+
+    wakeUp.release();
+    writer.thread.join();
+}
+
+void LogWriter::setFile(FILE* file)
+{
+    QMutexLocker locker{&writeLock};
+    logFile = file;
+    fileSet = true;
+
+    if (logFile)
+    {
+        for (const QByteArray& line : pending)
+            fwrite(line.constData(), 1, line.size(), logFile);
+
+        fflush(logFile);
+    }
+
+    pending.clear();
+}
+
+void LogWriter::setMinimumLevel(QtMsgType type)
+{
+    minimumSeverity.store(severity(type), std::memory_order_relaxed);
+}
+
+bool LogWriter::parseLevel(const QString& level, QtMsgType& type)
+{
+    if (level == QLatin1String("debug"))
+        type = QtDebugMsg;
+#if QT_VERSION >= QT_VERSION_CHECK(5, 5, 0)
+    else if (level == QLatin1String("info"))
+        type = QtInfoMsg;
+#endif
+    else if (level == QLatin1String("warning"))
+        type = QtWarningMsg;
+    else if (level == QLatin1String("critical"))
+        type = QtCriticalMsg;
+    else
+        return false;
+
+    return true;
+}
+
+void LogWriter::messageHandler(QtMsgType type, const QMessageLogContext& ctxt, const QString& msg)
+{
+    if (severity(type) < minimumSeverity.load(std::memory_order_relaxed))
+        return;
+
+    // Silence qWarning spam due to bug in QTextBrowser (trying to open a file for base64 images)
+    if (ctxt.function && !strcmp(ctxt.function, "virtual bool QFSFileEngine::open(QIODevice::OpenMode)")
+            && msg == QLatin1String("QFSFileEngine::open: No file name specified"))
+        return;
+
+    Entry* entry = new Entry;
+    entry->type = type;
+    entry->time = QTime::currentTime().msecsSinceStartOfDay();
+    entry->file = ctxt.file;
+    entry->line = ctxt.line;
+    entry->msg = msg;
+
+    if (type == QtFatalMsg || !running.load(std::memory_order_acquire))
+    {
+        QMutexLocker locker{&writeLock};
+        write(format(*entry));
+        flushFile();
+        delete entry;
+        return;
+    }
+
+    push(entry);
+}
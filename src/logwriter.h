@@ -0,0 +1,48 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LOGWRITER_H
+#define LOGWRITER_H
+
+#include <QtGlobal>
+#include <QString>
+#include <cstdio>
+
+class QMessageLogContext;
+
+/// Our Qt message handler, the threads that log only queue their messages
+/// A background thread formats them and writes them to stderr and the log file
+class LogWriter
+{
+public:
+    /// Starts the writer thread, until then messages are written by the thread that logs them
+    static void start();
+    /// Writes what is still queued and stops the thread, call it before closing the log file
+    static void stop();
+    /// Messages logged before the file is set are kept and written to it first, nullptr drops them
+    static void setFile(FILE* file);
+    /// Messages below this level are dropped before anything is done with them
+    static void setMinimumLevel(QtMsgType type);
+    /// Parses "debug", "info", "warning" or "critical", returns false if level is none of them
+    static bool parseLevel(const QString& level, QtMsgType& type);
+
+    static void messageHandler(QtMsgType type, const QMessageLogContext& ctxt, const QString& msg);
+};
+
+#endif // LOGWRITER_H
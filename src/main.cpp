@@ -21,6 +21,9 @@
 #include "persistence/settings.h"
 #include "src/nexus.h"
 #include "src/ipc.h"
+#include "src/trace.h"
+#include "src/memorystats.h"
+#include "src/logwriter.h"
 #include "src/net/toxuri.h"
 #include "src/net/autoupdate.h"
 #include "src/persistence/toxsave.h"
@@ -34,87 +37,18 @@
 #include <QDebug>
 #include <QDir>
 #include <QFile>
-#include <QMutex>
 #include <QFontDatabase>
-#include <QMutexLocker>
+#include <QTextStream>
 
 #include <sodium.h>
 #include <stdio.h>
+#include <cstring>
+#include <memory>
 
 #if defined(Q_OS_OSX)
 #include "platform/install_osx.h"
 #endif
 
-#ifdef LOG_TO_FILE
-static QAtomicPointer<FILE> logFileFile = nullptr;
-static QList<QByteArray>* logBuffer = new QList<QByteArray>();   //Store log messages until log file opened
-QMutex* logBufferMutex = new QMutex();
-#endif
-
-void logMessageHandler(QtMsgType type, const QMessageLogContext& ctxt, const QString& msg)
-{
-    // Silence qWarning spam due to bug in QTextBrowser (trying to open a file for base64 images)
-    if (ctxt.function == QString("virtual bool QFSFileEngine::open(QIODevice::OpenMode)")
-            && msg == QString("QFSFileEngine::open: No file name specified"))
-        return;
-
-    QString LogMsg = QString("[%1] %2:%3 : ")
-                .arg(QTime::currentTime().toString("HH:mm:ss.zzz")).arg(ctxt.file).arg(ctxt.line);
-    switch (type)
-    {
-        case QtDebugMsg:
-            LogMsg += "Debug";
-            break;
-        case QtWarningMsg:
-            LogMsg += "Warning";
-            break;
-        case QtCriticalMsg:
-            LogMsg += "Critical";
-            break;
-        case QtFatalMsg:
-            LogMsg += "Fatal";
-            break;
-        default:
-            break;
-    }
-
-    LogMsg += ": " + msg + "\n";
-    QByteArray LogMsgBytes = LogMsg.toUtf8();
-    fwrite(LogMsgBytes.constData(), 1, LogMsgBytes.size(), stderr);
-
-#ifdef LOG_TO_FILE
-    FILE * logFilePtr = logFileFile.load(); // atomically load the file pointer
-    if (!logFilePtr)
-    {
-        logBufferMutex->lock();
-        if(logBuffer)
-        {
-            logBuffer->append(LogMsgBytes);
-        }
-        logBufferMutex->unlock();
-    }
-    else
-    {
-        logBufferMutex->lock();
-        if(logBuffer)
-        {
-            // empty logBuffer to file
-            foreach(QByteArray msg, *logBuffer)
-            {
-                fwrite(msg.constData(), 1, msg.size(), logFilePtr);
-            }
-
-            delete logBuffer;   // no longer needed
-            logBuffer = nullptr;
-        }
-        logBufferMutex->unlock();
-
-        fwrite(LogMsgBytes.constData(), 1, LogMsgBytes.size(), logFilePtr);
-        fflush(logFilePtr);
-    }
-#endif
-}
-
 int main(int argc, char *argv[])
 {
 
@@ -123,9 +57,20 @@ int main(int argc, char *argv[])
     QGuiApplication::setAttribute(Qt::AA_UseHighDpiPixmaps);
 #endif
 
-    qInstallMessageHandler(logMessageHandler);
+    qInstallMessageHandler(LogWriter::messageHandler);
+    LogWriter::start();
 
-    QApplication a(argc, argv);
+    // The application object must exist before we parse the arguments, but headless we don't want QtWidgets
+    bool headless = false;
+    for (int i = 1; i < argc; ++i)
+        headless = headless || !strcmp(argv[i], "--headless");
+
+    // Without widgets we don't need a display either, unless a platform was asked for
+    if (headless && qgetenv("QT_QPA_PLATFORM").isEmpty())
+        qputenv("QT_QPA_PLATFORM", "minimal");
+
+    std::unique_ptr<QGuiApplication> app{headless ? new QGuiApplication(argc, argv) : new QApplication(argc, argv)};
+    QGuiApplication& a = *app;
     a.setApplicationName("qTox");
     a.setOrganizationName("Tox");
     a.setApplicationVersion("\nGit commit: " + QString(GIT_VERSION));
@@ -146,8 +91,28 @@ int main(int argc, char *argv[])
     parser.addVersionOption();
     parser.addPositionalArgument("uri", QObject::tr("Tox URI to parse"));
     parser.addOption(QCommandLineOption("p", QObject::tr("Starts new instance and loads specified profile."), QObject::tr("profile")));
+    parser.addOption(QCommandLineOption("trace", QObject::tr("Records a performance trace, written to file on exit."), QObject::tr("file")));
+    parser.addOption(QCommandLineOption("memory-log", QObject::tr("Logs the memory held by each subsystem at this interval."), QObject::tr("seconds")));
+    parser.addOption(QCommandLineOption("log-level", QObject::tr("Only logs messages of this level or above: debug, info, warning or critical."), QObject::tr("level")));
+    parser.addOption(QCommandLineOption("headless", QObject::tr("Runs without a GUI, controlled through a local socket. The password of an encrypted profile is read from the standard input.")));
+    parser.addOption(QCommandLineOption("control", QObject::tr("Name of the control socket in headless mode, qtox-headless-<profile> by default."), QObject::tr("name")));
     parser.process(a);
 
+    if (parser.isSet("log-level"))
+    {
+        QtMsgType level;
+        if (LogWriter::parseLevel(parser.value("log-level"), level))
+            LogWriter::setMinimumLevel(level);
+        else
+            qWarning() << "Unknown log level" << parser.value("log-level");
+    }
+
+    if (parser.isSet("trace"))
+        Trace::start();
+
+    if (parser.isSet("memory-log"))
+        MemoryStats::startLogging(parser.value("memory-log").toInt());
+
     IPC& ipc = IPC::getInstance();
 
     if (sodium_init() < 0) // For the auto-updater
@@ -190,7 +155,7 @@ int main(int argc, char *argv[])
     if(!mainLogFilePtr)
         qCritical() << "Couldn't open logfile" << logfile;
 
-    logFileFile.store(mainLogFilePtr);   // atomically set the logFile
+    LogWriter::setFile(mainLogFilePtr);
 #endif
 
     // Windows platform plugins DLL hell fix
@@ -212,10 +177,13 @@ int main(int argc, char *argv[])
 
     QString profileName;
     bool autoLogin = Settings::getInstance().getAutoLogin();
-    // Inter-process communication
-    ipc.registerEventHandler("uri", &toxURIEventHandler);
-    ipc.registerEventHandler("save", &toxSaveEventHandler);
-    ipc.registerEventHandler("activate", &toxActivateEventHandler);
+    // Inter-process communication, the handlers need the GUI so a headless instance leaves the events to others
+    if (!headless)
+    {
+        ipc.registerEventHandler("uri", &toxURIEventHandler);
+        ipc.registerEventHandler("save", &toxSaveEventHandler);
+        ipc.registerEventHandler("activate", &toxActivateEventHandler);
+    }
 
     uint32_t ipcDest = 0;
     QString eventType, firstParam;
@@ -251,9 +219,10 @@ int main(int argc, char *argv[])
         }
     }
 
-    if (!ipc.isCurrentOwner())
+    // A headless instance runs on its own, it doesn't hand its work to the GUI
+    if (!headless && !ipc.isCurrentOwner())
     {
-        time_t event = ipc.postEvent(eventType, firstParam.toUtf8(), ipcDest);
+        uint64_t event = ipc.postEvent(eventType, firstParam.toUtf8(), ipcDest);
         // If someone else processed it, we're done here, no need to actually start qTox
         if (ipc.waitUntilAccepted(event, 2))
         {
@@ -262,8 +231,35 @@ int main(int argc, char *argv[])
         }
     }
 
+    if (headless)
+    {
+        if (!Profile::exists(profileName))
+        {
+            qCritical() << "The profile" << profileName << "doesn't exist, pick one with -p";
+            return EXIT_FAILURE;
+        }
+
+        QString password;
+        if (Profile::isEncrypted(profileName))
+        {
+            qDebug() << "The profile is encrypted, reading its password from the standard input";
+            password = QTextStream(stdin).readLine();
+        }
+
+        Profile* profile = Profile::loadProfile(profileName, password);
+        if (!profile)
+        {
+            qCritical() << "Couldn't load the profile" << profileName;
+            return EXIT_FAILURE;
+        }
+
+        Nexus::getInstance().setProfile(profile);
+        Settings::getInstance().setCurrentProfile(profileName);
+        if (!Nexus::getInstance().startHeadless(parser.value("control")))
+            return EXIT_FAILURE;
+    }
     // Autologin
-    if (autoLogin)
+    else if (autoLogin)
     {
         if (Profile::exists(profileName))
         {
@@ -277,25 +273,36 @@ int main(int argc, char *argv[])
         }
     }
 
-    Nexus::getInstance().start();
+    if (!headless)
+    {
+        Nexus::getInstance().start();
 
-    // Event was not handled by already running instance therefore we handle it ourselves
-    if (eventType == "uri")
-        handleToxURI(firstParam.toUtf8());
-    else if (eventType == "save")
-        handleToxSave(firstParam.toUtf8());
+        // Event was not handled by already running instance therefore we handle it ourselves
+        if (eventType == "uri")
+            handleToxURI(firstParam.toUtf8());
+        else if (eventType == "save")
+            handleToxSave(firstParam.toUtf8());
+    }
 
     // Run
     int errorcode = a.exec();
 
+    if (parser.isSet("trace"))
+    {
+        Trace::stop();
+        Trace::exportJson(parser.value("trace"));
+    }
+
     Nexus::destroyInstance();
     CameraSource::destroyInstance();
     Settings::destroyInstance();
     qDebug() << "Clean exit with status" << errorcode;
 
 #ifdef LOG_TO_FILE
-    logFileFile.store(nullptr);   // atomically disable logging to file
-    fclose(mainLogFilePtr);
+    LogWriter::stop();
+    LogWriter::setFile(nullptr);
+    if (mainLogFilePtr)
+        fclose(mainLogFilePtr);
 #endif
     return errorcode;
 }
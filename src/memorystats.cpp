@@ -0,0 +1,104 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "memorystats.h"
+#include "src/chatlog/documentcache.h"
+#include "src/chatlog/pixmapcache.h"
+#include "src/chatlog/content/filetransferwidget.h"
+#include "src/nexus.h"
+#include "src/persistence/history.h"
+#include "src/persistence/profile.h"
+#include "src/video/videoframe.h"
+#include <QDebug>
+#include <QTimer>
+
+std::atomic<qint64> MemoryStats::objects[MemoryStats::KindCount];
+std::atomic<qint64> MemoryStats::sizes[MemoryStats::KindCount];
+
+namespace
+{
+QString size(qint64 bytes)
+{
+    return FileTransferWidget::getHumanReadableSize(bytes);
+}
+}
+
+MemoryStats::Usage MemoryStats::get(Kind kind)
+{
+    return {objects[kind].load(std::memory_order_relaxed), sizes[kind].load(std::memory_order_relaxed)};
+}
+
+/**
+@brief Reports what the big consumers hold right now, so a growing RSS can be attributed.
+
+The chat lines only count their own objects, the text they hold is in the statistics of each ChatLog.
+*/
+QStringList MemoryStats::report()
+{
+    QStringList lines;
+
+    const Usage chatLines = get(ChatLines);
+    const Usage contents = get(ChatLineContents);
+    lines << QObject::tr("Chat lines: %1 lines of %2, %3 contents")
+             .arg(chatLines.objects).arg(size(chatLines.bytes)).arg(contents.objects);
+
+    const DocumentCache::Statistics docs = DocumentCache::getInstance().getStatistics();
+    lines << QObject::tr("Text documents: %1 free, %2 retained, %3 reused, %4 created, %5 evicted")
+             .arg(docs.free).arg(docs.retained).arg(docs.hits).arg(docs.misses).arg(docs.evictions);
+
+    const PixmapCache::Stats pixmaps = PixmapCache::getInstance().getStats();
+    lines << QObject::tr("Pixmap cache: %1").arg(size(pixmaps.usedKiB * 1024LL));
+
+    const Usage frames = get(VideoFrames);
+    lines << QObject::tr("Video frames: %1 frames of %2, %3 of RGB conversions")
+             .arg(frames.objects).arg(size(frames.bytes)).arg(size(VideoFrame::rgb24CacheBytes()));
+
+    const Usage avatars = get(AvatarBuffers);
+    lines << QObject::tr("Avatar transfers: %1 receiving into %2").arg(avatars.objects).arg(size(avatars.bytes));
+
+    Profile* profile = Nexus::getProfile();
+    History* history = profile ? profile->getHistory() : nullptr;
+    if (history)
+        lines << QObject::tr("History database: %1 transactions waiting").arg(history->pendingWrites());
+
+    return lines;
+}
+
+void MemoryStats::startLogging(int interval)
+{
+    static QTimer* timer = nullptr;
+    if (!interval)
+    {
+        delete timer;
+        timer = nullptr;
+        return;
+    }
+
+    if (!timer)
+    {
+        timer = new QTimer();
+        QObject::connect(timer, &QTimer::timeout, []()
+        {
+            for (const QString& line : report())
+                qDebug("Memory: %s", qPrintable(line));
+        });
+    }
+
+    timer->start(interval * 1000);
+}
@@ -0,0 +1,76 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MEMORYSTATS_H
+#define MEMORYSTATS_H
+
+#include <QStringList>
+#include <atomic>
+
+/// Counts the objects and bytes of the subsystems that can grow large in a long session
+/// Counting is always on and costs an atomic add, the report is only logged when asked for
+class MemoryStats
+{
+public:
+    enum Kind
+    {
+        ChatLines,
+        ChatLineContents,
+        VideoFrames, ///< Bytes of the source buffers, the conversions are counted by VideoFrame
+        AvatarBuffers, ///< Avatars being received, by the capacity of their buffers
+        KindCount
+    };
+
+    struct Usage
+    {
+        qint64 objects;
+        qint64 bytes;
+    };
+
+    static void allocated(Kind kind, qint64 bytes = 0)
+    {
+        objects[kind].fetch_add(1, std::memory_order_relaxed);
+        sizes[kind].fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    static void freed(Kind kind, qint64 bytes = 0)
+    {
+        objects[kind].fetch_sub(1, std::memory_order_relaxed);
+        sizes[kind].fetch_sub(bytes, std::memory_order_relaxed);
+    }
+
+    static void resized(Kind kind, qint64 delta)
+    {
+        sizes[kind].fetch_add(delta, std::memory_order_relaxed);
+    }
+
+    static Usage get(Kind kind);
+
+    /// One line per subsystem, with the caches and queues that keep statistics of their own
+    /// Must be called from the GUI thread, like the caches it reads
+    static QStringList report();
+    /// Logs the report every interval seconds, 0 stops, from the GUI thread
+    static void startLogging(int interval);
+
+private:
+    static std::atomic<qint64> objects[KindCount];
+    static std::atomic<qint64> sizes[KindCount];
+};
+
+#endif // MEMORYSTATS_H
@@ -33,7 +33,11 @@
 #include <QtConcurrent/QtConcurrent>
 #include <QMessageBox>
 #include <QMutexLocker>
+#include <QEventLoop>
+#include <QTimer>
 #include <iostream>
+#include <memory>
+#include <vector>
 
 #ifdef Q_OS_WIN
 #include <windows.h>
@@ -110,12 +114,8 @@ AutoUpdater::VersionInfo AutoUpdater::getUpdateVersion()
     QNetworkAccessManager *manager = new QNetworkAccessManager;
     manager->setProxy(Settings::getInstance().getProxy());
     QNetworkReply* reply = manager->get(QNetworkRequest(QUrl(checkURI)));
-    while (!reply->isFinished())
-    {
-        if (abortFlag)
-            return versionInfo;
-        qApp->processEvents();
-    }
+    if (!waitForReply(reply))
+        return versionInfo;
 
     if (reply->error() != QNetworkReply::NoError)
     {
@@ -225,12 +225,8 @@ QByteArray AutoUpdater::getUpdateFlist()
     QNetworkAccessManager *manager = new QNetworkAccessManager;
     manager->setProxy(Settings::getInstance().getProxy());
     QNetworkReply* reply = manager->get(QNetworkRequest(QUrl(flistURI)));
-    while (!reply->isFinished())
-    {
-        if (abortFlag)
-            return flist;
-        qApp->processEvents();
-    }
+    if (!waitForReply(reply))
+        return flist;
 
     if (reply->error() != QNetworkReply::NoError)
     {
@@ -273,38 +269,273 @@ bool AutoUpdater::isUpToDate(AutoUpdater::UpdateFileMeta fileMeta)
     return true;
 }
 
-AutoUpdater::UpdateFile AutoUpdater::getUpdateFile(UpdateFileMeta fileMeta,
-                                        std::function<void(int,int)> progressCallback)
+bool AutoUpdater::waitForReply(QNetworkReply* reply)
 {
-    UpdateFile file;
-    file.metadata = fileMeta;
-
-    QNetworkAccessManager *manager = new QNetworkAccessManager;
-    manager->setProxy(Settings::getInstance().getProxy());
-    QNetworkReply* reply = manager->get(QNetworkRequest(QUrl(filesURI+fileMeta.id)));
-    QObject::connect(reply, &QNetworkReply::downloadProgress, progressCallback);
-    while (!reply->isFinished())
+    QEventLoop loop;
+    QTimer abortTimer;
+    QObject::connect(reply, &QNetworkReply::finished, &loop, &QEventLoop::quit);
+    QObject::connect(&abortTimer, &QTimer::timeout, [&]()
     {
         if (abortFlag)
-            return file;
-        qApp->processEvents();
-    }
+            loop.quit();
+    });
+    abortTimer.start(abortCheckInterval);
 
-    if (reply->error() != QNetworkReply::NoError)
+    if (!reply->isFinished())
+        loop.exec();
+
+    return !abortFlag;
+}
+
+/**
+@brief Downloads the files of the update, at most maxParallelDownloads at a time.
+
+Each file is written to a ".part" file as it arrives, so it never has to fit in memory,
+and an interrupted download asks the server for the rest of it with a range request.
+The part file is renamed once its signature is verified.
+The signatures are over the whole file, so they can only be checked once it's complete.
+*/
+bool AutoUpdater::downloadFiles(const QList<UpdateFileMeta>& files, const QString& updateDirStr)
+{
+    struct Download
     {
-        qWarning() << "getUpdateFile: network error: " + reply->errorString();
-        reply->deleteLater();
-        manager->deleteLater();
-        return file;
+        UpdateFileMeta meta;
+        QFile part;
+        QNetworkReply* reply = nullptr;
+        quint64 received = 0; ///< Bytes in the part file, including those of previous attempts
+        bool statusChecked = false;
+    };
+
+    std::vector<std::unique_ptr<Download>> downloads;
+    quint64 totalBytes = 0, receivedBytes = 0;
+    for (const UpdateFileMeta& fileMeta : files)
+    {
+        totalBytes += fileMeta.size;
+
+        // Skip files we already have
+        QString path = updateDirStr+fileMeta.installpath;
+        if (QFileInfo(path).exists() && QFileInfo(path).size() == (qint64)fileMeta.size)
+        {
+            qDebug() << "Skipping already downloaded file   '" + fileMeta.installpath+ "'";
+            receivedBytes += fileMeta.size;
+            continue;
+        }
+
+        // Create subdirs if necessary
+        QString fileDirStr{QFileInfo(path).absolutePath()};
+        if (!QDir(fileDirStr).exists())
+            QDir().mkpath(fileDirStr);
+
+        std::unique_ptr<Download> download{new Download};
+        download->meta = fileMeta;
+        download->part.setFileName(path+".part");
+        downloads.push_back(std::move(download));
     }
 
-    file.data = reply->readAll();
-    reply->deleteLater();
-    manager->deleteLater();
+    auto updateProgress = [&]()
+    {
+        if (totalBytes)
+            progressValue = 1 + 99.f * receivedBytes / totalBytes;
+    };
+    updateProgress();
 
-    return file;
-}
+    QNetworkAccessManager manager;
+    manager.setProxy(Settings::getInstance().getProxy());
+    QEventLoop loop;
+    bool failed = false;
+    size_t next = 0;
+    int running = 0;
+
+    auto fail = [&]()
+    {
+        if (failed)
+            return;
+
+        failed = true;
+        for (const std::unique_ptr<Download>& download : downloads)
+        {
+            if (download->reply)
+                download->reply->abort();
+        }
+        loop.quit();
+    };
+
+    // Checks the complete part file and moves it in place
+    auto finishDownload = [&](Download& download) -> bool
+    {
+        const UpdateFileMeta& meta = download.meta;
+        if (download.received != meta.size)
+        {
+            qCritical() << "downloadUpdate: Truncated file '" + meta.installpath + "', aborting...";
+            return false;
+        }
+
+        download.part.flush();
+        uchar* data = meta.size ? download.part.map(0, meta.size) : nullptr;
+        QByteArray buffer;
+        if (!data)
+        {
+            download.part.seek(0);
+            buffer = download.part.readAll();
+        }
+
+        const unsigned char* msg = data ? data : (const unsigned char*)buffer.constData();
+        const bool valid = crypto_sign_verify_detached(meta.sig, msg, meta.size, key) == 0;
+        if (data)
+            download.part.unmap(data);
+        download.part.close();
 
+        if (!valid)
+        {
+            qCritical() << "downloadUpdate: RECEIVED FORGED FILE, aborting...";
+            download.part.remove();
+            return false;
+        }
+
+        const QString path = updateDirStr+meta.installpath;
+        QFile::remove(path);
+        if (!download.part.rename(path))
+        {
+            qCritical() << "downloadUpdate: Can't save new update file, aborting...";
+            return false;
+        }
+
+        return true;
+    };
+
+    std::function<void()> startNext = [&]()
+    {
+        while (!failed && running < maxParallelDownloads && next < downloads.size())
+        {
+            Download& download = *downloads[next++];
+            if (!download.part.open(QIODevice::ReadWrite))
+            {
+                qCritical() << "downloadUpdate: Can't save new update file, aborting...";
+                fail();
+                return;
+            }
+
+            // Resume from what a previous attempt left, unless it can't be part of this file
+            download.received = download.part.size();
+            if (download.received > download.meta.size)
+            {
+                download.part.resize(0);
+                download.received = 0;
+            }
+            download.part.seek(download.received);
+            receivedBytes += download.received;
+
+            if (download.received == download.meta.size)
+            {
+                if (!finishDownload(download))
+                {
+                    fail();
+                    return;
+                }
+                continue;
+            }
+
+            QNetworkRequest request{QUrl(filesURI+download.meta.id)};
+            if (download.received)
+            {
+                request.setRawHeader("Range", "bytes=" + QByteArray::number(download.received) + "-");
+                qDebug() << "Resuming '" + download.meta.installpath + "' at" << download.received << "bytes ...";
+            }
+            else
+            {
+                qDebug() << "Downloading '" + download.meta.installpath + "' ...";
+            }
+
+            QNetworkReply* reply = manager.get(request);
+            download.reply = reply;
+            ++running;
+
+            Download* downloadPtr = &download;
+            QObject::connect(reply, &QNetworkReply::readyRead, [&, downloadPtr]()
+            {
+                Download& current = *downloadPtr;
+                if (!current.statusChecked)
+                {
+                    current.statusChecked = true;
+                    // The server may ignore the range and send the whole file
+                    int status = current.reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+                    if (current.received && status != 206)
+                    {
+                        current.part.resize(0);
+                        current.part.seek(0);
+                        receivedBytes -= current.received;
+                        current.received = 0;
+                    }
+                }
+
+                QByteArray chunk = current.reply->readAll();
+                if (current.received + chunk.size() > current.meta.size)
+                {
+                    qCritical() << "downloadUpdate: File '" + current.meta.installpath + "' is too large, aborting...";
+                    current.part.close();
+                    current.part.remove();
+                    fail();
+                    return;
+                }
+
+                if (current.part.write(chunk) != chunk.size())
+                {
+                    qCritical() << "downloadUpdate: Can't save new update file, aborting...";
+                    fail();
+                    return;
+                }
+
+                current.received += chunk.size();
+                receivedBytes += chunk.size();
+                updateProgress();
+            });
+
+            QObject::connect(reply, &QNetworkReply::finished, [&, downloadPtr]()
+            {
+                Download& current = *downloadPtr;
+                QNetworkReply* finished = current.reply;
+                current.reply = nullptr;
+                finished->deleteLater();
+                --running;
+
+                if (failed)
+                    return;
+
+                if (finished->error() != QNetworkReply::NoError)
+                {
+                    qCritical() << "downloadUpdate: Error downloading a file, aborting..." << finished->errorString();
+                    fail();
+                    return;
+                }
+
+                if (!finishDownload(current))
+                {
+                    fail();
+                    return;
+                }
+
+                startNext();
+            });
+        }
+
+        if (!running)
+            loop.quit();
+    };
+
+    QTimer abortTimer;
+    QObject::connect(&abortTimer, &QTimer::timeout, [&]()
+    {
+        if (abortFlag)
+            fail();
+    });
+    abortTimer.start(abortCheckInterval);
+
+    startNext();
+    if (!failed && running)
+        loop.exec();
+
+    return !failed && !abortFlag;
+}
 
 bool AutoUpdater::downloadUpdate()
 {
@@ -358,67 +589,9 @@ bool AutoUpdater::downloadUpdate()
 
     progressValue = 1;
 
-    // Download and write each new file
-    for (UpdateFileMeta fileMeta : diff)
-    {
-        float initialProgress = progressValue, step = 99./diff.size();
-        auto stepProgressCallback = [&](int current, int total)
-        {
-            progressValue = initialProgress + step * (float)current/total;
-        };
-
-        if (abortFlag)
-        {
-            isDownloadingUpdate = false;
-            return false;
-        }
-
-        // Skip files we already have
-        QFile fileFile(updateDirStr+fileMeta.installpath);
-        if (fileFile.open(QIODevice::ReadOnly) && fileFile.size() == (qint64)fileMeta.size)
-        {
-            qDebug() << "Skipping already downloaded file   '" + fileMeta.installpath+ "'";
-            fileFile.close();
-            progressValue = initialProgress + step;
-            continue;
-        }
-
-        qDebug() << "Downloading '" + fileMeta.installpath + "' ...";
-
-        // Create subdirs if necessary
-        QString fileDirStr{QFileInfo(updateDirStr+fileMeta.installpath).absolutePath()};
-        if (!QDir(fileDirStr).exists())
-            QDir().mkpath(fileDirStr);
-
-        // Download
-        UpdateFile file = getUpdateFile(fileMeta, stepProgressCallback);
-        if (abortFlag)
-            goto fail;
-        if (file.data.isNull())
-        {
-            qCritical() << "downloadUpdate: Error downloading a file, aborting...";
-            goto fail;
-        }
-
-        // Check signature
-        if (crypto_sign_verify_detached(file.metadata.sig, (unsigned char*)file.data.data(),
-                                        file.data.size(), key) != 0)
-        {
-            qCritical() << "downloadUpdate: RECEIVED FORGED FILE, aborting...";
-            goto fail;
-        }
-
-        // Save
-        if (!fileFile.open(QIODevice::WriteOnly | QIODevice::Truncate))
-        {
-            qCritical() << "downloadUpdate: Can't save new update file, aborting...";
-            goto fail;
-        }
-        fileFile.write(file.data);
-        fileFile.close();
-
-        progressValue = initialProgress + step;
-    }
+    // Download and write the new files
+    if (!downloadFiles(diff, updateDirStr))
+        goto fail;
 
     qDebug() << "downloadUpdate: The update is ready, it'll be installed on the next restart";
 
@@ -28,6 +28,8 @@
 #include <atomic>
 #include <functional>
 
+class QNetworkReply;
+
 /// For now we only support auto updates on Windows and OS X, although extending it is not a technical issue.
 /// Linux users are expected to use their package managers or update manually through official channels.
 #ifdef Q_OS_WIN
@@ -58,12 +60,6 @@ public:
         }
     };
 
-    struct UpdateFile
-    {
-        UpdateFileMeta metadata;
-        QByteArray data;
-    };
-
     struct VersionInfo
     {
         uint64_t timestamp;
@@ -110,10 +106,12 @@ protected:
     static QList<UpdateFileMeta> genUpdateDiff(QList<UpdateFileMeta> updateFlist);
     /// Checks if we have an up to date version of this file locally installed
     static bool isUpToDate(UpdateFileMeta file);
-    /// Tries to fetch the file from the update server. Returns a file with a null QByteArray on error.
-    /// Note that a file with an empty but non-null QByteArray is not an error, merely a file of size 0.
-    /// Will try to follow qTox's proxy settings, may block and processEvents
-    static UpdateFile getUpdateFile(UpdateFileMeta fileMeta, std::function<void(int,int)> progressCallback);
+    /// Downloads the files into the update dir, several at once, and checks their signatures
+    /// Interrupted downloads resume where they stopped. Returns false on error or abort
+    /// Will try to follow qTox's proxy settings, blocks in an event loop
+    static bool downloadFiles(const QList<UpdateFileMeta>& files, const QString& updateDirStr);
+    /// Waits for the reply in an event loop, returns false if the updates were aborted meanwhile
+    static bool waitForReply(QNetworkReply* reply);
     /// Does the actual work for checkUpdatesAsyncInteractive
     /// Blocking, but otherwise has the same properties than checkUpdatesAsyncInteractive
     static void checkUpdatesAsyncInteractiveWorker();
@@ -132,6 +130,8 @@ private:
     static const QString filesURI; ///< URI of the actual files of the latest version
     static const QString updaterBin; ///< Path to the qtox-updater binary
     static unsigned char key[];
+    static constexpr int maxParallelDownloads = 4;
+    static constexpr int abortCheckInterval = 100; ///< In ms, how often the event loops check the abortFlag
     static std::atomic_bool abortFlag; ///< If true, try to abort everything.
     static std::atomic_bool isDownloadingUpdate; ///< We'll pretend there's no new update available if we're already updating
     static std::atomic<float> progressValue;
@@ -24,6 +24,7 @@
 #include <QDebug>
 
 QByteArray AvatarBroadcaster::avatarData;
+QByteArray AvatarBroadcaster::avatarHash;
 QMap<uint32_t, bool> AvatarBroadcaster::friendsSentTo;
 
 static QMetaObject::Connection autoBroadcastConn;
@@ -37,8 +38,15 @@ void AvatarBroadcaster::setAvatar(QByteArray data)
     if (avatarData == data)
         return;
     avatarData = data;
+    avatarHash.clear();
+    if (!data.isEmpty())
+    {
+        avatarHash.resize(TOX_HASH_LENGTH);
+        tox_hash((uint8_t*)avatarHash.data(), (const uint8_t*)data.constData(), data.size());
+    }
     friendsSentTo.clear();
 
+    // Core queues them and only offers a few at a time
     QVector<uint32_t> friends = Core::getInstance()->getFriendList();
     for (uint32_t friendId : friends)
         sendAvatarTo(friendId);
@@ -50,7 +58,7 @@ void AvatarBroadcaster::sendAvatarTo(uint32_t friendId)
         return;
     if (!Core::getInstance()->isFriendOnline(friendId))
         return;
-    Core::getInstance()->sendAvatarFile(friendId, avatarData);
+    Core::getInstance()->sendAvatarFile(friendId, avatarData, avatarHash);
     friendsSentTo[friendId] = true;
 }
 
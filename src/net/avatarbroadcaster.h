@@ -42,6 +42,7 @@ public:
 
 private:
     static QByteArray avatarData;
+    static QByteArray avatarHash; ///< Hashed once per avatar, not once per friend
     static QMap<uint32_t, bool> friendsSentTo;
 };
 
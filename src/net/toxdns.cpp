@@ -22,7 +22,8 @@
 #include "src/core/cdata.h"
 #include <QMessageBox>
 #include <QCoreApplication>
-#include <QThread>
+#include <QEventLoop>
+#include <QTimer>
 #include <QDebug>
 #include <tox/tox.h>
 #include <tox/toxdns.h>
@@ -41,6 +42,9 @@ const ToxDNS::tox3_server ToxDNS::pinnedServers[]
                   0x69, 0x8A, 0x60, 0xA5, 0x5F, 0x6D, 0x88, 0x02, 0x8F, 0x94, 0x9F, 0x66, 0x14, 0x4F, 0x4F, 0x25 }}
 };
 
+QHash<QString, ToxDNS::CacheEntry<ToxId>> ToxDNS::resolvedCache;
+QHash<QString, ToxDNS::CacheEntry<QByteArray>> ToxDNS::serverKeyCache;
+
 void ToxDNS::showWarning(const QString &message)
 {
     QMessageBox warning;
@@ -57,15 +61,19 @@ QByteArray ToxDNS::fetchLastTextRecord(const QString& record, bool silent)
     QDnsLookup dns;
     dns.setType(QDnsLookup::TXT);
     dns.setName(record);
+
+    // Sleep in the event loop until the answer or the timeout, instead of polling
+    QEventLoop loop;
+    QTimer timeout;
+    timeout.setSingleShot(true);
+    connect(&dns, &QDnsLookup::finished, &loop, &QEventLoop::quit);
+    connect(&timeout, &QTimer::timeout, &loop, &QEventLoop::quit);
     dns.lookup();
+    timeout.start(lookupTimeout);
+    if (!dns.isFinished())
+        loop.exec();
 
-    int timeout;
-    for (timeout = 0; timeout<30 && !dns.isFinished(); ++timeout)
-    {
-        qApp->processEvents();
-        QThread::msleep(100);
-    }
-    if (timeout >= 30)
+    if (!dns.isFinished())
     {
         dns.abort();
         if (!silent)
@@ -205,29 +213,53 @@ ToxId ToxDNS::resolveToxAddress(const QString &address, bool silent)
     }
     else
     {
+        const QDateTime now = QDateTime::currentDateTimeUtc();
+        auto cached = resolvedCache.constFind(address);
+        if (cached != resolvedCache.constEnd() && cached->expires > now)
+            return cached->value;
+
         // If we're querying one of our pinned server, do a toxdns3 request directly
         QString servname = address.mid(address.indexOf('@')+1);
+        bool pinned = false;
         for (const ToxDNS::tox3_server& pin : ToxDNS::pinnedServers)
         {
             if (servname == pin.name)
             {
                 toxId = ToxId(queryTox3(pin, address, silent));
-                return toxId;
+                pinned = true;
+                break;
             }
         }
 
         // Otherwise try toxdns3 if we can get a pubkey or fallback to toxdns1
-        QByteArray pubkey = fetchLastTextRecord("_tox."+servname, true);
-        if (!pubkey.isEmpty())
+        if (!pinned)
         {
-            pubkey = QByteArray::fromHex(pubkey);
+            QByteArray pubkey;
+            auto cachedKey = serverKeyCache.constFind(servname);
+            if (cachedKey != serverKeyCache.constEnd() && cachedKey->expires > now)
+            {
+                pubkey = cachedKey->value;
+            }
+            else
+            {
+                pubkey = QByteArray::fromHex(fetchLastTextRecord("_tox."+servname, true));
+                if (!pubkey.isEmpty())
+                    serverKeyCache[servname] = {pubkey, now.addSecs(cacheTtl)};
+            }
 
-            QByteArray servnameData = servname.toUtf8();
-            ToxDNS::tox3_server server;
-            server.name = servnameData.data();
-            server.pubkey = (uint8_t*)pubkey.data();
-            toxId = ToxId(queryTox3(server, address, silent));
+            if (!pubkey.isEmpty())
+            {
+                QByteArray servnameData = servname.toUtf8();
+                ToxDNS::tox3_server server;
+                server.name = servnameData.data();
+                server.pubkey = (uint8_t*)pubkey.data();
+                toxId = ToxId(queryTox3(server, address, silent));
+            }
         }
+
+        if (!toxId.toString().isEmpty())
+            resolvedCache[address] = {toxId, now.addSecs(cacheTtl)};
+
         return toxId;
     }
 }
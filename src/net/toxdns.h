@@ -24,6 +24,8 @@
 #include "src/core/corestructs.h"
 #include "src/core/toxid.h"
 #include <QDnsLookup>
+#include <QDateTime>
+#include <QHash>
 #include <QObject>
 
 /// Handles tox1 and tox3 DNS queries
@@ -52,12 +54,25 @@ protected:
 
 private:
     /// Try to fetch the first entry of the given TXT record
-    /// Returns an empty object on failure. May block for up to ~3s
+    /// Returns an empty object on failure. Processes events while waiting, for up to ~3s
     /// May display message boxes on error if silent if false
     static QByteArray fetchLastTextRecord(const QString& record, bool silent=true);
 
 public:
     static const tox3_server pinnedServers[4];
+
+private:
+    template <typename T>
+    struct CacheEntry
+    {
+        T value;
+        QDateTime expires;
+    };
+
+    static constexpr int lookupTimeout = 3000; ///< In ms
+    static constexpr int cacheTtl = 10 * 60; ///< In seconds, only successful lookups are cached
+    static QHash<QString, CacheEntry<ToxId>> resolvedCache; ///< By address
+    static QHash<QString, CacheEntry<QByteArray>> serverKeyCache; ///< By server name, for the unpinned servers
 };
 
 #endif // QTOXDNS_H
@@ -23,65 +23,87 @@
 #include <QtDebug>
 #include <QNetworkAccessManager>
 #include <QNetworkReply>
+#include <QNetworkProxy>
 #include <QCoreApplication>
-#include <QThread>
+#include <QPointer>
 #include <sodium/crypto_box.h>
 #include <sodium/randombytes.h>
 #include <string>
 #include <ctime>
 
-QByteArray Toxme::makeJsonRequest(QString url, QString json, QNetworkReply::NetworkError &error)
+QHash<QString, Toxme::CacheEntry<QByteArray>> Toxme::pubkeyCache;
+QHash<QString, Toxme::CacheEntry<ToxId>> Toxme::lookupCache;
+QHash<QString, QList<Toxme::LookupCallback>> Toxme::pendingLookups;
+
+/**
+@brief Returns the manager shared by all the requests, so they can reuse the server connections.
+*/
+QNetworkAccessManager& Toxme::networkManager()
 {
-    if (error)
-        return QByteArray();
+    static QNetworkAccessManager* netman = new QNetworkAccessManager(qApp);
+
+    // Changing the proxy drops the cached connections, so only do it when it really changed
+    const QNetworkProxy proxy = Settings::getInstance().getProxy();
+    if (netman->proxy() != proxy)
+        netman->setProxy(proxy);
+
+    return *netman;
+}
 
-    QNetworkAccessManager netman;
-    netman.setProxy(Settings::getInstance().getProxy());
+void Toxme::makeJsonRequest(QString url, QByteArray json, ReplyCallback callback)
+{
     QNetworkRequest request{url};
     request.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
-    QNetworkReply* reply = netman.post(request, json.toUtf8());
+    QNetworkReply* reply = networkManager().post(request, json);
 
-    while (!reply->isFinished())
+    QObject::connect(reply, &QNetworkReply::finished, [reply, callback]()
     {
-        QThread::msleep(1);
-        qApp->processEvents();
-    }
+        reply->deleteLater();
+        if (reply->error())
+            qWarning() << "makeJsonRequest: A network error occured:" << reply->errorString();
 
-    QByteArray result = reply->readAll();
-    delete reply;
-    return result;
+        callback(reply->readAll(), reply->error());
+    });
 }
 
-QByteArray Toxme::getServerPubkey(QString url, QNetworkReply::NetworkError &error)
+void Toxme::getServerPubkey(QString url, ReplyCallback callback)
 {
-    if (error)
-        return QByteArray();
+    auto cached = pubkeyCache.constFind(url);
+    if (cached != pubkeyCache.constEnd() && cached->expires > QDateTime::currentDateTimeUtc())
+    {
+        callback(cached->value, QNetworkReply::NoError);
+        return;
+    }
 
     // Get key
-    QNetworkAccessManager netman;
-    netman.setProxy(Settings::getInstance().getProxy());
     QNetworkRequest request{url};
     request.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
-    QNetworkReply* reply = netman.get(request);
-
-    while (!reply->isFinished())
-    {
-        QThread::msleep(1);
-        qApp->processEvents();
-    }
+    QNetworkReply* reply = networkManager().get(request);
 
-    error = reply->error();
-    if (error)
+    QObject::connect(reply, &QNetworkReply::finished, [reply, url, callback]()
     {
-        qWarning() << "getServerPubkey: A network error occured:" << reply->errorString();
-        return QByteArray();
-    }
+        reply->deleteLater();
+        QNetworkReply::NetworkError error = reply->error();
+        if (error)
+        {
+            qWarning() << "getServerPubkey: A network error occured:" << reply->errorString();
+            callback(QByteArray(), error);
+            return;
+        }
+
+        QByteArray key = parseServerPubkey(reply->readAll());
+        if (!key.isEmpty())
+            pubkeyCache[url] = {key, QDateTime::currentDateTimeUtc().addSecs(pubkeyTtl)};
+
+        callback(key, error);
+    });
+}
 
+QByteArray Toxme::parseServerPubkey(QString json)
+{
     // Extract key
     static const QByteArray pattern{"key\":\""};
 
-    QString json = reply->readAll();
-    delete reply;
     json = json.remove(' ');
     int start = json.indexOf(pattern) + pattern.length();
     int end = json.indexOf("\"", start);
@@ -98,60 +120,105 @@ QByteArray Toxme::getServerPubkey(QString url, QNetworkReply::NetworkError &erro
     return key;
 }
 
-QByteArray Toxme::prepareEncryptedJson(QString url, int action, QString payload)
+/**
+@brief Encrypts the payload for the server, the callback gets an empty result if it couldn't.
+*/
+void Toxme::prepareEncryptedJson(QString url, int action, QString payload, ReplyCallback callback)
 {
     QPair<QByteArray, QByteArray> keypair = Core::getInstance()->getKeypair();
     if (keypair.first.isEmpty() || keypair.second.isEmpty())
     {
         qWarning() << "prepareEncryptedJson: Couldn't get our keypair, aborting";
-        return QByteArray();
+        callback(QByteArray(), QNetworkReply::NoError);
+        return;
     }
 
-    QNetworkReply::NetworkError error = QNetworkReply::NoError;
-    QByteArray key = getServerPubkey(url, error);
-    if (error != QNetworkReply::NoError)
-        return QByteArray();
-
-    QByteArray nonce(crypto_box_NONCEBYTES, 0);
-    randombytes((uint8_t*)nonce.data(), crypto_box_NONCEBYTES);
-
-    QByteArray payloadData = payload.toUtf8();
-    const size_t cypherlen = crypto_box_MACBYTES+payloadData.size();
-    unsigned char* payloadEnc = new unsigned char[cypherlen];
-
-    int cryptResult = crypto_box_easy(payloadEnc,(uint8_t*)payloadData.data(),payloadData.size(),
-                    (uint8_t*)nonce.data(),(unsigned char*)key.constData(),
-                    (uint8_t*)keypair.second.data());
-
-    if (cryptResult != 0) // error
-        return QByteArray();
-
-    QByteArray payloadEncData(reinterpret_cast<char*>(payloadEnc), cypherlen);
-    delete[] payloadEnc;
-
-    const QString json{"{\"action\":"+QString().setNum(action)+","
-                       "\"public_key\":\""+keypair.first.toHex()+"\","
-                       "\"encrypted\":\""+payloadEncData.toBase64()+"\","
-                       "\"nonce\":\""+nonce.toBase64()+"\"}"};
-    return json.toUtf8();
+    getServerPubkey(url, [keypair, action, payload, callback](QByteArray key, QNetworkReply::NetworkError error)
+    {
+        if (error != QNetworkReply::NoError || key.size() != crypto_box_PUBLICKEYBYTES)
+        {
+            callback(QByteArray(), error);
+            return;
+        }
+
+        QByteArray nonce(crypto_box_NONCEBYTES, 0);
+        randombytes((uint8_t*)nonce.data(), crypto_box_NONCEBYTES);
+
+        QByteArray payloadData = payload.toUtf8();
+        QByteArray payloadEncData(crypto_box_MACBYTES+payloadData.size(), 0);
+
+        int cryptResult = crypto_box_easy((uint8_t*)payloadEncData.data(),(uint8_t*)payloadData.data(),payloadData.size(),
+                        (uint8_t*)nonce.data(),(unsigned char*)key.constData(),
+                        (uint8_t*)keypair.second.data());
+
+        if (cryptResult != 0) // error
+        {
+            callback(QByteArray(), QNetworkReply::NoError);
+            return;
+        }
+
+        const QString json{"{\"action\":"+QString().setNum(action)+","
+                           "\"public_key\":\""+keypair.first.toHex()+"\","
+                           "\"encrypted\":\""+payloadEncData.toBase64()+"\","
+                           "\"nonce\":\""+nonce.toBase64()+"\"}"};
+        callback(json.toUtf8(), QNetworkReply::NoError);
+    });
 }
 
-ToxId Toxme::lookup(QString address)
+void Toxme::lookup(QString address, QObject* context, LookupCallback callback)
 {
     // JSON injection ?
     address = address.trimmed();
     address.replace('\\',"\\\\");
     address.replace('"',"\"");
 
+    QPointer<QObject> guard{context};
+    LookupCallback guardedCallback = [guard, callback](ToxId id)
+    {
+        if (guard)
+            callback(id);
+    };
+
+    auto cached = lookupCache.constFind(address);
+    if (cached != lookupCache.constEnd() && cached->expires > QDateTime::currentDateTimeUtc())
+    {
+        guardedCallback(cached->value);
+        return;
+    }
+
+    // Somebody is already looking this address up, the answer will do for us too
+    auto pending = pendingLookups.find(address);
+    if (pending != pendingLookups.end())
+    {
+        pending->append(guardedCallback);
+        return;
+    }
+    pendingLookups[address].append(guardedCallback);
+
     const QString json{"{\"action\":3,\"name\":\""+address+"\"}"};
 
     QString apiUrl = "https://" + address.split(QLatin1Char('@')).last() + "/api";
-    QNetworkReply::NetworkError error = QNetworkReply::NoError;
-    QByteArray response = makeJsonRequest(apiUrl, json, error);
-
-    if (error != QNetworkReply::NoError)
-        return ToxId();
+    makeJsonRequest(apiUrl, json.toUtf8(), [address](QByteArray response, QNetworkReply::NetworkError error)
+    {
+        ToxId id;
+        // Network errors aren't cached, the next try may well work
+        if (error == QNetworkReply::NoError)
+        {
+            id = parseLookup(response);
+            int ttl = lookupTtl;
+            if (id.toString().isEmpty())
+                ttl = failedLookupTtl;
+
+            lookupCache[address] = {id, QDateTime::currentDateTimeUtc().addSecs(ttl)};
+        }
+
+        for (const LookupCallback& callback : pendingLookups.take(address))
+            callback(id);
+    });
+}
 
+ToxId Toxme::parseLookup(QByteArray response)
+{
     static const QByteArray pattern{"tox_id\""};
     const int index = response.indexOf(pattern);
     if (index == -1)
@@ -204,8 +271,8 @@ Toxme::ExecCode Toxme::extractError(QString json)
     return ExecCode(r);
 }
 
-QString Toxme::createAddress(ExecCode &code, QString server, ToxId id, QString address,
-                             bool keepPrivate, QString bio)
+void Toxme::createAddress(QString server, ToxId id, QString address, bool keepPrivate, QString bio,
+                          QObject* context, CreateCallback callback)
 {
     int privacy = keepPrivate ? 0 : 2;
     // JSON injection ?
@@ -229,15 +296,43 @@ QString Toxme::createAddress(ExecCode &code, QString server, ToxId id, QString a
 
     QString pubkeyUrl = server + "/pk";
     QString apiUrl =  server + "/api";
-    QNetworkReply::NetworkError error = QNetworkReply::NoError;
-    QByteArray encrypted = prepareEncryptedJson(pubkeyUrl, 1, payload);
-    QByteArray response = makeJsonRequest(apiUrl, encrypted, error);
-
-    code = extractError(response);
-    if ((code != Ok && code != Updated) || error != QNetworkReply::NoError)
-        return QString();
-
-    return getPass(response, code);
+    QPointer<QObject> guard{context};
+    prepareEncryptedJson(pubkeyUrl, 1, payload,
+                         [apiUrl, guard, callback](QByteArray encrypted, QNetworkReply::NetworkError error)
+    {
+        if (!guard)
+            return;
+
+        if (error != QNetworkReply::NoError)
+        {
+            callback(ServerError, QString());
+            return;
+        }
+        else if (encrypted.isEmpty())
+        {
+            callback(ExecError, QString());
+            return;
+        }
+
+        makeJsonRequest(apiUrl, encrypted, [guard, callback](QByteArray response, QNetworkReply::NetworkError error)
+        {
+            if (!guard)
+                return;
+
+            ExecCode code = extractError(response);
+            if (error != QNetworkReply::NoError)
+                code = ServerError;
+
+            if (code != Ok && code != Updated)
+            {
+                callback(code, QString());
+                return;
+            }
+
+            QString password = getPass(response, code);
+            callback(code, password);
+        });
+    });
 }
 
 QString Toxme::getPass(QString json, ExecCode &code) {
@@ -271,7 +366,7 @@ QString Toxme::getPass(QString json, ExecCode &code) {
     return json;
 }
 
-Toxme::ExecCode Toxme::deleteAddress(QString server, ToxId id)
+void Toxme::deleteAddress(QString server, ToxId id, QObject* context, ExecCallback callback)
 {
     const QString payload{"{\"public_key\":\""+id.toString().left(64)+"\","
                           "\"timestamp\":"+QString().setNum(time(0))+"}"};
@@ -282,10 +377,30 @@ Toxme::ExecCode Toxme::deleteAddress(QString server, ToxId id)
 
     QString pubkeyUrl = server + "/pk";
     QString apiUrl = server + "/api";
-    QNetworkReply::NetworkError error = QNetworkReply::NoError;
-    QByteArray response = makeJsonRequest(apiUrl, prepareEncryptedJson(pubkeyUrl, 2, payload), error);
-
-    return extractError(response);
+    QPointer<QObject> guard{context};
+    prepareEncryptedJson(pubkeyUrl, 2, payload,
+                         [apiUrl, guard, callback](QByteArray encrypted, QNetworkReply::NetworkError error)
+    {
+        if (!guard)
+            return;
+
+        if (error != QNetworkReply::NoError)
+        {
+            callback(ServerError);
+            return;
+        }
+        else if (encrypted.isEmpty())
+        {
+            callback(ExecError);
+            return;
+        }
+
+        makeJsonRequest(apiUrl, encrypted, [guard, callback](QByteArray response, QNetworkReply::NetworkError error)
+        {
+            if (guard)
+                callback(error == QNetworkReply::NoError ? extractError(response) : ServerError);
+        });
+    });
 }
 
 /**
@@ -23,16 +23,18 @@
 
 #include <QString>
 #include <QMap>
-#include <QMutex>
+#include <QHash>
+#include <QDateTime>
 #include <QNetworkReply>
+#include <functional>
 #include <memory>
 #include "src/core/toxid.h"
 
 class QNetworkAccessManager;
 
 /// This class implements a client for the toxme.se API
-/// The class is thread safe
-/// May process events while waiting for blocking calls
+/// All the requests are asynchronous and share one QNetworkAccessManager, so connections are reused
+/// Must only be used from the GUI thread, the callbacks are called from it too
 class Toxme
 {
 public:
@@ -45,31 +47,56 @@ public:
         NoPassword = 4
     };
 
-    /// Converts a toxme.se address to a Tox ID, returns an empty ID on error
-    static ToxId lookup(QString address);
+    using LookupCallback = std::function<void(ToxId)>;
+    using CreateCallback = std::function<void(ExecCode, QString)>;
+    using ExecCallback = std::function<void(ExecCode)>;
+    using ReplyCallback = std::function<void(QByteArray, QNetworkReply::NetworkError)>;
+
+    /// Converts a toxme.se address to a Tox ID, the callback gets an empty ID on error
+    /// Results are cached, and lookups of an address already being looked up share its request
+    /// The callback is not called if context was destroyed in the meantime
+    static void lookup(QString address, QObject* context, LookupCallback callback);
     /// Creates a new toxme.se address associated with a Tox ID.
     /// If keepPrivate, the address will not be published on toxme.se
     /// The bio is a short optional description of yourself if you want to publish your address.
-    /// If it passed without error, return password, else return errorCode in QString
-    static QString createAddress(ExecCode &code, QString server, ToxId id, QString address,
-                              bool keepPrivate=true, QString bio=QString());
+    /// The callback gets Ok and the password, Updated, or the error code
+    static void createAddress(QString server, ToxId id, QString address, bool keepPrivate, QString bio,
+                              QObject* context, CreateCallback callback);
     /// Deletes the address associated with your current Tox ID
-    static ExecCode deleteAddress(QString server, ToxId id);
+    static void deleteAddress(QString server, ToxId id, QObject* context, ExecCallback callback);
     /// Return string of the corresponding error code
     static QString getErrorMessage(int errorCode);
     static QString translateErrorMessage(int errorCode);
 
 private:
     Toxme()=delete;
-    static QByteArray makeJsonRequest(QString url, QString json, QNetworkReply::NetworkError &error);
-    static QByteArray prepareEncryptedJson(QString url, int action, QString payload);
-    static QByteArray getServerPubkey(QString url, QNetworkReply::NetworkError &error);
+    static QNetworkAccessManager& networkManager();
+    static void makeJsonRequest(QString url, QByteArray json, ReplyCallback callback);
+    static void prepareEncryptedJson(QString url, int action, QString payload, ReplyCallback callback);
+    static void getServerPubkey(QString url, ReplyCallback callback);
+    static QByteArray parseServerPubkey(QString json);
+    static ToxId parseLookup(QByteArray response);
     static QString getPass(QString json, ExecCode &code);
     static ExecCode extractError(QString json);
 
 private:
     static const QMap<QString, QString> pubkeyUrls;
     static const QMap<QString, QString> apiUrls;
+
+    template <typename T>
+    struct CacheEntry
+    {
+        T value;
+        QDateTime expires;
+    };
+
+    static constexpr int pubkeyTtl = 24 * 60 * 60; ///< In seconds, server keys hardly ever change
+    static constexpr int lookupTtl = 10 * 60; ///< In seconds, for the addresses that resolved
+    static constexpr int failedLookupTtl = 60; ///< In seconds, for the addresses that didn't
+
+    static QHash<QString, CacheEntry<QByteArray>> pubkeyCache; ///< By pubkey URL
+    static QHash<QString, CacheEntry<ToxId>> lookupCache; ///< By address
+    static QHash<QString, QList<LookupCallback>> pendingLookups; ///< Callbacks waiting for an address
 };
 
 #endif // TOXME_H
@@ -20,15 +20,18 @@
 
 #include "nexus.h"
 #include "src/persistence/profile.h"
+#include "src/persistence/history.h"
 #include "src/core/core.h"
 #include "src/core/coreav.h"
 #include "src/widget/widget.h"
+#include "src/headless.h"
 #include "persistence/settings.h"
 #include "video/camerasource.h"
 #include "widget/gui.h"
 #include "widget/loginscreen.h"
 #include <QThread>
 #include <QDebug>
+#include <QElapsedTimer>
 #include <QImageReader>
 #include <QFile>
 #include <QApplication>
@@ -57,6 +60,7 @@ Nexus::Nexus(QObject *parent) :
 
 Nexus::~Nexus()
 {
+    delete headless;
     delete widget;
     delete loginScreen;
     delete profile;
@@ -66,11 +70,8 @@ Nexus::~Nexus()
 #endif
 }
 
-void Nexus::start()
+void Nexus::registerMetaTypes()
 {
-    qDebug() << "Starting up";
-
-    // Setup the environment
     qRegisterMetaType<Status>("Status");
     qRegisterMetaType<vpx_image>("vpx_image");
     qRegisterMetaType<uint8_t>("uint8_t");
@@ -83,8 +84,20 @@ void Nexus::start()
     qRegisterMetaType<Profile*>("Profile*");
     qRegisterMetaType<ToxAV*>("ToxAV*");
     qRegisterMetaType<ToxFile>("ToxFile");
+    qRegisterMetaType<ToxFile::Ptr>("ToxFile::Ptr");
     qRegisterMetaType<ToxFile::FileDirection>("ToxFile::FileDirection");
+    qRegisterMetaType<QVector<FriendSnapshot>>("QVector<FriendSnapshot>");
+    qRegisterMetaType<CoreEvents>("CoreEvents");
     qRegisterMetaType<std::shared_ptr<VideoFrame>>("std::shared_ptr<VideoFrame>");
+    qRegisterMetaType<QList<History::HistMessage>>("QList<History::HistMessage>");
+}
+
+void Nexus::start()
+{
+    qDebug() << "Starting up";
+
+    // Setup the environment
+    registerMetaTypes();
 
     loginScreen = new LoginScreen();
 
@@ -176,32 +189,73 @@ void Nexus::showMainGUI()
     connect(core, &Core::statusMessageSet,           widget, &Widget::setStatusMessage);
     connect(core, &Core::selfAvatarChanged,          widget, &Widget::onSelfAvatarLoaded);
     connect(core, &Core::friendAdded,                widget, &Widget::addFriend);
+    connect(core, &Core::friendsLoaded,              widget, &Widget::onFriendsLoaded);
     connect(core, &Core::friendshipChanged,          widget, &Widget::onFriendshipChanged);
     connect(core, &Core::failedToAddFriend,          widget, &Widget::addFriendFailed);
     connect(core, &Core::friendUsernameChanged,      widget, &Widget::onFriendUsernameChanged);
-    connect(core, &Core::friendStatusChanged,        widget, &Widget::onFriendStatusChanged);
     connect(core, &Core::friendStatusMessageChanged, widget, &Widget::onFriendStatusMessageChanged);
     connect(core, &Core::friendRequestReceived,      widget, &Widget::onFriendRequestReceived);
-    connect(core, &Core::friendMessageReceived,      widget, &Widget::onFriendMessageReceived);
+    connect(core, &Core::eventsReceived,             widget, &Widget::onCoreEvents);
     connect(core, &Core::receiptRecieved,            widget, &Widget::onReceiptRecieved);
     connect(core, &Core::groupInviteReceived,        widget, &Widget::onGroupInviteReceived);
-    connect(core, &Core::groupMessageReceived,       widget, &Widget::onGroupMessageReceived);
-    connect(core, &Core::groupNamelistChanged,       widget, &Widget::onGroupNamelistChanged);
     connect(core, &Core::groupTitleChanged,          widget, &Widget::onGroupTitleChanged);
     connect(core, &Core::groupPeerAudioPlaying,      widget, &Widget::onGroupPeerAudioPlaying);
     connect(core, &Core::emptyGroupCreated, widget, &Widget::onEmptyGroupCreated);
-    connect(core, &Core::friendTypingChanged, widget, &Widget::onFriendTypingChanged);
 
     connect(core, &Core::messageSentResult, widget, &Widget::onMessageSendResult);
     connect(core, &Core::groupSentResult, widget, &Widget::onGroupSendResult);
 
     connect(widget, &Widget::statusSet, core, &Core::setStatus);
     connect(widget, &Widget::friendRequested, core, &Core::requestFriendship);
+    connect(widget, &Widget::friendsRequested, core, &Core::requestFriendships);
     connect(widget, &Widget::friendRequestAccepted, core, &Core::acceptFriendRequest);
 
     profile->startCore();
 }
 
+/**
+@brief Runs the Core without any widget, for bots and relays.
+@return False if no profile is set.
+*/
+bool Nexus::startHeadless(const QString& controlSocket)
+{
+    if (!profile)
+    {
+        qCritical() << "Headless mode needs a profile";
+        return false;
+    }
+
+    qDebug() << "Starting up headless";
+    registerMetaTypes();
+
+    headless = new Headless(profile);
+
+    // The same connections as the desktop GUI's, minus what only the widgets care about
+    Core* core = profile->getCore();
+    connect(core, &Core::connected,             headless, &Headless::onConnected);
+    connect(core, &Core::disconnected,          headless, &Headless::onDisconnected);
+    connect(core, &Core::failedToStart,         headless, &Headless::onFailedToStartCore);
+    connect(core, &Core::badProxy,              headless, &Headless::onFailedToStartCore);
+    connect(core, &Core::friendRequestReceived, headless, &Headless::onFriendRequestReceived);
+    connect(core, &Core::eventsReceived,        headless, &Headless::onCoreEvents);
+    connect(core, &Core::receiptRecieved,       headless, &Headless::onReceiptReceived);
+
+    connect(headless, &Headless::statusSet,             core, &Core::setStatus);
+    connect(headless, &Headless::friendRequested,       core, &Core::requestFriendship);
+    connect(headless, &Headless::friendRequestAccepted, core, &Core::acceptFriendRequest);
+
+    if (!headless->listen(controlSocket))
+        return false;
+
+    profile->startCore();
+    return true;
+}
+
+bool Nexus::isHeadless()
+{
+    return getInstance().headless != nullptr;
+}
+
 Nexus& Nexus::getInstance()
 {
     if (!nexus)
@@ -233,7 +287,12 @@ void Nexus::setProfile(Profile* profile)
 {
     getInstance().profile = profile;
     if (profile)
+    {
+        QElapsedTimer clock;
+        clock.start();
         Settings::getInstance().loadPersonal(profile);
+        qDebug() << "Loaded the personal settings in" << clock.elapsed() << "ms";
+    }
 }
 
 Widget* Nexus::getDesktopGUI()
@@ -27,6 +27,7 @@ class Widget;
 class Profile;
 class LoginScreen;
 class Core;
+class Headless;
 
 #ifdef Q_OS_MAC
 class QMenuBar;
@@ -40,6 +41,8 @@ class QSignalMapper;
 /// This class is in charge of connecting various systems together
 /// and forwarding signals appropriately to the right objects
 /// It is in charge of starting the GUI and the Core
+/// A process hosts a single profile: Core::getInstance(), the personal settings of Settings,
+/// FriendList and GroupList are all process-wide, so front ends should reach the Core through their Profile
 class Nexus : public QObject
 {
     Q_OBJECT
@@ -49,6 +52,9 @@ public:
     /// Hides the login screen and shows the GUI for the given profile.
     /// Will delete the current GUI, if it exists.
     void showMainGUI();
+    /// Starts the Core of the profile set with setProfile without any widget, see Headless
+    /// The control socket is named after the profile if controlSocket is empty
+    bool startHeadless(const QString& controlSocket = QString());
 
     static Nexus& getInstance();
     static void destroyInstance();
@@ -56,6 +62,7 @@ public:
     static Profile* getProfile(); ///< Will return 0 if not started
     static void setProfile(Profile* profile); ///< Delete the current profile, if any, and replaces it
     static Widget* getDesktopGUI(); ///< Will return 0 if not started
+    static bool isHeadless(); ///< True once startHeadless was called, there's no desktop GUI then
     static QString getSupportedImageFilter();
     static bool tryRemoveFile(const QString& filepath); ///< Dangerous way to find out if a path is writable
 
@@ -88,11 +95,13 @@ private:
 private:
     explicit Nexus(QObject *parent = 0);
     ~Nexus();
+    static void registerMetaTypes();
 
 private:
     Profile* profile;
     Widget* widget;
     LoginScreen* loginScreen;
+    Headless* headless = nullptr;
 };
 
 #endif // NEXUS_H
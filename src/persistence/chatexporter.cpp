@@ -0,0 +1,213 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "chatexporter.h"
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QObject>
+#include <QStringList>
+#include <QDebug>
+
+/**
+@class ChatExporter
+@brief Streams a chat log to a file.
+
+The formats are made so we can write them as we go: HTML and JSON only need a few
+closing tags or brackets after the last message, which finish() writes.
+*/
+
+/**
+@brief Returns a JSON string literal of text, quotes included
+*/
+static QByteArray jsonString(const QString& text)
+{
+    QJsonArray array;
+    array.append(text);
+    QByteArray json = QJsonDocument{array}.toJson(QJsonDocument::Compact);
+    return json.mid(1, json.size() - 2);
+}
+
+ChatExporter::ChatExporter(const QString &path, Format format, const QString &timestampFormat)
+    : file{path}, format{format}, timestampFormat{timestampFormat}
+{
+    buffer.reserve(bufferSize);
+}
+
+ChatExporter::~ChatExporter()
+{
+    if (file.isOpen())
+        finish();
+}
+
+QStringList ChatExporter::nameFilters()
+{
+    return {QObject::tr("Plain text (*.txt)"),
+            QObject::tr("Web page (*.html)"),
+            QObject::tr("JSON (*.json)")};
+}
+
+ChatExporter::Format ChatExporter::formatFor(const QString &nameFilter, const QString &path)
+{
+    int index = nameFilters().indexOf(nameFilter);
+    if (index >= 0)
+        return static_cast<Format>(index);
+
+    QString suffix = QFileInfo{path}.suffix().toLower();
+    if (suffix == "html" || suffix == "htm")
+        return Format::Html;
+    else if (suffix == "json")
+        return Format::Json;
+    else
+        return Format::PlainText;
+}
+
+QString ChatExporter::withExtension(const QString &path, Format format)
+{
+    if (!QFileInfo{path}.suffix().isEmpty())
+        return path;
+
+    switch (format)
+    {
+    case Format::Html:
+        return path + ".html";
+    case Format::Json:
+        return path + ".json";
+    default:
+        return path + ".txt";
+    }
+}
+
+bool ChatExporter::begin(const QString &title)
+{
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        qWarning() << "Can't open" << file.fileName() << "to export the chat log:" << file.errorString();
+        failed = true;
+        return false;
+    }
+
+    switch (format)
+    {
+    case Format::Html:
+        buffer += "<!DOCTYPE html>\n<html>\n<head>\n<meta charset=\"utf-8\">\n<title>";
+        buffer += title.toHtmlEscaped().toUtf8();
+        buffer += "</title>\n</head>\n<body>\n";
+        break;
+    case Format::Json:
+        buffer += "{\"chat\":";
+        buffer += jsonString(title);
+        buffer += ",\"messages\":[\n";
+        break;
+    default:
+        break;
+    }
+    return true;
+}
+
+bool ChatExporter::addMessage(const QString &sender, const QString &message, const QDateTime &time, bool pending)
+{
+    if (failed || canceled || !file.isOpen())
+        return false;
+
+    QString timestamp = pending ? QObject::tr("Not sent") : time.toString(timestampFormat);
+    switch (format)
+    {
+    case Format::Html:
+        buffer += "<p><b>";
+        buffer += sender.toHtmlEscaped().toUtf8();
+        buffer += "</b> <small>[";
+        buffer += timestamp.toHtmlEscaped().toUtf8();
+        buffer += "]</small><br>\n";
+        buffer += message.toHtmlEscaped().replace('\n', "<br>\n").toUtf8();
+        buffer += "</p>\n";
+        break;
+    case Format::Json:
+    {
+        if (!firstMessage)
+            buffer += ",\n";
+        QJsonObject entry;
+        entry.insert("sender", sender);
+        entry.insert("timestamp", time.toUTC().toString(Qt::ISODate));
+        entry.insert("message", message);
+        entry.insert("pending", pending);
+        buffer += QJsonDocument{entry}.toJson(QJsonDocument::Compact);
+        break;
+    }
+    default:
+        buffer += QString("[%2] %1\n%3\n\n").arg(sender, timestamp, message).toUtf8();
+        break;
+    }
+    firstMessage = false;
+
+    if (buffer.size() >= bufferSize)
+        return flush();
+    return true;
+}
+
+bool ChatExporter::finish()
+{
+    if (!file.isOpen())
+        return false;
+
+    switch (format)
+    {
+    case Format::Html:
+        buffer += "</body>\n</html>\n";
+        break;
+    case Format::Json:
+        buffer += "\n]}\n";
+        break;
+    default:
+        break;
+    }
+
+    bool ok = flush() && !canceled;
+    file.close();
+    if (!ok)
+        file.remove();
+    return ok;
+}
+
+void ChatExporter::cancel()
+{
+    canceled = true;
+}
+
+bool ChatExporter::isCanceled() const
+{
+    return canceled;
+}
+
+QString ChatExporter::getPath() const
+{
+    return file.fileName();
+}
+
+bool ChatExporter::flush()
+{
+    if (!failed && file.write(buffer) != buffer.size())
+    {
+        qWarning() << "Failed to write the chat log to" << file.fileName() << ":" << file.errorString();
+        failed = true;
+    }
+    // Keeps the reserved capacity
+    buffer.truncate(0);
+    return !failed;
+}
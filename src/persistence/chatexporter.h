@@ -0,0 +1,79 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef CHATEXPORTER_H
+#define CHATEXPORTER_H
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QFile>
+#include <QStringList>
+#include <atomic>
+
+/// Writes a chat log to a file as plain text, HTML or JSON, one message at a time
+/// The output is buffered and written in large blocks, so exporting never holds the whole log in memory
+/// Nothing but cancel() is thread-safe, but the exporter can be used from any one thread
+class ChatExporter
+{
+public:
+    enum class Format
+    {
+        PlainText,
+        Html,
+        Json
+    };
+
+    /// timestampFormat is a QDateTime format, like the one of the chat log
+    ChatExporter(const QString& path, Format format, const QString& timestampFormat);
+    ~ChatExporter();
+
+    /// Returns the file dialog name filters of our formats, in the order of Format
+    static QStringList nameFilters();
+    /// Returns the format of a filter in nameFilters(), or guesses it from the extension of the path
+    static Format formatFor(const QString& nameFilter, const QString& path);
+    /// Returns the path with the extension of format appended, if it has no extension yet
+    static QString withExtension(const QString& path, Format format);
+
+    /// Opens the file and writes the header of the log, title names the chat
+    bool begin(const QString& title);
+    /// Adds a message, pending is set for the messages that weren't delivered yet
+    bool addMessage(const QString& sender, const QString& message, const QDateTime& time, bool pending);
+    /// Writes the end of the log and closes the file
+    bool finish();
+
+    /// Makes the next addMessage() calls fail, can be called from any thread
+    void cancel();
+    bool isCanceled() const;
+    QString getPath() const;
+
+private:
+    bool flush();
+
+private:
+    QFile file;
+    Format format;
+    QString timestampFormat;
+    QByteArray buffer;
+    bool failed = false;
+    bool firstMessage = true;
+    std::atomic_bool canceled{false};
+    /// Bytes buffered before we write them to the file
+    static constexpr int bufferSize = 64*1024;
+};
+
+#endif // CHATEXPORTER_H
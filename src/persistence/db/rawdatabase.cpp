@@ -1,11 +1,16 @@
 #include "rawdatabase.h"
+#include "src/persistence/passkeycache.h"
+#include "src/trace.h"
 #include <QDebug>
 #include <QMetaObject>
 #include <QMutexLocker>
 #include <QCoreApplication>
 #include <QFile>
+#include <QFileInfo>
+#include <QTimer>
 #include <cassert>
 #include <tox/toxencryptsave.h>
+#include <sodium.h>
 
 /// The two following defines are required to use SQLCipher
 /// They are used by the sqlite3.h header
@@ -14,9 +19,143 @@
 
 #include <sqlcipher/sqlite3.h>
 
-RawDatabase::RawDatabase(const QString &path, const QString& password)
-    : workerThread{new QThread}, path{path}, currentHexKey{deriveKey(password)}
+namespace
 {
+/// Overwrites a string that held our key, in place, along with every copy sharing its data
+void wipe(QString& text)
+{
+    if (!text.isEmpty())
+        sodium_memzero(const_cast<QChar*>(text.constData()), text.size() * sizeof(QChar));
+    text.clear();
+}
+
+void wipe(QByteArray& data)
+{
+    if (!data.isEmpty())
+        sodium_memzero(const_cast<char*>(data.constData()), data.size());
+    data.clear();
+}
+}
+
+/**
+@brief A read-only connection to the database, executing the reads queued on it on its own thread.
+
+With a write-ahead log, SQLite lets readers run alongside the writer of the main connection,
+each reader seeing the database as of the start of its transaction.
+*/
+class RawDatabase::ReadConnection : public QThread
+{
+public:
+    explicit ReadConnection(int index);
+    /// Executes the reads still queued, then closes the connection
+    ~ReadConnection();
+    /// Opens the database read-only, configured like the main connection, must be called before start
+    bool open(const QString& path, const QString& hexKey, const OpenOptions& options);
+    void enqueue(const Transaction& trans);
+
+protected:
+    void run() override;
+
+private:
+    sqlite3* sqlite;
+    StatementCache statementCache;
+    QMutex queueMutex;
+    QWaitCondition queueCondition;
+    QQueue<Transaction> queue;
+    bool stopping;
+};
+
+RawDatabase::ReadConnection::ReadConnection(int index)
+    : sqlite{nullptr}, statementCache{maxCachedQueries}, stopping{false}
+{
+    setObjectName(QString("qTox Database Reader %1").arg(index));
+}
+
+RawDatabase::ReadConnection::~ReadConnection()
+{
+    {
+        QMutexLocker locker{&queueMutex};
+        stopping = true;
+    }
+    queueCondition.wakeOne();
+    wait();
+
+    statementCache.clear();
+    if (sqlite)
+        sqlite3_close(sqlite);
+}
+
+bool RawDatabase::ReadConnection::open(const QString& path, const QString& hexKey, const OpenOptions& options)
+{
+    if (sqlite3_open_v2(path.toUtf8().data(), &sqlite, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, nullptr)
+            != SQLITE_OK)
+    {
+        qWarning() << "Failed to open a read connection to"<<path<<"with error:"<<sqlite3_errmsg(sqlite);
+        sqlite3_close(sqlite);
+        sqlite = nullptr;
+        return false;
+    }
+
+    // The key must be set first, and checked by reading the schema
+    QString setup;
+    if (!hexKey.isEmpty())
+        setup += "PRAGMA key = \"x'"+hexKey+"'\"; ";
+    setup += QString("PRAGMA cache_size = -%1; PRAGMA mmap_size = %2; PRAGMA temp_store = %3; "
+                     "SELECT count(*) FROM sqlite_master;")
+            .arg(qMax(0, options.cacheSizeKiB))
+            .arg(qMax(0, options.mmapSizeMiB) * 1024LL * 1024LL)
+            .arg(options.memoryTempStore ? "MEMORY" : "DEFAULT");
+    QByteArray setupData = setup.toUtf8();
+    wipe(setup);
+    int result = sqlite3_exec(sqlite, setupData.constData(), nullptr, nullptr, nullptr);
+    wipe(setupData);
+    if (result != SQLITE_OK)
+    {
+        qWarning() << "Failed to set up a read connection:"<<sqlite3_errmsg(sqlite);
+        sqlite3_close(sqlite);
+        sqlite = nullptr;
+        return false;
+    }
+
+    return true;
+}
+
+void RawDatabase::ReadConnection::enqueue(const Transaction& trans)
+{
+    {
+        QMutexLocker locker{&queueMutex};
+        queue.enqueue(trans);
+    }
+    queueCondition.wakeOne();
+}
+
+void RawDatabase::ReadConnection::run()
+{
+    forever
+    {
+        Transaction trans;
+        {
+            QMutexLocker locker{&queueMutex};
+            while (queue.isEmpty() && !stopping)
+                queueCondition.wait(&queueMutex);
+            if (queue.isEmpty())
+                return;
+            trans = queue.dequeue();
+        }
+
+        TraceSpan span{"RawDatabase::ReadConnection"};
+        signalResult(trans, executeTransaction(sqlite, statementCache, trans));
+    }
+}
+
+RawDatabase::RawDatabase(const QString &path, const QString& password, const OpenOptions& options)
+    : workerThread{new QThread}, batchTimer{new QTimer{this}}, interactiveStreak{0}, statementCache{maxCachedQueries},
+      path{path}, currentHexKey{deriveKey(password)}, options{options}, batchWindow{defaultBatchWindow},
+      maxBatchSize{defaultMaxBatchSize}
+{
+    batchTimer->setSingleShot(true);
+    connect(batchTimer, SIGNAL(timeout()), this, SLOT(process()));
+
     workerThread->setObjectName("qTox Database");
     moveToThread(workerThread.get());
     workerThread->start();
@@ -58,7 +197,10 @@ bool RawDatabase::open(const QString& path, const QString &hexKey)
 
     if (!hexKey.isEmpty())
     {
-        if (!execNow("PRAGMA key = \"x'"+hexKey+"'\""))
+        QString keyStatement = "PRAGMA key = \"x'"+hexKey+"'\"";
+        bool keyed = execNow(Query::secret(keyStatement));
+        wipe(keyStatement);
+        if (!keyed)
         {
             qWarning() << "Failed to set encryption key";
             close();
@@ -72,16 +214,76 @@ bool RawDatabase::open(const QString& path, const QString &hexKey)
             return false;
         }
     }
+
+    if (!applyOptions())
+        qWarning() << "Failed to apply the database options, using SQLite's defaults";
+
+    openReaders(hexKey);
     return true;
 }
 
+bool RawDatabase::applyOptions()
+{
+    static const char* const synchronousModes[] = {"OFF", "NORMAL", "FULL"};
+    int synchronous = static_cast<int>(options.synchronous);
+    if (synchronous < 0 || synchronous > 2)
+        synchronous = static_cast<int>(OpenOptions::Synchronous::Full);
+
+    // A negative cache_size is in KiB instead of pages
+    return execNow(QString("PRAGMA journal_mode = %1;").arg(options.walJournal ? "WAL" : "DELETE"))
+        && execNow(QString("PRAGMA synchronous = %1;").arg(synchronousModes[synchronous]))
+        && execNow(QString("PRAGMA cache_size = -%1;").arg(qMax(0, options.cacheSizeKiB)))
+        && execNow(QString("PRAGMA mmap_size = %1;").arg(qMax(0, options.mmapSizeMiB) * 1024LL * 1024LL))
+        && execNow(QString("PRAGMA temp_store = %1;").arg(options.memoryTempStore ? "MEMORY" : "DEFAULT"));
+}
+
+void RawDatabase::openReaders(const QString& hexKey)
+{
+    if (!options.walJournal || options.readConnections <= 0)
+        return;
+
+    std::vector<std::unique_ptr<ReadConnection>> opened;
+    for (int i = 0; i < options.readConnections; ++i)
+    {
+        std::unique_ptr<ReadConnection> reader{new ReadConnection{i}};
+        if (!reader->open(path, hexKey, options))
+            break;
+        reader->start();
+        opened.push_back(std::move(reader));
+    }
+
+    if (opened.empty())
+        qWarning() << "No read connection, reads will use the main connection";
+
+    QMutexLocker locker{&readersMutex};
+    readers = std::move(opened);
+}
+
+void RawDatabase::closeReaders()
+{
+    std::vector<std::unique_ptr<ReadConnection>> closing;
+    {
+        QMutexLocker locker{&readersMutex};
+        closing.swap(readers);
+    }
+    // Each reader finishes its queue before closing, we don't hold the lock meanwhile
+    // so new reads fall back to the main connection instead of waiting
+    closing.clear();
+}
+
 void RawDatabase::close()
 {
     if (QThread::currentThread() != workerThread.get())
         return (void)QMetaObject::invokeMethod(this, "close", Qt::BlockingQueuedConnection);
 
+    closeReaders();
+
     // We assume we're in the ctor or dtor, so we just need to finish processing our transactions
     process();
+    batchTimer->stop();
+
+    // Cached statements must all be finalized or sqlite3_close will refuse to close
+    statementCache.clear();
 
     if (sqlite3_close(sqlite) == SQLITE_OK)
         sqlite = nullptr;
@@ -91,7 +293,9 @@ void RawDatabase::close()
 
 bool RawDatabase::isOpen()
 {
-    // We don't need thread safety since only the ctor/dtor can write this pointer
+    // Besides the ctor and dtor, the worker thread writes this pointer when exportWithKey, rename or remove
+    // close and reopen the database. For the other threads it's only a hint, what they queue meanwhile
+    // waits for the reopened database anyway.
     return sqlite != nullptr;
 }
 
@@ -100,12 +304,12 @@ bool RawDatabase::execNow(const QString& statement)
     return execNow(Query{statement});
 }
 
-bool RawDatabase::execNow(const RawDatabase::Query &statement)
+bool RawDatabase::execNow(const RawDatabase::Query &statement, Priority priority)
 {
-    return execNow(QVector<Query>{statement});
+    return execNow(QVector<Query>{statement}, priority);
 }
 
-bool RawDatabase::execNow(const QVector<RawDatabase::Query> &statements)
+bool RawDatabase::execNow(const QVector<RawDatabase::Query> &statements, Priority priority)
 {
     if (!sqlite)
     {
@@ -113,25 +317,89 @@ bool RawDatabase::execNow(const QVector<RawDatabase::Query> &statements)
         return false;
     }
 
-    std::atomic_bool done{false};
-    std::atomic_bool success{false};
+    TraceSpan span{"RawDatabase::execNow"};
+    Completion completion;
 
     Transaction trans;
     trans.queries = statements;
-    trans.done = &done;
-    trans.success = &success;
+    trans.completion = &completion;
     {
         QMutexLocker locker{&transactionsMutex};
-        pendingTransactions.enqueue(trans);
+        if (priority == Priority::Interactive)
+            interactiveTransactions.enqueue(trans);
+        else
+            pendingTransactions.enqueue(trans);
     }
 
     // We can't use blocking queued here, otherwise we might process future transactions
     // before returning, but we only want to wait until this transaction is done.
+    // On the worker thread this processes the transaction right away, and we don't wait at all.
     QMetaObject::invokeMethod(this, "process");
-    while (!done.load(std::memory_order_acquire))
-        QThread::msleep(10);
 
-    return success.load(std::memory_order_acquire);
+    return waitFor(completion);
+}
+
+bool RawDatabase::readNow(const RawDatabase::Query& statement, const QString& key)
+{
+    return readNow(QVector<Query>{statement}, key);
+}
+
+bool RawDatabase::readNow(const QVector<RawDatabase::Query>& statements, const QString& key)
+{
+    if (!sqlite)
+    {
+        qWarning() << "Trying to read, but the database is not open";
+        return false;
+    }
+
+    TraceSpan span{"RawDatabase::readNow"};
+    Completion completion;
+
+    Transaction trans;
+    trans.queries = statements;
+    trans.completion = &completion;
+    if (!queueRead(trans, key))
+        return execNow(statements, Priority::Interactive);
+
+    return waitFor(completion);
+}
+
+void RawDatabase::readLater(const QVector<RawDatabase::Query>& statements,
+                            std::function<void(bool)> completionCallback, const QString& key)
+{
+    if (!sqlite)
+    {
+        qWarning() << "Trying to read, but the database is not open";
+        if (completionCallback)
+            completionCallback(false);
+        return;
+    }
+
+    Transaction trans;
+    trans.queries = statements;
+    trans.completionCallback = completionCallback;
+    if (!queueRead(trans, key))
+        execLater(statements, completionCallback, Priority::Interactive);
+}
+
+bool RawDatabase::queueRead(const Transaction& trans, const QString& key)
+{
+    QMutexLocker locker{&readersMutex};
+    if (readers.empty())
+        return false;
+
+    uint index = key.isEmpty() ? nextReader.fetch_add(1, std::memory_order_relaxed) : qHash(key);
+    readers[index % readers.size()]->enqueue(trans);
+    return true;
+}
+
+bool RawDatabase::waitFor(Completion& completion)
+{
+    QMutexLocker locker{&completion.mutex};
+    while (!completion.done)
+        completion.condition.wait(&completion.mutex);
+
+    return completion.success;
 }
 
 void RawDatabase::execLater(const QString &statement)
@@ -145,26 +413,86 @@ void RawDatabase::execLater(const RawDatabase::Query &statement)
 }
 
 void RawDatabase::execLater(const QVector<RawDatabase::Query> &statements)
+{
+    execLater(statements, {});
+}
+
+void RawDatabase::execLater(const QVector<RawDatabase::Query> &statements,
+                            std::function<void(bool)> completionCallback, Priority priority)
 {
     if (!sqlite)
     {
         qWarning() << "Trying to exec, but the database is not open";
+        if (completionCallback)
+            completionCallback(false);
         return;
     }
 
     Transaction trans;
     trans.queries = statements;
+    trans.batchable = priority == Priority::Background;
+    trans.completionCallback = completionCallback;
     {
         QMutexLocker locker{&transactionsMutex};
-        pendingTransactions.enqueue(trans);
+        if (priority == Priority::Interactive)
+            interactiveTransactions.enqueue(trans);
+        else
+            pendingTransactions.enqueue(trans);
     }
 
-    QMetaObject::invokeMethod(this, "process");
+    // Always queued, so execLater is safe to call from a completion callback on the worker thread
+    if (priority == Priority::Interactive)
+        QMetaObject::invokeMethod(this, "process", Qt::QueuedConnection);
+    else
+        QMetaObject::invokeMethod(this, "scheduleProcess", Qt::QueuedConnection);
+}
+
+void RawDatabase::compactLater()
+{
+    if (!sqlite)
+    {
+        qWarning() << "Trying to compact, but the database is not open";
+        return;
+    }
+
+    QMetaObject::invokeMethod(this, "compact", Qt::QueuedConnection);
+}
+
+void RawDatabase::setBatching(int windowMs, int maxTransactions)
+{
+    batchWindow.store(windowMs, std::memory_order_relaxed);
+    maxBatchSize.store(qMax(1, maxTransactions), std::memory_order_relaxed);
 }
 
 void RawDatabase::sync()
 {
     QMetaObject::invokeMethod(this, "process", Qt::BlockingQueuedConnection);
+
+    // Each reader is done with the reads queued before ours once it gets to an empty transaction
+    // We don't wait under the lock, reads queued by the callbacks and closeReaders need it.
+    // A closing reader still runs its queue, so our transactions complete either way
+    size_t count;
+    std::unique_ptr<Completion[]> completions;
+    {
+        QMutexLocker locker{&readersMutex};
+        count = readers.size();
+        completions.reset(new Completion[count]);
+        for (size_t i = 0; i < count; ++i)
+        {
+            Transaction trans;
+            trans.completion = &completions[i];
+            readers[i]->enqueue(trans);
+        }
+    }
+
+    for (size_t i = 0; i < count; ++i)
+        waitFor(completions[i]);
+}
+
+int RawDatabase::pendingCount()
+{
+    QMutexLocker locker{&transactionsMutex};
+    return pendingTransactions.size() + interactiveTransactions.size();
 }
 
 bool RawDatabase::setPassword(const QString& password)
@@ -183,83 +511,161 @@ bool RawDatabase::setPassword(const QString& password)
         return ret;
     }
 
-    // If we need to decrypt or encrypt, we'll need to sync and close,
-    // so we always process the pending queue before rekeying for consistency
+    cancelExport.store(false, std::memory_order_relaxed);
+    return changeKey(password, {});
+}
+
+void RawDatabase::setPasswordLater(const QString &password, std::function<void(int)> progressCallback,
+                                   std::function<void(bool)> completionCallback)
+{
+    if (!sqlite)
+    {
+        qWarning() << "Trying to change the password, but the database is not open";
+        if (completionCallback)
+            completionCallback(false);
+        return;
+    }
+
+    {
+        QMutexLocker locker{&transactionsMutex};
+        pendingPasswordChanges.enqueue({password, progressCallback, completionCallback});
+        cancelExport.store(false, std::memory_order_relaxed);
+    }
+
+    QMetaObject::invokeMethod(this, "processPasswordChange", Qt::QueuedConnection);
+}
+
+void RawDatabase::cancelPasswordChange()
+{
+    cancelExport.store(true, std::memory_order_relaxed);
+}
+
+void RawDatabase::processPasswordChange()
+{
+    assert(QThread::currentThread() == workerThread.get());
+
+    PasswordChange change;
+    {
+        QMutexLocker locker{&transactionsMutex};
+        if (pendingPasswordChanges.isEmpty())
+            return;
+        change = pendingPasswordChanges.dequeue();
+    }
+
+    bool succeeded = sqlite && changeKey(change.password, change.progressCallback);
+    if (change.completionCallback)
+        change.completionCallback(succeeded);
+}
+
+bool RawDatabase::changeKey(const QString &password, std::function<void(int)> progressCallback)
+{
+    // We always process the pending queue before rekeying for consistency,
+    // since we'll need to close the database to swap in the exported file
     process();
 
-    if (QFile::exists(path+".tmp"))
+    if (password.isEmpty() && currentHexKey.isEmpty())
+        return true;
+
+    return exportWithKey(password.isEmpty() ? QString() : deriveKey(password), progressCallback);
+}
+
+bool RawDatabase::exportWithKey(const QString &hexKey, std::function<void(int)> progressCallback)
+{
+    ExportProgress progress;
+    progress.db = this;
+    progress.tmpPath = path+".tmp";
+    progress.lastPercent = -1;
+    progress.callback = progressCallback;
+
+    if (QFile::exists(progress.tmpPath))
     {
         qWarning() << "Found old temporary export file while rekeying, deleting it";
-        QFile::remove(path+".tmp");
+        QFile::remove(progress.tmpPath);
     }
 
-    if (!password.isEmpty())
+    // The exported file grows to about the size of the database, which gives us our progress
+    qint64 pageCount = 0, pageSize = 0;
+    execNow(Query{"PRAGMA page_count;", [&pageCount](const QVector<QVariant>& row)
     {
-        QString newHexKey = deriveKey(password);
-        if (!currentHexKey.isEmpty())
-        {
-            if (!execNow("PRAGMA rekey = \"x'"+newHexKey+"'\""))
-            {
-                qWarning() << "Failed to change encryption key";
-                close();
-                return false;
-            }
-        }
+        pageCount = row[0].toLongLong();
+    }});
+    execNow(Query{"PRAGMA page_size;", [&pageSize](const QVector<QVariant>& row)
+    {
+        pageSize = row[0].toLongLong();
+    }});
+    progress.totalSize = pageCount * pageSize;
+    progress.reportTimer.start();
+
+    QString key = hexKey.isEmpty() ? QString("''") : "\"x'"+hexKey+"'\"";
+    sqlite3_progress_handler(sqlite, exportProgressOps, exportProgressHandler, &progress);
+    QString exportStatement = "ATTACH DATABASE '"+progress.tmpPath+"' AS rekeyed KEY "+key+";"
+                              "SELECT sqlcipher_export('rekeyed');"
+                              "DETACH DATABASE rekeyed;";
+    wipe(key);
+    bool exported = execNow(Query::secret(exportStatement));
+    wipe(exportStatement);
+    sqlite3_progress_handler(sqlite, 0, nullptr, nullptr);
+
+    if (!exported)
+    {
+        if (cancelExport.load(std::memory_order_relaxed))
+            qDebug() << "Password change cancelled, keeping the old key";
         else
-        {
-            // Need to encrypt the database
-            if (!execNow("ATTACH DATABASE '"+path+".tmp' AS encrypted KEY \"x'"+newHexKey+"'\";"
-                         "SELECT sqlcipher_export('encrypted');"
-                         "DETACH DATABASE encrypted;"))
-            {
-                qWarning() << "Failed to export encrypted database";
-                close();
-                return false;
-            }
+            qWarning() << "Failed to export the database with the new key, keeping the old one";
 
-            // This is racy as hell, but nobody will race with us since we hold the profile lock
-            // If we crash or die here, the rename should be atomic, so we can recover no matter what
-            close();
-            QFile::remove(path);
-            QFile::rename(path+".tmp", path);
-            currentHexKey = newHexKey;
-            if (!open(path, currentHexKey))
-            {
-                qWarning() << "Failed to open encrypted database";
-                return false;
-            }
-        }
+        // The export may have been interrupted before it detached the new file
+        bool attached = false;
+        execNow(Query{"PRAGMA database_list;", [&attached](const QVector<QVariant>& row)
+        {
+            attached = attached || row[1].toString() == "rekeyed";
+        }});
+        if (attached)
+            execNow("DETACH DATABASE rekeyed;");
+        QFile::remove(progress.tmpPath);
+        return false;
     }
-    else
-    {
-        if (currentHexKey.isEmpty())
-            return true;
 
-        // Need to decrypt the database
-        if (!execNow("ATTACH DATABASE '"+path+".tmp' AS plaintext KEY '';"
-                     "SELECT sqlcipher_export('plaintext');"
-                     "DETACH DATABASE plaintext;"))
-        {
-            qWarning() << "Failed to export decrypted database";
-            close();
-            return false;
-        }
+    if (progressCallback)
+        progressCallback(100);
 
-        // This is racy as hell, but nobody will race with us since we hold the profile lock
-        // If we crash or die here, the rename should be atomic, so we can recover no matter what
-        close();
-        QFile::remove(path);
-        QFile::rename(path+".tmp", path);
-        currentHexKey.clear();
-        if (!open(path))
-        {
-            qCritical() << "Failed to open decrypted database";
-            return false;
-        }
+    // This is racy as hell, but nobody will race with us since we hold the profile lock
+    // If we crash or die here, the rename should be atomic, so we can recover no matter what
+    close();
+    QFile::remove(path);
+    QFile::rename(progress.tmpPath, path);
+    currentHexKey = hexKey;
+    if (!open(path, currentHexKey))
+    {
+        qCritical() << "Failed to open the database with its new key";
+        return false;
     }
     return true;
 }
 
+int RawDatabase::exportProgressHandler(void *exportProgress)
+{
+    ExportProgress* progress = static_cast<ExportProgress*>(exportProgress);
+
+    // Interrupts the export, which then fails with SQLITE_INTERRUPT
+    if (progress->db->cancelExport.load(std::memory_order_relaxed))
+        return 1;
+
+    if (!progress->callback || progress->totalSize <= 0
+            || progress->reportTimer.elapsed() < exportProgressInterval)
+        return 0;
+
+    progress->reportTimer.restart();
+    qint64 written = QFileInfo(progress->tmpPath).size();
+    // We only report 100% once the new file is in place
+    int percent = qBound(0, static_cast<int>(written * 100 / progress->totalSize), 99);
+    if (percent != progress->lastPercent)
+    {
+        progress->lastPercent = percent;
+        progress->callback(percent);
+    }
+    return 0;
+}
+
 bool RawDatabase::rename(const QString &newPath)
 {
     if (!sqlite)
@@ -317,14 +723,40 @@ QString RawDatabase::deriveKey(QString password)
     if (password.isEmpty())
         return {};
 
-    QByteArray passData = password.toUtf8();
-
     static_assert(TOX_PASS_KEY_LENGTH >= 32, "toxcore must provide 256bit or longer keys");
 
     static const uint8_t expandConstant[TOX_PASS_SALT_LENGTH+1] = "L'ignorance est le pire des maux";
-    TOX_PASS_KEY key;
-    tox_derive_key_with_salt((uint8_t*)passData.data(), passData.size(), expandConstant, &key, nullptr);
-    return QByteArray((char*)key.key, 32).toHex();
+    auto key = PasskeyCache::getKey(password, expandConstant);
+    if (!key)
+    {
+        qCritical() << "Failed to derive the database key";
+        return {};
+    }
+    return QByteArray((const char*)key->key, 32).toHex();
+}
+
+void RawDatabase::compact()
+{
+    assert(QThread::currentThread() == workerThread.get());
+
+    if (!sqlite)
+        return;
+
+    // Finish the pending transactions first, so we don't run inside one of their batches
+    process();
+
+    // 2 is INCREMENTAL, a database created without it must be fully vacuumed once to switch
+    int autoVacuum = 0;
+    Query getMode{"PRAGMA auto_vacuum;", [&autoVacuum](const QVector<QVariant>& row)
+    {
+        autoVacuum = row[0].toInt();
+    }};
+    if (!executeQuery(getMode))
+        return;
+
+    Query vacuum{autoVacuum == 2 ? "PRAGMA incremental_vacuum;" : "PRAGMA auto_vacuum = INCREMENTAL; VACUUM;"};
+    if (!executeQuery(vacuum))
+        qWarning() << "Failed to compact the database";
 }
 
 void RawDatabase::process()
@@ -334,132 +766,369 @@ void RawDatabase::process()
     if (!sqlite)
         return;
 
+    TraceSpan span{"RawDatabase::process"};
     forever
     {
-        // Fetch the next transaction
-        Transaction trans;
+        // Fetch the next transaction, along with the batchable ones queued right after it
+        // The interactive lane goes first, but a long streak of it lets a background batch through
+        QVector<Transaction> batch;
         {
             QMutexLocker locker{&transactionsMutex};
-            if (pendingTransactions.isEmpty())
+            if (!interactiveTransactions.isEmpty()
+                    && (pendingTransactions.isEmpty() || interactiveStreak < maxInteractiveStreak))
+            {
+                batch += interactiveTransactions.dequeue();
+                ++interactiveStreak;
+            }
+            else if (!pendingTransactions.isEmpty())
+            {
+                batch += pendingTransactions.dequeue();
+                interactiveStreak = 0;
+            }
+            else
+            {
                 return;
-            trans = pendingTransactions.dequeue();
+            }
+            if (batch.first().batchable)
+            {
+                int maxBatch = maxBatchSize.load(std::memory_order_relaxed);
+                while (batch.size() < maxBatch && !pendingTransactions.isEmpty()
+                       && pendingTransactions.head().batchable)
+                    batch += pendingTransactions.dequeue();
+            }
+            Trace::count("RawDatabase pending", pendingTransactions.size());
+            Trace::count("RawDatabase interactive", interactiveTransactions.size());
         }
 
-        // In case we exit early, prepare to signal errors
-        if (trans.success != nullptr)
-            trans.success->store(false, std::memory_order_release);
+        if (batch.size() == 1)
+            signalResult(batch.first(), executeTransaction(batch.first()));
+        else
+            executeBatch(batch);
+    }
+}
+
+bool RawDatabase::executeTransaction(Transaction& trans)
+{
+    return executeTransaction(sqlite, statementCache, trans);
+}
 
-        // Add transaction commands if necessary
-        if (trans.queries.size() > 1)
+bool RawDatabase::executeTransaction(sqlite3* sqlite, StatementCache& statementCache, Transaction& trans)
+{
+    // Add transaction commands if necessary
+    bool isMultiQuery = trans.queries.size() > 1;
+    if (isMultiQuery)
+    {
+        trans.queries.prepend({"BEGIN;"});
+        trans.queries.append({"COMMIT;"});
+    }
+
+    // Execute each query of our transaction, in order
+    bool succeeded = true;
+    PendingInserts inserts;
+    for (Query& query : trans.queries)
+    {
+        if (!executeQuery(sqlite, statementCache, query, &inserts))
         {
-            trans.queries.prepend({"BEGIN;"});
-            trans.queries.append({"COMMIT;"});
+            succeeded = false;
+            break;
         }
+    }
+
+    // Don't leave a half-done transaction open if one of the queries failed
+    if (!succeeded && isMultiQuery && !sqlite3_get_autocommit(sqlite))
+        sqlite3_exec(sqlite, "ROLLBACK;", nullptr, nullptr, nullptr);
+
+    // The rowids of a rolled back transaction don't exist
+    if (succeeded)
+        for (const auto& insert : inserts)
+            insert.first(insert.second);
 
-        // Compile queries
-        for (Query& query : trans.queries)
+    return succeeded;
+}
+
+void RawDatabase::executeBatch(QVector<Transaction>& batch)
+{
+    if (sqlite3_exec(sqlite, "BEGIN;", nullptr, nullptr, nullptr) != SQLITE_OK)
+    {
+        qWarning() << "Failed to begin a batch of"<<batch.size()<<"transactions:"<<sqlite3_errmsg(sqlite);
+        for (const Transaction& trans : batch)
+            signalResult(trans, false);
+        return;
+    }
+
+    // Each transaction gets its own savepoint, so that a failing transaction
+    // is rolled back on its own without affecting the rest of the batch
+    // The insert callbacks wait for the commit, until then the rowids may still be rolled back
+    QVector<bool> results(batch.size(), false);
+    QVector<PendingInserts> inserts(batch.size());
+    int executed = 0;
+    bool rolledBack = false;
+    for (; executed < batch.size(); ++executed)
+    {
+        Transaction& trans = batch[executed];
+        bool succeeded = sqlite3_exec(sqlite, "SAVEPOINT batched;", nullptr, nullptr, nullptr) == SQLITE_OK;
+        for (int i=0; succeeded && i<trans.queries.size(); ++i)
+            succeeded = executeQuery(trans.queries[i], &inserts[executed]);
+
+        // Some errors make SQLite roll back the whole transaction by itself,
+        // then the previous transactions of the batch are lost and we stop batching
+        if (sqlite3_get_autocommit(sqlite))
         {
-            assert(query.statements.isEmpty());
-            // sqlite3_prepare_v2 only compiles one statement at a time in the query, we need to loop over them all
-            int curParam=0;
-            const char* compileTail = query.query.data();
-            do {
-                // Compile the next statement
-                sqlite3_stmt* stmt;
-                int r;
-                if ((r = sqlite3_prepare_v2(sqlite, compileTail,
-                                       query.query.size() - static_cast<int>(compileTail - query.query.data()),
-                                       &stmt, &compileTail)) != SQLITE_OK)
-                {
-                    qWarning() << "Failed to prepare statement"<<query.query<<"with error"<<r;
-                    goto cleanupStatements;
-                }
-                query.statements += stmt;
-
-                // Now we can bind our params to this statement
-                int nParams = sqlite3_bind_parameter_count(stmt);
-                if (query.blobs.size() < curParam+nParams)
-                {
-                    qWarning() << "Not enough parameters to bind to query "<<query.query;
-                    goto cleanupStatements;
-                }
-                for (int i=0; i<nParams; ++i)
-                {
-                    const QByteArray& blob = query.blobs[curParam+i];
-                    if (sqlite3_bind_blob(stmt, i+1, blob.data(), blob.size(), SQLITE_STATIC) != SQLITE_OK)
-                    {
-                        qWarning() << "Failed to bind param"<<curParam+i<<"to query "<<query.query;
-                        goto cleanupStatements;
-                    }
-                }
-                curParam += nParams;
-            } while (compileTail != query.query.data()+query.query.size());
+            qWarning() << "A batch of transactions was rolled back by an error";
+            rolledBack = true;
+            break;
         }
 
-        // Execute each statement of each query of our transaction
-        for (Query& query : trans.queries)
+        if (succeeded)
+            succeeded = sqlite3_exec(sqlite, "RELEASE batched;", nullptr, nullptr, nullptr) == SQLITE_OK;
+        else
+            sqlite3_exec(sqlite, "ROLLBACK TO batched; RELEASE batched;", nullptr, nullptr, nullptr);
+        results[executed] = succeeded;
+    }
+
+    if (!rolledBack && sqlite3_exec(sqlite, "COMMIT;", nullptr, nullptr, nullptr) != SQLITE_OK)
+    {
+        qWarning() << "Failed to commit a batch of"<<batch.size()<<"transactions:"<<sqlite3_errmsg(sqlite);
+        sqlite3_exec(sqlite, "ROLLBACK;", nullptr, nullptr, nullptr);
+        rolledBack = true;
+    }
+
+    if (!rolledBack)
+    {
+        for (int i=0; i<executed; ++i)
         {
-            for (sqlite3_stmt* stmt : query.statements)
+            if (results[i])
+                for (const auto& insert : inserts[i])
+                    insert.first(insert.second);
+            signalResult(batch[i], results[i]);
+        }
+    }
+
+    // Nothing of a rolled back batch was kept, so all its transactions run on their own,
+    // and so do the ones we didn't get to
+    for (int i=rolledBack ? 0 : executed; i<batch.size(); ++i)
+        signalResult(batch[i], executeTransaction(batch[i]));
+}
+
+void RawDatabase::signalResult(const Transaction& trans, bool succeeded)
+{
+    if (trans.completionCallback)
+        trans.completionCallback(succeeded);
+
+    // Signal transaction results, the waiter may return and destroy the completion as soon as we unlock
+    if (trans.completion != nullptr)
+    {
+        QMutexLocker locker{&trans.completion->mutex};
+        trans.completion->success = succeeded;
+        trans.completion->done = true;
+        trans.completion->condition.wakeOne();
+    }
+}
+
+void RawDatabase::scheduleProcess()
+{
+    assert(QThread::currentThread() == workerThread.get());
+
+    int window = batchWindow.load(std::memory_order_relaxed);
+    int pending;
+    {
+        QMutexLocker locker{&transactionsMutex};
+        pending = pendingTransactions.size();
+    }
+
+    // Wait a little for more transactions to coalesce, unless we already have a full batch
+    if (window <= 0 || pending >= maxBatchSize.load(std::memory_order_relaxed))
+    {
+        batchTimer->stop();
+        process();
+    }
+    else if (!batchTimer->isActive())
+    {
+        batchTimer->start(window);
+    }
+}
+
+bool RawDatabase::compileQuery(sqlite3* sqlite, const QByteArray& query, QVector<sqlite3_stmt*>& statements,
+                               bool secret)
+{
+    // sqlite3_prepare_v2 only compiles one statement at a time in the query, we need to loop over them all
+    const char* compileTail = query.data();
+    do {
+        // Compile the next statement
+        sqlite3_stmt* stmt;
+        int r;
+        if ((r = sqlite3_prepare_v2(sqlite, compileTail,
+                               query.size() - static_cast<int>(compileTail - query.data()),
+                               &stmt, &compileTail)) != SQLITE_OK)
+        {
+            qWarning() << "Failed to prepare statement"<<(secret ? QByteArray("<secret>") : query)<<"with error"<<r;
+            for (sqlite3_stmt* compiled : statements)
+                sqlite3_finalize(compiled);
+            statements.clear();
+            return false;
+        }
+
+        // Trailing whitespace or comments don't compile to a statement
+        if (stmt)
+            statements += stmt;
+    } while (compileTail != query.data()+query.size());
+
+    return true;
+}
+
+bool RawDatabase::executeQuery(Query& query, PendingInserts* pendingInserts)
+{
+    return executeQuery(sqlite, statementCache, query, pendingInserts);
+}
+
+bool RawDatabase::executeQuery(sqlite3* sqlite, StatementCache& statementCache, Query& query,
+                               PendingInserts* pendingInserts)
+{
+    // Fetch the compiled statements from the cache, or compile and cache them
+    // The secret queries are never cached, the cache keys would keep their text around
+    std::unique_ptr<CompiledQuery> uncached;
+    CompiledQuery* compiled = query.cached ? statementCache.object(query.query) : nullptr;
+    if (!compiled)
+    {
+        QVector<sqlite3_stmt*> statements;
+        bool compiledOk = compileQuery(sqlite, query.query, statements, !query.cached);
+        if (!query.cached)
+            wipe(query.query);
+        if (!compiledOk)
+            return false;
+
+        compiled = new CompiledQuery;
+        compiled->statements = statements;
+        if (query.cached)
+            statementCache.insert(query.query, compiled);
+        else
+            uncached.reset(compiled);
+    }
+
+    // Bind our params to each statement, then execute it
+    bool succeeded = true;
+    int curParam=0;
+    for (sqlite3_stmt* stmt : compiled->statements)
+    {
+        int nParams = sqlite3_bind_parameter_count(stmt);
+        if (query.params.size() < curParam+nParams)
+        {
+            qWarning() << "Not enough parameters to bind to query "<<query.query;
+            succeeded = false;
+            break;
+        }
+        for (int i=0; i<nParams; ++i)
+        {
+            if (bindParam(stmt, i+1, query.params[curParam+i]) != SQLITE_OK)
             {
-                int column_count = sqlite3_column_count(stmt);
-                int result;
-                do {
-                    result = sqlite3_step(stmt);
-
-                    // Execute our row callback
-                    if (result == SQLITE_ROW && query.rowCallback)
-                    {
-                        QVector<QVariant> row;
-                        for (int i=0; i<column_count; ++i)
-                            row += extractData(stmt, i);
-
-                        query.rowCallback(row);
-                    }
-                } while (result == SQLITE_ROW);
-                if (result == SQLITE_ERROR)
-                {
-                    qWarning() << "Error executing query "<<query.query;
-                    goto cleanupStatements;
-                }
-                else if (result == SQLITE_MISUSE)
-                {
-                    qWarning() << "Misuse executing query "<<query.query;
-                    goto cleanupStatements;
-                }
-                else if (result == SQLITE_CONSTRAINT)
-                {
-                    qWarning() << "Constraint error executing query "<<query.query;
-                    goto cleanupStatements;
-                }
-                else if (result != SQLITE_DONE)
-                {
-                    qWarning() << "Unknown error"<<result<<"executing query "<<query.query;
-                    goto cleanupStatements;
-                }
+                qWarning() << "Failed to bind param"<<curParam+i<<"to query "<<query.query;
+                succeeded = false;
+                break;
             }
-
-            if (query.insertCallback)
-                query.insertCallback(sqlite3_last_insert_rowid(sqlite));
         }
+        curParam += nParams;
+        if (!succeeded)
+            break;
+
+        int column_count = sqlite3_column_count(stmt);
+        int result;
+        do {
+            result = sqlite3_step(stmt);
+
+            // Execute our row callback
+            if (result == SQLITE_ROW && query.rowCallback)
+            {
+                QVector<QVariant> row;
+                for (int i=0; i<column_count; ++i)
+                    row += extractData(stmt, i);
 
-        if (trans.success != nullptr)
-            trans.success->store(true, std::memory_order_release);
+                query.rowCallback(row);
+            }
+            else if (result == SQLITE_ROW && query.rowCursorCallback)
+            {
+                query.rowCursorCallback(Row{stmt});
+            }
+        } while (result == SQLITE_ROW);
 
-        // Free our statements
-        cleanupStatements:
-        for (Query& query : trans.queries)
+
+        if (result == SQLITE_ERROR)
+        {
+            qWarning() << "Error executing query "<<query.query;
+            succeeded = false;
+        }
+        else if (result == SQLITE_MISUSE)
         {
-            for (sqlite3_stmt* stmt : query.statements)
-                sqlite3_finalize(stmt);
-            query.statements.clear();
+            qWarning() << "Misuse executing query "<<query.query;
+            succeeded = false;
         }
+        else if (result == SQLITE_CONSTRAINT)
+        {
+            qWarning() << "Constraint error executing query "<<query.query;
+            succeeded = false;
+        }
+        else if (result != SQLITE_DONE)
+        {
+            qWarning() << "Unknown error"<<result<<"executing query "<<query.query;
+            succeeded = false;
+        }
+        if (!succeeded)
+            break;
+    }
 
-        // Signal transaction results
-        if (trans.done != nullptr)
-            trans.done->store(true, std::memory_order_release);
+    // The bound data belongs to the query, so they can't stay bound to the cached statements
+    for (sqlite3_stmt* stmt : compiled->statements)
+    {
+        sqlite3_reset(stmt);
+        sqlite3_clear_bindings(stmt);
+    }
+
+    if (succeeded && query.insertCallback)
+    {
+        if (pendingInserts)
+            pendingInserts->append(qMakePair(query.insertCallback, static_cast<int64_t>(sqlite3_last_insert_rowid(sqlite))));
+        else
+            query.insertCallback(sqlite3_last_insert_rowid(sqlite));
+    }
+
+    return succeeded;
+}
+
+int RawDatabase::bindParam(sqlite3_stmt *stmt, int index, const QVariant &param)
+{
+    switch (param.userType())
+    {
+    case QMetaType::Int:
+    case QMetaType::UInt:
+    case QMetaType::LongLong:
+    case QMetaType::ULongLong:
+    case QMetaType::Bool:
+        return sqlite3_bind_int64(stmt, index, param.toLongLong());
+    case QMetaType::QString:
+    {
+        // SQLite keeps its own copy of the text, since our UTF-8 conversion is a temporary
+        QByteArray str = param.toString().toUtf8();
+        return sqlite3_bind_text(stmt, index, str.constData(), str.size(), SQLITE_TRANSIENT);
+    }
+    case QMetaType::QByteArray:
+    {
+        // The blob is owned by the query, which outlives the statement's execution
+        const QByteArray& blob = *static_cast<const QByteArray*>(param.constData());
+        return sqlite3_bind_blob(stmt, index, blob.constData(), blob.size(), SQLITE_STATIC);
+    }
+    default:
+        if (param.isNull())
+            return sqlite3_bind_null(stmt, index);
+        qWarning() << "Unsupported parameter type"<<param.typeName();
+        return SQLITE_MISMATCH;
     }
 }
 
+RawDatabase::CompiledQuery::~CompiledQuery()
+{
+    for (sqlite3_stmt* stmt : statements)
+        sqlite3_finalize(stmt);
+}
+
 QVariant RawDatabase::extractData(sqlite3_stmt *stmt, int col)
 {
     int type = sqlite3_column_type(stmt, col);
@@ -484,3 +1153,32 @@ QVariant RawDatabase::extractData(sqlite3_stmt *stmt, int col)
         return QByteArray::fromRawData(data, len);
     }
 }
+
+int RawDatabase::Row::columnCount() const
+{
+    return sqlite3_column_count(stmt);
+}
+
+bool RawDatabase::Row::isNull(int col) const
+{
+    return sqlite3_column_type(stmt, col) == SQLITE_NULL;
+}
+
+int64_t RawDatabase::Row::getInt64(int col) const
+{
+    return sqlite3_column_int64(stmt, col);
+}
+
+QString RawDatabase::Row::getString(int col) const
+{
+    const char* str = reinterpret_cast<const char*>(sqlite3_column_text(stmt, col));
+    int len = sqlite3_column_bytes(stmt, col);
+    return QString::fromUtf8(str, len);
+}
+
+QByteArray RawDatabase::Row::getRawData(int col) const
+{
+    const char* data = reinterpret_cast<const char*>(sqlite3_column_blob(stmt, col));
+    int len = sqlite3_column_bytes(stmt, col);
+    return QByteArray::fromRawData(data, len);
+}
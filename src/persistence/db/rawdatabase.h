@@ -8,62 +8,160 @@
 #include <QVector>
 #include <QPair>
 #include <QMutex>
+#include <QWaitCondition>
 #include <QVariant>
+#include <QCache>
+#include <QElapsedTimer>
 #include <memory>
+#include <vector>
 #include <atomic>
 
+class QTimer;
 struct sqlite3;
 struct sqlite3_stmt;
 
 /// Implements a low level RAII interface to a SQLCipher (SQlite3) database
 /// Thread-safe, does all database operations on a worker thread
 /// The queries must not contain transaction commands (BEGIN/COMMIT/...) or the behavior is undefined
+/// Transactions executed with execLater may be coalesced into a single SQLite transaction,
+/// so they must not contain statements that can't run inside a transaction (VACUUM, ATTACH, ...)
 class RawDatabase : QObject
 {
     Q_OBJECT
 
 public:
+    /// A result row, reading its columns straight from the statement without converting them to QVariants
+    /// Only valid during the row callback it was passed to, and so is any data returned by getRawData
+    class Row
+    {
+    public:
+        int columnCount() const;
+        bool isNull(int col) const;
+        int64_t getInt64(int col) const;
+        /// Decodes the column as UTF-8 text
+        QString getString(int col) const;
+        /// Returns the bytes of the column without copying them, only valid until the callback returns
+        QByteArray getRawData(int col) const;
+    private:
+        explicit Row(sqlite3_stmt* stmt) : stmt{stmt} {}
+        sqlite3_stmt* stmt;
+
+        friend class RawDatabase;
+    };
+
     /// A query to be executed by the database. Can be composed of one or more SQL statements in the query,
-    /// optional BLOB parameters to be bound, and callbacks fired when the query is executed
+    /// optional parameters to be bound, and callbacks fired when the query is executed
+    /// Parameters are bound in order to the '?' placeholders of all the statements of the query,
+    /// integers are bound as INTEGER, QStrings as TEXT, QByteArrays as BLOB and null QVariants as NULL
     /// Calling any database method from a query callback is undefined behavior
     class Query
     {
     public:
-        Query(QString query, QVector<QByteArray> blobs = {}, std::function<void(int64_t)> insertCallback={})
-            : query{query.toUtf8()}, blobs{blobs}, insertCallback{insertCallback} {}
+        Query(QString query, QVector<QVariant> params = {}, std::function<void(int64_t)> insertCallback={})
+            : query{query.toUtf8()}, params{params}, insertCallback{insertCallback} {}
         Query(QString query, std::function<void(int64_t)> insertCallback)
             : query{query.toUtf8()}, insertCallback{insertCallback} {}
         Query(QString query, std::function<void(const QVector<QVariant>&)> rowCallback)
             : query{query.toUtf8()}, rowCallback{rowCallback} {}
+        Query(QString query, QVector<QVariant> params, std::function<void(const QVector<QVariant>&)> rowCallback)
+            : query{query.toUtf8()}, params{params}, rowCallback{rowCallback} {}
+        Query(QString query, QVector<QVariant> params, std::function<void(const Row&)> rowCursorCallback)
+            : query{query.toUtf8()}, params{params}, rowCursorCallback{rowCursorCallback} {}
+        Query(QString query, std::function<void(const Row&)> rowCursorCallback)
+            : query{query.toUtf8()}, rowCursorCallback{rowCursorCallback} {}
         Query() = default;
+        /// Returns a query that stays out of the statement cache, its text is wiped once it's executed
+        /// For the statements with our encryption key in their text
+        static Query secret(const QString& query)
+        {
+            Query secretQuery{query};
+            secretQuery.cached = false;
+            return secretQuery;
+        }
     private:
         QByteArray query; ///< UTF-8 query string
-        QVector<QByteArray> blobs; ///< Bound data blobs
+        QVector<QVariant> params; ///< Bound parameters
         std::function<void(int64_t)> insertCallback; ///< Called after execution with the last insert rowid
         std::function<void(const QVector<QVariant>&)> rowCallback; ///< Called during execution for each row
-        QVector<sqlite3_stmt*> statements; ///< Statements to be compiled from the query
+        std::function<void(const Row&)> rowCursorCallback; ///< Same, but reads the row without QVariants
+        bool cached = true; ///< If false, the statements are compiled for this execution only
 
         friend class RawDatabase;
     };
 
+    /// Which lane of the queue a transaction waits in
+    /// Interactive transactions skip ahead of the background ones, so they mustn't depend on pending writes
+    enum class Priority
+    {
+        Background, ///< Writes and maintenance, executed in the order they were queued
+        Interactive ///< Reads the GUI is waiting for
+    };
+
+    /// Performance related settings, applied with PRAGMAs every time the database is opened
+    struct OpenOptions
+    {
+        enum class Synchronous : int {Off = 0, Normal = 1, Full = 2};
+
+        bool walJournal = true; ///< Use a write-ahead log instead of a rollback journal
+        Synchronous synchronous = Synchronous::Normal; ///< How often SQLite waits for data to reach the disk
+        int cacheSizeKiB = 8192; ///< Maximum size of the page cache
+        int mmapSizeMiB = 0; ///< Maximum size of memory mapped I/O, 0 disables it
+        bool memoryTempStore = true; ///< Keep temporary tables and indices in memory
+        /// Read-only connections for readNow and readLater, only opened with walJournal
+        int readConnections = 2;
+    };
+
 public:
     /// Tries to open a database
     /// If password is empty, the database will be opened unencrypted
     /// Otherwise we will use toxencryptsave to derive a key and encrypt the database
-    RawDatabase(const QString& path, const QString& password);
+    RawDatabase(const QString& path, const QString& password, const OpenOptions& options);
     ~RawDatabase();
     bool isOpen(); ///< Returns true if the database was opened successfully
     /// Executes a SQL transaction synchronously.
     /// Returns whether the transaction was successful.
     bool execNow(const QString& statement);
-    bool execNow(const Query& statement);
-    bool execNow(const QVector<Query>& statements);
+    bool execNow(const Query& statement, Priority priority = Priority::Background);
+    bool execNow(const QVector<Query>& statements, Priority priority = Priority::Background);
     /// Executes a SQL transaction asynchronously.
     void execLater(const QString& statement);
     void execLater(const Query& statement);
     void execLater(const QVector<Query>& statements);
-    /// Waits until all the pending transactions are executed
+    /// Executes a SQL transaction asynchronously, then calls the completion callback
+    /// from the worker thread with whether the transaction was successful
+    /// Interactive transactions are never batched, they don't wait for the batching window
+    void execLater(const QVector<Query>& statements, std::function<void(bool)> completionCallback,
+                   Priority priority = Priority::Background);
+    /// Executes a read-only SQL transaction synchronously on one of the read connections
+    /// Reads with the same key always use the same connection, so they run in order, and different
+    /// keys may run in parallel. With an empty key, any connection is used.
+    /// The reads don't wait for the transactions queued on the main connection, they may not see them yet.
+    /// If there is no read connection, runs in the interactive lane of the main connection instead.
+    bool readNow(const Query& statement, const QString& key = QString());
+    bool readNow(const QVector<Query>& statements, const QString& key = QString());
+    /// Same as readNow, but asynchronously, the completion callback is called from the read connection's thread
+    void readLater(const QVector<Query>& statements, std::function<void(bool)> completionCallback,
+                   const QString& key = QString());
+    /// Waits until all the pending transactions and reads are executed
     void sync();
+    /// Returns how many transactions are waiting for the worker thread, thread-safe
+    int pendingCount();
+    /// Changes the password without blocking, the worker thread exports the database to a new file with the new key,
+    /// then swaps it with the old one. The transactions queued meanwhile wait until it's done.
+    /// progressCallback is called from the worker thread with a percentage, completionCallback with the result
+    void setPasswordLater(const QString& password, std::function<void(int)> progressCallback,
+                          std::function<void(bool)> completionCallback);
+    /// Interrupts a password change in progress, the database then keeps its old password
+    void cancelPasswordChange();
+    /// Asynchronously returns the free pages of the database to the filesystem, after the pending transactions
+    /// The first compaction switches the database to incremental auto_vacuum, which needs a full VACUUM
+    void compactLater();
+    /// Sets how long execLater transactions may wait to be coalesced with the next ones,
+    /// and how many of them can be committed together. A window of 0 disables the wait.
+    void setBatching(int windowMs, int maxTransactions);
+    /// Derives a 256bit key from the password and returns it hex-encoded
+    /// The key is cached, deriving it ahead of time makes opening the database faster
+    static QString deriveKey(QString password);
 
 public slots:
     /// Changes the database password, encrypting or decrypting if necessary
@@ -86,33 +184,162 @@ protected slots:
     /// Unqueues, compiles, binds and executes queries, then notifies of results
     /// MUST only be called from the worker thread
     void process();
+    /// Processes the pending transactions now if we have enough of them to fill a batch,
+    /// otherwise waits for the batching window to expire
+    void scheduleProcess();
+    /// Implements setPasswordLater, processes the next pending password change
+    void processPasswordChange();
+    /// Implements compactLater, VACUUM can't run in a transaction so this is never batched
+    void compact();
 
 protected:
-    /// Derives a 256bit key from the password and returns it hex-encoded
-    static QString deriveKey(QString password);
+    /// Insert callbacks waiting for their transaction to commit, with the rowid each gets
+    using PendingInserts = QVector<QPair<std::function<void(int64_t)>, int64_t>>;
+
+    /// Applies our OpenOptions to the newly opened database
+    bool applyOptions();
+    /// Opens the read connections, if our options ask for any
+    void openReaders(const QString& hexKey);
+    /// Closes the read connections, after they finish the reads queued on them
+    void closeReaders();
+    /// Changes the key of the database, processing all the pending transactions first
+    /// MUST only be called from the worker thread
+    bool changeKey(const QString& password, std::function<void(int)> progressCallback);
+    /// Exports the database to a temporary file with hexKey, or unencrypted if it's empty, then replaces the
+    /// database with it. The database keeps its old key if the export fails or is cancelled.
+    bool exportWithKey(const QString& hexKey, std::function<void(int)> progressCallback);
+    /// SQLite progress handler of exportWithKey, reports the progress and interrupts the export when cancelled
+    static int exportProgressHandler(void* exportProgress);
     /// Extracts a variant from one column of a result row depending on the column type
     static QVariant extractData(sqlite3_stmt* stmt, int col);
+    /// Executes a query on the main connection, MUST only be called from the worker thread
+    bool executeQuery(Query& query, PendingInserts* pendingInserts = nullptr);
+    /// Binds a parameter to a statement according to its type, returns the SQLite result code
+    static int bindParam(sqlite3_stmt* stmt, int index, const QVariant& param);
 
 private:
+    /// Lives on the stack of an execNow caller, which sleeps on the condition until the worker is done
+    struct Completion
+    {
+        QMutex mutex;
+        QWaitCondition condition;
+        bool done = false;
+        bool success = false;
+    };
+
     /// SQL transactions to be processed
     /// A transaction is made of queries, which can have bound BLOBs
     struct Transaction
     {
         QVector<Query> queries;
-        /// If not a nullptr, the result of the transaction will be set
-        std::atomic_bool* success = nullptr;
-        /// If not a nullptr, will be set to true when the transaction has been executed
-        std::atomic_bool* done = nullptr;
+        /// If not a nullptr, gets the result of the transaction and its waiter is woken up
+        Completion* completion = nullptr;
+        /// If true, may be committed along with other batchable transactions
+        bool batchable = false;
+        /// If set, called with the result of the transaction once it has been executed
+        std::function<void(bool)> completionCallback;
+    };
+
+    /// A password change requested with setPasswordLater
+    struct PasswordChange
+    {
+        QString password;
+        std::function<void(int)> progressCallback;
+        std::function<void(bool)> completionCallback;
+    };
+
+    /// State of a running exportWithKey, passed to the progress handler
+    struct ExportProgress
+    {
+        RawDatabase* db;
+        QString tmpPath;
+        qint64 totalSize;
+        int lastPercent;
+        QElapsedTimer reportTimer;
+        std::function<void(int)> callback;
     };
 
+    /// The compiled statements of one query, finalized when evicted from the statement cache
+    struct CompiledQuery
+    {
+        ~CompiledQuery();
+        QVector<sqlite3_stmt*> statements;
+    };
+
+    /// LRU cache of compiled statements keyed by query text, one per connection
+    using StatementCache = QCache<QByteArray, CompiledQuery>;
+
+    /// A read-only connection with its own thread, defined in the source file
+    class ReadConnection;
+
+    /// Maximum number of distinct queries whose compiled statements are kept around
+    static constexpr int maxCachedQueries = 64;
+    /// Default number of milliseconds execLater transactions wait to be coalesced
+    static constexpr int defaultBatchWindow = 50;
+    /// Default maximum number of transactions committed together
+    static constexpr int defaultMaxBatchSize = 256;
+    /// Interactive transactions executed in a row before a waiting background batch gets its turn
+    static constexpr int maxInteractiveStreak = 8;
+    /// Number of SQLite VM instructions between two calls of the export progress handler
+    static constexpr int exportProgressOps = 10000;
+    /// Minimum milliseconds between two export progress reports
+    static constexpr int exportProgressInterval = 100;
+
+private:
+    /// Compiles, binds and executes every statement of a query, then resets them for reuse
+    /// Compiled statements are fetched from and stored into the connection's statement cache
+    /// With pendingInserts, the insert callback is queued there instead of called, for after the commit
+    static bool executeQuery(sqlite3* sqlite, StatementCache& statementCache, Query& query,
+                             PendingInserts* pendingInserts = nullptr);
+    /// Compiles all the statements of a query, returns false and frees them on failure
+    /// With secret set, a failure isn't logged along with the query
+    static bool compileQuery(sqlite3* sqlite, const QByteArray& query, QVector<sqlite3_stmt*>& statements,
+                             bool secret = false);
+    /// Executes one transaction on its own, returns whether it was successful
+    /// The insert callbacks of its queries are only called once it's committed
+    static bool executeTransaction(sqlite3* sqlite, StatementCache& statementCache, Transaction& trans);
+    /// Same, on the main connection
+    bool executeTransaction(Transaction& trans);
+    /// Executes several transactions in a single SQLite transaction, then signals each result
+    /// If SQLite rolls the whole batch back, its transactions run again on their own
+    void executeBatch(QVector<Transaction>& batch);
+    /// Notifies the caller of a transaction of its result
+    static void signalResult(const Transaction& trans, bool succeeded);
+    /// Blocks until the transaction of the completion is done, returns its result
+    static bool waitFor(Completion& completion);
+    /// Queues a read on the connection of its key, returns false if we have no read connection
+    bool queueRead(const Transaction& trans, const QString& key);
+
 private:
     sqlite3* sqlite;
     std::unique_ptr<QThread> workerThread;
+    /// Fires when the batching window of the pending execLater transactions expires
+    QTimer* batchTimer;
     QQueue<Transaction> pendingTransactions;
-    /// Protects pendingTransactions
+    /// The interactive lane, drained before pendingTransactions
+    QQueue<Transaction> interactiveTransactions;
+    /// Interactive transactions executed since the last background one, only used by the worker thread
+    int interactiveStreak;
+    /// Pending setPasswordLater requests, also protected by transactionsMutex
+    QQueue<PasswordChange> pendingPasswordChanges;
+    /// Protects pendingTransactions and interactiveTransactions
     QMutex transactionsMutex;
+    /// Set by cancelPasswordChange to interrupt a running export
+    std::atomic_bool cancelExport{false};
+    /// LRU cache of compiled statements keyed by query text, kept across transactions
+    /// Only accessed from the worker thread, cleared before closing the database
+    StatementCache statementCache;
+    /// Opened and closed with the main connection, by the worker thread
+    std::vector<std::unique_ptr<ReadConnection>> readers;
+    /// Protects readers, so a read isn't queued on a connection being closed
+    QMutex readersMutex;
+    /// Picks the read connection of reads without a key
+    std::atomic_uint nextReader{0};
     QString path;
     QString currentHexKey;
+    OpenOptions options;
+    std::atomic_int batchWindow;
+    std::atomic_int maxBatchSize;
 };
 
 #endif // RAWDATABASE_H
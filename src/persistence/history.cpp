@@ -3,18 +3,34 @@
 #include "src/persistence/settings.h"
 #include "src/persistence/db/rawdatabase.h"
 #include "src/persistence/historykeeper.h"
+#include "src/persistence/chatexporter.h"
+#include "src/core/toxid.h"
+#include "src/persistence/serialize.h"
 #include <QDebug>
+#include <QCryptographicHash>
+#include <QRegularExpression>
+#include <QTimer>
+#include <QIODevice>
+#include <QtEndian>
 #include <cassert>
+#include <algorithm>
+#include <memory>
 
 using namespace std;
 
 History::History(const QString &profileName, const QString &password)
-    : db{getDbPath(profileName), password}
+    : db{getDbPath(profileName), password, getDbOptions()}
 {
     init();
+
+    retentionTimer = new QTimer{this};
+    retentionTimer->setInterval(retentionInterval);
+    connect(retentionTimer, &QTimer::timeout, this, &History::enforceRetention);
+    retentionTimer->start();
+    QTimer::singleShot(retentionStartDelay, this, SLOT(enforceRetention()));
 }
 
-History::History(const QString &profileName, const QString &password, const HistoryKeeper &oldHistory)
+History::History(const QString &profileName, const QString &password, HistoryKeeper &oldHistory)
     : History{profileName, password}
 {
     import(oldHistory);
@@ -23,7 +39,8 @@ History::History(const QString &profileName, const QString &password, const Hist
 History::~History()
 {
     // We could have execLater requests pending with a lambda attached,
-    // so clear the pending transactions first
+    // so clear the pending transactions first. A running removal resumes on the next start.
+    closing.store(true, std::memory_order_release);
     db.sync();
 }
 
@@ -32,9 +49,233 @@ bool History::isValid()
     return db.isOpen();
 }
 
+int History::pendingWrites()
+{
+    return db.pendingCount();
+}
+
+// The stream starts with "qToxHist", a version byte and a flags byte, followed by blocks.
+// A block is its varint length and a payload of records, qCompressed if the header says so.
+// A record is its varint length, then the varint timestamp, a flags byte, and the chat key, sender key,
+// display name and message, each as a varint length and UTF-8 data. An empty block ends the stream.
+// Version 1 streams have no group chats, their records never have streamGroupChatFlag.
+bool History::exportStream(QIODevice *device, bool compress)
+{
+    if (!isValid() || !device->isWritable())
+    {
+        qWarning() << "Can't export the history, the database or the device is not open";
+        return false;
+    }
+
+    QByteArray header{"qToxHist"};
+    header += uint8ToData(streamVersion);
+    header += uint8ToData(compress ? streamCompressedFlag : 0);
+    if (device->write(header) != header.size())
+        return false;
+
+    QByteArray block;
+    bool writeFailed = false;
+    auto writeBlock = [&]()
+    {
+        QByteArray payload = compress && !block.isEmpty() ? qCompress(block) : block;
+        QByteArray data = vuintToData(payload.size()) + payload;
+        writeFailed = writeFailed || device->write(data) != data.size();
+        block.clear();
+    };
+
+    bool ok = db.execNow(RawDatabase::Query{"SELECT timestamp, faux_offline_pending.id, chat.public_key, "
+                                                   "sender.public_key, aliases.display_name, message, chat.kind FROM history "
+                                            "LEFT JOIN faux_offline_pending ON history.id = faux_offline_pending.id "
+                                            "JOIN peers chat ON chat_id = chat.id "
+                                            "JOIN aliases ON sender_alias = aliases.id "
+                                            "JOIN peers sender ON aliases.owner = sender.id "
+                                            "ORDER BY history.id;",
+                                            [&](const RawDatabase::Row& row)
+    {
+        if (writeFailed)
+            return;
+
+        QByteArray record = vuintToData(row.getInt64(0));
+        uint8_t flags = row.isNull(1) ? 0 : streamPendingFlag;
+        if (row.getInt64(6) == static_cast<int>(ChatKind::Group))
+            flags |= streamGroupChatFlag;
+        record += uint8ToData(flags);
+        for (int col = 2; col < 6; ++col)
+        {
+            QByteArray field = row.getRawData(col);
+            record += vuintToData(field.size());
+            record += field;
+        }
+
+        block += vuintToData(record.size());
+        block += record;
+        if (block.size() >= streamBlockSize)
+            writeBlock();
+    }});
+
+    if (!block.isEmpty())
+        writeBlock();
+    writeBlock();
+
+    if (!ok || writeFailed)
+    {
+        qWarning() << "Failed to export the history";
+        return false;
+    }
+    return true;
+}
+
+bool History::importStream(QIODevice *device)
+{
+    if (!isValid() || !device->isReadable())
+    {
+        qWarning() << "Can't import the history, the database or the device is not open";
+        return false;
+    }
+
+    QByteArray header = device->read(10);
+    uint8_t version = header.size() == 10 ? dataToUint8(header.mid(8)) : 0;
+    if (!header.startsWith("qToxHist") || version < 1 || version > streamVersion)
+    {
+        qWarning() << "Can't import the history, unknown stream format";
+        return false;
+    }
+    bool compressed = dataToUint8(header.mid(9)) & streamCompressedFlag;
+
+    forever
+    {
+        quint64 blockSize;
+        if (!readStreamVUint(device, blockSize) || blockSize > static_cast<quint64>(maxStreamBlockSize))
+        {
+            qWarning() << "History stream is truncated or corrupted";
+            return false;
+        }
+        if (blockSize == 0)
+            return true;
+
+        QByteArray payload = device->read(blockSize);
+        if (static_cast<quint64>(payload.size()) != blockSize)
+        {
+            qWarning() << "History stream is truncated";
+            return false;
+        }
+        if (compressed)
+        {
+            // qUncompress allocates whatever the size prefix says, and returns an empty array on corrupted data
+            if (payload.size() < 4 || qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(payload.constData()))
+                    > static_cast<quint32>(maxStreamBlockSize))
+            {
+                qWarning() << "History stream has a corrupted compressed block";
+                return false;
+            }
+            payload = qUncompress(payload);
+            if (payload.isEmpty())
+            {
+                qWarning() << "History stream has a corrupted compressed block";
+                return false;
+            }
+        }
+
+        QVector<RawDatabase::Query> queries;
+        int pos = 0;
+        while (pos < payload.size())
+        {
+            QByteArray record;
+            if (!readField(payload, pos, record))
+            {
+                qWarning() << "History stream has a corrupted block";
+                return false;
+            }
+
+            // Newer versions may append fields to records, we only read the ones we know
+            int recordPos = 0;
+            quint64 timestamp;
+            QByteArray chat, sender, dispName, message;
+            if (!readVUint(record, recordPos, timestamp) || recordPos >= record.size())
+            {
+                qWarning() << "History stream has a corrupted message";
+                return false;
+            }
+            uint8_t flags = dataToUint8(record.mid(recordPos++));
+            if (!readField(record, recordPos, chat) || !readField(record, recordPos, sender)
+                || !readField(record, recordPos, dispName) || !readField(record, recordPos, message))
+            {
+                qWarning() << "History stream has a corrupted message";
+                return false;
+            }
+
+            ChatKind kind = flags & streamGroupChatFlag ? ChatKind::Group : ChatKind::Friend;
+            queries += generateNewMessageQueries(QString::fromUtf8(chat), QString::fromUtf8(message),
+                                                 QString::fromUtf8(sender),
+                                                 QDateTime::fromMSecsSinceEpoch(static_cast<qint64>(timestamp)),
+                                                 !(flags & streamPendingFlag), QString::fromUtf8(dispName),
+                                                 {}, kind);
+        }
+
+        if (!db.execNow(queries))
+        {
+            qWarning() << "Failed to import a block of the history stream";
+            // The failed block may have cached peers and aliases that were rolled back
+            loadIdCaches();
+            return false;
+        }
+    }
+}
+
+bool History::readStreamVUint(QIODevice *device, quint64 &value)
+{
+    QByteArray data;
+    char byte;
+    do
+    {
+        if (data.size() == 10 || !device->getChar(&byte))
+            return false;
+        data += byte;
+    } while (byte & 0x80);
+
+    value = dataToVUint(data);
+    return true;
+}
+
+bool History::readVUint(const QByteArray &data, int &pos, quint64 &value)
+{
+    int end = pos;
+    do
+    {
+        if (end >= data.size() || end - pos == 10)
+            return false;
+    } while (data[end++] & 0x80);
+
+    value = dataToVUint(data.mid(pos, end - pos));
+    pos = end;
+    return true;
+}
+
+bool History::readField(const QByteArray &data, int &pos, QByteArray &field)
+{
+    quint64 size;
+    if (!readVUint(data, pos, size) || size > static_cast<quint64>(data.size() - pos))
+        return false;
+
+    field = data.mid(pos, size);
+    pos += size;
+    return true;
+}
+
 void History::setPassword(const QString& password)
 {
-    db.setPassword(password);
+    db.setPasswordLater(password, [this](int percent)
+    {
+        emit passwordChangeProgress(percent);
+    }, [this](bool success)
+    {
+        emit passwordChanged(success);
+    });
+}
+
+void History::cancelPasswordChange()
+{
+    db.cancelPasswordChange();
 }
 
 void History::rename(const QString &newName)
@@ -47,91 +288,169 @@ bool History::remove()
     return db.remove();
 }
 
+/**
+@brief Removes the peers, then deletes the messages in the background.
+
+Every read joins the messages with their chat's peer, so they disappear with it.
+The ids of the removed peers and aliases are never handed out again, the new messages
+can't be mistaken for the old ones that are still waiting to be deleted.
+*/
 void History::eraseHistory()
 {
-    db.execNow("DELETE FROM faux_offline_pending;"
-               "DELETE FROM history;"
-               "DELETE FROM aliases;"
-               "DELETE FROM peers;"
-               "VACUUM;");
+    db.execLater("INSERT OR REPLACE INTO history_removals "
+                   "SELECT DISTINCT chat_id, (SELECT IFNULL(MAX(id), -1) FROM history) FROM history_hours;"
+                 "DELETE FROM aliases;"
+                 "DELETE FROM peers;");
+    peers.removeAll();
+    aliases.clear();
+    removeQueuedChats();
 }
 
+/**
+@brief Deletes the messages of the chat written so far in the background.
+
+The friend's peer and aliases are kept, the messages they sent in group chats refer to them.
+The messages disappear chunk by chunk, the new ones are kept since they're past the last id we recorded.
+*/
 void History::removeFriendHistory(const QString &friendPk)
 {
-    if (!peers.contains(friendPk))
+    qint64 id = peers.find(ToxPk(friendPk));
+    if (id < 0)
         return;
-    int64_t id = peers[friendPk];
-
-    if (db.execNow(QString("DELETE FROM faux_offline_pending "
-               "WHERE faux_offline_pending.id IN ( "
-                 "SELECT faux_offline_pending.id FROM faux_offline_pending "
-                 "LEFT JOIN history ON faux_offline_pending.id = history.id "
-                 "WHERE chat_id=%1 "
-               "); "
-               "DELETE FROM history WHERE chat_id=%1; "
-               "DELETE FROM aliases WHERE owner=%1; "
-               "DELETE FROM peers WHERE id=%1; "
-               "VACUUM;").arg(id)))
-    {
-        peers.remove(friendPk);
-    }
-    else
-    {
-        qWarning() << "Failed to remove friend's history";
-    }
+
+    db.execLater(RawDatabase::Query{"INSERT OR REPLACE INTO history_removals (chat_id, last_id) "
+                                    "SELECT ?, IFNULL(MAX(id), -1) FROM history;", {id}});
+    removeQueuedChats();
 }
 
-QVector<RawDatabase::Query> History::generateNewMessageQueries(const QString &friendPk, const QString &message,
-                                        const QString &sender, const QDateTime &time, bool isSent, QString dispName,
-                                                               std::function<void(int64_t)> insertIdCallback)
+void History::removeQueuedChats(bool continuing)
 {
-    QVector<RawDatabase::Query> queries;
-
-    // Get the db id of the peer we're chatting with
-    int64_t peerId;
-    if (peers.contains(friendPk))
+    // The message counts per chat come from the small history_hours table, not from the messages
+    auto chats = make_shared<QVector<QPair<qint64, qint64>>>();
+    auto remaining = make_shared<qint64>(0);
+    db.execLater({RawDatabase::Query{"SELECT history_removals.chat_id, last_id, IFNULL(SUM(count), 0) "
+                                     "FROM history_removals LEFT JOIN history_hours "
+                                       "ON history_hours.chat_id = history_removals.chat_id "
+                                     "GROUP BY history_removals.chat_id;",
+                                     [chats, remaining](const RawDatabase::Row& row)
     {
-        peerId = peers[friendPk];
-    }
-    else
+        *chats += qMakePair(row.getInt64(0), row.getInt64(1));
+        *remaining += row.getInt64(2);
+    }}}, [this, chats, remaining, continuing](bool succeeded)
     {
-        if (peers.isEmpty())
-            peerId = 0;
-        else
-            peerId = *max_element(begin(peers), end(peers))+1;
-        peers[friendPk] = peerId;
-        queries += RawDatabase::Query{("INSERT INTO peers (id, public_key) VALUES (%1, '"+friendPk+"');").arg(peerId)};
-    }
+        if (!succeeded)
+        {
+            qWarning() << "Failed to list the chats to remove from the history";
+            if (continuing)
+                chatRemoval.reset();
+            return;
+        }
+
+        bool running = chatRemoval != nullptr;
+        if (!running)
+        {
+            if (chats->isEmpty())
+                return;
+            chatRemoval.reset(new ChatRemoval);
+        }
+
+        chatRemoval->chats = *chats;
+        chatRemoval->total = chatRemoval->removed + *remaining;
+        if (running && !continuing)
+            return;
+
+        if (chats->isEmpty())
+        {
+            qDebug() << "Removed"<<chatRemoval->removed<<"messages from the history";
+            emit historyRemovalProgress(chatRemoval->removed, chatRemoval->removed);
+            chatRemoval.reset();
+            db.compactLater();
+            return;
+        }
+
+        removeNextChunk();
+    });
+}
+
+void History::removeNextChunk()
+{
+    if (closing.load(std::memory_order_acquire))
+        return;
 
-    // Get the db id of the sender of the message
-    int64_t senderId;
-    if (peers.contains(sender))
+    // Both subqueries read the same range of the chat_id index, so they select the same messages
+    // The chat's removal is over once it has no message left up to its last id
+    QPair<qint64, qint64> chat = chatRemoval->chats.first();
+    auto deleted = make_shared<qint64>(0);
+    db.execLater({RawDatabase::Query{"DELETE FROM faux_offline_pending WHERE id IN "
+                                       "(SELECT id FROM history WHERE chat_id = ? AND id <= ? LIMIT ?);"
+                                     "DELETE FROM history WHERE id IN "
+                                       "(SELECT id FROM history WHERE chat_id = ? AND id <= ? LIMIT ?);"
+                                     "SELECT changes();"
+                                     "DELETE FROM history_removals WHERE chat_id = ? AND last_id = ? AND NOT EXISTS "
+                                       "(SELECT 1 FROM history WHERE chat_id = ? AND id <= ?);",
+                                     {chat.first, chat.second, removalChunkSize,
+                                      chat.first, chat.second, removalChunkSize,
+                                      chat.first, chat.second, chat.first, chat.second},
+                                     [deleted](const RawDatabase::Row& row)
     {
-        senderId = peers[sender];
-    }
-    else
+        *deleted = row.getInt64(0);
+    }}}, [this, chat, deleted](bool succeeded)
     {
-        if (peers.isEmpty())
-            senderId = 0;
+        if (!succeeded)
+        {
+            qWarning() << "Failed to remove messages from the history, will try again on the next start";
+            chatRemoval.reset();
+            return;
+        }
+
+        // The chunk was queued behind the writes made since the last one, so they're never held up for long
+        chatRemoval->removed += *deleted;
+        emit historyRemovalProgress(chatRemoval->removed, chatRemoval->total);
+        // The list may have been refreshed meanwhile, so we look for our chat
+        if (*deleted < removalChunkSize)
+            chatRemoval->chats.removeOne(chat);
+
+        if (closing.load(std::memory_order_acquire))
+            return;
+
+        // A chat may have been removed meanwhile, so we list them again before we're done
+        if (chatRemoval->chats.isEmpty())
+            removeQueuedChats(true);
         else
-            senderId = *max_element(begin(peers), end(peers))+1;
-        peers[sender] = senderId;
-        queries += RawDatabase::Query{("INSERT INTO peers (id, public_key) VALUES (%1, '"+sender+"');").arg(senderId)};
-    }
+            removeNextChunk();
+    });
+}
 
-    queries += RawDatabase::Query(QString("INSERT OR IGNORE INTO aliases (owner, display_name) VALUES (%1, ?);")
-                                  .arg(senderId), {dispName.toUtf8()});
+QVector<RawDatabase::Query> History::generateNewMessageQueries(const QString &friendPk, const QString &message,
+                                        const QString &sender, const QDateTime &time, bool isSent, QString dispName,
+                                                               std::function<void(int64_t)> insertIdCallback,
+                                                               ChatKind kind)
+{
+    QVector<RawDatabase::Query> queries;
+
+    // Get the db ids of the peer we're chatting with and of the sender of the message
+    bool isNewPeer;
+    qint64 peerId = peers.findOrInsert(ToxPk(friendPk), isNewPeer);
+    if (isNewPeer)
+        queries += RawDatabase::Query{"INSERT INTO peers (id, public_key, kind) VALUES (?, ?, ?);",
+                                      {peerId, friendPk, static_cast<int>(kind)}};
+
+    qint64 senderId = peers.findOrInsert(ToxPk(sender), isNewPeer);
+    if (isNewPeer)
+        queries += RawDatabase::Query{"INSERT INTO peers (id, public_key) VALUES (?, ?);", {senderId, sender}};
 
-    // If the alias already existed, the insert will ignore the conflict and last_insert_rowid() will return garbage,
-    // so we have to check changes() and manually fetch the row ID in this case
-    queries += RawDatabase::Query(QString("INSERT INTO history (timestamp, chat_id, message, sender_alias) "
-                                          "VALUES (%1, %2, ?, ("
-                                          "  CASE WHEN changes() IS 0 THEN ("
-                                          "    SELECT id FROM aliases WHERE owner=%3 AND display_name=?)"
-                                          "  ELSE last_insert_rowid() END"
-                                          "));")
-                                    .arg(time.toMSecsSinceEpoch()).arg(peerId).arg(senderId),
-                                    {message.toUtf8(), dispName.toUtf8()}, insertIdCallback);
+    // Get the db id of the sender's alias, only new aliases need to touch the aliases table
+    QByteArray dispNameData = dispName.toUtf8();
+    bool isNewAlias;
+    qint64 aliasId = findOrInsertAlias(senderId, dispNameData, isNewAlias);
+    if (isNewAlias)
+        queries += RawDatabase::Query("INSERT INTO aliases (id, owner, display_name) VALUES (?, ?, ?);",
+                                      {aliasId, senderId, dispNameData});
+
+    queries += RawDatabase::Query("INSERT INTO history (timestamp, chat_id, message, sender_alias) "
+                                  "VALUES (?, ?, ?, ?);",
+                                  {time.toMSecsSinceEpoch(), peerId, message.toUtf8(), aliasId},
+                                  insertIdCallback);
 
     if (!isSent)
         queries += RawDatabase::Query{"INSERT INTO faux_offline_pending (id) VALUES (last_insert_rowid());"};
@@ -139,44 +458,341 @@ QVector<RawDatabase::Query> History::generateNewMessageQueries(const QString &fr
     return queries;
 }
 
+qint64 History::findOrInsertAlias(qint64 owner, const QByteArray &displayName, bool &isNew)
+{
+    int oldSize = aliases.size();
+    qint64& id = aliases[qMakePair(owner, displayName)];
+    isNew = aliases.size() != oldSize;
+    if (isNew)
+        id = nextAliasId++;
+    return id;
+}
+
+void History::enforceRetention()
+{
+    if (!isValid())
+        return;
+
+    // Everything runs on the database thread, the settings getters are thread-safe
+    auto chats = make_shared<QVector<QPair<qint64, QString>>>();
+    RawDatabase* database = &db;
+    db.execLater({RawDatabase::Query{"SELECT id, public_key FROM peers "
+                                     "WHERE id IN (SELECT DISTINCT chat_id FROM history);",
+                                     [chats](const RawDatabase::Row& row)
+    {
+        *chats += qMakePair(row.getInt64(0), row.getString(1));
+    }}}, [chats, database](bool succeeded)
+    {
+        if (!succeeded)
+            return;
+
+        const Settings& s = Settings::getInstance();
+        const QDateTime now = QDateTime::currentDateTime();
+        QVector<RawDatabase::Query> queries;
+        for (const QPair<qint64, QString>& chat : *chats)
+        {
+            // Messages still pending delivery are kept, we need them to send them later
+            ToxId friendId{chat.second};
+            int maxAge = s.getFriendHistoryMaxAge(friendId);
+            if (maxAge > 0)
+                queries += RawDatabase::Query{"DELETE FROM history WHERE chat_id = ? AND timestamp < ? "
+                                              "AND id NOT IN (SELECT id FROM faux_offline_pending);",
+                                              {chat.first, now.addDays(-maxAge).toMSecsSinceEpoch()}};
+
+            int maxRows = s.getFriendHistoryMaxRows(friendId);
+            if (maxRows > 0)
+                queries += RawDatabase::Query{"DELETE FROM history WHERE id IN ("
+                                                "SELECT id FROM history WHERE chat_id = ? "
+                                                "ORDER BY timestamp DESC, id DESC LIMIT -1 OFFSET ?) "
+                                              "AND id NOT IN (SELECT id FROM faux_offline_pending);",
+                                              {chat.first, maxRows}};
+        }
+
+        if (queries.isEmpty())
+            return;
+
+        database->execLater(queries);
+        database->compactLater();
+    });
+}
+
 void History::addNewMessage(const QString &friendPk, const QString &message, const QString &sender,
                 const QDateTime &time, bool isSent, QString dispName, std::function<void(int64_t)> insertIdCallback)
 {
     db.execLater(generateNewMessageQueries(friendPk, message, sender, time, isSent, dispName, insertIdCallback));
 }
 
+void History::addNewGroupMessage(const QString &groupKey, const QString &message, const QString &sender,
+                                 const QDateTime &time, const QString &dispName)
+{
+    db.execLater(generateNewMessageQueries(groupKey, message, sender, time, true, dispName, {}, ChatKind::Group));
+}
+
+/**
+@brief Hashes the title into a string shaped like a public key, so the group shares the peers table.
+A group that's renamed starts a new history, and groups with the same title share theirs.
+*/
+QString History::groupChatKey(const QString &title)
+{
+    QByteArray hash = QCryptographicHash::hash("qTox group chat: " + title.toUtf8(), QCryptographicHash::Sha256);
+    return QString::fromLatin1(hash.toHex().toUpper());
+}
+
 QList<History::HistMessage> History::getChatHistory(const QString &friendPk, const QDateTime &from, const QDateTime &to)
 {
     QList<HistMessage> messages;
 
-    auto rowCallback = [&messages](const QVector<QVariant>& row)
+    // Don't forget to update the rowCallback if you change the selected columns!
+    db.readNow(RawDatabase::Query{"SELECT history.id, faux_offline_pending.id, timestamp, chat.public_key, "
+                       "aliases.display_name, sender.public_key, message FROM history "
+                "LEFT JOIN faux_offline_pending ON history.id = faux_offline_pending.id "
+                "JOIN peers chat ON chat_id = chat.id "
+                "JOIN aliases ON sender_alias = aliases.id "
+                "JOIN peers sender ON aliases.owner = sender.id "
+                "WHERE timestamp BETWEEN ? AND ? AND chat.public_key=? "
+                "ORDER BY timestamp, history.id;",
+                {from.toMSecsSinceEpoch(), to.toMSecsSinceEpoch(), friendPk}, makeHistMessageCallback(messages)},
+                friendPk);
+
+    return messages;
+}
+
+QList<History::HistMessage> History::getChatHistoryPage(const QString &friendPk, const QDateTime &beforeTime,
+                                                        qint64 beforeId, int limit)
+{
+    QList<HistMessage> messages;
+
+    // Messages are ordered by (timestamp, id), walking the (chat_id, timestamp) index backwards from the cursor
+    // Don't forget to update the rowCallback if you change the selected columns!
+    qint64 before = beforeTime.toMSecsSinceEpoch();
+    db.readNow(RawDatabase::Query{"SELECT history.id, faux_offline_pending.id, timestamp, chat.public_key, "
+                       "aliases.display_name, sender.public_key, message FROM history "
+                "LEFT JOIN faux_offline_pending ON history.id = faux_offline_pending.id "
+                "JOIN peers chat ON chat_id = chat.id "
+                "JOIN aliases ON sender_alias = aliases.id "
+                "JOIN peers sender ON aliases.owner = sender.id "
+                "WHERE chat.public_key=? AND timestamp <= ? AND (timestamp < ? OR history.id < ?) "
+                "ORDER BY timestamp DESC, history.id DESC LIMIT ?;",
+                {friendPk, before, before, beforeId, limit}, makeHistMessageCallback(messages)},
+                friendPk);
+
+    // We fetched the page newest first, but callers want it in chronological order
+    std::reverse(messages.begin(), messages.end());
+    return messages;
+}
+
+/**
+@brief Counts the messages with a friend on each day from one date to another, both included.
+
+The counts are kept per UTC hour, and each hour is counted for the local day it starts in.
+That's exact in the time zones that are a whole number of hours away from UTC. In the others
+(India, Iran, Nepal, parts of Australia, Newfoundland...) the hour around local midnight
+straddles two days and its messages all go to the earlier one, it's an approximation
+that's good enough for a calendar.
+*/
+QMap<QDate, int> History::getMessageCountPerDay(const QString &friendPk, const QDate &from, const QDate &to)
+{
+    QMap<QDate, int> counts;
+    qint64 firstHour = QDateTime(from).toMSecsSinceEpoch() / msecsPerHour;
+    qint64 lastHour = QDateTime(to.addDays(1)).toMSecsSinceEpoch() / msecsPerHour;
+    db.readNow(RawDatabase::Query{"SELECT hour, count FROM history_hours JOIN peers chat ON chat_id = chat.id "
+                "WHERE chat.public_key=? AND hour >= ? AND hour < ?;",
+                {friendPk, firstHour, lastHour}, [&counts, &from](const RawDatabase::Row& row)
+    {
+        QDate day = QDateTime::fromMSecsSinceEpoch(row.getInt64(0) * msecsPerHour).date();
+        // With a half hour offset, the first hour we read starts on the day before from
+        if (day >= from)
+            counts[day] += static_cast<int>(row.getInt64(1));
+    }}, friendPk);
+
+    return counts;
+}
+
+QList<History::HistMessage> History::getPendingMessages(const QString &friendPk)
+{
+    QList<HistMessage> messages;
+
+    // Don't forget to update the rowCallback if you change the selected columns!
+    db.execNow({"SELECT history.id, faux_offline_pending.id, timestamp, chat.public_key, "
+                       "aliases.display_name, sender.public_key, message FROM faux_offline_pending "
+                "JOIN history ON history.id = faux_offline_pending.id "
+                "JOIN peers chat ON chat_id = chat.id "
+                "JOIN aliases ON sender_alias = aliases.id "
+                "JOIN peers sender ON aliases.owner = sender.id "
+                "WHERE chat.public_key=? "
+                "ORDER BY history.id;",
+                {friendPk}, makeHistMessageCallback(messages)});
+
+    return messages;
+}
+
+bool History::hasPendingMessages(const QString &friendPk)
+{
+    bool pending = false;
+
+    // like getPendingMessages, this must see the writes that are still queued
+    db.execNow({"SELECT 1 FROM faux_offline_pending "
+                "JOIN history ON history.id = faux_offline_pending.id "
+                "JOIN peers chat ON chat_id = chat.id "
+                "WHERE chat.public_key=? LIMIT 1;",
+                {friendPk}, [&pending](const QVector<QVariant>&)
     {
-        // dispName and message could have null bytes, QString::fromUtf8 truncates on null bytes so we strip them
-        messages += {row[0].toLongLong(),
-                    row[1].isNull(),
-                    QDateTime::fromMSecsSinceEpoch(row[2].toLongLong()),
-                    row[3].toString(),
-                    QString::fromUtf8(row[4].toByteArray().replace('\0',"")),
-                    row[5].toString(),
-                    QString::fromUtf8(row[6].toByteArray().replace('\0',""))};
+        pending = true;
+    }});
+
+    return pending;
+}
+
+qint64 History::getChatHistoryAsync(const QString &friendPk, const QDateTime &from, const QDateTime &to)
+{
+    qint64 requestId = ++lastRequestId;
+
+    // The callbacks run on the database thread, the chunks are queued to the receivers' threads by our signal
+    auto chunk = std::make_shared<QList<HistMessage>>();
+    auto appendRow = makeHistMessageCallback(*chunk);
+    auto rowCallback = [this, requestId, chunk, appendRow](const RawDatabase::Row& row)
+    {
+        appendRow(row);
+        if (chunk->size() >= asyncChunkSize)
+        {
+            emit chatHistoryChunk(requestId, *chunk, false);
+            chunk->clear();
+        }
     };
 
     // Don't forget to update the rowCallback if you change the selected columns!
-    db.execNow({QString("SELECT history.id, faux_offline_pending.id, timestamp, chat.public_key, "
-                               "aliases.display_name, sender.public_key, message FROM history "
-                       "LEFT JOIN faux_offline_pending ON history.id = faux_offline_pending.id "
-                       "JOIN peers chat ON chat_id = chat.id "
-                       "JOIN aliases ON sender_alias = aliases.id "
-                       "JOIN peers sender ON aliases.owner = sender.id "
-                       "WHERE timestamp BETWEEN %1 AND %2 AND chat.public_key='%3';")
-                        .arg(from.toMSecsSinceEpoch()).arg(to.toMSecsSinceEpoch()).arg(friendPk), rowCallback});
+    RawDatabase::Query query{"SELECT history.id, faux_offline_pending.id, timestamp, chat.public_key, "
+                                    "aliases.display_name, sender.public_key, message FROM history "
+                             "LEFT JOIN faux_offline_pending ON history.id = faux_offline_pending.id "
+                             "JOIN peers chat ON chat_id = chat.id "
+                             "JOIN aliases ON sender_alias = aliases.id "
+                             "JOIN peers sender ON aliases.owner = sender.id "
+                             "WHERE timestamp BETWEEN ? AND ? AND chat.public_key=? "
+                             "ORDER BY timestamp, history.id;",
+                             {from.toMSecsSinceEpoch(), to.toMSecsSinceEpoch(), friendPk}, rowCallback};
+
+    db.readLater({query}, [this, requestId, chunk](bool succeeded)
+    {
+        if (!succeeded)
+            qWarning() << "Failed to load chat history";
+        emit chatHistoryChunk(requestId, *chunk, true);
+        chunk->clear();
+    }, friendPk);
+
+    return requestId;
+}
+
+qint64 History::exportChatAsync(const QString &friendPk, std::shared_ptr<ChatExporter> exporter)
+{
+    qint64 requestId = ++lastRequestId;
+
+    // Each row is written as soon as it's read, only the exporter's buffer is ever in memory
+    auto total = std::make_shared<qint64>(0);
+    auto exported = std::make_shared<qint64>(0);
+    RawDatabase::Query countQuery{"SELECT COUNT(*) FROM history JOIN peers chat ON chat_id = chat.id "
+                                  "WHERE chat.public_key=?;",
+                                  {friendPk}, [total](const RawDatabase::Row& row)
+    {
+        *total = row.getInt64(0);
+    }};
+
+    RawDatabase::Query query{"SELECT timestamp, faux_offline_pending.id, aliases.display_name, message FROM history "
+                             "LEFT JOIN faux_offline_pending ON history.id = faux_offline_pending.id "
+                             "JOIN peers chat ON chat_id = chat.id "
+                             "JOIN aliases ON sender_alias = aliases.id "
+                             "WHERE chat.public_key=? "
+                             "ORDER BY timestamp, history.id;",
+                             {friendPk}, [this, requestId, exporter, total, exported](const RawDatabase::Row& row)
+    {
+        if (!exporter->addMessage(decodeBlob(row.getRawData(2)), decodeBlob(row.getRawData(3)),
+                                  QDateTime::fromMSecsSinceEpoch(row.getInt64(0)), !row.isNull(1)))
+            return;
+
+        if (++*exported % exportProgressInterval == 0)
+            emit chatExportProgress(requestId, *exported, *total);
+    }};
+
+    db.readLater({countQuery, query}, [this, requestId, exporter, total](bool succeeded)
+    {
+        bool ok = exporter->finish() && succeeded;
+        if (!ok)
+            qWarning() << "Failed to export the chat history to" << exporter->getPath();
+        emit chatExportProgress(requestId, *total, *total);
+        emit chatExportFinished(requestId, ok);
+    }, friendPk);
+
+    return requestId;
+}
+
+std::function<void(const RawDatabase::Row&)> History::makeHistMessageCallback(QList<HistMessage>& messages)
+{
+    return [&messages](const RawDatabase::Row& row)
+    {
+        messages += {row.getInt64(0),
+                    row.isNull(1),
+                    QDateTime::fromMSecsSinceEpoch(row.getInt64(2)),
+                    row.getString(3),
+                    decodeBlob(row.getRawData(4)),
+                    row.getString(5),
+                    decodeBlob(row.getRawData(6))};
+    };
+}
+
+QList<History::HistMessage> History::search(const QString &query, const QString &friendPk, int limit)
+{
+    QList<HistMessage> messages;
+    QStringList terms = query.split(QRegularExpression("\\s+"), QString::SkipEmptyParts);
+    if (terms.isEmpty())
+        return messages;
+
+    // Don't forget to update the rowCallback if you change the selected columns!
+    static const QString columns = "SELECT history.id, faux_offline_pending.id, timestamp, chat.public_key, "
+                                          "aliases.display_name, sender.public_key, message FROM history "
+                                   "LEFT JOIN faux_offline_pending ON history.id = faux_offline_pending.id "
+                                   "JOIN peers chat ON chat_id = chat.id "
+                                   "JOIN aliases ON sender_alias = aliases.id "
+                                   "JOIN peers sender ON aliases.owner = sender.id ";
+
+    if (hasFullTextSearch.load(std::memory_order_acquire))
+    {
+        // Quote each term so the user can't write FTS5 syntax by accident, the terms are implicitly ANDed
+        QStringList quotedTerms;
+        for (QString term : terms)
+            quotedTerms += '"' + term.replace('"', "\"\"") + '"';
+
+        db.readNow(RawDatabase::Query{columns + "JOIN history_fts ON history_fts.rowid = history.id "
+                    "WHERE history_fts MATCH ? AND (? = '' OR chat.public_key = ?) "
+                    "ORDER BY history.id DESC LIMIT ?;",
+                    {quotedTerms.join(' '), friendPk, friendPk, limit}, makeHistMessageCallback(messages)},
+                    friendPk);
+    }
+    else
+    {
+        QString pattern = query.trimmed();
+        pattern.replace('\\', "\\\\").replace('%', "\\%").replace('_', "\\_");
+        db.readNow(RawDatabase::Query{columns + "WHERE message LIKE ? ESCAPE '\\' AND (? = '' OR chat.public_key = ?) "
+                    "ORDER BY history.id DESC LIMIT ?;",
+                    {'%' + pattern + '%', friendPk, friendPk, limit}, makeHistMessageCallback(messages)},
+                    friendPk);
+    }
 
     return messages;
 }
 
+QString History::decodeBlob(const QByteArray& data)
+{
+    // dispName and message could have null bytes, in which case we strip them
+    if (!data.contains('\0'))
+        return QString::fromUtf8(data.constData(), data.size());
+
+    QByteArray stripped{data.constData(), data.size()};
+    stripped.replace('\0', "");
+    return QString::fromUtf8(stripped.constData(), stripped.size());
+}
+
 void History::markAsSent(qint64 id)
 {
-    db.execLater(QString("DELETE FROM faux_offline_pending WHERE id=%1;").arg(id));
+    db.execLater({"DELETE FROM faux_offline_pending WHERE id=?;", {id}});
 }
 
 QString History::getDbPath(const QString &profileName)
@@ -184,6 +800,18 @@ QString History::getDbPath(const QString &profileName)
     return Settings::getInstance().getSettingsDirPath() + profileName + ".db";
 }
 
+RawDatabase::OpenOptions History::getDbOptions()
+{
+    Settings& s = Settings::getInstance();
+    RawDatabase::OpenOptions options;
+    options.walJournal = s.getHistoryWalJournal();
+    options.synchronous = static_cast<RawDatabase::OpenOptions::Synchronous>(s.getHistorySyncMode());
+    options.cacheSizeKiB = s.getHistoryCacheSize() * 1024;
+    options.mmapSizeMiB = s.getHistoryMmapSize();
+    options.memoryTempStore = s.getHistoryMemoryTempStore();
+    return options;
+}
+
 void History::init()
 {
     if (!isValid())
@@ -200,14 +828,137 @@ void History::init()
                                                      "message BLOB NOT NULL);"
                  "CREATE TABLE IF NOT EXISTS faux_offline_pending (id INTEGER PRIMARY KEY);");
 
-    // Cache our current peers
-    db.execLater(RawDatabase::Query{"SELECT public_key, id FROM peers;", [this](const QVector<QVariant>& row)
+    migrateSchema();
+    initFullTextSearch();
+
+    loadIdCaches();
+    // Finishes the removals that were interrupted when we were closed
+    removeQueuedChats();
+}
+
+void History::loadIdCaches()
+{
+    // This must complete before we save any message, or we could hand out ids that are already taken
+    peers.clear();
+    db.execNow(RawDatabase::Query{"SELECT public_key, id FROM peers;", [this](const RawDatabase::Row& row)
+    {
+        peers.insert(ToxPk(row.getString(0)), row.getInt64(1));
+    }});
+    // The messages of a removed peer may still be waiting to be deleted, a new peer mustn't get their chat id
+    db.execNow(RawDatabase::Query{"SELECT MAX(chat_id) FROM history;", [this](const RawDatabase::Row& row)
+    {
+        if (!row.isNull(0))
+            peers.reserve(row.getInt64(0));
+    }});
+
+    aliases.clear();
+    nextAliasId = 0;
+    db.execNow(RawDatabase::Query{"SELECT id, owner, display_name FROM aliases;", [this](const RawDatabase::Row& row)
+    {
+        qint64 id = row.getInt64(0);
+        QByteArray displayName = row.getRawData(2);
+        // The raw data is only valid during the callback, so make a deep copy
+        aliases[qMakePair(row.getInt64(1), QByteArray(displayName.constData(), displayName.size()))] = id;
+        nextAliasId = qMax(nextAliasId, id+1);
+    }});
+}
+
+void History::initFullTextSearch()
+{
+    bool exists = false;
+    db.execNow(RawDatabase::Query{"SELECT name FROM sqlite_master WHERE type='table' AND name='history_fts';",
+                                  [&exists](const QVector<QVariant>&)
+    {
+        exists = true;
+    }});
+
+    if (exists)
+    {
+        hasFullTextSearch.store(true, std::memory_order_release);
+        return;
+    }
+
+    // The index is kept in sync by triggers, so it also follows removeFriendHistory and eraseHistory
+    // This needs SQLCipher to be built with FTS5, we try again each time we're opened and fall back to LIKE
+    // Indexing an existing history can take a while, so we don't wait for it
+    db.execLater({RawDatabase::Query{"CREATE VIRTUAL TABLE history_fts USING fts5(message, "
+                                                "content='history', content_rowid='id');"},
+                  RawDatabase::Query{"CREATE TRIGGER history_fts_insert AFTER INSERT ON history BEGIN "
+                                       "INSERT INTO history_fts (rowid, message) VALUES (new.id, new.message); "
+                                     "END;"},
+                  RawDatabase::Query{"CREATE TRIGGER history_fts_delete AFTER DELETE ON history BEGIN "
+                                       "INSERT INTO history_fts (history_fts, rowid, message) "
+                                       "VALUES ('delete', old.id, old.message); "
+                                     "END;"},
+                  RawDatabase::Query{"INSERT INTO history_fts (history_fts) VALUES ('rebuild');"}},
+                 [this](bool succeeded)
     {
-        peers[row[0].toString()] = row[1].toInt();
+        if (!succeeded)
+            qWarning() << "Full-text search is not available, history search will be slow";
+        hasFullTextSearch.store(succeeded, std::memory_order_release);
+    });
+}
+
+void History::migrateSchema()
+{
+    // Each migration upgrades the schema from the version at its index to the next one,
+    // only ever append to this list, existing migrations have already run on users' databases
+    static const QVector<QString> migrations = {
+        // 0 -> 1: getChatHistory filters messages by chat and timestamp
+        "CREATE INDEX IF NOT EXISTS history_chat_id_timestamp ON history (chat_id, timestamp);",
+        // 1 -> 2: group chats are stored as peers too, see ChatKind
+        "ALTER TABLE peers ADD COLUMN kind INTEGER NOT NULL DEFAULT 0;",
+        // 2 -> 3: getMessageCountPerDay reads the message counts per chat and hour, kept up to date by triggers
+        "CREATE TABLE history_hours (chat_id INTEGER NOT NULL, hour INTEGER NOT NULL, count INTEGER NOT NULL, "
+                                    "PRIMARY KEY (chat_id, hour)) WITHOUT ROWID;"
+        "INSERT INTO history_hours SELECT chat_id, timestamp / 3600000, COUNT(*) FROM history "
+                                  "GROUP BY chat_id, timestamp / 3600000;"
+        "CREATE TRIGGER history_hours_insert AFTER INSERT ON history BEGIN "
+          "INSERT OR IGNORE INTO history_hours VALUES (new.chat_id, new.timestamp / 3600000, 0); "
+          "UPDATE history_hours SET count = count + 1 "
+          "WHERE chat_id = new.chat_id AND hour = new.timestamp / 3600000; "
+        "END;"
+        "CREATE TRIGGER history_hours_delete AFTER DELETE ON history BEGIN "
+          "UPDATE history_hours SET count = count - 1 "
+          "WHERE chat_id = old.chat_id AND hour = old.timestamp / 3600000; "
+          "DELETE FROM history_hours WHERE chat_id = old.chat_id AND hour = old.timestamp / 3600000 AND count <= 0; "
+        "END;",
+        // 3 -> 4: the chats whose messages up to last_id are being deleted in the background, see removeQueuedChats
+        "CREATE TABLE history_removals (chat_id INTEGER PRIMARY KEY, last_id INTEGER NOT NULL);",
+    };
+
+    int64_t version = -1;
+    db.execNow(RawDatabase::Query{"PRAGMA user_version;", [&version](const QVector<QVariant>& row)
+    {
+        version = row[0].toLongLong();
     }});
+
+    if (version < 0)
+    {
+        qWarning() << "Failed to read the history schema version";
+        return;
+    }
+
+    if (version > migrations.size())
+    {
+        qWarning() << "History schema version"<<version<<"is newer than ours, was it opened by a newer qTox?";
+        return;
+    }
+
+    for (int64_t i = version; i < migrations.size(); ++i)
+    {
+        // The version is bumped in the same transaction, so a failed migration will be retried
+        if (!db.execNow({RawDatabase::Query{migrations[i]},
+                         RawDatabase::Query{QString("PRAGMA user_version = %1;").arg(i+1)}}))
+        {
+            qWarning() << "Failed to migrate the history schema to version"<<i+1;
+            return;
+        }
+        qDebug() << "Migrated the history schema to version"<<i+1;
+    }
 }
 
-void History::import(const HistoryKeeper &oldHistory)
+void History::import(HistoryKeeper &oldHistory)
 {
     if (!isValid())
     {
@@ -215,23 +966,54 @@ void History::import(const HistoryKeeper &oldHistory)
         return;
     }
 
-    qDebug() << "Importing old database...";
+    // The last imported message is committed with each batch, so we can resume after an interruption
+    qint64 lastImportedId = -1;
+    db.execNow("CREATE TABLE IF NOT EXISTS legacy_import (id INTEGER PRIMARY KEY CHECK (id = 0), "
+                                                         "last_id INTEGER NOT NULL);");
+    db.execNow(RawDatabase::Query{"SELECT last_id FROM legacy_import WHERE id = 0;",
+                                  [&lastImportedId](const QVector<QVariant>& row)
+    {
+        lastImportedId = row[0].toLongLong();
+    }});
+
+    if (lastImportedId >= 0)
+        qDebug() << "Resuming old database import after message"<<lastImportedId;
+    else
+        qDebug() << "Importing old database...";
+
     QTime t=QTime::currentTime();
     t.start();
-    QVector<RawDatabase::Query> queries;
-    constexpr int batchSize = 1000;
-    queries.reserve(batchSize);
-    QList<HistoryKeeper::HistMessage> oldMessages = oldHistory.exportMessagesDeleteFile();
-    for (const HistoryKeeper::HistMessage& msg : oldMessages)
+    const qint64 total = oldHistory.countMessages(-1);
+    qint64 imported = total - oldHistory.countMessages(lastImportedId);
+    emit importProgress(imported, total);
+
+    QList<HistoryKeeper::HistMessage> oldMessages;
+    while (!(oldMessages = oldHistory.exportMessages(lastImportedId, importBatchSize)).isEmpty())
     {
-        queries += generateNewMessageQueries(msg.chat, msg.message, msg.sender, msg.timestamp, true, msg.dispName);
-        if (queries.size() >= batchSize)
+        QVector<RawDatabase::Query> queries;
+        for (const HistoryKeeper::HistMessage& msg : oldMessages)
+            queries += generateNewMessageQueries(msg.chat, msg.message, msg.sender, msg.timestamp, true, msg.dispName);
+
+        lastImportedId = oldMessages.last().id;
+        queries += RawDatabase::Query{"INSERT OR REPLACE INTO legacy_import (id, last_id) VALUES (0, ?);",
+                                      {lastImportedId}};
+        if (!db.execNow(queries))
         {
-            db.execLater(queries);
-            queries.clear();
+            qWarning() << "Failed to import old messages, the import will resume on the next start";
+            // The failed batch may have cached peers and aliases that were rolled back
+            loadIdCaches();
+            return;
         }
+
+        imported += oldMessages.size();
+        emit importProgress(imported, total);
     }
-    db.execLater(queries);
-    db.sync();
+
+    // Some old messages may have been skipped by the export joins, make sure we report completion
+    emit importProgress(total, total);
     qDebug() << "Imported old database in"<<t.elapsed()<<"ms";
+
+    // Remove the old file before the progress, if we're interrupted in between we won't import twice
+    oldHistory.removeHistory();
+    db.execLater("DROP TABLE legacy_import;");
 }
@@ -5,19 +5,36 @@
 #include <QDateTime>
 #include <QVector>
 #include <QHash>
+#include <QMap>
+#include <QPair>
+#include <QObject>
 #include <cstdint>
 #include "src/persistence/db/rawdatabase.h"
+#include "src/persistence/peeridregistry.h"
+#include <memory>
 
 class Profile;
 class HistoryKeeper;
 class RawDatabase;
+class QTimer;
+class QIODevice;
+class ChatExporter;
 
 /// Interacts with the profile database to save the chat history
-class History
-{   
+class History : public QObject
+{
+    Q_OBJECT
 public:
+    /// What the chat_id of a message refers to, stored in the kind column of the peers table
+    enum class ChatKind
+    {
+        Friend = 0,
+        Group = 1
+    };
+
     struct HistMessage
     {
+        HistMessage() = default;
         HistMessage(qint64 id, bool isSent, QDateTime timestamp, QString chat, QString dispName, QString sender, QString message) :
             chat{chat}, sender{sender}, message{message}, dispName{dispName}, timestamp{timestamp}, id{id}, isSent{isSent} {}
 
@@ -26,8 +43,8 @@ public:
         QString message;
         QString dispName;
         QDateTime timestamp;
-        qint64 id;
-        bool isSent;
+        qint64 id = 0;
+        bool isSent = false;
     };
 
 public:
@@ -36,13 +53,23 @@ public:
     History(const QString& profileName, const QString& password);
     /// Opens the profile database, and import from the old database
     /// If password is empty, the database will be opened unencrypted
-    History(const QString& profileName, const QString& password, const HistoryKeeper& oldHistory);
+    History(const QString& profileName, const QString& password, HistoryKeeper& oldHistory);
     ~History();
     /// Checks if the database was opened successfully
     bool isValid();
-    /// Imports messages from the old history file
-    void import(const HistoryKeeper& oldHistory);
-    /// Changes the database password, will encrypt or decrypt if necessary
+    /// Returns how many writes are queued for the database thread
+    int pendingWrites();
+    /// Imports messages from the old history file, in batches committed along with the import progress
+    /// An interrupted import resumes where it stopped, the old file is only removed once it completes
+    /// Note that removing the old file destroys oldHistory
+    void import(HistoryKeeper& oldHistory);
+    /// Writes all the chat history to device in our streaming backup format, blocks are compressed if compress is set
+    /// Rows are written from the database thread as they are read, so device must be usable from another thread
+    bool exportStream(QIODevice* device, bool compress = true);
+    /// Adds the messages of a stream written by exportStream to the history, committing them block by block
+    bool importStream(QIODevice* device);
+    /// Changes the database password without blocking, will encrypt or decrypt if necessary
+    /// Reports its progress with passwordChangeProgress and its result with passwordChanged
     void setPassword(const QString& password);
     /// Moves the database file on disk to match the new name
     void rename(const QString& newName);
@@ -50,30 +77,155 @@ public:
     bool remove();
 
     /// Erases all the chat history from the database
+    /// The history is gone as soon as this returns, its messages are deleted in the background
+    /// Reports its progress with historyRemovalProgress
     void eraseHistory();
-    /// Erases the chat history with one friend
+    /// Erases the chat history with one friend, its messages are deleted in the background
+    /// Unlike eraseHistory, they disappear chunk by chunk. The friend's messages in group chats are kept.
     void removeFriendHistory(const QString& friendPk);
     /// Saves a chat message in the database
     void addNewMessage(const QString& friendPk, const QString& message, const QString& sender,
                         const QDateTime &time, bool isSent, QString dispName,
                        std::function<void(int64_t)> insertIdCallback={});
+    /// Saves a group chat message in the database, groupKey comes from groupChatKey()
+    /// Like all our writes it's queued, so the messages of a busy group are committed together
+    void addNewGroupMessage(const QString& groupKey, const QString& message, const QString& sender,
+                            const QDateTime& time, const QString& dispName);
+    /// Returns the key a group chat is stored under, in place of a friend's public key
+    /// Our group chats have no persistent id, so the key is derived from the title
+    static QString groupChatKey(const QString& title);
     /// Fetches chat messages from the database
     QList<HistMessage> getChatHistory(const QString& friendPk, const QDateTime &from, const QDateTime &to);
+    /// Fetches at most limit chat messages sent before the cursor message, in chronological order
+    /// The cursor is the timestamp and id of the oldest message already fetched, or a timestamp and an id of 0
+    /// to fetch the messages strictly older than the timestamp. Pass the first returned message to get the next page.
+    QList<HistMessage> getChatHistoryPage(const QString& friendPk, const QDateTime &beforeTime,
+                                          qint64 beforeId, int limit);
+    /// Fetches our messages to a friend that weren't delivered yet, in the order they were written
+    /// This only walks the pending messages, however big the history is
+    QList<HistMessage> getPendingMessages(const QString& friendPk);
+    /// Same as checking getPendingMessages for emptiness, without reading the messages
+    bool hasPendingMessages(const QString& friendPk);
+    /// Fetches chat messages from the database without blocking, in chronological order
+    /// The messages are delivered in chunks with chatHistoryChunk, tagged with the returned request id
+    qint64 getChatHistoryAsync(const QString& friendPk, const QDateTime &from, const QDateTime &to);
+    /// Returns how many messages were exchanged on each local day from..to, days without messages are left out
+    /// This reads a small summary table, not the messages, so it's fast enough for the GUI thread
+    /// The counts are per UTC hour, in time zones with a half hour offset the hour around midnight goes to the earlier day
+    QMap<QDate, int> getMessageCountPerDay(const QString& friendPk, const QDate& from, const QDate& to);
+    /// Writes all the chat history with a friend to exporter, from the database thread as the rows are read
+    /// Reports its progress with chatExportProgress and its result with chatExportFinished, tagged with the returned id
+    /// The exporter's begin() must have been called already, we call its finish()
+    qint64 exportChatAsync(const QString& friendPk, std::shared_ptr<ChatExporter> exporter);
+    /// Searches the messages containing all the words of the query, newest first
+    /// If friendPk is empty, searches the messages of all the chats
+    QList<HistMessage> search(const QString& query, const QString& friendPk, int limit);
     /// Marks a message as sent, removing it from the faux-offline pending messages list
     void markAsSent(qint64 id);
     /// Retrieves the path to the database file for a given profile.
     static QString getDbPath(const QString& profileName);
+    /// Builds the database options from the user's settings
+    static RawDatabase::OpenOptions getDbOptions();
+
+public slots:
+    /// Cancels a password change in progress, the database then keeps its old password
+    void cancelPasswordChange();
+    /// Deletes the messages past the retention settings of their chat, then compacts the database
+    /// Runs on the database thread, this is called periodically but can be called to apply new settings
+    void enforceRetention();
+
+signals:
+    /// Emitted from the database thread with each chunk of messages of a getChatHistoryAsync request
+    /// The last chunk of a request has finished set, and may be empty
+    void chatHistoryChunk(qint64 requestId, QList<History::HistMessage> messages, bool finished);
+    /// Emitted from the database thread every few hundred messages of an exportChatAsync request
+    void chatExportProgress(qint64 requestId, qint64 exported, qint64 total);
+    /// Emitted from the database thread once an export is over, success is false if it failed or was canceled
+    void chatExportFinished(qint64 requestId, bool success);
+    /// Emitted from the database thread while the password is being changed, with the percentage done
+    void passwordChangeProgress(int percent);
+    /// Emitted from the database thread once a password change is over, success is false if it failed or was cancelled
+    void passwordChanged(bool success);
+    /// Emitted after each batch of an import, with the number of old messages imported so far
+    void importProgress(qint64 imported, qint64 total);
+    /// Emitted from the database thread after each chunk of messages deleted by eraseHistory or removeFriendHistory
+    /// The removal is over once removed equals total
+    void historyRemovalProgress(qint64 removed, qint64 total);
+
 protected:
+    /// Returns a row callback appending the rows of our message SELECTs to messages as HistMessages
+    static std::function<void(const RawDatabase::Row&)> makeHistMessageCallback(QList<HistMessage>& messages);
+    /// Decodes a UTF-8 message or display name blob with a single conversion
+    static QString decodeBlob(const QByteArray& data);
+    /// Reads a varint from a stream
+    static bool readStreamVUint(QIODevice* device, quint64& value);
+    /// Reads a varint at pos in data and advances pos, returns false if data ends before it
+    static bool readVUint(const QByteArray& data, int& pos, quint64& value);
+    /// Reads a field prefixed with its varint length at pos in data and advances pos
+    static bool readField(const QByteArray& data, int& pos, QByteArray& field);
     /// Makes sure the history tables are created
     void init();
+    /// Upgrades the database schema to the latest version, tracked with PRAGMA user_version
+    void migrateSchema();
+    /// (Re)loads the caches of the ids of our peers and their aliases from the database
+    void loadIdCaches();
+    /// Returns the id of the alias, allocating a new one if it's unknown
+    /// isNew is set if the alias was just allocated and still needs to be stored in the database
+    qint64 findOrInsertAlias(qint64 owner, const QByteArray& displayName, bool& isNew);
+    /// Creates the full-text search index of the messages if we don't have it yet
+    void initFullTextSearch();
+    /// Deletes the messages of the chats in the history_removals table, a chunk per transaction
+    /// The new messages are written between the chunks, and an interrupted removal resumes when we're opened again
+    /// If a removal is already running, it only refreshes its list of chats, unless continuing is set
+    void removeQueuedChats(bool continuing = false);
+    /// Deletes the next chunk of messages of the running removal, MUST only be called from the database thread
+    void removeNextChunk();
     QVector<RawDatabase::Query> generateNewMessageQueries(const QString& friendPk, const QString& message,
                                     const QString& sender, const QDateTime &time, bool isSent, QString dispName,
-                                                          std::function<void(int64_t)> insertIdCallback={});
+                                                          std::function<void(int64_t)> insertIdCallback={},
+                                                          ChatKind kind = ChatKind::Friend);
 
 private:
     RawDatabase db;
     // Cached mappings to speed up message saving
-    QHash<QString, int64_t> peers; ///< Maps friend public keys to unique IDs by index
+    PeerIdRegistry peers; ///< Maps friend public keys to unique IDs by index
+    QHash<QPair<qint64, QByteArray>, qint64> aliases; ///< Maps (owner, display name) pairs to alias IDs
+    qint64 nextAliasId = 0; ///< Next free alias ID, above all the IDs in aliases
+    qint64 lastRequestId = 0; ///< Last getChatHistoryAsync request id handed out
+    std::atomic_bool hasFullTextSearch{false}; ///< Set by the database thread once history_fts is usable
+    /// Chats whose messages are being deleted by removeQueuedChats, only used by the database thread
+    struct ChatRemoval
+    {
+        QVector<QPair<qint64, qint64>> chats; ///< Chat ids with the last message id to delete
+        qint64 removed = 0;
+        qint64 total = 0;
+    };
+    /// The running removal, or nullptr, only used by the database thread
+    std::unique_ptr<ChatRemoval> chatRemoval;
+    /// Set once we're being destroyed, so the removal stops queuing chunks
+    std::atomic_bool closing{false};
+    /// Number of messages per chunk delivered by getChatHistoryAsync
+    static constexpr int asyncChunkSize = 200;
+    /// Size of the buckets of the history_hours table
+    static constexpr qint64 msecsPerHour = 60*60*1000;
+    /// Number of messages exported between two chatExportProgress signals
+    static constexpr int exportProgressInterval = 500;
+    /// Number of old messages read and committed at once by import
+    static constexpr int importBatchSize = 5000;
+    /// Number of messages deleted per transaction by removeQueuedChats
+    static constexpr int removalChunkSize = 2000;
+    /// Version of the exportStream format, 2 added streamGroupChatFlag
+    static constexpr uint8_t streamVersion = 2;
+    static constexpr uint8_t streamCompressedFlag = 0x01; ///< Stream header flag, blocks are qCompressed
+    static constexpr uint8_t streamPendingFlag = 0x01; ///< Record flag, the message wasn't delivered yet
+    static constexpr uint8_t streamGroupChatFlag = 0x02; ///< Record flag, the chat key is a groupChatKey()
+    static constexpr int streamBlockSize = 64*1024; ///< Uncompressed size after which exportStream writes a block
+    static constexpr int maxStreamBlockSize = 16*1024*1024; ///< importStream treats larger blocks as corrupted, compressed or not
+    /// Periodically enforces the retention settings
+    QTimer* retentionTimer;
+    /// Milliseconds between two enforceRetention runs, the first one is retentionStartDelay after opening
+    static constexpr int retentionInterval = 6*60*60*1000;
+    static constexpr int retentionStartDelay = 60*1000;
 };
 
 #endif // HISTORY_H
@@ -146,10 +146,17 @@ HistoryKeeper::~HistoryKeeper()
 }
 
 QList<HistoryKeeper::HistMessage> HistoryKeeper::exportMessages()
+{
+    // A negative LIMIT means no limit for SQLite
+    return exportMessages(-1, -1);
+}
+
+QList<HistoryKeeper::HistMessage> HistoryKeeper::exportMessages(qint64 afterId, int limit)
 {
     QSqlQuery dbAnswer;
     dbAnswer = oldDb->exec(QString("SELECT history.id, timestamp, user_id, message, status, name, alias FROM history LEFT JOIN sent_status ON history.id = sent_status.id ") +
-                        QString("INNER JOIN aliases ON history.sender = aliases.id INNER JOIN chats ON history.chat_id = chats.id;"));
+                        QString("INNER JOIN aliases ON history.sender = aliases.id INNER JOIN chats ON history.chat_id = chats.id ") +
+                        QString("WHERE history.id > %1 ORDER BY history.id LIMIT %2;").arg(afterId).arg(limit));
 
     QList<HistMessage> res;
 
@@ -172,6 +179,15 @@ QList<HistoryKeeper::HistMessage> HistoryKeeper::exportMessages()
     return res;
 }
 
+qint64 HistoryKeeper::countMessages(qint64 afterId)
+{
+    QSqlQuery dbAnswer = oldDb->exec(QString("SELECT COUNT(*) FROM history WHERE id > %1;").arg(afterId));
+    if (!dbAnswer.next())
+        return 0;
+
+    return dbAnswer.value(0).toLongLong();
+}
+
 QString HistoryKeeper::unWrapMessage(const QString &str)
 {
     QString unWrappedMessage(str);
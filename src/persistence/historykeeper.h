@@ -67,6 +67,10 @@ public:
     void removeHistory();
     static QList<HistMessage> exportMessagesDeleteFile();
     QList<HistMessage> exportMessages();
+    /// Exports at most limit messages with an id greater than afterId, in id order
+    QList<HistMessage> exportMessages(qint64 afterId, int limit);
+    /// Counts the messages with an id greater than afterId
+    qint64 countMessages(qint64 afterId);
 
 private:
     explicit HistoryKeeper(GenericDdInterface *db_);
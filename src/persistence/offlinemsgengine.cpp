@@ -19,15 +19,10 @@
 
 #include "offlinemsgengine.h"
 #include "src/friend.h"
-#include "src/persistence/settings.h"
-#include "src/core/core.h"
 #include "src/nexus.h"
 #include "src/persistence/profile.h"
+#include <QDateTime>
 #include <QMutexLocker>
-#include <QTimer>
-
-const int OfflineMsgEngine::offlineTimeout = 20000;
-QMutex OfflineMsgEngine::globalMutex;
 
 OfflineMsgEngine::OfflineMsgEngine(Friend *frnd) :
     mutex(QMutex::Recursive),
@@ -43,66 +38,39 @@ void OfflineMsgEngine::dischargeReceipt(int receipt)
 {
     QMutexLocker ml(&mutex);
 
-    Profile* profile = Nexus::getProfile();
-    auto it = receipts.find(receipt);
-    if (it != receipts.end())
+    auto it = pendingMsgs.find(receipt);
+    if (it == pendingMsgs.end())
     {
-        int mID = it.value();
-        auto msgIt = undeliveredMsgs.find(mID);
-        if (msgIt != undeliveredMsgs.end())
-        {
-            if (profile->isHistoryEnabled())
-                profile->getHistory()->markAsSent(mID);
-            msgIt.value().msg->markAsSent(QDateTime::currentDateTime());
-            undeliveredMsgs.erase(msgIt);
-        }
-        receipts.erase(it);
+        earlyReceipts.insert(receipt);
+        return;
     }
+
+    markAsSent(it->messageID, it->msg);
+    pendingMsgs.erase(it);
 }
 
-void OfflineMsgEngine::registerReceipt(int receipt, int64_t messageID, ChatMessage::Ptr msg, const QDateTime &timestamp)
+void OfflineMsgEngine::registerReceipt(int receipt, int64_t messageID, ChatMessage::Ptr msg)
 {
     QMutexLocker ml(&mutex);
 
-    receipts[receipt] = messageID;
-    undeliveredMsgs[messageID] = {msg, timestamp, receipt};
+    if (earlyReceipts.remove(receipt))
+        markAsSent(messageID, msg);
+    else
+        pendingMsgs[receipt] = {messageID, msg};
 }
 
-void OfflineMsgEngine::deliverOfflineMsgs()
+void OfflineMsgEngine::attachMessage(int64_t messageID, ChatMessage::Ptr msg)
 {
     QMutexLocker ml(&mutex);
 
-    if (!Settings::getInstance().getFauxOfflineMessaging())
-        return;
-
-    if (f->getStatus() == Status::Offline)
-        return;
-
-    if (undeliveredMsgs.size() == 0)
-        return;
-
-    QMap<int64_t, MsgPtr> msgs = undeliveredMsgs;
-    removeAllReceipts();
-    undeliveredMsgs.clear();
-
-    for (auto iter = msgs.begin(); iter != msgs.end(); ++iter)
+    // Only the messages queued for sending are here, so there are few
+    for (PendingMsg& pending : pendingMsgs)
     {
-        auto val = iter.value();
-        auto key = iter.key();
-
-        if (val.timestamp.msecsTo(QDateTime::currentDateTime()) < offlineTimeout)
+        if (pending.messageID == messageID)
         {
-            registerReceipt(val.receipt, key, val.msg, val.timestamp);
-            continue;
+            pending.msg = msg;
+            return;
         }
-        QString messageText = val.msg->toString();
-        int rec;
-        if (val.msg->isAction())
-            rec = Core::getInstance()->sendAction(f->getFriendID(), messageText);
-        else
-            rec = Core::getInstance()->sendMessage(f->getFriendID(), messageText);
-
-        registerReceipt(rec, key, val.msg);
     }
 }
 
@@ -110,5 +78,15 @@ void OfflineMsgEngine::removeAllReceipts()
 {
     QMutexLocker ml(&mutex);
 
-    receipts.clear();
+    pendingMsgs.clear();
+    earlyReceipts.clear();
+}
+
+void OfflineMsgEngine::markAsSent(int64_t messageID, const ChatMessage::Ptr& msg)
+{
+    Profile* profile = Nexus::getProfile();
+    if (profile->isHistoryEnabled())
+        profile->getHistory()->markAsSent(messageID);
+    if (msg)
+        msg->markAsSent(QDateTime::currentDateTime());
 }
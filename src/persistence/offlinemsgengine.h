@@ -23,45 +23,44 @@
 #include <QObject>
 #include <QSet>
 #include <QMutex>
-#include <QDateTime>
-#include <QMap>
+#include <QHash>
 #include "src/chatlog/chatmessage.h"
 
 class Friend;
-class QTimer;
 
+/// Marks our messages as sent once the friend confirms them.
+/// Core queues and re-sends the messages itself, the receipts are the ids it gave them.
+/// Nothing runs unless a message is registered or a receipt arrives.
 class OfflineMsgEngine : public QObject
 {
     Q_OBJECT
 public:
     explicit OfflineMsgEngine(Friend *);
     virtual ~OfflineMsgEngine();
-    static QMutex globalMutex;
-
     void dischargeReceipt(int receipt);
-    void registerReceipt(int receipt, int64_t messageID, ChatMessage::Ptr msg, const QDateTime &timestamp = QDateTime::currentDateTime());
+    /// msg may be null if the message isn't shown, attachMessage can give it later
+    void registerReceipt(int receipt, int64_t messageID, ChatMessage::Ptr msg);
+    /// Gives the line of a message waiting for its receipt, to mark it as sent once it comes
+    void attachMessage(int64_t messageID, ChatMessage::Ptr msg);
 
 public slots:
-    void deliverOfflineMsgs();
     void removeAllReceipts();
 
 private:
-    struct MsgPtr {
+    void markAsSent(int64_t messageID, const ChatMessage::Ptr& msg);
+
+private:
+    struct PendingMsg
+    {
+        int64_t messageID;
         ChatMessage::Ptr msg;
-        QDateTime timestamp;
-        int receipt;
     };
 
     QMutex mutex;
     Friend* f;
-    QHash<int, int64_t> receipts;
-    QMap<int64_t, MsgPtr> undeliveredMsgs;
-
-    // timeout after which faux offline messages get to be re-sent
-    // originally was 2s, but since that was causing lots of duplicated
-    // messages on receiving end, make qTox be more lazy about re-sending
-    // should be 20s
-    static const int offlineTimeout;
+    QHash<int, PendingMsg> pendingMsgs; ///< By receipt
+    /// The history registers a message once it's written, its receipt can come back first
+    QSet<int> earlyReceipts;
 };
 
 #endif // OFFLINEMSGENGINE_H
@@ -0,0 +1,150 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "passkeycache.h"
+#include <QMutexLocker>
+#include <QFile>
+#include <QDebug>
+#include <sodium.h>
+
+QMutex PasskeyCache::mutex;
+QHash<QString, QHash<QByteArray, PasskeyCache::Key>> PasskeyCache::keys;
+QHash<QString, PasskeyCache::Key> PasskeyCache::encryptionKeys;
+
+/**
+ * @brief Derives a key into locked memory
+ * @param salt The salt to derive with, or a nullptr to pick a random one
+ * @return The key, or a nullptr if the derivation failed
+ */
+PasskeyCache::Key PasskeyCache::derive(const QString& password, const uint8_t* salt)
+{
+    // sodium_malloc guards and locks the memory, sodium_free wipes it.
+    // When we run out of lockable memory, a wiped heap allocation is still better than no key.
+    TOX_PASS_KEY* key = static_cast<TOX_PASS_KEY*>(sodium_malloc(sizeof(TOX_PASS_KEY)));
+    bool locked = key != nullptr;
+    if (!locked)
+    {
+        qWarning() << "Couldn't allocate locked memory for a passkey";
+        key = new TOX_PASS_KEY;
+    }
+    auto release = [locked](const TOX_PASS_KEY* key)
+    {
+        if (locked)
+        {
+            sodium_free(const_cast<TOX_PASS_KEY*>(key));
+        }
+        else
+        {
+            sodium_memzero(const_cast<TOX_PASS_KEY*>(key), sizeof(TOX_PASS_KEY));
+            delete key;
+        }
+    };
+
+    QByteArray passData = password.toUtf8();
+    uint8_t* pass = reinterpret_cast<uint8_t*>(passData.data());
+    bool ok;
+    if (salt)
+        ok = tox_derive_key_with_salt(pass, passData.size(), salt, key, nullptr);
+    else
+        ok = tox_derive_key_from_pass(pass, passData.size(), key, nullptr);
+    sodium_memzero(passData.data(), passData.size());
+
+    if (!ok)
+    {
+        qWarning() << "Key derivation failed";
+        release(key);
+        return nullptr;
+    }
+    return Key(key, release);
+}
+
+PasskeyCache::Key PasskeyCache::getKey(const QString& password, const uint8_t* salt)
+{
+    QByteArray saltData(reinterpret_cast<const char*>(salt), TOX_PASS_SALT_LENGTH);
+
+    {
+        QMutexLocker locker{&mutex};
+        Key key = keys.value(password).value(saltData);
+        if (key)
+            return key;
+    }
+
+    // Derive without the lock, so keys with different salts can be derived in parallel
+    Key derived = derive(password, salt);
+
+    QMutexLocker locker{&mutex};
+    Key& key = keys[password][saltData];
+    if (!key)
+        key = derived;
+    return key;
+}
+
+PasskeyCache::Key PasskeyCache::getDecryptionKey(const QString& password, const QByteArray& data)
+{
+    const uint8_t* cData = reinterpret_cast<const uint8_t*>(data.constData());
+    if (data.size() < TOX_PASS_ENCRYPTION_EXTRA_LENGTH || !tox_is_data_encrypted(cData))
+        return nullptr;
+
+    uint8_t salt[TOX_PASS_SALT_LENGTH];
+    if (!tox_get_salt(cData, salt))
+        return nullptr;
+    Key key = getKey(password, salt);
+
+    // The salts of our own files are random, so the first one we see can encrypt the next files too
+    QMutexLocker locker{&mutex};
+    Key& encryptionKey = encryptionKeys[password];
+    if (!encryptionKey)
+        encryptionKey = key;
+    return key;
+}
+
+PasskeyCache::Key PasskeyCache::getEncryptionKey(const QString& password)
+{
+    QMutexLocker locker{&mutex};
+    Key& key = encryptionKeys[password];
+    if (key)
+        return key;
+
+    key = derive(password, nullptr);
+    if (key)
+        keys[password][QByteArray(reinterpret_cast<const char*>(key->salt), TOX_PASS_SALT_LENGTH)] = key;
+    return key;
+}
+
+void PasskeyCache::prefetch(const QString& password, const QString& path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+    getDecryptionKey(password, file.read(TOX_PASS_ENCRYPTION_EXTRA_LENGTH));
+}
+
+void PasskeyCache::forget(const QString& password)
+{
+    QMutexLocker locker{&mutex};
+    keys.remove(password);
+    encryptionKeys.remove(password);
+}
+
+void PasskeyCache::clear()
+{
+    QMutexLocker locker{&mutex};
+    keys.clear();
+    encryptionKeys.clear();
+}
@@ -0,0 +1,71 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef PASSKEYCACHE_H
+#define PASSKEYCACHE_H
+
+#include <QString>
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+#include <tox/toxencryptsave.h>
+#include <memory>
+
+/// Derives the keys of the current profile once, instead of on every load and save.
+/// The key derivation is deliberately slow, but a profile only ever needs one key per salt.
+/// The keys live in locked memory, which is wiped once the last user releases them.
+/// Thread-safe, the settings and history threads use it along with Core and the GUI,
+/// and keys with different salts are derived in parallel.
+class PasskeyCache
+{
+private:
+    PasskeyCache()=delete;
+
+public:
+    using Key = std::shared_ptr<const TOX_PASS_KEY>;
+
+    /// Returns the key for data encrypted with this password and salt, derived at most once
+    static Key getKey(const QString& password, const uint8_t* salt);
+    /// Returns the key to decrypt data encrypted by toxencryptsave, using the salt in its header
+    /// Returns a nullptr if the data isn't encrypted
+    static Key getDecryptionKey(const QString& password, const QByteArray& data);
+    /// Returns the key to encrypt new data with this password
+    /// Reuses the key of the first file we decrypted with this password, so logging in
+    /// is all the derivation a profile needs. Keys from getKey are never reused,
+    /// since their salt may not be random.
+    static Key getEncryptionKey(const QString& password);
+    /// Derives the key of an encrypted file ahead of time, reading only its header
+    /// Does nothing if the file isn't encrypted
+    static void prefetch(const QString& password, const QString& path);
+    /// Forgets the keys of a password we don't use anymore
+    static void forget(const QString& password);
+    /// Wipes and forgets every key, their memory is released once nobody holds them anymore
+    static void clear();
+
+private:
+    static Key derive(const QString& password, const uint8_t* salt);
+
+private:
+    static QMutex mutex;
+    static QHash<QString, QHash<QByteArray, Key>> keys; ///< For each password, keys by salt
+    static QHash<QString, Key> encryptionKeys; ///< For each password, the key new data is encrypted with
+};
+
+#endif // PASSKEYCACHE_H
@@ -0,0 +1,46 @@
+#include "peeridregistry.h"
+
+void PeerIdRegistry::insert(const ToxPk &publicKey, qint64 id)
+{
+    ids.insert(publicKey, id);
+    if (id >= nextId)
+        nextId = id+1;
+}
+
+qint64 PeerIdRegistry::findOrInsert(const ToxPk &publicKey, bool &isNew)
+{
+    // operator[] default-inserts unknown keys, so the size tells us if it was there with a single lookup
+    int oldSize = ids.size();
+    qint64& id = ids[publicKey];
+    isNew = ids.size() != oldSize;
+    if (isNew)
+        id = nextId++;
+    return id;
+}
+
+qint64 PeerIdRegistry::find(const ToxPk &publicKey) const
+{
+    return ids.value(publicKey, -1);
+}
+
+void PeerIdRegistry::remove(const ToxPk &publicKey)
+{
+    ids.remove(publicKey);
+}
+
+void PeerIdRegistry::clear()
+{
+    ids.clear();
+    nextId = 0;
+}
+
+void PeerIdRegistry::removeAll()
+{
+    ids.clear();
+}
+
+void PeerIdRegistry::reserve(qint64 id)
+{
+    if (id >= nextId)
+        nextId = id+1;
+}
@@ -0,0 +1,33 @@
+#ifndef PEERIDREGISTRY_H
+#define PEERIDREGISTRY_H
+
+#include "src/core/toxpk.h"
+#include <QHash>
+
+/// Maps public keys to the ids of their rows in the peers table of the history
+/// New ids are handed out from a monotonic counter, so allocating one never scans the known peers
+class PeerIdRegistry
+{
+public:
+    /// Registers a peer already stored in the database, and makes sure new ids won't collide with it
+    void insert(const ToxPk& publicKey, qint64 id);
+    /// Returns the id of the peer, allocating a new one if it's unknown
+    /// isNew is set if the peer was just allocated and still needs to be stored in the database
+    qint64 findOrInsert(const ToxPk& publicKey, bool& isNew);
+    /// Returns the id of the peer, or -1 if it's unknown
+    qint64 find(const ToxPk& publicKey) const;
+    /// Forgets a peer, its id will not be handed out again
+    void remove(const ToxPk& publicKey);
+    /// Forgets all peers and starts allocating ids from 0 again
+    void clear();
+    /// Forgets all peers, their ids will not be handed out again
+    void removeAll();
+    /// Makes sure new ids won't collide with id, which may still be used by rows waiting to be deleted
+    void reserve(qint64 id);
+
+private:
+    QHash<ToxPk, qint64> ids;
+    qint64 nextId = 0;
+};
+
+#endif // PEERIDREGISTRY_H
@@ -20,6 +20,7 @@
 
 #include "profile.h"
 #include "profilelocker.h"
+#include "passkeycache.h"
 #include "src/persistence/settings.h"
 #include "src/persistence/historykeeper.h"
 #include "src/core/core.h"
@@ -27,22 +28,57 @@
 #include "src/widget/widget.h"
 #include "src/nexus.h"
 #include <cassert>
+#include <functional>
+#include <QBuffer>
+#include <QCryptographicHash>
 #include <QDir>
 #include <QFileInfo>
+#include <QImageReader>
 #include <QSaveFile>
+#include <QElapsedTimer>
+#include <QtConcurrent/QtConcurrentRun>
+#include <QProgressDialog>
+#include <QApplication>
 #include <QThread>
+#include <QRunnable>
 #include <QObject>
 #include <QDebug>
 #include <sodium.h>
 
 QVector<QString> Profile::profiles;
 
+namespace
+{
+/// Runs a function on a QThreadPool, QtConcurrent can only pick a pool starting with Qt 5.4
+class PoolTask : public QRunnable
+{
+public:
+    explicit PoolTask(std::function<void()> task) : task{task} {}
+    void run() override { task(); }
+
+private:
+    std::function<void()> task;
+};
+
+/// Avatar cache key of a size variant, the full size image uses an invalid size
+QString avatarCacheKey(const QString& ownerId, const QSize& size)
+{
+    return ownerId + '/' + QString::number(size.width()) + 'x' + QString::number(size.height());
+}
+}
+
 Profile::Profile(QString name, QString password, bool isNewProfile)
     : name{name}, password{password},
-      newProfile{isNewProfile}, isRemoved{false}
+      newProfile{isNewProfile}, isRemoved{false}, saveGeneration{0}, writtenGeneration{0},
+      avatarCache{avatarCacheSize}, avatarGeneration{0}
 {
+    // One writer keeps the background saves in order
+    savePool.setMaxThreadCount(1);
+    avatarSavePool.setMaxThreadCount(1);
+    // Decoding is mostly disk bound, a chat full of photos shouldn't take every core
+    thumbnailPool.setMaxThreadCount(2);
     if (!password.isEmpty())
-        passkey = *core->createPasskey(password);
+        passkey = PasskeyCache::getEncryptionKey(password);
 
     Settings& s = Settings::getInstance();
     s.setCurrentProfile(name);
@@ -57,6 +93,28 @@ Profile::Profile(QString name, QString password, bool isNewProfile)
         GUI::showError(QObject::tr("Error"), QObject::tr("qTox couldn't open your chat logs, they will be disabled."));
         history.release();
     }
+    else
+    {
+        // The history is re-encrypted in the background, the rest of the profile follows once it's done
+        // The changes complete in the order they were requested, each with the password it was started with
+        QObject::connect(history.get(), &History::passwordChanged, history.get(), [this](bool success)
+        {
+            if (pendingPasswords.isEmpty())
+                return;
+
+            QString newPassword = pendingPasswords.dequeue();
+            if (success)
+            {
+                applyPassword(newPassword);
+                Nexus::getDesktopGUI()->reloadHistory();
+            }
+            else
+            {
+                GUI::showWarning(QObject::tr("Password not changed"),
+                                 QObject::tr("Your chat history couldn't be re-encrypted, your password was not changed."));
+            }
+        });
+    }
 
     coreThread = new QThread();
     coreThread->setObjectName("qTox Core");
@@ -79,67 +137,128 @@ Profile* Profile::loadProfile(QString name, QString password)
         return nullptr;
     }
 
-    // Check password
+    // None of the slow parts of the login depend on each other, they're mostly key derivations
+    // for files encrypted with different salts. We run them in parallel, history and settings
+    // then find their keys in the PasskeyCache.
+    QElapsedTimer clock;
+    clock.start();
+    QByteArray toxSave;
+    QFuture<bool> saveLoaded = QtConcurrent::run([&]()
     {
-        QString path = Settings::getInstance().getSettingsDirPath() + name + ".tox";
-        QFile saveFile(path);
-        qDebug() << "Loading tox save "<<path;
-
-        if (!saveFile.exists())
+        return readToxSave(name, password, toxSave);
+    });
+    QVector<QFuture<void>> prefetches;
+    if (!password.isEmpty())
+    {
+        QString dir = Settings::getInstance().getSettingsDirPath();
+        prefetches.append(QtConcurrent::run([password]()
         {
-            qWarning() << "The tox save file "<<path<<" was not found";
-            ProfileLocker::unlock();
-            return nullptr;
-        }
-
-        if (!saveFile.open(QIODevice::ReadOnly))
+            RawDatabase::deriveKey(password);
+        }));
+        prefetches.append(QtConcurrent::run([password, dir, name]()
         {
-            qCritical() << "The tox save file " << path << " couldn't' be opened";
-            ProfileLocker::unlock();
-            return nullptr;
-        }
-
-        qint64 fileSize = saveFile.size();
-        if (fileSize <= 0)
+            PasskeyCache::prefetch(password, dir + name + ".ini");
+        }));
+        prefetches.append(QtConcurrent::run([password, dir]()
         {
-            qWarning() << "The tox save file"<<path<<" is empty!";
-            ProfileLocker::unlock();
-            return nullptr;
-        }
+            QDir avatars(dir + "avatars");
+            for (const QString& file : avatars.entryList({"*.png"}, QDir::Files))
+                PasskeyCache::prefetch(password, avatars.filePath(file));
+        }));
+    }
+    bool ok = saveLoaded.result();
+    for (QFuture<void>& prefetch : prefetches)
+        prefetch.waitForFinished();
+    qDebug() << "Read the tox save and derived the profile keys in" << clock.elapsed() << "ms";
+
+    if (!ok)
+    {
+        PasskeyCache::forget(password);
+        ProfileLocker::unlock();
+        return nullptr;
+    }
 
-        QByteArray data = saveFile.readAll();
-        if (tox_is_data_encrypted((uint8_t*)data.data()))
+    clock.restart();
+    Profile* p = new Profile(name, password, false);
+    p->loadedToxSave = toxSave;
+    qDebug() << "Opened the profile and its history in" << clock.elapsed() << "ms";
+    if (p->history && HistoryKeeper::isFileExist(!password.isEmpty()) && !qobject_cast<QApplication*>(qApp))
+    {
+        // Headless, there are no widgets to show the progress with
+        p->history->import(*HistoryKeeper::getInstance(*p));
+    }
+    else if (p->history && HistoryKeeper::isFileExist(!password.isEmpty()))
+    {
+        // Importing a large old history can take a while, the modal dialog keeps processing events
+        QProgressDialog progress(QObject::tr("Importing your old chat history..."), QString(), 0, 0);
+        progress.setWindowTitle(QObject::tr("Importing chat history"));
+        progress.setCancelButton(nullptr);
+        progress.setWindowModality(Qt::ApplicationModal);
+        progress.setMinimumDuration(500);
+        QObject::connect(p->history.get(), &History::importProgress, &progress,
+                         [&progress](qint64 imported, qint64 total)
         {
-            if (password.isEmpty())
-            {
-                qCritical() << "The tox save file is encrypted, but we don't have a password!";
-                ProfileLocker::unlock();
-                return nullptr;
-            }
+            progress.setMaximum(static_cast<int>(total));
+            progress.setValue(static_cast<int>(imported));
+        });
+        p->history->import(*HistoryKeeper::getInstance(*p));
+    }
+    return p;
+}
 
-            uint8_t salt[TOX_PASS_SALT_LENGTH];
-            tox_get_salt(reinterpret_cast<uint8_t *>(data.data()), salt);
-            auto tmpkey = *Core::createPasskey(password, salt);
+/**
+ * @brief Reads and decrypts the .tox save of a profile
+ * @param data Set to the plaintext save on success
+ * @return False if the save is missing, unreadable or the password is wrong
+ */
+bool Profile::readToxSave(const QString& name, const QString& password, QByteArray& data)
+{
+    QString path = Settings::getInstance().getSettingsDirPath() + name + ".tox";
+    QFile saveFile(path);
+    qDebug() << "Loading tox save "<<path;
 
-            data = Core::decryptData(data, tmpkey);
-            if (data.isEmpty())
-            {
-                qCritical() << "Failed to decrypt the tox save file";
-                ProfileLocker::unlock();
-                return nullptr;
-            }
+    if (!saveFile.exists())
+    {
+        qWarning() << "The tox save file "<<path<<" was not found";
+        return false;
+    }
+
+    if (!saveFile.open(QIODevice::ReadOnly))
+    {
+        qCritical() << "The tox save file " << path << " couldn't' be opened";
+        return false;
+    }
+
+    qint64 fileSize = saveFile.size();
+    if (fileSize <= 0)
+    {
+        qWarning() << "The tox save file"<<path<<" is empty!";
+        return false;
+    }
+
+    data = saveFile.readAll();
+    if (tox_is_data_encrypted((uint8_t*)data.data()))
+    {
+        if (password.isEmpty())
+        {
+            qCritical() << "The tox save file is encrypted, but we don't have a password!";
+            return false;
         }
-        else
+
+        auto tmpkey = PasskeyCache::getDecryptionKey(password, data);
+        data = tmpkey ? Core::decryptData(data, *tmpkey) : QByteArray();
+        if (data.isEmpty())
         {
-            if (!password.isEmpty())
-                qWarning() << "We have a password, but the tox save file is not encrypted";
+            qCritical() << "Failed to decrypt the tox save file";
+            return false;
         }
     }
-
-    Profile* p = new Profile(name, password, false);
-    if (p->history && HistoryKeeper::isFileExist(!password.isEmpty()))
-        p->history->import(*HistoryKeeper::getInstance(*p));
-    return p;
+    else
+    {
+        if (!password.isEmpty())
+            qWarning() << "We have a password, but the tox save file is not encrypted";
+    }
+    return true;
 }
 
 Profile* Profile::createProfile(QString name, QString password)
@@ -168,8 +287,13 @@ Profile* Profile::createProfile(QString name, QString password)
 
 Profile::~Profile()
 {
+    // Always saved, the DHT nodes toxcore found since the last save don't mark it dirty
     if (!isRemoved && core->isReady())
-        saveToxSave();
+        saveToxSave(true);
+    savePool.waitForDone();
+    avatarPool.waitForDone();
+    avatarSavePool.waitForDone();
+    thumbnailPool.waitForDone();
     delete core;
     delete coreThread;
     if (!isRemoved)
@@ -180,6 +304,7 @@ Profile::~Profile()
         assert(ProfileLocker::getCurLockName() == name);
         ProfileLocker::unlock();
     }
+    PasskeyCache::clear();
 }
 
 QVector<QString> Profile::getFilesByExt(QString extension)
@@ -237,6 +362,13 @@ QByteArray Profile::loadToxSave()
     assert(!isRemoved);
     QByteArray data;
 
+    // The first load gets the save we already decrypted at login
+    if (!loadedToxSave.isEmpty())
+    {
+        data.swap(loadedToxSave);
+        return data;
+    }
+
     QString path = Settings::getInstance().getSettingsDirPath() + name + ".tox";
     QFile saveFile(path);
     qint64 fileSize;
@@ -271,11 +403,8 @@ QByteArray Profile::loadToxSave()
             goto fail;
         }
 
-        uint8_t salt[TOX_PASS_SALT_LENGTH];
-        tox_get_salt(reinterpret_cast<uint8_t *>(data.data()), salt);
-        passkey = *core->createPasskey(password, salt);
-
-        data = core->decryptData(data, passkey);
+        auto key = PasskeyCache::getDecryptionKey(password, data);
+        data = key ? core->decryptData(data, *key) : QByteArray();
         if (data.isEmpty())
             qCritical() << "Failed to decrypt the tox save file";
     }
@@ -290,9 +419,14 @@ fail:
     return data;
 }
 
-void Profile::saveToxSave()
+void Profile::saveToxSave(bool force)
 {
     assert(core->isReady());
+    if (!force && !core->isToxSaveDirty())
+    {
+        qDebug() << "The tox save didn't change, not saving it";
+        return;
+    }
     QByteArray data = core->getToxSaveData();
     assert(data.size());
     saveToxSave(data);
@@ -301,6 +435,33 @@ void Profile::saveToxSave()
 void Profile::saveToxSave(QByteArray data)
 {
     assert(!isRemoved);
+    writeToxSave(data, ++saveGeneration);
+}
+
+/**
+ * @brief Encrypts and writes the .tox save on a background thread
+ *
+ * The saves are written one after the other, and a save that was overtaken
+ * by a newer one while it waited is dropped instead of overwriting it.
+ */
+void Profile::saveToxSaveAsync(QByteArray data)
+{
+    assert(!isRemoved);
+    quint64 generation = ++saveGeneration;
+    savePool.start(new PoolTask([=]()
+    {
+        writeToxSave(data, generation);
+    }));
+}
+
+void Profile::writeToxSave(QByteArray data, quint64 generation)
+{
+    QMutexLocker locker{&saveMutex};
+    // The profile may have been removed while this save was waiting for its turn
+    if (isRemoved || generation < writtenGeneration)
+        return;
+    writtenGeneration = generation;
+
     ProfileLocker::assertLock();
     assert(ProfileLocker::getCurLockName() == name);
 
@@ -315,8 +476,7 @@ void Profile::saveToxSave(QByteArray data)
 
     if (!password.isEmpty())
     {
-        passkey = *core->createPasskey(password);
-        data = core->encryptData(data, passkey);
+        data = passkey ? core->encryptData(data, *passkey) : QByteArray();
         if (data.isEmpty())
         {
             qCritical() << "Failed to encrypt, can't save!";
@@ -364,9 +524,181 @@ QPixmap Profile::loadAvatar()
 
 QPixmap Profile::loadAvatar(const QString &ownerId)
 {
-    QPixmap pic;
-    pic.loadFromData(loadAvatarData(ownerId));
-    return pic;
+    return QPixmap::fromImage(loadAvatarImage(ownerId, QSize()));
+}
+
+QPixmap Profile::loadAvatar(const QString &ownerId, const QSize &size)
+{
+    return QPixmap::fromImage(loadAvatarImage(ownerId, size));
+}
+
+QImage Profile::loadAvatarImage(const QString &ownerId, const QSize &size)
+{
+    const QString key = avatarCacheKey(ownerId, size);
+    quint64 generation;
+    {
+        QMutexLocker locker{&avatarMutex};
+        if (const QImage* cached = avatarCache.object(key))
+            return *cached;
+
+        generation = avatarGeneration;
+    }
+
+    QImage image;
+    if (size.isValid())
+    {
+        QImage full = loadAvatarImage(ownerId, QSize());
+        if (!full.isNull())
+            image = full.scaled(size, Qt::KeepAspectRatioByExpanding, Qt::SmoothTransformation);
+    }
+    else
+    {
+        image.loadFromData(loadAvatarData(ownerId));
+    }
+
+    // Missing avatars are cached too, group peers without one would hit the disk on every namelist change
+    QMutexLocker locker{&avatarMutex};
+    if (generation == avatarGeneration)
+        avatarCache.insert(key, new QImage(image), qMax(image.byteCount(), 1));
+
+    return image;
+}
+
+QFuture<QImage> Profile::loadAvatarAsync(const QString &ownerId)
+{
+    QFutureInterface<QImage> promise;
+    promise.reportStarted();
+
+    {
+        QMutexLocker locker{&avatarMutex};
+        if (const QImage* cached = avatarCache.object(avatarCacheKey(ownerId, QSize())))
+        {
+            promise.reportFinished(cached);
+            return promise.future();
+        }
+    }
+
+    avatarPool.start(new PoolTask([this, ownerId, promise]() mutable
+    {
+        // An avatar saved while we were reading may have been missed, read again until nothing changed
+        QImage image;
+        quint64 generation;
+        forever
+        {
+            avatarMutex.lock();
+            generation = avatarGeneration;
+            avatarMutex.unlock();
+
+            image = loadAvatarImage(ownerId, QSize());
+
+            QMutexLocker locker{&avatarMutex};
+            if (generation == avatarGeneration)
+                break;
+        }
+
+        promise.reportFinished(&image);
+    }));
+
+    return promise.future();
+}
+
+QFuture<QImage> Profile::loadThumbnailAsync(const QString &filePath, const QSize &size, Qt::AspectRatioMode mode)
+{
+    QFutureInterface<QImage> promise;
+    promise.reportStarted();
+
+    const QString dir = thumbnailDir(name);
+    const QString password = getPassword();
+    const PasskeyCache::Key key = getPasskey();
+
+    thumbnailPool.start(new PoolTask([=]() mutable
+    {
+        QImage image;
+        QFileInfo info(filePath);
+        if (!info.isFile())
+        {
+            promise.reportFinished(&image);
+            return;
+        }
+
+        // A file changed in place gets a new thumbnail, we don't need to keep track of it
+        QCryptographicHash hash(QCryptographicHash::Sha256);
+        hash.addData(info.absoluteFilePath().toUtf8());
+        hash.addData(QByteArray::number(info.lastModified().toMSecsSinceEpoch()));
+        hash.addData(QByteArray::number(info.size()));
+        hash.addData(QByteArray::number(size.width()) + 'x' + QByteArray::number(size.height())
+                     + '/' + QByteArray::number(mode));
+        const QString cachePath = dir + hash.result().toHex() + ".png";
+
+        QFile cached(cachePath);
+        if (cached.open(QIODevice::ReadOnly))
+        {
+            QByteArray data = cached.readAll();
+            if (!password.isEmpty())
+            {
+                auto cachedKey = PasskeyCache::getDecryptionKey(password, data);
+                data = cachedKey ? Core::decryptData(data, *cachedKey) : QByteArray();
+            }
+
+            if (image.loadFromData(data, "PNG"))
+            {
+                promise.reportFinished(&image);
+                return;
+            }
+        }
+
+        // Most decoders can skip the detail we won't show, a big JPEG is decoded at a fraction of its size
+        QImageReader reader(filePath);
+        QSize fullSize = reader.size();
+        if (fullSize.isValid() && (fullSize.width() > size.width() || fullSize.height() > size.height()))
+            reader.setScaledSize(fullSize.scaled(size, mode));
+
+        image = reader.read();
+        if (image.isNull())
+        {
+            qWarning() << "Couldn't create a thumbnail of" << filePath << reader.errorString();
+            promise.reportFinished(&image);
+            return;
+        }
+
+        QByteArray data;
+        QBuffer buffer(&data);
+        buffer.open(QIODevice::WriteOnly);
+        image.save(&buffer, "PNG");
+        buffer.close();
+
+        if (!password.isEmpty())
+            data = key ? Core::encryptData(data, *key) : QByteArray();
+
+        QSaveFile file(cachePath);
+        if (!data.isEmpty() && QDir().mkpath(dir) && file.open(QIODevice::WriteOnly))
+        {
+            file.write(data);
+            file.commit();
+        }
+
+        promise.reportFinished(&image);
+    }));
+
+    return promise.future();
+}
+
+QString Profile::thumbnailDir(const QString &name)
+{
+    return Settings::getInstance().getSettingsDirPath() + "thumbnails" + QDir::separator()
+            + name + QDir::separator();
+}
+
+void Profile::invalidateAvatar(const QString &ownerId)
+{
+    QMutexLocker locker{&avatarMutex};
+    ++avatarGeneration;
+    const QString prefix = ownerId + '/';
+    for (const QString& key : avatarCache.keys())
+    {
+        if (key.startsWith(prefix))
+            avatarCache.remove(key);
+    }
 }
 
 QByteArray Profile::loadAvatarData(const QString &ownerId)
@@ -393,18 +725,28 @@ QByteArray Profile::loadAvatarData(const QString &ownerId, const QString &passwo
     QByteArray pic = file.readAll();
     if (encrypted && !pic.isEmpty())
     {
-        uint8_t salt[TOX_PASS_SALT_LENGTH];
-        tox_get_salt(reinterpret_cast<uint8_t *>(pic.data()), salt);
-        auto passkey = core->createPasskey(password, salt);
-        pic = core->decryptData(pic, *passkey);
+        auto key = PasskeyCache::getDecryptionKey(password, pic);
+        pic = key ? core->decryptData(pic, *key) : QByteArray();
     }
     return pic;
 }
 
 void Profile::saveAvatar(QByteArray pic, const QString &ownerId)
 {
+    if (pic.isEmpty())
+        Settings::getInstance().removeAvatarHash(ownerId);
+    else
+        Settings::getInstance().setAvatarHash(ownerId, hashAvatar(pic));
+
     if (!password.isEmpty() && !pic.isEmpty())
-        pic = core->encryptData(pic, passkey);
+    {
+        if (!passkey)
+        {
+            qCritical() << "No key to encrypt the avatar with, can't save!";
+            return;
+        }
+        pic = core->encryptData(pic, *passkey);
+    }
 
     QString path = avatarPath(ownerId);
     QDir(Settings::getInstance().getSettingsDirPath()).mkdir("avatars");
@@ -423,13 +765,65 @@ void Profile::saveAvatar(QByteArray pic, const QString &ownerId)
         file.write(pic);
         file.commit();
     }
+
+    invalidateAvatar(ownerId);
+}
+
+/**
+ * @brief Decodes, encrypts and saves an avatar we received, without blocking the caller.
+ *
+ * After a login hundreds of friends may send us their avatar, Core shouldn't decode them all.
+ * Invalid images aren't saved. The decoded avatar is kept in the avatar cache, the GUI
+ * is going to show it right away.
+ */
+QFuture<QImage> Profile::saveAvatarAsync(const QByteArray& pic, const QString& ownerId)
+{
+    QFutureInterface<QImage> promise;
+    promise.reportStarted();
+
+    avatarSavePool.start(new PoolTask([this, pic, ownerId, promise]() mutable
+    {
+        QImage image = QImage::fromData(pic);
+        if (image.isNull())
+        {
+            qWarning() << "Received an invalid avatar from" << ownerId;
+            promise.reportFinished(&image);
+            return;
+        }
+
+        saveAvatar(pic, ownerId);
+
+        {
+            QMutexLocker locker{&avatarMutex};
+            avatarCache.insert(avatarCacheKey(ownerId, QSize()), new QImage(image), qMax(image.byteCount(), 1));
+        }
+
+        promise.reportFinished(&image);
+    }));
+
+    return promise.future();
 }
 
 QByteArray Profile::getAvatarHash(const QString &ownerId)
 {
+    // Avatars cached before the index existed are hashed from disk once, then indexed
+    Settings& s = Settings::getInstance();
+    QByteArray avatarHash = s.getAvatarHash(ownerId);
+    if (!avatarHash.isEmpty())
+        return avatarHash;
+
     QByteArray pic = loadAvatarData(ownerId);
+    avatarHash = hashAvatar(pic);
+    if (!pic.isEmpty())
+        s.setAvatarHash(ownerId, avatarHash);
+
+    return avatarHash;
+}
+
+QByteArray Profile::hashAvatar(const QByteArray &pic)
+{
     QByteArray avatarHash(TOX_HASH_LENGTH, 0);
-    tox_hash((uint8_t*)avatarHash.data(), (uint8_t*)pic.data(), pic.size());
+    tox_hash((uint8_t*)avatarHash.data(), (const uint8_t*)pic.data(), pic.size());
     return avatarHash;
 }
 
@@ -451,6 +845,8 @@ History *Profile::getHistory()
 void Profile::removeAvatar(const QString &ownerId)
 {
     QFile::remove(avatarPath(ownerId));
+    invalidateAvatar(ownerId);
+    Settings::getInstance().removeAvatarHash(ownerId);
     if (ownerId == core->getSelfId().publicKey)
         core->setAvatar({});
 }
@@ -490,7 +886,10 @@ QVector<QString> Profile::remove()
         qWarning() << "Profile " << name << " is already removed!";
         return {};
     }
-    isRemoved = true;
+    {
+        QMutexLocker locker{&saveMutex};
+        isRemoved = true;
+    }
 
     qDebug() << "Removing profile" << name;
     for (int i=0; i<profiles.size(); i++)
@@ -533,6 +932,9 @@ QVector<QString> Profile::remove()
         qWarning() << "Could not remove file " << historyLegacyUnencrypted.fileName();
     }
 
+    // the thumbnails can be made again from the files, they aren't worth failing over
+    QDir(thumbnailDir(name)).removeRecursively();
+
     if (history)
     {
         if(!history->remove() && QFile::exists(History::getDbPath(name)))
@@ -556,6 +958,7 @@ bool Profile::rename(QString newName)
 
     QFile::rename(path+".tox", newPath+".tox");
     QFile::rename(path+".ini", newPath+".ini");
+    QDir().rename(thumbnailDir(name), thumbnailDir(newName));
     if (history)
         history->rename(newName);
     bool resetAutorun = Settings::getInstance().getAutorun();
@@ -581,32 +984,45 @@ QString Profile::getPassword() const
     return password;
 }
 
-const TOX_PASS_KEY& Profile::getPasskey() const
+PasskeyCache::Key Profile::getPasskey() const
 {
+    QMutexLocker locker{&saveMutex};
     return passkey;
 }
 
 void Profile::restartCore()
 {
     GUI::setEnabled(false); // Core::reset re-enables it
+    // Forced like on exit, the DHT nodes are lost with the old Tox instance otherwise
     if (!isRemoved && core->isReady())
-        saveToxSave();
+        saveToxSave(true);
     QMetaObject::invokeMethod(core, "reset");
 }
 
 void Profile::setPassword(QString newPassword)
 {
-    QByteArray avatar = loadAvatarData(core->getSelfId().publicKey);
-    QString oldPassword = password;
-    password = newPassword;
-    passkey = *core->createPasskey(password);
-    saveToxSave();
-
+    // If the history fails or is cancelled, the whole profile keeps its old password
     if (history)
     {
+        pendingPasswords.enqueue(newPassword);
         history->setPassword(newPassword);
-        Nexus::getDesktopGUI()->reloadHistory();
+        return;
+    }
+
+    applyPassword(newPassword);
+}
+
+void Profile::applyPassword(QString newPassword)
+{
+    QByteArray avatar = loadAvatarData(core->getSelfId().publicKey);
+    QString oldPassword = password;
+    {
+        QMutexLocker locker{&saveMutex};
+        password = newPassword;
+        passkey = PasskeyCache::getEncryptionKey(password);
     }
+    // The state didn't change, but it must be encrypted with the new key
+    saveToxSave(true);
     saveAvatar(avatar, core->getSelfId().publicKey);
 
     QVector<uint32_t> friendList = core->getFriendList();
@@ -616,4 +1032,6 @@ void Profile::setPassword(QString newPassword)
         QString friendPublicKey = core->getFriendPublicKey(i.next());
         saveAvatar(loadAvatarData(friendPublicKey,oldPassword),friendPublicKey);
     }
+    if (oldPassword != password)
+        PasskeyCache::forget(oldPassword);
 }
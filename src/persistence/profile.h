@@ -25,9 +25,17 @@
 #include <QString>
 #include <QByteArray>
 #include <QPixmap>
+#include <QImage>
+#include <QCache>
+#include <QFuture>
+#include <QMutex>
+#include <QQueue>
+#include <QThreadPool>
 #include <tox/toxencryptsave.h>
 #include <memory>
+#include <atomic>
 #include "src/persistence/history.h"
+#include "src/persistence/passkeycache.h"
 
 class Core;
 class QThread;
@@ -54,19 +62,35 @@ public:
     bool isEncrypted() const; ///< Returns true if we have a password set (doesn't check the actual file on disk)
     bool checkPassword(); ///< Checks whether the password is valid
     QString getPassword() const;
-    void setPassword(QString newPassword); ///< Changes the encryption password and re-saves everything with it
-    const TOX_PASS_KEY& getPasskey() const;
+    /// Changes the encryption password and re-saves everything with it
+    /// If we have a history, this only starts re-encrypting it, the rest follows once History::passwordChanged succeeds
+    void setPassword(QString newPassword);
+    PasskeyCache::Key getPasskey() const; ///< The key we encrypt with, a nullptr without a password
 
     QByteArray loadToxSave(); ///< Loads the profile's .tox save from file, unencrypted
-    void saveToxSave(); ///< Saves the profile's .tox save, encrypted if needed. Invalid on deleted profiles.
+    /// Saves the profile's .tox save, encrypted if needed, unless Core has nothing new to save. Invalid on deleted profiles.
+    /// Core doesn't track the DHT nodes, so the save is forced when the Tox instance goes away
+    void saveToxSave(bool force = false);
     void saveToxSave(QByteArray data); ///< Write the .tox save, encrypted if needed. Invalid on deleted profiles.
+    /// Encrypts and writes the .tox save on a background thread, unless a newer save was written meanwhile
+    void saveToxSaveAsync(QByteArray data);
 
     QPixmap loadAvatar(); ///< Get our avatar from cache
     QPixmap loadAvatar(const QString& ownerId); ///< Get a contact's avatar from cache
+    /// Get a contact's avatar from cache, scaled to cover size. The scaled variant is kept in memory as well
+    QPixmap loadAvatar(const QString& ownerId, const QSize& size);
+    /// Loads and decrypts a contact's avatar on a worker thread, the result is a null image if there's none
+    QFuture<QImage> loadAvatarAsync(const QString& ownerId);
+    /// Decodes an image file reduced to size on a worker thread, it's never decoded at full size
+    /// The thumbnails are kept on disk per profile, encrypted if we are, the result is a null image on error
+    QFuture<QImage> loadThumbnailAsync(const QString& filePath, const QSize& size,
+                                       Qt::AspectRatioMode mode = Qt::KeepAspectRatioByExpanding);
     QByteArray loadAvatarData(const QString& ownerId); ///< Get a contact's avatar from cache
     QByteArray loadAvatarData(const QString& ownerId, const QString& password); ///< Get a contact's avatar from cache, with a specified profile password.
     void saveAvatar(QByteArray pic, const QString& ownerId); ///< Save an avatar to cache
-    QByteArray getAvatarHash(const QString& ownerId); ///< Get the tox hash of a cached avatar
+    /// Decodes a received avatar on a worker thread and saves it if it's valid, the result is a null image otherwise
+    QFuture<QImage> saveAvatarAsync(const QByteArray& pic, const QString& ownerId);
+    QByteArray getAvatarHash(const QString& ownerId); ///< Get the tox hash of a cached avatar, from the index if possible
     void removeAvatar(const QString& ownerId); ///< Removes a cached avatar
     void removeAvatar(); ///< Removes our own avatar
 
@@ -103,15 +127,43 @@ private:
     /// Gets the path of the avatar file cached by this profile and corresponding to this owner ID
     /// If forceUnencrypted, we return the path to the plaintext file even if we're an encrypted profile
     QString avatarPath(const QString& ownerId, bool forceUnencrypted = false);
+    /// Reads and decrypts the .tox save of a profile, returns false on error
+    static bool readToxSave(const QString& name, const QString& password, QByteArray& data);
+    /// Switches to the new password and re-saves the tox save and avatars with it
+    void applyPassword(QString newPassword);
+    /// Encrypts and writes a save, skipped if a save with a higher generation was already written
+    void writeToxSave(QByteArray data, quint64 generation);
+    /// Computes the tox hash of plaintext avatar data
+    static QByteArray hashAvatar(const QByteArray& pic);
+    /// Decodes an avatar, scaled to cover size if it's valid, or takes it from the in-memory cache
+    QImage loadAvatarImage(const QString& ownerId, const QSize& size);
+    /// Drops every decoded variant of an avatar, called whenever it's saved or removed
+    void invalidateAvatar(const QString& ownerId);
+    /// Directory of the profile's cached thumbnails, with a trailing separator
+    static QString thumbnailDir(const QString& name);
 
 private:
     Core* core;
     QThread* coreThread;
     QString name, password;
-    TOX_PASS_KEY passkey;
+    /// Passwords the history is being re-encrypted with, oldest first, one per passwordChanged to come
+    QQueue<QString> pendingPasswords;
+    PasskeyCache::Key passkey;
     std::unique_ptr<History> history;
+    QByteArray loadedToxSave; ///< The save we decrypted at login, until Core loads it
     bool newProfile; ///< True if this is a newly created profile, with no .tox save file yet.
     bool isRemoved; ///< True if the profile has been removed by remove()
+    mutable QMutex saveMutex; ///< Serializes writing the .tox save, and guards the password and passkey it uses
+    QThreadPool savePool; ///< Single thread writing the .tox saves in the background
+    std::atomic<quint64> saveGeneration; ///< Generation of the last save handed out for writing
+    quint64 writtenGeneration; ///< Generation of the last save written, protected by saveMutex
+    QMutex avatarMutex; ///< Guards the avatar cache, avatars are loaded from both the GUI and Core threads
+    QCache<QString, QImage> avatarCache; ///< Decoded avatars by owner and size, null images for missing ones
+    quint64 avatarGeneration; ///< Bumped by invalidateAvatar, so loads racing with a save aren't cached
+    QThreadPool avatarPool; ///< Decrypts and decodes avatars for loadAvatarAsync
+    QThreadPool thumbnailPool; ///< Decodes thumbnails for loadThumbnailAsync, so they don't hold up avatars
+    QThreadPool avatarSavePool; ///< Single thread for saveAvatarAsync, so a friend's newest avatar is saved last
+    static constexpr int avatarCacheSize = 32 * 1024 * 1024; ///< In bytes of decoded image data
     static QVector<QString> profiles;
     /// How much data we need to read to check if the file is encrypted
     /// Must be >= TOX_ENC_SAVE_MAGIC_LENGTH (8), which isn't publicly defined
@@ -204,16 +204,16 @@ uint64_t dataToUint64(QByteArray data)
             +(((uint64_t)(uint8_t)data[7])<<56);
 }
 
-size_t dataToVUint(const QByteArray& data)
+uint64_t dataToVUint(const QByteArray& data)
 {
     unsigned char num3;
-    size_t num = 0;
+    uint64_t num = 0;
     int num2 = 0;
     int i=0;
     do
     {
         num3 = data[i]; i++;
-        num |= (num3 & 0x7f) << num2;
+        num |= static_cast<uint64_t>(num3 & 0x7f) << num2;
         num2 += 7;
     } while ((num3 & 0x80) != 0);
     return num;
@@ -271,10 +271,11 @@ QByteArray uint64ToData(uint64_t num)
     return data;
 }
 
-QByteArray vuintToData(size_t num)
+QByteArray vuintToData(uint64_t num)
 {
-    QByteArray data(sizeof(size_t), 0);
-    // Write the size in a Uint of variable lenght (8-32 bits)
+    // A 64 bits number takes at most 10 bytes with 7 bits per byte
+    QByteArray data(10, 0);
+    // Write the size in a Uint of variable lenght (8-64 bits)
     int i=0;
     while (num >= 0x80)
     {
@@ -20,7 +20,6 @@
 
 #include "settings.h"
 #include "src/persistence/smileypack.h"
-#include "src/persistence/db/plaindb.h"
 #include "src/core/corestructs.h"
 #include "src/core/core.h"
 #include "src/widget/gui.h"
@@ -44,19 +43,80 @@
 #include <QCryptographicHash>
 #include <QMutexLocker>
 #include <QThread>
+#include <QTimer>
 #include <QNetworkProxy>
 
 #define SHOW_SYSTEM_TRAY_DEFAULT (bool) true
+#define PERSONAL_SAVE_INTERVAL 1000 // How often the personal settings may be rewritten, in ms
+#define GLOBAL_SAVE_INTERVAL 1000 // How often the global settings may be rewritten, in ms
+
+namespace
+{
+// The serialized format only stores strings, and the old INI files give us the typed values
+
+QString packBytes(const QByteArray& data)
+{
+    return QString::fromLatin1(data.toBase64());
+}
+
+QByteArray unpackBytes(const QVariant& value)
+{
+    if (value.type() == QVariant::ByteArray)
+        return value.toByteArray();
+    return QByteArray::fromBase64(value.toString().toLatin1());
+}
+
+QString packSize(const QSize& size)
+{
+    return QString("%1,%2").arg(size.width()).arg(size.height());
+}
+
+QSize unpackSize(const QVariant& value)
+{
+    if (value.type() == QVariant::Size)
+        return value.toSize();
+    QStringList parts = value.toString().split(',');
+    if (parts.size() != 2)
+        return QSize();
+    return QSize(parts[0].toInt(), parts[1].toInt());
+}
+
+QString packRect(const QRect& rect)
+{
+    return QString("%1,%2,%3,%4").arg(rect.x()).arg(rect.y()).arg(rect.width()).arg(rect.height());
+}
+
+QRect unpackRect(const QVariant& value)
+{
+    if (value.type() == QVariant::Rect)
+        return value.toRect();
+    QStringList parts = value.toString().split(',');
+    if (parts.size() != 4)
+        return QRect();
+    return QRect(parts[0].toInt(), parts[1].toInt(), parts[2].toInt(), parts[3].toInt());
+}
+}
 
 const QString Settings::globalSettingsFile = "qtox.ini";
+const QString Settings::serializedGlobalSettingsFile = "qtox.settings";
 Settings* Settings::settings{nullptr};
 QMutex Settings::bigLock{QMutex::Recursive};
 QThread* Settings::settingsThread{nullptr};
 
 Settings::Settings() :
     loaded(false), useCustomDhtList{false},
-    makeToxPortable{false}, currentProfileId(0)
-{
+    makeToxPortable{false}, currentProfileId(0), personalDirty{false}, globalDirty{false}
+{
+    // Moves to the settings thread along with us
+    personalSaveTimer = new QTimer(this);
+    personalSaveTimer->setSingleShot(true);
+    personalSaveTimer->setInterval(PERSONAL_SAVE_INTERVAL);
+    connect(personalSaveTimer, &QTimer::timeout, this, &Settings::flushPersonal);
+    globalSaveTimer = new QTimer(this);
+    globalSaveTimer->setSingleShot(true);
+    globalSaveTimer->setInterval(GLOBAL_SAVE_INTERVAL);
+    connect(globalSaveTimer, &QTimer::timeout, this, &Settings::writeGlobal);
+
     settingsThread = new QThread();
     settingsThread->setObjectName("qTox Settings");
     settingsThread->start(QThread::LowPriority);
@@ -97,8 +157,8 @@ void Settings::loadGlobal()
 
     if (QFile(qApp->applicationDirPath()+QDir::separator()+globalSettingsFile).exists())
     {
-        QSettings ps(qApp->applicationDirPath()+QDir::separator()+globalSettingsFile, QSettings::IniFormat);
-        ps.setIniCodec("UTF-8");
+        SettingsSerializer ps(qApp->applicationDirPath()+QDir::separator()+globalSettingsFile);
+        ps.load();
         ps.beginGroup("General");
             makeToxPortable = ps.value("makeToxPortable", false).toBool();
         ps.endGroup();
@@ -109,7 +169,11 @@ void Settings::loadGlobal()
     }
 
     QDir dir(getSettingsDirPath());
-    QString filePath = dir.filePath(globalSettingsFile);
+    QString filePath = dir.filePath(serializedGlobalSettingsFile);
+
+    // Before we serialized them, the global settings were in the INI file
+    if (!QFile(filePath).exists())
+        filePath = dir.filePath(globalSettingsFile);
 
     // If no settings file exist -- use the default one
     if (!QFile(filePath).exists())
@@ -120,8 +184,9 @@ void Settings::loadGlobal()
 
     qDebug() << "Loading settings from " + filePath;
 
-    QSettings s(filePath, QSettings::IniFormat);
-    s.setIniCodec("UTF-8");
+    // Reads both our serialized format and the INI files
+    SettingsSerializer s(filePath);
+    s.load();
     s.beginGroup("Login");
         autoLogin = s.value("autoLogin", false).toBool();
     s.endGroup();
@@ -148,6 +213,18 @@ void Settings::loadGlobal()
         {
             useCustomDhtList=false;
         }
+
+        int scoreCount = s.beginReadArray("nodeScores");
+        for (int i = 0; i < scoreCount; i ++)
+        {
+            s.setArrayIndex(i);
+            DhtNodeScore score;
+            score.successes = s.value("successes").toUInt();
+            score.failures = s.value("failures").toUInt();
+            score.connectTime = s.value("connectTime").toUInt();
+            dhtNodeScores[s.value("userId").toString()] = score;
+        }
+        s.endArray();
     s.endGroup();
 
     s.beginGroup("General");
@@ -181,18 +258,27 @@ void Settings::loadGlobal()
         separateWindow = s.value("separateWindow", false).toBool();
         dontGroupWindows = s.value("dontGroupWindows", true).toBool();
         groupchatPosition = s.value("groupchatPosition", true).toBool();
+        virtualFriendList = s.value("virtualFriendList", false).toBool();
         markdownPreference = static_cast<MarkdownType>(s.value("markdownPreference", 1).toInt());
     s.endGroup();
 
     s.beginGroup("Advanced");
-        int sType = s.value("dbSyncType", static_cast<int>(Db::syncType::stFull)).toInt();
-        setDbSyncType(sType);
+        historyWalJournal = s.value("historyWalJournal", true).toBool();
+        setHistorySyncMode(s.value("historySyncMode", 1).toInt());
+        historyCacheSize = s.value("historyCacheSize", 8).toInt();
+        historyMmapSize = s.value("historyMmapSize", 0).toInt();
+        historyMemoryTempStore = s.value("historyMemoryTempStore", true).toBool();
+    s.endGroup();
+
+    s.beginGroup("FileTransfers");
+        fileUploadLimit = s.value("uploadLimit", 0).toInt();
+        fileFriendUploadLimit = s.value("friendUploadLimit", 0).toInt();
     s.endGroup();
 
     s.beginGroup("Widgets");
         QList<QString> objectNames = s.childKeys();
         for (const QString& name : objectNames)
-            widgetSettings[name] = s.value(name).toByteArray();
+            widgetSettings[name] = unpackBytes(s.value(name));
 
     s.endGroup();
 
@@ -204,10 +290,11 @@ void Settings::loadGlobal()
             smileyPack = DEFAULT_SMILEYS;
         }
         emojiFontPointSize = s.value("emojiFontPointSize", 16).toInt();
+        chatMaxLines = s.value("chatMaxLines", 0).toInt();
         firstColumnHandlePos = s.value("firstColumnHandlePos", 50).toInt();
         secondColumnHandlePosFromRight = s.value("secondColumnHandlePosFromRight", 50).toInt();
-        timestampFormat = s.value("timestampFormat", "hh:mm:ss").toString();
-        dateFormat = s.value("dateFormat", "dddd, MMMM d, yyyy").toString();
+        std::atomic_store(&timestampFormat, std::make_shared<const QString>(s.value("timestampFormat", "hh:mm:ss").toString()));
+        std::atomic_store(&dateFormat, std::make_shared<const QString>(s.value("dateFormat", "dddd, MMMM d, yyyy").toString()));
         minimizeOnClose = s.value("minimizeOnClose", false).toBool();
         minimizeToTray = s.value("minimizeToTray", false).toBool();
         lightTrayIcon = s.value("lightTrayIcon", false).toBool();
@@ -225,12 +312,12 @@ void Settings::loadGlobal()
     s.endGroup();
 
     s.beginGroup("State");
-        windowGeometry = s.value("windowGeometry", QByteArray()).toByteArray();
-        windowState = s.value("windowState", QByteArray()).toByteArray();
-        splitterState = s.value("splitterState", QByteArray()).toByteArray();
-        dialogGeometry = s.value("dialogGeometry", QByteArray()).toByteArray();
-        dialogSplitterState = s.value("dialogSplitterState", QByteArray()).toByteArray();
-        dialogSettingsGeometry = s.value("dialogSettingsGeometry", QByteArray()).toByteArray();
+        windowGeometry = unpackBytes(s.value("windowGeometry", QByteArray()));
+        windowState = unpackBytes(s.value("windowState", QByteArray()));
+        splitterState = unpackBytes(s.value("splitterState", QByteArray()));
+        dialogGeometry = unpackBytes(s.value("dialogGeometry", QByteArray()));
+        dialogSplitterState = unpackBytes(s.value("dialogSplitterState", QByteArray()));
+        dialogSettingsGeometry = unpackBytes(s.value("dialogSettingsGeometry", QByteArray()));
     s.endGroup();
 
     s.beginGroup("Audio");
@@ -239,12 +326,17 @@ void Settings::loadGlobal()
         audioInGainDecibel = s.value("inGain", 0).toReal();
         outVolume = s.value("outVolume", 100).toInt();
         filterAudio = s.value("filterAudio", false).toBool();
+        audioFrameDuration = s.value("frameDuration", 20).toInt();
+        audioInputKeepWarm = s.value("inputKeepWarm", 30).toInt();
+        realtimeThreads = s.value("realtimeThreads", false).toBool();
     s.endGroup();
 
     s.beginGroup("Video");
         videoDev = s.value("videoDev", "").toString();
-        camVideoRes = s.value("camVideoRes",QSize()).toSize();
+        camVideoRes = unpackSize(s.value("camVideoRes", QSize()));
         camVideoFPS = s.value("camVideoFPS", 0).toUInt();
+        camVideoHwAccel = s.value("camVideoHwAccel", false).toBool();
+        screenRegion = unpackRect(s.value("screenRegion", QRect()));
     s.endGroup();
 
     // Read the embedded DHT bootstrap nodes list if needed
@@ -303,6 +395,8 @@ void Settings::loadPersonal(Profile* profile)
     ps.beginGroup("Privacy");
         typingNotification = ps.value("typingNotification", true).toBool();
         enableLogging = ps.value("enableLogging", true).toBool();
+        historyMaxAge = ps.value("historyMaxAge", 0).toInt();
+        historyMaxRows = ps.value("historyMaxRows", 0).toInt();
     ps.endGroup();
 
     ps.beginGroup("Friends");
@@ -317,11 +411,13 @@ void Settings::loadPersonal(Profile* profile)
             fp.note = ps.value("note").toString();
             fp.autoAcceptDir = ps.value("autoAcceptDir").toString();
             fp.circleID = ps.value("circle", -1).toInt();
+            fp.historyMaxAge = ps.value("historyMaxAge", -1).toInt();
+            fp.historyMaxRows = ps.value("historyMaxRows", -1).toInt();
 
             if (getEnableLogging())
                 fp.activity = ps.value("activity", QDate()).toDate();
 
-            friendLst[ToxId(fp.addr).publicKey] = fp;
+            friendLst[ToxPk(fp.addr)] = fp;
         }
         ps.endArray();
     ps.endGroup();
@@ -346,6 +442,40 @@ void Settings::loadPersonal(Profile* profile)
         compactLayout = ps.value("compactLayout", true).toBool();
     ps.endGroup();
 
+    ps.beginGroup("Transfers");
+        size = ps.beginReadArray("Transfer");
+        resumableTransfers.clear();
+        resumableTransfers.reserve(size);
+        for (int i = 0; i < size; i ++)
+        {
+            ps.setArrayIndex(i);
+            ResumableTransfer transfer;
+            transfer.friendPk = ps.value("friendPk").toString();
+            transfer.fileId = QByteArray::fromHex(ps.value("fileId").toByteArray());
+            transfer.fileName = ps.value("fileName").toString();
+            transfer.filePath = ps.value("filePath").toString();
+            transfer.fileSize = ps.value("fileSize").toULongLong();
+            transfer.sending = ps.value("sending").toBool();
+            resumableTransfers.push_back(transfer);
+        }
+        ps.endArray();
+    ps.endGroup();
+
+    ps.beginGroup("AvatarHashes");
+        size = ps.beginReadArray("Avatar");
+        avatarHashes.clear();
+        avatarHashes.reserve(size);
+        for (int i = 0; i < size; i ++)
+        {
+            ps.setArrayIndex(i);
+            QString ownerId = ps.value("ownerId").toString();
+            QByteArray hash = QByteArray::fromHex(ps.value("hash").toByteArray());
+            if (!ownerId.isEmpty() && !hash.isEmpty())
+                avatarHashes[ownerId] = hash;
+        }
+        ps.endArray();
+    ps.endGroup();
+
     ps.beginGroup("Circles");
         size = ps.beginReadArray("Circle");
         circleLst.clear();
@@ -369,19 +499,29 @@ void Settings::loadPersonal(Profile* profile)
     ps.endGroup();
 }
 
+/**
+ * @brief Marks the global settings as changed, they're written at most once per GLOBAL_SAVE_INTERVAL
+ */
 void Settings::saveGlobal()
 {
     if (QThread::currentThread() != settingsThread)
         return (void) QMetaObject::invokeMethod(&getInstance(), "saveGlobal");
 
+    globalDirty = true;
+    if (!globalSaveTimer->isActive())
+        globalSaveTimer->start();
+}
+
+void Settings::writeGlobal()
+{
     QMutexLocker locker{&bigLock};
-    QString path = getSettingsDirPath() + globalSettingsFile;
-    qDebug() << "Saving global settings at " + path;
+    globalDirty = false;
+    globalSaveTimer->stop();
 
-    QSettings s(path, QSettings::IniFormat);
-    s.setIniCodec("UTF-8");
+    QString path = getSettingsDirPath() + serializedGlobalSettingsFile;
+    qDebug() << "Saving global settings at " + path;
 
-    s.clear();
+    SettingsSerializer s(path);
 
     s.beginGroup("Login");
         s.setValue("autoLogin", autoLogin);
@@ -399,6 +539,18 @@ void Settings::saveGlobal()
             s.setValue("port", dhtServerList[i].port);
         }
         s.endArray();
+
+        s.beginWriteArray("nodeScores", dhtNodeScores.size());
+        int scoreIndex = 0;
+        for (auto it = dhtNodeScores.constBegin(); it != dhtNodeScores.constEnd(); ++it)
+        {
+            s.setArrayIndex(scoreIndex++);
+            s.setValue("userId", it.key());
+            s.setValue("successes", it.value().successes);
+            s.setValue("failures", it.value().failures);
+            s.setValue("connectTime", it.value().connectTime);
+        }
+        s.endArray();
     s.endGroup();
 
     s.beginGroup("General");
@@ -424,64 +576,109 @@ void Settings::saveGlobal()
         s.setValue("separateWindow", separateWindow);
         s.setValue("dontGroupWindows", dontGroupWindows);
         s.setValue("groupchatPosition", groupchatPosition);
+        s.setValue("virtualFriendList", virtualFriendList);
         s.setValue("autoSaveEnabled", autoSaveEnabled);
         s.setValue("globalAutoAcceptDir", globalAutoAcceptDir);
-        s.setValue("markdownPreference", static_cast<int>(markdownPreference));
+        s.setValue("markdownPreference", static_cast<int>(markdownPreference.load()));
     s.endGroup();
 
     s.beginGroup("Advanced");
-        s.setValue("dbSyncType", static_cast<int>(dbSyncType));
+        s.setValue("historyWalJournal", historyWalJournal);
+        s.setValue("historySyncMode", historySyncMode);
+        s.setValue("historyCacheSize", historyCacheSize);
+        s.setValue("historyMmapSize", historyMmapSize);
+        s.setValue("historyMemoryTempStore", historyMemoryTempStore);
+    s.endGroup();
+
+    s.beginGroup("FileTransfers");
+        s.setValue("uploadLimit", fileUploadLimit);
+        s.setValue("friendUploadLimit", fileFriendUploadLimit);
     s.endGroup();
 
     s.beginGroup("Widgets");
     const QList<QString> widgetNames = widgetSettings.keys();
     for (const QString& name : widgetNames)
-        s.setValue(name, widgetSettings.value(name));
+        s.setValue(name, packBytes(widgetSettings.value(name)));
     s.endGroup();
 
     s.beginGroup("GUI");
         s.setValue("smileyPack", smileyPack);
         s.setValue("emojiFontPointSize", emojiFontPointSize);
+        s.setValue("chatMaxLines", chatMaxLines);
         s.setValue("firstColumnHandlePos", firstColumnHandlePos);
         s.setValue("secondColumnHandlePosFromRight", secondColumnHandlePosFromRight);
-        s.setValue("timestampFormat", timestampFormat);
-        s.setValue("dateFormat", dateFormat);
+        s.setValue("timestampFormat", getTimestampFormat());
+        s.setValue("dateFormat", getDateFormat());
         s.setValue("minimizeOnClose", minimizeOnClose);
         s.setValue("minimizeToTray", minimizeToTray);
         s.setValue("lightTrayIcon", lightTrayIcon);
-        s.setValue("useEmoticons", useEmoticons);
+        s.setValue("useEmoticons", useEmoticons.load());
         s.setValue("themeColor", themeColor);
         s.setValue("style", style);
-        s.setValue("statusChangeNotificationEnabled", statusChangeNotificationEnabled);
+        s.setValue("statusChangeNotificationEnabled", statusChangeNotificationEnabled.load());
     s.endGroup();
 
     s.beginGroup("State");
-        s.setValue("windowGeometry", windowGeometry);
-        s.setValue("windowState", windowState);
-        s.setValue("splitterState", splitterState);
-        s.setValue("dialogGeometry", dialogGeometry);
-        s.setValue("dialogSplitterState", dialogSplitterState);
-        s.setValue("dialogSettingsGeometry", dialogSettingsGeometry);
+        s.setValue("windowGeometry", packBytes(windowGeometry));
+        s.setValue("windowState", packBytes(windowState));
+        s.setValue("splitterState", packBytes(splitterState));
+        s.setValue("dialogGeometry", packBytes(dialogGeometry));
+        s.setValue("dialogSplitterState", packBytes(dialogSplitterState));
+        s.setValue("dialogSettingsGeometry", packBytes(dialogSettingsGeometry));
     s.endGroup();
 
     s.beginGroup("Audio");
         s.setValue("inDev", inDev);
         s.setValue("outDev", outDev);
-        s.setValue("inGain", audioInGainDecibel);
-        s.setValue("outVolume", outVolume);
-        s.setValue("filterAudio", filterAudio);
+        s.setValue("inGain", audioInGainDecibel.load());
+        s.setValue("outVolume", outVolume.load());
+        s.setValue("filterAudio", filterAudio.load());
+        s.setValue("frameDuration", audioFrameDuration.load());
+        s.setValue("inputKeepWarm", audioInputKeepWarm.load());
+        s.setValue("realtimeThreads", realtimeThreads.load());
     s.endGroup();
 
     s.beginGroup("Video");
         s.setValue("videoDev", videoDev);
-        s.setValue("camVideoRes",camVideoRes);
+        s.setValue("camVideoRes", packSize(camVideoRes));
         s.setValue("camVideoFPS",camVideoFPS);
+        s.setValue("camVideoHwAccel", camVideoHwAccel);
+        s.setValue("screenRegion", packRect(screenRegion));
     s.endGroup();
+
+    s.save();
+
+    writePortableMarker();
 }
 
+/**
+ * @brief Marks the personal settings as changed, they're written at most once per PERSONAL_SAVE_INTERVAL
+ *
+ * Changes tend to come in bursts, like friends dragged between circles one after the other.
+ * Each save rewrites and re-encrypts the whole file, so the whole burst is written at once.
+ */
 void Settings::savePersonal()
 {
-    savePersonal(Nexus::getProfile());
+    if (QThread::currentThread() != settingsThread)
+        return (void) QMetaObject::invokeMethod(&getInstance(), "savePersonalLater");
+
+    savePersonalLater();
+}
+
+void Settings::savePersonalLater()
+{
+    personalDirty = true;
+    if (!personalSaveTimer->isActive())
+        personalSaveTimer->start();
+}
+
+/**
+ * @brief Writes the personal settings of the current profile now, if they changed since the last write
+ */
+void Settings::flushPersonal()
+{
+    if (personalDirty)
+        savePersonal(Nexus::getProfile());
 }
 
 void Settings::savePersonal(Profile* profile)
@@ -502,6 +699,10 @@ void Settings::savePersonal(QString profileName, QString password)
 
     QMutexLocker locker{&bigLock};
 
+    // This write includes every change we were waiting to save
+    personalDirty = false;
+    personalSaveTimer->stop();
+
     QString path = getSettingsDirPath() + profileName + ".ini";
 
     qDebug() << "Saving personal settings at " << path;
@@ -518,6 +719,8 @@ void Settings::savePersonal(QString profileName, QString password)
             ps.setValue("note", frnd.note);
             ps.setValue("autoAcceptDir", frnd.autoAcceptDir);
             ps.setValue("circle", frnd.circleID);
+            ps.setValue("historyMaxAge", frnd.historyMaxAge);
+            ps.setValue("historyMaxRows", frnd.historyMaxRows);
 
             if (getEnableLogging())
                 ps.setValue("activity", frnd.activity);
@@ -546,6 +749,38 @@ void Settings::savePersonal(QString profileName, QString password)
         ps.setValue("compactLayout", compactLayout);
     ps.endGroup();
 
+    ps.beginGroup("Transfers");
+        ps.beginWriteArray("Transfer", resumableTransfers.size());
+        index = 0;
+        for (auto& transfer : resumableTransfers)
+        {
+            ps.setArrayIndex(index);
+            ps.setValue("friendPk", transfer.friendPk);
+            ps.setValue("fileId", transfer.fileId.toHex());
+            ps.setValue("fileName", transfer.fileName);
+            ps.setValue("filePath", transfer.filePath);
+            ps.setValue("fileSize", transfer.fileSize);
+            ps.setValue("sending", transfer.sending);
+
+            ++index;
+        }
+        ps.endArray();
+    ps.endGroup();
+
+    ps.beginGroup("AvatarHashes");
+        ps.beginWriteArray("Avatar", avatarHashes.size());
+        index = 0;
+        for (auto it = avatarHashes.constBegin(); it != avatarHashes.constEnd(); ++it)
+        {
+            ps.setArrayIndex(index);
+            ps.setValue("ownerId", it.key());
+            ps.setValue("hash", it.value().toHex());
+
+            ++index;
+        }
+        ps.endArray();
+    ps.endGroup();
+
     ps.beginGroup("Circles");
         ps.beginWriteArray("Circle", circleLst.size());
         index = 0;
@@ -562,6 +797,8 @@ void Settings::savePersonal(QString profileName, QString password)
     ps.beginGroup("Privacy");
         ps.setValue("typingNotification", typingNotification);
         ps.setValue("enableLogging", enableLogging);
+        ps.setValue("historyMaxAge", historyMaxAge);
+        ps.setValue("historyMaxRows", historyMaxRows);
     ps.endGroup();
 
     ps.beginGroup("Toxme");
@@ -652,6 +889,18 @@ void Settings::setDhtServerList(const QList<DhtServer>& newDhtServerList)
     emit dhtServerListChanged();
 }
 
+QHash<QString, DhtNodeScore> Settings::getDhtNodeScores() const
+{
+    QMutexLocker locker{&bigLock};
+    return dhtNodeScores;
+}
+
+void Settings::setDhtNodeScore(const QString& userId, const DhtNodeScore& score)
+{
+    QMutexLocker locker{&bigLock};
+    dhtNodeScores[userId] = score;
+}
+
 bool Settings::getEnableIPv6() const
 {
     QMutexLocker locker{&bigLock};
@@ -674,6 +923,7 @@ void Settings::setMakeToxPortable(bool newValue)
 {
     QMutexLocker locker{&bigLock};
     QFile(getSettingsDirPath()+globalSettingsFile).remove();
+    QFile(getSettingsDirPath()+serializedGlobalSettingsFile).remove();
     makeToxPortable = newValue;
     saveGlobal();
 }
@@ -730,13 +980,14 @@ void Settings::setShowSystemTray(const bool& newValue)
 
 void Settings::setUseEmoticons(bool newValue)
 {
-    QMutexLocker locker{&bigLock};
-    useEmoticons = newValue;
+    if (useEmoticons.exchange(newValue) == newValue)
+        return;
+
+    emit messageFormattingChanged();
 }
 
 bool Settings::getUseEmoticons() const
 {
-    QMutexLocker locker{&bigLock};
     return useEmoticons;
 }
 
@@ -796,13 +1047,11 @@ void Settings::setLightTrayIcon(bool newValue)
 
 bool Settings::getStatusChangeNotificationEnabled() const
 {
-    QMutexLocker locker{&bigLock};
     return statusChangeNotificationEnabled;
 }
 
 void Settings::setStatusChangeNotificationEnabled(bool newValue)
 {
-    QMutexLocker locker{&bigLock};
     statusChangeNotificationEnabled = newValue;
 }
 
@@ -1037,19 +1286,91 @@ void Settings::setEnableLogging(bool newValue)
     enableLogging = newValue;
 }
 
-Db::syncType Settings::getDbSyncType() const
+int Settings::getHistoryMaxAge() const
+{
+    QMutexLocker locker{&bigLock};
+    return historyMaxAge;
+}
+
+void Settings::setHistoryMaxAge(int days)
+{
+    QMutexLocker locker{&bigLock};
+    historyMaxAge = days;
+}
+
+int Settings::getHistoryMaxRows() const
+{
+    QMutexLocker locker{&bigLock};
+    return historyMaxRows;
+}
+
+void Settings::setHistoryMaxRows(int rows)
 {
     QMutexLocker locker{&bigLock};
-    return dbSyncType;
+    historyMaxRows = rows;
 }
 
-void Settings::setDbSyncType(int newValue)
+bool Settings::getHistoryWalJournal() const
+{
+    QMutexLocker locker{&bigLock};
+    return historyWalJournal;
+}
+
+void Settings::setHistoryWalJournal(bool newValue)
+{
+    QMutexLocker locker{&bigLock};
+    historyWalJournal = newValue;
+}
+
+int Settings::getHistorySyncMode() const
+{
+    QMutexLocker locker{&bigLock};
+    return historySyncMode;
+}
+
+void Settings::setHistorySyncMode(int newValue)
 {
     QMutexLocker locker{&bigLock};
     if (newValue >= 0 && newValue <= 2)
-        dbSyncType = static_cast<Db::syncType>(newValue);
+        historySyncMode = newValue;
     else
-        dbSyncType = Db::syncType::stFull;
+        historySyncMode = 1;
+}
+
+int Settings::getHistoryCacheSize() const
+{
+    QMutexLocker locker{&bigLock};
+    return historyCacheSize;
+}
+
+void Settings::setHistoryCacheSize(int newValue)
+{
+    QMutexLocker locker{&bigLock};
+    historyCacheSize = qMax(1, newValue);
+}
+
+int Settings::getHistoryMmapSize() const
+{
+    QMutexLocker locker{&bigLock};
+    return historyMmapSize;
+}
+
+void Settings::setHistoryMmapSize(int newValue)
+{
+    QMutexLocker locker{&bigLock};
+    historyMmapSize = qMax(0, newValue);
+}
+
+bool Settings::getHistoryMemoryTempStore() const
+{
+    QMutexLocker locker{&bigLock};
+    return historyMemoryTempStore;
+}
+
+void Settings::setHistoryMemoryTempStore(bool newValue)
+{
+    QMutexLocker locker{&bigLock};
+    historyMemoryTempStore = newValue;
 }
 
 int Settings::getAutoAwayTime() const
@@ -1070,7 +1391,7 @@ void Settings::setAutoAwayTime(int newValue)
 QString Settings::getAutoAcceptDir(const ToxId& id) const
 {
     QMutexLocker locker{&bigLock};
-    QString key = id.publicKey;
+    ToxPk key = id.getPublicKey();
 
     auto it = friendLst.find(key);
     if (it != friendLst.end())
@@ -1082,7 +1403,7 @@ QString Settings::getAutoAcceptDir(const ToxId& id) const
 void Settings::setAutoAcceptDir(const ToxId &id, const QString& dir)
 {
     QMutexLocker locker{&bigLock};
-    QString key = id.publicKey;
+    ToxPk key = id.getPublicKey();
 
     auto it = friendLst.find(key);
     if (it != friendLst.end())
@@ -1100,7 +1421,7 @@ QString Settings::getContactNote(const ToxId &id) const
 {
     QMutexLocker locker{&bigLock};
 
-    auto it = friendLst.find(id.publicKey);
+    auto it = friendLst.find(id.getPublicKey());
     if (it != friendLst.end())
         return it->note;
 
@@ -1111,7 +1432,7 @@ void Settings::setContactNote(const ToxId &id, const QString& note)
 {
     QMutexLocker locker{&bigLock};
 
-    auto it = friendLst.find(id.publicKey);
+    auto it = friendLst.find(id.getPublicKey());
     if (it != friendLst.end())
     {
         qDebug() << note;
@@ -1174,6 +1495,19 @@ void Settings::setEmojiFontPointSize(int value)
     emit emojiFontChanged();
 }
 
+int Settings::getChatMaxLines() const
+{
+    QMutexLocker locker{&bigLock};
+    return chatMaxLines;
+}
+
+void Settings::setChatMaxLines(int value)
+{
+    QMutexLocker locker{&bigLock};
+    chatMaxLines = value;
+    emit chatMaxLinesChanged();
+}
+
 int Settings::getFirstColumnHandlePos() const
 {
     QMutexLocker locker{&bigLock};
@@ -1198,40 +1532,37 @@ void Settings::setSecondColumnHandlePosFromRight(const int pos)
     secondColumnHandlePosFromRight = pos;
 }
 
-const QString& Settings::getTimestampFormat() const
+QString Settings::getTimestampFormat() const
 {
-    QMutexLocker locker{&bigLock};
-    return timestampFormat;
+    return *std::atomic_load(&timestampFormat);
 }
 
 void Settings::setTimestampFormat(const QString &format)
 {
-    QMutexLocker locker{&bigLock};
-    timestampFormat = format;
+    std::atomic_store(&timestampFormat, std::make_shared<const QString>(format));
 }
 
-const QString& Settings::getDateFormat() const
+QString Settings::getDateFormat() const
 {
-    QMutexLocker locker{&bigLock};
-    return dateFormat;
+    return *std::atomic_load(&dateFormat);
 }
 
 void Settings::setDateFormat(const QString &format)
 {
-    QMutexLocker locker{&bigLock};
-    dateFormat = format;
+    std::atomic_store(&dateFormat, std::make_shared<const QString>(format));
 }
 
 MarkdownType Settings::getMarkdownPreference() const
 {
-    QMutexLocker locker{&bigLock};
     return markdownPreference;
 }
 
 void Settings::setMarkdownPreference(MarkdownType newValue)
 {
-    QMutexLocker locker{&bigLock};
-    markdownPreference = newValue;
+    if (markdownPreference.exchange(newValue) == newValue)
+        return;
+
+    emit messageFormattingChanged();
 }
 
 QByteArray Settings::getWindowGeometry() const
@@ -1368,13 +1699,11 @@ void Settings::setInDev(const QString& deviceSpecifier)
 
 qreal Settings::getAudioInGain() const
 {
-    QMutexLocker locker{&bigLock};
     return audioInGainDecibel;
 }
 
 void Settings::setAudioInGain(qreal dB)
 {
-    QMutexLocker locker{&bigLock};
     audioInGainDecibel = dB;
 }
 
@@ -1404,29 +1733,81 @@ void Settings::setOutDev(const QString& deviceSpecifier)
 
 int Settings::getOutVolume() const
 {
-    QMutexLocker locker{&bigLock};
     return outVolume;
 }
 
 void Settings::setOutVolume(int volume)
 {
-    QMutexLocker locker{&bigLock};
     outVolume = volume;
 }
 
 bool Settings::getFilterAudio() const
 {
-    QMutexLocker locker{&bigLock};
     // temporary disable filteraudio, as it doesn't work as expected
     return false;
 }
 
 void Settings::setFilterAudio(bool newValue)
 {
-    QMutexLocker locker{&bigLock};
     filterAudio = newValue;
 }
 
+int Settings::getAudioFrameDuration() const
+{
+    return audioFrameDuration;
+}
+
+void Settings::setAudioFrameDuration(int ms)
+{
+    audioFrameDuration = ms;
+}
+
+int Settings::getAudioInputKeepWarm() const
+{
+    return audioInputKeepWarm;
+}
+
+void Settings::setAudioInputKeepWarm(int seconds)
+{
+    audioInputKeepWarm = qMax(0, seconds);
+}
+
+bool Settings::getRealtimeThreads() const
+{
+    return realtimeThreads;
+}
+
+void Settings::setRealtimeThreads(bool enabled)
+{
+    realtimeThreads = enabled;
+}
+
+int Settings::getFileUploadLimit() const
+{
+    QMutexLocker locker{&bigLock};
+    return fileUploadLimit;
+}
+
+void Settings::setFileUploadLimit(int limit)
+{
+    QMutexLocker locker{&bigLock};
+    fileUploadLimit = qMax(0, limit);
+    emit fileTransferLimitsChanged();
+}
+
+int Settings::getFileFriendUploadLimit() const
+{
+    QMutexLocker locker{&bigLock};
+    return fileFriendUploadLimit;
+}
+
+void Settings::setFileFriendUploadLimit(int limit)
+{
+    QMutexLocker locker{&bigLock};
+    fileFriendUploadLimit = qMax(0, limit);
+    emit fileTransferLimitsChanged();
+}
+
 QSize Settings::getCamVideoRes() const
 {
     QMutexLocker locker{&bigLock};
@@ -1451,10 +1832,34 @@ void Settings::setCamVideoFPS(unsigned short newValue)
     camVideoFPS = newValue;
 }
 
+bool Settings::getCamVideoHwAccel() const
+{
+    QMutexLocker locker{&bigLock};
+    return camVideoHwAccel;
+}
+
+void Settings::setCamVideoHwAccel(bool newValue)
+{
+    QMutexLocker locker{&bigLock};
+    camVideoHwAccel = newValue;
+}
+
+QRect Settings::getScreenRegion() const
+{
+    QMutexLocker locker{&bigLock};
+    return screenRegion;
+}
+
+void Settings::setScreenRegion(QRect newValue)
+{
+    QMutexLocker locker{&bigLock};
+    screenRegion = newValue;
+}
+
 QString Settings::getFriendAdress(const QString &publicKey) const
 {
     QMutexLocker locker{&bigLock};
-    QString key = ToxId(publicKey).publicKey;
+    ToxPk key(publicKey);
     auto it = friendLst.find(key);
     if (it != friendLst.end())
         return it->addr;
@@ -1465,7 +1870,7 @@ QString Settings::getFriendAdress(const QString &publicKey) const
 void Settings::updateFriendAdress(const QString &newAddr)
 {
     QMutexLocker locker{&bigLock};
-    QString key = ToxId(newAddr).publicKey;
+    ToxPk key(newAddr);
     auto it = friendLst.find(key);
     if (it != friendLst.end())
     {
@@ -1478,14 +1883,14 @@ void Settings::updateFriendAdress(const QString &newAddr)
         fp.alias = "";
         fp.note = "";
         fp.autoAcceptDir = "";
-        friendLst[newAddr] = fp;
+        friendLst[key] = fp;
     }
 }
 
 QString Settings::getFriendAlias(const ToxId &id) const
 {
     QMutexLocker locker{&bigLock};
-    QString key = id.publicKey;
+    ToxPk key = id.getPublicKey();
     auto it = friendLst.find(key);
     if (it != friendLst.end())
         return it->alias;
@@ -1496,7 +1901,7 @@ QString Settings::getFriendAlias(const ToxId &id) const
 void Settings::setFriendAlias(const ToxId &id, const QString &alias)
 {
     QMutexLocker locker{&bigLock};
-    QString key = id.publicKey;
+    ToxPk key = id.getPublicKey();
     auto it = friendLst.find(key);
     if (it != friendLst.end())
     {
@@ -1515,7 +1920,7 @@ void Settings::setFriendAlias(const ToxId &id, const QString &alias)
 
 int Settings::getFriendCircleID(const ToxId &id) const
 {
-    QString key = id.publicKey;
+    ToxPk key = id.getPublicKey();
     auto it = friendLst.find(key);
     if (it != friendLst.end())
         return it->circleID;
@@ -1525,7 +1930,7 @@ int Settings::getFriendCircleID(const ToxId &id) const
 
 void Settings::setFriendCircleID(const ToxId &id, int circleID)
 {
-    QString key = id.publicKey;
+    ToxPk key = id.getPublicKey();
     auto it = friendLst.find(key);
     if (it != friendLst.end())
     {
@@ -1545,7 +1950,7 @@ void Settings::setFriendCircleID(const ToxId &id, int circleID)
 
 QDate Settings::getFriendActivity(const ToxId &id) const
 {
-    QString key = id.publicKey;
+    ToxPk key = id.getPublicKey();
     auto it = friendLst.find(key);
     if (it != friendLst.end())
         return it->activity;
@@ -1555,7 +1960,7 @@ QDate Settings::getFriendActivity(const ToxId &id) const
 
 void Settings::setFriendActivity(const ToxId &id, const QDate &activity)
 {
-    QString key = id.publicKey;
+    ToxPk key = id.getPublicKey();
     auto it = friendLst.find(key);
     if (it != friendLst.end())
     {
@@ -1574,10 +1979,68 @@ void Settings::setFriendActivity(const ToxId &id, const QDate &activity)
     }
 }
 
+int Settings::getFriendHistoryMaxAge(const ToxId &id) const
+{
+    QMutexLocker locker{&bigLock};
+    ToxPk key = id.getPublicKey();
+    auto it = friendLst.find(key);
+    if (it != friendLst.end() && it->historyMaxAge >= 0)
+        return it->historyMaxAge;
+
+    return historyMaxAge;
+}
+
+void Settings::setFriendHistoryMaxAge(const ToxId &id, int days)
+{
+    QMutexLocker locker{&bigLock};
+    ToxPk key = id.getPublicKey();
+    auto it = friendLst.find(key);
+    if (it != friendLst.end())
+    {
+        it->historyMaxAge = days;
+    }
+    else
+    {
+        friendProp fp;
+        fp.addr = key;
+        fp.historyMaxAge = days;
+        friendLst[key] = fp;
+    }
+}
+
+int Settings::getFriendHistoryMaxRows(const ToxId &id) const
+{
+    QMutexLocker locker{&bigLock};
+    ToxPk key = id.getPublicKey();
+    auto it = friendLst.find(key);
+    if (it != friendLst.end() && it->historyMaxRows >= 0)
+        return it->historyMaxRows;
+
+    return historyMaxRows;
+}
+
+void Settings::setFriendHistoryMaxRows(const ToxId &id, int rows)
+{
+    QMutexLocker locker{&bigLock};
+    ToxPk key = id.getPublicKey();
+    auto it = friendLst.find(key);
+    if (it != friendLst.end())
+    {
+        it->historyMaxRows = rows;
+    }
+    else
+    {
+        friendProp fp;
+        fp.addr = key;
+        fp.historyMaxRows = rows;
+        friendLst[key] = fp;
+    }
+}
+
 void Settings::removeFriendSettings(const ToxId &id)
 {
     QMutexLocker locker{&bigLock};
-    QString key = id.publicKey;
+    ToxPk key = id.getPublicKey();
     friendLst.remove(key);
 }
 
@@ -1641,6 +2104,18 @@ void Settings::setGroupchatPosition(bool value)
     groupchatPosition = value;
 }
 
+bool Settings::getVirtualFriendList() const
+{
+    QMutexLocker locker{&bigLock};
+    return virtualFriendList;
+}
+
+void Settings::setVirtualFriendList(bool value)
+{
+    QMutexLocker locker{&bigLock};
+    virtualFriendList = value;
+}
+
 int Settings::getCircleCount() const
 {
     return circleLst.size();
@@ -1748,6 +2223,60 @@ void Settings::readFriendRequest(int index)
     friendRequests[index].read = true;
 }
 
+QList<Settings::ResumableTransfer> Settings::getResumableTransfers() const
+{
+    QMutexLocker locker{&bigLock};
+    return resumableTransfers;
+}
+
+void Settings::addResumableTransfer(const ResumableTransfer& transfer)
+{
+    QMutexLocker locker{&bigLock};
+    for (auto& known : resumableTransfers)
+    {
+        if (known.fileId == transfer.fileId)
+        {
+            known = transfer;
+            return;
+        }
+    }
+
+    resumableTransfers.push_back(transfer);
+}
+
+bool Settings::removeResumableTransfer(const QByteArray& fileId)
+{
+    QMutexLocker locker{&bigLock};
+    for (int i = 0; i < resumableTransfers.size(); ++i)
+    {
+        if (resumableTransfers[i].fileId == fileId)
+        {
+            resumableTransfers.removeAt(i);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+QByteArray Settings::getAvatarHash(const QString& ownerId) const
+{
+    QMutexLocker locker{&bigLock};
+    return avatarHashes.value(ownerId);
+}
+
+void Settings::setAvatarHash(const QString& ownerId, const QByteArray& hash)
+{
+    QMutexLocker locker{&bigLock};
+    avatarHashes[ownerId] = hash;
+}
+
+void Settings::removeAvatarHash(const QString& ownerId)
+{
+    QMutexLocker locker{&bigLock};
+    avatarHashes.remove(ownerId);
+}
+
 int Settings::removeCircle(int id)
 {
     // Replace index with last one and remove last one instead.
@@ -1806,6 +2335,29 @@ void Settings::createSettingsDir()
         qCritical() << "Error while creating directory " << dir;
 }
 
+/**
+@brief Keeps qtox.ini an INI file with makeToxPortable in it.
+The updater and older versions of qTox read it, the other settings it has are left as they were.
+Downgrading to a version before the serialized global settings loses the changes made since.
+*/
+void Settings::writePortableMarker()
+{
+    QString path = getSettingsDirPath() + globalSettingsFile;
+
+    // A few builds serialized the global settings in it, they're in their own file now
+    if (SettingsSerializer::isSerializedFormat(path))
+        QFile(path).remove();
+
+    if (!makeToxPortable && !QFile(path).exists())
+        return;
+
+    QSettings ini(path, QSettings::IniFormat);
+    ini.setIniCodec("UTF-8");
+    ini.beginGroup("General");
+        ini.setValue("makeToxPortable", makeToxPortable);
+    ini.endGroup();
+}
+
 void Settings::sync()
 {
     if (QThread::currentThread() != settingsThread)
@@ -1816,4 +2368,7 @@ void Settings::sync()
 
     QMutexLocker locker{&bigLock};
     qApp->processEvents();
+    flushPersonal();
+    if (globalDirty)
+        writeGlobal();
 }
@@ -28,10 +28,13 @@
 #include <QDate>
 #include <QNetworkProxy>
 #include "src/core/corestructs.h"
+#include "src/core/toxpk.h"
+#include <atomic>
+#include <memory>
 
 class ToxId;
 class Profile;
-namespace Db { enum class syncType; }
+class QTimer;
 
 enum ProxyType {ptNone, ptSOCKS5, ptHTTP};
 
@@ -48,10 +51,11 @@ public:
     QString getAppCacheDirPath(); ///< The returned path ends with a directory separator
 
     void createSettingsDir(); ///< Creates a path to the settings dir, if it doesn't already exist
+    void writePortableMarker(); ///< Updates makeToxPortable in the INI file next to the serialized settings
     void createPersonal(QString basename); ///< Write a default personal .ini settings file for a profile
 
-    void savePersonal(); ///< Asynchronous, saves the current profile
-    void savePersonal(Profile *profile); ///< Asynchronous
+    void savePersonal(); ///< Asynchronous, saves the current profile shortly, along with the changes made meanwhile
+    void savePersonal(Profile *profile); ///< Asynchronous, saves right away
 
     void loadGlobal();
     void loadPersonal();
@@ -64,20 +68,37 @@ public:
         bool read;
     };
 
+    /// A file transfer that didn't complete yet, it can be resumed after a restart
+    struct ResumableTransfer
+    {
+        QString friendPk;
+        QByteArray fileId; ///< The 32 byte id toxcore knows the file by on both ends
+        QString fileName;
+        QString filePath;
+        quint64 fileSize;
+        bool sending;
+    };
+
 
 public slots:
-    void saveGlobal(); ///< Asynchronous
-    void sync(); ///< Waits for all asynchronous operations to complete
+    void saveGlobal(); ///< Asynchronous, saves shortly, along with the changes made meanwhile
+    void sync(); ///< Waits for all asynchronous operations to complete, and writes the pending personal changes
 
 signals:
     void dhtServerListChanged();
     void smileyPackChanged();
+    void messageFormattingChanged(); ///< Emoticons or markdown were turned on or off
     void emojiFontChanged();
+    void chatMaxLinesChanged();
+    void fileTransferLimitsChanged();
 
 public:
     // Getter/setters
     const QList<DhtServer>& getDhtServerList() const;
     void setDhtServerList(const QList<DhtServer>& newDhtServerList);
+    /// By public key of the node, kept across nodes lists
+    QHash<QString, DhtNodeScore> getDhtNodeScores() const;
+    void setDhtNodeScore(const QString& userId, const DhtNodeScore& score);
 
     bool getEnableIPv6() const;
     void setEnableIPv6(bool newValue);
@@ -151,8 +172,28 @@ public:
     bool getEnableLogging() const;
     void setEnableLogging(bool newValue);
 
-    Db::syncType getDbSyncType() const;
-    void setDbSyncType(int newValue);
+    // History retention, 0 keeps everything
+    int getHistoryMaxAge() const;
+    void setHistoryMaxAge(int days);
+
+    int getHistoryMaxRows() const;
+    void setHistoryMaxRows(int rows);
+
+    // History database, changes apply the next time the profile is loaded
+    bool getHistoryWalJournal() const;
+    void setHistoryWalJournal(bool newValue);
+
+    int getHistorySyncMode() const; ///< 0 is OFF, 1 is NORMAL and 2 is FULL
+    void setHistorySyncMode(int newValue);
+
+    int getHistoryCacheSize() const; ///< In MiB
+    void setHistoryCacheSize(int newValue);
+
+    int getHistoryMmapSize() const; ///< In MiB, 0 disables memory mapped I/O
+    void setHistoryMmapSize(int newValue);
+
+    bool getHistoryMemoryTempStore() const;
+    void setHistoryMemoryTempStore(bool newValue);
 
     int getAutoAwayTime() const;
     void setAutoAwayTime(int newValue);
@@ -190,6 +231,23 @@ public:
     bool getFilterAudio() const;
     void setFilterAudio(bool newValue);
 
+    int getAudioFrameDuration() const;
+    void setAudioFrameDuration(int ms);
+
+    /// Seconds the input device stays open after the last subscriber is gone, 0 closes it right away
+    int getAudioInputKeepWarm() const;
+    void setAudioInputKeepWarm(int seconds);
+
+    /// If the audio and video threads ask the system for real-time priority, read as they start
+    bool getRealtimeThreads() const;
+    void setRealtimeThreads(bool enabled);
+
+    /// In KiB/s, 0 for no limit
+    int getFileUploadLimit() const;
+    void setFileUploadLimit(int limit);
+    int getFileFriendUploadLimit() const;
+    void setFileFriendUploadLimit(int limit);
+
     QString getVideoDev() const;
     void setVideoDev(const QString& deviceSpecifier);
 
@@ -199,6 +257,12 @@ public:
     unsigned short getCamVideoFPS() const;
     void setCamVideoFPS(unsigned short newValue);
 
+    bool getCamVideoHwAccel() const;
+    void setCamVideoHwAccel(bool newValue);
+
+    QRect getScreenRegion() const;
+    void setScreenRegion(QRect newValue);
+
     bool isAnimationEnabled() const;
     void setAnimationEnabled(bool newValue);
 
@@ -217,6 +281,10 @@ public:
     int getEmojiFontPointSize() const;
     void setEmojiFontPointSize(int value);
 
+    /// The number of lines kept by each chat log, the oldest are reloaded from history when needed. 0 for no limit.
+    int getChatMaxLines() const;
+    void setChatMaxLines(int value);
+
     QString getContactNote(const ToxId& id) const;
     void setContactNote(const ToxId& id, const QString& note);
 
@@ -233,10 +301,10 @@ public:
     int getSecondColumnHandlePosFromRight() const;
     void setSecondColumnHandlePosFromRight(const int pos);
 
-    const QString& getTimestampFormat() const;
+    QString getTimestampFormat() const;
     void setTimestampFormat(const QString& format);
 
-    const QString& getDateFormat() const;
+    QString getDateFormat() const;
     void setDateFormat(const QString& format);
 
     bool isMinimizeOnCloseEnabled() const;
@@ -280,6 +348,13 @@ public:
     QDate getFriendActivity(const ToxId &id) const;
     void setFriendActivity(const ToxId &id, const QDate &date);
 
+    // Per-friend history retention, falls back to the global one if set to -1
+    int getFriendHistoryMaxAge(const ToxId &id) const;
+    void setFriendHistoryMaxAge(const ToxId &id, int days);
+
+    int getFriendHistoryMaxRows(const ToxId &id) const;
+    void setFriendHistoryMaxRows(const ToxId &id, int rows);
+
     void removeFriendSettings(const ToxId &id);
 
     bool getFauxOfflineMessaging() const;
@@ -297,6 +372,11 @@ public:
     bool getGroupchatPosition() const;
     void setGroupchatPosition(bool value);
 
+    /// Paint friends through a model/view list instead of one laid out widget each.
+    /// Read once when the friend list is created, takes effect after a restart.
+    bool getVirtualFriendList() const;
+    void setVirtualFriendList(bool value);
+
     bool getAutoLogin() const;
     void setAutoLogin(bool state);
 
@@ -316,6 +396,15 @@ public:
     void removeFriendRequest(int index);
     void readFriendRequest(int index);
 
+    QList<ResumableTransfer> getResumableTransfers() const;
+    void addResumableTransfer(const ResumableTransfer& transfer);
+    bool removeResumableTransfer(const QByteArray& fileId);
+
+    /// Index of the tox hashes of the cached avatars, so they don't have to be loaded to be compared
+    QByteArray getAvatarHash(const QString& ownerId) const;
+    void setAvatarHash(const QString& ownerId, const QByteArray& hash);
+    void removeAvatarHash(const QString& ownerId);
+
     // Assume all widgets have unique names
     // Don't use it to save every single thing you want to save, use it
     // for some general purpose widgets, such as MainWindows or Splitters,
@@ -348,6 +437,9 @@ private:
 
 private slots:
     void savePersonal(QString profileName, QString password);
+    void savePersonalLater();
+    void flushPersonal();
+    void writeGlobal(); ///< Writes the global settings now
 
 private:
     bool loaded;
@@ -355,12 +447,14 @@ private:
     bool useCustomDhtList;
     QList<DhtServer> dhtServerList;
     int dhtServerId;
+    QHash<QString, DhtNodeScore> dhtNodeScores;
     bool dontShowDhtDialog;
 
     bool autoLogin;
     bool fauxOfflineMessaging;
     bool compactLayout;
     bool groupchatPosition;
+    bool virtualFriendList;
     bool separateWindow;
     bool dontGroupWindows;
     bool enableIPv6;
@@ -370,7 +464,9 @@ private:
     bool closeToTray;
     bool minimizeToTray;
     bool lightTrayIcon;
-    bool useEmoticons;
+    // The settings read on hot paths, like for every message or audio frame, don't take the bigLock:
+    // the scalars are atomics, the strings are swapped whole with std::atomic_load/atomic_store
+    std::atomic_bool useEmoticons;
     bool checkUpdates;
     bool showWindow;
     bool showInFront;
@@ -394,6 +490,8 @@ private:
     QString toxmePass;
 
     bool enableLogging;
+    int historyMaxAge;
+    int historyMaxRows;
 
     int autoAwayTime;
 
@@ -403,10 +501,13 @@ private:
     QString globalAutoAcceptDir;
 
     QList<Request> friendRequests;
+    QList<ResumableTransfer> resumableTransfers;
+    QHash<QString, QByteArray> avatarHashes;
 
     // GUI
     QString smileyPack;
     int emojiFontPointSize;
+    int chatMaxLines;
     bool minimizeOnClose;
     QByteArray windowGeometry;
     QByteArray windowState;
@@ -418,28 +519,43 @@ private:
     bool showSystemTray;
 
     // ChatView
-    MarkdownType markdownPreference;
+    std::atomic<MarkdownType> markdownPreference;
     int firstColumnHandlePos;
     int secondColumnHandlePosFromRight;
-    QString timestampFormat;
-    QString dateFormat;
-    bool statusChangeNotificationEnabled;
+    std::shared_ptr<const QString> timestampFormat;
+    std::shared_ptr<const QString> dateFormat;
+    std::atomic_bool statusChangeNotificationEnabled;
 
     // Privacy
     bool typingNotification;
-    Db::syncType dbSyncType;
+
+    // History database
+    bool historyWalJournal;
+    int historySyncMode;
+    int historyCacheSize;
+    int historyMmapSize;
+    bool historyMemoryTempStore;
 
     // Audio
     QString inDev;
     QString outDev;
-    qreal audioInGainDecibel;
-    int outVolume;
-    bool filterAudio;
+    std::atomic<qreal> audioInGainDecibel;
+    std::atomic_int outVolume;
+    std::atomic_bool filterAudio;
+    std::atomic_int audioFrameDuration;
+    std::atomic_int audioInputKeepWarm;
+    std::atomic_bool realtimeThreads;
+
+    // File transfers
+    int fileUploadLimit;
+    int fileFriendUploadLimit;
 
     // Video
     QString videoDev;
     QSize camVideoRes;
     unsigned short camVideoFPS;
+    bool camVideoHwAccel;
+    QRect screenRegion;
 
     struct friendProp
     {
@@ -449,6 +565,8 @@ private:
         QString note;
         int circleID = -1;
         QDate activity = QDate();
+        int historyMaxAge = -1;
+        int historyMaxRows = -1;
     };
 
     struct circleProp
@@ -457,15 +575,21 @@ private:
         bool expanded;
     };
 
-    QHash<QString, friendProp> friendLst;
+    QHash<ToxPk, friendProp> friendLst;
 
     QVector<circleProp> circleLst;
 
     int themeColor;
 
+    QTimer* personalSaveTimer; ///< Only used from the settings thread
+    bool personalDirty; ///< True if the personal settings changed since we last wrote them
+    QTimer* globalSaveTimer; ///< Only used from the settings thread
+    bool globalDirty; ///< True if the global settings changed since we last wrote them
+
     static QMutex bigLock;
     static Settings* settings;
-    static const QString globalSettingsFile;
+    static const QString globalSettingsFile; ///< INI, for older versions and the updater, and the portable marker
+    static const QString serializedGlobalSettingsFile; ///< What we load the global settings from
     static QThread* settingsThread;
 };
 
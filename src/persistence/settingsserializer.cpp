@@ -19,8 +19,7 @@
 
 #include "settingsserializer.h"
 #include "serialize.h"
-#include "src/nexus.h"
-#include "src/persistence/profile.h"
+#include "src/persistence/passkeycache.h"
 #include "src/core/core.h"
 #include <QSaveFile>
 #include <QFile>
@@ -159,10 +158,20 @@ void SettingsSerializer::setValue(const QString &key, const QVariant &value)
         Value nv{group, array, arrayIndex, key, value};
         if (array >= 0)
             arrays[array].values.append(values.size());
+        valueIndex.insert(keyOf(nv), values.size());
         values.append(nv);
     }
 }
 
+QStringList SettingsSerializer::childKeys() const
+{
+    QStringList keys;
+    for (const Value& v : values)
+        if (v.group == group && v.array == -1)
+            keys.append(v.key);
+    return keys;
+}
+
 QVariant SettingsSerializer::value(const QString &key, const QVariant &defaultValue) const
 {
     const Value* v = findValue(key);
@@ -172,26 +181,49 @@ QVariant SettingsSerializer::value(const QString &key, const QVariant &defaultVa
         return defaultValue;
 }
 
-const SettingsSerializer::Value* SettingsSerializer::findValue(const QString& key) const
+uint qHash(const SettingsSerializer::ValueKey& k, uint seed)
 {
-    if (array != -1)
-    {
-        for (const Array& a : arrays)
-        {
-            if (a.group != group)
-                continue;
-            for (int vi : a.values)
-                if (values[vi].arrayIndex == arrayIndex && values[vi].key == key)
-                    return &values[vi];
-        }
-    }
-    else
+    return qHash(k.key, seed) ^ qHash(k.group, seed) ^ (qHash(k.array, seed) << 8)
+            ^ (qHash(k.arrayIndex, seed) << 16);
+}
+
+SettingsSerializer::ValueKey SettingsSerializer::currentKey(const QString& key) const
+{
+    if (array == -1)
+        return {group, -1, -1, key};
+    return {group, array, arrayIndex, key};
+}
+
+SettingsSerializer::ValueKey SettingsSerializer::keyOf(const Value& v)
+{
+    if (v.array == -1)
+        return {v.group, -1, -1, v.key};
+    return {v.group, v.array, v.arrayIndex, v.key};
+}
+
+/**
+ * @brief Rebuilds the index after values were moved around
+ *
+ * Like the linear scans it replaces, the first of duplicate values wins.
+ */
+void SettingsSerializer::rebuildValueIndex()
+{
+    valueIndex.clear();
+    valueIndex.reserve(values.size());
+    for (int i=0; i<values.size(); i++)
     {
-        for (const Value& v : values)
-            if (v.group == group && v.array == -1 && v.key == key)
-                return &v;
+        ValueKey k = keyOf(values[i]);
+        if (!valueIndex.contains(k))
+            valueIndex.insert(k, i);
     }
-    return nullptr;
+}
+
+const SettingsSerializer::Value* SettingsSerializer::findValue(const QString& key) const
+{
+    auto it = valueIndex.constFind(currentKey(key));
+    if (it == valueIndex.constEnd())
+        return nullptr;
+    return &values[it.value()];
 }
 
 SettingsSerializer::Value* SettingsSerializer::findValue(const QString& key)
@@ -227,7 +259,27 @@ void SettingsSerializer::save()
         return;
     }
 
+    // Bucket the arrays and values by group in one pass, instead of rescanning them for each group.
+    // Index 0 holds what isn't in any group.
+    QVector<QVector<int>> groupArrays(groups.size() + 1), groupValues(groups.size() + 1);
+    int estimatedSize = 4 + TOX_PASS_ENCRYPTION_EXTRA_LENGTH;
+    for (int ai=0; ai<arrays.size(); ai++)
+    {
+        const Array& a = arrays[ai];
+        if (a.size > 0)
+            groupArrays[a.group + 1].append(ai);
+    }
+    for (int vi=0; vi<values.size(); vi++)
+    {
+        const Value& v = values[vi];
+        // Keys and small values, plus the tag, lengths and array index
+        estimatedSize += 2 * v.key.size() + 16;
+        if (v.array == -1)
+            groupValues[v.group + 1].append(vi);
+    }
+
     QByteArray data(magic, 4);
+    data.reserve(estimatedSize);
     QDataStream stream(&data, QIODevice::ReadWrite | QIODevice::Append);
     stream.setVersion(QDataStream::Qt_5_0);
 
@@ -241,12 +293,9 @@ void SettingsSerializer::save()
         }
 
         // Save all the arrays of this group
-        for (const Array& a : arrays)
+        for (int ai : groupArrays[g + 1])
         {
-            if (a.group != g)
-                continue;
-            if (a.size <= 0)
-                continue;
+            const Array& a = arrays[ai];
             writeStream(stream, RecordTag::ArrayStart);
             writeStream(stream, a.name.toUtf8());
             writeStream(stream, vuintToData(a.size));
@@ -262,10 +311,9 @@ void SettingsSerializer::save()
         }
 
         // Save all the values of this group that aren't in an array
-        for (const Value& v : values)
+        for (int vi : groupValues[g + 1])
         {
-            if (v.group != g || v.array != -1)
-                continue;
+            const Value& v = values[vi];
             writeStream(stream, RecordTag::Value);
             writeStream(stream, v.key.toUtf8());
             writePackedVariant(stream, v.value);
@@ -275,9 +323,14 @@ void SettingsSerializer::save()
     // Encrypt
     if (!password.isEmpty())
     {
-        Core* core = Nexus::getCore();
-        auto passkey = core->createPasskey(password);
-        data = core->encryptData(data, *passkey);
+        auto passkey = PasskeyCache::getEncryptionKey(password);
+        if (!passkey)
+        {
+            qCritical() << "Failed to derive a key, can't save!";
+            f.cancelWriting();
+            return;
+        }
+        data = Core::encryptData(data, *passkey);
     }
 
     f.write(data);
@@ -314,13 +367,8 @@ void SettingsSerializer::readSerialized()
             return;
         }
 
-        Core* core = Nexus::getCore();
-
-        uint8_t salt[TOX_PASS_SALT_LENGTH];
-        tox_get_salt(reinterpret_cast<uint8_t *>(data.data()), salt);
-        auto passkey = core->createPasskey(password, salt);
-
-        data = core->decryptData(data, *passkey);
+        auto passkey = PasskeyCache::getDecryptionKey(password, data);
+        data = passkey ? Core::decryptData(data, *passkey) : QByteArray();
         if (data.isEmpty())
         {
             qCritical() << "Failed to decrypt the settings file";
@@ -510,8 +558,9 @@ void SettingsSerializer::readIni()
             if (!groups[g].startsWith(arrayPrefix))
                 continue;
             bool ok;
+            // QSettings numbers the array elements from 1
             quint64 groupArrayIndex = groups[g].mid(arrayPrefix.size()).toInt(&ok);
-            if (!ok)
+            if (!ok || groupArrayIndex == 0)
                 continue;
             groupsToKill.append(g);
             //qDebug() << "Found element"<<groupArrayIndex<<"of array"<<a.name;
@@ -528,7 +577,7 @@ void SettingsSerializer::readIni()
                 groupSizes[g]--;
                 v.group = a.group;
                 v.array = ai;
-                v.arrayIndex = groupArrayIndex;
+                v.arrayIndex = groupArrayIndex - 1;
                 a.values.append(vi);
                 //qDebug() << "Found key"<<v.key<<"at index"<<groupArrayIndex<<"of array"<<a.name;
             }
@@ -545,6 +594,9 @@ void SettingsSerializer::readIni()
         removeGroup(g);
     }
 
+    // The arrays took over values, and removing keys and groups moved the others
+    rebuildValueIndex();
+
     group = array = -1;
 }
 
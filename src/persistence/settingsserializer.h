@@ -22,7 +22,9 @@
 
 #include <QSettings>
 #include <QVector>
+#include <QHash>
 #include <QString>
+#include <QStringList>
 #include <QDataStream>
 
 /// Serializes a QSettings's data in an (optionally) encrypted binary format
@@ -51,6 +53,7 @@ public:
 
     void setValue(const QString &key, const QVariant &value);
     QVariant value(const QString &key, const QVariant &defaultValue = QVariant()) const;
+    QStringList childKeys() const; ///< The keys of the current group, outside of arrays
 
 private:
     enum class RecordTag : uint8_t
@@ -80,6 +83,21 @@ private:
         QVariant value;
     };
 
+    /// Where a value lives, array values are identified by their array and index
+    struct ValueKey
+    {
+        qint64 group;
+        qint64 array, arrayIndex; ///< Both -1 outside of arrays
+        QString key;
+
+        bool operator==(const ValueKey& other) const
+        {
+            return group == other.group && array == other.array
+                    && arrayIndex == other.arrayIndex && key == other.key;
+        }
+    };
+    friend uint qHash(const ValueKey& k, uint seed);
+
     struct Array
     {
         qint64 group;
@@ -91,6 +109,9 @@ private:
 private:
     const Value *findValue(const QString& key) const;
     Value *findValue(const QString& key);
+    ValueKey currentKey(const QString& key) const; ///< Where key lives in the current group and array
+    static ValueKey keyOf(const Value& v);
+    void rebuildValueIndex();
     void readSerialized();
     void readIni();
     void removeValue(const QString& key);
@@ -104,6 +125,7 @@ private:
     QVector<QString> groups;
     QVector<Array> arrays;
     QVector<Value> values;
+    QHash<ValueKey, int> valueIndex; ///< Index in values of each value, so lookups don't scan them all
     static const char magic[]; ///< Little endian ASCII "QTOX" magic
 };
 
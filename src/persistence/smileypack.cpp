@@ -18,6 +18,7 @@
 */
 
 #include "smileypack.h"
+#include "src/chatlog/pixmapcache.h"
 #include "src/persistence/settings.h"
 #include "src/widget/style.h"
 
@@ -34,11 +35,124 @@
 #include <QBuffer>
 #include <QStringBuilder>
 #include <QtConcurrent/QtConcurrentRun>
+#include <QGuiApplication>
+#include <QDebug>
+#include <QResource>
+
+namespace
+{
+
+/// The files of the bundled packs are under this once their bundle is registered
+const QString bundleRoot = QStringLiteral(":/smileys/");
+
+/// Where the resource bundles of our packs are installed, next to the binary when it's built
+QStringList bundleDirs()
+{
+    const QString appDir = QCoreApplication::applicationDirPath();
+    return {appDir + "/smileys", appDir + "/../share/qtox/smileys",
+            appDir + "/../Resources/smileys", "/usr/share/qtox/smileys"};
+}
+
+QString findBundle(const QString& pack)
+{
+    for (const QString& dir : bundleDirs())
+    {
+        const QString bundle = dir + '/' + pack + ".rcc";
+        if (QFileInfo::exists(bundle))
+            return QFileInfo(bundle).canonicalFilePath();
+    }
+
+    return QString();
+}
+
+/// Returns the pack whose bundle has this file, like "Universe" for ":/smileys/Universe/emoticons.xml"
+QString bundledPack(const QString& filename)
+{
+    if (!filename.startsWith(bundleRoot))
+        return QString();
+
+    return filename.mid(bundleRoot.size()).section('/', 0, 0);
+}
+
+}
+
+EmoticonMatcher::EmoticonMatcher()
+    : nodes(1)
+{
+}
+
+void EmoticonMatcher::insert(const QString& key)
+{
+    int node = 0;
+    for (QChar c : key)
+    {
+        int next = child(node, c.unicode());
+        if (next < 0)
+        {
+            next = nodes.size();
+            nodes[node].children.push_back({c.unicode(), next});
+            nodes.emplace_back();
+        }
+
+        node = next;
+    }
+
+    if (nodes[node].key < 0)
+    {
+        nodes[node].key = keys.size();
+        keys.append(key);
+    }
+}
+
+const QString* EmoticonMatcher::findWord(const QString& text, int begin, int end, bool escape) const
+{
+    int node = 0;
+    for (int i = begin; i < end && node >= 0; ++i)
+    {
+        const char* escapedChar = nullptr;
+        if (escape)
+        {
+            switch (text[i].unicode())
+            {
+            case '<': escapedChar = "&lt;"; break;
+            case '>': escapedChar = "&gt;"; break;
+            case '&': escapedChar = "&amp;"; break;
+            case '"': escapedChar = "&quot;"; break;
+            default: break;
+            }
+        }
+
+        if (!escapedChar)
+        {
+            node = child(node, text[i].unicode());
+            continue;
+        }
+
+        for (; *escapedChar && node >= 0; ++escapedChar)
+            node = child(node, static_cast<ushort>(*escapedChar));
+    }
+
+    if (node < 0 || nodes[node].key < 0)
+        return nullptr;
+
+    return &keys[nodes[node].key];
+}
+
+int EmoticonMatcher::child(int node, ushort c) const
+{
+    for (const std::pair<ushort, int>& child : nodes[node].children)
+    {
+        if (child.first == c)
+            return child.second;
+    }
+
+    return -1;
+}
 
 SmileyPack::SmileyPack()
 {
-    loadingMutex.lock();
-    QtConcurrent::run(this, &SmileyPack::load, Settings::getInstance().getSmileyPack());
+    QtConcurrent::run(this, &SmileyPack::load, Settings::getInstance().getSmileyPack(), 0,
+                      qApp->devicePixelRatio());
     connect(&Settings::getInstance(), &Settings::smileyPackChanged, this, &SmileyPack::onSmileyPackChanged);
 }
 
@@ -52,6 +166,17 @@ QList<QPair<QString, QString> > SmileyPack::listSmileyPacks(const QStringList &p
 {
     QList<QPair<QString, QString> > smileyPacks;
 
+    for (const QString& dir : bundleDirs())
+    {
+        for (const QFileInfo& bundle : QDir(dir).entryInfoList(QStringList() << "*.rcc", QDir::Files))
+        {
+            const QPair<QString, QString> pack{bundle.completeBaseName(),
+                                               bundleRoot + bundle.completeBaseName() + "/emoticons.xml"};
+            if (!smileyPacks.contains(pack))
+                smileyPacks << pack;
+        }
+    }
+
     for (QString path : paths)
     {
         if (path.leftRef(1) == "~")
@@ -89,22 +214,79 @@ QList<QPair<QString, QString> > SmileyPack::listSmileyPacks(const QStringList &p
 
 bool SmileyPack::isValid(const QString &filename)
 {
+    const QString pack = bundledPack(filename);
+    if (!pack.isEmpty())
+        return !findBundle(pack).isEmpty();
+
     return QFile(filename).exists();
 }
 
-bool SmileyPack::load(const QString& filename)
+/**
+ * @brief Registers the resource bundle of a pack we ship, Qt maps it instead of reading it.
+ * @param usedBundles The bundles the pack being loaded needs, the bundle is added to them.
+ * @return False if the pack has no bundle, or it can't be registered.
+ */
+bool SmileyPack::registerBundle(const QString& pack, QStringList& usedBundles)
 {
-    // discard old data
-    filenameTable.clear();
-    iconCache.clear();
-    emoticons.clear();
-    path.clear();
+    const QString bundle = findBundle(pack);
+    if (bundle.isEmpty())
+    {
+        qWarning() << "There's no resource bundle for the smiley pack" << pack;
+        return false;
+    }
+
+    if (usedBundles.contains(bundle))
+        return true;
+
+    QMutexLocker locker(&bundleMutex);
+    if (!bundles.contains(bundle))
+    {
+        if (!QResource::registerResource(bundle))
+        {
+            qWarning() << "Can't register the smiley bundle" << bundle;
+            return false;
+        }
+        bundles << bundle;
+    }
+
+    usedBundles << bundle;
+    return true;
+}
+
+/**
+ * @brief Unmaps the bundles of the previous packs, once the current one was published.
+ */
+void SmileyPack::releaseBundles(const QStringList& keep)
+{
+    QMutexLocker locker(&bundleMutex);
+    for (auto it = bundles.begin(); it != bundles.end();)
+    {
+        if (keep.contains(*it))
+        {
+            ++it;
+            continue;
+        }
+
+        QResource::unregisterResource(*it);
+        it = bundles.erase(it);
+    }
+}
+
+bool SmileyPack::load(const QString& filename, int generation, qreal ratio)
+{
+    // the packs we ship are in resource bundles, only those of the current pack stay mapped
+    QStringList usedBundles;
+    const QString pack = bundledPack(filename);
+    if (!pack.isEmpty())
+        registerBundle(pack, usedBundles);
 
     // open emoticons.xml
     QFile xmlFile(filename);
     if (!xmlFile.open(QIODevice::ReadOnly))
     {
-        loadingMutex.unlock();
+        // discard old data
+        publish(generation, QString(), QHash<QString, QString>(), QList<QStringList>(),
+                std::shared_ptr<const EmoticonMatcher>(), QStringList());
         return false; // cannot open file
     }
 
@@ -123,7 +305,12 @@ bool SmileyPack::load(const QString& filename)
      * </messaging-emoticon-map>
      */
 
-    path = QFileInfo(filename).absolutePath();
+    // Nothing is locked while parsing, the icons are only decoded once they're used
+    QString newPath = QFileInfo(filename).absolutePath();
+    QHash<QString, QString> newFilenameTable;
+    QList<QStringList> newEmoticons;
+    QHash<QString, bool> fileExists;
+    std::shared_ptr<EmoticonMatcher> newMatcher = std::make_shared<EmoticonMatcher>();
 
     QDomDocument doc;
     doc.setContent(xmlFile.readAll());
@@ -134,17 +321,26 @@ bool SmileyPack::load(const QString& filename)
         QString file = emoticonElements.at(i).attributes().namedItem("file").nodeValue();
         QDomElement stringElement = emoticonElements.at(i).firstChildElement("string");
 
+        if (!fileExists.contains(file))
+        {
+            // a pack can use the images of another one, like ASCII+Universe
+            const QString otherPack = bundledPack(QDir::cleanPath(QDir(newPath).filePath(file)));
+            if (!otherPack.isEmpty())
+                registerBundle(otherPack, usedBundles);
+
+            fileExists.insert(file, QFileInfo::exists(QDir(newPath).filePath(file)));
+        }
+
         QStringList emoticonSet; // { ":)", ":-)" } etc.
 
         while (!stringElement.isNull())
         {
             QString emoticon = stringElement.text()
                                 .replace("<","&lt;").replace(">","&gt;");
-            filenameTable.insert(emoticon, file);
+            newFilenameTable.insert(emoticon, file);
+            newMatcher->insert(emoticon);
 
-            cacheSmiley(file); // preload all smileys
-
-            if (!getCachedSmiley(emoticon).isNull())
+            if (fileExists.value(file))
                 emoticonSet.push_back(emoticon);
 
             stringElement = stringElement.nextSibling().toElement();
@@ -152,37 +348,83 @@ bool SmileyPack::load(const QString& filename)
         }
 
         if (emoticonSet.size() > 0)
-            emoticons.push_back(emoticonSet);
+            newEmoticons.push_back(emoticonSet);
+    }
+
+    if (!publish(generation, newPath, newFilenameTable, newEmoticons, newMatcher, usedBundles))
+        return false; // a newer pack was selected meanwhile
+
+    QStringList files;
+    for (auto it = fileExists.constBegin(); it != fileExists.constEnd(); ++it)
+    {
+        if (it.value())
+            files << QDir(newPath).filePath(it.key());
     }
 
-    // success!
-    loadingMutex.unlock();
+    // so the chats and the emoticons widget don't have to render them when first shown
+    renderSmileys(files, Settings::getInstance().getEmojiFontPointSize(), ratio);
     return true;
 }
 
-QString SmileyPack::smileyfied(QString msg)
+/**
+ * @brief Replaces the current pack with a loaded one, unless a newer load was started.
+ * @return False if the pack was outdated and discarded.
+ */
+bool SmileyPack::publish(int generation, const QString& newPath, const QHash<QString, QString>& newFilenameTable,
+                         const QList<QStringList>& newEmoticons, std::shared_ptr<const EmoticonMatcher> newMatcher,
+                         const QStringList& newBundles)
 {
     QMutexLocker locker(&loadingMutex);
+    if (generation != loadGeneration)
+        return false; // the newest load releases our bundles
 
-    QRegExp exp("\\S+"); // matches words
+    path = newPath;
+    filenameTable = newFilenameTable;
+    emoticons = newEmoticons;
+    iconCache.clear();
+    std::atomic_store(&matcher, newMatcher);
+    releaseBundles(newBundles);
+    return true;
+}
 
-    int index = msg.indexOf(exp);
+QString SmileyPack::smileyfied(const QString& msg)
+{
+    std::shared_ptr<const EmoticonMatcher> currentMatcher = getMatcher();
+    if (!currentMatcher)
+        return msg;
+
+    QString out;
+    out.reserve(msg.size() * 2);
 
     // if a word is key of a smiley, replace it by its corresponding image in Rich Text
-    while (index >= 0)
+    int pos = 0;
+    while (pos < msg.size())
     {
-        QString key = exp.cap();
-        if (filenameTable.contains(key))
+        if (msg[pos].isSpace())
         {
-            QString imgRichText = getAsRichText(key);
-
-            msg.replace(index, key.length(), imgRichText);
-            index += imgRichText.length() - key.length();
+            out += msg[pos++];
+            continue;
         }
-        index = msg.indexOf(exp, index + key.length());
+
+        int wordEnd = pos;
+        while (wordEnd < msg.size() && !msg[wordEnd].isSpace())
+            ++wordEnd;
+
+        const QString* key = currentMatcher->findWord(msg, pos, wordEnd, false);
+        if (key)
+            out += getAsRichText(*key);
+        else
+            out += msg.midRef(pos, wordEnd - pos);
+
+        pos = wordEnd;
     }
 
-    return msg;
+    return out;
+}
+
+std::shared_ptr<const EmoticonMatcher> SmileyPack::getMatcher() const
+{
+    return std::atomic_load(&matcher);
 }
 
 QList<QStringList> SmileyPack::getEmoticons() const
@@ -196,6 +438,20 @@ QString SmileyPack::getAsRichText(const QString &key)
     return QString("<img title=\"%1\" src=\"key:%1\"\\>").arg(key);
 }
 
+QPixmap SmileyPack::getAsPixmap(const QString& key, QSize size)
+{
+    QString file;
+    {
+        QMutexLocker locker(&loadingMutex);
+        if (!filenameTable.contains(key))
+            return QPixmap();
+
+        file = QDir(path).filePath(filenameTable.value(key));
+    }
+
+    return PixmapCache::getInstance().get(file, size);
+}
+
 QIcon SmileyPack::getAsIcon(const QString &key)
 {
     QMutexLocker locker(&loadingMutex);
@@ -225,8 +481,38 @@ QIcon SmileyPack::getCachedSmiley(const QString &key)
     return iconCache.value(file);
 }
 
+void SmileyPack::renderSmileys(const QStringList& files, int size, qreal ratio)
+{
+    QList<QPair<QString, QImage>> images;
+    for (const QString& file : files)
+        images.append({file, PixmapCache::render(file, QSize(size, size), ratio)});
+
+    {
+        QMutexLocker locker(&renderedMutex);
+        renderedSize = QSize(size, size);
+        rendered = images;
+    }
+
+    QMetaObject::invokeMethod(this, "onSmileysRendered", Qt::QueuedConnection);
+}
+
+void SmileyPack::onSmileysRendered()
+{
+    QMutexLocker locker(&renderedMutex);
+    for (const QPair<QString, QImage>& image : rendered)
+        PixmapCache::getInstance().insert(image.first, renderedSize, image.second);
+
+    rendered.clear();
+}
+
 void SmileyPack::onSmileyPackChanged()
 {
-    loadingMutex.lock();
-    QtConcurrent::run(this, &SmileyPack::load, Settings::getInstance().getSmileyPack());
+    int generation;
+    {
+        QMutexLocker locker(&loadingMutex);
+        generation = ++loadGeneration;
+    }
+
+    QtConcurrent::run(this, &SmileyPack::load, Settings::getInstance().getSmileyPack(), generation,
+                      qApp->devicePixelRatio());
 }
@@ -26,35 +26,75 @@
 #include <QStringList>
 #include <QIcon>
 #include <QMutex>
+#include <memory>
+#include <vector>
 
 #define SMILEYPACK_SEARCH_PATHS                                                                                             \
     {                                                                                                                       \
         ":/smileys", "./smileys", "/usr/share/qtox/smileys", "/usr/share/emoticons", "~/.kde4/share/emoticons", "~/.kde/share/emoticons" \
     }
 
+/// A trie of the emoticons of a smiley pack. It is built once by SmileyPack::load and never
+/// modified afterwards, so it can be shared between threads without locking.
+class EmoticonMatcher
+{
+public:
+    EmoticonMatcher();
+
+    /// Adds an emoticon, escaped like the keys of SmileyPack
+    void insert(const QString& key);
+    /// Returns the emoticon spelled by text[begin, end), or nullptr.
+    /// Pass escape if the text still needs to be html escaped, as the emoticons are.
+    const QString* findWord(const QString& text, int begin, int end, bool escape) const;
+
+private:
+    struct Node
+    {
+        std::vector<std::pair<ushort, int>> children; ///< Character and index of the child node
+        int key = -1; ///< Index of the emoticon ending here, if any
+    };
+
+    int child(int node, ushort c) const;
+
+    std::vector<Node> nodes;
+    QStringList keys;
+};
+
 //maps emoticons to smileys
 class SmileyPack : public QObject
 {
     Q_OBJECT
 public:
     static SmileyPack& getInstance();
+    /// Also lists the packs we ship as resource bundles, they're only registered once loaded
     static QList<QPair<QString, QString> > listSmileyPacks(const QStringList& paths = SMILEYPACK_SEARCH_PATHS);
     static bool isValid(const QString& filename);
 
-    QString smileyfied(QString msg);
+    QString smileyfied(const QString& msg);
+    /// Returns the emoticons of the current pack, never blocks
+    std::shared_ptr<const EmoticonMatcher> getMatcher() const;
     QList<QStringList> getEmoticons() const;
-    QString getAsRichText(const QString& key);
+    static QString getAsRichText(const QString& key);
     QIcon getAsIcon(const QString& key);
+    /// Returns the smiley at the given size, rendered at most once per size
+    QPixmap getAsPixmap(const QString& key, QSize size);
 
 private slots:
     void onSmileyPackChanged();
+    void onSmileysRendered();
 
 private:
     SmileyPack();
     SmileyPack(SmileyPack&) = delete;
     SmileyPack& operator=(const SmileyPack&) = delete;
 
-    bool load(const QString& filename); ///< The caller must lock loadingMutex and should run it in a thread
+    bool load(const QString& filename, int generation, qreal ratio); ///< Should run in a thread, only locks to publish the pack
+    bool publish(int generation, const QString& newPath, const QHash<QString, QString>& newFilenameTable,
+                 const QList<QStringList>& newEmoticons, std::shared_ptr<const EmoticonMatcher> newMatcher,
+                 const QStringList& newBundles);
+    bool registerBundle(const QString& pack, QStringList& usedBundles);
+    void releaseBundles(const QStringList& keep);
+    void renderSmileys(const QStringList& files, int size, qreal ratio);
     void cacheSmiley(const QString& name);
     QIcon getCachedSmiley(const QString& key);
 
@@ -62,7 +102,16 @@ private:
     QHash<QString, QIcon> iconCache; // representation of a smiley ie. "happy.png" -> data
     QList<QStringList> emoticons; // {{ ":)", ":-)" }, {":(", ...}, ... }
     QString path; // directory containing the cfg and image files
+    std::shared_ptr<const EmoticonMatcher> matcher; // only accessed atomically
     mutable QMutex loadingMutex;
+    int loadGeneration = 0; // of the last load started, older loads are discarded
+    QStringList bundles; // the registered resource bundles, of the current pack and the loads after it
+    QMutex bundleMutex;
+
+    // smileys rendered ahead of time by load, at the emoji size, for onSmileysRendered
+    QSize renderedSize;
+    QList<QPair<QString, QImage>> rendered;
+    QMutex renderedMutex;
 };
 
 #endif // SMILEYPACK_H
@@ -22,8 +22,11 @@
 #include <QString>
 #include <QVector>
 #include <QPair>
+#include <memory>
 #include "src/video/videomode.h"
 
+struct AVFrame;
+
 #ifndef Q_OS_MACX
 #error "This file is only meant to be compiled for Mac OS X targets"
 #endif
@@ -34,6 +37,33 @@ namespace avfoundation
 
     QVector<VideoMode> getDeviceModes(QString devName);
     QVector<QPair<QString, QString>> getDeviceList();
+
+    /// Captures a camera with an AVCaptureSession, without libavdevice or a decoder.
+    /// The camera gives us NV12 CVPixelBuffers backed by IOSurfaces, the frames point straight
+    /// into them and keep them alive, so renderers can draw the surfaces without any copy.
+    class Capture
+    {
+    public:
+        ~Capture();
+
+        /// Returns nullptr if the device can't be opened, a null mode keeps the device's format
+        static Capture* open(const QString& devName, const VideoMode& mode);
+
+        /// Switches the device to another format without stopping the session
+        bool setMode(const VideoMode& mode);
+        /// Waits for the next frame, returns nullptr on timeout or error
+        /// pixelBuffer gets the CVPixelBufferRef the frame points into
+        AVFrame* grabFrame(std::shared_ptr<void>& pixelBuffer);
+
+        struct Session; ///< Internal, also seen by the sample buffer delegate
+
+    private:
+        explicit Capture(Session* session);
+        Capture(const Capture&) = delete;
+        Capture& operator=(const Capture&) = delete;
+
+        Session* session;
+    };
 }
 
 #endif // AVFOUNDATION_H
@@ -19,9 +19,302 @@
  */
 
 #include "avfoundation.h"
+#include <QDebug>
+#include <QMutex>
 #include <QObject>
+#include <QWaitCondition>
+
+extern "C" {
+#include <libavutil/buffer.h>
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+}
 
 #import <AVFoundation/AVFoundation.h>
+#import <CoreVideo/CoreVideo.h>
+
+/// Everything the capture session needs, the delegate only sees it through a plain pointer
+struct avfoundation::Capture::Session
+{
+    AVCaptureSession* captureSession = nil;
+    AVCaptureDevice* device = nil;
+    AVCaptureDeviceInput* input = nil;
+    AVCaptureVideoDataOutput* output = nil;
+    id delegate = nil;
+    dispatch_queue_t queue = nullptr;
+
+    QMutex lock;
+    QWaitCondition frameArrived; ///< Woken with the lock when latest is set
+    CVPixelBufferRef latest = nullptr; ///< Retained, the newest buffer grabFrame didn't take yet
+};
+
+/// Keeps the newest buffer of the camera, grabFrame takes it from there
+@interface QToxCaptureDelegate : NSObject <AVCaptureVideoDataOutputSampleBufferDelegate>
+{
+    avfoundation::Capture::Session* session;
+}
+- (id)initWithSession:(avfoundation::Capture::Session*)captureSession;
+@end
+
+@implementation QToxCaptureDelegate
+
+- (id)initWithSession:(avfoundation::Capture::Session*)captureSession
+{
+    if ((self = [super init]))
+        session = captureSession;
+    return self;
+}
+
+- (void)captureOutput:(AVCaptureOutput*)captureOutput
+    didOutputSampleBuffer:(CMSampleBufferRef)sampleBuffer
+           fromConnection:(AVCaptureConnection*)connection
+{
+    Q_UNUSED(captureOutput);
+    Q_UNUSED(connection);
+
+    CVImageBufferRef image = CMSampleBufferGetImageBuffer(sampleBuffer);
+    if (!image)
+        return;
+
+    CVPixelBufferRetain(image);
+    CVPixelBufferRef dropped;
+    {
+        QMutexLocker locker(&session->lock);
+        // a stream thread that's behind only gets the latest image
+        dropped = session->latest;
+        session->latest = image;
+        session->frameArrived.wakeOne();
+    }
+
+    if (dropped)
+        CVPixelBufferRelease(dropped);
+}
+
+@end
+
+namespace
+{
+
+/// Finds the format and frame rate of the device closest to the mode, returns false if none has its size
+bool findFormat(AVCaptureDevice* device, const VideoMode& mode, AVCaptureDeviceFormat*& bestFormat, float& bestFps)
+{
+    bestFormat = nil;
+    bestFps = 0;
+    for (AVCaptureDeviceFormat* format in [device formats])
+    {
+        CMFormatDescriptionRef formatDescription;
+        formatDescription = (CMFormatDescriptionRef)[format performSelector:@selector(formatDescription)];
+        CMVideoDimensions dimensions = CMVideoFormatDescriptionGetDimensions(formatDescription);
+        if (dimensions.width != mode.width || dimensions.height != mode.height)
+            continue;
+
+        for (AVFrameRateRange* range in format.videoSupportedFrameRateRanges)
+        {
+            float fps = qMin(static_cast<float>(range.maxFrameRate), mode.FPS);
+            if (fps < range.minFrameRate)
+                continue;
+
+            if (!bestFormat || fps > bestFps)
+            {
+                bestFormat = format;
+                bestFps = fps;
+            }
+        }
+    }
+
+    return bestFormat != nil;
+}
+
+/// Applies the mode to the device, the caller has begun the configuration of the session
+bool applyMode(AVCaptureDevice* device, const VideoMode& mode)
+{
+    if (!mode)
+        return true;
+
+    AVCaptureDeviceFormat* format;
+    float fps;
+    if (!findFormat(device, mode, format, fps))
+    {
+        qWarning() << "The camera has no" << mode.width << "x" << mode.height << "format";
+        return false;
+    }
+
+    NSError* error = nil;
+    if (![device lockForConfiguration:&error])
+    {
+        qWarning() << "Can't configure the camera:" << QString::fromNSString([error localizedDescription]);
+        return false;
+    }
+
+    [device setActiveFormat:format];
+    // the frame duration of the device itself only exists from 10.9
+    if (fps > 0 && [device respondsToSelector:@selector(setActiveVideoMinFrameDuration:)])
+        [device setActiveVideoMinFrameDuration:CMTimeMake(1000, static_cast<int32_t>(fps * 1000))];
+    [device unlockForConfiguration];
+    return true;
+}
+
+/// Gives the pixel buffer back once the last reference to the frame is gone
+void releasePixelBuffer(void* opaque, uint8_t*)
+{
+    CVPixelBufferRef buffer = static_cast<CVPixelBufferRef>(opaque);
+    CVPixelBufferUnlockBaseAddress(buffer, kCVPixelBufferLock_ReadOnly);
+    CVPixelBufferRelease(buffer);
+}
+
+}
+
+avfoundation::Capture::Capture(Session* session)
+    : session{session}
+{
+}
+
+avfoundation::Capture::~Capture()
+{
+    [session->captureSession stopRunning];
+    [session->output setSampleBufferDelegate:nil queue:nullptr];
+    // the delegate may still be running a last callback
+    dispatch_sync(session->queue, ^{});
+    dispatch_release(session->queue);
+
+    [session->captureSession release];
+    [session->input release];
+    [session->output release];
+    [session->device release];
+    [session->delegate release];
+
+    if (session->latest)
+        CVPixelBufferRelease(session->latest);
+    delete session;
+}
+
+avfoundation::Capture* avfoundation::Capture::open(const QString& devName, const VideoMode& mode)
+{
+    NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+    AVCaptureDevice* device = [AVCaptureDevice deviceWithUniqueID:devName.toNSString()];
+    if (!device)
+    {
+        qWarning() << "No camera" << devName;
+        [pool drain];
+        return nullptr;
+    }
+
+    NSError* error = nil;
+    AVCaptureDeviceInput* input = [AVCaptureDeviceInput deviceInputWithDevice:device error:&error];
+    if (!input)
+    {
+        qWarning() << "Can't open the camera" << devName << QString::fromNSString([error localizedDescription]);
+        [pool drain];
+        return nullptr;
+    }
+
+    Session* session = new Session;
+    session->device = [device retain];
+    session->input = [input retain];
+    session->captureSession = [[AVCaptureSession alloc] init];
+    session->output = [[AVCaptureVideoDataOutput alloc] init];
+    session->delegate = [[QToxCaptureDelegate alloc] initWithSession:session];
+    session->queue = dispatch_queue_create("chat.tox.qtox.camera", DISPATCH_QUEUE_SERIAL);
+
+    // NV12 in IOSurfaces, what the cameras give and what the renderer and the encoder's conversion take
+    NSDictionary* settings = [NSDictionary dictionaryWithObjectsAndKeys:
+        [NSNumber numberWithUnsignedInt:kCVPixelFormatType_420YpCbCr8BiPlanarVideoRange],
+        (id)kCVPixelBufferPixelFormatTypeKey,
+        [NSDictionary dictionary], (id)kCVPixelBufferIOSurfacePropertiesKey,
+        nil];
+    [session->output setVideoSettings:settings];
+    [session->output setAlwaysDiscardsLateVideoFrames:YES];
+    [session->output setSampleBufferDelegate:session->delegate queue:session->queue];
+
+    Capture* capture = new Capture{session};
+    [session->captureSession beginConfiguration];
+    bool ok = [session->captureSession canAddInput:input] && [session->captureSession canAddOutput:session->output];
+    if (ok)
+    {
+        [session->captureSession addInput:input];
+        [session->captureSession addOutput:session->output];
+        ok = applyMode(device, mode);
+    }
+    [session->captureSession commitConfiguration];
+
+    if (!ok)
+    {
+        qWarning() << "Can't capture the camera" << devName << "natively";
+        delete capture;
+        [pool drain];
+        return nullptr;
+    }
+
+    [session->captureSession startRunning];
+    qDebug() << "Capturing" << devName << "with AVFoundation";
+    [pool drain];
+    return capture;
+}
+
+bool avfoundation::Capture::setMode(const VideoMode& mode)
+{
+    NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+    [session->captureSession beginConfiguration];
+    bool ok = applyMode(session->device, mode);
+    [session->captureSession commitConfiguration];
+    [pool drain];
+    return ok;
+}
+
+AVFrame* avfoundation::Capture::grabFrame(std::shared_ptr<void>& pixelBuffer)
+{
+    CVPixelBufferRef buffer;
+    {
+        QMutexLocker locker(&session->lock);
+        if (!session->latest)
+            session->frameArrived.wait(&session->lock, 1000);
+
+        buffer = session->latest;
+        session->latest = nullptr;
+    }
+
+    if (!buffer)
+        return nullptr;
+
+    if (CVPixelBufferGetPixelFormatType(buffer) != kCVPixelFormatType_420YpCbCr8BiPlanarVideoRange
+            || CVPixelBufferGetPlaneCount(buffer) != 2
+            || CVPixelBufferLockBaseAddress(buffer, kCVPixelBufferLock_ReadOnly) != kCVReturnSuccess)
+    {
+        CVPixelBufferRelease(buffer);
+        return nullptr;
+    }
+
+    // the frame keeps the reference we got from the delegate
+    AVFrame* frame = av_frame_alloc();
+    uint8_t* luma = static_cast<uint8_t*>(CVPixelBufferGetBaseAddressOfPlane(buffer, 0));
+    if (frame)
+        frame->buf[0] = av_buffer_create(luma, CVPixelBufferGetDataSize(buffer), releasePixelBuffer, buffer, 0);
+
+    if (!frame || !frame->buf[0])
+    {
+        av_frame_free(&frame);
+        releasePixelBuffer(buffer, nullptr);
+        return nullptr;
+    }
+
+    frame->width = static_cast<int>(CVPixelBufferGetWidth(buffer));
+    frame->height = static_cast<int>(CVPixelBufferGetHeight(buffer));
+    frame->format = AV_PIX_FMT_NV12;
+    frame->opaque = nullptr;
+    frame->data[0] = luma;
+    frame->linesize[0] = static_cast<int>(CVPixelBufferGetBytesPerRowOfPlane(buffer, 0));
+    frame->data[1] = static_cast<uint8_t*>(CVPixelBufferGetBaseAddressOfPlane(buffer, 1));
+    frame->linesize[1] = static_cast<int>(CVPixelBufferGetBytesPerRowOfPlane(buffer, 1));
+
+    // and the renderers get their own, they may hold it past the frame's release
+    CVPixelBufferRetain(buffer);
+    pixelBuffer = std::shared_ptr<void>(buffer, [](void* ref)
+    {
+        CVPixelBufferRelease(static_cast<CVPixelBufferRef>(ref));
+    });
+
+    return frame;
+}
 
 QVector<QPair<QString, QString> > avfoundation::getDeviceList()
 {
@@ -0,0 +1,599 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "mediafoundation.h"
+
+#include <mfapi.h>
+#include <mfidl.h>
+#include <mfreadwrite.h>
+#include <mferror.h>
+#include <objbase.h>
+#include <algorithm>
+#include <string>
+#include <QDebug>
+#include <QMutex>
+#include <QObject>
+#include <QWaitCondition>
+#include <atomic>
+
+extern "C" {
+#include <libavutil/buffer.h>
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+}
+
+namespace
+{
+
+const DWORD videoStream = static_cast<DWORD>(MF_SOURCE_READER_FIRST_VIDEO_STREAM);
+
+template <typename T>
+void safeRelease(T*& object)
+{
+    if (object)
+    {
+        object->Release();
+        object = nullptr;
+    }
+}
+
+/// COM and Media Foundation are reference counted, every user starts and stops them
+class MFScope
+{
+public:
+    MFScope()
+        : com{SUCCEEDED(CoInitializeEx(nullptr, COINIT_APARTMENTTHREADED))}
+        , started{SUCCEEDED(MFStartup(MF_VERSION, MFSTARTUP_LITE))}
+    {
+    }
+
+    ~MFScope()
+    {
+        if (started)
+            MFShutdown();
+        // the GUI thread already has COM in another mode, that's fine too
+        if (com)
+            CoUninitialize();
+    }
+
+    bool isStarted() const
+    {
+        return started;
+    }
+
+private:
+    bool com, started;
+};
+
+/// Prefers the subtypes that need the least work, for modes of the same size and rate
+int subtypeRank(uint32_t fourcc)
+{
+    if (fourcc == MAKEFOURCC('N', 'V', '1', '2'))
+        return 3;
+    if (fourcc == MAKEFOURCC('Y', 'U', 'Y', '2'))
+        return 2;
+    if (fourcc == MAKEFOURCC('M', 'J', 'P', 'G'))
+        return 1;
+    return 0;
+}
+
+bool readMode(IMFMediaType* type, VideoMode& mode)
+{
+    UINT32 width = 0, height = 0, num = 0, den = 0;
+    GUID subtype;
+    if (FAILED(MFGetAttributeSize(type, MF_MT_FRAME_SIZE, &width, &height))
+            || FAILED(MFGetAttributeRatio(type, MF_MT_FRAME_RATE, &num, &den))
+            || FAILED(type->GetGUID(MF_MT_SUBTYPE, &subtype)) || !den)
+        return false;
+
+    mode.width = static_cast<unsigned short>(width);
+    mode.height = static_cast<unsigned short>(height);
+    mode.FPS = static_cast<float>(num) / den;
+    mode.pixel_format = subtype.Data1;
+    return true;
+}
+
+bool enumDevices(IMFActivate**& devices, UINT32& count)
+{
+    IMFAttributes* attributes = nullptr;
+    if (FAILED(MFCreateAttributes(&attributes, 1)))
+        return false;
+
+    HRESULT hr = attributes->SetGUID(MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE, MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE_VIDCAP_GUID);
+    if (SUCCEEDED(hr))
+        hr = MFEnumDeviceSources(attributes, &devices, &count);
+    attributes->Release();
+    return SUCCEEDED(hr);
+}
+
+IMFMediaSource* createSource(const QString& link)
+{
+    IMFAttributes* attributes = nullptr;
+    if (FAILED(MFCreateAttributes(&attributes, 2)))
+        return nullptr;
+
+    IMFMediaSource* source = nullptr;
+    const std::wstring wideLink = link.toStdWString();
+    HRESULT hr = attributes->SetGUID(MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE, MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE_VIDCAP_GUID);
+    if (SUCCEEDED(hr))
+        hr = attributes->SetString(MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE_VIDCAP_SYMBOLIC_LINK, wideLink.c_str());
+    if (SUCCEEDED(hr))
+        hr = MFCreateDeviceSource(attributes, &source);
+    attributes->Release();
+
+    if (FAILED(hr))
+        qWarning() << "Can't open the Media Foundation camera" << link << QString::number(hr, 16);
+    return SUCCEEDED(hr) ? source : nullptr;
+}
+
+/// Picks the camera's native type for the mode, and asks the reader for NV12 out of it
+bool setFormat(IMFSourceReader* reader, const VideoMode& mode)
+{
+    if (mode)
+    {
+        bool found = false;
+        IMFMediaType* type = nullptr;
+        for (DWORD i = 0; !found && SUCCEEDED(reader->GetNativeMediaType(videoStream, i, &type)); ++i)
+        {
+            VideoMode native{0, 0, 0, 0};
+            found = readMode(type, native) && native.width == mode.width && native.height == mode.height
+                    && qAbs(native.FPS - mode.FPS) < 0.5f
+                    && (!mode.pixel_format || native.pixel_format == mode.pixel_format)
+                    && SUCCEEDED(reader->SetCurrentMediaType(videoStream, nullptr, type));
+            type->Release();
+        }
+
+        if (!found)
+        {
+            qWarning() << "The camera has no" << mode.width << "x" << mode.height << "at" << mode.FPS << "fps type";
+            return false;
+        }
+    }
+
+    IMFMediaType* output = nullptr;
+    HRESULT hr = MFCreateMediaType(&output);
+    if (SUCCEEDED(hr))
+        hr = output->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video);
+    if (SUCCEEDED(hr))
+        hr = output->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_NV12);
+    if (SUCCEEDED(hr))
+        hr = reader->SetCurrentMediaType(videoStream, nullptr, output);
+    safeRelease(output);
+
+    if (FAILED(hr))
+    {
+        qWarning() << "The camera can't give us NV12" << QString::number(hr, 16);
+        return false;
+    }
+
+    return true;
+}
+
+/// Ties a frame's buffer to the reader's sample, so freeing the frame gives the buffer back
+struct BufferRef
+{
+    IMFMediaBuffer* buffer;
+    IMF2DBuffer* buffer2d; ///< Set if the buffer was locked as a 2D buffer
+};
+
+void releaseBuffer(void* opaque, uint8_t*)
+{
+    BufferRef* ref = static_cast<BufferRef*>(opaque);
+    if (ref->buffer2d)
+    {
+        ref->buffer2d->Unlock2D();
+        ref->buffer2d->Release();
+    }
+    else
+    {
+        ref->buffer->Unlock();
+    }
+
+    ref->buffer->Release();
+    delete ref;
+}
+
+}
+
+/**
+ * @brief Keeps the newest sample of the source reader, and asks it for the next one right away.
+ *
+ * The source reader references us as its callback, and we reference it until stop() breaks the cycle.
+ */
+class MediaFoundation::Capture::Reader : public IMFSourceReaderCallback
+{
+public:
+    Reader() = default;
+
+    STDMETHODIMP QueryInterface(REFIID iid, void** object) override
+    {
+        if (!object)
+            return E_POINTER;
+
+        if (iid == IID_IUnknown || iid == IID_IMFSourceReaderCallback)
+        {
+            *object = static_cast<IMFSourceReaderCallback*>(this);
+            AddRef();
+            return S_OK;
+        }
+
+        *object = nullptr;
+        return E_NOINTERFACE;
+    }
+
+    STDMETHODIMP_(ULONG) AddRef() override
+    {
+        return ++refs;
+    }
+
+    STDMETHODIMP_(ULONG) Release() override
+    {
+        const ULONG left = --refs;
+        if (!left)
+            delete this;
+        return left;
+    }
+
+    STDMETHODIMP OnReadSample(HRESULT status, DWORD, DWORD flags, LONGLONG, IMFSample* sample) override
+    {
+        IMFSample* dropped = nullptr;
+        {
+            QMutexLocker locker(&lock);
+            if (FAILED(status) || (flags & (MF_SOURCE_READERF_ERROR | MF_SOURCE_READERF_ENDOFSTREAM)))
+            {
+                if (!stopping)
+                    qWarning() << "The Media Foundation camera stopped streaming" << QString::number(status, 16);
+                failed = true;
+                frameArrived.wakeAll();
+                return S_OK;
+            }
+
+            // the ticks of the stream have no sample, a stream thread that's behind only gets the latest one
+            if (sample)
+            {
+                sample->AddRef();
+                dropped = latest;
+                latest = sample;
+                frameArrived.wakeOne();
+            }
+        }
+
+        safeRelease(dropped);
+        requestSample();
+        return S_OK;
+    }
+
+    STDMETHODIMP OnFlush(DWORD) override
+    {
+        return S_OK;
+    }
+
+    STDMETHODIMP OnEvent(DWORD, IMFMediaEvent*) override
+    {
+        return S_OK;
+    }
+
+    /// Takes over the references, and starts reading
+    bool start(IMFMediaSource* mediaSource, IMFSourceReader* reader)
+    {
+        IMFMediaType* type = nullptr;
+        bool ok = SUCCEEDED(reader->GetCurrentMediaType(videoStream, &type));
+        UINT32 frameWidth = 0, frameHeight = 0;
+        if (ok)
+            ok = SUCCEEDED(MFGetAttributeSize(type, MF_MT_FRAME_SIZE, &frameWidth, &frameHeight));
+
+        // decoders round the height up to whole macroblocks, the aperture is what's displayed
+        MFVideoArea aperture;
+        if (ok && SUCCEEDED(type->GetBlob(MF_MT_MINIMUM_DISPLAY_APERTURE, reinterpret_cast<UINT8*>(&aperture),
+                                          sizeof(aperture), nullptr)))
+        {
+            width = aperture.Area.cx;
+            height = aperture.Area.cy;
+        }
+        else
+        {
+            width = static_cast<int>(frameWidth);
+            height = static_cast<int>(frameHeight);
+        }
+        planeHeight = static_cast<int>(frameHeight);
+        stride = static_cast<LONG>(MFGetAttributeUINT32(type, MF_MT_DEFAULT_STRIDE, frameWidth));
+        safeRelease(type);
+
+        {
+            QMutexLocker locker(&lock);
+            source = mediaSource;
+            sourceReader = reader;
+        }
+
+        if (ok)
+            requestSample();
+        return ok;
+    }
+
+    /// Stops reading and drops our references to the reader, the samples it still has in flight fail
+    void stop()
+    {
+        IMFMediaSource* mediaSource;
+        IMFSourceReader* reader;
+        IMFSample* sample;
+        {
+            QMutexLocker locker(&lock);
+            stopping = true;
+            mediaSource = source;
+            reader = sourceReader;
+            sample = latest;
+            source = nullptr;
+            sourceReader = nullptr;
+            latest = nullptr;
+            frameArrived.wakeAll();
+        }
+
+        if (mediaSource)
+            mediaSource->Shutdown();
+        safeRelease(reader);
+        safeRelease(mediaSource);
+        safeRelease(sample);
+    }
+
+    /// Waits for the next sample, returns nullptr on timeout or error
+    IMFSample* takeSample(unsigned long timeout)
+    {
+        QMutexLocker locker(&lock);
+        if (!latest && !failed)
+            frameArrived.wait(&lock, timeout);
+
+        IMFSample* sample = latest;
+        latest = nullptr;
+        return sample;
+    }
+
+public:
+    // only written by start, before the first sample
+    int width = 0, height = 0, planeHeight = 0;
+    LONG stride = 0;
+
+private:
+    ~Reader() = default;
+
+    void requestSample()
+    {
+        IMFSourceReader* reader;
+        {
+            QMutexLocker locker(&lock);
+            if (stopping || !sourceReader)
+                return;
+            reader = sourceReader;
+            reader->AddRef();
+        }
+
+        // the result comes in OnReadSample, on a thread of Media Foundation's
+        if (FAILED(reader->ReadSample(videoStream, 0, nullptr, nullptr, nullptr, nullptr)))
+        {
+            QMutexLocker locker(&lock);
+            failed = true;
+        }
+        reader->Release();
+    }
+
+private:
+    std::atomic<ULONG> refs{1};
+    QMutex lock;
+    QWaitCondition frameArrived; ///< Woken with the lock when latest is set, or when we fail or stop
+    IMFMediaSource* source = nullptr;
+    IMFSourceReader* sourceReader = nullptr;
+    IMFSample* latest = nullptr; ///< Referenced, the newest sample grabFrame didn't take yet
+    bool stopping = false;
+    bool failed = false;
+};
+
+QVector<QPair<QString,QString>> MediaFoundation::getDeviceList()
+{
+    QVector<QPair<QString,QString>> devices;
+    MFScope mf;
+    IMFActivate** activates = nullptr;
+    UINT32 count = 0;
+    if (!mf.isStarted() || !enumDevices(activates, count))
+        return devices;
+
+    for (UINT32 i = 0; i < count; ++i)
+    {
+        WCHAR* link = nullptr;
+        WCHAR* name = nullptr;
+        UINT32 length;
+        if (SUCCEEDED(activates[i]->GetAllocatedString(MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE_VIDCAP_SYMBOLIC_LINK, &link, &length))
+                && SUCCEEDED(activates[i]->GetAllocatedString(MF_DEVSOURCE_ATTRIBUTE_FRIENDLY_NAME, &name, &length)))
+        {
+            devices.append({DEVICE_PREFIX + QString::fromWCharArray(link),
+                            QObject::tr("%1 (Media Foundation)").arg(QString::fromWCharArray(name))});
+        }
+
+        CoTaskMemFree(link);
+        CoTaskMemFree(name);
+        activates[i]->Release();
+    }
+    CoTaskMemFree(activates);
+
+    return devices;
+}
+
+QVector<VideoMode> MediaFoundation::getDeviceModes(QString devName)
+{
+    QVector<VideoMode> modes;
+    MFScope mf;
+    if (!mf.isStarted())
+        return modes;
+
+    IMFMediaSource* source = createSource(devName);
+    if (!source)
+        return modes;
+
+    IMFSourceReader* reader = nullptr;
+    if (SUCCEEDED(MFCreateSourceReaderFromMediaSource(source, nullptr, &reader)))
+    {
+        IMFMediaType* type = nullptr;
+        for (DWORD i = 0; SUCCEEDED(reader->GetNativeMediaType(videoStream, i, &type)); ++i)
+        {
+            VideoMode mode{0, 0, 0, 0};
+            if (readMode(type, mode))
+            {
+                auto same = std::find_if(modes.begin(), modes.end(), [&](const VideoMode& other)
+                {
+                    return other.width == mode.width && other.height == mode.height && other.FPS == mode.FPS;
+                });
+
+                if (same == modes.end())
+                    modes.append(mode);
+                else if (subtypeRank(mode.pixel_format) > subtypeRank(same->pixel_format))
+                    same->pixel_format = mode.pixel_format;
+            }
+            type->Release();
+        }
+        reader->Release();
+    }
+
+    source->Shutdown();
+    source->Release();
+    return modes;
+}
+
+MediaFoundation::Capture::Capture(Reader* reader)
+    : reader{reader}
+{
+    MFStartup(MF_VERSION, MFSTARTUP_LITE);
+}
+
+MediaFoundation::Capture::~Capture()
+{
+    reader->stop();
+    reader->Release();
+    MFShutdown();
+}
+
+MediaFoundation::Capture* MediaFoundation::Capture::open(const QString& devName, const VideoMode& mode)
+{
+    MFScope mf;
+    if (!mf.isStarted())
+        return nullptr;
+
+    IMFMediaSource* source = createSource(devName);
+    if (!source)
+        return nullptr;
+
+    Capture* capture = new Capture{new Reader};
+    IMFAttributes* attributes = nullptr;
+    IMFSourceReader* sourceReader = nullptr;
+    HRESULT hr = MFCreateAttributes(&attributes, 3);
+    if (SUCCEEDED(hr))
+        hr = attributes->SetUnknown(MF_SOURCE_READER_ASYNC_CALLBACK, capture->reader);
+    // decodes MJPEG on the GPU, when the driver has a hardware transform for it
+    if (SUCCEEDED(hr))
+        hr = attributes->SetUINT32(MF_READWRITE_ENABLE_HARDWARE_TRANSFORMS, TRUE);
+    // lets the reader convert the uncompressed types like YUY2 to NV12
+    if (SUCCEEDED(hr))
+        hr = attributes->SetUINT32(MF_SOURCE_READER_ENABLE_VIDEO_PROCESSING, TRUE);
+    if (SUCCEEDED(hr))
+        hr = MFCreateSourceReaderFromMediaSource(source, attributes, &sourceReader);
+    safeRelease(attributes);
+
+    if (FAILED(hr))
+    {
+        qWarning() << "Can't create a Media Foundation source reader" << QString::number(hr, 16);
+        source->Shutdown();
+        source->Release();
+        delete capture;
+        return nullptr;
+    }
+
+    bool ok = setFormat(sourceReader, mode);
+    // the reader takes over the source and source reader, even if we fail
+    ok = capture->reader->start(source, sourceReader) && ok;
+    if (!ok)
+    {
+        delete capture;
+        return nullptr;
+    }
+
+    qDebug() << "Capturing" << devName << "with Media Foundation";
+    return capture;
+}
+
+AVFrame* MediaFoundation::Capture::grabFrame()
+{
+    IMFSample* sample = reader->takeSample(1000);
+    if (!sample)
+        return nullptr;
+
+    IMFMediaBuffer* buffer = nullptr;
+    HRESULT hr = sample->ConvertToContiguousBuffer(&buffer);
+    sample->Release();
+    if (FAILED(hr))
+        return nullptr;
+
+    // the 2D buffers tell us their real pitch, the others have the type's default stride
+    BYTE* data = nullptr;
+    LONG pitch = reader->stride;
+    BufferRef* ref = new BufferRef{buffer, nullptr};
+    if (SUCCEEDED(buffer->QueryInterface(IID_IMF2DBuffer, reinterpret_cast<void**>(&ref->buffer2d))))
+    {
+        hr = ref->buffer2d->Lock2D(&data, &pitch);
+        if (FAILED(hr))
+            safeRelease(ref->buffer2d);
+    }
+    else
+    {
+        ref->buffer2d = nullptr;
+        hr = buffer->Lock(&data, nullptr, nullptr);
+    }
+
+    // NV12 is never bottom-up
+    if (FAILED(hr) || pitch <= 0)
+    {
+        if (SUCCEEDED(hr))
+            releaseBuffer(ref, nullptr);
+        else
+        {
+            buffer->Release();
+            delete ref;
+        }
+        return nullptr;
+    }
+
+    AVFrame* frame = av_frame_alloc();
+    if (frame)
+        frame->buf[0] = av_buffer_create(data, pitch * reader->planeHeight * 3 / 2, releaseBuffer, ref, 0);
+
+    if (!frame || !frame->buf[0])
+    {
+        av_frame_free(&frame);
+        releaseBuffer(ref, nullptr);
+        return nullptr;
+    }
+
+    frame->width = reader->width;
+    frame->height = reader->height;
+    frame->format = AV_PIX_FMT_NV12;
+    frame->opaque = nullptr;
+    frame->data[0] = data;
+    frame->linesize[0] = pitch;
+    // the interleaved chroma follows the whole luma plane, at the same pitch
+    frame->data[1] = data + pitch * reader->planeHeight;
+    frame->linesize[1] = pitch;
+
+    return frame;
+}
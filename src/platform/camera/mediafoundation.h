@@ -0,0 +1,70 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MEDIAFOUNDATION_H
+#define MEDIAFOUNDATION_H
+
+#include <QString>
+#include <QVector>
+#include <QPair>
+#include "src/video/videomode.h"
+
+#ifndef Q_OS_WIN
+#error "This file is only meant to be compiled for Windows targets"
+#endif
+
+struct AVFrame;
+
+namespace MediaFoundation
+{
+    /// Our names of the Media Foundation cameras start with this, followed by their symbolic link
+    const QString DEVICE_PREFIX{"mf#"};
+
+    /// The names are DEVICE_PREFIX followed by the symbolic links, so they can be told apart from DirectShow's
+    QVector<QPair<QString,QString>> getDeviceList();
+    /// devName is the symbolic link of the camera, without the prefix
+    /// The pixel_format of the modes is the FOURCC of the camera's subtype, one mode per size and rate
+    QVector<VideoMode> getDeviceModes(QString devName);
+
+    /// Captures a camera with an asynchronous IMFSourceReader, which decodes MJPEG on the GPU
+    /// when it can and converts everything to NV12. The frames point straight into the reader's
+    /// pooled buffers, which go back to it when the frames are freed.
+    class Capture
+    {
+    public:
+        ~Capture();
+
+        /// devName is the symbolic link of the camera, returns nullptr if it can't stream this mode
+        static Capture* open(const QString& devName, const VideoMode& mode);
+
+        /// Waits for the next frame, returns nullptr on timeout or error
+        AVFrame* grabFrame();
+
+        class Reader; ///< Internal, the sample callbacks of the source reader
+
+    private:
+        explicit Capture(Reader* reader);
+        Capture(const Capture&) = delete;
+        Capture& operator=(const Capture&) = delete;
+
+        Reader* reader; ///< Referenced, it lives as long as the source reader has callbacks to make
+    };
+}
+
+#endif // MEDIAFOUNDATION_H
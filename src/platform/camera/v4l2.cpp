@@ -22,13 +22,21 @@
 
 #include "v4l2.h"
 
+#include <QDebug>
+#include <QMutex>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <poll.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <linux/videodev2.h>
 #include <dirent.h>
 #include <map>
+extern "C" {
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+}
 
 /**
  * Most of this file is adapted from libavdevice's v4l2.c,
@@ -52,6 +60,7 @@ static std::map<uint32_t,QString> createPixFmtToName()
     m[V4L2_PIX_FMT_H264] = QString("h264");
     m[V4L2_PIX_FMT_MJPEG] = QString("mjpeg");
     m[V4L2_PIX_FMT_YUYV] = QString("yuyv422");
+    m[V4L2_PIX_FMT_NV12] = QString("nv12");
     return m;
 }
 const std::map<uint32_t,QString> pixFmtToName = createPixFmtToName();
@@ -217,3 +226,281 @@ bool v4l2::betterPixelFormat(uint32_t a, uint32_t b)
 	return pixFmtToQuality.at(a) > pixFmtToQuality.at(b);
 }
 
+
+/// The open device and its mapped buffers
+struct v4l2::Capture::Device
+{
+    ~Device();
+
+    struct Buffer
+    {
+        void* start;
+        size_t length;
+    };
+
+    int fd = -1;
+    QVector<Buffer> buffers;
+    int width = 0, height = 0, bytesPerLine = 0;
+    int pixFmt = AV_PIX_FMT_NONE;
+    QString name;
+    QMutex lock; ///< Guards streaming, the frames give their buffers back from any thread
+    bool streaming = false;
+};
+
+namespace
+{
+
+/// Ties a frame's buffer to the device, so freeing the frame gives the buffer back
+struct BufferRef
+{
+    std::shared_ptr<v4l2::Capture::Device> device;
+    unsigned index;
+};
+
+int xioctl(int fd, unsigned long request, void* arg)
+{
+    int r;
+    do {
+        r = ioctl(fd, request, arg);
+    } while (r < 0 && errno == EINTR);
+    return r;
+}
+
+bool queueBuffer(int fd, unsigned index)
+{
+    v4l2_buffer buf{};
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = index;
+    return xioctl(fd, VIDIOC_QBUF, &buf) == 0;
+}
+
+void releaseBuffer(void* opaque, uint8_t*)
+{
+    BufferRef* ref = static_cast<BufferRef*>(opaque);
+    {
+        QMutexLocker locker{&ref->device->lock};
+        if (ref->device->streaming)
+            queueBuffer(ref->device->fd, ref->index);
+    }
+    delete ref;
+}
+
+}
+
+v4l2::Capture::Device::~Device()
+{
+    if (fd < 0)
+        return;
+
+    if (streaming)
+    {
+        v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        xioctl(fd, VIDIOC_STREAMOFF, &type);
+    }
+
+    for (const Buffer& buffer : buffers)
+        munmap(buffer.start, buffer.length);
+
+    ::close(fd);
+}
+
+v4l2::Capture::Capture(std::shared_ptr<Device> device)
+    : device{device}
+{
+}
+
+/**
+ * @brief Stops streaming, the buffers are unmapped once the last frame using them is freed.
+ */
+v4l2::Capture::~Capture()
+{
+    QMutexLocker locker{&device->lock};
+    if (device->streaming)
+    {
+        v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        xioctl(device->fd, VIDIOC_STREAMOFF, &type);
+        device->streaming = false;
+    }
+}
+
+bool v4l2::Capture::isSupported(uint32_t pixelFormat)
+{
+    return pixelFormat == V4L2_PIX_FMT_YUYV || pixelFormat == V4L2_PIX_FMT_NV12;
+}
+
+v4l2::Capture* v4l2::Capture::open(const QString& devName, const VideoMode& mode)
+{
+    if (!isSupported(mode.pixel_format) || !mode.width || !mode.height)
+        return nullptr;
+
+    int error = 0;
+    int fd = deviceOpen(devName, &error);
+    if (fd < 0 || error != 0)
+        return nullptr;
+
+    std::shared_ptr<Device> device = std::make_shared<Device>();
+    device->fd = fd;
+    device->name = devName;
+    if (!startStreaming(*device, mode))
+        return nullptr;
+
+    return new Capture{device};
+}
+
+/**
+ * @brief Switches to another raw mode on the open device, without closing it.
+ * Renegotiating is much faster than reopening on most UVC cameras, but the buffers are remapped,
+ * so all the frames must have been freed already.
+ * @return False if frames are still out or the device refused, the capture is stopped then.
+ */
+bool v4l2::Capture::setMode(const VideoMode& mode)
+{
+    if (!isSupported(mode.pixel_format) || !mode.width || !mode.height)
+        return false;
+
+    if (device.use_count() > 1)
+    {
+        qDebug() << "Can't change the mode of" << device->name << "while frames are out";
+        return false;
+    }
+
+    QMutexLocker locker{&device->lock};
+    if (device->streaming)
+    {
+        v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        xioctl(device->fd, VIDIOC_STREAMOFF, &type);
+        device->streaming = false;
+    }
+
+    for (const Device::Buffer& buffer : device->buffers)
+        munmap(buffer.start, buffer.length);
+    device->buffers.clear();
+
+    // the driver only accepts a new format once the old buffers are gone
+    v4l2_requestbuffers req{};
+    req.count = 0;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_MMAP;
+    xioctl(device->fd, VIDIOC_REQBUFS, &req);
+
+    return startStreaming(*device, mode);
+}
+
+/**
+ * @brief Sets the mode, maps the buffers and starts streaming, callers must own the device.
+ */
+bool v4l2::Capture::startStreaming(Device& device, const VideoMode& mode)
+{
+    const int fd = device.fd;
+    const QString& devName = device.name;
+
+    v4l2_format fmt{};
+    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    fmt.fmt.pix.width = mode.width;
+    fmt.fmt.pix.height = mode.height;
+    fmt.fmt.pix.pixelformat = mode.pixel_format;
+    fmt.fmt.pix.field = V4L2_FIELD_NONE;
+    if (xioctl(fd, VIDIOC_S_FMT, &fmt) < 0 || fmt.fmt.pix.pixelformat != mode.pixel_format)
+    {
+        qWarning() << "Can't set the mode of" << devName;
+        return false;
+    }
+
+    device.width = fmt.fmt.pix.width;
+    device.height = fmt.fmt.pix.height;
+    device.bytesPerLine = fmt.fmt.pix.bytesperline;
+    device.pixFmt = mode.pixel_format == V4L2_PIX_FMT_YUYV ? AV_PIX_FMT_YUYV422 : AV_PIX_FMT_NV12;
+
+    if (mode.FPS)
+    {
+        v4l2_streamparm parm{};
+        parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        parm.parm.capture.timeperframe.numerator = 1;
+        parm.parm.capture.timeperframe.denominator = mode.FPS;
+        // not all drivers can, they'll just run at their own rate
+        xioctl(fd, VIDIOC_S_PARM, &parm);
+    }
+
+    // enough for the stream thread, the delivery queue and a display, without adding latency
+    v4l2_requestbuffers req{};
+    req.count = 6;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_MMAP;
+    if (xioctl(fd, VIDIOC_REQBUFS, &req) < 0 || req.count < 2)
+    {
+        qWarning() << devName << "doesn't support mmap streaming";
+        return false;
+    }
+
+    for (unsigned i = 0; i < req.count; ++i)
+    {
+        v4l2_buffer buf{};
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = i;
+        if (xioctl(fd, VIDIOC_QUERYBUF, &buf) < 0)
+            return false;
+
+        void* start = mmap(nullptr, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, buf.m.offset);
+        if (start == MAP_FAILED)
+            return false;
+
+        device.buffers.append({start, buf.length});
+        if (!queueBuffer(fd, i))
+            return false;
+    }
+
+    v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (xioctl(fd, VIDIOC_STREAMON, &type) < 0)
+    {
+        qWarning() << "Can't start streaming" << devName;
+        return false;
+    }
+    device.streaming = true;
+
+    qDebug() << "Capturing" << devName << "natively at" << device.width << "x" << device.height;
+    return true;
+}
+
+AVFrame* v4l2::Capture::grabFrame()
+{
+    pollfd pfd{device->fd, POLLIN, 0};
+    if (poll(&pfd, 1, 1000) <= 0)
+        return nullptr;
+
+    v4l2_buffer buf{};
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    if (xioctl(device->fd, VIDIOC_DQBUF, &buf) < 0)
+        return nullptr;
+
+    const Device::Buffer& buffer = device->buffers[buf.index];
+    AVFrame* frame = av_frame_alloc();
+    BufferRef* ref = new BufferRef{device, buf.index};
+    if (frame)
+        frame->buf[0] = av_buffer_create(static_cast<uint8_t*>(buffer.start), buffer.length,
+                                         releaseBuffer, ref, 0);
+
+    if (!frame || !frame->buf[0])
+    {
+        av_frame_free(&frame);
+        releaseBuffer(ref, nullptr);
+        return nullptr;
+    }
+
+    frame->width = device->width;
+    frame->height = device->height;
+    frame->format = device->pixFmt;
+    frame->opaque = nullptr;
+    frame->data[0] = static_cast<uint8_t*>(buffer.start);
+    frame->linesize[0] = device->bytesPerLine;
+    if (device->pixFmt == AV_PIX_FMT_NV12)
+    {
+        // the interleaved chroma follows the luma plane, at the same stride
+        frame->data[1] = frame->data[0] + device->bytesPerLine * device->height;
+        frame->linesize[1] = device->bytesPerLine;
+    }
+
+    return frame;
+}
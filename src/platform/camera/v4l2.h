@@ -22,8 +22,11 @@
 #include <QString>
 #include <QVector>
 #include <QPair>
+#include <memory>
 #include "src/video/videomode.h"
 
+struct AVFrame;
+
 #ifndef Q_OS_LINUX
 #error "This file is only meant to be compiled for Linux targets"
 #endif
@@ -34,6 +37,35 @@ namespace v4l2
     QVector<QPair<QString, QString>> getDeviceList();
     QString getPixelFormatString(uint32_t pixel_format);
     bool betterPixelFormat(uint32_t a, uint32_t b);
+
+    /// Streams a camera through the driver's mmap buffers, without libavdevice or a decoder.
+    /// Only for the raw pixel formats, the frames point straight into the driver's buffers,
+    /// which go back to the driver when the frames are freed.
+    class Capture
+    {
+    public:
+        ~Capture();
+
+        /// True if we can capture this V4L2 pixel format without decoding it
+        static bool isSupported(uint32_t pixelFormat);
+        /// Returns nullptr if the device can't stream this mode
+        static Capture* open(const QString& devName, const VideoMode& mode);
+
+        /// Renegotiates another mode in place, only once all the frames are freed
+        bool setMode(const VideoMode& mode);
+        /// Waits for the next frame, returns nullptr on timeout or error
+        AVFrame* grabFrame();
+
+        struct Device; ///< Internal, the frames keep it alive too
+
+    private:
+        explicit Capture(std::shared_ptr<Device> device);
+        static bool startStreaming(Device& device, const VideoMode& mode);
+        Capture(const Capture&) = delete;
+        Capture& operator=(const Capture&) = delete;
+
+        std::shared_ptr<Device> device; ///< Shared with the frames still out, so it outlives them
+    };
 }
 
 #endif // V4L2_H
@@ -0,0 +1,38 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PLATFORM_THREADPRIORITY_H
+#define PLATFORM_THREADPRIORITY_H
+
+namespace Platform
+{
+    enum class ThreadClass
+    {
+        Audio, ///< Short periodic work that must never be late
+        Video  ///< Heavier work, a late frame is only a stutter
+    };
+
+    /// Promotes the calling thread above normal work
+    /// Returns true only if the system reports the new priority in effect, logs why not otherwise
+    bool setThreadRealtime(ThreadClass threadClass);
+    /// Puts the calling thread back to the normal priority, for pool threads that run other work next
+    void resetThreadPriority();
+}
+
+#endif // PLATFORM_THREADPRIORITY_H
@@ -0,0 +1,108 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QtCore/qsystemdetection.h>
+#ifdef Q_OS_OSX
+#include "src/platform/threadpriority.h"
+#include <QDebug>
+#include <QThread>
+#include <mach/mach.h>
+#include <mach/mach_time.h>
+#include <mach/thread_policy.h>
+#include <pthread.h>
+#include <pthread/qos.h>
+
+/**
+@file threadpriority_osx.cpp
+
+Audio threads get the time constraint policy CoreAudio uses for its own threads, which the
+scheduler honors before anything else. Video threads only need the user-interactive QoS class.
+*/
+
+namespace
+{
+uint64_t nsToAbsolute(uint64_t ns)
+{
+    static mach_timebase_info_data_t timebase = []()
+    {
+        mach_timebase_info_data_t info;
+        mach_timebase_info(&info);
+        return info;
+    }();
+
+    return ns * timebase.denom / timebase.numer;
+}
+
+bool setTimeConstraint()
+{
+    // we wake up every 10 ms for a small amount of work, see Audio::doCapture
+    thread_time_constraint_policy_data_t policy;
+    policy.period = static_cast<uint32_t>(nsToAbsolute(10 * 1000 * 1000));
+    policy.computation = static_cast<uint32_t>(nsToAbsolute(2 * 1000 * 1000));
+    policy.constraint = static_cast<uint32_t>(nsToAbsolute(10 * 1000 * 1000));
+    policy.preemptible = 1;
+
+    thread_port_t thread = pthread_mach_thread_np(pthread_self());
+    if (thread_policy_set(thread, THREAD_TIME_CONSTRAINT_POLICY, reinterpret_cast<thread_policy_t>(&policy),
+                          THREAD_TIME_CONSTRAINT_POLICY_COUNT) != KERN_SUCCESS)
+        return false;
+
+    // the kernel answers with the default policy if ours wasn't applied
+    thread_time_constraint_policy_data_t applied;
+    mach_msg_type_number_t count = THREAD_TIME_CONSTRAINT_POLICY_COUNT;
+    boolean_t isDefault = FALSE;
+    if (thread_policy_get(thread, THREAD_TIME_CONSTRAINT_POLICY, reinterpret_cast<thread_policy_t>(&applied),
+                          &count, &isDefault) != KERN_SUCCESS)
+        return false;
+
+    return !isDefault;
+}
+
+bool setInteractiveQos()
+{
+    if (pthread_set_qos_class_self_np(QOS_CLASS_USER_INTERACTIVE, 0) != 0)
+        return false;
+
+    return qos_class_self() == QOS_CLASS_USER_INTERACTIVE;
+}
+}
+
+bool Platform::setThreadRealtime(ThreadClass threadClass)
+{
+    const QString thread = QThread::currentThread()->objectName();
+    const bool audio = threadClass == ThreadClass::Audio;
+    if (!(audio ? setTimeConstraint() : setInteractiveQos()))
+    {
+        qWarning() << "Couldn't raise the priority of thread" << thread;
+        return false;
+    }
+
+    qDebug() << "Thread" << thread << "runs with" << (audio ? "a time constraint policy" : "the user-interactive QoS");
+    return true;
+}
+
+void Platform::resetThreadPriority()
+{
+    thread_standard_policy_data_t policy;
+    thread_policy_set(pthread_mach_thread_np(pthread_self()), THREAD_STANDARD_POLICY,
+                      reinterpret_cast<thread_policy_t>(&policy), THREAD_STANDARD_POLICY_COUNT);
+    pthread_set_qos_class_self_np(QOS_CLASS_DEFAULT, 0);
+}
+
+#endif  // Q_OS_OSX
@@ -0,0 +1,149 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QtCore/qsystemdetection.h>
+#if defined(Q_OS_UNIX) && !defined(__APPLE__) && !defined(__MACH__)
+#include "src/platform/threadpriority.h"
+#include <QDebug>
+#include <QThread>
+#ifdef QTOX_RTKIT
+#include <QDBusConnection>
+#include <QDBusMessage>
+#include <QDBusVariant>
+#endif
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/**
+@file threadpriority_unix.cpp
+
+We ask for SCHED_RR ourselves first, which works when RLIMIT_RTPRIO allows it,
+and go through rtkit otherwise, as desktop sessions usually don't grant that limit.
+*/
+
+namespace
+{
+#ifdef SCHED_RESET_ON_FORK
+const int resetOnFork = SCHED_RESET_ON_FORK; ///< Processes we start don't inherit the priority
+#else
+const int resetOnFork = 0;
+#endif
+
+/// Audio needs to preempt video, both stay well below rtkit's usual maximum of 20
+int priorityFor(Platform::ThreadClass threadClass)
+{
+    return threadClass == Platform::ThreadClass::Audio ? 10 : 5;
+}
+
+bool isRealtime()
+{
+    // not pthread_getschedparam, glibc may return a cached policy that rtkit changed behind its back
+    int policy = sched_getscheduler(0);
+    return policy >= 0 && (policy & ~resetOnFork) == SCHED_RR;
+}
+
+bool setSchedulerDirectly(int priority)
+{
+    sched_param param{};
+    param.sched_priority = priority;
+    return sched_setscheduler(0, SCHED_RR | resetOnFork, &param) == 0;
+}
+
+#ifdef QTOX_RTKIT
+bool setSchedulerWithRtkit(int priority)
+{
+    QDBusConnection bus = QDBusConnection::systemBus();
+    if (!bus.isConnected())
+    {
+        qWarning() << "Can't ask rtkit for real-time priority, no system bus";
+        return false;
+    }
+
+    const QString service = QStringLiteral("org.freedesktop.RealtimeKit1");
+    const QString path = QStringLiteral("/org/freedesktop/RealtimeKit1");
+
+    // rtkit only grants real-time scheduling to processes that limit how long a thread can hog the CPU
+    rlimit limit;
+    const rlim_t maxRealtimeUs = 200000;
+    if (getrlimit(RLIMIT_RTTIME, &limit) == 0
+            && (limit.rlim_max == RLIM_INFINITY || limit.rlim_max > maxRealtimeUs))
+    {
+        limit.rlim_cur = limit.rlim_max = maxRealtimeUs;
+        setrlimit(RLIMIT_RTTIME, &limit);
+    }
+
+    QDBusMessage get = QDBusMessage::createMethodCall(service, path, QStringLiteral("org.freedesktop.DBus.Properties"),
+                                                      QStringLiteral("Get"));
+    get << service << QStringLiteral("MaxRealtimePriority");
+    QDBusMessage maxReply = bus.call(get, QDBus::Block, 1000);
+    if (maxReply.type() == QDBusMessage::ReplyMessage && !maxReply.arguments().isEmpty())
+    {
+        int maxPriority = maxReply.arguments().first().value<QDBusVariant>().variant().toInt();
+        if (maxPriority > 0)
+            priority = qMin(priority, maxPriority);
+    }
+
+    QDBusMessage make = QDBusMessage::createMethodCall(service, path, service, QStringLiteral("MakeThreadRealtime"));
+    make << static_cast<quint64>(syscall(SYS_gettid)) << static_cast<quint32>(priority);
+    QDBusMessage reply = bus.call(make, QDBus::Block, 1000);
+    if (reply.type() != QDBusMessage::ReplyMessage)
+    {
+        qWarning() << "rtkit refused real-time priority:" << reply.errorMessage();
+        return false;
+    }
+
+    return true;
+}
+#endif
+}
+
+bool Platform::setThreadRealtime(ThreadClass threadClass)
+{
+    const QString thread = QThread::currentThread()->objectName();
+    const int priority = priorityFor(threadClass);
+    bool asked = setSchedulerDirectly(priority);
+#ifdef QTOX_RTKIT
+    if (!asked)
+        asked = setSchedulerWithRtkit(priority);
+#endif
+
+    if (!asked || !isRealtime())
+    {
+        qWarning() << "Couldn't give real-time priority to thread" << thread;
+        return false;
+    }
+
+    qDebug() << "Thread" << thread << "runs with real-time priority" << priority;
+    return true;
+}
+
+void Platform::resetThreadPriority()
+{
+    if (!isRealtime())
+        return;
+
+    sched_param param{};
+    param.sched_priority = 0;
+    if (sched_setscheduler(0, SCHED_OTHER, &param) != 0)
+        qWarning() << "Couldn't reset the priority of thread" << QThread::currentThread()->objectName();
+}
+
+#endif  // Q_OS_UNIX
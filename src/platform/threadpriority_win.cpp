@@ -0,0 +1,82 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QtCore/qsystemdetection.h>
+#ifdef Q_OS_WIN32
+#include "src/platform/threadpriority.h"
+#include <QDebug>
+#include <QThread>
+#include <windows.h>
+#include <avrt.h>
+
+/**
+@file threadpriority_win.cpp
+
+The Multimedia Class Scheduler Service boosts registered threads into the real-time range
+without letting them starve the system. Its boost isn't visible with GetThreadPriority, the task
+handle is its confirmation. If the service is disabled, we fall back to a plain thread priority.
+*/
+
+namespace
+{
+thread_local HANDLE mmcssTask = nullptr;
+}
+
+bool Platform::setThreadRealtime(ThreadClass threadClass)
+{
+    const QString thread = QThread::currentThread()->objectName();
+    const bool audio = threadClass == ThreadClass::Audio;
+
+    DWORD taskIndex = 0;
+    if (!mmcssTask)
+        mmcssTask = AvSetMmThreadCharacteristicsW(audio ? L"Pro Audio" : L"Capture", &taskIndex);
+
+    if (mmcssTask)
+    {
+        if (audio && !AvSetMmThreadPriority(mmcssTask, AVRT_PRIORITY_HIGH))
+            qWarning() << "MMCSS didn't raise the priority of thread" << thread << GetLastError();
+
+        qDebug() << "Thread" << thread << "registered with MMCSS as" << (audio ? "Pro Audio" : "Capture");
+        return true;
+    }
+
+    qWarning() << "MMCSS is unavailable for thread" << thread << GetLastError();
+    const int priority = audio ? THREAD_PRIORITY_TIME_CRITICAL : THREAD_PRIORITY_HIGHEST;
+    if (!SetThreadPriority(GetCurrentThread(), priority) || GetThreadPriority(GetCurrentThread()) != priority)
+    {
+        qWarning() << "Couldn't raise the priority of thread" << thread;
+        return false;
+    }
+
+    qDebug() << "Thread" << thread << "runs with priority" << priority;
+    return true;
+}
+
+void Platform::resetThreadPriority()
+{
+    if (mmcssTask)
+    {
+        AvRevertMmThreadCharacteristics(mmcssTask);
+        mmcssTask = nullptr;
+    }
+
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_NORMAL);
+}
+
+#endif  // Q_OS_WIN32
@@ -0,0 +1,168 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "trace.h"
+#include <QByteArray>
+#include <QCoreApplication>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QSaveFile>
+#include <QThread>
+#include <memory>
+
+/**
+@class Trace
+@brief Lightweight tracing of hot paths, to diagnose lag reported from the field.
+
+Events are written to a fixed ring from any thread without locking, the oldest ones are overwritten.
+The ring is allocated by the first start() and kept until exit, so a span that's still being recorded
+while tracing stops never writes to freed memory.
+*/
+
+namespace
+{
+struct Event
+{
+    std::atomic<quint64> seq; ///< Index of the event + 1 once it's written, so readers can skip torn events
+    const char* name;
+    char phase; ///< 'X' for spans, 'C' for counters, as in the Chrome trace format
+    quintptr thread;
+    qint64 timestamp; ///< Microseconds since the first start()
+    qint64 value; ///< Duration in microseconds for spans, the value for counters
+};
+
+std::unique_ptr<Event[]> events;
+quint64 capacity = 0;
+std::atomic<quint64> nextEvent{0};
+QElapsedTimer clock;
+QMutex controlMutex; ///< Serializes start, stop and export
+}
+
+std::atomic_bool Trace::enabled{false};
+
+/**
+@brief Starts recording. The capacity of the ring is fixed by the first call.
+*/
+void Trace::start(int ringSize)
+{
+    QMutexLocker locker{&controlMutex};
+    if (!events)
+    {
+        capacity = static_cast<quint64>(qMax(ringSize, 1));
+        events.reset(new Event[capacity]);
+        for (quint64 i = 0; i < capacity; ++i)
+            events[i].seq.store(0, std::memory_order_relaxed);
+
+        clock.start();
+    }
+
+    enabled.store(true, std::memory_order_release);
+}
+
+void Trace::stop()
+{
+    enabled.store(false, std::memory_order_release);
+}
+
+void Trace::count(const char* name, qint64 value)
+{
+    if (isEnabled())
+        record(name, 'C', now(), value);
+}
+
+qint64 Trace::now()
+{
+    return clock.nsecsElapsed() / 1000;
+}
+
+void Trace::record(const char* name, char phase, qint64 timestamp, qint64 value)
+{
+    quint64 index = nextEvent.fetch_add(1, std::memory_order_relaxed);
+    Event& event = events[index % capacity];
+    event.seq.store(0, std::memory_order_relaxed);
+    event.name = name;
+    event.phase = phase;
+    event.thread = reinterpret_cast<quintptr>(QThread::currentThreadId());
+    event.timestamp = timestamp;
+    event.value = value;
+    event.seq.store(index + 1, std::memory_order_release);
+}
+
+bool Trace::exportJson(const QString& path)
+{
+    QMutexLocker locker{&controlMutex};
+    if (!events)
+    {
+        qWarning() << "Tracing was never started, nothing to export";
+        return false;
+    }
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        qWarning() << "Couldn't write the trace to" << path;
+        return false;
+    }
+
+    const QByteArray pid = QByteArray::number(QCoreApplication::applicationPid());
+    const quint64 end = nextEvent.load(std::memory_order_acquire);
+    const quint64 begin = end > capacity ? end - capacity : 0;
+
+    QByteArray json = "{\"traceEvents\":[";
+    int written = 0;
+    for (quint64 i = begin; i < end; ++i)
+    {
+        const Event& event = events[i % capacity];
+        if (event.seq.load(std::memory_order_acquire) != i + 1)
+            continue;
+
+        const char* name = event.name;
+        const char phase = event.phase;
+        const quintptr thread = event.thread;
+        const qint64 timestamp = event.timestamp;
+        const qint64 value = event.value;
+
+        // Overwritten while we were reading it
+        if (event.seq.load(std::memory_order_acquire) != i + 1)
+            continue;
+
+        if (written++)
+            json += ',';
+
+        json += "{\"name\":\"" + QByteArray(name) + "\",\"ph\":\"" + phase + "\",\"pid\":" + pid
+                + ",\"tid\":" + QByteArray::number(static_cast<quint64>(thread))
+                + ",\"ts\":" + QByteArray::number(timestamp);
+        if (phase == 'X')
+            json += ",\"dur\":" + QByteArray::number(value) + '}';
+        else
+            json += ",\"args\":{\"value\":" + QByteArray::number(value) + "}}";
+    }
+    json += "],\"displayTimeUnit\":\"ms\"}";
+
+    file.write(json);
+    if (!file.commit())
+    {
+        qWarning() << "Couldn't write the trace to" << path;
+        return false;
+    }
+
+    qDebug() << "Wrote" << written << "trace events to" << path;
+    return true;
+}
@@ -0,0 +1,76 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <QString>
+#include <atomic>
+
+/// Records spans and counters into a ring buffer, exported as Chrome trace JSON (chrome://tracing)
+/// Disabled by default, recording then costs a single atomic load
+class Trace
+{
+public:
+    /// Starts recording, keeping the last capacity events
+    static void start(int capacity = 1 << 16);
+    static void stop();
+    static bool isEnabled()
+    {
+        return enabled.load(std::memory_order_acquire);
+    }
+
+    /// Records the current value of a counter, name must be a string literal
+    static void count(const char* name, qint64 value);
+    /// Writes everything that's still in the ring, returns false on error
+    static bool exportJson(const QString& path);
+
+private:
+    friend class TraceSpan;
+    static qint64 now();
+    static void record(const char* name, char phase, qint64 timestamp, qint64 value);
+
+private:
+    static std::atomic_bool enabled;
+};
+
+/// Records the time from its construction to its destruction, name must be a string literal
+class TraceSpan
+{
+public:
+    explicit TraceSpan(const char* spanName)
+        : name{Trace::isEnabled() ? spanName : nullptr}, start{name ? Trace::now() : 0}
+    {
+    }
+
+    ~TraceSpan()
+    {
+        if (name)
+            Trace::record(name, 'X', start, Trace::now() - start);
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    const char* name;
+    qint64 start;
+};
+
+#endif // TRACE_H
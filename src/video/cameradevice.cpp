@@ -30,6 +30,7 @@ extern "C" {
 
 #ifdef Q_OS_WIN
 #include "src/platform/camera/directshow.h"
+#include "src/platform/camera/mediafoundation.h"
 #endif
 #ifdef Q_OS_LINUX
 #include "src/platform/camera/v4l2.h"
@@ -130,6 +131,8 @@ CameraDevice* CameraDevice::open(QString devName, VideoMode mode)
         {
             screen.setWidth(mode.width);
             screen.setHeight(mode.height);
+            // x11grab takes the corner of the area after the display name
+            devName += QString("+%1,%2").arg(mode.x).arg(mode.y);
         }
         else
         {
@@ -158,7 +161,16 @@ CameraDevice* CameraDevice::open(QString devName, VideoMode mode)
 #ifdef Q_OS_WIN
     else if (devName.startsWith("gdigrab#"))
     {
-        av_dict_set(&options, "framerate", QString().setNum(5).toStdString().c_str(), 0);
+        if (mode.width && mode.height)
+        {
+            av_dict_set(&options, "video_size", QString("%1x%2").arg(mode.width).arg(mode.height).toStdString().c_str(), 0);
+            av_dict_set(&options, "offset_x", QString().setNum(mode.x).toStdString().c_str(), 0);
+            av_dict_set(&options, "offset_y", QString().setNum(mode.y).toStdString().c_str(), 0);
+        }
+        if (mode.FPS)
+            av_dict_set(&options, "framerate", QString().setNum(mode.FPS).toStdString().c_str(), 0);
+        else
+            av_dict_set(&options, "framerate", QString().setNum(5).toStdString().c_str(), 0);
     }
 #endif
 #ifdef Q_OS_WIN
@@ -322,6 +334,11 @@ QVector<QPair<QString, QString>> CameraDevice::getDeviceList()
     else
         devices += getRawDeviceListGeneric();
 
+#ifdef Q_OS_WIN
+    // CameraSource captures these itself, they never go through libavdevice
+    devices += MediaFoundation::getDeviceList();
+#endif
+
     if (idesktopFormat)
     {
         if (idesktopFormat->name == QString("x11grab"))
@@ -353,6 +370,14 @@ QString CameraDevice::getDefaultDeviceName()
 
 QVector<VideoMode> CameraDevice::getVideoModes(QString devName)
 {
+    if (isScreen(devName))
+        return getScreenModes();
+
+#ifdef Q_OS_WIN
+    if (devName.startsWith(MediaFoundation::DEVICE_PREFIX))
+        return MediaFoundation::getDeviceModes(devName.mid(MediaFoundation::DEVICE_PREFIX.size()));
+#endif
+
     if (!iformat);
 #ifdef Q_OS_WIN
     else if (iformat->name == QString("dshow"))
@@ -373,6 +398,55 @@ QVector<VideoMode> CameraDevice::getVideoModes(QString devName)
     return {};
 }
 
+bool CameraDevice::isScreen(const QString& devName)
+{
+    return devName.startsWith("x11grab#") || devName.startsWith("gdigrab#");
+}
+
+QVector<VideoMode> CameraDevice::getScreenModes()
+{
+    QVector<QRect> areas;
+    QRect desktop;
+    for (QScreen* screen : QApplication::screens())
+    {
+        QRect area = screen->geometry();
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 5, 0))
+        qreal pixRatio = screen->devicePixelRatio();
+        area = QRect(area.topLeft() * pixRatio, area.size() * pixRatio);
+#endif
+        // toxav hates odd resolutions (off by one stride)
+        area.setWidth(area.width() & ~1);
+        area.setHeight(area.height() & ~1);
+#ifdef Q_OS_LINUX
+        // Workaround https://trac.ffmpeg.org/ticket/4574, like for the default mode
+        area.setWidth(area.width() - 2);
+        area.setHeight(area.height() - 2);
+#endif
+        desktop |= area;
+        // the grabbers can't start left or above the primary screen
+        if (area.x() >= 0 && area.y() >= 0)
+            areas.append(area);
+    }
+
+    if (areas.size() > 1 && desktop.x() >= 0 && desktop.y() >= 0)
+        areas.append(desktop);
+
+    // screens change slowly, a low frame rate keeps the text sharp on slow links
+    const float rates[] = {5, 15, 30};
+    QVector<VideoMode> modes;
+    for (const QRect& area : areas)
+    {
+        for (float FPS : rates)
+        {
+            VideoMode mode{static_cast<unsigned short>(area.width()), static_cast<unsigned short>(area.height()),
+                           FPS, 0, static_cast<unsigned short>(area.x()), static_cast<unsigned short>(area.y())};
+            modes.append(mode);
+        }
+    }
+
+    return modes;
+}
+
 QString CameraDevice::getPixelFormatString(uint32_t pixel_format)
 {
 #ifdef Q_OS_LINUX
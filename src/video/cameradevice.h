@@ -59,6 +59,8 @@ public:
 
     /// Get the list of video modes for a device
     static QVector<VideoMode> getVideoModes(QString devName);
+    /// True if the device captures the desktop instead of a camera
+    static bool isScreen(const QString& devName);
     /// Get the name of the pixel format of a video mode
     static QString getPixelFormatString(uint32_t pixel_format);
     /// Returns true if we prefer format a to b, false otherwise (such as if there's no preference)
@@ -74,6 +76,7 @@ private:
     static CameraDevice* open(QString devName, AVDictionary** options);
     static bool getDefaultInputFormat(); ///< Sets CameraDevice::iformat, returns success/failure
     static QVector<QPair<QString, QString> > getRawDeviceListGeneric(); ///< Uses avdevice_list_devices
+    static QVector<VideoMode> getScreenModes(); ///< Each screen, and all of them, at a few frame rates
 
 public:
     const QString devName; ///< Short name of the device
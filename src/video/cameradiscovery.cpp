@@ -0,0 +1,121 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "cameradiscovery.h"
+#include "cameradevice.h"
+
+#include <QDebug>
+#include <QFileSystemWatcher>
+#include <QTimer>
+#include <QtConcurrent/QtConcurrentRun>
+
+#ifdef Q_OS_WIN
+#include <objbase.h>
+#endif
+
+CameraDiscovery& CameraDiscovery::getInstance()
+{
+    static CameraDiscovery instance;
+    return instance;
+}
+
+CameraDiscovery::CameraDiscovery()
+    : hotplugTimer{new QTimer{this}}
+{
+    connect(&scanWatcher, &QFutureWatcher<Devices>::finished, this, &CameraDiscovery::onScanFinished);
+
+    hotplugTimer->setSingleShot(true);
+    hotplugTimer->setInterval(500);
+    connect(hotplugTimer, &QTimer::timeout, this, &CameraDiscovery::refresh);
+
+#ifdef Q_OS_LINUX
+    // udev creates and removes the video nodes, watching /dev needs no extra dependency
+    hotplugWatcher = new QFileSystemWatcher{{"/dev"}, this};
+    connect(hotplugWatcher, &QFileSystemWatcher::directoryChanged, this, [this]()
+    {
+        hotplugTimer->start();
+    });
+#endif
+}
+
+void CameraDiscovery::refresh()
+{
+    if (scanWatcher.isRunning())
+    {
+        rescan = true;
+        return;
+    }
+
+    rescan = false;
+    scanWatcher.setFuture(QtConcurrent::run(&CameraDiscovery::scan));
+}
+
+bool CameraDiscovery::isReady() const
+{
+    return ready;
+}
+
+QVector<QPair<QString, QString>> CameraDiscovery::getDeviceList() const
+{
+    return devices.list;
+}
+
+QVector<VideoMode> CameraDiscovery::getVideoModes(const QString& devName) const
+{
+    // the screens are known right away, and only from the GUI thread
+    if (CameraDevice::isScreen(devName))
+        return CameraDevice::getVideoModes(devName);
+
+    return devices.modes.value(devName);
+}
+
+void CameraDiscovery::onScanFinished()
+{
+    devices = scanWatcher.result();
+    ready = true;
+    emit devicesChanged();
+
+    if (rescan)
+        refresh();
+}
+
+CameraDiscovery::Devices CameraDiscovery::scan()
+{
+#ifdef Q_OS_WIN
+    // DirectShow needs COM in this thread too
+    CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+#endif
+
+    Devices found;
+    found.list = CameraDevice::getDeviceList();
+    for (const QPair<QString, QString>& device : found.list)
+    {
+        if (device.first == "none" || CameraDevice::isScreen(device.first))
+            continue;
+
+        found.modes[device.first] = CameraDevice::getVideoModes(device.first);
+    }
+
+#ifdef Q_OS_WIN
+    CoUninitialize();
+#endif
+
+    qDebug() << "Found" << found.list.size() << "video devices";
+    return found;
+}
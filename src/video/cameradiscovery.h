@@ -0,0 +1,84 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CAMERADISCOVERY_H
+#define CAMERADISCOVERY_H
+
+#include <QObject>
+#include <QHash>
+#include <QMutex>
+#include <QPair>
+#include <QString>
+#include <QVector>
+#include <QFutureWatcher>
+#include "videomode.h"
+
+class QFileSystemWatcher;
+class QTimer;
+
+/// Lists the video devices and probes their modes in the background,
+/// so the GUI never waits on slow camera drivers. The results are cached
+/// until the next scan, which runs again when devices are plugged in or out.
+/// All methods must be called from the GUI thread.
+class CameraDiscovery : public QObject
+{
+    Q_OBJECT
+
+public:
+    static CameraDiscovery& getInstance();
+
+    /// Starts a new scan in the background, unless one is already running
+    void refresh();
+    /// True once a scan finished, before that the lists are empty
+    bool isReady() const;
+
+    /// Device names and descriptions, same as CameraDevice::getDeviceList
+    QVector<QPair<QString, QString>> getDeviceList() const;
+    /// The modes of a device found by the last scan
+    QVector<VideoMode> getVideoModes(const QString& devName) const;
+
+signals:
+    void devicesChanged(); ///< A scan finished
+
+private slots:
+    void onScanFinished();
+
+private:
+    CameraDiscovery();
+    CameraDiscovery(const CameraDiscovery&) = delete;
+    CameraDiscovery& operator=(const CameraDiscovery&) = delete;
+
+    struct Devices
+    {
+        QVector<QPair<QString, QString>> list;
+        QHash<QString, QVector<VideoMode>> modes;
+    };
+
+    static Devices scan(); ///< Runs in a worker thread
+
+private:
+    Devices devices;
+    bool ready = false;
+    bool rescan = false; ///< A refresh was asked for while scanning
+    QFutureWatcher<Devices> scanWatcher;
+    QFileSystemWatcher* hotplugWatcher = nullptr;
+    QTimer* hotplugTimer; ///< Waits for the device nodes to settle after a hotplug
+};
+
+#endif // CAMERADISCOVERY_H
@@ -22,26 +22,109 @@ extern "C" {
 #include <libavdevice/avdevice.h>
 #include <libavformat/avformat.h>
 #include <libswscale/swscale.h>
+
+// generic hardware decoding through a hw_device_ctx appeared with libavcodec 58
+#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(58, 0, 0)
+#define CAMERA_HWACCEL
+#include <libavutil/hwcontext.h>
+#endif
 }
+#include <QCoreApplication>
 #include <QMutexLocker>
 #include <QDebug>
+#include <QThread>
 #include <QtConcurrent/QtConcurrentRun>
 #include <memory>
 #include <functional>
 #include "camerasource.h"
 #include "cameradevice.h"
 #include "videoframe.h"
+#include "framebufferpool.h"
+#include "src/persistence/settings.h"
+#include "src/platform/threadpriority.h"
+#include "src/captureclock.h"
+#ifdef Q_OS_LINUX
+#include "src/platform/camera/v4l2.h"
+#endif
+#ifdef Q_OS_MACX
+#include "src/platform/camera/avfoundation.h"
+#endif
+#ifdef Q_OS_WIN
+#include "src/platform/camera/mediafoundation.h"
+#endif
+
+// the cameras we capture without libavdevice on some platforms
+#if defined(Q_OS_LINUX) || defined(Q_OS_MACX) || defined(Q_OS_WIN)
+#define CAMERA_NATIVE_CAPTURE
+#endif
 
 CameraSource* CameraSource::instance{nullptr};
 
+namespace
+{
+
+// frames waiting to be delivered, a subscriber that can't keep up only gets the latest ones
+const int maxQueuedFrames = 2;
+
+// how long the device stays open after the last subscriber left, opening a camera takes seconds
+const int closeGracePeriod = 3000;
+
+#ifdef CAMERA_HWACCEL
+/// Picks the hardware format of the decoder if it's offered, software decoding otherwise
+static AVPixelFormat getHwFormat(AVCodecContext* ctx, const AVPixelFormat* formats)
+{
+    int hwPixFmt = *static_cast<int*>(ctx->opaque);
+    for (const AVPixelFormat* format = formats; *format != AV_PIX_FMT_NONE; ++format)
+    {
+        if (*format == hwPixFmt)
+            return *format;
+    }
+
+    qWarning() << "The hardware decoder can't decode this stream, using the software one";
+    return avcodec_default_get_format(ctx, formats);
+}
+#endif
+
+class FrameDeliveryThread : public QThread
+{
+public:
+    explicit FrameDeliveryThread(std::function<void()> deliver)
+        : deliver{deliver}
+    {
+    }
+
+protected:
+    virtual void run() final override
+    {
+        deliver();
+    }
+
+private:
+    std::function<void()> deliver;
+};
+
+}
+
 CameraSource::CameraSource()
-    : deviceName{"none"}, device{nullptr}, mode(VideoMode{0,0,0,0}),
+    : framePool{std::make_shared<FrameBufferPool>()},
+      deviceName{"none"}, device{nullptr}, mode(VideoMode{0,0,0,0}),
       cctx{nullptr}, cctxOrig{nullptr}, videoStreamIndex{-1},
-      _isOpen{false}, streamBlocker{false}, subscriptions{0}
+      _isOpen{false}, streamBlocker{false}, subscriptions{0},
+      deliveryThread{new FrameDeliveryThread(std::bind(&CameraSource::deliverFrames, this))},
+      streaming{false}
 {
     subscriptions = 0;
     av_register_all();
     avdevice_register_all();
+
+    // we're unsubscribed from any thread, the CoreAV one may be gone by the time the timer fires
+    closeTimer.setSingleShot(true);
+    closeTimer.setInterval(closeGracePeriod);
+    closeTimer.moveToThread(QCoreApplication::instance()->thread());
+    QObject::connect(&closeTimer, &QTimer::timeout, [this]()
+    {
+        closeLingeringDevice();
+    });
 }
 
 CameraSource& CameraSource::getInstance()
@@ -77,12 +160,19 @@ void CameraSource::open(const QString& DeviceName, VideoMode Mode)
 
     if (DeviceName == deviceName && Mode == mode)
     {
-        streamBlocker = false;
+        unblockStream();
         return;
     }
 
-    if (subscriptions)
+    if (DeviceName == deviceName && (subscriptions || lingering) && changeModeInPlace(Mode))
+    {
+        unblockStream();
+        return;
+    }
+
+    if (subscriptions || lingering)
         closeDevice();
+    lingering = false;
 
     deviceName = DeviceName;
     mode = Mode;
@@ -91,7 +181,29 @@ void CameraSource::open(const QString& DeviceName, VideoMode Mode)
     if (subscriptions && _isOpen)
         openDevice();
 
-    streamBlocker = false;
+    unblockStream();
+}
+
+/**
+ * @brief Opens the current device again, so it picks up changed decoder settings.
+ */
+void CameraSource::reopen()
+{
+    streamBlocker = true;
+    QMutexLocker l{&biglock};
+
+    if (lingering)
+    {
+        closeDevice();
+        lingering = false;
+    }
+    else if (subscriptions && _isOpen)
+    {
+        closeDevice();
+        openDevice();
+    }
+
+    unblockStream();
 }
 
 void CameraSource::close()
@@ -109,18 +221,13 @@ CameraSource::~CameraSource()
     QMutexLocker l{&biglock};
 
     if (!_isOpen)
-        return;
-
-    // Free all remaining VideoFrame
-    // Locking must be done precisely this way to avoid races
-    for (int i = 0; i < freelist.size(); i++)
     {
-        std::shared_ptr<VideoFrame> vframe = freelist[i].lock();
-        if (!vframe)
-            continue;
-        vframe->releaseFrame();
+        deliveryThread->wait();
+        return;
     }
 
+    releaseFrames();
+
     if (cctx)
         avcodec_free_context(&cctx);
     if (cctxOrig)
@@ -128,18 +235,24 @@ CameraSource::~CameraSource()
 
     if (device)
     {
-        for(int i = 0; i < subscriptions; i++)
+        const int opened = subscriptions + (lingering ? 1 : 0);
+        for(int i = 0; i < opened; i++)
             device->close();
         device = nullptr;
     }
 
+#ifdef CAMERA_NATIVE_CAPTURE
+    delete nativeCapture;
+    nativeCapture = nullptr;
+#endif
+
     // Memfence so the stream thread sees a nullptr device
     std::atomic_thread_fence(std::memory_order_release);
     l.unlock();
 
-    // Synchronize with our stream thread
-    while (streamFuture.isRunning())
-        QThread::yieldCurrentThread();
+    // Synchronize with our stream thread, the delivery stops with it
+    streamFuture.waitForFinished();
+    deliveryThread->wait();
 }
 
 bool CameraSource::subscribe()
@@ -152,6 +265,14 @@ bool CameraSource::subscribe()
         return true;
     }
 
+    // the device was kept open for us, with the reference of the last subscriber
+    if (lingering)
+    {
+        lingering = false;
+        ++subscriptions;
+        return true;
+    }
+
     if (openDevice())
     {
         ++subscriptions;
@@ -174,7 +295,7 @@ void CameraSource::unsubscribe()
 {
     streamBlocker = true;
     QMutexLocker l{&biglock};
-    streamBlocker = false;
+    unblockStream();
 
     if (!_isOpen)
     {
@@ -182,7 +303,7 @@ void CameraSource::unsubscribe()
         return;
     }
 
-    if (!device)
+    if (!device && !nativeCapture)
     {
         qWarning() << "Unsubscribing with zero subscriber";
         return;
@@ -190,14 +311,11 @@ void CameraSource::unsubscribe()
 
     if (subscriptions - 1 == 0)
     {
-        closeDevice();
-        l.unlock();
-
-        // Synchronize with our stream thread
-        while (streamFuture.isRunning())
-            QThread::yieldCurrentThread();
+        // keep the stream going with its device reference, in case someone subscribes again soon
+        lingering = true;
+        QMetaObject::invokeMethod(&closeTimer, "start", Qt::QueuedConnection);
     }
-    else
+    else if (device)
     {
         device->close();
     }
@@ -214,6 +332,58 @@ bool CameraSource::openDevice()
         return true;
     }
 
+#ifdef Q_OS_LINUX
+    if (nativeCapture)
+        return true;
+
+    // Raw modes need neither libavdevice nor a decoder, we stream the driver's buffers directly
+    if (mode && v4l2::Capture::isSupported(mode.pixel_format))
+        nativeCapture = v4l2::Capture::open(deviceName, mode);
+
+    if (nativeCapture)
+    {
+        isScreen = false;
+        startStreaming();
+        return true;
+    }
+#endif
+
+#ifdef Q_OS_MACX
+    if (nativeCapture)
+        return true;
+
+    // The cameras give us IOSurfaces we can draw as they are, only the screen goes through libavdevice
+    if (!deviceName.startsWith(avfoundation::CAPTURE_SCREEN))
+        nativeCapture = avfoundation::Capture::open(deviceName, mode);
+
+    if (nativeCapture)
+    {
+        isScreen = false;
+        startStreaming();
+        return true;
+    }
+#endif
+
+#ifdef Q_OS_WIN
+    if (nativeCapture)
+        return true;
+
+    // libavdevice only knows DirectShow, the Media Foundation cameras have no fallback
+    if (deviceName.startsWith(MediaFoundation::DEVICE_PREFIX))
+    {
+        nativeCapture = MediaFoundation::Capture::open(deviceName.mid(MediaFoundation::DEVICE_PREFIX.size()), mode);
+        if (!nativeCapture)
+        {
+            qWarning() << "Failed to open the Media Foundation camera"<<deviceName;
+            return false;
+        }
+
+        isScreen = false;
+        startStreaming();
+        return true;
+    }
+#endif
+
     // We need to create a new CameraDevice
     AVCodec* codec;
     if (mode)
@@ -226,6 +396,9 @@ bool CameraSource::openDevice()
         return false;
     }
 
+    isScreen = CameraDevice::isScreen(deviceName);
+    lastScreenFrame.invalidate();
+
     // We need to open the device as many time as we already have subscribers,
     // otherwise the device could get closed while we still have subscribers
     for (int i = 0; i < subscriptions; i++)
@@ -256,56 +429,175 @@ bool CameraSource::openDevice()
 
     cctx->refcounted_frames = 1;
 
+    bool hwAccel = Settings::getInstance().getCamVideoHwAccel() && setupHwDecoder(codec);
+
     // Open codec
     if(avcodec_open2(cctx, codec, nullptr)<0)
     {
         avcodec_free_context(&cctx);
-        return false;
+        hwPixFmt = -1;
+
+        // give the software decoder a try
+        if (!hwAccel)
+            return false;
+
+        qWarning() << "Failed to open the hardware decoder, using the software one";
+        cctx = avcodec_alloc_context3(codec);
+        if (avcodec_copy_context(cctx, cctxOrig) != 0)
+            return false;
+
+        cctx->refcounted_frames = 1;
+        if (avcodec_open2(cctx, codec, nullptr) < 0)
+        {
+            avcodec_free_context(&cctx);
+            return false;
+        }
     }
 
+    startStreaming();
+    return true;
+}
+
+void CameraSource::startStreaming()
+{
     if (streamFuture.isRunning())
+    {
         qDebug() << "The stream thread is already running! Keeping the current one open.";
+    }
     else
+    {
+        // the previous delivery ends with its stream thread
+        deliveryThread->wait();
+
+        queueLock.lock();
+        streaming = true;
+        queueLock.unlock();
+
+        deliveryThread->start();
         streamFuture = QtConcurrent::run(std::bind(&CameraSource::stream, this));
+    }
 
     // Synchronize with our stream thread
     while (!streamFuture.isRunning())
         QThread::yieldCurrentThread();
 
     emit deviceOpened();
+}
 
-    return true;
+void CameraSource::closeLingeringDevice()
+{
+    streamBlocker = true;
+    QMutexLocker l{&biglock};
+    unblockStream();
+
+    if (!lingering)
+        return;
+
+    lingering = false;
+    closeDevice();
+    l.unlock();
+
+    // Synchronize with our stream thread, the delivery stops with it
+    streamFuture.waitForFinished();
+    deliveryThread->wait();
 }
 
-void CameraSource::closeDevice()
+/**
+ * @brief Switches the open device to another mode of the same device without closing it.
+ * Only the native V4L2 and AVFoundation captures can renegotiate, libavdevice needs a new context for each mode.
+ * @return False if the device must be reopened instead.
+ */
+bool CameraSource::changeModeInPlace(VideoMode newMode)
 {
-    qDebug() << "Closing device "<<deviceName;
+#ifdef Q_OS_LINUX
+    if (!nativeCapture || !newMode || !v4l2::Capture::isSupported(newMode.pixel_format))
+        return false;
+
+    // the frames point into the driver's buffers, which get remapped
+    releaseFrames();
+    queueLock.lock();
+    frameQueue.clear();
+    queueLock.unlock();
 
-    // Free all remaining VideoFrame
-    // Locking must be done precisely this way to avoid races
-    for (int i = 0; i < freelist.size(); i++)
+    if (nativeCapture->setMode(newMode))
     {
-        std::shared_ptr<VideoFrame> vframe = freelist[i].lock();
-        if (!vframe)
-            continue;
-        vframe->releaseFrame();
+        qDebug() << "Changed the mode of" << deviceName << "in place";
+        mode = newMode;
+        emit deviceOpened();
+        return true;
     }
-    freelist.clear();
-    freelist.squeeze();
+#elif defined(Q_OS_MACX)
+    // the frames hold their own pixel buffers, they don't need to be released first
+    if (nativeCapture && newMode && nativeCapture->setMode(newMode))
+    {
+        qDebug() << "Changed the mode of" << deviceName << "in place";
+        mode = newMode;
+        emit deviceOpened();
+        return true;
+    }
+#else
+    Q_UNUSED(newMode);
+#endif
+
+    return false;
+}
+
+void CameraSource::closeDevice()
+{
+    qDebug() << "Closing device "<<deviceName;
+
+    releaseFrames();
+
+    queueLock.lock();
+    frameQueue.clear();
+    queueLock.unlock();
 
     // Free our resources and close the device
     videoStreamIndex = -1;
     avcodec_free_context(&cctx);
+    hwPixFmt = -1;
     avcodec_close(cctxOrig);
     cctxOrig = nullptr;
     while (device && !device->close()) {}
     device = nullptr;
+#ifdef CAMERA_NATIVE_CAPTURE
+    delete nativeCapture;
+    nativeCapture = nullptr;
+#endif
     // Memfence so the stream thread sees a nullptr device
     std::atomic_thread_fence(std::memory_order_release);
 }
 
 void CameraSource::stream()
 {
+    // we run on a pool thread, so the priority is only ours while we stream
+    const bool realtime = Settings::getInstance().getRealtimeThreads()
+                          && Platform::setThreadRealtime(Platform::ThreadClass::Video);
+
+    auto queueFrame = [=](AVFrame* frame, std::shared_ptr<void> nativeBuffer, qint64 captureTime)
+    {
+        freelistLock.lock();
+
+        int freeFreelistSlot = getFreelistSlotLockless();
+        auto frameFreeCb = std::bind(&CameraSource::freelistCallback, this, freeFreelistSlot, freelistGeneration);
+        std::shared_ptr<VideoFrame> vframe = std::make_shared<VideoFrame>(frame, frameFreeCb, framePool);
+        if (nativeBuffer)
+            vframe->setNativeBuffer(nativeBuffer);
+        vframe->setCaptureTime(captureTime);
+        freelist[freeFreelistSlot] = vframe;
+        freelistLock.unlock();
+
+        // Hand the frame over to the delivery thread, dropping the oldest one if it's behind.
+        // The dropped frame is only deleted once we've unlocked, it takes the freelistLock.
+        std::shared_ptr<VideoFrame> dropped;
+        queueLock.lock();
+        if (frameQueue.size() >= maxQueuedFrames)
+            dropped = frameQueue.dequeue();
+        frameQueue.enqueue(vframe);
+        frameQueued.wakeOne();
+        queueLock.unlock();
+    };
+
     auto streamLoop = [=]()
     {
         AVFrame* frame = av_frame_alloc();
@@ -316,24 +608,34 @@ void CameraSource::stream()
         AVPacket packet;
         if (av_read_frame(device->context, &packet)<0)
             return;
+        // the packet is what the device captured, decoding it is already on our clock
+        const qint64 captureTime = CaptureClock::now();
 
         // Only keep packets from the right stream;
         if (packet.stream_index==videoStreamIndex)
         {
+            // The desktop grabbers send raw images, so we can skip those that didn't change before decoding
+            if (isScreen && isUnchangedScreen(packet.data, packet.size))
+            {
+                av_frame_free(&frame);
+                av_packet_unref(&packet);
+                return;
+            }
+
             // Decode video frame
             int frameFinished;
             avcodec_decode_video2(cctx, frame, &frameFinished, &packet);
             if (!frameFinished)
                 return;
 
-            freelistLock.lock();
+            if (frame->format == hwPixFmt)
+            {
+                frame = downloadHwFrame(frame);
+                if (!frame)
+                    return;
+            }
 
-            int freeFreelistSlot = getFreelistSlotLockless();
-            auto frameFreeCb = std::bind(&CameraSource::freelistCallback, this, freeFreelistSlot);
-            std::shared_ptr<VideoFrame> vframe = std::make_shared<VideoFrame>(frame, frameFreeCb);
-            freelist.append(vframe);
-            freelistLock.unlock();
-            emit frameAvailable(vframe);
+            queueFrame(frame, nullptr, captureTime);
         }
 
       // Free the packet that was allocated by av_read_frame
@@ -345,35 +647,262 @@ void CameraSource::stream()
 
         // When a thread makes device null, it releases it, so we acquire here
         std::atomic_thread_fence(std::memory_order_acquire);
-        if (!device)
+        if (!device && !nativeCapture)
         {
             biglock.unlock();
-            return;
+            break;
         }
 
+#if defined(Q_OS_LINUX)
+        if (nativeCapture)
+        {
+            // the frame points into the driver's buffer, no packet to copy or decode
+            if (AVFrame* frame = nativeCapture->grabFrame())
+                queueFrame(frame, nullptr, CaptureClock::now());
+        }
+        else
+        {
+            streamLoop();
+        }
+#elif defined(Q_OS_MACX)
+        if (nativeCapture)
+        {
+            // the frame points into the camera's pixel buffer, which the renderers can also draw directly
+            std::shared_ptr<void> pixelBuffer;
+            if (AVFrame* frame = nativeCapture->grabFrame(pixelBuffer))
+                queueFrame(frame, pixelBuffer, CaptureClock::now());
+        }
+        else
+        {
+            streamLoop();
+        }
+#elif defined(Q_OS_WIN)
+        if (nativeCapture)
+        {
+            // the frame points into the reader's pooled buffer, already NV12 and decoded on the GPU if it could
+            if (AVFrame* frame = nativeCapture->grabFrame())
+                queueFrame(frame, nullptr, CaptureClock::now());
+        }
+        else
+        {
+            streamLoop();
+        }
+#else
         streamLoop();
+#endif
 
         // Give a chance to other functions to pick up the lock if needed
         biglock.unlock();
-        while (streamBlocker)
-            QThread::yieldCurrentThread();
-        QThread::yieldCurrentThread();
+        if (streamBlocker)
+        {
+            QMutexLocker l{&blockerLock};
+            while (streamBlocker)
+                streamUnblocked.wait(&blockerLock);
+        }
     }
+
+    if (realtime)
+        Platform::resetThreadPriority();
+
+    // let the delivery thread finish
+    QMutexLocker l{&queueLock};
+    streaming = false;
+    frameQueued.wakeAll();
 }
 
-void CameraSource::freelistCallback(int freelistIndex)
+void CameraSource::deliverFrames()
+{
+    forever {
+        std::shared_ptr<VideoFrame> vframe;
+
+        {
+            QMutexLocker l{&queueLock};
+            while (frameQueue.isEmpty() && streaming)
+                frameQueued.wait(&queueLock);
+
+            if (frameQueue.isEmpty())
+                return;
+
+            vframe = frameQueue.dequeue();
+        }
+
+        prepareFrame(vframe);
+        emit frameAvailable(vframe);
+    }
+}
+
+void CameraSource::unblockStream()
+{
+    streamBlocker = false;
+
+    // the stream thread checks streamBlocker again with the blockerLock held, so it can't miss this
+    QMutexLocker l{&blockerLock};
+    streamUnblocked.wakeAll();
+}
+
+/**
+ * @brief Sets the decoder context up to decode on the GPU, if the codec supports it on this system.
+ * @return False if the software decoder will be used.
+ */
+bool CameraSource::setupHwDecoder(AVCodec* codec)
+{
+#ifdef CAMERA_HWACCEL
+#if defined(Q_OS_WIN)
+    const char* deviceName = "dxva2";
+#elif defined(Q_OS_OSX)
+    const char* deviceName = "videotoolbox";
+#else
+    const char* deviceName = "vaapi";
+#endif
+
+    AVHWDeviceType type = av_hwdevice_find_type_by_name(deviceName);
+    if (type == AV_HWDEVICE_TYPE_NONE)
+        return false;
+
+    for (int i = 0;; ++i)
+    {
+        const AVCodecHWConfig* config = avcodec_get_hw_config(codec, i);
+        if (!config)
+        {
+            qDebug() << "No hardware decoder for" << codec->name;
+            return false;
+        }
+
+        if ((config->methods & AV_CODEC_HW_CONFIG_METHOD_HW_DEVICE_CTX) && config->device_type == type)
+        {
+            hwPixFmt = config->pix_fmt;
+            break;
+        }
+    }
+
+    AVBufferRef* hwDevice = nullptr;
+    if (av_hwdevice_ctx_create(&hwDevice, type, nullptr, nullptr, 0) < 0)
+    {
+        qWarning() << "Failed to create the" << deviceName << "device";
+        hwPixFmt = -1;
+        return false;
+    }
+
+    // the codec context takes our reference
+    cctx->hw_device_ctx = hwDevice;
+    cctx->opaque = &hwPixFmt;
+    cctx->get_format = getHwFormat;
+    qDebug() << "Decoding the camera with" << deviceName;
+    return true;
+#else
+    Q_UNUSED(codec);
+    return false;
+#endif
+}
+
+/**
+ * @brief Downloads a frame decoded on the GPU, and frees it.
+ *
+ * The download goes straight to I420 if the hardware supports it, so the frame
+ * doesn't have to be converted again before being encoded.
+ * @return The frame in memory, or nullptr on failure.
+ */
+AVFrame* CameraSource::downloadHwFrame(AVFrame* hwFrame)
+{
+#ifdef CAMERA_HWACCEL
+    AVFrame* frame = av_frame_alloc();
+    if (!frame)
+    {
+        av_frame_free(&hwFrame);
+        return nullptr;
+    }
+
+    AVPixelFormat* formats = nullptr;
+    if (av_hwframe_transfer_get_formats(hwFrame->hw_frames_ctx, AV_HWFRAME_TRANSFER_DIRECTION_FROM, &formats, 0) >= 0)
+    {
+        for (AVPixelFormat* format = formats; *format != AV_PIX_FMT_NONE; ++format)
+        {
+            if (*format == AV_PIX_FMT_YUV420P)
+                frame->format = AV_PIX_FMT_YUV420P;
+        }
+
+        av_free(formats);
+    }
+
+    if (av_hwframe_transfer_data(frame, hwFrame, 0) < 0)
+    {
+        qWarning() << "Failed to download a frame from the hardware decoder";
+        av_frame_free(&frame);
+    }
+    else
+    {
+        av_frame_copy_props(frame, hwFrame);
+        frame->opaque = nullptr;
+    }
+
+    av_frame_free(&hwFrame);
+    return frame;
+#else
+    return hwFrame;
+#endif
+}
+
+/**
+ * @brief Tells if a desktop image is the same as the last one, and recent enough to skip this one.
+ *
+ * Still images are sent again once a second, so the peers get a keyframe now and then.
+ */
+bool CameraSource::isUnchangedScreen(const uint8_t* data, int size)
+{
+    const qint64 stillImageInterval = 1000;
+
+    uint hash = qHash(QByteArray::fromRawData(reinterpret_cast<const char*>(data), size));
+    if (hash == lastScreenHash && lastScreenFrame.isValid()
+            && lastScreenFrame.elapsed() < stillImageInterval)
+        return true;
+
+    lastScreenHash = hash;
+    lastScreenFrame.start();
+    return false;
+}
+
+void CameraSource::freelistCallback(int freelistIndex, int generation)
 {
     QMutexLocker l{&freelistLock};
+
+    // the freelist was cleared since, the slot may belong to another frame now
+    if (generation != freelistGeneration)
+        return;
+
     freelist[freelistIndex].reset();
+    freeSlots.push(freelistIndex);
 }
 
 int CameraSource::getFreelistSlotLockless()
 {
-    int size = freelist.size();
-    for (int i = 0; i < size; ++i)
-        if (freelist[i].expired())
-            return i;
+    if (!freeSlots.isEmpty())
+        return freeSlots.pop();
+
+    freelist.append(std::weak_ptr<VideoFrame>());
+    return freelist.size() - 1;
+}
+
+void CameraSource::releaseFrames()
+{
+    // Take the frames that are still alive out of the freelist first, releasing them outside of
+    // the freelistLock since the last reference we hold could be the one deleting the frame
+    QVector<std::shared_ptr<VideoFrame>> frames;
 
-    freelist.resize(size + (size>>1) + 4); // Arbitrary growth strategy, should work well
-    return size;
+    freelistLock.lock();
+    for (const std::weak_ptr<VideoFrame>& weakFrame : freelist)
+    {
+        std::shared_ptr<VideoFrame> vframe = weakFrame.lock();
+        if (vframe)
+            frames.append(vframe);
+    }
+
+    freelist.clear();
+    freelist.squeeze();
+    freeSlots.clear();
+    freeSlots.squeeze();
+    ++freelistGeneration;
+    freelistLock.unlock();
+
+    for (std::shared_ptr<VideoFrame>& vframe : frames)
+        vframe->releaseFrame();
 }
@@ -24,12 +24,26 @@
 #include <QString>
 #include <QFuture>
 #include <QVector>
+#include <QQueue>
+#include <QStack>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QElapsedTimer>
+#include <QTimer>
 #include <atomic>
+#include <memory>
 #include "src/video/videosource.h"
 #include "src/video/videomode.h"
 
 class CameraDevice;
+class FrameBufferPool;
+class QThread;
 struct AVCodecContext;
+struct AVCodec;
+struct AVFrame;
+namespace v4l2 { class Capture; }
+namespace avfoundation { class Capture; }
+namespace MediaFoundation { class Capture; }
 
 /**
  * This class is a wrapper to share a camera's captured video frames
@@ -40,6 +54,8 @@ struct AVCodecContext;
  * The source is lazy in the sense that it will only keep the video
  * device open as long as there are subscribers, the source can be
  * open but the device closed if there are zero subscribers.
+ * The device stays open for a moment after the last subscriber leaves,
+ * so going from the settings preview to a call doesn't reopen it.
  **/
 
 class CameraSource : public VideoSource
@@ -54,6 +70,7 @@ public:
     void open();
     void open(const QString& deviceName);
     void open(const QString& deviceName, VideoMode mode);
+    void reopen();
     void close(); ///< Equivalent to opening the source with the video device "none". Stops streaming.
     bool isOpen();
 
@@ -67,34 +84,69 @@ signals:
 private:
     CameraSource();
     ~CameraSource();
-    /// Blocking. Decodes video stream and emits new frames.
+    /// Blocking. Decodes video stream and queues new frames for deliverFrames.
     /// Designed to run in its own thread.
     void stream();
+    /// Blocking. Emits the frames queued by stream, until it returns.
+    /// Runs in the deliveryThread, so slow subscribers like the encoder never hold up the capture.
+    void deliverFrames();
+    void unblockStream(); ///< Resets the streamBlocker and wakes the stream thread up
+    bool setupHwDecoder(AVCodec* codec);
+    AVFrame* downloadHwFrame(AVFrame* hwFrame);
+    bool isUnchangedScreen(const uint8_t* data, int size);
     /// All VideoFrames must be deleted or released before we can close the device
     /// or the device will forcibly free them, and then ~VideoFrame() will double free.
     /// In theory very careful coding from our users could ensure all VideoFrames
     /// die before unsubscribing, even the ones currently in flight in the metatype system.
     /// But that's just asking for trouble and mysterious crashes, so we'll just
     /// maintain a freelist and have all VideoFrames tell us when they die so we can forget them.
-    void freelistCallback(int freelistIndex);
-    /// Get the index of a free slot in the freelist
+    void freelistCallback(int freelistIndex, int generation);
+    /// Get the index of a free slot in the freelist, in constant time
     /// Callers must hold the freelistLock
     int getFreelistSlotLockless();
+    /// Releases all the frames that are still alive and empties the freelist
+    void releaseFrames();
     bool openDevice(); ///< Callers must own the biglock. Actually opens the video device and starts streaming.
     void closeDevice(); ///< Callers must own the biglock. Actually closes the video device and stops streaming.
+    void startStreaming(); ///< Callers must own the biglock. Starts the stream and delivery threads if needed.
+    bool changeModeInPlace(VideoMode newMode); ///< Callers must own the biglock and block the stream.
+    void closeLingeringDevice(); ///< Closes the device if nobody subscribed again during the grace period
 
 private:
     QVector<std::weak_ptr<VideoFrame>> freelist; ///< Frames that need freeing before we can safely close the device
+    QStack<int> freeSlots; ///< Indices of the empty slots of the freelist
+    int freelistGeneration = 0; ///< Incremented when the freelist is emptied, so late callbacks are ignored
+    std::shared_ptr<FrameBufferPool> framePool; ///< For the conversions of our frames
     QFuture<void> streamFuture; ///< Future of the streaming thread
     QString deviceName; ///< Short name of the device for CameraDevice's open(QString)
     CameraDevice* device; ///< Non-owning pointer to an open CameraDevice, or nullptr. Not atomic, synced with memfences when becomes null.
+#ifdef Q_OS_MACX
+    avfoundation::Capture* nativeCapture = nullptr; ///< Replaces the device and decoder for cameras on macOS, synced like device
+#elif defined(Q_OS_WIN)
+    MediaFoundation::Capture* nativeCapture = nullptr; ///< Replaces the device and decoder for Media Foundation cameras, synced like device
+#else
+    v4l2::Capture* nativeCapture = nullptr; ///< Replaces the device and decoder for raw camera modes on Linux, synced like device
+#endif
     VideoMode mode; ///< What mode we tried to open the device in, all zeros means default mode
     AVCodecContext* cctx, *cctxOrig; ///< Codec context of the camera's selected video stream
     int videoStreamIndex; ///< A camera can have multiple streams, this is the one we're decoding
+    int hwPixFmt = -1; ///< Pixel format of the frames decoded on the GPU, AV_PIX_FMT_NONE without hardware decoding
     QMutex biglock, freelistLock; ///< True when locked. Faster than mutexes for video decoding.
     std::atomic_bool _isOpen;
     std::atomic_bool streamBlocker; ///< Holds the streaming thread still when true
     std::atomic_int subscriptions; ///< Remember how many times we subscribed for RAII
+    bool lingering = false; ///< The device is still open without subscribers, with the biglock
+    QTimer closeTimer; ///< Closes a lingering device, lives in the GUI thread
+    QMutex blockerLock;
+    QWaitCondition streamUnblocked; ///< Woken when streamBlocker is reset, with the blockerLock
+    std::unique_ptr<QThread> deliveryThread;
+    QQueue<std::shared_ptr<VideoFrame>> frameQueue; ///< Decoded frames not delivered yet, the oldest are dropped first
+    QMutex queueLock; ///< Protects frameQueue and streaming
+    QWaitCondition frameQueued;
+    bool streaming; ///< False once the stream thread is done, deliverFrames stops then
+    bool isScreen = false; ///< True when sharing the desktop, whose frames are mostly identical
+    uint lastScreenHash = 0; ///< Hash of the last captured desktop image we delivered
+    QElapsedTimer lastScreenFrame; ///< Since we last delivered a desktop image
 
     static CameraSource* instance;
 };
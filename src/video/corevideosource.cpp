@@ -23,11 +23,12 @@ extern "C" {
 #include <libavutil/imgutils.h>
 }
 #include "corevideosource.h"
+#include "framebufferpool.h"
 #include "videoframe.h"
 
 CoreVideoSource::CoreVideoSource()
     : subscribers{0}, deleteOnClose{false},
-    stopped{false}
+    stopped{false}, framePool{std::make_shared<FrameBufferPool>()}
 {
 }
 
@@ -40,44 +41,36 @@ void CoreVideoSource::pushFrame(const vpx_image_t* vpxframe)
 
     std::shared_ptr<VideoFrame> vframe;
     AVFrame* avframe;
-    uint8_t* buf;
     int width = vpxframe->d_w, height = vpxframe->d_h;
-    int dstStride, srcStride, minStride;
 
     if (subscribers <= 0)
         return;
 
-    avframe = av_frame_alloc();
+    // the frames of the previous VideoFrames are recycled
+    avframe = framePool->acquire(width, height, AV_PIX_FMT_YUV420P);
     if (!avframe)
         return;
-    avframe->width = width;
-    avframe->height = height;
-    avframe->format = AV_PIX_FMT_YUV420P;
 
-    int imgBufferSize = av_image_get_buffer_size(AV_PIX_FMT_YUV420P, width, height, 1);
-    buf = (uint8_t*)av_malloc(imgBufferSize);
-    if (!buf)
+    // The planes of toxav are only valid during its callback, this is the only copy of them,
+    // the frame is converted straight to the size it's displayed at by VideoSurface
+    for (int plane = 0; plane < 3; ++plane)
     {
-        av_frame_free(&avframe);
-        return;
+        int dstStride = avframe->linesize[plane], srcStride = vpxframe->stride[plane];
+        int rows = plane == 0 ? height : (height + 1) / 2;
+
+        if (dstStride == srcStride)
+        {
+            memcpy(avframe->data[plane], vpxframe->planes[plane], dstStride * rows);
+            continue;
+        }
+
+        int minStride = std::min(dstStride, srcStride);
+        for (int i = 0; i < rows; i++)
+            memcpy(avframe->data[plane] + dstStride * i, vpxframe->planes[plane] + srcStride * i, minStride);
     }
-    avframe->opaque = buf;
-
-    uint8_t** data = avframe->data;
-    int* linesize = avframe->linesize;
-    av_image_fill_arrays(data, linesize, buf, AV_PIX_FMT_YUV420P, width, height, 1);
-
-    dstStride=avframe->linesize[0], srcStride=vpxframe->stride[0], minStride=std::min(dstStride, srcStride);
-    for (int i=0; i<height; i++)
-        memcpy(avframe->data[0]+dstStride*i, vpxframe->planes[0]+srcStride*i, minStride);
-    dstStride=avframe->linesize[1], srcStride=vpxframe->stride[1], minStride=std::min(dstStride, srcStride);
-    for (int i=0; i<height/2; i++)
-        memcpy(avframe->data[1]+dstStride*i, vpxframe->planes[1]+srcStride*i, minStride);
-    dstStride=avframe->linesize[2], srcStride=vpxframe->stride[2], minStride=std::min(dstStride, srcStride);
-    for (int i=0; i<height/2; i++)
-        memcpy(avframe->data[2]+dstStride*i, vpxframe->planes[2]+srcStride*i, minStride);
-
-    vframe = std::make_shared<VideoFrame>(avframe);
+
+    vframe = std::make_shared<VideoFrame>(avframe, nullptr, framePool);
+    prepareFrame(vframe);
     emit frameAvailable(vframe);
 }
 
@@ -23,9 +23,12 @@
 
 #include <vpx/vpx_image.h>
 #include <atomic>
+#include <memory>
 #include "videosource.h"
 #include <QMutex>
 
+class FrameBufferPool;
+
 /// A VideoSource that emits frames received by Core
 class CoreVideoSource : public VideoSource
 {
@@ -55,6 +58,7 @@ private:
     std::atomic_bool deleteOnClose; ///< If true, self-delete after the last suscriber is gone
     QMutex biglock;
     std::atomic_bool stopped;
+    std::shared_ptr<FrameBufferPool> framePool; ///< Shared with our frames, which can outlive us
 
 friend class CoreAV;
 friend struct ToxFriendCall;
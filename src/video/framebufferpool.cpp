@@ -0,0 +1,125 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/imgutils.h>
+}
+#include "framebufferpool.h"
+
+#include <QDebug>
+
+namespace
+{
+
+// a few frames of each stream are in flight at once, don't keep more than they need
+const int maxIdleFrames = 8;
+
+}
+
+uint qHash(const FrameBufferPool::Key& key)
+{
+    return ::qHash(key.width) ^ ::qHash(key.height << 12) ^ ::qHash(key.format << 24);
+}
+
+FrameBufferPool::~FrameBufferPool()
+{
+    for (AVFrame* frame : idle)
+        free(frame);
+}
+
+AVFrame* FrameBufferPool::acquire(int width, int height, int format)
+{
+    {
+        QMutexLocker locker(&mutex);
+        auto it = idle.find({width, height, format});
+        if (it != idle.end())
+        {
+            AVFrame* frame = it.value();
+            idle.erase(it);
+            return frame;
+        }
+    }
+
+    return allocate(width, height, format);
+}
+
+void FrameBufferPool::release(AVFrame* frame)
+{
+    // decoded frames reference the buffers of their decoder
+    if (!frame->opaque)
+    {
+        free(frame);
+        return;
+    }
+
+    QMutexLocker locker(&mutex);
+    if (idle.size() >= maxIdleFrames)
+    {
+        // the stream changed resolution, the frames of the old one go first
+        Key key{frame->width, frame->height, frame->format};
+        auto it = idle.begin();
+        while (it != idle.end() && it.key() == key)
+            ++it;
+
+        if (it == idle.end())
+        {
+            free(frame);
+            return;
+        }
+
+        free(it.value());
+        idle.erase(it);
+    }
+
+    idle.insert({frame->width, frame->height, frame->format}, frame);
+}
+
+AVFrame* FrameBufferPool::allocate(int width, int height, int format)
+{
+    AVFrame* frame = av_frame_alloc();
+    if (!frame)
+    {
+        qCritical() << "av_frame_alloc failed";
+        return nullptr;
+    }
+
+    int imgBufferSize = av_image_get_buffer_size((AVPixelFormat)format, width, height, 1);
+    uint8_t* buf = (uint8_t*)av_malloc(imgBufferSize);
+    if (!buf)
+    {
+        qCritical() << "av_malloc failed";
+        av_frame_free(&frame);
+        return nullptr;
+    }
+    frame->opaque = buf;
+
+    av_image_fill_arrays(frame->data, frame->linesize, buf, (AVPixelFormat)format, width, height, 1);
+    frame->width = width;
+    frame->height = height;
+    frame->format = format;
+    return frame;
+}
+
+void FrameBufferPool::free(AVFrame* frame)
+{
+    av_free(frame->opaque);
+    av_frame_unref(frame);
+    av_frame_free(&frame);
+}
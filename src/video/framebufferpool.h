@@ -0,0 +1,69 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FRAMEBUFFERPOOL_H
+#define FRAMEBUFFERPOOL_H
+
+#include <QMultiHash>
+#include <QMutex>
+
+struct AVFrame;
+
+/// Recycles the AVFrames of a video source and their buffers, so a stream doesn't
+/// allocate megabytes for each of its frames. Frames come back to the pool when the
+/// VideoFrame owning them is deleted. All methods are thread-safe.
+/// The frames are laid out like av_image_fill_arrays does with an alignment of 1,
+/// their buffer is in opaque, to be freed with av_free.
+class FrameBufferPool
+{
+public:
+    FrameBufferPool() = default;
+    ~FrameBufferPool();
+
+    /// Returns a frame of this geometry and pixel format, from the pool if possible
+    AVFrame* acquire(int width, int height, int format);
+    /// Takes back a frame of the layout above, frames without a buffer of their own are freed
+    void release(AVFrame* frame);
+
+    /// Same as acquire, without pool
+    static AVFrame* allocate(int width, int height, int format);
+    /// Frees a frame, including its buffer in opaque
+    static void free(AVFrame* frame);
+
+private:
+    FrameBufferPool(const FrameBufferPool&) = delete;
+    FrameBufferPool& operator=(const FrameBufferPool&) = delete;
+
+    struct Key
+    {
+        int width, height, format;
+
+        bool operator==(const Key& other) const
+        {
+            return width == other.width && height == other.height && format == other.format;
+        }
+    };
+    friend uint qHash(const Key& key);
+
+private:
+    QMultiHash<Key, AVFrame*> idle;
+    QMutex mutex;
+};
+
+#endif // FRAMEBUFFERPOOL_H
@@ -31,7 +31,7 @@ GenericNetCamView::GenericNetCamView(QWidget *parent)
     int spacing = verLayout->spacing();
     verLayout->setSpacing(0);
 
-    QHBoxLayout* buttonLayout = new QHBoxLayout();
+    buttonLayout = new QHBoxLayout();
     buttonLayout->addStretch();
     button = new QPushButton();
     buttonLayout->addWidget(button);
@@ -24,6 +24,7 @@
 
 class VideoSurface;
 class QPushButton;
+class QHBoxLayout;
 class QVBoxLayout;
 
 class GenericNetCamView : public QWidget
@@ -40,6 +41,7 @@ public slots:
 
 protected:
     QVBoxLayout* verLayout;
+    QHBoxLayout* buttonLayout;
     VideoSurface* videoSurface;
 
 private:
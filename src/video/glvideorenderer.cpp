@@ -0,0 +1,353 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "glvideorenderer.h"
+#include "videoframe.h"
+
+#include <QOpenGLContext>
+#include <QOpenGLShaderProgram>
+#include <QDebug>
+#include <vpx/vpx_image.h>
+
+#ifdef Q_OS_MACX
+#include <CoreVideo/CoreVideo.h>
+#include <IOSurface/IOSurface.h>
+#include <OpenGL/CGLIOSurface.h>
+#include <OpenGL/OpenGL.h>
+#endif
+
+namespace
+{
+
+const char* vertexShader =
+    "attribute vec2 position;\n"
+    "attribute vec2 texCoord;\n"
+    "varying vec2 coord;\n"
+    "void main()\n"
+    "{\n"
+    "    gl_Position = vec4(position, 0.0, 1.0);\n"
+    "    coord = texCoord;\n"
+    "}\n";
+
+// BT.601 with the limited range, same as swscale does by default
+const char* fragmentShader =
+    "#ifdef GL_ES\n"
+    "precision mediump float;\n"
+    "#endif\n"
+    "uniform sampler2D texY;\n"
+    "uniform sampler2D texU;\n"
+    "uniform sampler2D texV;\n"
+    "uniform vec3 scales;\n"
+    "varying vec2 coord;\n"
+    "void main()\n"
+    "{\n"
+    "    float y = 1.1643 * (texture2D(texY, vec2(coord.x * scales.x, coord.y)).r - 0.0625);\n"
+    "    float u = texture2D(texU, vec2(coord.x * scales.y, coord.y)).r - 0.5;\n"
+    "    float v = texture2D(texV, vec2(coord.x * scales.z, coord.y)).r - 0.5;\n"
+    "    gl_FragColor = vec4(y + 1.5958 * v, y - 0.39173 * u - 0.81290 * v, y + 2.017 * u, 1.0);\n"
+    "}\n";
+
+#ifdef Q_OS_MACX
+// Same conversion for the NV12 planes of an IOSurface, rectangle textures are sampled in pixels
+const char* surfaceFragmentShader =
+    "#extension GL_ARB_texture_rectangle : enable\n"
+    "uniform sampler2DRect texY;\n"
+    "uniform sampler2DRect texUV;\n"
+    "uniform vec2 size;\n"
+    "varying vec2 coord;\n"
+    "void main()\n"
+    "{\n"
+    "    vec2 pos = coord * size;\n"
+    "    float y = 1.1643 * (texture2DRect(texY, pos).r - 0.0625);\n"
+    "    vec2 uv = texture2DRect(texUV, pos * 0.5).ra - 0.5;\n"
+    "    gl_FragColor = vec4(y + 1.5958 * uv.y, y - 0.39173 * uv.x - 0.81290 * uv.y, y + 2.017 * uv.x, 1.0);\n"
+    "}\n";
+#endif
+
+// a quad covering the whole widget, textures have their first row at the top
+const GLfloat positions[] = {-1.0f, -1.0f, 1.0f, -1.0f, -1.0f, 1.0f, 1.0f, 1.0f};
+const GLfloat texCoords[] = {0.0f, 1.0f, 1.0f, 1.0f, 0.0f, 0.0f, 1.0f, 0.0f};
+
+}
+
+GLVideoRenderer::GLVideoRenderer(QWidget* parent)
+    : QOpenGLWidget{parent}
+{
+}
+
+GLVideoRenderer::~GLVideoRenderer()
+{
+    makeCurrent();
+    cleanup();
+    doneCurrent();
+}
+
+bool GLVideoRenderer::isAvailable()
+{
+    static const bool available = []()
+    {
+        QOpenGLContext context;
+        return context.create();
+    }();
+
+    return available;
+}
+
+void GLVideoRenderer::setFrame(std::shared_ptr<VideoFrame> newFrame)
+{
+    frame = newFrame;
+    frameChanged = true;
+    update();
+}
+
+void GLVideoRenderer::initializeGL()
+{
+    initializeOpenGLFunctions();
+    connect(context(), &QOpenGLContext::aboutToBeDestroyed, this, &GLVideoRenderer::cleanup);
+
+    program = new QOpenGLShaderProgram;
+    if (!program->addShaderFromSourceCode(QOpenGLShader::Vertex, vertexShader)
+            || !program->addShaderFromSourceCode(QOpenGLShader::Fragment, fragmentShader)
+            || !program->link())
+    {
+        qWarning() << "Failed to set up the video shaders:" << program->log();
+        delete program;
+        program = nullptr;
+        emit failed();
+        return;
+    }
+
+    program->bind();
+    program->setUniformValue("texY", 0);
+    program->setUniformValue("texU", 1);
+    program->setUniformValue("texV", 2);
+    program->release();
+
+    glGenTextures(3, textures);
+    for (GLuint texture : textures)
+    {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+
+#ifdef Q_OS_MACX
+    initSurfaceProgram();
+#endif
+
+    initialized = true;
+    frameChanged = true;
+}
+
+void GLVideoRenderer::paintGL()
+{
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    if (!initialized || !frame)
+        return;
+
+    if (frameChanged)
+        uploadFrame();
+
+#ifdef Q_OS_MACX
+    if (surface)
+    {
+        drawSurface();
+        return;
+    }
+#endif
+
+    program->bind();
+    program->setUniformValue("scales", planeScales[0], planeScales[1], planeScales[2]);
+
+    for (int i = 0; i < 3; ++i)
+    {
+        glActiveTexture(GL_TEXTURE0 + i);
+        glBindTexture(GL_TEXTURE_2D, textures[i]);
+    }
+
+    drawQuad(program);
+    program->release();
+
+    glActiveTexture(GL_TEXTURE0);
+}
+
+void GLVideoRenderer::drawQuad(QOpenGLShaderProgram* shader)
+{
+    shader->enableAttributeArray("position");
+    shader->enableAttributeArray("texCoord");
+    shader->setAttributeArray("position", positions, 2);
+    shader->setAttributeArray("texCoord", texCoords, 2);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    shader->disableAttributeArray("position");
+    shader->disableAttributeArray("texCoord");
+}
+
+/**
+ * @brief Uploads the planes of the frame, converting it to YUV420 first if needed.
+ *
+ * The textures are as wide as the strides of the planes, the shader only samples their visible part.
+ */
+void GLVideoRenderer::uploadFrame()
+{
+    frameChanged = false;
+
+#ifdef Q_OS_MACX
+    // the camera frames are already in video memory
+    std::shared_ptr<void> pixelBuffer = frame->getNativeBuffer();
+    if (pixelBuffer && bindSurface(pixelBuffer))
+        return;
+    surface.reset();
+#endif
+
+    vpx_image* img = frame->toVpxImage();
+    if (!img->planes[0])
+    {
+        delete img;
+        return;
+    }
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    for (int i = 0; i < 3; ++i)
+    {
+        int width = i == 0 ? img->d_w : (img->d_w + 1) / 2;
+        int height = i == 0 ? img->d_h : (img->d_h + 1) / 2;
+        int stride = img->stride[i];
+
+        glBindTexture(GL_TEXTURE_2D, textures[i]);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, stride, height, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, img->planes[i]);
+        planeScales[i] = width / static_cast<float>(stride);
+    }
+
+    delete img;
+}
+
+#ifdef Q_OS_MACX
+/**
+ * @brief Sets up the shader and textures of the IOSurfaces, we upload the frames if that fails.
+ */
+void GLVideoRenderer::initSurfaceProgram()
+{
+    surfaceProgram = new QOpenGLShaderProgram;
+    if (!surfaceProgram->addShaderFromSourceCode(QOpenGLShader::Vertex, vertexShader)
+            || !surfaceProgram->addShaderFromSourceCode(QOpenGLShader::Fragment, surfaceFragmentShader)
+            || !surfaceProgram->link())
+    {
+        qWarning() << "Failed to set up the IOSurface shaders, uploading the frames instead:" << surfaceProgram->log();
+        delete surfaceProgram;
+        surfaceProgram = nullptr;
+        return;
+    }
+
+    surfaceProgram->bind();
+    surfaceProgram->setUniformValue("texY", 0);
+    surfaceProgram->setUniformValue("texUV", 1);
+    surfaceProgram->release();
+
+    glGenTextures(2, surfaceTextures);
+    for (GLuint texture : surfaceTextures)
+    {
+        glBindTexture(GL_TEXTURE_RECTANGLE_ARB, texture);
+        glTexParameteri(GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+    glBindTexture(GL_TEXTURE_RECTANGLE_ARB, 0);
+}
+
+bool GLVideoRenderer::bindSurface(const std::shared_ptr<void>& pixelBuffer)
+{
+    CVPixelBufferRef buffer = static_cast<CVPixelBufferRef>(pixelBuffer.get());
+    IOSurfaceRef ioSurface = CVPixelBufferGetIOSurface(buffer);
+    if (!surfaceProgram || !ioSurface || IOSurfaceGetPlaneCount(ioSurface) != 2)
+        return false;
+
+    CGLContextObj cglContext = CGLGetCurrentContext();
+    const GLsizei width = static_cast<GLsizei>(IOSurfaceGetWidthOfPlane(ioSurface, 0));
+    const GLsizei height = static_cast<GLsizei>(IOSurfaceGetHeightOfPlane(ioSurface, 0));
+
+    glBindTexture(GL_TEXTURE_RECTANGLE_ARB, surfaceTextures[0]);
+    CGLError error = CGLTexImageIOSurface2D(cglContext, GL_TEXTURE_RECTANGLE_ARB, GL_LUMINANCE,
+                                            width, height, GL_LUMINANCE, GL_UNSIGNED_BYTE, ioSurface, 0);
+    if (error == kCGLNoError)
+    {
+        glBindTexture(GL_TEXTURE_RECTANGLE_ARB, surfaceTextures[1]);
+        error = CGLTexImageIOSurface2D(cglContext, GL_TEXTURE_RECTANGLE_ARB, GL_LUMINANCE_ALPHA,
+                                       static_cast<GLsizei>(IOSurfaceGetWidthOfPlane(ioSurface, 1)),
+                                       static_cast<GLsizei>(IOSurfaceGetHeightOfPlane(ioSurface, 1)),
+                                       GL_LUMINANCE_ALPHA, GL_UNSIGNED_BYTE, ioSurface, 1);
+    }
+    glBindTexture(GL_TEXTURE_RECTANGLE_ARB, 0);
+
+    if (error != kCGLNoError)
+    {
+        qWarning() << "Failed to bind the IOSurface of a frame:" << CGLErrorString(error);
+        return false;
+    }
+
+    surface = pixelBuffer;
+    surfaceSize = QSize(width, height);
+    return true;
+}
+
+void GLVideoRenderer::drawSurface()
+{
+    surfaceProgram->bind();
+    surfaceProgram->setUniformValue("size", static_cast<GLfloat>(surfaceSize.width()),
+                                    static_cast<GLfloat>(surfaceSize.height()));
+
+    for (int i = 0; i < 2; ++i)
+    {
+        glActiveTexture(GL_TEXTURE0 + i);
+        glBindTexture(GL_TEXTURE_RECTANGLE_ARB, surfaceTextures[i]);
+    }
+
+    drawQuad(surfaceProgram);
+    surfaceProgram->release();
+
+    for (int i = 1; i >= 0; --i)
+    {
+        glActiveTexture(GL_TEXTURE0 + i);
+        glBindTexture(GL_TEXTURE_RECTANGLE_ARB, 0);
+    }
+}
+#endif
+
+void GLVideoRenderer::cleanup()
+{
+    if (!initialized)
+        return;
+
+    glDeleteTextures(3, textures);
+    delete program;
+    program = nullptr;
+#ifdef Q_OS_MACX
+    if (surfaceProgram)
+        glDeleteTextures(2, surfaceTextures);
+    delete surfaceProgram;
+    surfaceProgram = nullptr;
+    surface.reset();
+#endif
+    initialized = false;
+}
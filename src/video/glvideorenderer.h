@@ -0,0 +1,80 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GLVIDEORENDERER_H
+#define GLVIDEORENDERER_H
+
+#include <QOpenGLWidget>
+#include <QOpenGLFunctions>
+#include <memory>
+
+class QOpenGLShaderProgram;
+class VideoFrame;
+
+/// Draws VideoFrames with OpenGL: the YUV420 planes are uploaded as textures, and the
+/// color conversion and scaling are done by a fragment shader instead of swscale.
+/// On macOS, the camera frames are IOSurfaces that are bound as textures without any upload.
+/// Used by VideoSurface, which falls back to QPainter if this isn't available.
+class GLVideoRenderer : public QOpenGLWidget, protected QOpenGLFunctions
+{
+    Q_OBJECT
+public:
+    explicit GLVideoRenderer(QWidget* parent = 0);
+    ~GLVideoRenderer();
+
+    /// Returns false if there is no usable OpenGL on this system
+    static bool isAvailable();
+
+    /// The frame to draw, drawn black if null
+    void setFrame(std::shared_ptr<VideoFrame> newFrame);
+
+signals:
+    void failed(); ///< The shaders couldn't be set up, the renderer can't draw anything
+
+protected:
+    virtual void initializeGL() final override;
+    virtual void paintGL() final override;
+
+private:
+    void uploadFrame();
+    void drawQuad(QOpenGLShaderProgram* shader);
+#ifdef Q_OS_MACX
+    void initSurfaceProgram();
+    /// Binds the NV12 planes of the CVPixelBuffer's IOSurface, returns false if it has none
+    bool bindSurface(const std::shared_ptr<void>& pixelBuffer);
+    void drawSurface();
+#endif
+    void cleanup();
+
+private:
+    std::shared_ptr<VideoFrame> frame;
+    bool frameChanged = false;
+    bool initialized = false;
+    QOpenGLShaderProgram* program = nullptr;
+    GLuint textures[3] = {0, 0, 0}; ///< Y, U and V
+    float planeScales[3] = {1.0f, 1.0f, 1.0f}; ///< Visible part of the textures, made as wide as the strides
+#ifdef Q_OS_MACX
+    QOpenGLShaderProgram* surfaceProgram = nullptr; ///< Samples the NV12 planes of an IOSurface
+    GLuint surfaceTextures[2] = {0, 0}; ///< Y and interleaved UV, rectangle textures bound to the IOSurface
+    std::shared_ptr<void> surface; ///< The CVPixelBuffer bound to surfaceTextures, alive for as long as we draw it
+    QSize surfaceSize;
+#endif
+};
+
+#endif // GLVIDEORENDERER_H
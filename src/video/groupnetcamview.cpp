@@ -19,9 +19,9 @@
 
 #include "groupnetcamview.h"
 #include "src/widget/tool/croppinglabel.h"
+#include "src/video/grouppeergrid.h"
 #include "src/video/videosurface.h"
 #include "src/persistence/profile.h"
-#include "src/audio/audio.h"
 #include "src/core/core.h"
 #include "src/nexus.h"
 #include "src/friendlist.h"
@@ -29,10 +29,18 @@
 #include <QBoxLayout>
 #include <QScrollArea>
 #include <QSplitter>
-#include <QTimer>
 #include <QMap>
 
 #include <QDebug>
+
+namespace
+{
+
+/// Our own tile in the grid, sorted before every peer
+const int selfTile = -2;
+
+}
+
 class LabeledVideo : public QFrame
 {
 public:
@@ -109,6 +117,7 @@ private:
 
 GroupNetCamView::GroupNetCamView(int group, QWidget *parent)
     : GenericNetCamView(parent)
+    , activePeer(-1)
     , group(group)
 {
     videoLabelSurface = new LabeledVideo(QPixmap(), this, false);
@@ -125,41 +134,38 @@ GroupNetCamView::GroupNetCamView(int group, QWidget *parent)
     splitter->addWidget(videoLabelSurface);
     splitter->setStyleSheet("QSplitter { background-color: black; } QSplitter::handle { background-color: black; }");
 
+    // every tile is drawn by the grid in a single paint pass, however many peers there are
     QScrollArea* scrollArea = new QScrollArea();
-    scrollArea->setVerticalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+    scrollArea->setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
     scrollArea->setFrameStyle(QFrame::NoFrame);
-    QWidget* widget = new QWidget(nullptr);
     scrollArea->setWidgetResizable(true);
-    horLayout = new QHBoxLayout(widget);
-    horLayout->addStretch(1);
+    peerGrid = new GroupPeerGrid(nullptr);
 
-    selfVideoSurface = new LabeledVideo(Nexus::getProfile()->loadAvatar(), this);
-    horLayout->addWidget(selfVideoSurface);
+    selfName = Core::getInstance()->getUsername();
+    selfAvatar = Nexus::getProfile()->loadAvatar();
+    peerGrid->setTile(selfTile, selfAvatar, selfName);
 
-    horLayout->addStretch(1);
     splitter->addWidget(scrollArea);
-    scrollArea->setWidget(widget);
-
-    connect(&Audio::getInstance(), &Audio::groupAudioPlayed, this, &GroupNetCamView::groupAudioPlayed);
+    scrollArea->setWidget(peerGrid);
 
-    QTimer* timer = new QTimer(this);
-    timer->setInterval(1000);
-    connect(timer, &QTimer::timeout, this, &GroupNetCamView::findActivePeer);
-    timer->start();
+    // the group call's mixer tells us who's speaking, there's nothing to poll
+    connect(Core::getInstance(), &Core::groupActiveSpeakerChanged, this, &GroupNetCamView::onActiveSpeakerChanged);
 
     connect(Core::getInstance(), &Core::selfAvatarChanged, [this](const QPixmap& pixmap)
     {
-        selfVideoSurface->getVideoSurface()->setAvatar(pixmap);
-        findActivePeer();
+        selfAvatar = pixmap;
+        peerGrid->setTileAvatar(selfTile, pixmap);
+        setActive(activePeer);
     });
     connect(Core::getInstance(), &Core::usernameSet, [this](const QString& username)
     {
-        selfVideoSurface->setText(username);
-        findActivePeer();
+        selfName = username;
+        peerGrid->setTileName(selfTile, username);
+        setActive(activePeer);
     });
     connect(Core::getInstance(), &Core::friendAvatarChanged, this, &GroupNetCamView::friendAvatarChanged);
 
-    selfVideoSurface->setText(Core::getInstance()->getUsername());
+    setActive(-1);
 }
 
 void GroupNetCamView::clearPeers()
@@ -172,15 +178,17 @@ void GroupNetCamView::clearPeers()
 
 void GroupNetCamView::addPeer(int peer, const QString& name)
 {
-    QPixmap groupAvatar = Nexus::getProfile()->loadAvatar(Core::getInstance()->getGroupPeerToxId(group, peer).toString());
-    LabeledVideo* labeledVideo = new LabeledVideo(groupAvatar, this);
-    labeledVideo->setText(name);
-    horLayout->insertWidget(horLayout->count() - 1, labeledVideo);
+    removePeer(peer);
+
+    ToxId peerId = Core::getInstance()->getGroupPeerToxId(group, peer);
     PeerVideo peerVideo;
-    peerVideo.video = labeledVideo;
+    peerVideo.name = name;
+    peerVideo.avatar = Nexus::getProfile()->loadAvatar(peerId.toString());
+    peerVideo.publicKey = peerId.getPublicKey();
     videoList.insert(peer, peerVideo);
+    peerByPublicKey.insert(peerVideo.publicKey, peer);
 
-    findActivePeer();
+    peerGrid->setTile(peer, peerVideo.avatar, name);
 }
 
 void GroupNetCamView::removePeer(int peer)
@@ -189,90 +197,70 @@ void GroupNetCamView::removePeer(int peer)
 
     if (peerVideo != videoList.end())
     {
-        LabeledVideo* labeledVideo = peerVideo.value().video;
-        horLayout->removeWidget(labeledVideo);
-        labeledVideo->deleteLater();
-        videoList.remove(peer);
+        peerGrid->removeTile(peer);
+
+        auto byKey = peerByPublicKey.find(peerVideo.value().publicKey);
+        if (byKey != peerByPublicKey.end() && byKey.value() == peer)
+            peerByPublicKey.erase(byKey);
+
+        videoList.erase(peerVideo);
 
-        findActivePeer();
+        if (activePeer == peer)
+            setActive(-1);
     }
 }
 
 void GroupNetCamView::setActive(int peer)
 {
-    if (peer == -1)
+    auto peerVideo = videoList.find(peer);
+
+    if (peerVideo == videoList.end())
     {
-        videoLabelSurface->setText(selfVideoSurface->getText());
+        videoLabelSurface->setText(selfName);
+        videoLabelSurface->getVideoSurface()->setAvatar(selfAvatar);
+        peerGrid->setActive(-1);
         activePeer = -1;
         return;
     }
 
-    auto peerVideo = videoList.find(peer);
-
-    if (peerVideo != videoList.end())
-    {
-        // When group video exists:
-        // videoSurface->setSource(peerVideo.value()->getVideoSurface()->source);
-
-        auto lastVideo = videoList.find(activePeer);
-
-        if (lastVideo != videoList.end())
-            lastVideo.value().video->setActive(false);
+    // When group video exists:
+    // videoSurface->setSource(peerVideo.value()->getVideoSurface()->source);
 
-        LabeledVideo *labeledVideo = peerVideo.value().video;
-        videoLabelSurface->setText(labeledVideo->getText());
-        videoLabelSurface->getVideoSurface()->setAvatar(labeledVideo->getVideoSurface()->getAvatar());
-        labeledVideo->setActive();
+    videoLabelSurface->setText(peerVideo.value().name);
+    videoLabelSurface->getVideoSurface()->setAvatar(peerVideo.value().avatar);
+    peerGrid->setActive(peer);
 
-        activePeer = peer;
-    }
+    activePeer = peer;
 }
 
-void GroupNetCamView::groupAudioPlayed(int Group, int peer, unsigned short volume)
+void GroupNetCamView::onActiveSpeakerChanged(int Group, int peer)
 {
     if (group != Group)
         return;
 
-    auto peerVideo = videoList.find(peer);
-
-    if (peerVideo != videoList.end())
-        peerVideo.value().volume = volume;
-}
-
-void GroupNetCamView::findActivePeer()
-{
-    int candidate = -1;
-    int maximum = 0;
-
-    for (auto peer = videoList.begin(); peer != videoList.end(); ++peer)
-    {
-        if (peer.value().volume > maximum)
-        {
-            maximum = peer.value().volume;
-            candidate = peer.key();
-        }
-    }
+    // a peer we don't show yet keeps the last speaker up rather than blanking the view
+    if (peer != -1 && !videoList.contains(peer))
+        return;
 
-    setActive(candidate);
+    setActive(peer);
 }
 
 void GroupNetCamView::friendAvatarChanged(int FriendId, const QPixmap &pixmap)
 {
     Friend* f = FriendList::findFriend(FriendId);
+    if (!f)
+        return;
 
-    for (int i = 0; i < Core::getInstance()->getGroupNumberPeers(group); ++i)
-    {
-        if (Core::getInstance()->getGroupPeerToxId(group, i) == f->getToxId())
-        {
-            auto peerVideo = videoList.find(i);
-
-            if (peerVideo != videoList.end())
-            {
-                peerVideo.value().video->getVideoSurface()->setAvatar(pixmap);
-                findActivePeer();
-            }
+    auto peer = peerByPublicKey.find(f->getToxId().getPublicKey());
+    if (peer == peerByPublicKey.end())
+        return;
 
-            break;
-        }
+    auto peerVideo = videoList.find(peer.value());
+    if (peerVideo != videoList.end())
+    {
+        peerVideo.value().avatar = pixmap;
+        peerGrid->setTileAvatar(peer.value(), pixmap);
+        if (activePeer == peer.value())
+            setActive(activePeer);
     }
 }
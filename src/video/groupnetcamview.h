@@ -21,10 +21,12 @@
 #define GROUPNETCAMVIEW_H
 
 #include "genericnetcamview.h"
+#include "src/core/toxpk.h"
+#include <QHash>
 #include <QMap>
 
+class GroupPeerGrid;
 class LabeledVideo;
-class QHBoxLayout;
 
 class GroupNetCamView : public GenericNetCamView
 {
@@ -34,26 +36,26 @@ public:
     void addPeer(int peer, const QString &name);
     void removePeer(int peer);
 
-public slots:
-    void groupAudioPlayed(int group, int peer, unsigned short volume);
-
 private slots:
-    void findActivePeer();
+    void onActiveSpeakerChanged(int group, int peer);
     void friendAvatarChanged(int FriendId, const QPixmap& pixmap);
 
 private:
     struct PeerVideo
     {
-        LabeledVideo* video;
-        unsigned short volume = 0;
+        QString name;
+        QPixmap avatar;
+        ToxPk publicKey;
     };
 
     void setActive(int peer);
 
-    QHBoxLayout* horLayout;
+    GroupPeerGrid* peerGrid;
     QMap<int, PeerVideo> videoList;
+    QHash<ToxPk, int> peerByPublicKey; ///< So avatar changes don't go through every peer
     LabeledVideo* videoLabelSurface;
-    LabeledVideo* selfVideoSurface;
+    QString selfName;
+    QPixmap selfAvatar;
     int activePeer;
     int group;
 };
@@ -0,0 +1,208 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "grouppeergrid.h"
+#include "src/widget/style.h"
+#include <algorithm>
+#include <iterator>
+#include <QPaintEvent>
+#include <QPainter>
+
+namespace
+{
+
+/// Side of a tile's avatar, in pixels
+const int avatarSize = 96;
+/// Space between a tile's border and its content, where the highlight shows
+const int tilePadding = 6;
+/// Space between tiles
+const int tileSpacing = 6;
+
+}
+
+GroupPeerGrid::GroupPeerGrid(QWidget* parent)
+    : QWidget(parent)
+    , activeKey{-1}
+    , columns{1}
+{
+    QSizePolicy policy{QSizePolicy::Expanding, QSizePolicy::Preferred};
+    policy.setHeightForWidth(true);
+    setSizePolicy(policy);
+}
+
+void GroupPeerGrid::setTile(int key, const QPixmap& avatar, const QString& name)
+{
+    Tile& tile = tiles[key];
+    tile.avatar = avatar;
+    tile.name = name;
+    scaleAvatar(tile);
+    relayout();
+}
+
+void GroupPeerGrid::setTileAvatar(int key, const QPixmap& avatar)
+{
+    auto it = tiles.find(key);
+    if (it == tiles.end())
+        return;
+
+    it->avatar = avatar;
+    scaleAvatar(*it);
+    update(tileRect(std::distance(tiles.begin(), it)));
+}
+
+void GroupPeerGrid::setTileName(int key, const QString& name)
+{
+    auto it = tiles.find(key);
+    if (it == tiles.end())
+        return;
+
+    it->name = name;
+    update(tileRect(std::distance(tiles.begin(), it)));
+}
+
+void GroupPeerGrid::removeTile(int key)
+{
+    if (!tiles.remove(key))
+        return;
+
+    if (activeKey == key)
+        activeKey = -1;
+
+    relayout();
+}
+
+void GroupPeerGrid::setActive(int key)
+{
+    if (activeKey == key)
+        return;
+
+    // only the two tiles that changed are repainted
+    auto last = tiles.find(activeKey);
+    if (last != tiles.end())
+        update(tileRect(std::distance(tiles.begin(), last)));
+
+    activeKey = key;
+
+    auto active = tiles.find(activeKey);
+    if (active != tiles.end())
+        update(tileRect(std::distance(tiles.begin(), active)));
+}
+
+QSize GroupPeerGrid::sizeHint() const
+{
+    int tileWidth = avatarSize + 2 * tilePadding;
+    int width = tiles.size() * (tileWidth + tileSpacing) + tileSpacing;
+    return QSize(width, heightForWidth(width));
+}
+
+bool GroupPeerGrid::hasHeightForWidth() const
+{
+    return true;
+}
+
+int GroupPeerGrid::heightForWidth(int width) const
+{
+    int tileHeight = avatarSize + 3 * tilePadding + fontMetrics().height();
+    int rows = (tiles.size() + columnsFor(width) - 1) / columnsFor(width);
+    return std::max(rows, 1) * (tileHeight + tileSpacing) + tileSpacing;
+}
+
+void GroupPeerGrid::paintEvent(QPaintEvent* event)
+{
+    QPainter painter(this);
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.setClipRegion(event->region());
+    painter.fillRect(event->rect(), Qt::black);
+
+    int index = 0;
+    for (auto it = tiles.constBegin(); it != tiles.constEnd(); ++it, ++index)
+    {
+        QRect rect = tileRect(index);
+        if (!event->region().intersects(rect))
+            continue;
+
+        if (it.key() == activeKey)
+        {
+            painter.setPen(Qt::NoPen);
+            painter.setBrush(QColor("#414141"));
+            painter.drawRoundedRect(rect, 10, 10);
+        }
+
+        QRect avatarRect{rect.left() + tilePadding, rect.top() + tilePadding, avatarSize, avatarSize};
+        painter.fillRect(avatarRect, Qt::white);
+        painter.drawPixmap(avatarRect.topLeft() + QPoint{(avatarSize - it->scaled.width()) / 2,
+                                                         (avatarSize - it->scaled.height()) / 2},
+                           it->scaled);
+
+        QRect labelRect{rect.left() + tilePadding, avatarRect.bottom() + tilePadding,
+                        avatarSize, fontMetrics().height()};
+        painter.setPen(Qt::white);
+        painter.drawText(labelRect, Qt::AlignCenter,
+                         fontMetrics().elidedText(it->name, Qt::ElideRight, labelRect.width()));
+    }
+}
+
+void GroupPeerGrid::resizeEvent(QResizeEvent* event)
+{
+    QWidget::resizeEvent(event);
+
+    if (columnsFor(width()) != columns)
+        relayout();
+}
+
+int GroupPeerGrid::columnsFor(int width) const
+{
+    int tileWidth = avatarSize + 2 * tilePadding;
+    return std::max(1, (width - tileSpacing) / (tileWidth + tileSpacing));
+}
+
+/**
+@brief Where the tile at that position is drawn, the tiles of each row are centered.
+*/
+QRect GroupPeerGrid::tileRect(int index) const
+{
+    int tileWidth = avatarSize + 2 * tilePadding;
+    int tileHeight = avatarSize + 3 * tilePadding + fontMetrics().height();
+    int row = index / columns;
+    int column = index % columns;
+    int inRow = std::min(columns, tiles.size() - row * columns);
+    int rowWidth = inRow * (tileWidth + tileSpacing) - tileSpacing;
+    int left = (width() - rowWidth) / 2;
+
+    return QRect(left + column * (tileWidth + tileSpacing), tileSpacing + row * (tileHeight + tileSpacing),
+                 tileWidth, tileHeight);
+}
+
+void GroupPeerGrid::scaleAvatar(Tile& tile) const
+{
+    if (tile.avatar.isNull())
+        tile.scaled = Style::scaleSvgImage(":/img/contact_dark.svg", avatarSize, avatarSize);
+    else
+        tile.scaled = tile.avatar.scaled(avatarSize, avatarSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+}
+
+/**
+@brief Recomputes the columns after tiles or the width changed, and repaints everything.
+*/
+void GroupPeerGrid::relayout()
+{
+    columns = columnsFor(width());
+    updateGeometry();
+    update();
+}
@@ -0,0 +1,73 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GROUPPEERGRID_H
+#define GROUPPEERGRID_H
+
+#include <QMap>
+#include <QPixmap>
+#include <QWidget>
+
+/**
+@brief Draws every tile of a group call in one widget, instead of a widget per peer.
+
+Tiles flow in rows as wide as the grid, and only those in the repainted region are drawn,
+so peers scrolled out of view cost nothing.
+*/
+class GroupPeerGrid : public QWidget
+{
+public:
+    explicit GroupPeerGrid(QWidget* parent = nullptr);
+
+    /// Adds the tile or updates it, tiles are ordered by key
+    void setTile(int key, const QPixmap& avatar, const QString& name);
+    void setTileAvatar(int key, const QPixmap& avatar);
+    void setTileName(int key, const QString& name);
+    void removeTile(int key);
+    /// Highlights a single tile, -1 for none
+    void setActive(int key);
+
+    QSize sizeHint() const final override;
+    bool hasHeightForWidth() const final override;
+    int heightForWidth(int width) const final override;
+
+protected:
+    void paintEvent(QPaintEvent* event) final override;
+    void resizeEvent(QResizeEvent* event) final override;
+
+private:
+    struct Tile
+    {
+        QPixmap avatar;
+        QPixmap scaled; ///< The avatar at the size it's drawn at, so repaints don't scale it again
+        QString name;
+    };
+
+    int columnsFor(int width) const;
+    QRect tileRect(int index) const;
+    void scaleAvatar(Tile& tile) const;
+    void relayout();
+
+private:
+    QMap<int, Tile> tiles;
+    int activeKey;
+    int columns;
+};
+
+#endif // GROUPPEERGRID_H
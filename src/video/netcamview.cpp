@@ -22,6 +22,7 @@
 #include "src/friend.h"
 #include "src/friendlist.h"
 #include "src/core/core.h"
+#include "src/core/coreav.h"
 #include "src/video/videosurface.h"
 #include "src/widget/tool/movablewidget.h"
 #include "src/persistence/settings.h"
@@ -30,6 +31,9 @@
 #include <QLabel>
 #include <QBoxLayout>
 #include <QFrame>
+#include <QPushButton>
+#include <QStringList>
+#include <QTimer>
 
 NetCamView::NetCamView(int friendId, QWidget* parent)
     : GenericNetCamView(parent)
@@ -55,6 +59,21 @@ NetCamView::NetCamView(int friendId, QWidget* parent)
     frameLayout->addWidget(selfVideoSurface);
     frameLayout->setMargin(0);
 
+    statsLabel = new QLabel(videoSurface);
+    statsLabel->setStyleSheet("QLabel { color: white; background-color: rgba(0, 0, 0, 160); padding: 4px; }");
+    statsLabel->setTextInteractionFlags(Qt::TextSelectableByMouse);
+    statsLabel->move(8, 8);
+    statsLabel->hide();
+
+    statsTimer = new QTimer(this);
+    statsTimer->setInterval(1000);
+    connect(statsTimer, &QTimer::timeout, this, &NetCamView::updateStats);
+
+    statsButton = new QPushButton(tr("Call statistics"));
+    statsButton->setCheckable(true);
+    buttonLayout->insertWidget(0, statsButton);
+    connect(statsButton, &QPushButton::toggled, this, &NetCamView::toggleStats);
+
     updateRatio();
     connections += connect(selfVideoSurface, &VideoSurface::ratioChanged, this, &NetCamView::updateRatio);
 
@@ -142,6 +161,55 @@ void NetCamView::updateRatio()
     selfFrame->setRatio(selfVideoSurface->getRatio());
 }
 
+void NetCamView::toggleStats(bool show)
+{
+    statsLabel->setVisible(show);
+    if (!show)
+    {
+        statsTimer->stop();
+        return;
+    }
+
+    updateStats();
+    statsTimer->start();
+}
+
+void NetCamView::updateStats()
+{
+    CoreAV* av = Core::getInstance()->getAv();
+    std::shared_ptr<const CallStats> stats = av->getCallStats(friendId);
+    if (!stats)
+    {
+        statsLabel->setText(tr("No call in progress"));
+        statsLabel->adjustSize();
+        return;
+    }
+
+    AudioJitterBuffer::Stats audio = av->getCallAudioStats(friendId);
+    QStringList lines;
+    lines << tr("Audio: %1 kb/s, sent %2 (%3 errors), received %4")
+             .arg(stats->audioBitrate.load()).arg(stats->audioFramesSent.load())
+             .arg(stats->audioSendErrors.load()).arg(stats->audioFramesReceived.load());
+    lines << tr("Audio playback: %1 ms latency, %2 ms jitter, %3 concealed")
+             .arg(audio.latency).arg(audio.jitter).arg(audio.concealed);
+    lines << tr("Video: %1 kb/s, sent %2 (%3 errors, %4 dropped, %5 stale), received %6")
+             .arg(stats->videoBitrate.load()).arg(stats->videoFramesSent.load())
+             .arg(stats->videoSendErrors.load()).arg(stats->videoFramesDropped.load())
+             .arg(stats->videoFramesStale.load()).arg(stats->videoFramesReceived.load());
+    lines << tr("Video timing: convert %1 ms, encode %2 ms")
+             .arg(stats->convertTime / 1000.0, 0, 'f', 1).arg(stats->encodeTime / 1000.0, 0, 'f', 1);
+    lines << tr("Call setup: answered after %1 ms, first audio after %2 ms, first video after %3 ms")
+             .arg(stats->answerDelay.load()).arg(stats->firstAudioDelay.load())
+             .arg(stats->firstVideoDelay.load());
+    lines << tr("Capture to send: audio %1 ms, video %2 ms, video behind by %3 ms")
+             .arg(stats->audioLatency / 1000.0, 0, 'f', 1).arg(stats->videoLatency / 1000.0, 0, 'f', 1)
+             .arg(stats->avSkew() / 1000.0, 0, 'f', 1);
+
+    statsLabel->setText(lines.join('\n'));
+    statsLabel->adjustSize();
+    statsLabel->raise();
+}
+
 void NetCamView::updateFrameSize(QSize size)
 {
     selfFrame->setMaximumSize(size.height() / 3, size.width() / 3);
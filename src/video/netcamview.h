@@ -27,6 +27,9 @@ class QHBoxLayout;
 struct vpx_image;
 class VideoSource;
 class QFrame;
+class QLabel;
+class QPushButton;
+class QTimer;
 class MovableWidget;
 
 class NetCamView : public GenericNetCamView
@@ -48,6 +51,8 @@ protected:
 
 private slots:
     void updateRatio();
+    void toggleStats(bool show);
+    void updateStats();
 
 private:
     void updateFrameSize(QSize size);
@@ -55,6 +60,9 @@ private:
     VideoSurface* selfVideoSurface;
     MovableWidget* selfFrame;
     int friendId;
+    QPushButton* statsButton;
+    QLabel* statsLabel; ///< Overlaid on the friend's video, for triaging call quality
+    QTimer* statsTimer;
     bool e = false;
     QVector<QMetaObject::Connection> connections;
 };
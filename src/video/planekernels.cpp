@@ -0,0 +1,94 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "planekernels.h"
+
+#include <QtGlobal>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PLANEKERNELS_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define PLANEKERNELS_NEON
+#include <arm_neon.h>
+#endif
+
+namespace
+{
+
+/// Halves one row pair, returns how many destination pixels were done
+int halveRowSimd(const uint8_t* row0, const uint8_t* row1, uint8_t* dst, int dstWidth)
+{
+    int x = 0;
+#if defined(PLANEKERNELS_SSE2)
+    const __m128i lowBytes = _mm_set1_epi16(0x00ff);
+    for (; x + 16 <= dstWidth; x += 16)
+    {
+        const __m128i* src0 = reinterpret_cast<const __m128i*>(row0 + 2 * x);
+        const __m128i* src1 = reinterpret_cast<const __m128i*>(row1 + 2 * x);
+        __m128i a = _mm_avg_epu8(_mm_loadu_si128(src0), _mm_loadu_si128(src1));
+        __m128i b = _mm_avg_epu8(_mm_loadu_si128(src0 + 1), _mm_loadu_si128(src1 + 1));
+        // a and b now hold 16 vertical averages each, average the neighbouring pairs
+        a = _mm_avg_epu16(_mm_and_si128(a, lowBytes), _mm_srli_epi16(a, 8));
+        b = _mm_avg_epu16(_mm_and_si128(b, lowBytes), _mm_srli_epi16(b, 8));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), _mm_packus_epi16(a, b));
+    }
+#elif defined(PLANEKERNELS_NEON)
+    for (; x + 16 <= dstWidth; x += 16)
+    {
+        uint8x16x2_t a = vld2q_u8(row0 + 2 * x);
+        uint8x16x2_t b = vld2q_u8(row1 + 2 * x);
+        uint8x16_t even = vrhaddq_u8(a.val[0], b.val[0]);
+        uint8x16_t odd = vrhaddq_u8(a.val[1], b.val[1]);
+        vst1q_u8(dst + x, vrhaddq_u8(even, odd));
+    }
+#else
+    Q_UNUSED(row0);
+    Q_UNUSED(row1);
+    Q_UNUSED(dst);
+    Q_UNUSED(dstWidth);
+#endif
+    return x;
+}
+
+}
+
+/**
+ * @brief Downscales a plane by two in both directions with a box filter.
+ *
+ * The vectorized path rounds twice, so its pixels can be one step brighter than
+ * the exact average. That's invisible, and still better than what a bilinear
+ * swscale does to a large ratio.
+ */
+void PlaneKernels::halvePlane(const uint8_t* src, int srcStride,
+                              uint8_t* dst, int dstStride, int dstWidth, int dstHeight)
+{
+    for (int y = 0; y < dstHeight; ++y)
+    {
+        const uint8_t* row0 = src + 2 * y * srcStride;
+        const uint8_t* row1 = row0 + srcStride;
+        uint8_t* out = dst + y * dstStride;
+
+        for (int x = halveRowSimd(row0, row1, out, dstWidth); x < dstWidth; ++x)
+        {
+            int sum = row0[2 * x] + row0[2 * x + 1] + row1[2 * x] + row1[2 * x + 1];
+            out[x] = static_cast<uint8_t>((sum + 2) >> 2);
+        }
+    }
+}
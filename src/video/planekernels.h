@@ -0,0 +1,34 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PLANEKERNELS_H
+#define PLANEKERNELS_H
+
+#include <cstdint>
+
+/// Hand-written loops for the plane operations swscale is slow at
+namespace PlaneKernels
+{
+    /// Averages every 2x2 block of src into one pixel of dst.
+    /// src must have at least 2*dstWidth columns and 2*dstHeight rows.
+    void halvePlane(const uint8_t* src, int srcStride,
+                    uint8_t* dst, int dstStride, int dstWidth, int dstHeight);
+}
+
+#endif // PLANEKERNELS_H
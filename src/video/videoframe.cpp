@@ -18,9 +18,11 @@
 */
 
 #include <iostream>
+#include <atomic>
 
 #include <QMutexLocker>
 #include <QDebug>
+#include <QHash>
 #include <vpx/vpx_image.h>
 extern "C" {
 #include <libavcodec/avcodec.h>
@@ -29,12 +31,136 @@ extern "C" {
 }
 #include "videoframe.h"
 #include "camerasource.h"
+#include "framebufferpool.h"
+#include "planekernels.h"
+#include "src/trace.h"
+#include "src/memorystats.h"
+
+namespace
+{
+
+/// The geometry and algorithm of a conversion, everything a SwsContext depends on
+struct SwsKey
+{
+    int srcWidth, srcHeight, srcFormat;
+    int dstWidth, dstHeight, dstFormat;
+    int algo;
+
+    bool operator==(const SwsKey& other) const
+    {
+        return srcWidth == other.srcWidth && srcHeight == other.srcHeight && srcFormat == other.srcFormat
+            && dstWidth == other.dstWidth && dstHeight == other.dstHeight && dstFormat == other.dstFormat
+            && algo == other.algo;
+    }
+};
+
+uint qHash(const SwsKey& key)
+{
+    return ::qHash(key.srcWidth) ^ ::qHash(key.srcHeight << 8) ^ ::qHash(key.srcFormat << 16)
+         ^ ::qHash(key.dstWidth << 4) ^ ::qHash(key.dstHeight << 12) ^ ::qHash(key.dstFormat << 20)
+         ^ ::qHash(key.algo << 24);
+}
+
+/// Keeps the SwsContexts of finished conversions, so the next frame of the same
+/// geometry doesn't have to rebuild the scaler filter tables.
+/// A context is only used by one conversion at a time, a stream converting frames in
+/// several threads gets one context per thread.
+class SwsContextPool
+{
+public:
+    static SwsContextPool& getInstance()
+    {
+        static SwsContextPool pool;
+        return pool;
+    }
+
+    ~SwsContextPool()
+    {
+        for (SwsContext* ctx : idle)
+            sws_freeContext(ctx);
+    }
+
+    /// Returns a context for the conversion, give it back with release
+    SwsContext* acquire(const SwsKey& key)
+    {
+        {
+            QMutexLocker locker(&mutex);
+            auto it = idle.find(key);
+            if (it != idle.end())
+            {
+                SwsContext* ctx = it.value();
+                idle.erase(it);
+                return ctx;
+            }
+        }
+
+        return sws_getContext(key.srcWidth, key.srcHeight, (AVPixelFormat)key.srcFormat,
+                              key.dstWidth, key.dstHeight, (AVPixelFormat)key.dstFormat,
+                              key.algo, nullptr, nullptr, nullptr);
+    }
+
+    void release(const SwsKey& key, SwsContext* ctx)
+    {
+        if (!ctx)
+            return;
+
+        QMutexLocker locker(&mutex);
+        if (idle.size() >= maxIdle)
+        {
+            // more geometries than streams in a call, the ones in use are recreated once
+            sws_freeContext(idle.begin().value());
+            idle.erase(idle.begin());
+        }
+
+        idle.insert(key, ctx);
+    }
+
+private:
+    SwsContextPool() = default;
+
+private:
+    // several streams of a group call can share a geometry, so keep a few contexts per key
+    QMultiHash<SwsKey, SwsContext*> idle;
+    QMutex mutex;
+    static constexpr int maxIdle = 16;
+};
+
+/// Bytes held by the RGB24 conversions of all the frames
+std::atomic<qint64> scaledRGB24Bytes{0};
+/// Past this, each frame only keeps its newest RGB24 conversion
+const qint64 maxScaledRGB24Bytes = 64 * 1024 * 1024;
+
+qint64 rgb24Bytes(const AVFrame* frame)
+{
+    return 3LL * frame->width * frame->height;
+}
+
+/// Converts a whole frame with a pooled context
+void scaleFrame(const SwsKey& key, const AVFrame* src, AVFrame* dst)
+{
+    SwsContext* swsCtx = SwsContextPool::getInstance().acquire(key);
+    if (!swsCtx)
+    {
+        qCritical() << "sws_getContext failed";
+        return;
+    }
+
+    sws_scale(swsCtx, (uint8_t const * const *)src->data,
+                src->linesize, 0, key.srcHeight,
+                dst->data, dst->linesize);
+    SwsContextPool::getInstance().release(key, swsCtx);
+}
+
+}
 
 VideoFrame::VideoFrame(AVFrame* frame, int w, int h, int fmt, std::function<void()> freelistCallback)
     : freelistCallback{freelistCallback},
       frameOther{nullptr}, frameYUV420{nullptr}, frameRGB24{nullptr},
-      width{w}, height{h}, pixFmt{fmt}
+      width{w}, height{h}, pixFmt{fmt},
+      sourceBytes{qMax(0, av_image_get_buffer_size(static_cast<AVPixelFormat>(fmt), w, h, 1))}
 {
+    MemoryStats::allocated(MemoryStats::VideoFrames, sourceBytes);
+
     // Silences pointless swscale warning spam
     // See libswscale/utils.c:1153 @ 74f0bd3
     frame->color_range = AVCOL_RANGE_MPEG;
@@ -53,6 +179,7 @@ VideoFrame::VideoFrame(AVFrame* frame, int w, int h, int fmt, std::function<void
 
     if (pixFmt == AV_PIX_FMT_YUV420P) {
         frameYUV420 = frame;
+        yuvReady = true;
     } else if (pixFmt == AV_PIX_FMT_RGB24) {
         frameRGB24 = frame;
     } else {
@@ -65,6 +192,12 @@ VideoFrame::VideoFrame(AVFrame* frame, std::function<void()> freelistCallback)
 {
 }
 
+VideoFrame::VideoFrame(AVFrame* frame, std::function<void()> freelistCallback, std::shared_ptr<FrameBufferPool> pool)
+    : VideoFrame{frame, frame->width, frame->height, frame->format, freelistCallback}
+{
+    this->pool = pool;
+}
+
 VideoFrame::VideoFrame(AVFrame* frame)
     : VideoFrame{frame, frame->width, frame->height, frame->format, nullptr}
 {
@@ -76,19 +209,31 @@ VideoFrame::~VideoFrame()
         freelistCallback();
 
     releaseFrameLockless();
+    MemoryStats::freed(MemoryStats::VideoFrames, sourceBytes);
+}
+
+int VideoFrame::liveCount()
+{
+    return static_cast<int>(MemoryStats::get(MemoryStats::VideoFrames).objects);
+}
+
+qint64 VideoFrame::rgb24CacheBytes()
+{
+    return scaledRGB24Bytes;
 }
 
 QImage VideoFrame::toQImage(QSize size)
 {
-    if (!convertToRGB24(size))
+    AVFrame* rgbFrame = convertToRGB24(size);
+    if (!rgbFrame)
         return QImage();
 
-    QMutexLocker locker(&biglock);
+    QMutexLocker locker(&rgbLock);
 
-    return QImage(*frameRGB24->data, frameRGB24->width, frameRGB24->height, *frameRGB24->linesize, QImage::Format_RGB888);
+    return QImage(*rgbFrame->data, rgbFrame->width, rgbFrame->height, *rgbFrame->linesize, QImage::Format_RGB888);
 }
 
-vpx_image *VideoFrame::toVpxImage()
+vpx_image *VideoFrame::toVpxImage(QSize size)
 {
     // libvpx doesn't provide a clean way to reuse an existing external buffer
     // so we'll manually fill-in the vpx_image fields and hope for the best.
@@ -98,37 +243,62 @@ vpx_image *VideoFrame::toVpxImage()
     if (!convertToYUV420())
         return img;
 
-    img->w = img->d_w = width;
-    img->h = img->d_h = height;
+    QMutexLocker locker(&yuvLock);
+
+    AVFrame* yuvFrame = frameYUV420;
+    if (!size.isEmpty() && size.width() * 2 <= width && size.height() * 2 <= height)
+    {
+        if (scaledYUV420 && scaledYUV420Target != size)
+            freeFrame(scaledYUV420);
+
+        if (!scaledYUV420)
+        {
+            scaledYUV420 = halveYUV420(size);
+            scaledYUV420Target = size;
+        }
+
+        if (scaledYUV420)
+            yuvFrame = scaledYUV420;
+    }
+
+    img->w = img->d_w = yuvFrame->width;
+    img->h = img->d_h = yuvFrame->height;
     img->fmt = VPX_IMG_FMT_I420;
-    img->planes[0] = frameYUV420->data[0];
-    img->planes[1] = frameYUV420->data[1];
-    img->planes[2] = frameYUV420->data[2];
+    img->planes[0] = yuvFrame->data[0];
+    img->planes[1] = yuvFrame->data[1];
+    img->planes[2] = yuvFrame->data[2];
     img->planes[3] = nullptr;
-    img->stride[0] = frameYUV420->linesize[0];
-    img->stride[1] = frameYUV420->linesize[1];
-    img->stride[2] = frameYUV420->linesize[2];
-    img->stride[3] = frameYUV420->linesize[3];
+    img->stride[0] = yuvFrame->linesize[0];
+    img->stride[1] = yuvFrame->linesize[1];
+    img->stride[2] = yuvFrame->linesize[2];
+    img->stride[3] = yuvFrame->linesize[3];
     return img;
 }
 
-bool VideoFrame::convertToRGB24(QSize size)
+AVFrame* VideoFrame::convertToRGB24(QSize size)
 {
-    QMutexLocker locker(&biglock);
+    TraceSpan span{"VideoFrame::convertToRGB24"};
+    QMutexLocker locker(&rgbLock);
+    // shared with the I420 conversion, this only keeps frameOther from being freed under us
+    QReadLocker sourceLocker(&sourceLock);
 
     AVFrame* sourceFrame;
     if (frameOther)
     {
         sourceFrame = frameOther;
     }
-    else if (frameYUV420)
+    else if (yuvReady)
     {
         sourceFrame = frameYUV420;
     }
+    else if (frameRGB24)
+    {
+        sourceFrame = frameRGB24;
+    }
     else
     {
         qWarning() << "None of the frames are valid! Did someone release us?";
-        return false;
+        return nullptr;
     }
     //std::cout << "converting to RGB24" << std::endl;
 
@@ -138,138 +308,221 @@ bool VideoFrame::convertToRGB24(QSize size)
         size.setHeight(sourceFrame->height);
     }
 
-    if (frameRGB24)
-    {
-        if (frameRGB24->width == size.width() && frameRGB24->height == size.height())
-            return true;
+    if (frameRGB24 && frameRGB24->width == size.width() && frameRGB24->height == size.height())
+        return frameRGB24;
 
-        av_free(frameRGB24->opaque);
-        av_frame_unref(frameRGB24);
-        av_frame_free(&frameRGB24);
+    for (AVFrame* scaled : scaledRGB24)
+    {
+        if (scaled->width == size.width() && scaled->height == size.height())
+            return scaled;
     }
 
-    frameRGB24=av_frame_alloc();
-    if (!frameRGB24)
+    // a source rarely has more views than this, and under memory pressure we only keep one
+    int maxScaledFrames = scaledRGB24Bytes > maxScaledRGB24Bytes ? 1 : 4;
+    while (scaledRGB24.size() >= maxScaledFrames)
     {
-        qCritical() << "av_frame_alloc failed";
-        return false;
+        scaledRGB24Bytes -= rgb24Bytes(scaledRGB24.first());
+        freeFrame(scaledRGB24.first());
+        scaledRGB24.removeFirst();
     }
 
-    int imgBufferSize = av_image_get_buffer_size(AV_PIX_FMT_RGB24, size.width(), size.height(), 1);
-    uint8_t* buf = (uint8_t*)av_malloc(imgBufferSize);
-    if (!buf)
+    AVFrame* rgbFrame = allocateFrame(size.width(), size.height(), AV_PIX_FMT_RGB24);
+    if (!rgbFrame)
+        return nullptr;
+
+    int srcWidth = width, srcHeight = height;
+    int srcFormat = sourceFrame == frameOther ? pixFmt
+                  : sourceFrame == frameYUV420 ? AV_PIX_FMT_YUV420P : AV_PIX_FMT_RGB24;
+    AVFrame* halved = halveYUV420(size);
+    if (halved)
     {
-        qCritical() << "av_malloc failed";
-        av_frame_free(&frameRGB24);
-        return false;
+        sourceFrame = halved;
+        srcWidth = halved->width;
+        srcHeight = halved->height;
+        srcFormat = AV_PIX_FMT_YUV420P;
     }
-    frameRGB24->opaque = buf;
-
-    uint8_t** data = frameRGB24->data;
-    int* linesize = frameRGB24->linesize;
-    av_image_fill_arrays(data, linesize, buf, AV_PIX_FMT_RGB24, size.width(), size.height(), 1);
-    frameRGB24->width = size.width();
-    frameRGB24->height = size.height();
 
     // Bilinear is better for shrinking, bicubic better for upscaling
-    int resizeAlgo = size.width()<=width ? SWS_BILINEAR : SWS_BICUBIC;
+    int resizeAlgo = size.width()<=srcWidth ? SWS_BILINEAR : SWS_BICUBIC;
 
-    SwsContext *swsCtx =  sws_getContext(width, height, (AVPixelFormat)pixFmt,
-                                          size.width(), size.height(), AV_PIX_FMT_RGB24,
-                                          resizeAlgo, nullptr, nullptr, nullptr);
-    sws_scale(swsCtx, (uint8_t const * const *)sourceFrame->data,
-                sourceFrame->linesize, 0, height,
-                frameRGB24->data, frameRGB24->linesize);
-    sws_freeContext(swsCtx);
+    scaleFrame({srcWidth, srcHeight, srcFormat, size.width(), size.height(), AV_PIX_FMT_RGB24, resizeAlgo},
+               sourceFrame, rgbFrame);
 
-    return true;
+    if (halved)
+        freeFrame(halved);
+
+    scaledRGB24.append(rgbFrame);
+    scaledRGB24Bytes += rgb24Bytes(rgbFrame);
+    return rgbFrame;
+}
+
+/**
+ * @brief Halves the I420 frame for as long as it stays at least twice the size we need.
+ *
+ * Our box filter is much cheaper than letting swscale shrink a 1080p frame into
+ * a small view, and doesn't alias like it does at large ratios.
+ * @return The smallest halved frame, or nullptr if the frame can't be halved.
+ */
+AVFrame* VideoFrame::halveYUV420(QSize size)
+{
+    TraceSpan span{"VideoFrame::halveYUV420"};
+    if (!yuvReady)
+        return nullptr;
+
+    AVFrame* halved = nullptr;
+    int w = width, h = height;
+    // multiples of 4 keep the chroma planes exactly twice the halved ones
+    while (w % 4 == 0 && h % 4 == 0 && size.width() * 2 <= w && size.height() * 2 <= h)
+    {
+        AVFrame* next = allocateFrame(w / 2, h / 2, AV_PIX_FMT_YUV420P);
+        if (!next)
+            break;
+
+        const AVFrame* from = halved ? halved : frameYUV420;
+        for (int i = 0; i < 3; ++i)
+        {
+            int shift = i ? 1 : 0;
+            PlaneKernels::halvePlane(from->data[i], from->linesize[i], next->data[i], next->linesize[i],
+                                     (w / 2) >> shift, (h / 2) >> shift);
+        }
+
+        if (halved)
+            freeFrame(halved);
+
+        halved = next;
+        w /= 2;
+        h /= 2;
+    }
+
+    return halved;
 }
 
 bool VideoFrame::convertToYUV420()
 {
-    QMutexLocker locker(&biglock);
+    if (yuvReady)
+        return true;
 
-    if (frameYUV420)
+    TraceSpan span{"VideoFrame::convertToYUV420"};
+
+    QMutexLocker locker(&yuvLock);
+
+    if (yuvReady)
         return true;
 
-    AVFrame* sourceFrame;
-    if (frameOther)
-    {
-        sourceFrame = frameOther;
-    }
-    else if (frameRGB24)
     {
-        sourceFrame = frameRGB24;
+        QReadLocker sourceLocker(&sourceLock);
+
+        AVFrame* sourceFrame;
+        if (frameOther)
+        {
+            sourceFrame = frameOther;
+        }
+        else if (frameRGB24)
+        {
+            sourceFrame = frameRGB24;
+        }
+        else
+        {
+            qCritical() << "None of the frames are valid! Did someone release us?";
+            return false;
+        }
+        //std::cout << "converting to YUV420" << std::endl;
+
+        frameYUV420 = allocateFrame(width, height, AV_PIX_FMT_YUV420P);
+        if (!frameYUV420)
+            return false;
+
+        scaleFrame({width, height, pixFmt, width, height, AV_PIX_FMT_YUV420P, SWS_BILINEAR},
+                   sourceFrame, frameYUV420);
     }
-    else
-    {
-        qCritical() << "None of the frames are valid! Did someone release us?";
-        return false;
-    }
-    //std::cout << "converting to YUV420" << std::endl;
 
-    frameYUV420=av_frame_alloc();
-    if (!frameYUV420)
-    {
-        qCritical() << "av_frame_alloc failed";
-        return false;
-    }
+    yuvReady = true;
 
-    int imgBufferSize = av_image_get_buffer_size(AV_PIX_FMT_RGB24, width, height, 1);
-    uint8_t* buf = (uint8_t*)av_malloc(imgBufferSize);
-    if (!buf)
+    // the encoder only needs the I420 copy, and the displays can convert from it too,
+    // unless one of them is still converting the original, then we keep it until release
+    if (sourceLock.tryLockForWrite())
     {
-        qCritical() << "av_malloc failed";
-        av_frame_free(&frameYUV420);
-        return false;
+        if (frameOther)
+            freeFrame(frameOther);
+        sourceLock.unlock();
     }
-    frameYUV420->opaque = buf;
-
-    uint8_t** data = frameYUV420->data;
-    int* linesize = frameYUV420->linesize;
-    av_image_fill_arrays(data, linesize, buf, AV_PIX_FMT_YUV420P, width, height, 1);
-
-    SwsContext *swsCtx =  sws_getContext(width, height, (AVPixelFormat)pixFmt,
-                                          width, height, AV_PIX_FMT_YUV420P,
-                                          SWS_BILINEAR, nullptr, nullptr, nullptr);
-    sws_scale(swsCtx, (uint8_t const * const *)sourceFrame->data,
-                sourceFrame->linesize, 0, height,
-                frameYUV420->data, frameYUV420->linesize);
-    sws_freeContext(swsCtx);
 
     return true;
 }
 
 void VideoFrame::releaseFrame()
 {
-    QMutexLocker locker(&biglock);
+    // always in this order, the conversions take the sourceLock last
+    QMutexLocker rgbLocker(&rgbLock);
+    QMutexLocker yuvLocker(&yuvLock);
+    QWriteLocker sourceLocker(&sourceLock);
     freelistCallback = nullptr;
     releaseFrameLockless();
 }
 
 void VideoFrame::releaseFrameLockless()
 {
+    yuvReady = false;
+    nativeBuffer.reset();
     if (frameOther)
-    {
-        av_free(frameOther->opaque);
-        av_frame_unref(frameOther);
-        av_frame_free(&frameOther);
-    }
+        freeFrame(frameOther);
     if (frameYUV420)
-    {
-        av_free(frameYUV420->opaque);
-        av_frame_unref(frameYUV420);
-        av_frame_free(&frameYUV420);
-    }
+        freeFrame(frameYUV420);
     if (frameRGB24)
+        freeFrame(frameRGB24);
+
+    for (AVFrame*& scaled : scaledRGB24)
     {
-        av_free(frameRGB24->opaque);
-        av_frame_unref(frameRGB24);
-        av_frame_free(&frameRGB24);
+        scaledRGB24Bytes -= rgb24Bytes(scaled);
+        freeFrame(scaled);
     }
+    scaledRGB24.clear();
+
+    if (scaledYUV420)
+        freeFrame(scaledYUV420);
+}
+
+AVFrame* VideoFrame::allocateFrame(int w, int h, int fmt)
+{
+    if (pool)
+        return pool->acquire(w, h, fmt);
+
+    return FrameBufferPool::allocate(w, h, fmt);
+}
+
+void VideoFrame::freeFrame(AVFrame*& frame)
+{
+    if (pool)
+        pool->release(frame);
+    else
+        FrameBufferPool::free(frame);
+
+    frame = nullptr;
 }
 
 QSize VideoFrame::getSize()
 {
     return {width, height};
 }
+
+void VideoFrame::setNativeBuffer(std::shared_ptr<void> buffer)
+{
+    QWriteLocker locker(&sourceLock);
+    nativeBuffer = buffer;
+}
+
+std::shared_ptr<void> VideoFrame::getNativeBuffer()
+{
+    QReadLocker locker(&sourceLock);
+    return nativeBuffer;
+}
+
+void VideoFrame::setCaptureTime(qint64 time)
+{
+    captureTime.store(time, std::memory_order_relaxed);
+}
+
+qint64 VideoFrame::getCaptureTime() const
+{
+    return captureTime.load(std::memory_order_relaxed);
+}
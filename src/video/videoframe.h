@@ -21,44 +21,76 @@
 #define VIDEOFRAME_H
 
 #include <QMutex>
+#include <QReadWriteLock>
 #include <QImage>
+#include <QVector>
 #include <functional>
+#include <memory>
+#include <atomic>
 
 struct AVFrame;
 struct AVCodecContext;
 struct vpx_image;
+class FrameBufferPool;
 
 /// VideoFrame takes ownership of an AVFrame* and allows fast conversions to other formats
 /// Ownership of all video frame buffers is kept by the VideoFrame, even after conversion
 /// All references to the frame data become invalid when the VideoFrame is deleted
 /// We try to avoid pixel format conversions as much as possible, at the cost of some memory
-/// All methods are thread-safe. If provided freelistCallback will be called by the destructor,
+/// Once converted to I420 the original frame is dropped, and the RGB24 conversions are
+/// limited to one per frame when all the frames together hold too many of them
+/// All methods are thread-safe, and conversions to different formats run in parallel.
+/// If provided freelistCallback will be called by the destructor,
 /// unless releaseFrame was called in between.
+/// With a pool, the converted frames are taken from it and all our frames go back to it.
 class VideoFrame
 {
 public:
     explicit VideoFrame(AVFrame* frame);
     VideoFrame(AVFrame* frame, std::function<void()> freelistCallback);
     VideoFrame(AVFrame* frame, int w, int h, int fmt, std::function<void()> freelistCallback);
+    VideoFrame(AVFrame* frame, std::function<void()> freelistCallback, std::shared_ptr<FrameBufferPool> pool);
     ~VideoFrame();
 
+    /// Returns how many frames exist right now, in all the threads
+    static int liveCount();
+    /// Returns the bytes held by the RGB24 conversions of all the frames
+    static qint64 rgb24CacheBytes();
+
     /// Return the size of the original frame
     QSize getSize();
 
+    /// The platform image the frame wraps without copying, like a CVPixelBufferRef on macOS
+    /// Set by the source before it shares the frame, renderers can draw it directly
+    void setNativeBuffer(std::shared_ptr<void> buffer);
+    /// Keeps the native image alive on its own, nullptr if there's none or the frame was released
+    std::shared_ptr<void> getNativeBuffer();
+
+    /// When the source captured the frame, in µs of the CaptureClock, set before it shares the frame
+    /// The conversions keep it, 0 means unknown, like for the frames we receive
+    void setCaptureTime(qint64 time);
+    qint64 getCaptureTime() const;
+
     /// Frees all internal buffers and frame data, removes the freelistCallback
     /// This makes all converted objects that shares our internal buffers invalid
     void releaseFrame();
 
     /// Converts the VideoFrame to a QImage that shares our internal video buffer
+    /// The conversions to the last few sizes are kept, so several views of different sizes
+    /// can display the same frame without converting it again
     QImage toQImage(QSize size = QSize());
     /// Converts the VideoFrame to a vpx_image_t that shares our internal video buffer
     /// Free it with operator delete, NOT vpx_img_free
-    vpx_image* toVpxImage();
+    /// With a size, the frame is halved for as long as it stays at least that large
+    vpx_image* toVpxImage(QSize size = QSize());
 
 protected:
-    bool convertToRGB24(QSize size = QSize());
+    AVFrame* convertToRGB24(QSize size = QSize());
     bool convertToYUV420();
+    AVFrame* halveYUV420(QSize size);
     void releaseFrameLockless();
+    AVFrame* allocateFrame(int w, int h, int fmt);
+    void freeFrame(AVFrame*& frame);
 
 private:
     // Disable copy. Use a shared_ptr if you need copies.
@@ -67,10 +99,20 @@ private:
 
 private:
     std::function<void()> freelistCallback;
-    QMutex biglock;
+    std::shared_ptr<FrameBufferPool> pool;
+    QMutex rgbLock; ///< Guards the RGB24 conversions
+    QMutex yuvLock; ///< Guards the conversion to I420 and the shrunk copy for the encoder
+    QReadWriteLock sourceLock; ///< Held for reading while frameOther is converted, for writing to free it
+    std::atomic_bool yuvReady{false}; ///< Once true, frameYUV420 can be read without a lock until released
     AVFrame* frameOther, *frameYUV420, *frameRGB24;
+    std::shared_ptr<void> nativeBuffer; ///< What frameOther points into, if it's a platform image, with the sourceLock
+    std::atomic<qint64> captureTime{0};
+    QVector<AVFrame*> scaledRGB24; ///< Conversions to RGB24 at various sizes, the oldest first
+    AVFrame* scaledYUV420 = nullptr; ///< Last shrunk frame given to the encoder
+    QSize scaledYUV420Target; ///< The size scaledYUV420 was shrunk for
     int width, height;
     int pixFmt;
+    const int sourceBytes; ///< Of the frame we were given, as counted by MemoryStats
 };
 
 #endif // VIDEOFRAME_H
@@ -27,6 +27,7 @@ struct VideoMode
     unsigned short width, height; ///< Displayed video resolution (NOT frame resolution)
     float FPS; ///< Max frames per second supported by the device at this resolution
     uint32_t pixel_format;
+    unsigned short x, y; ///< Top left corner of the captured area, for screen sharing
 
     /// All zeros means a default/unspecified mode
     operator bool() const
@@ -39,7 +40,9 @@ struct VideoMode
         return width == other.width
                 && height == other.height
                 && FPS == other.FPS
-                && pixel_format == other.pixel_format;
+                && pixel_format == other.pixel_format
+                && x == other.x
+                && y == other.y;
     }
 
     uint32_t norm(const VideoMode& other) const
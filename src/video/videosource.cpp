@@ -0,0 +1,51 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "videosource.h"
+#include "videoframe.h"
+
+#include <QMutexLocker>
+#include <QVector>
+
+void VideoSource::setTargetSize(const void* subscriber, QSize size)
+{
+    QMutexLocker locker(&targetSizesLock);
+
+    if (size.isEmpty())
+        targetSizes.remove(subscriber);
+    else
+        targetSizes.insert(subscriber, size);
+}
+
+void VideoSource::prepareFrame(const std::shared_ptr<VideoFrame>& frame)
+{
+    QVector<QSize> sizes;
+    {
+        QMutexLocker locker(&targetSizesLock);
+        for (QSize size : targetSizes)
+        {
+            if (!sizes.contains(size))
+                sizes.append(size);
+        }
+    }
+
+    // the frame keeps its conversions, the subscribers just get them
+    for (QSize size : sizes)
+        frame->toQImage(size);
+}
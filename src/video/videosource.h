@@ -21,6 +21,9 @@
 #define VIDEOSOURCE_H
 
 #include <QObject>
+#include <QHash>
+#include <QMutex>
+#include <QSize>
 #include <memory>
 
 class VideoFrame;
@@ -39,11 +42,23 @@ public:
     /// Stop emitting frameAvailable signals, and free associated resources if necessary
     virtual void unsubscribe() = 0;
 
+    /// The subscriber will display the frames at this size, an empty size cancels it
+    /// The frames are converted to each distinct size once, before being emitted
+    void setTargetSize(const void* subscriber, QSize size);
+
+protected:
+    /// Converts the frame to the sizes given to setTargetSize, sources call it before emitting
+    void prepareFrame(const std::shared_ptr<VideoFrame>& frame);
+
 signals:
     void frameAvailable(std::shared_ptr<VideoFrame> frame);
     /// Emitted when the source is stopped for an indefinite amount of time,
     /// but might restart sending frames again later
     void sourceStopped();
+
+private:
+    QHash<const void*, QSize> targetSizes;
+    QMutex targetSizesLock;
 };
 
 #endif // VIDEOSOURCE_H
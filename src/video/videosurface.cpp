@@ -25,10 +25,18 @@
 #include "src/persistence/settings.h"
 #include "src/core/core.h"
 #include "src/widget/style.h"
+#ifdef QTOX_GL_VIDEO
+#include "src/video/glvideorenderer.h"
+#endif
 
 #include <QPainter>
 #include <QLabel>
 #include <QDebug>
+#include <QTimer>
+#include <QScreen>
+#include <QWindow>
+#include <QGuiApplication>
+#include <QThread>
 
 float getSizeRatio(const QSize size)
 {
@@ -43,7 +51,28 @@ VideoSurface::VideoSurface(const QPixmap& avatar, QWidget* parent, bool expandin
     , avatar{avatar}
     , ratio{1.0f}
     , expanding{expanding}
+    , presentTimer{new QTimer{this}}
 {
+    presentTimer->setSingleShot(true);
+    connect(presentTimer, &QTimer::timeout, this, &VideoSurface::presentFrame);
+
+#ifdef QTOX_GL_VIDEO
+    if (GLVideoRenderer::isAvailable())
+    {
+        glRenderer = new GLVideoRenderer(this);
+        glRenderer->setAttribute(Qt::WA_TransparentForMouseEvents);
+        glRenderer->hide();
+
+        // fall back to drawing the frames ourselves
+        connect(glRenderer, &GLVideoRenderer::failed, this, [this]()
+        {
+            glRenderer->deleteLater();
+            glRenderer = nullptr;
+            recalulateBounds();
+        });
+    }
+#endif
+
     recalulateBounds();
 }
 
@@ -101,8 +130,11 @@ void VideoSurface::subscribe()
     if (source && hasSubscribed++ == 0)
     {
         source->subscribe();
-        connect(source, &VideoSource::frameAvailable, this, &VideoSurface::onNewFrameAvailable);
+        acceptFrames = true;
+        connect(source, &VideoSource::frameAvailable, this, &VideoSurface::onNewFrameAvailable,
+                Qt::DirectConnection);
         connect(source, &VideoSource::sourceStopped, this, &VideoSurface::onSourceStopped);
+        recalulateBounds();
     }
 }
 
@@ -114,30 +146,77 @@ void VideoSurface::unsubscribe()
     if (--hasSubscribed != 0)
         return;
 
+    // Disconnecting doesn't wait for a frame the source's thread is delivering, we must wait for it ourselves
+    acceptFrames = false;
+    disconnect(source, &VideoSource::frameAvailable, this, &VideoSurface::onNewFrameAvailable);
+    while (deliveries.load() != 0)
+        QThread::yieldCurrentThread();
+
     lock();
-    lastFrame.reset();
+    pendingFrame.reset();
     unlock();
+    lastFrame.reset();
+    updateRenderer();
 
     ratio = 1.0f;
     recalulateBounds();
     emit ratioChanged();
     emit boundaryChanged();
 
+    source->setTargetSize(this, QSize());
     source->unsubscribe();
-    disconnect(source, &VideoSource::frameAvailable, this, &VideoSurface::onNewFrameAvailable);
     disconnect(source, &VideoSource::sourceStopped, this, &VideoSurface::onSourceStopped);
 }
 
 void VideoSurface::onNewFrameAvailable(std::shared_ptr<VideoFrame> newFrame)
 {
-    QSize newSize;
+    ++deliveries;
+    if (acceptFrames)
+    {
+        lock();
+        pendingFrame = std::move(newFrame);
+        unlock();
+
+        // frames coming in while we wait for the GUI thread just replace the pending one
+        if (!presentQueued.exchange(true))
+            QMetaObject::invokeMethod(this, "presentFrame", Qt::QueuedConnection);
+    }
+    --deliveries;
+}
+
+void VideoSurface::presentFrame()
+{
+    if (lastPresent.isValid())
+    {
+        qint64 wait = frameInterval() - lastPresent.elapsed();
+        if (wait > 0)
+        {
+            if (!presentTimer->isActive())
+                presentTimer->start(wait);
+            return;
+        }
+    }
+
+    presentQueued = false;
 
     lock();
-    lastFrame = newFrame;
-    newSize = lastFrame->getSize();
+    std::shared_ptr<VideoFrame> newFrame = std::move(pendingFrame);
+    pendingFrame.reset();
     unlock();
 
-    float newRatio = getSizeRatio(newSize);
+    if (!newFrame)
+        return;
+
+    lastFrame = newFrame;
+    lastPresent.start();
+
+#ifdef QTOX_GL_VIDEO
+    if (glRenderer)
+        glRenderer->setFrame(newFrame);
+#endif
+    updateRenderer();
+
+    float newRatio = getSizeRatio(newFrame->getSize());
 
     if (newRatio != ratio && isVisible())
     {
@@ -147,25 +226,34 @@ void VideoSurface::onNewFrameAvailable(std::shared_ptr<VideoFrame> newFrame)
         emit boundaryChanged();
     }
 
-    update();
+    // don't repaint what nobody would see
+    if (isVisible() && !visibleRegion().isEmpty())
+        update();
 }
 
 void VideoSurface::onSourceStopped()
 {
     // If the source's stream is on hold, just revert back to the avatar view
+    lock();
+    pendingFrame.reset();
+    unlock();
     lastFrame.reset();
+    updateRenderer();
     update();
 }
 
 void VideoSurface::paintEvent(QPaintEvent*)
 {
-    lock();
-
     QPainter painter(this);
     painter.fillRect(painter.viewport(), Qt::black);
-    if (lastFrame)
+    if (lastFrame && glRenderer)
     {
-        QImage frame = lastFrame->toQImage(rect().size());
+        // the renderer draws the frame over us
+    }
+    else if (lastFrame)
+    {
+        // converted at the size it's drawn at, so the painter doesn't have to scale it again
+        QImage frame = lastFrame->toQImage(boundingRect.size());
         if (frame.isNull())
             lastFrame.reset();
         painter.drawImage(boundingRect, frame, frame.rect(), Qt::NoFormatConversion);
@@ -180,8 +268,6 @@ void VideoSurface::paintEvent(QPaintEvent*)
 
         painter.drawPixmap(boundingRect, drawnAvatar, drawnAvatar.rect());
     }
-
-    unlock();
 }
 
 void VideoSurface::resizeEvent(QResizeEvent* event)
@@ -194,7 +280,8 @@ void VideoSurface::resizeEvent(QResizeEvent* event)
 void VideoSurface::showEvent(QShowEvent* e)
 {
     Q_UNUSED(e);
-    //emit ratioChanged();
+    // we skipped the repaints while hidden
+    update();
 }
 
 void VideoSurface::recalulateBounds()
@@ -220,9 +307,56 @@ void VideoSurface::recalulateBounds()
         boundingRect.setRect(pos.x(), pos.y(), size.width(), size.height());
     }
 
+    // let the source convert the frames for us, the OpenGL renderer scales them itself
+    if (source && hasSubscribed)
+        source->setTargetSize(this, glRenderer ? QSize() : boundingRect.size());
+
+    updateRenderer();
     update();
 }
 
+/**
+ * @brief Shows the OpenGL renderer over the bounding rect while there is a frame to draw.
+ */
+void VideoSurface::updateRenderer()
+{
+#ifdef QTOX_GL_VIDEO
+    if (!glRenderer)
+        return;
+
+    if (!lastFrame)
+    {
+        glRenderer->setFrame(nullptr);
+        glRenderer->hide();
+        return;
+    }
+
+    if (glRenderer->geometry() != boundingRect)
+        glRenderer->setGeometry(boundingRect);
+
+    if (!glRenderer->isVisible())
+        glRenderer->show();
+#endif
+}
+
+/**
+ * @brief Time between two refreshes of the screen we're on, in ms.
+ */
+int VideoSurface::frameInterval() const
+{
+    QScreen* screen = nullptr;
+    if (QWindow* win = window()->windowHandle())
+        screen = win->screen();
+    if (!screen)
+        screen = QGuiApplication::primaryScreen();
+
+    qreal refreshRate = screen ? screen->refreshRate() : 0;
+    if (refreshRate < 1)
+        refreshRate = 60;
+
+    return qRound(1000 / refreshRate);
+}
+
 void VideoSurface::lock()
 {
     // Fast lock
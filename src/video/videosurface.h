@@ -21,10 +21,14 @@
 #define SELFCAMVIEW_H
 
 #include <QWidget>
+#include <QElapsedTimer>
 #include <memory>
 #include <atomic>
 #include "src/video/videosource.h"
 
+class GLVideoRenderer;
+class QTimer;
+
 class VideoSurface : public QWidget
 {
     Q_OBJECT
@@ -54,22 +58,34 @@ protected:
     virtual void showEvent(QShowEvent* event) final override;
 
 private slots:
+    /// Called directly from the source's thread, only keeps the frame for presentFrame
     void onNewFrameAvailable(std::shared_ptr<VideoFrame> newFrame);
+    /// Shows the latest frame, at most once per screen refresh
+    void presentFrame();
     void onSourceStopped();
 
 private:
     void recalulateBounds();
+    void updateRenderer();
+    int frameInterval() const;
     void lock();
     void unlock();
 
     QRect boundingRect;
     VideoSource* source;
-    std::shared_ptr<VideoFrame> lastFrame;
-    std::atomic_bool frameLock; ///< Fast lock for lastFrame
+    std::shared_ptr<VideoFrame> lastFrame; ///< The frame we show, only used from the GUI thread
+    std::shared_ptr<VideoFrame> pendingFrame; ///< The latest frame of the source, not shown yet
+    std::atomic_bool frameLock; ///< Fast lock for pendingFrame
+    std::atomic_bool presentQueued{false}; ///< True while a call to presentFrame is on its way
+    std::atomic_bool acceptFrames{false}; ///< Cleared by unsubscribe, the source may still be calling us
+    std::atomic_int deliveries{0}; ///< Calls of onNewFrameAvailable running on the source's thread
+    QTimer* presentTimer;
+    QElapsedTimer lastPresent;
     uint8_t hasSubscribed;
     QPixmap avatar;
     float ratio;
     bool expanding;
+    GLVideoRenderer* glRenderer = nullptr; ///< Draws the frames if OpenGL is available, over our bounding rect
 };
 
 #endif // SELFCAMVIEW_H
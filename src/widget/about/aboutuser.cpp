@@ -38,7 +38,7 @@ void AboutUser::setFriend(Friend *f)
     ui->publicKey->setCursorPosition(0); //scroll textline to left
     ui->note->setPlainText(Settings::getInstance().getContactNote(f->getToxId()));
 
-    QPixmap avatar = Nexus::getProfile()->loadAvatar(f->getToxId().toString());
+    QPixmap avatar = Nexus::getProfile()->loadAvatar(f->getToxId().toString(), ui->avatar->maximumSize());
     ui->statusMessage->setText(f->getStatusMessage());
     if(!avatar.isNull()) {
         ui->avatar->setPixmap(avatar);
@@ -25,6 +25,7 @@
 #include "tool/croppinglabel.h"
 #include <QBoxLayout>
 #include <QMouseEvent>
+#include <QTimer>
 
 #include <QApplication>
 
@@ -66,6 +67,11 @@ CategoryWidget::CategoryWidget(QWidget* parent)
 
     setAcceptDrops(true);
 
+    releaseTimer = new QTimer(this);
+    releaseTimer->setSingleShot(true);
+    releaseTimer->setInterval(releaseDelay);
+    connect(releaseTimer, &QTimer::timeout, this, &CategoryWidget::releaseFriendWidgets);
+
     onCompactChanged(isCompact());
 
     setExpanded(true, false);
@@ -81,6 +87,17 @@ void CategoryWidget::setExpanded(bool isExpanded, bool save)
 {
     expanded = isExpanded;
     setMouseTracking(true);
+
+    // Friends are laid out while the list is still hidden, so it's shown only once
+    if (isExpanded)
+    {
+        releaseTimer->stop();
+        layoutCollapsedFriends();
+    }
+    else
+    {
+        releaseTimer->start();
+    }
     listWidget->setVisible(isExpanded);
 
     QString pixmapPath;
@@ -123,32 +140,122 @@ void CategoryWidget::editName()
 
 void CategoryWidget::addFriendWidget(FriendWidget* w, Status s)
 {
-    listLayout->addFriendWidget(w, s);
+    // While collapsed, a friend that isn't laid out here yet only needs to become our child,
+    // the sorted insertion and the theme wait until we're expanded
+    bool laidOut = w->parentWidget() == listWidget && !collapsedFriends.contains(w);
+    if (!expanded && !laidOut)
+    {
+        if (w->parentWidget() != listWidget)
+            w->setParent(listWidget);
+        collapsedFriends[w] = s;
+    }
+    else
+    {
+        listLayout->addFriendWidget(w, s);
+        w->reloadTheme(); // Otherwise theme will change when moving to another circle.
+    }
     updateStatus();
     onAddFriendWidget(w);
-    w->reloadTheme(); // Otherwise theme will change when moving to another circle.
 }
 
 void CategoryWidget::removeFriendWidget(FriendWidget* w, Status s)
 {
-    listLayout->removeFriendWidget(w, s);
+    if (!collapsedFriends.remove(w))
+        listLayout->removeFriendWidget(w, s);
     updateStatus();
 }
 
 void CategoryWidget::updateStatus()
 {
-    statusLabel->setText(QString::number(listLayout->friendOnlineCount()) + QStringLiteral(" / ") + QString::number(listLayout->friendTotalCount()));
+    int online = listLayout->friendOnlineCount();
+    int total = listLayout->friendTotalCount();
+    for (auto it = collapsedFriends.begin(); it != collapsedFriends.end();)
+    {
+        if (!isCollapsedFriend(it.key()))
+        {
+            it = collapsedFriends.erase(it);
+            continue;
+        }
+
+        if (it.value() != Status::Offline)
+            ++online;
+        ++total;
+        ++it;
+    }
+
+    statusLabel->setText(QString::number(online) + QStringLiteral(" / ") + QString::number(total));
 }
 
 bool CategoryWidget::hasChatrooms() const
 {
-    return listLayout->hasChatrooms();
+    if (listLayout->hasChatrooms())
+        return true;
+
+    for (auto it = collapsedFriends.begin(); it != collapsedFriends.end(); ++it)
+        if (isCollapsedFriend(it.key()))
+            return true;
+
+    return false;
+}
+
+bool CategoryWidget::isCollapsedFriend(FriendWidget* w) const
+{
+    return w->parentWidget() == listWidget;
+}
+
+/**
+@brief Inserts the friends added while we were collapsed into the sorted layouts.
+*/
+void CategoryWidget::layoutCollapsedFriends()
+{
+    if (collapsedFriends.isEmpty())
+        return;
+
+    QHash<FriendWidget*, Status> pending;
+    pending.swap(collapsedFriends);
+    for (auto it = pending.begin(); it != pending.end(); ++it)
+    {
+        FriendWidget* w = it.key();
+        if (!isCollapsedFriend(w))
+            continue;
+
+        listLayout->addFriendWidget(w, it.value());
+        w->reloadTheme();
+    }
+    updateStatus();
+}
+
+/**
+@brief Called once we've been collapsed for releaseDelay.
+
+The widgets belong to their Friend so they stay around, but while they're out of the layouts,
+status changes and moves between circles don't resort or relayout anything here.
+*/
+void CategoryWidget::releaseFriendWidgets()
+{
+    if (expanded)
+        return;
+
+    QLayout* layouts[] = {listLayout->getLayoutOnline(), listLayout->getLayoutOffline()};
+    for (QLayout* layout : layouts)
+    {
+        Status s = layout == listLayout->getLayoutOffline() ? Status::Offline : Status::Online;
+        QLayoutItem* item;
+        while ((item = layout->takeAt(0)) != nullptr)
+        {
+            FriendWidget* w = dynamic_cast<FriendWidget*>(item->widget());
+            if (w != nullptr)
+                collapsedFriends[w] = s;
+            delete item;
+        }
+    }
 }
 
 void CategoryWidget::search(const QString &searchString, bool updateAll, bool hideOnline, bool hideOffline)
 {
     if (updateAll)
     {
+        layoutCollapsedFriends();
         listLayout->searchChatrooms(searchString, hideOnline, hideOffline);
     }
     bool inCategory = searchString.isEmpty() && !(hideOnline && hideOffline);
@@ -157,6 +264,7 @@ void CategoryWidget::search(const QString &searchString, bool updateAll, bool hi
 
 bool CategoryWidget::cycleContacts(bool forward)
 {
+    layoutCollapsedFriends();
     if (listLayout->friendTotalCount() == 0)
     {
         return false;
@@ -203,6 +311,8 @@ bool CategoryWidget::cycleContacts(FriendWidget* activeChatroomWidget, bool forw
     if (friendWidget == nullptr)
         return false;
 
+    layoutCollapsedFriends();
+
     currentLayout = listLayout->getLayoutOnline();
     index = listLayout->indexOfFriendWidget(friendWidget, true);
     if (index == -1)
@@ -316,17 +426,20 @@ void CategoryWidget::setContainerAttribute(Qt::WidgetAttribute attribute, bool e
     Style::repolish(container);
 }
 
-QLayout* CategoryWidget::friendOfflineLayout() const
+QLayout* CategoryWidget::friendOfflineLayout()
 {
+    layoutCollapsedFriends();
     return listLayout->getLayoutOffline();
 }
 
-QLayout* CategoryWidget::friendOnlineLayout() const
+QLayout* CategoryWidget::friendOnlineLayout()
 {
+    layoutCollapsedFriends();
     return listLayout->getLayoutOnline();
 }
 
 void CategoryWidget::moveFriendWidgets(FriendListWidget* friendList)
 {
+    layoutCollapsedFriends();
     listLayout->moveFriendWidgets(friendList);
 }
@@ -22,12 +22,14 @@
 
 #include "genericchatitemwidget.h"
 #include "src/core/corestructs.h"
+#include <QHash>
 
 class FriendListLayout;
 class FriendListWidget;
 class FriendWidget;
 class QVBoxLayout;
 class QHBoxLayout;
+class QTimer;
 
 class CategoryWidget : public GenericChatItemWidget
 {
@@ -57,12 +59,21 @@ protected:
 
     void editName();
     void setContainerAttribute(Qt::WidgetAttribute attribute, bool enabled);
-    QLayout* friendOnlineLayout() const;
-    QLayout* friendOfflineLayout() const;
+    QLayout* friendOnlineLayout();
+    QLayout* friendOfflineLayout();
     void moveFriendWidgets(FriendListWidget* friendList);
     void emitChatroomWidget(QLayout *layout, int index);
 
+private slots:
+    /// Takes the friend widgets out of the layouts while we stay collapsed, so changes to them are cheap
+    void releaseFriendWidgets();
+
 private:
+    /// Lays out the friends added while we were collapsed
+    void layoutCollapsedFriends();
+    /// Whether the friend was added while collapsed and wasn't moved elsewhere since
+    bool isCollapsedFriend(FriendWidget* w) const;
+
     virtual void onSetName() {}
     virtual void onExpand() {}
     virtual void onAddFriendWidget(FriendWidget*) {}
@@ -76,6 +87,12 @@ private:
     QWidget* container;
     QFrame* lineFrame;
     bool expanded = false;
+    /// Friends added while collapsed, children of listWidget but not in its layouts
+    /// An entry is stale once its widget was moved to another parent, like QLayout forgets such widgets
+    QHash<FriendWidget*, Status> collapsedFriends;
+    QTimer* releaseTimer;
+    /// How long we stay collapsed before releasing the friend widgets from the layouts, in ms
+    static constexpr int releaseDelay = 60 * 1000;
 };
 
 #endif // CATEGORYWIDGET_H
@@ -34,6 +34,7 @@
 #include "src/widget/friendlistlayout.h"
 #include "src/widget/form/settingswidget.h"
 #include "src/widget/translator.h"
+#include "src/trace.h"
 #include <QBoxLayout>
 #include <QSplitter>
 #include <QGuiApplication>
@@ -167,7 +168,10 @@ FriendWidget* ContentDialog::addFriend(int friendId, QString id)
     connect(frnd, &Friend::displayedNameChanged, this, &ContentDialog::updateFriendWidget);
     connect(settingsWidget, &SettingsWidget::compactToggled, friendWidget, &FriendWidget::compactChange);
     connect(friendWidget, &FriendWidget::chatroomWidgetClicked, this, &ContentDialog::onChatroomWidgetClicked);
-    connect(friendWidget, SIGNAL(chatroomWidgetClicked(GenericChatroomWidget*)), frnd->getChatForm(), SLOT(focusInput()));
+    connect(friendWidget, &GenericChatroomWidget::chatroomWidgetClicked, frnd, [frnd]()
+    {
+        frnd->getChatForm()->focusInput();
+    });
     connect(Core::getInstance(), &Core::friendAvatarChanged, friendWidget, &FriendWidget::onAvatarChange);
     connect(Core::getInstance(), &Core::friendAvatarRemoved, friendWidget, &FriendWidget::onAvatarRemoved);
 
@@ -617,6 +621,7 @@ void ContentDialog::onChatroomWidgetClicked(GenericChatroomWidget *widget, bool
     if (activeChatroomWidget == widget)
         return;
 
+    TraceSpan span{"ContentDialog::onChatroomWidgetClicked"};
     contentLayout->clear();
 
     if (activeChatroomWidget != nullptr)
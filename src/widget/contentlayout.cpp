@@ -62,28 +62,55 @@ ContentLayout::~ContentLayout()
 {
     clear();
 
+    // The widgets aren't ours, they must outlive our containers
+    for (QList<QPointer<QWidget>>* warm : {&warmHeads, &warmContent})
+    {
+        for (QPointer<QWidget> widget : *warm)
+            if (widget && (widget->parentWidget() == mainHead || widget->parentWidget() == mainContent))
+                widget->setParent(nullptr);
+    }
+
     mainHead->deleteLater();
     mainContent->deleteLater();
 }
 
+/**
+@brief Takes the shown widgets out of the layouts and hides them.
+
+Reparenting a form repolishes its whole tree and makes its chat log resize again when shown,
+so the last few widgets stay our hidden children, and are shown again as they are.
+*/
 void ContentLayout::clear()
 {
     QLayoutItem* item;
     while ((item = mainHead->layout()->takeAt(0)) != 0)
     {
-        item->widget()->hide();
-        item->widget()->setParent(nullptr);
+        keepWarm(warmHeads, item->widget(), mainHead);
         delete item;
     }
 
     while ((item = mainContent->layout()->takeAt(0)) != 0)
     {
-        item->widget()->hide();
-        item->widget()->setParent(nullptr);
+        keepWarm(warmContent, item->widget(), mainContent);
         delete item;
     }
 }
 
+void ContentLayout::keepWarm(QList<QPointer<QWidget>>& warm, QWidget* widget, QWidget* parent)
+{
+    widget->hide();
+    warm.removeAll(widget);
+    warm.prepend(widget);
+
+    while (warm.size() > maxWarmWidgets)
+    {
+        QPointer<QWidget> released = warm.takeLast();
+        // It may have been shown somewhere else since
+        if (released && released->parentWidget() == parent)
+            released->setParent(nullptr);
+    }
+}
+
 void ContentLayout::init()
 {
     setMargin(0);
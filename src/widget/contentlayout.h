@@ -22,6 +22,8 @@
 
 #include <QBoxLayout>
 #include <QFrame>
+#include <QList>
+#include <QPointer>
 
 class ContentLayout : public QVBoxLayout
 {
@@ -30,6 +32,7 @@ public:
     explicit ContentLayout(QWidget* parent);
     ~ContentLayout();
 
+    /// Hides the shown widgets, the recently shown ones stay our children so showing them again is cheap
     void clear();
 
     QFrame mainHLine;
@@ -39,6 +42,12 @@ public:
 
 private:
     void init();
+    /// Keeps the widget as a hidden child of parent, releasing the least recently shown one past maxWarmWidgets
+    static void keepWarm(QList<QPointer<QWidget>>& warm, QWidget* widget, QWidget* parent);
+
+private:
+    QList<QPointer<QWidget>> warmHeads, warmContent; ///< Most recently shown first
+    static constexpr int maxWarmWidgets = 8;
 };
 
 #endif // CONTENTLAYOUT_H
@@ -25,6 +25,9 @@
 #include <QClipboard>
 #include <QRegularExpression>
 #include <QTabWidget>
+#include <QFileDialog>
+#include <QFile>
+#include <QDir>
 #include <QSignalMapper>
 #include <tox/tox.h>
 #include "src/nexus.h"
@@ -42,6 +45,7 @@
 #include <QScrollArea>
 
 AddFriendForm::AddFriendForm()
+    : importDone{0}
 {
     tabWidget = new QTabWidget();
     main = new QWidget(tabWidget), head = new QWidget();
@@ -66,6 +70,15 @@ AddFriendForm::AddFriendForm()
     layout.addWidget(&message);
     layout.addWidget(&sendButton);
 
+    QHBoxLayout* importLayout = new QHBoxLayout();
+    importLayout->addWidget(&importFileButton);
+    importLayout->addWidget(&importClipboardButton);
+    layout.addLayout(importLayout);
+    layout.addWidget(&importProgress);
+    layout.addWidget(&importLabel);
+    importProgress.hide();
+    importLabel.setWordWrap(true);
+
     head->setLayout(&headLayout);
     headLayout.addWidget(&headLabel);
 
@@ -73,7 +86,11 @@ AddFriendForm::AddFriendForm()
     connect(&toxId, &QLineEdit::textChanged, this, &AddFriendForm::onIdChanged);
     connect(tabWidget, &QTabWidget::currentChanged, this, &AddFriendForm::onCurrentChanged);
     connect(&sendButton, SIGNAL(clicked()), this, SLOT(onSendTriggered()));
+    connect(&importFileButton, &QPushButton::clicked, this, &AddFriendForm::onImportFileTriggered);
+    connect(&importClipboardButton, &QPushButton::clicked, this, &AddFriendForm::onImportClipboardTriggered);
     connect(Nexus::getCore(), &Core::usernameSet, this, &AddFriendForm::onUsernameSet);
+    connect(Nexus::getCore(), &Core::friendRequestProgress, this, &AddFriendForm::onFriendRequestProgress);
+    connect(Nexus::getCore(), &Core::friendRequestsFinished, this, &AddFriendForm::onFriendRequestsFinished);
 
     retranslateUi();
     Translator::registerHandler(std::bind(&AddFriendForm::retranslateUi, this), this);
@@ -150,10 +167,18 @@ void AddFriendForm::onSendTriggered()
 {
     QString id = toxId.text().trimmed();
 
-    if (!ToxId::isToxId(id))
+    if (ToxId::isToxId(id))
+    {
+        sendFriendRequest(id);
+        return;
+    }
+
+    // Try Toxme, without a second request if the button is clicked again meanwhile
+    sendButton.setEnabled(false);
+    Toxme::lookup(id, this, [this, id](ToxId resolved)
     {
-        ToxId toxId = Toxme::lookup(id); // Try Toxme
-        if (toxId.toString().isEmpty())  // If it isn't supported
+        onIdChanged(toxId.text());
+        if (resolved.toString().isEmpty())  // If it isn't supported
         {
             qDebug() << "Toxme didn't return a ToxID, trying ToxDNS";
             if (Settings::getInstance().getProxyType() != ProxyType::ptNone)
@@ -163,16 +188,19 @@ void AddFriendForm::onSendTriggered()
                 if (btn != QMessageBox::Yes)
                     return;
             }
-            toxId = ToxDNS::resolveToxAddress(id, true); // Use ToxDNS
-            if (toxId.toString().isEmpty())
+            resolved = ToxDNS::resolveToxAddress(id, true); // Use ToxDNS
+            if (resolved.toString().isEmpty())
             {
                 GUI::showWarning(tr("Couldn't add friend"), tr("This Tox ID does not exist","DNS error"));
                 return;
             }
         }
-        id = toxId.toString();
-    }
+        sendFriendRequest(resolved.toString());
+    });
+}
 
+void AddFriendForm::sendFriendRequest(const QString& id)
+{
     deleteFriendRequest(id);
     if (id.toUpper() == Core::getInstance()->getSelfId().toString().toUpper())
         GUI::showWarning(tr("Couldn't add friend"), tr("You can't add yourself as a friend!","When trying to add your own Tox ID as friend"));
@@ -183,6 +211,95 @@ void AddFriendForm::onSendTriggered()
     this->message.clear();
 }
 
+void AddFriendForm::onImportFileTriggered()
+{
+    QString path = QFileDialog::getOpenFileName(main, tr("Import a list of Tox IDs"), QDir::homePath(),
+                                                tr("Text files (*.txt *.csv);;All files (*)"));
+    if (path.isEmpty())
+        return;
+
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+    {
+        GUI::showWarning(tr("Couldn't add friend"), tr("Couldn't open %1").arg(path));
+        return;
+    }
+
+    importFriendRequests(QString::fromUtf8(file.readAll()));
+}
+
+void AddFriendForm::onImportClipboardTriggered()
+{
+    importFriendRequests(QApplication::clipboard()->text());
+}
+
+/**
+@brief Sends a friend request to every Tox ID of the text, with the message of the form.
+
+One ID per line or separated by commas, lines starting with # are comments.
+Core checks them all, this only splits the text and shows the progress.
+*/
+void AddFriendForm::importFriendRequests(const QString& text)
+{
+    QStringList ids;
+    for (const QString& line : text.split('\n'))
+    {
+        QString trimmed = line.trimmed();
+        if (trimmed.isEmpty() || trimmed.startsWith('#'))
+            continue;
+
+        ids << trimmed.split(QRegularExpression("[\\s,;]+"), QString::SkipEmptyParts);
+    }
+
+    if (ids.isEmpty())
+    {
+        GUI::showWarning(tr("Couldn't add friend"), tr("No Tox ID found to import"));
+        return;
+    }
+
+    for (const QString& id : ids)
+        if (ToxId::isToxId(id))
+            deleteFriendRequest(id);
+
+    importDone = 0;
+    importErrors.clear();
+    importProgress.setRange(0, ids.size());
+    importProgress.setValue(0);
+    importProgress.show();
+    importLabel.clear();
+    importFileButton.setEnabled(false);
+    importClipboardButton.setEnabled(false);
+
+    emit friendsRequested(ids, getMessage());
+    this->message.clear();
+}
+
+void AddFriendForm::onFriendRequestProgress(int, int total, const QString& userId, const QString& errorInfo)
+{
+    importProgress.setMaximum(total);
+    importProgress.setValue(++importDone);
+    if (!errorInfo.isEmpty())
+        importErrors << userId + QStringLiteral(": ") + errorInfo;
+}
+
+void AddFriendForm::onFriendRequestsFinished(int sent, int total)
+{
+    importProgress.hide();
+    importFileButton.setEnabled(true);
+    importClipboardButton.setEnabled(true);
+    importLabel.setText(tr("Sent %1 of %2 friend requests").arg(sent).arg(total));
+
+    if (!importErrors.isEmpty())
+    {
+        const int shownErrors = 10;
+        QStringList shown = importErrors.mid(0, shownErrors);
+        if (importErrors.size() > shownErrors)
+            shown << tr("and %n more", "", importErrors.size() - shownErrors);
+        GUI::showWarning(tr("Couldn't add friend"), shown.join('\n'));
+    }
+    importErrors.clear();
+}
+
 void AddFriendForm::onIdChanged(const QString &id)
 {
     QString tId = id.trimmed();
@@ -274,6 +391,10 @@ void AddFriendForm::retranslateUi()
     headLabel.setText(tr("Add Friends"));
     messageLabel.setText(tr("Message","The message you send in friend requests"));
     sendButton.setText(tr("Send friend request"));
+    importFileButton.setText(tr("Import from file"));
+    importClipboardButton.setText(tr("Import from clipboard"));
+    importFileButton.setToolTip(tr("Send a request to each Tox ID of a text file, one per line"));
+    importClipboardButton.setToolTip(tr("Send a request to each Tox ID copied in the clipboard"));
     message.setPlaceholderText(tr("%1 here! Tox me maybe?",
                 "Default message in friend requests if the field is left blank. Write something appropriate!")
                 .arg(lastUsername));
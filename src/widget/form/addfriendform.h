@@ -26,6 +26,7 @@
 #include <QTextEdit>
 #include <QPushButton>
 #include <QSet>
+#include <QProgressBar>
 
 class QTabWidget;
 
@@ -56,6 +57,7 @@ public:
 
 signals:
     void friendRequested(const QString& friendAddress, const QString& message);
+    void friendsRequested(const QStringList& friendAddresses, const QString& message);
     void friendRequestAccepted(const QString& friendAddress);
     void friendRequestsSeen();
 
@@ -68,6 +70,10 @@ private slots:
     void onFriendRequestAccepted();
     void onFriendRequestRejected();
     void onCurrentChanged(int index);
+    void onImportFileTriggered();
+    void onImportClipboardTriggered();
+    void onFriendRequestProgress(int index, int total, const QString& userId, const QString& errorInfo);
+    void onFriendRequestsFinished(int sent, int total);
 
 private:
     void retranslateUi();
@@ -77,10 +83,15 @@ private:
     void retranslateRejectButton(QPushButton* rejectButton);
     void deleteFriendRequest(const QString &toxId);
     void setIdFromClipboard();
+    void sendFriendRequest(const QString& id);
+    void importFriendRequests(const QString& text);
 
 private:
-    QLabel headLabel, toxIdLabel, messageLabel;
-    QPushButton sendButton;
+    QLabel headLabel, toxIdLabel, messageLabel, importLabel;
+    QPushButton sendButton, importFileButton, importClipboardButton;
+    QProgressBar importProgress;
+    int importDone; ///< Entries of the running import Core reported on
+    QStringList importErrors;
     QLineEdit toxId;
     QTextEdit message;
     QVBoxLayout layout, headLayout;
@@ -19,6 +19,7 @@
 
 #include <QDebug>
 #include <QBoxLayout>
+#include <QElapsedTimer>
 #include <QScrollBar>
 #include <QFileDialog>
 #include <QMessageBox>
@@ -34,6 +35,10 @@
 #include <QStyle>
 #include <QSplitter>
 #include <QClipboard>
+#include <QProgressDialog>
+#include <QFutureWatcher>
+#include <QtConcurrent/QtConcurrent>
+#include <QTextDocument>
 #include <cassert>
 #include "chatform.h"
 #include "src/audio/audio.h"
@@ -42,26 +47,29 @@
 #include "src/friend.h"
 #include "src/widget/style.h"
 #include "src/persistence/settings.h"
-#include "src/core/cstring.h"
 #include "src/widget/tool/callconfirmwidget.h"
 #include "src/widget/friendwidget.h"
 #include "src/widget/form/loadhistorydialog.h"
+#include "src/widget/form/searchhistorydialog.h"
 #include "src/widget/tool/chattextedit.h"
 #include "src/widget/widget.h"
 #include "src/widget/maskablepixmapwidget.h"
 #include "src/widget/tool/croppinglabel.h"
 #include "src/chatlog/chatmessage.h"
 #include "src/chatlog/content/filetransferwidget.h"
+#include "src/chatlog/content/imagepreview.h"
 #include "src/chatlog/chatlinecontentproxy.h"
 #include "src/chatlog/content/text.h"
 #include "src/chatlog/chatlog.h"
 #include "src/video/netcamview.h"
 #include "src/persistence/offlinemsgengine.h"
+#include "src/persistence/chatexporter.h"
 #include "src/widget/tool/screenshotgrabber.h"
 #include "src/widget/tool/flyoutoverlaywidget.h"
 #include "src/widget/translator.h"
 #include "src/video/videosource.h"
 #include "src/video/camerasource.h"
+#include "src/trace.h"
 #include "src/nexus.h"
 #include "src/persistence/profile.h"
 
@@ -103,6 +111,7 @@ ChatForm::ChatForm(Friend* chatFriend)
     connect(this, &GenericChatForm::messageInserted, this, &ChatForm::onMessageInserted);
 
     loadHistoryAction = menu.addAction(QString(), this, SLOT(onLoadHistory()));
+    searchHistoryAction = menu.addAction(QString(), this, SLOT(onSearchHistory()));
     copyStatusAction = statusMessageMenu.addAction(QString(), this, SLOT(onCopyStatusMessage()));
 
     connect(core, &Core::fileSendStarted, this, &ChatForm::startFileSend);
@@ -114,7 +123,16 @@ ChatForm::ChatForm(Friend* chatFriend)
     connect(msgEdit, &ChatTextEdit::enterPressed, this, &ChatForm::onSendTriggered);
     connect(msgEdit, &ChatTextEdit::textChanged, this, &ChatForm::onTextEditChanged);
     connect(core, &Core::fileSendFailed, this, &ChatForm::onFileSendFailed);
+    connect(core, &Core::fileTransferFinished, this, &ChatForm::onFileTransferFinished);
     connect(this, &ChatForm::chatAreaCleared, getOfflineMsgEngine(), &OfflineMsgEngine::removeAllReceipts);
+    connect(chatWidget, &ChatLog::topReached, this, &ChatForm::loadHistoryPage);
+    connect(chatWidget, &ChatLog::linesTrimmed, this, &ChatForm::onChatLogTrimmed);
+    connect(this, &ChatForm::chatAreaCleared, this, [this]()
+    {
+        // The lines of pending loads would be inserted in the cleared chat area
+        pendingHistoryLoads.clear();
+        chatWidget->setBusy(false);
+    });
     connect(statusMessageLabel, &CroppingLabel::customContextMenuRequested, this, [&](const QPoint& pos)
     {
         if(!statusMessageLabel->text().isEmpty())
@@ -171,18 +189,51 @@ void ChatForm::onTextEditChanged()
         return;
     }
 
-    if (msgEdit->toPlainText().length() > 0)
+    // Only tell the friend when we start or stop typing, and don't copy the whole text on every change
+    if (!msgEdit->document()->isEmpty())
     {
         typingTimer.start(3000);
         if (!isTyping)
             Core::getInstance()->sendTyping(f->getFriendID(), (isTyping = true));
     }
-    else
+    else if (isTyping)
     {
+        typingTimer.stop();
         Core::getInstance()->sendTyping(f->getFriendID(), (isTyping = false));
     }
 }
 
+void ChatForm::sendText(const QString& text)
+{
+    SendMessageStr(text);
+}
+
+/**
+@brief Saves a large paste next to the screenshots and sends it as a text file.
+*/
+void ChatForm::sendTextAsFile(const QString& text)
+{
+    QDir(Settings::getInstance().getAppDataDirPath()).mkpath("pastes");
+    QString filepath = QString("%1pastes%2qTox_Paste_%3.txt")
+                           .arg(Settings::getInstance().getAppDataDirPath())
+                           .arg(QDir::separator())
+                           .arg(QDateTime::currentDateTime().toString("yyyy-MM-dd HH-mm-ss.zzz"));
+
+    QFile file(filepath);
+    if (!file.open(QFile::WriteOnly) || file.write(text.toUtf8()) < 0)
+    {
+        qWarning() << "Failed to save the paste to" << filepath;
+        QMessageBox::warning(this,
+                             tr("Failed to save the paste"),
+                             tr("qTox wasn't able to save the pasted text to a file"));
+        return;
+    }
+    file.close();
+
+    QFileInfo fi(filepath);
+    emit sendFile(f->getFriendID(), fi.fileName(), fi.filePath(), fi.size());
+}
+
 void ChatForm::onAttachClicked()
 {
     QStringList paths = QFileDialog::getOpenFileNames(this,
@@ -216,9 +267,9 @@ void ChatForm::onAttachClicked()
     }
 }
 
-void ChatForm::startFileSend(ToxFile file)
+void ChatForm::startFileSend(const ToxFile::Ptr& file)
 {
-    if (file.friendId != f->getFriendID())
+    if (file->friendId != f->getFriendID())
         return;
 
     QString name;
@@ -229,17 +280,17 @@ void ChatForm::startFileSend(ToxFile file)
         previousId = core->getSelfId();
     }
 
-    insertChatMessage(ChatMessage::createFileTransferMessage(name, file, true, QDateTime::currentDateTime()));
+    insertChatMessage(ChatMessage::createFileTransferMessage(name, *file, true, QDateTime::currentDateTime()));
 
     Widget::getInstance()->updateFriendActivity(f);
 }
 
-void ChatForm::onFileRecvRequest(ToxFile file)
+void ChatForm::onFileRecvRequest(const ToxFile::Ptr& file)
 {
-    if (file.friendId != f->getFriendID())
+    if (file->friendId != f->getFriendID())
         return;
 
-    Widget::getInstance()->newFriendMessageAlert(file.friendId);
+    Widget::getInstance()->newFriendMessageAlert(file->friendId);
 
     QString name;
     ToxId friendId = f->getToxId();
@@ -249,7 +300,7 @@ void ChatForm::onFileRecvRequest(ToxFile file)
         previousId = friendId;
     }
 
-    ChatMessage::Ptr msg = ChatMessage::createFileTransferMessage(name, file, false, QDateTime::currentDateTime());
+    ChatMessage::Ptr msg = ChatMessage::createFileTransferMessage(name, *file, false, QDateTime::currentDateTime());
     insertChatMessage(msg);
 
     ChatLineContentProxy* proxy = static_cast<ChatLineContentProxy*>(msg->getContent(1));
@@ -269,6 +320,14 @@ void ChatForm::onFileRecvRequest(ToxFile file)
     Widget::getInstance()->updateFriendActivity(f);
 }
 
+void ChatForm::onFileTransferFinished(const ToxFile::Ptr& file)
+{
+    if (file->friendId != f->getFriendID() || !ImagePreview::canPreview(file->filePath))
+        return;
+
+    insertChatMessage(ChatMessage::createImagePreviewMessage(file->filePath));
+}
+
 void ChatForm::onAvInvite(uint32_t FriendId, bool video)
 {
     if (FriendId != f->getFriendID())
@@ -300,6 +359,13 @@ void ChatForm::onAvInvite(uint32_t FriendId, bool video)
     connect(callConfirm, &CallConfirmWidget::accepted, this, &ChatForm::onAnswerCallTriggered);
     connect(callConfirm, &CallConfirmWidget::rejected, this, &ChatForm::onRejectCallTriggered);
 
+    // the view is built while it rings, answering only has to show it
+    if (video && !netcam)
+    {
+        netcam = createNetcam();
+        netcam->hide();
+    }
+
     insertChatMessage(ChatMessage::createChatInfoMessage(tr("%1 calling").arg(f->getDisplayedName()),
                                                          ChatMessage::INFO,
                                                          QDateTime::currentDateTime()));
@@ -463,6 +529,7 @@ void ChatForm::onRejectCallTriggered()
 
     enableCallButtons();
     stopCounter();
+    hideNetcam();
 }
 
 void ChatForm::onCallTriggered()
@@ -631,9 +698,12 @@ void ChatForm::onAvatarChange(uint32_t FriendId, const QPixmap &pic)
 
 GenericNetCamView *ChatForm::createNetcam()
 {
-    qDebug() << "creating netcam";
+    TraceSpan span{"ChatForm::createNetcam"};
+    QElapsedTimer timer;
+    timer.start();
     NetCamView* view = new NetCamView(f->getFriendID(), this);
     view->show(Core::getInstance()->getAv()->getVideoSourceFromCall(f->getFriendID()), f->getDisplayedName());
+    qDebug() << "Created the netcam in" << timer.elapsed() << "ms";
     return view;
 }
 
@@ -689,7 +759,7 @@ void ChatForm::onAvatarRemoved(uint32_t FriendId)
     avatar->setPixmap(QPixmap(":/img/contact_dark.svg"));
 }
 
-void ChatForm::loadHistory(QDateTime since, bool processUndelivered)
+void ChatForm::loadHistory(QDateTime since)
 {
     QDateTime now = historyBaselineDate.addMSecs(-1);
 
@@ -708,24 +778,223 @@ void ChatForm::loadHistory(QDateTime since, bool processUndelivered)
         }
     }
 
-    auto msgs = Nexus::getProfile()->getHistory()->getChatHistory(f->getToxId().publicKey, since, now);
+    History* history = Nexus::getProfile()->getHistory();
+    connect(history, &History::chatHistoryChunk, this, &ChatForm::onChatHistoryChunk, Qt::UniqueConnection);
 
-    ToxId storedPrevId = previousId;
-    ToxId prevId;
+    // The messages will be inserted once they have all been received, we show the busy scene until then
+    earliestMessage = since;
+    historyCursorTime = since;
+    historyCursorId = 0;
 
-    QList<ChatLine::Ptr> historyMessages;
+    qint64 requestId = history->getChatHistoryAsync(f->getToxId().publicKey, since, now);
+    pendingHistoryLoads.insert(requestId, HistoryLoad());
+    chatWidget->setBusy(true);
+}
+
+/**
+@brief Hands our undelivered messages to Core's send queue, however much of the history is shown.
+The lines of those already loaded are marked as sent with them, the others when they're loaded.
+*/
+void ChatForm::sendPendingMessages()
+{
+    Profile* profile = Nexus::getProfile();
+    if (pendingMessagesSent || !profile->isHistoryEnabled())
+        return;
+
+    pendingMessagesSent = true;
+    QList<History::HistMessage> msgs = profile->getHistory()->getPendingMessages(f->getToxId().publicKey);
+    if (msgs.isEmpty())
+        return;
+
+    QHash<qint64, ChatMessage::Ptr> shown;
+    for (ChatLine::Ptr line : chatWidget->getLines())
+    {
+        ChatMessage::Ptr msg = std::dynamic_pointer_cast<ChatMessage>(line);
+        if (msg && msg->getHistoryId() >= 0)
+            shown[msg->getHistoryId()] = msg;
+    }
+
+    Core* core = Core::getInstance();
+    for (const History::HistMessage& it : msgs)
+    {
+        bool isAction = it.message.startsWith("/me ", Qt::CaseInsensitive);
+        int rec = isAction ? core->sendAction(f->getFriendID(), it.message.mid(4))
+                           : core->sendMessage(f->getFriendID(), it.message);
+        getOfflineMsgEngine()->registerReceipt(rec, it.id, shown.value(it.id));
+    }
+    qDebug() << "Queued" << msgs.size() << "undelivered messages for friend" << f->getFriendID();
+}
+
+void ChatForm::onChatHistoryChunk(qint64 requestId, QList<History::HistMessage> messages, bool finished)
+{
+    // The history is shared by all the chat forms, so this may well be somebody else's request
+    auto it = pendingHistoryLoads.find(requestId);
+    if (it == pendingHistoryLoads.end())
+        return;
+
+    HistoryLoad& load = *it;
+    if (!messages.isEmpty() && !load.hasFirstMessage)
+    {
+        load.hasFirstMessage = true;
+        load.firstMessageTime = messages.first().timestamp;
+        load.firstMessageId = messages.first().id;
+    }
+    buildHistoryLines(messages, load);
+
+    if (!finished)
+        return;
+
+    // Loads complete in the order they were requested, each one older than the previous
+    if (load.hasFirstMessage)
+    {
+        historyCursorTime = load.firstMessageTime;
+        historyCursorId = load.firstMessageId;
+    }
+
+    QList<ChatLine::Ptr> lines = load.lines;
+    pendingHistoryLoads.erase(it);
+    insertHistoryLines(lines);
+
+    if (pendingHistoryLoads.isEmpty())
+        chatWidget->setBusy(false);
+}
+
+void ChatForm::loadHistoryPage()
+{
+    // Wait for the pending loads, the page must go on top of what they return
+    if (historyExhausted || !pendingHistoryLoads.isEmpty() || !Nexus::getProfile()->isHistoryEnabled())
+        return;
+
+    // If nothing was loaded from history yet, start right before the messages of this session
+    if (historyCursorTime.isNull())
+    {
+        historyCursorTime = earliestMessage.isNull() ? historyBaselineDate : earliestMessage;
+        historyCursorId = 0;
+    }
+
+    auto msgs = Nexus::getProfile()->getHistory()->getChatHistoryPage(f->getToxId().publicKey, historyCursorTime,
+                                                                      historyCursorId, historyPageSize);
+    if (msgs.size() < historyPageSize)
+        historyExhausted = true;
+    if (msgs.isEmpty())
+        return;
+
+    historyCursorTime = msgs.first().timestamp;
+    historyCursorId = msgs.first().id;
+    // Date based loads must continue from before this page
+    earliestMessage = historyCursorTime;
+
+    HistoryLoad load;
+    buildHistoryLines(msgs, load);
+    insertHistoryLines(load.lines);
+}
+
+void ChatForm::onChatLogTrimmed()
+{
+    // The next history page continues right before the oldest message left, reloading the dropped ones
+    for (ChatLine::Ptr line : chatWidget->getLines())
+    {
+        ChatMessage::Ptr msg = std::dynamic_pointer_cast<ChatMessage>(line);
+        if (!msg || msg->getDate().isNull())
+            continue;
+
+        historyCursorTime = msg->getDate();
+        historyCursorId = qMax<qint64>(msg->getHistoryId(), 0); // messages of this session are before their time
+        earliestMessage = historyCursorTime;
+        historyExhausted = false;
+        return;
+    }
+}
+
+/**
+@brief Drops the lines of an inactive chat but the last page, the others are reloaded from history on scroll.
+*/
+void ChatForm::releaseChatLog()
+{
+    // Without history, the dropped lines couldn't come back
+    Profile* profile = Nexus::getProfile();
+    if (!profile || !profile->isHistoryEnabled() || !pendingHistoryLoads.isEmpty())
+        return;
+
+    const ChatLog::Statistics before = chatWidget->getStatistics();
+    if (before.lines <= historyPageSize)
+        return;
+
+    chatWidget->releaseLines(historyPageSize);
+    const ChatLog::Statistics after = chatWidget->getStatistics();
+    if (after.lines < before.lines)
+        qDebug() << "Released" << before.lines - after.lines << "lines of an inactive chat, with"
+                 << before.textBytes - after.textBytes << "bytes of text";
+}
+
+void ChatForm::onSaveLogClicked()
+{
+    Profile* profile = Nexus::getProfile();
+    if (!profile->isHistoryEnabled())
+    {
+        GenericChatForm::onSaveLogClicked();
+        return;
+    }
+
+    std::shared_ptr<ChatExporter> exporter = askLogExporter();
+    if (!exporter)
+        return;
+
+    if (!exporter->begin(f->getDisplayedName()))
+    {
+        QMessageBox::warning(this, tr("Save chat log"),
+                             tr("Couldn't write to %1.").arg(exporter->getPath()));
+        return;
+    }
+
+    History* history = profile->getHistory();
+    qint64 requestId = history->exportChatAsync(f->getToxId().publicKey, exporter);
+
+    // The signals are queued from the database thread, so connecting after starting can't miss any
+    QProgressDialog* progress = new QProgressDialog(tr("Saving the chat log..."), tr("Cancel"), 0, 0, this);
+    progress->setWindowTitle(tr("Save chat log"));
+    progress->setAutoClose(false);
+    progress->setMinimumDuration(500);
+    connect(history, &History::chatExportProgress, progress,
+            [progress, requestId](qint64 id, qint64 exported, qint64 total)
+    {
+        if (id != requestId)
+            return;
+
+        progress->setMaximum(static_cast<int>(total));
+        progress->setValue(static_cast<int>(exported));
+    });
+    connect(history, &History::chatExportFinished, progress,
+            [this, progress, requestId, exporter](qint64 id, bool success)
+    {
+        if (id != requestId)
+            return;
+
+        progress->deleteLater();
+        if (!success && !exporter->isCanceled())
+            QMessageBox::warning(this, tr("Save chat log"),
+                                 tr("Couldn't write to %1.").arg(exporter->getPath()));
+    });
+    connect(progress, &QProgressDialog::canceled, [exporter]()
+    {
+        exporter->cancel();
+    });
+}
+
+void ChatForm::buildHistoryLines(const QList<History::HistMessage>& msgs, HistoryLoad& load)
+{
+    ToxId storedPrevId = previousId;
 
-    QDate lastDate(1,0,0);
     for (const auto &it : msgs)
     {
         // Show the date every new day
         QDateTime msgDateTime = it.timestamp.toLocalTime();
         QDate msgDate = msgDateTime.date();
 
-        if (msgDate > lastDate)
+        if (msgDate > load.lastDate)
         {
-            lastDate = msgDate;
-            historyMessages.append(ChatMessage::createChatInfoMessage(msgDate.toString(Settings::getInstance().getDateFormat()), ChatMessage::INFO, QDateTime()));
+            load.lastDate = msgDate;
+            load.lines.append(ChatMessage::createChatInfoMessage(msgDate.toString(Settings::getInstance().getDateFormat()), ChatMessage::INFO, QDateTime()));
         }
 
         // Show each messages
@@ -738,36 +1007,29 @@ void ChatForm::loadHistory(QDateTime since, bool processUndelivered)
                                                               isAction ? it.message.mid(4) : it.message,
                                                               isAction ? ChatMessage::ACTION : ChatMessage::NORMAL,
                                                               authorId.isSelf(),
-                                                              needSending ? QDateTime() : msgDateTime);
+                                                              needSending ? QDateTime() : msgDateTime,
+                                                              it.id);
 
-        if (!isAction && (prevId == authorId) && (prevMsgDateTime.secsTo(msgDateTime) < getChatLog()->repNameAfter) )
+        if (!isAction && (load.prevId == authorId) && (prevMsgDateTime.secsTo(msgDateTime) < getChatLog()->repNameAfter) )
             msg->hideSender();
 
-        prevId = authorId;
+        load.prevId = authorId;
         prevMsgDateTime = msgDateTime;
 
+        // The message may be queued already, then this line is marked as sent along with it
         if (needSending)
-        {
-            if (processUndelivered)
-            {
-                int rec;
-                if (!isAction)
-                    rec = Core::getInstance()->sendMessage(f->getFriendID(), msg->toString());
-                else
-                    rec = Core::getInstance()->sendAction(f->getFriendID(), msg->toString());
-
-                getOfflineMsgEngine()->registerReceipt(rec, it.id, msg);
-            }
-        }
-        historyMessages.append(msg);
+            getOfflineMsgEngine()->attachMessage(it.id, msg);
+        load.lines.append(msg);
     }
 
     previousId = storedPrevId;
-    int savedSliderPos = chatWidget->verticalScrollBar()->maximum() - chatWidget->verticalScrollBar()->value();
+}
 
-    earliestMessage = since;
+void ChatForm::insertHistoryLines(const QList<ChatLine::Ptr>& lines)
+{
+    int savedSliderPos = chatWidget->verticalScrollBar()->maximum() - chatWidget->verticalScrollBar()->value();
 
-    chatWidget->insertChatlineOnTop(historyMessages);
+    chatWidget->insertChatlineOnTop(lines);
 
     savedSliderPos = chatWidget->verticalScrollBar()->maximum() - savedSliderPos;
     chatWidget->verticalScrollBar()->setValue(savedSliderPos);
@@ -800,23 +1062,41 @@ void ChatForm::onScreenshotTaken(const QPixmap &pixmap) {
                            .arg(QDir::separator())
                            .arg(QDateTime::currentDateTime().toString("yyyy-MM-dd HH-mm-ss.zzz"));
 
-    QFile file(filepath);
+    // encoding a multi-monitor screenshot takes a while, the GUI only waits for the result
+    QImage image = pixmap.toImage();
+    QFutureWatcher<qint64>* saveWatcher = new QFutureWatcher<qint64>(this);
+    connect(saveWatcher, &QFutureWatcher<qint64>::finished, this, [=]()
+    {
+        qint64 filesize = saveWatcher->result();
+        saveWatcher->deleteLater();
 
-    if (!file.open(QFile::ReadWrite))
+        if (filesize < 0)
+        {
+            QMessageBox::warning(this,
+                                 tr("Failed to open temporary file", "Temporary file for screenshot"),
+                                 tr("qTox wasn't able to save the screenshot"));
+            return;
+        }
+
+        QFileInfo fi(filepath);
+        emit sendFile(f->getFriendID(), fi.fileName(), fi.filePath(), filesize);
+    });
+    saveWatcher->setFuture(QtConcurrent::run([image, filepath]() -> qint64
     {
-        QMessageBox::warning(this,
-                             tr("Failed to open temporary file", "Temporary file for screenshot"),
-                             tr("qTox wasn't able to save the screenshot"));
-        return;
-    }
+        QFile file(filepath);
 
-    pixmap.save(&file, "PNG");
+        if (!file.open(QFile::WriteOnly))
+            return -1;
 
-    long long filesize = file.size();
-    file.close();
-    QFileInfo fi(file);
+        if (!image.save(&file, "PNG", screenshotPngQuality))
+        {
+            qWarning() << "Failed to encode the screenshot to" << filepath;
+            file.remove();
+            return -1;
+        }
 
-    emit sendFile(f->getFriendID(), fi.fileName(), fi.filePath(), filesize);
+        return file.size();
+    }));
 }
 
 void ChatForm::onLoadHistory()
@@ -824,7 +1104,7 @@ void ChatForm::onLoadHistory()
     if (!Nexus::getProfile()->isHistoryEnabled())
         return;
 
-    LoadHistoryDialog dlg;
+    LoadHistoryDialog dlg{f->getToxId().publicKey};
 
     if (dlg.exec())
     {
@@ -833,6 +1113,15 @@ void ChatForm::onLoadHistory()
     }
 }
 
+void ChatForm::onSearchHistory()
+{
+    if (!Nexus::getProfile()->isHistoryEnabled())
+        return;
+
+    SearchHistoryDialog dlg{f->getToxId().publicKey, this};
+    dlg.exec();
+}
+
 void ChatForm::onMessageInserted()
 {
     if (netcam && bodySplitter->sizes()[1] == 0)
@@ -950,12 +1239,12 @@ void ChatForm::SendMessageStr(QString msg)
     if (isAction)
         msg = msg = msg.right(msg.length() - 4);
 
-    QList<CString> splittedMsg = Core::splitMessage(msg, TOX_MAX_MESSAGE_LENGTH);
+    const QByteArray utf8Msg = msg.toUtf8();
     QDateTime timestamp = QDateTime::currentDateTime();
 
-    for (CString& c_msg : splittedMsg)
+    for (const Core::MessageSpan& span : Core::splitMessage(utf8Msg, TOX_MAX_MESSAGE_LENGTH))
     {
-        QString qt_msg = CString::toString(c_msg.data(), c_msg.size());
+        QString qt_msg = QString::fromUtf8(utf8Msg.constData() + span.offset, span.length);
         QString qt_msg_hist = qt_msg;
         if (isAction)
             qt_msg_hist = "/me " + qt_msg;
@@ -999,6 +1288,7 @@ void ChatForm::retranslateUi()
     QString volObjectName = volButton->objectName();
     QString micObjectName = micButton->objectName();
     loadHistoryAction->setText(tr("Load chat history..."));
+    searchHistoryAction->setText(tr("Search chat history..."));
     copyStatusAction->setText(tr("Copy"));
 
     if (volObjectName == QStringLiteral("green"))
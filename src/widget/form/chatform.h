@@ -22,6 +22,7 @@
 
 #include "genericchatform.h"
 #include "src/core/corestructs.h"
+#include "src/persistence/history.h"
 #include <QSet>
 #include <QLabel>
 #include <QTimer>
@@ -43,7 +44,11 @@ public:
     explicit ChatForm(Friend* chatFriend);
     ~ChatForm();
     void setStatusMessage(QString newMessage);
-    void loadHistory(QDateTime since, bool processUndelivered = false);
+    void loadHistory(QDateTime since);
+    /// Queues the messages of past sessions that weren't delivered, once per session, when the friend comes online
+    void sendPendingMessages();
+    /// Loads the page of history messages right before the oldest one displayed
+    void loadHistoryPage();
 
     void dischargeReceipt(int receipt);
     void setFriendTyping(bool isTyping);
@@ -56,8 +61,8 @@ signals:
     void aliasChanged(const QString& alias);
 
 public slots:
-    void startFileSend(ToxFile file);
-    void onFileRecvRequest(ToxFile file);
+    void startFileSend(const ToxFile::Ptr& file);
+    void onFileRecvRequest(const ToxFile::Ptr& file);
     void onAvInvite(uint32_t FriendId, bool video);
     void onAvStart(uint32_t FriendId, bool video);
     void onAvEnd(uint32_t FriendId);
@@ -77,7 +82,9 @@ private slots:
     void onMicMuteToggle();
     void onVolMuteToggle();
     void onFileSendFailed(uint32_t FriendId, const QString &fname);
+    void onFileTransferFinished(const ToxFile::Ptr& file);
     void onLoadHistory();
+    void onSearchHistory();
     void onUpdateTime();
     void onEnableCallButtons();
     void onScreenshotClicked();
@@ -85,18 +92,41 @@ private slots:
     void doScreenshot();
     void onMessageInserted();
     void onCopyStatusMessage();
+    void onChatHistoryChunk(qint64 requestId, QList<History::HistMessage> messages, bool finished);
+    void onChatLogTrimmed();
+    /// Exports the whole history with this friend in the background, not just the loaded lines
+    virtual void onSaveLogClicked() final override;
 
 private:
     void retranslateUi();
     void showOutgoingCall(bool video);
+    /// Lines being built from history messages, which can arrive in several chunks
+    struct HistoryLoad
+    {
+        QList<ChatLine::Ptr> lines;
+        ToxId prevId;
+        QDate lastDate = QDate(1,0,0);
+        bool hasFirstMessage = false;
+        QDateTime firstMessageTime;
+        qint64 firstMessageId = 0;
+    };
+
+    /// Appends the lines displaying history messages to the lines of a load
+    void buildHistoryLines(const QList<History::HistMessage>& msgs, HistoryLoad& load);
+    /// Prepends history lines to the chat log, keeping the current scroll position
+    void insertHistoryLines(const QList<ChatLine::Ptr>& lines);
 
 protected:
     virtual GenericNetCamView* createNetcam() final override;
+    virtual void sendText(const QString& text) final override;
+    virtual bool canSendFiles() const final override { return true; }
+    virtual void sendTextAsFile(const QString& text) final override;
     // drag & drop
     virtual void dragEnterEvent(QDragEnterEvent* ev) final override;
     virtual void dropEvent(QDropEvent* ev) final override;
     virtual void hideEvent(QHideEvent* event) final override;
     virtual void showEvent(QShowEvent* event) final override;
+    virtual void releaseChatLog() final override;
 
 private:
     CoreAV* coreav;
@@ -110,7 +140,14 @@ private:
     QElapsedTimer timeElapsed;
     OfflineMsgEngine *offlineEngine;
     QAction* loadHistoryAction;
+    QAction* searchHistoryAction;
     QAction* copyStatusAction;
+    /// Number of messages loaded each time the user scrolls to the top of the chat log
+    static constexpr int historyPageSize = 100;
+    /// Qt's PNG quality, 70 is zlib level 2: files a bit bigger than the default, but several times faster to encode
+    static constexpr int screenshotPngQuality = 70;
+    QHash<qint64, HistoryLoad> pendingHistoryLoads; ///< Maps getChatHistoryAsync requests to their lines
+    bool pendingMessagesSent = false; ///< Core keeps what it was given across the friend's disconnections
 
     QHash<uint, FileTransferInstance*> ftransWidgets;
     void startCounter();
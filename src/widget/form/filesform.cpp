@@ -21,7 +21,10 @@
 #include "src/widget/widget.h"
 #include "src/widget/translator.h"
 #include "src/widget/contentlayout.h"
+#include "src/persistence/settings.h"
 #include <QFileInfo>
+#include <QFormLayout>
+#include <QSpinBox>
 #include <QWindow>
 
 FilesForm::FilesForm()
@@ -37,11 +40,31 @@ FilesForm::FilesForm()
     recvd = new QListWidget;
     sent = new QListWidget;
 
+    limits = new QWidget;
+    QFormLayout* limitsLayout = new QFormLayout(limits);
+    uploadLimitLabel = new QLabel;
+    friendUploadLimitLabel = new QLabel;
+    uploadLimit = new QSpinBox;
+    friendUploadLimit = new QSpinBox;
+    for (QSpinBox* limit : {uploadLimit, friendUploadLimit})
+    {
+        limit->setRange(0, 1024 * 1024);
+        limit->setSingleStep(64);
+    }
+    uploadLimit->setValue(Settings::getInstance().getFileUploadLimit());
+    friendUploadLimit->setValue(Settings::getInstance().getFileFriendUploadLimit());
+    limitsLayout->addRow(uploadLimitLabel, uploadLimit);
+    limitsLayout->addRow(friendUploadLimitLabel, friendUploadLimit);
+
     main.addTab(recvd, QString());
     main.addTab(sent, QString());
+    main.addTab(limits, QString());
 
     connect(sent, &QListWidget::itemActivated, this, &FilesForm::onFileActivated);
     connect(recvd, &QListWidget::itemActivated, this, &FilesForm::onFileActivated);
+    auto spinValueChanged = (void(QSpinBox::*)(int)) &QSpinBox::valueChanged;
+    connect(uploadLimit, spinValueChanged, this, &FilesForm::onUploadLimitChanged);
+    connect(friendUploadLimit, spinValueChanged, this, &FilesForm::onFriendUploadLimitChanged);
 
     retranslateUi();
     Translator::registerHandler(std::bind(&FilesForm::retranslateUi, this), this);
@@ -52,6 +75,7 @@ FilesForm::~FilesForm()
     Translator::unregister(this);
     delete recvd;
     delete sent;
+    delete limits;
     head->deleteLater();
 }
 
@@ -98,9 +122,28 @@ void FilesForm::onFileActivated(QListWidgetItem *item)
     Widget::confirmExecutableOpen(QFileInfo(item->data(Qt::UserRole).toString()));
 }
 
+void FilesForm::onUploadLimitChanged(int limit)
+{
+    Settings::getInstance().setFileUploadLimit(limit);
+}
+
+void FilesForm::onFriendUploadLimitChanged(int limit)
+{
+    Settings::getInstance().setFileFriendUploadLimit(limit);
+}
+
 void FilesForm::retranslateUi()
 {
     headLabel.setText(tr("Transferred Files","\"Headline\" of the window"));
     main.setTabText(0, tr("Downloads"));
     main.setTabText(1, tr("Uploads"));
+    main.setTabText(2, tr("Limits"));
+
+    uploadLimitLabel->setText(tr("Upload limit"));
+    friendUploadLimitLabel->setText(tr("Upload limit per friend"));
+    for (QSpinBox* limit : {uploadLimit, friendUploadLimit})
+    {
+        limit->setSuffix(tr(" KiB/s", "Upload limit unit"));
+        limit->setSpecialValueText(tr("Unlimited"));
+    }
 }
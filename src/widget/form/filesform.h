@@ -28,6 +28,7 @@
 
 class ContentLayout;
 class QListWidget;
+class QSpinBox;
 
 class FilesForm : public QObject
 {
@@ -46,6 +47,8 @@ public slots:
 
 private slots:
     void onFileActivated(QListWidgetItem* item);
+    void onUploadLimitChanged(int limit);
+    void onFriendUploadLimitChanged(int limit);
 
 private:
     void retranslateUi();
@@ -57,6 +60,9 @@ private:
     QVBoxLayout headLayout;
     QTabWidget main;
     QListWidget* sent, * recvd;
+    QWidget* limits;
+    QLabel* uploadLimitLabel, * friendUploadLimitLabel;
+    QSpinBox* uploadLimit, * friendUploadLimit;
 };
 
 #endif // FILESFORM_H
@@ -25,12 +25,14 @@
 #include <QShortcut>
 #include <QKeyEvent>
 #include <QSplitter>
+#include <QMessageBox>
 
 #include "src/persistence/smileypack.h"
 #include "src/widget/emoticonswidget.h"
 #include "src/widget/style.h"
 #include "src/widget/widget.h"
 #include "src/persistence/settings.h"
+#include "src/persistence/chatexporter.h"
 #include "src/widget/tool/chattextedit.h"
 #include "src/widget/maskablepixmapwidget.h"
 #include "src/core/core.h"
@@ -78,7 +80,12 @@ GenericChatForm::GenericChatForm(QWidget *parent)
     connect(&Settings::getInstance(), &Settings::emojiFontChanged,
             this, [this]() { chatWidget->forceRelayout(); });
 
+    chatWidget->setMaxLines(Settings::getInstance().getChatMaxLines());
+    connect(&Settings::getInstance(), &Settings::chatMaxLinesChanged,
+            this, [this]() { chatWidget->setMaxLines(Settings::getInstance().getChatMaxLines()); });
+
     msgEdit = new ChatTextEdit();
+    connect(msgEdit, &ChatTextEdit::largePasted, this, &GenericChatForm::onLargePaste);
 
     sendButton = new QPushButton();
     emoteButton = new QPushButton();
@@ -214,9 +221,12 @@ GenericChatForm::GenericChatForm(QWidget *parent)
     netcam = nullptr;
 }
 
+QList<GenericChatForm*> GenericChatForm::recentForms;
+
 GenericChatForm::~GenericChatForm()
 {
     Translator::unregister(this);
+    recentForms.removeOne(this);
 }
 
 void GenericChatForm::adjustFileMenuPosition()
@@ -286,6 +296,25 @@ void GenericChatForm::show(ContentLayout* contentLayout)
 void GenericChatForm::showEvent(QShowEvent *)
 {
     msgEdit->setFocus();
+    markRecentlyShown();
+}
+
+/**
+@brief Keeps the chat logs of the recently shown forms, the others only keep their newest lines.
+
+Once a form falls out of the recently shown ones, it releases what it can reload from the history later.
+Visible forms, in a separate window for example, are left alone.
+*/
+void GenericChatForm::markRecentlyShown()
+{
+    recentForms.removeOne(this);
+    recentForms.prepend(this);
+
+    for (int i = maxRecentForms; i < recentForms.size(); ++i)
+    {
+        if (!recentForms[i]->isVisible())
+            recentForms[i]->releaseChatLog();
+    }
 }
 
 bool GenericChatForm::event(QEvent* e)
@@ -388,37 +417,37 @@ void GenericChatForm::onEmoteInsertRequested(QString str)
     msgEdit->setFocus(); // refocus so that we can continue typing
 }
 
-void GenericChatForm::onSaveLogClicked()
+std::shared_ptr<ChatExporter> GenericChatForm::askLogExporter()
 {
-    QString path = QFileDialog::getSaveFileName(0, tr("Save chat log"));
+    QString filter;
+    QString path = QFileDialog::getSaveFileName(0, tr("Save chat log"), QString(),
+                                                ChatExporter::nameFilters().join(";;"), &filter);
     if (path.isEmpty())
-        return;
+        return nullptr;
+
+    ChatExporter::Format format = ChatExporter::formatFor(filter, path);
+    return std::make_shared<ChatExporter>(ChatExporter::withExtension(path, format), format,
+                                          Settings::getInstance().getTimestampFormat());
+}
 
-    QFile file(path);
-    if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
+void GenericChatForm::onSaveLogClicked()
+{
+    std::shared_ptr<ChatExporter> exporter = askLogExporter();
+    if (!exporter || !exporter->begin(nameLabel->fullText()))
         return;
 
-    QString plainText;
-    auto lines = chatWidget->getLines();
-    for (ChatLine::Ptr l : lines)
+    for (ChatLine::Ptr l : chatWidget->getLines())
     {
         Timestamp* rightCol = dynamic_cast<Timestamp*>(l->getContent(2));
-
         if (!rightCol)
-            return;
+            continue;
 
-        ChatLineContent* middleCol = l->getContent(1);
-        ChatLineContent* leftCol = l->getContent(0);
-
-        QString timestamp = (!rightCol || rightCol->getTime().isNull()) ? tr("Not sent") : rightCol->getText();
-        QString nick = leftCol->getText();
-        QString msg = middleCol->getText();
-
-        plainText += QString("[%2] %1\n%3\n\n").arg(nick, timestamp, msg);
+        QDateTime time = rightCol->getTime();
+        if (!exporter->addMessage(l->getContent(0)->getText(), l->getContent(1)->getText(), time, time.isNull()))
+            break;
     }
 
-    file.write(plainText.toUtf8());
-    file.close();
+    exporter->finish();
 }
 
 void GenericChatForm::onCopyLogClicked()
@@ -452,6 +481,9 @@ void GenericChatForm::clearChatArea(bool notinform)
 
     earliestMessage = QDateTime(); //null
     historyBaselineDate = QDateTime::currentDateTime();
+    historyCursorTime = QDateTime(); //null
+    historyCursorId = 0;
+    historyExhausted = false;
 
     emit chatAreaCleared();
 }
@@ -549,6 +581,30 @@ void GenericChatForm::onSplitterMoved(int, int)
         netcam->setShowMessages(bodySplitter->sizes()[1] == 0);
 }
 
+/**
+@brief Offers to send a large paste as a file or as messages, or to paste it anyway.
+*/
+void GenericChatForm::onLargePaste(const QString& text)
+{
+    QMessageBox box(QMessageBox::Question, tr("Large paste"),
+                    tr("The pasted text is %1 KiB long, how do you want to send it?")
+                        .arg(text.toUtf8().size() / 1024),
+                    QMessageBox::NoButton, this);
+    QPushButton* asFileButton = canSendFiles() ? box.addButton(tr("Send as a file"), QMessageBox::AcceptRole) : nullptr;
+    QPushButton* messagesButton = box.addButton(tr("Send as messages"), QMessageBox::AcceptRole);
+    QPushButton* pasteButton = box.addButton(tr("Paste anyway"), QMessageBox::ActionRole);
+    box.addButton(QMessageBox::Cancel);
+    box.exec();
+
+    QAbstractButton* clicked = box.clickedButton();
+    if (asFileButton && clicked == asFileButton)
+        sendTextAsFile(text);
+    else if (clicked == messagesButton)
+        sendText(text);
+    else if (clicked == pasteButton)
+        msgEdit->insertPlainText(text);
+}
+
 void GenericChatForm::onShowMessagesClicked()
 {
     if (netcam)
@@ -599,6 +655,8 @@ void GenericChatForm::showNetcam()
 
     bodySplitter->insertWidget(0, netcam);
     bodySplitter->setCollapsible(0, false);
+    // it may have been built hidden in advance
+    netcam->show();
 }
 
 void GenericChatForm::hideNetcam()
@@ -27,6 +27,7 @@
 #include "src/core/corestructs.h"
 #include "src/chatlog/chatmessage.h"
 #include "../../core/toxid.h"
+#include <memory>
 
 // Spacing in px inserted when the author of the last message changes
 #define AUTHOR_CHANGE_SPACING 5 // why the hell is this a thing? surely the different font is enough?
@@ -43,6 +44,7 @@ class FlyoutOverlayWidget;
 class ContentLayout;
 class QSplitter;
 class GenericNetCamView;
+class ChatExporter;
 
 namespace Ui {
     class MainWindow;
@@ -82,7 +84,8 @@ protected slots:
     void onChatContextMenuRequested(QPoint pos);
     void onEmoteButtonClicked();
     void onEmoteInsertRequested(QString str);
-    void onSaveLogClicked();
+    /// Exports the lines loaded in the chat log
+    virtual void onSaveLogClicked();
     void onCopyLogClicked();
     void clearChatArea(bool);
     void clearChatArea();
@@ -91,14 +94,24 @@ protected slots:
     void hideFileMenu();
     void onShowMessagesClicked();
     void onSplitterMoved(int pos, int index);
+    /// Asks the user how to send a paste too large for the message edit
+    void onLargePaste(const QString& text);
 
 private:
     void retranslateUi();
 
 protected:
+    /// Asks the user where to save the chat log, returns nullptr if they cancel
+    std::shared_ptr<ChatExporter> askLogExporter();
     void showNetcam();
     void hideNetcam();
     virtual GenericNetCamView* createNetcam() = 0;
+    /// Sends the text as messages, split as needed, as if the user had typed it
+    virtual void sendText(const QString& text) = 0;
+    /// Whether large pastes can be sent with sendTextAsFile
+    virtual bool canSendFiles() const { return false; }
+    /// Saves the text in a file and sends that instead
+    virtual void sendTextAsFile(const QString& text) { Q_UNUSED(text); }
     QString resolveToxId(const ToxId &id);
     void insertChatMessage(ChatMessage::Ptr msg);
     void adjustFileMenuPosition();
@@ -107,6 +120,12 @@ protected:
     virtual bool event(QEvent *) final override;
     virtual void resizeEvent(QResizeEvent* event) final override;
     virtual bool eventFilter(QObject* object, QEvent* event) final override;
+    /// Frees what the form can reload later, called while it's hidden and not among the recently shown forms
+    virtual void releaseChatLog() {}
+
+private:
+    /// Puts the form first among the recently shown ones, and releases the chat logs past the limit
+    void markRecentlyShown();
 
 protected:
     QAction* saveChatAction, *clearAction;
@@ -125,11 +144,19 @@ protected:
     QPushButton *sendButton;
     ChatLog *chatWidget;
     QDateTime earliestMessage;
+    // Keyset cursor of the oldest message loaded from history, the id is 0 if we only know a date
+    QDateTime historyCursorTime;
+    qint64 historyCursorId = 0;
+    bool historyExhausted = false; ///< True once there is no older message left to load
     QDateTime historyBaselineDate = QDateTime::currentDateTime(); // used by HistoryKeeper to load messages from t to historyBaselineDate (excluded)
     bool audioInputFlag;
     bool audioOutputFlag;
     QSplitter* bodySplitter;
     GenericNetCamView* netcam;
+
+private:
+    static QList<GenericChatForm*> recentForms; ///< The forms that were shown, most recently shown first
+    static constexpr int maxRecentForms = 8; ///< Forms whose chat log is kept whole
 };
 
 #endif // GENERICCHATFORM_H
@@ -27,15 +27,23 @@
 #include "src/core/core.h"
 #include "src/core/coreav.h"
 #include "src/widget/style.h"
+#include "src/persistence/settings.h"
+#include "src/persistence/profile.h"
+#include "src/persistence/history.h"
+#include "src/chatlog/chatlog.h"
+#include "src/nexus.h"
 #include "src/widget/flowlayout.h"
 #include "src/widget/translator.h"
 #include "src/video/groupnetcamview.h"
 #include <QDebug>
+#include <QRegularExpression>
 #include <QTimer>
+#include <QScrollBar>
 #include <QPushButton>
 #include <QMimeData>
 #include <QDragEnterEvent>
 #include <QtAlgorithms>
+#include <algorithm>
 
 GroupChatForm::GroupChatForm(Group* chatGroup)
     : group(chatGroup), inCall{false}
@@ -44,6 +52,9 @@ GroupChatForm::GroupChatForm(Group* chatGroup)
 
     tabber = new TabCompleter(msgEdit, group);
 
+    // Group chats can stay open for a very long time, so we don't keep all their messages in memory
+    chatWidget->setVirtualized(true);
+
     fileButton->setEnabled(false);
     if (group->isAvGroupchat())
     {
@@ -69,20 +80,7 @@ GroupChatForm::GroupChatForm(Group* chatGroup)
     msgEdit->setObjectName("group");
 
     namesListLayout = new FlowLayout(0,5,0);
-    QStringList names(group->getPeerList());
-
-    for (QString& name : names)
-    {
-        QLabel *l = new QLabel();
-        QString tooltip = correctNames(name);
-        if (tooltip.isNull())
-        {
-            l->setToolTip(tooltip);
-        }
-        l->setText(name);
-        l->setTextFormat(Qt::PlainText);
-        namesListLayout->addWidget(l);
-    }
+    updatePeerLabels();
 
     headTextLayout->addWidget(nusersLabel);
     headTextLayout->addLayout(namesListLayout);
@@ -107,14 +105,19 @@ GroupChatForm::GroupChatForm(Group* chatGroup)
         }
     });
 
+    connect(chatWidget, &ChatLog::topReached, this, &GroupChatForm::loadHistoryPage);
+
     setAcceptDrops(true);
     Translator::registerHandler(std::bind(&GroupChatForm::retranslateUi, this), this);
+
+    loadHistoryPage();
 }
 
 // Correct names with "\n" in NamesListLayout widget
 QString GroupChatForm::correctNames(QString& name)
 {
-    int pos = name.indexOf(QRegExp("\n|\r\n|\r"));
+    static const QRegularExpression lineBreak("\n|\r\n|\r");
+    int pos = name.indexOf(lineBreak);
     int len = name.length();
     if ( (pos < len) && (pos !=-1) )
     {
@@ -134,6 +137,74 @@ GroupChatForm::~GroupChatForm()
     Translator::unregister(this);
 }
 
+/**
+@brief Loads the messages right before the oldest one shown, called on scroll and when the title changes.
+The messages of this session are all in the chat log already, so the first page ends at historyBaselineDate.
+*/
+void GroupChatForm::loadHistoryPage()
+{
+    Profile* profile = Nexus::getProfile();
+    if (!profile || !profile->isHistoryEnabled() || !group->hasTitle())
+        return;
+
+    // A renamed group continues with the history of its new title, above what we have shown so far
+    QString key = History::groupChatKey(group->getName());
+    if (key != historyKey)
+    {
+        historyKey = key;
+        historyCursorTime = QDateTime();
+        historyCursorId = 0;
+        historyExhausted = false;
+    }
+
+    if (historyExhausted)
+        return;
+
+    if (historyCursorTime.isNull())
+        historyCursorTime = historyBaselineDate;
+
+    QList<History::HistMessage> msgs = profile->getHistory()->getChatHistoryPage(historyKey, historyCursorTime,
+                                                                                 historyCursorId, historyPageSize);
+    if (msgs.size() < historyPageSize)
+        historyExhausted = true;
+    if (msgs.isEmpty())
+        return;
+
+    historyCursorTime = msgs.first().timestamp;
+    historyCursorId = msgs.first().id;
+
+    QList<ChatLine::Ptr> lines;
+    QDate lastDate;
+    ToxId prevId;
+    QDateTime prevTime;
+    for (const History::HistMessage& it : msgs)
+    {
+        QDateTime time = it.timestamp.toLocalTime();
+        if (time.date() != lastDate)
+        {
+            lastDate = time.date();
+            lines.append(ChatMessage::createChatInfoMessage(lastDate.toString(Settings::getInstance().getDateFormat()),
+                                                            ChatMessage::INFO, QDateTime()));
+        }
+
+        ToxId authorId{it.sender};
+        bool isAction = it.message.startsWith("/me ", Qt::CaseInsensitive);
+        ChatMessage::Ptr msg = ChatMessage::createChatMessage(it.dispName, isAction ? it.message.mid(4) : it.message,
+                                                              isAction ? ChatMessage::ACTION : ChatMessage::NORMAL,
+                                                              authorId.isSelf(), time, it.id);
+        if (!isAction && prevId == authorId && prevTime.secsTo(time) < getChatLog()->repNameAfter)
+            msg->hideSender();
+
+        prevId = isAction ? ToxId() : authorId;
+        prevTime = time;
+        lines.append(msg);
+    }
+
+    int savedSliderPos = chatWidget->verticalScrollBar()->maximum() - chatWidget->verticalScrollBar()->value();
+    chatWidget->insertChatlineOnTop(lines);
+    chatWidget->verticalScrollBar()->setValue(chatWidget->verticalScrollBar()->maximum() - savedSliderPos);
+}
+
 void GroupChatForm::onSendTriggered()
 {
     QString msg = msgEdit->toPlainText();
@@ -142,7 +213,12 @@ void GroupChatForm::onSendTriggered()
 
     msgEdit->setLastMessage(msg);
     msgEdit->clear();
+    sendText(msg);
+}
 
+void GroupChatForm::sendText(const QString& text)
+{
+    QString msg = text;
     if (group->getPeersCount() != 1)
     {
         if (msg.startsWith("/me ", Qt::CaseInsensitive))
@@ -172,49 +248,7 @@ void GroupChatForm::onUserListChanged()
     else
         nusersLabel->setText(tr("%1 users in chat", "Number of users in chat").arg(peersCount));
 
-    QLayoutItem *child;
-    while ((child = namesListLayout->takeAt(0)))
-    {
-        child->widget()->hide();
-        delete child->widget();
-        delete child;
-    }
-    peerLabels.clear();
-
-    // the list needs peers in peernumber order, nameLayout needs alphabetical
-    QList<QLabel*> nickLabelList;
-
-    // first traverse in peer number order, storing the QLabels as necessary
-    QStringList names = group->getPeerList();
-    unsigned nNames = names.size();
-    for (unsigned i=0; i<nNames; ++i)
-    {
-        QString tooltip = correctNames(names[i]);
-        peerLabels.append(new QLabel(names[i]));
-        if (!tooltip.isEmpty())
-            peerLabels[i]->setToolTip(tooltip);
-        peerLabels[i]->setTextFormat(Qt::PlainText);
-        nickLabelList.append(peerLabels[i]);
-        if (group->isSelfPeerNumber(i))
-            peerLabels[i]->setStyleSheet("QLabel {color : green;}");
-
-        if (netcam && !group->isSelfPeerNumber(i))
-            static_cast<GroupNetCamView*>(netcam)->addPeer(i, names[i]);
-    }
-
-    if (netcam)
-        static_cast<GroupNetCamView*>(netcam)->clearPeers();
-
-    // now alphabetize and add to layout
-    qSort(nickLabelList.begin(), nickLabelList.end(), [](QLabel *a, QLabel *b){return a->text().toLower() < b->text().toLower();});
-    for (unsigned i=0; i<nNames; ++i)
-    {
-        QLabel *label = nickLabelList.at(i);
-        if (i != nNames - 1)
-            label->setText(label->text() + ", ");
-
-        namesListLayout->addWidget(label);
-    }
+    updatePeerLabels();
 
     // Enable or disable call button
     if (peersCount > 1 && group->isAvGroupchat())
@@ -239,6 +273,156 @@ void GroupChatForm::onUserListChanged()
     }
 }
 
+/**
+@brief Brings the name labels and the netcam in line with the group's peers.
+
+Peers are matched by public key, so only the labels of peers who joined, left or
+were renamed are touched. The others keep their place in the alphabetical order.
+*/
+void GroupChatForm::updatePeerLabels()
+{
+    QStringList names = group->getPeerList();
+    QStringList keys = group->getPeerKeys();
+    QHash<QString, QLabel*> gone = peerLabelsByKey;
+    QLabel* oldLastLabel = lastPeerLabel;
+    QLabel* newSelfLabel = nullptr;
+    GroupNetCamView* netcamView = static_cast<GroupNetCamView*>(netcam);
+
+    QStringList labelKeys;
+    peerLabels.clear();
+    peerLabels.reserve(names.size());
+
+    for (int i = 0; i < names.size(); ++i)
+    {
+        // peers without a known key are told apart by number
+        QString key = i < keys.size() ? keys[i] : QString();
+        if (key.isEmpty())
+            key = QString::number(i);
+
+        QLabel* label = peerLabelsByKey.value(key);
+        if (label != nullptr && !gone.contains(key))
+        {
+            // same key twice, the label is already taken by an earlier peer
+            key += QLatin1Char('#') + QString::number(i);
+            label = peerLabelsByKey.value(key);
+        }
+
+        QString name = names[i];
+        QString tooltip = correctNames(name);
+        bool renamed = false;
+
+        if (label == nullptr)
+        {
+            label = new QLabel();
+            label->setTextFormat(Qt::PlainText);
+            label->setToolTip(tooltip);
+            insertPeerLabel(label, name);
+            peerLabelsByKey.insert(key, label);
+        }
+        else
+        {
+            gone.remove(key);
+
+            if (label->property("peerName").toString() != name)
+            {
+                renamed = true;
+                removePeerLabel(label);
+                label->setToolTip(tooltip);
+                insertPeerLabel(label, name);
+            }
+        }
+
+        peerLabels.append(label);
+        labelKeys.append(key);
+        if (group->isSelfPeerNumber(i))
+            newSelfLabel = label;
+
+        bool moved = i >= peerLabelKeys.size() || peerLabelKeys[i] != key;
+        if (netcamView && (moved || renamed))
+        {
+            netcamView->removePeer(i);
+            if (!group->isSelfPeerNumber(i))
+                netcamView->addPeer(i, name);
+        }
+    }
+
+    for (auto it = gone.constBegin(); it != gone.constEnd(); ++it)
+    {
+        removePeerLabel(it.value());
+        peerLabelsByKey.remove(it.key());
+
+        if (selfPeerLabel == it.value())
+            selfPeerLabel = nullptr;
+
+        if (oldLastLabel == it.value())
+            oldLastLabel = nullptr;
+
+        delete it.value();
+    }
+
+    if (netcamView)
+    {
+        for (int i = names.size(); i < peerLabelKeys.size(); ++i)
+            netcamView->removePeer(i);
+    }
+
+    peerLabelKeys = labelKeys;
+
+    if (newSelfLabel != selfPeerLabel)
+    {
+        if (selfPeerLabel != nullptr)
+            selfPeerLabel->setStyleSheet("");
+
+        if (newSelfLabel != nullptr)
+            newSelfLabel->setStyleSheet("QLabel {color : green;}");
+
+        selfPeerLabel = newSelfLabel;
+    }
+
+    // Only the last label goes without a comma.
+    int count = namesListLayout->count();
+    lastPeerLabel = count > 0 ? static_cast<QLabel*>(namesListLayout->itemAt(count - 1)->widget()) : nullptr;
+
+    if (oldLastLabel != nullptr && oldLastLabel != lastPeerLabel)
+        oldLastLabel->setText(oldLastLabel->property("peerName").toString() + ", ");
+
+    if (lastPeerLabel != nullptr)
+        lastPeerLabel->setText(lastPeerLabel->property("peerName").toString());
+}
+
+void GroupChatForm::insertPeerLabel(QLabel* label, const QString& name)
+{
+    QString sortName = name.toLower();
+    auto it = std::upper_bound(sortedPeerNames.begin(), sortedPeerNames.end(), sortName);
+    int index = it - sortedPeerNames.begin();
+
+    sortedPeerNames.insert(index, sortName);
+    label->setProperty("peerName", name);
+    label->setText(name + ", ");
+    namesListLayout->insertWidget(index, label);
+}
+
+void GroupChatForm::removePeerLabel(QLabel* label)
+{
+    QString sortName = label->property("peerName").toString().toLower();
+    auto it = std::lower_bound(sortedPeerNames.begin(), sortedPeerNames.end(), sortName);
+
+    for (int index = it - sortedPeerNames.begin(); index < sortedPeerNames.size(); ++index)
+    {
+        if (namesListLayout->itemAt(index)->widget() == label)
+        {
+            delete namesListLayout->takeAt(index);
+            sortedPeerNames.removeAt(index);
+            namesListLayout->invalidate();
+
+            if (lastPeerLabel == label)
+                lastPeerLabel = nullptr;
+
+            return;
+        }
+    }
+}
+
 void GroupChatForm::peerAudioPlaying(int peer)
 {
     peerLabels[peer]->setStyleSheet("QLabel {color : red;}");
@@ -22,6 +22,8 @@
 
 #include "genericchatform.h"
 #include <QMap>
+#include <QHash>
+#include <QStringList>
 
 namespace Ui {class MainWindow;}
 class Group;
@@ -38,6 +40,8 @@ public:
 
     void onUserListChanged();
     void peerAudioPlaying(int peer);
+    /// Prepends a page of the messages saved before this session, the history is found by the group title
+    void loadHistoryPage();
 
 signals:
     void groupTitleChanged(int groupnum, const QString& name);
@@ -50,6 +54,7 @@ private slots:
 
 protected:
     virtual GenericNetCamView* createNetcam() final override;
+    virtual void sendText(const QString& text) final override;
     virtual void keyPressEvent(QKeyEvent* ev) final override;
     virtual void keyReleaseEvent(QKeyEvent* ev) final override;
     // drag & drop
@@ -58,15 +63,26 @@ protected:
 
 private:
     void retranslateUi();
+    void updatePeerLabels();
+    void insertPeerLabel(QLabel* label, const QString& name);
+    void removePeerLabel(QLabel* label);
 
 private:
     Group* group;
     QList<QLabel*> peerLabels; // maps peernumbers to the QLabels in namesListLayout
+    QHash<QString, QLabel*> peerLabelsByKey; // maps public keys to the same QLabels
+    QStringList peerLabelKeys; // public keys by peernumber, as of the last update
+    QStringList sortedPeerNames; // lowercased names, in namesListLayout order
+    QLabel* lastPeerLabel = nullptr; // the only label without a trailing comma
+    QLabel* selfPeerLabel = nullptr;
     QMap<int, QTimer*> peerAudioTimers; // timeout = peer stopped sending audio
     FlowLayout* namesListLayout;
     QLabel *nusersLabel;
     TabCompleter* tabber;
     bool inCall;
+    QString historyKey; ///< History::groupChatKey() of the title the history cursor belongs to
+    /// Number of messages loaded each time the user scrolls to the top of the chat log
+    static constexpr int historyPageSize = 100;
     QString correctNames(QString& name);
 };
 
@@ -19,12 +19,20 @@
 
 #include "loadhistorydialog.h"
 #include "ui_loadhistorydialog.h"
+#include "src/persistence/history.h"
+#include "src/persistence/profile.h"
+#include "src/nexus.h"
+#include <QTextCharFormat>
 
-LoadHistoryDialog::LoadHistoryDialog(QWidget *parent) :
+LoadHistoryDialog::LoadHistoryDialog(const QString& friendPk, QWidget *parent) :
     QDialog(parent),
-    ui(new Ui::LoadHistoryDialog)
+    ui(new Ui::LoadHistoryDialog),
+    friendPk{friendPk}
 {
     ui->setupUi(this);
+
+    connect(ui->fromDate, &QCalendarWidget::currentPageChanged, this, &LoadHistoryDialog::highlightActiveDays);
+    highlightActiveDays(ui->fromDate->yearShown(), ui->fromDate->monthShown());
 }
 
 LoadHistoryDialog::~LoadHistoryDialog()
@@ -43,3 +51,26 @@ QDateTime LoadHistoryDialog::getFromDate()
 
     return res;
 }
+
+/**
+@brief Shows the days of the displayed month with messages in bold, with their count as tooltip.
+The calendar also shows a few days of the neighbouring months, so we look a week around it.
+*/
+void LoadHistoryDialog::highlightActiveDays(int year, int month)
+{
+    History* history = Nexus::getProfile()->getHistory();
+    ui->fromDate->setDateTextFormat(QDate(), QTextCharFormat());
+    if (!history)
+        return;
+
+    QDate first(year, month, 1);
+    QMap<QDate, int> counts = history->getMessageCountPerDay(friendPk, first.addDays(-7),
+                                                             first.addMonths(1).addDays(7));
+    QTextCharFormat format;
+    format.setFontWeight(QFont::Bold);
+    for (auto it = counts.constBegin(); it != counts.constEnd(); ++it)
+    {
+        format.setToolTip(tr("%n message(s)", "", it.value()));
+        ui->fromDate->setDateTextFormat(it.key(), format);
+    }
+}
@@ -32,13 +32,18 @@ class LoadHistoryDialog : public QDialog
     Q_OBJECT
 
 public:
-    explicit LoadHistoryDialog(QWidget *parent = 0);
+    /// The days of the calendar with messages from the friend are highlighted
+    explicit LoadHistoryDialog(const QString& friendPk, QWidget *parent = 0);
     ~LoadHistoryDialog();
 
     QDateTime getFromDate();
 
+private slots:
+    void highlightActiveDays(int year, int month);
+
 private:
     Ui::LoadHistoryDialog *ui;
+    QString friendPk;
 };
 
 #endif // LOADHISTORYDIALOG_H
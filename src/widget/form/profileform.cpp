@@ -32,6 +32,7 @@
 #include "src/widget/translator.h"
 #include "src/persistence/profilelocker.h"
 #include "src/persistence/profile.h"
+#include "src/persistence/history.h"
 #include "src/persistence/settings.h"
 #include "src/net/toxme.h"
 #include <QLabel>
@@ -47,6 +48,7 @@
 #include <QWindow>
 #include <QMenu>
 #include <QMouseEvent>
+#include <QProgressDialog>
 
 ProfileForm::ProfileForm(QWidget *parent) :
     QWidget{parent}, qr{nullptr}
@@ -132,6 +134,14 @@ ProfileForm::ProfileForm(QWidget *parent) :
     connect(core, &Core::usernameSet, this, [=](const QString& val) { bodyUI->userName->setText(val); });
     connect(core, &Core::statusMessageSet, this, [=](const QString& val) { bodyUI->statusMessage->setText(val); });
 
+    // The form is created on first use, so Core has usually announced all of these already
+    if (core->isReady())
+    {
+        setToxId(core->getSelfId().toString());
+        bodyUI->userName->setText(core->getUsername());
+        bodyUI->statusMessage->setText(core->getStatusMessage());
+    }
+
     for (QComboBox* cb : findChildren<QComboBox*>())
     {
             cb->installEventFilter(this);
@@ -442,7 +452,7 @@ void ProfileForm::onDeletePassClicked()
                       tr("Are you sure you want to delete your password?","deletion confirmation text")))
         return;
 
-    Nexus::getProfile()->setPassword(QString());
+    setPasswordWithProgress(QString());
 }
 
 void ProfileForm::onChangePassClicked()
@@ -453,7 +463,31 @@ void ProfileForm::onChangePassClicked()
         return;
 
     QString newPass = dialog->getPassword();
-    Nexus::getProfile()->setPassword(newPass);
+    setPasswordWithProgress(newPass);
+}
+
+void ProfileForm::setPasswordWithProgress(const QString& newPassword)
+{
+    Profile* profile = Nexus::getProfile();
+    History* history = profile->getHistory();
+    if (history)
+    {
+        // Connect before starting, so we can't miss the end of a quick change
+        QString label = newPassword.isEmpty() ? tr("Decrypting your chat history...")
+                                              : tr("Encrypting your chat history...");
+        QProgressDialog* progress = new QProgressDialog(label, tr("Cancel"), 0, 100, this);
+        progress->setWindowTitle(tr("Changing password"));
+        progress->setWindowModality(Qt::WindowModal);
+        progress->setAutoClose(false);
+        progress->setMinimumDuration(500);
+        connect(history, &History::passwordChangeProgress, progress, &QProgressDialog::setValue);
+        connect(history, &History::passwordChanged, progress, &QProgressDialog::deleteLater);
+        connect(progress, &QProgressDialog::canceled, history, &History::cancelPasswordChange);
+        connect(history, &History::passwordChanged, this, &ProfileForm::setPasswordButtonsText,
+                Qt::UniqueConnection);
+    }
+
+    profile->setPassword(newPassword);
 }
 
 void ProfileForm::retranslateUi()
@@ -516,35 +550,36 @@ void ProfileForm::onRegisterButtonClicked()
 
     Core* oldCore = Core::getInstance();
 
-    Toxme::ExecCode code = Toxme::ExecCode::Ok;
-    QString response = Toxme::createAddress(code, server, id, name, privacy, bio);
-
-    Core* newCore = Core::getInstance();
-    // Make sure the user didn't logout (or logout and login)
-    // before the request is finished, else qTox will crash.
-    if (oldCore == newCore)
+    Toxme::createAddress(server, id, name, privacy, bio, this,
+                         [this, oldCore, name, server, bio, privacy](Toxme::ExecCode code, QString response)
     {
-        switch (code) {
-        case Toxme::Updated:
-            GUI::showInfo(tr("Done!"), tr("Account %1@%2 updated successfully").arg(name, server));
-            Settings::getInstance().setToxme(name, server, bio, privacy);
-            showExistingToxme();
-            break;
-        case Toxme::Ok:
-            GUI::showInfo(tr("Done!"), tr("Successfully added %1@%2 to the database. Save your password").arg(name, server));
-            Settings::getInstance().setToxme(name, server, bio, privacy, response);
-            showExistingToxme();
-            break;
-        default:
-            QString errorMessage = Toxme::getErrorMessage(code);
-            qWarning() << errorMessage;
-            QString translated = Toxme::translateErrorMessage(code);
-            GUI::showWarning(tr("Toxme error"),  translated);
-        }
+        Core* newCore = Core::getInstance();
+        // Make sure the user didn't logout (or logout and login)
+        // before the request is finished, else qTox will crash.
+        if (oldCore == newCore)
+        {
+            switch (code) {
+            case Toxme::Updated:
+                GUI::showInfo(tr("Done!"), tr("Account %1@%2 updated successfully").arg(name, server));
+                Settings::getInstance().setToxme(name, server, bio, privacy);
+                showExistingToxme();
+                break;
+            case Toxme::Ok:
+                GUI::showInfo(tr("Done!"), tr("Successfully added %1@%2 to the database. Save your password").arg(name, server));
+                Settings::getInstance().setToxme(name, server, bio, privacy, response);
+                showExistingToxme();
+                break;
+            default:
+                QString errorMessage = Toxme::getErrorMessage(code);
+                qWarning() << errorMessage;
+                QString translated = Toxme::translateErrorMessage(code);
+                GUI::showWarning(tr("Toxme error"),  translated);
+            }
 
-        bodyUI->toxmeRegisterButton->setEnabled(true);
-        bodyUI->toxmeUpdateButton->setEnabled(true);
-        bodyUI->toxmeRegisterButton->setText(tr("Register"));
-        bodyUI->toxmeUpdateButton->setText(tr("Update"));
-    }
+            bodyUI->toxmeRegisterButton->setEnabled(true);
+            bodyUI->toxmeUpdateButton->setEnabled(true);
+            bodyUI->toxmeRegisterButton->setText(tr("Register"));
+            bodyUI->toxmeUpdateButton->setText(tr("Update"));
+        }
+    });
 }
@@ -84,6 +84,8 @@ private slots:
     void onRegisterButtonClicked();
 
 private:
+    /// Shows the progress of the history re-encryption, with a button to cancel it, then changes the password
+    void setPasswordWithProgress(const QString& newPassword);
     void showExistingToxme();
     void retranslateUi();
     void prFileLabelUpdate();
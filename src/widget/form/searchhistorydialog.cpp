@@ -0,0 +1,72 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "searchhistorydialog.h"
+#include "src/nexus.h"
+#include "src/persistence/history.h"
+#include "src/persistence/profile.h"
+#include "src/persistence/settings.h"
+#include <QLineEdit>
+#include <QListWidget>
+#include <QVBoxLayout>
+
+/// Maximum number of messages displayed for one search
+static constexpr int maxSearchResults = 500;
+
+SearchHistoryDialog::SearchHistoryDialog(const QString &friendPk, QWidget *parent) :
+    QDialog(parent), friendPk{friendPk}
+{
+    setWindowTitle(tr("Search chat history"));
+
+    searchEdit = new QLineEdit(this);
+    searchEdit->setPlaceholderText(tr("Search for words in your messages"));
+    resultsList = new QListWidget(this);
+    resultsList->setWordWrap(true);
+
+    QVBoxLayout* layout = new QVBoxLayout(this);
+    layout->addWidget(searchEdit);
+    layout->addWidget(resultsList);
+
+    resize(500, 400);
+
+    connect(searchEdit, &QLineEdit::returnPressed, this, &SearchHistoryDialog::onSearch);
+}
+
+void SearchHistoryDialog::onSearch()
+{
+    resultsList->clear();
+
+    Profile* profile = Nexus::getProfile();
+    if (!profile || !profile->isHistoryEnabled())
+        return;
+
+    QList<History::HistMessage> msgs = profile->getHistory()->search(searchEdit->text(), friendPk, maxSearchResults);
+    if (msgs.isEmpty())
+    {
+        resultsList->addItem(tr("No messages found"));
+        return;
+    }
+
+    QString format = Settings::getInstance().getDateFormat() + " " + Settings::getInstance().getTimestampFormat();
+    for (const History::HistMessage& msg : msgs)
+    {
+        resultsList->addItem(QString("[%1] %2: %3").arg(msg.timestamp.toLocalTime().toString(format),
+                                                         msg.dispName, msg.message));
+    }
+}
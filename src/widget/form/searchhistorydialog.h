@@ -0,0 +1,46 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SEARCHHISTORYDIALOG_H
+#define SEARCHHISTORYDIALOG_H
+
+#include <QDialog>
+
+class QLineEdit;
+class QListWidget;
+
+/// Searches the saved chat history, either of one friend or of all of them
+class SearchHistoryDialog : public QDialog
+{
+    Q_OBJECT
+
+public:
+    /// If friendPk is empty, all the chats are searched
+    explicit SearchHistoryDialog(const QString& friendPk, QWidget *parent = 0);
+
+private slots:
+    void onSearch();
+
+private:
+    QString friendPk;
+    QLineEdit* searchEdit;
+    QListWidget* resultsList;
+};
+
+#endif // SEARCHHISTORYDIALOG_H
@@ -20,6 +20,7 @@
 #include "setpassworddialog.h"
 #include "ui_setpassworddialog.h"
 #include <QPushButton>
+#include <QRegularExpression>
 
 const double SetPasswordDialog::reasonablePasswordLength = 8.;
 
@@ -91,10 +92,12 @@ int SetPasswordDialog::getPasswordStrength(QString pass)
     }
 
     int variations = -1;
-    variations += pass.contains(QRegExp("[0-9]", Qt::CaseSensitive, QRegExp::RegExp)) ? 1 : 0;
-    variations += pass.contains(QRegExp("[a-z]", Qt::CaseSensitive, QRegExp::RegExp)) ? 1 : 0;
-    variations += pass.contains(QRegExp("[A-Z]", Qt::CaseSensitive, QRegExp::RegExp)) ? 1 : 0;
-    variations += pass.contains(QRegExp("[\\W]", Qt::CaseSensitive, QRegExp::RegExp)) ? 1 : 0;
+    static const QRegularExpression digit("[0-9]"), lower("[a-z]"), upper("[A-Z]");
+    static const QRegularExpression symbol("[\\W]", QRegularExpression::UseUnicodePropertiesOption);
+    variations += pass.contains(digit) ? 1 : 0;
+    variations += pass.contains(lower) ? 1 : 0;
+    variations += pass.contains(upper) ? 1 : 0;
+    variations += pass.contains(symbol) ? 1 : 0;
 
     int score = fscore;
     score += variations * 10;
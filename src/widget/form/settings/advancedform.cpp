@@ -20,9 +20,29 @@
 #include "ui_advancedsettings.h"
 
 #include "advancedform.h"
+#include "src/audio/audio.h"
+#include "src/audio/audiojitterbuffer.h"
+#include "src/chatlog/chatlog.h"
+#include "src/chatlog/content/filetransferwidget.h"
+#include "src/core/core.h"
+#include "src/core/coreav.h"
+#include "src/friend.h"
+#include "src/friendlist.h"
+#include "src/group.h"
+#include "src/grouplist.h"
+#include "src/memorystats.h"
 #include "src/persistence/settings.h"
 #include "src/persistence/db/plaindb.h"
 #include "src/widget/translator.h"
+#include "src/widget/form/chatform.h"
+#include "src/widget/form/groupchatform.h"
+
+#include <QDateTime>
+
+/// How often the diagnostics are refreshed, in ms
+static constexpr int DIAGNOSTICS_INTERVAL = 1000;
+/// Transfers we got no progress from for this long are not shown anymore, in ms
+static constexpr qint64 TRANSFER_STALE_TIME = 3000;
 
 AdvancedForm::AdvancedForm() :
     GenericForm(QPixmap(":/img/settings/general.png"))
@@ -30,11 +50,27 @@ AdvancedForm::AdvancedForm() :
     bodyUI = new Ui::AdvancedSettings;
     bodyUI->setupUi(this);
 
-    bodyUI->cbMakeToxPortable->setChecked(Settings::getInstance().getMakeToxPortable());
+    Settings& s = Settings::getInstance();
+    bodyUI->cbMakeToxPortable->setChecked(s.getMakeToxPortable());
+    bodyUI->cbHistoryWal->setChecked(s.getHistoryWalJournal());
+    bodyUI->historySyncComboBox->setCurrentIndex(s.getHistorySyncMode());
+    bodyUI->historyCacheSpinBox->setValue(s.getHistoryCacheSize());
+    bodyUI->historyMmapSpinBox->setValue(s.getHistoryMmapSize());
+    bodyUI->cbHistoryMemoryTempStore->setChecked(s.getHistoryMemoryTempStore());
 
     connect(bodyUI->cbMakeToxPortable, &QCheckBox::stateChanged, this, &AdvancedForm::onMakeToxPortableUpdated);
+    connect(bodyUI->cbHistoryWal, &QCheckBox::stateChanged, this, &AdvancedForm::onHistoryDbOptionsUpdated);
+    connect(bodyUI->historySyncComboBox, SIGNAL(currentIndexChanged(int)), this, SLOT(onHistoryDbOptionsUpdated()));
+    connect(bodyUI->historyCacheSpinBox, SIGNAL(editingFinished()), this, SLOT(onHistoryDbOptionsUpdated()));
+    connect(bodyUI->historyMmapSpinBox, SIGNAL(editingFinished()), this, SLOT(onHistoryDbOptionsUpdated()));
+    connect(bodyUI->cbHistoryMemoryTempStore, &QCheckBox::stateChanged, this, &AdvancedForm::onHistoryDbOptionsUpdated);
     connect(bodyUI->resetButton, SIGNAL(clicked()), this, SLOT(resetToDefault()));
 
+    diagnosticsTimer.setInterval(DIAGNOSTICS_INTERVAL);
+    connect(&diagnosticsTimer, &QTimer::timeout, this, &AdvancedForm::updateDiagnostics);
+    if (Core* core = Core::getInstance())
+        connect(core, &Core::fileTransferInfo, this, &AdvancedForm::onFileTransferInfo);
+
     for (QCheckBox *cb : findChildren<QCheckBox*>()) // this one is to allow scrolling on checkboxes
     {
         cb->installEventFilter(this);
@@ -54,6 +90,17 @@ void AdvancedForm::onMakeToxPortableUpdated()
     Settings::getInstance().setMakeToxPortable(bodyUI->cbMakeToxPortable->isChecked());
 }
 
+void AdvancedForm::onHistoryDbOptionsUpdated()
+{
+    Settings& s = Settings::getInstance();
+    s.setHistoryWalJournal(bodyUI->cbHistoryWal->isChecked());
+    s.setHistorySyncMode(bodyUI->historySyncComboBox->currentIndex());
+    s.setHistoryCacheSize(bodyUI->historyCacheSpinBox->value());
+    s.setHistoryMmapSize(bodyUI->historyMmapSpinBox->value());
+    s.setHistoryMemoryTempStore(bodyUI->cbHistoryMemoryTempStore->isChecked());
+    s.saveGlobal();
+}
+
 void AdvancedForm::resetToDefault()
 {
 }
@@ -69,7 +116,119 @@ bool AdvancedForm::eventFilter(QObject *o, QEvent *e)
     return QWidget::eventFilter(o, e);
 }
 
+void AdvancedForm::showEvent(QShowEvent* event)
+{
+    updateDiagnostics();
+    diagnosticsTimer.start();
+    GenericForm::showEvent(event);
+}
+
+void AdvancedForm::hideEvent(QHideEvent* event)
+{
+    diagnosticsTimer.stop();
+    GenericForm::hideEvent(event);
+}
+
+void AdvancedForm::onFileTransferInfo(const ToxFile::Ptr& file)
+{
+    TransferRate& rate = transfers[(static_cast<quint64>(file->friendId) << 32) | file->fileNum];
+    rate.fileName = QString::fromUtf8(file->fileName);
+    rate.bytesPerSec = file->bytesPerSec;
+    rate.bytesSent = file->bytesSent;
+    rate.filesize = file->filesize;
+    rate.updated = QDateTime::currentMSecsSinceEpoch();
+}
+
+/**
+@brief Shows where the time and memory go, so it can be read without a profiler.
+*/
+void AdvancedForm::updateDiagnostics()
+{
+    QStringList lines;
+
+    Core* core = Core::getInstance();
+    if (core)
+    {
+        const Core::IterationStats stats = core->getIterationStats();
+        lines << tr("Core loop: %1 iterations, late by %2 µs on average and %3 µs at most, "
+                    "taking %4 µs on average and %5 µs at most")
+                 .arg(stats.iterations).arg(stats.meanLatency).arg(stats.maxLatency)
+                 .arg(stats.meanDuration).arg(stats.maxDuration);
+
+        const Core::GroupQueueStats groups = core->getGroupQueueStats();
+        lines << tr("Group messages: %1 sent, %2 dropped, %3 pieces queued, %4 at most")
+                 .arg(groups.sent).arg(groups.dropped).arg(groups.queued).arg(groups.maxQueued);
+    }
+
+    lines << MemoryStats::report();
+
+    int chatForms = 0;
+    for (Friend* f : FriendList::getAllFriends())
+    {
+        if (!f->findChatForm())
+            continue;
+
+        ++chatForms;
+        const ChatLog::Statistics chat = f->findChatForm()->getChatLog()->getStatistics();
+        if (chat.lines)
+            lines << tr("Chat with %1: %2 lines, %3 in memory, %4 of text, %5 repaints of %6 pixels on average")
+                     .arg(f->getDisplayedName()).arg(chat.lines).arg(chat.materialized)
+                     .arg(FileTransferWidget::getHumanReadableSize(chat.textBytes))
+                     .arg(chat.repaints).arg(chat.repaints ? chat.repaintedPixels / chat.repaints : 0);
+    }
+    lines << tr("Chat forms: %1 of %2 friends").arg(chatForms).arg(FriendList::getAllFriends().size());
+
+    for (Group* g : GroupList::getAllGroups())
+    {
+        const ChatLog::Statistics chat = g->getChatForm()->getChatLog()->getStatistics();
+        if (chat.lines)
+            lines << tr("Group %1: %2 lines, %3 in memory, %4 of text, %5 repaints of %6 pixels on average")
+                     .arg(g->getName()).arg(chat.lines).arg(chat.materialized)
+                     .arg(FileTransferWidget::getHumanReadableSize(chat.textBytes))
+                     .arg(chat.repaints).arg(chat.repaints ? chat.repaintedPixels / chat.repaints : 0);
+    }
+
+    const Audio::CaptureStats capture = Audio::getInstance().getCaptureStats();
+    lines << tr("Audio capture: %1 frames, %2 dropped, processing %3 µs on average and %4 µs at most")
+             .arg(capture.captured).arg(capture.dropped)
+             .arg(capture.meanProcessing).arg(capture.maxProcessing);
+
+    CoreAV* av = core ? core->getAv() : nullptr;
+    if (av && av->anyActiveCalls())
+    {
+        for (Friend* f : FriendList::getAllFriends())
+        {
+            if (!av->getCallStats(f->getFriendID()))
+                continue;
+
+            const AudioJitterBuffer::Stats audio = av->getCallAudioStats(f->getFriendID());
+            lines << tr("Call with %1: %2 audio frames queued of %3 wanted, %4 ms latency")
+                     .arg(f->getDisplayedName()).arg(audio.depth).arg(audio.targetDepth).arg(audio.latency);
+        }
+    }
+
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    for (auto it = transfers.begin(); it != transfers.end();)
+    {
+        if (now - it->updated > TRANSFER_STALE_TIME)
+        {
+            it = transfers.erase(it);
+            continue;
+        }
+
+        lines << tr("Transfer of %1: %2/s, %3 of %4")
+                 .arg(it->fileName)
+                 .arg(FileTransferWidget::getHumanReadableSize(static_cast<qint64>(it->bytesPerSec)))
+                 .arg(FileTransferWidget::getHumanReadableSize(it->bytesSent))
+                 .arg(FileTransferWidget::getHumanReadableSize(it->filesize));
+        ++it;
+    }
+
+    bodyUI->diagnosticsLabel->setText(lines.join('\n'));
+}
+
 void AdvancedForm::retranslateUi()
 {
     bodyUI->retranslateUi(this);
+    updateDiagnostics();
 }
@@ -21,6 +21,10 @@
 #define ADVANCEDFORM_H
 
 #include "genericsettings.h"
+#include "src/core/corestructs.h"
+
+#include <QHash>
+#include <QTimer>
 
 class Core;
 
@@ -38,16 +42,34 @@ public:
 
 protected:
     bool eventFilter(QObject *o, QEvent *e) final override;
+    void showEvent(QShowEvent* event) final override;
+    void hideEvent(QHideEvent* event) final override;
 
 private slots:
     void onMakeToxPortableUpdated();
+    void onHistoryDbOptionsUpdated();
     void resetToDefault();
+    void updateDiagnostics();
+    void onFileTransferInfo(const ToxFile::Ptr& file);
 
 private:
     void retranslateUi();
 
 private:
+    struct TransferRate
+    {
+        QString fileName;
+        double bytesPerSec;
+        quint64 bytesSent;
+        quint64 filesize;
+        qint64 updated; ///< msecsSinceEpoch of the last progress we got
+    };
+
     Ui::AdvancedSettings* bodyUI;
+    /// Refreshes the diagnostics while the form is visible
+    QTimer diagnosticsTimer;
+    /// The data files being transferred, keyed by friend and file number
+    QHash<quint64, TransferRate> transfers;
 };
 
 #endif // ADVANCEDFORM_H
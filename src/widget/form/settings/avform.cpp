@@ -23,6 +23,7 @@
 #include "src/persistence/settings.h"
 #include "src/video/camerasource.h"
 #include "src/video/cameradevice.h"
+#include "src/video/cameradiscovery.h"
 #include "src/video/videosurface.h"
 #include "src/widget/translator.h"
 #include "src/core/core.h"
@@ -56,12 +57,16 @@ AVForm::AVForm() :
     connect(bodyUI->outDevCombobox, qcbxIndexChangedStr, this, &AVForm::onOutDevChanged);
     connect(bodyUI->videoDevCombobox, qcbxIndexChangedInt, this, &AVForm::onVideoDevChanged);
     connect(bodyUI->videoModescomboBox, qcbxIndexChangedInt, this, &AVForm::onVideoModesIndexChanged);
+    bodyUI->hwAccelCheckbox->setChecked(Settings::getInstance().getCamVideoHwAccel());
+    connect(bodyUI->hwAccelCheckbox, &QCheckBox::toggled, this, &AVForm::onHwAccelToggled);
     connect(bodyUI->rescanButton, &QPushButton::clicked, this, [=]()
     {
         getAudioInDevices();
         getAudioOutDevices();
-        getVideoDevices();
+        CameraDiscovery::getInstance().refresh();
     });
+    connect(&CameraDiscovery::getInstance(), &CameraDiscovery::devicesChanged,
+            this, &AVForm::onVideoDevicesChanged);
 
     bodyUI->playbackSlider->setTracking(false);
     bodyUI->playbackSlider->installEventFilter(this);
@@ -84,6 +89,17 @@ AVForm::AVForm() :
     connect(bodyUI->microphoneSlider, &QSlider::valueChanged,
             this, &AVForm::onMicrophoneValueChanged);
 
+    for (int duration : Audio::validFrameDurations())
+        bodyUI->frameDurationCombobox->addItem(tr("%1 ms").arg(duration), duration);
+    int frameDurationIndex = bodyUI->frameDurationCombobox->findData(Settings::getInstance().getAudioFrameDuration());
+    if (frameDurationIndex < 0)
+        frameDurationIndex = bodyUI->frameDurationCombobox->findData(audio.frameDuration());
+    bodyUI->frameDurationCombobox->setCurrentIndex(frameDurationIndex);
+    connect(bodyUI->frameDurationCombobox, qcbxIndexChangedInt, this, &AVForm::onFrameDurationChanged);
+
+    bodyUI->realtimeThreadsCheckbox->setChecked(Settings::getInstance().getRealtimeThreads());
+    connect(bodyUI->realtimeThreadsCheckbox, &QCheckBox::toggled, this, &AVForm::onRealtimeThreadsToggled);
+
     for (QComboBox* cb : findChildren<QComboBox*>())
     {
         cb->installEventFilter(this);
@@ -123,7 +139,9 @@ void AVForm::showEvent(QShowEvent* event)
     getAudioOutDevices();
     getAudioInDevices();
     createVideoSurface();
+    // show what we know right away, the scan updates it when it's done
     getVideoDevices();
+    CameraDiscovery::getInstance().refresh();
 
     if (!subscribedToAudioIn) {
         // TODO: this should not be done in show/hide events
@@ -142,14 +160,17 @@ void AVForm::onVideoModesIndexChanged(int index)
         return;
     }
     int devIndex = bodyUI->videoDevCombobox->currentIndex();
-    if (devIndex<0 || devIndex>=videoModes.size())
+    if (devIndex<0 || devIndex>=videoDeviceList.size())
     {
         qWarning() << "Invalid device index";
         return;
     }
     QString devName = videoDeviceList[devIndex].first;
     VideoMode mode = videoModes[index];
-    Settings::getInstance().setCamVideoRes(QSize(mode.width, mode.height));
+    if (CameraDevice::isScreen(devName))
+        Settings::getInstance().setScreenRegion(QRect(mode.x, mode.y, mode.width, mode.height));
+    else
+        Settings::getInstance().setCamVideoRes(QSize(mode.width, mode.height));
     Settings::getInstance().setCamVideoFPS(mode.FPS);
     camera.open(devName, mode);
 }
@@ -162,7 +183,10 @@ void AVForm::updateVideoModes(int curIndex)
         return;
     }
     QString devName = videoDeviceList[curIndex].first;
-    videoModes = CameraDevice::getVideoModes(devName);
+    if (CameraDevice::isScreen(devName))
+        return updateScreenModes(devName);
+
+    videoModes = CameraDiscovery::getInstance().getVideoModes(devName);
     std::sort(videoModes.begin(), videoModes.end(),
         [](const VideoMode& a, const VideoMode& b)
             {return a.width!=b.width ? a.width>b.width :
@@ -296,6 +320,44 @@ void AVForm::updateVideoModes(int curIndex)
     }
 }
 
+/**
+ * @brief Lists the screens to share, and the frame rates to share them at.
+ */
+void AVForm::updateScreenModes(const QString& devName)
+{
+    videoModes = CameraDiscovery::getInstance().getVideoModes(devName);
+    QRect prefRegion = Settings::getInstance().getScreenRegion();
+    unsigned short prefFPS = Settings::getInstance().getCamVideoFPS();
+
+    bool previouslyBlocked = bodyUI->videoModescomboBox->blockSignals(true);
+    bodyUI->videoModescomboBox->clear();
+    int prefIndex = 0;
+    for (int i = 0; i < videoModes.size(); ++i)
+    {
+        const VideoMode& mode = videoModes[i];
+        bodyUI->videoModescomboBox->addItem(tr("%1x%2 at %3,%4, %5 fps", "Screen sharing area and frame rate")
+                                            .arg(mode.width).arg(mode.height)
+                                            .arg(mode.x).arg(mode.y).arg(mode.FPS));
+
+        if (QRect(mode.x, mode.y, mode.width, mode.height) == prefRegion && mode.FPS == prefFPS)
+            prefIndex = i;
+    }
+
+    if (videoModes.isEmpty())
+        bodyUI->videoModescomboBox->addItem(tr("Default resolution"));
+    bodyUI->videoModescomboBox->blockSignals(previouslyBlocked);
+
+    if (videoModes.isEmpty())
+    {
+        camera.open(devName);
+        return;
+    }
+
+    // force the signal, the index may not have changed but the device did
+    bodyUI->videoModescomboBox->setCurrentIndex(-1);
+    bodyUI->videoModescomboBox->setCurrentIndex(prefIndex);
+}
+
 void AVForm::onVideoDevChanged(int index)
 {
     if (index<0 || index>=videoDeviceList.size())
@@ -314,11 +376,28 @@ void AVForm::onVideoDevChanged(int index)
         Core::getInstance()->getAv()->sendNoVideo();
 }
 
+void AVForm::onHwAccelToggled(bool hwAccel)
+{
+    Settings::getInstance().setCamVideoHwAccel(hwAccel);
+    camera.reopen();
+}
+
+void AVForm::onVideoDevicesChanged()
+{
+    // the camera isn't ours to open while we're hidden
+    if (isVisible())
+        getVideoDevices();
+}
+
 void AVForm::getVideoDevices()
 {
+    const CameraDiscovery& discovery = CameraDiscovery::getInstance();
+    if (!discovery.isReady())
+        return;
+
     QString settingsInDev = Settings::getInstance().getVideoDev();
     int videoDevIndex = 0;
-    videoDeviceList = CameraDevice::getDeviceList();
+    videoDeviceList = discovery.getDeviceList();
     //prevent currentIndexChanged to be fired while adding items
     bodyUI->videoDevCombobox->blockSignals(true);
     bodyUI->videoDevCombobox->clear();
@@ -412,6 +491,18 @@ void AVForm::onFilterAudioToggled(bool filterAudio)
     Settings::getInstance().setFilterAudio(filterAudio);
 }
 
+void AVForm::onFrameDurationChanged(int index)
+{
+    int duration = bodyUI->frameDurationCombobox->itemData(index).toInt();
+    if (Audio::getInstance().setFrameDuration(duration))
+        Settings::getInstance().setAudioFrameDuration(duration);
+}
+
+void AVForm::onRealtimeThreadsToggled(bool enabled)
+{
+    Settings::getInstance().setRealtimeThreads(enabled);
+}
+
 void AVForm::onPlaybackValueChanged(int value)
 {
     Settings::getInstance().setOutVolume(value);
@@ -472,6 +563,10 @@ bool AVForm::eventFilter(QObject *o, QEvent *e)
 void AVForm::retranslateUi()
 {
     bodyUI->retranslateUi(this);
+
+    const QVector<int> durations = Audio::validFrameDurations();
+    for (int i = 0; i < bodyUI->frameDurationCombobox->count() && i < durations.size(); ++i)
+        bodyUI->frameDurationCombobox->setItemText(i, tr("%1 ms").arg(durations[i]));
 }
 
 void AVForm::on_btnPlayTestSound_clicked(bool checked)
@@ -57,17 +57,22 @@ private slots:
     void onInDevChanged(QString deviceDescriptor);
     void onOutDevChanged(QString deviceDescriptor);
     void onFilterAudioToggled(bool filterAudio);
+    void onFrameDurationChanged(int index);
+    void onRealtimeThreadsToggled(bool enabled);
     void onPlaybackValueChanged(int value);
     void onMicrophoneValueChanged(int value);
 
     // camera
     void onVideoDevChanged(int index);
     void onVideoModesIndexChanged(int index);
+    void onHwAccelToggled(bool hwAccel);
+    void onVideoDevicesChanged();
 
     void on_btnPlayTestSound_clicked(bool checked);
 
 protected:
     void updateVideoModes(int curIndex);
+    void updateScreenModes(const QString& devName);
 
 private:
     bool eventFilter(QObject *o, QEvent *e) final override;
@@ -41,6 +41,8 @@ PrivacyForm::PrivacyForm() :
 
     connect(bodyUI->cbTypingNotification, SIGNAL(stateChanged(int)), this, SLOT(onTypingNotificationEnabledUpdated()));
     connect(bodyUI->cbKeepHistory, SIGNAL(stateChanged(int)), this, SLOT(onEnableLoggingUpdated()));
+    connect(bodyUI->historyMaxAgeSpinBox, SIGNAL(editingFinished()), this, SLOT(onHistoryRetentionUpdated()));
+    connect(bodyUI->historyMaxRowsSpinBox, SIGNAL(editingFinished()), this, SLOT(onHistoryRetentionUpdated()));
     connect(bodyUI->nospamLineEdit, SIGNAL(editingFinished()), this, SLOT(setNospam()));
     connect(bodyUI->randomNosapamButton, SIGNAL(clicked()), this, SLOT(generateRandomNospam()));
     connect(bodyUI->nospamLineEdit, SIGNAL(textChanged(QString)), this, SLOT(onNospamEdit()));
@@ -75,6 +77,23 @@ void PrivacyForm::onTypingNotificationEnabledUpdated()
     Settings::getInstance().setTypingNotification(bodyUI->cbTypingNotification->isChecked());
 }
 
+void PrivacyForm::onHistoryRetentionUpdated()
+{
+    Settings& s = Settings::getInstance();
+    int maxAge = bodyUI->historyMaxAgeSpinBox->value();
+    int maxRows = bodyUI->historyMaxRowsSpinBox->value();
+    if (maxAge == s.getHistoryMaxAge() && maxRows == s.getHistoryMaxRows())
+        return;
+
+    s.setHistoryMaxAge(maxAge);
+    s.setHistoryMaxRows(maxRows);
+    s.savePersonal();
+
+    History* history = Nexus::getProfile()->getHistory();
+    if (history)
+        history->enforceRetention();
+}
+
 void PrivacyForm::setNospam()
 {
     QString newNospam = bodyUI->nospamLineEdit->text();
@@ -90,6 +109,8 @@ void PrivacyForm::showEvent(QShowEvent*)
     bodyUI->nospamLineEdit->setText(Core::getInstance()->getSelfId().noSpam);
     bodyUI->cbTypingNotification->setChecked(Settings::getInstance().isTypingNotificationEnabled());
     bodyUI->cbKeepHistory->setChecked(Settings::getInstance().getEnableLogging());
+    bodyUI->historyMaxAgeSpinBox->setValue(Settings::getInstance().getHistoryMaxAge());
+    bodyUI->historyMaxRowsSpinBox->setValue(Settings::getInstance().getHistoryMaxRows());
 }
 
 void PrivacyForm::generateRandomNospam()
@@ -37,6 +37,7 @@ public:
 private slots:
     void onEnableLoggingUpdated();
     void onTypingNotificationEnabledUpdated();
+    void onHistoryRetentionUpdated();
     void setNospam();
     void generateRandomNospam();
     void onNospamEdit();
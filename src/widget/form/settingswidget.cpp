@@ -29,6 +29,8 @@
 #include "src/widget/contentlayout.h"
 #include <QTabWidget>
 #include <QLabel>
+#include <QDebug>
+#include <QElapsedTimer>
 #include <QWindow>
 
 SettingsWidget::SettingsWidget(QWidget* parent)
@@ -57,17 +59,8 @@ SettingsWidget::SettingsWidget(QWidget* parent)
 
     bodyLayout->addWidget(settingsWidgets);
 
-    GeneralForm* gfrm = new GeneralForm(this);
-    PrivacyForm* pfrm = new PrivacyForm;
-    AVForm* avfrm = new AVForm;
-    AdvancedForm *expfrm = new AdvancedForm;
-    AboutForm *abtfrm = new AboutForm;
-
-    cfgForms = {{ gfrm, pfrm, avfrm, expfrm, abtfrm }};
-    for (GenericForm* cfgForm : cfgForms)
-        settingsWidgets->addTab(cfgForm, cfgForm->getFormIcon(), cfgForm->getFormName());
-
-    connect(settingsWidgets, &QTabWidget::currentChanged, this, &SettingsWidget::onTabChanged);
+    // The pages are only created when the settings are first shown
+    cfgForms.fill(nullptr);
 
     Translator::registerHandler(std::bind(&SettingsWidget::retranslateUi, this), this);
 }
@@ -83,8 +76,34 @@ void SettingsWidget::setBodyHeadStyle(QString style)
     body->setStyle(QStyleFactory::create(style));
 }
 
+/**
+@brief Creates the settings pages, most sessions never open the settings so this isn't done on startup.
+*/
+void SettingsWidget::createForms()
+{
+    if (cfgForms[0])
+        return;
+
+    QElapsedTimer elapsed;
+    elapsed.start();
+
+    GeneralForm* gfrm = new GeneralForm(this);
+    PrivacyForm* pfrm = new PrivacyForm;
+    AVForm* avfrm = new AVForm;
+    AdvancedForm *expfrm = new AdvancedForm;
+    AboutForm *abtfrm = new AboutForm;
+
+    cfgForms = {{ gfrm, pfrm, avfrm, expfrm, abtfrm }};
+    for (GenericForm* cfgForm : cfgForms)
+        settingsWidgets->addTab(cfgForm, cfgForm->getFormIcon(), cfgForm->getFormName());
+
+    connect(settingsWidgets, &QTabWidget::currentChanged, this, &SettingsWidget::onTabChanged);
+    qDebug() << "Created the settings forms in" << elapsed.elapsed() << "ms";
+}
+
 void SettingsWidget::showAbout()
 {
+    createForms();
     onTabChanged(settingsWidgets->count() - 1);
 }
 
@@ -101,6 +120,7 @@ bool SettingsWidget::isShown() const
 
 void SettingsWidget::show(ContentLayout* contentLayout)
 {
+    createForms();
     contentLayout->mainContent->layout()->addWidget(body);
     contentLayout->mainHead->layout()->addWidget(head);
     body->show();
@@ -118,6 +138,9 @@ void SettingsWidget::onTabChanged(int index)
 
 void SettingsWidget::retranslateUi()
 {
+    if (!cfgForms[0])
+        return;
+
     GenericForm* currentWidget = static_cast<GenericForm*>(settingsWidgets->currentWidget());
     nameLabel->setText(currentWidget->getFormName());
     for (size_t i=0; i<cfgForms.size(); i++)
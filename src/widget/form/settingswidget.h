@@ -57,6 +57,7 @@ private slots:
     void onTabChanged(int);
 
 private:
+    void createForms();
     void retranslateUi();
 
 private:
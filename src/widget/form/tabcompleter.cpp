@@ -27,15 +27,18 @@
 #include "src/core/core.h"
 #include "src/group.h"
 #include "src/widget/tool/chattextedit.h"
-#include <QRegExp>
 #include <QKeyEvent>
 
 const QString TabCompleter::nickSuffix = QString(": ");
 
 TabCompleter::TabCompleter(ChatTextEdit* msgEdit, Group* group)
     : QObject{msgEdit}, msgEdit{msgEdit}, group{group},
-      enabled{false}, lastCompletionLength{0}
+      enabled{false}, lastCompletionLength{0}, trie(1)
 {
+    for (const QString& name : group->getPeerList())
+        insertName(name);
+
+    connect(group, &Group::peerNamesChanged, this, &TabCompleter::onPeerNamesChanged);
 }
 
 /* from quassel/src/uisupport/multilineedit.h
@@ -53,20 +56,134 @@ void TabCompleter::buildCompletionList()
     completionMap.clear();
     nextCompletion = completionMap.begin();
 
-    // split the string on the given RE (not chars, nums or braces/brackets) and take the last section
-    QString tabAbbrev = msgEdit->toPlainText().left(msgEdit->textCursor().position())
-        .section(QRegExp("[^\\w\\d\\$:@--_\\[\\]{}|`^.\\\\]"), -1, -1);
-    // that section is then used as the completion regex
-    QRegExp regex(QString("^[-_\\[\\]{}|`^.\\\\]*").append(QRegExp::escape(tabAbbrev)), Qt::CaseInsensitive);
+    // take the nick characters right before the cursor (chars, nums or braces/brackets)
+    const QString text = msgEdit->toPlainText();
+    const int end = msgEdit->textCursor().position();
+    int begin = end;
+    while (begin > 0 && isNickChar(text[begin - 1]))
+        --begin;
+
+    lastCompletionLength = end - begin;
+
+    // that section is then looked up in the trie, ignoring the punctuation names may start with
+    const QString tabAbbrev = text.mid(begin, end - begin);
+    int node = findNode(tabAbbrev, skipLeadingPunctuation(tabAbbrev, 0));
+    if (node < 0)
+        return;
 
-    for (auto name : group->getPeerList())
+    QStringList names;
+    collectNames(node, names);
+
+    const QString selfName = Core::getInstance()->getUsername().toLower();
+    for (const QString& name : names)
     {
-        if (regex.indexIn(name) > -1)
-            completionMap[name.toLower()] = name;
+        QString lowerName = name.toLower();
+        completionMap[SortableString(lowerName, lowerName == selfName)] = name;
     }
 
     nextCompletion = completionMap.begin();
-    lastCompletionLength = tabAbbrev.length();
+}
+
+void TabCompleter::onPeerNamesChanged(const QStringList& removed, const QStringList& added)
+{
+    for (const QString& name : removed)
+        removeName(name);
+
+    for (const QString& name : added)
+        insertName(name);
+}
+
+void TabCompleter::insertName(const QString& name)
+{
+    if (name.isEmpty())
+        return;
+
+    int node = 0;
+    ++trie[node].count;
+    for (int i = skipLeadingPunctuation(name, 0); i < name.size(); ++i)
+    {
+        ushort c = name[i].toCaseFolded().unicode();
+        int next = child(node, c);
+        if (next < 0)
+        {
+            next = trie.size();
+            trie[node].children.push_back({c, next});
+            trie.emplace_back();
+        }
+
+        node = next;
+        ++trie[node].count;
+    }
+
+    trie[node].names.append(name);
+}
+
+/**
+@brief Removes one peer's name, nodes are kept for the next peer who uses them.
+*/
+void TabCompleter::removeName(const QString& name)
+{
+    const int begin = skipLeadingPunctuation(name, 0);
+    int last = findNode(name, begin);
+    if (last < 0 || !trie[last].names.removeOne(name))
+        return;
+
+    int node = 0;
+    --trie[node].count;
+    for (int i = begin; i < name.size(); ++i)
+    {
+        node = child(node, name[i].toCaseFolded().unicode());
+        --trie[node].count;
+    }
+}
+
+/**
+@brief Walks the trie along prefix, starting at its begin index.
+@return The node spelling the prefix, or -1 if no name starts with it.
+*/
+int TabCompleter::findNode(const QString& prefix, int begin) const
+{
+    int node = 0;
+    for (int i = begin; i < prefix.size() && node >= 0; ++i)
+        node = child(node, prefix[i].toCaseFolded().unicode());
+
+    return node;
+}
+
+int TabCompleter::child(int node, ushort c) const
+{
+    for (const std::pair<ushort, int>& child : trie[node].children)
+    {
+        if (child.first == c)
+            return child.second;
+    }
+
+    return -1;
+}
+
+void TabCompleter::collectNames(int node, QStringList& names) const
+{
+    names.append(trie[node].names);
+    for (const std::pair<ushort, int>& child : trie[node].children)
+    {
+        if (trie[child.second].count > 0)
+            collectNames(child.second, names);
+    }
+}
+
+int TabCompleter::skipLeadingPunctuation(const QString& text, int begin)
+{
+    static const QString punctuation = QStringLiteral("-_[]{}|`^.\\");
+    while (begin < text.size() && punctuation.contains(text[begin]))
+        ++begin;
+
+    return begin;
+}
+
+bool TabCompleter::isNickChar(QChar c)
+{
+    static const QString symbols = QStringLiteral("$:@-_[]{}|`^.\\");
+    return c.isLetterOrNumber() || c.isMark() || symbols.contains(c);
 }
 
 
@@ -119,10 +236,9 @@ void TabCompleter::reset()
 // this determines the sort order
 bool TabCompleter::SortableString::operator<(const SortableString &other) const
 {
-    QString name = Core::getInstance()->getUsername();
-    if (this->contents == name)
+    if (this->isSelf)
         return false;
-    else if (other.contents == name)
+    else if (other.isSelf)
         return true;
 
 /*  QDateTime thisTime = thisUser->lastChannelActivity(_currentBufferId);
@@ -29,6 +29,8 @@
 #include <QString>
 #include <QMap>
 #include <QObject> // I'm really confused why I need this
+#include <QStringList>
+#include <vector>
 
 class ChatTextEdit;
 class Group;
@@ -43,11 +45,23 @@ public slots:
     void complete();
     void reset();
 
+private slots:
+    void onPeerNamesChanged(const QStringList& removed, const QStringList& added);
+
 private:
     struct SortableString {
-        inline SortableString(const QString &n) : contents{n} {}
+        inline SortableString(const QString &n, bool isSelf) : contents{n}, isSelf{isSelf} {}
         bool operator<(const SortableString &other) const;
         QString contents;
+        bool isSelf; ///< Our own name sorts last
+    };
+
+    /// Case-folded peer names, without the leading punctuation that is skipped when completing
+    struct TrieNode
+    {
+        std::vector<std::pair<ushort, int>> children; ///< Folded character and index of the child node
+        QStringList names; ///< Peer names ending here, once per peer that uses them
+        int count = 0; ///< Names in the whole subtree, to skip the branches of peers who left
     };
 
     ChatTextEdit* msgEdit;
@@ -59,7 +73,17 @@ private:
     QMap<SortableString, QString>::Iterator nextCompletion;
     int lastCompletionLength;
 
+    std::vector<TrieNode> trie;
+
     void buildCompletionList();
+    void insertName(const QString& name);
+    void removeName(const QString& name);
+    int findNode(const QString& prefix, int begin) const;
+    int child(int node, ushort c) const;
+    void collectNames(int node, QStringList& names) const;
+
+    static int skipLeadingPunctuation(const QString& text, int begin);
+    static bool isNickChar(QChar c);
 };
 
 
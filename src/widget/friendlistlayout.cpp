@@ -48,16 +48,15 @@ void FriendListLayout::init()
 
 void FriendListLayout::addFriendWidget(FriendWidget* w, Status s)
 {
-    friendOfflineLayout.removeSortedWidget(w);
-    friendOnlineLayout.removeSortedWidget(w);
+    GenericChatItemLayout& target = s == Status::Offline ? friendOfflineLayout : friendOnlineLayout;
+    GenericChatItemLayout& other = s == Status::Offline ? friendOnlineLayout : friendOfflineLayout;
 
-    if (s == Status::Offline)
-    {
-        friendOfflineLayout.addSortedWidget(w);
+    // Going from online to away or busy doesn't move the widget.
+    if (target.existsSortedWidget(w))
         return;
-    }
 
-    friendOnlineLayout.addSortedWidget(w);
+    other.removeSortedWidget(w);
+    target.addSortedWidget(w);
 }
 
 void FriendListLayout::removeFriendWidget(FriendWidget *widget, Status s)
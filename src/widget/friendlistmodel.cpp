@@ -0,0 +1,313 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "friendlistmodel.h"
+#include "friendwidget.h"
+#include "src/friend.h"
+#include "src/friendlist.h"
+#include "src/friendsearchindex.h"
+#include "src/persistence/settings.h"
+#include <QCollator>
+#include <QTimer>
+#include <algorithm>
+
+/**
+@class FriendListModel
+@brief Flat model of the friend list for FriendListView.
+
+Rows are the headers of circles or activity categories, each followed by its
+friends when expanded. Friends without a circle come first in name mode, as
+they do in the widget based list; online friends are sorted before offline
+ones and then by name.
+
+The model doesn't track individual changes. Every change invalidates it, and
+the rows are rebuilt from FriendList once control returns to the event loop,
+so adding a thousand friends at startup costs a single rebuild.
+*/
+
+FriendListModel::FriendListModel(FriendListWidget* parent)
+    : QAbstractListModel(parent)
+    , listWidget(parent)
+    , mode(FriendListWidget::Name)
+    , hideOnline(false)
+    , hideOffline(false)
+{
+    rebuildTimer = new QTimer(this);
+    rebuildTimer->setSingleShot(true);
+    rebuildTimer->setInterval(0);
+    connect(rebuildTimer, &QTimer::timeout, this, &FriendListModel::rebuild);
+}
+
+int FriendListModel::rowCount(const QModelIndex& parent) const
+{
+    if (parent.isValid())
+        return 0;
+
+    return rows.size();
+}
+
+QVariant FriendListModel::data(const QModelIndex& index, int role) const
+{
+    if (!index.isValid() || index.row() >= rows.size())
+        return QVariant();
+
+    const Row& row = rows[index.row()];
+
+    switch (role)
+    {
+    case Qt::DisplayRole:
+        return row.title;
+    case TypeRole:
+        return static_cast<int>(row.type);
+    case FriendIdRole:
+        return row.type == FriendRow ? row.id : -1;
+    case SectionIdRole:
+        return row.type == FriendRow ? -1 : row.id;
+    case ExpandedRole:
+        return row.expanded;
+    case CountRole:
+        if (row.type == FriendRow)
+            return QVariant();
+
+        return QString::number(row.online) + QStringLiteral(" / ") + QString::number(row.total);
+    default:
+        return QVariant();
+    }
+}
+
+void FriendListModel::setMode(FriendListWidget::Mode mode)
+{
+    this->mode = mode;
+    invalidate();
+}
+
+void FriendListModel::setFilter(const QString& searchString, bool hideOnline, bool hideOffline)
+{
+    this->searchString = searchString;
+    this->hideOnline = hideOnline;
+    this->hideOffline = hideOffline;
+    invalidate();
+}
+
+/**
+@brief Expands or collapses the circle or category of a header row.
+*/
+void FriendListModel::toggleExpanded(const QModelIndex& index)
+{
+    if (!index.isValid() || index.row() >= rows.size())
+        return;
+
+    const Row& row = rows[index.row()];
+
+    if (row.type == CircleRow)
+    {
+        Settings::getInstance().setCircleExpanded(row.id, !row.expanded);
+    }
+    else if (row.type == CategoryRow)
+    {
+        if (row.expanded)
+            collapsedCategories.insert(row.id);
+        else
+            collapsedCategories.remove(row.id);
+    }
+    else
+    {
+        return;
+    }
+
+    rebuild();
+}
+
+FriendWidget* FriendListModel::getFriendWidget(const QModelIndex& index) const
+{
+    if (!index.isValid() || index.row() >= rows.size() || rows[index.row()].type != FriendRow)
+        return nullptr;
+
+    Friend* contact = FriendList::findFriend(rows[index.row()].id);
+    return contact != nullptr ? contact->getFriendWidget() : nullptr;
+}
+
+/**
+@brief Finds the friend shown after or before another one, wrapping around.
+@param friendId Friend to start from, if it isn't shown the first or last friend is returned.
+@param forward Search downwards if true, upwards otherwise.
+@return Friend widget of the next shown friend, nullptr if none is shown.
+*/
+FriendWidget* FriendListModel::nextFriendWidget(int friendId, bool forward) const
+{
+    int count = rows.size();
+    int start = friendRows.value(friendId, forward ? -1 : count);
+
+    for (int i = 1; i <= count; ++i)
+    {
+        int row = forward ? start + i : start - i;
+        row = (row % count + count) % count;
+
+        if (rows[row].type == FriendRow)
+            return getFriendWidget(index(row));
+    }
+
+    return nullptr;
+}
+
+/**
+@brief Schedules a rebuild of the rows.
+*/
+void FriendListModel::invalidate()
+{
+    if (!rebuildTimer->isActive())
+        rebuildTimer->start();
+}
+
+void FriendListModel::rebuild()
+{
+    rebuildTimer->stop();
+
+    const Settings& s = Settings::getInstance();
+    int sectionCount;
+
+    if (mode == FriendListWidget::Name)
+        sectionCount = s.getCircleCount() + 1;
+    else
+        sectionCount = FriendListWidget::activityCategoryCount();
+
+    QVector<QVector<Entry>> sections(sectionCount);
+
+    if (!searchString.isEmpty())
+        searchMatches = FriendList::getSearchIndex().find(searchString);
+
+    for (Friend* contact : FriendList::getAllFriends())
+    {
+        FriendWidget* widget = contact->getFriendWidget();
+        if (widget == nullptr)
+            continue;
+
+        int section;
+        if (mode == FriendListWidget::Name)
+            section = s.getFriendCircleID(contact->getToxId()) + 1;
+        else
+            section = listWidget->activityCategory(contact);
+
+        if (section < 0 || section >= sectionCount)
+            section = 0;
+
+        sections[section].append({contact, widget->getName(), contact->getStatus() != Status::Offline});
+    }
+
+    QCollator collator;
+    collator.setNumericMode(true);
+
+    for (QVector<Entry>& entries : sections)
+    {
+        std::sort(entries.begin(), entries.end(), [&collator](const Entry& lhs, const Entry& rhs)
+        {
+            if (lhs.online != rhs.online)
+                return lhs.online;
+
+            int compareValue = collator.compare(lhs.name, rhs.name);
+            if (compareValue != 0)
+                return compareValue < 0;
+
+            return lhs.contact < rhs.contact; // Consistent ordering.
+        });
+    }
+
+    beginResetModel();
+    rows.clear();
+    friendRows.clear();
+
+    if (mode == FriendListWidget::Name)
+    {
+        appendSection(FriendRow, -1, QString(), true, sections[0]);
+
+        QVector<int> circles;
+        for (int i = 0; i < s.getCircleCount(); ++i)
+            circles.append(i);
+
+        std::sort(circles.begin(), circles.end(), [&collator, &s](int lhs, int rhs)
+        {
+            int compareValue = collator.compare(s.getCircleName(lhs), s.getCircleName(rhs));
+            return compareValue != 0 ? compareValue < 0 : lhs < rhs;
+        });
+
+        for (int id : circles)
+            appendSection(CircleRow, id, s.getCircleName(id), s.getCircleExpanded(id), sections[id + 1]);
+    }
+    else
+    {
+        for (int i = 0; i < sectionCount; ++i)
+        {
+            appendSection(CategoryRow, i, listWidget->activityCategoryName(i),
+                          !collapsedCategories.contains(i), sections[i]);
+        }
+    }
+
+    endResetModel();
+}
+
+bool FriendListModel::accepts(const Entry& entry) const
+{
+    if (entry.online ? hideOnline : hideOffline)
+        return false;
+
+    if (searchString.isEmpty())
+        return true;
+
+    int friendId = static_cast<int>(entry.contact->getFriendID());
+    return std::binary_search(searchMatches.begin(), searchMatches.end(), friendId);
+}
+
+/**
+@brief Appends a header row and the friends shown below it.
+@param type CircleRow or CategoryRow, FriendRow to append the friends without a header.
+*/
+void FriendListModel::appendSection(RowType type, int id, const QString& title, bool expanded, const QVector<Entry>& entries)
+{
+    QVector<const Entry*> shown;
+    int online = 0;
+
+    for (const Entry& entry : entries)
+    {
+        if (entry.online)
+            ++online;
+
+        if (accepts(entry))
+            shown.append(&entry);
+    }
+
+    if (type != FriendRow)
+    {
+        // Empty circles stay visible unless something is filtered, like CircleWidget does.
+        bool keepEmpty = type == CircleRow && searchString.isEmpty() && !(hideOnline && hideOffline);
+        if (shown.isEmpty() && !keepEmpty)
+            return;
+
+        rows.append({type, id, title, online, entries.size(), expanded});
+
+        if (!expanded)
+            return;
+    }
+
+    for (const Entry* entry : shown)
+    {
+        int friendId = static_cast<int>(entry->contact->getFriendID());
+        friendRows.insert(friendId, rows.size());
+        rows.append({FriendRow, friendId, entry->name, 0, 0, true});
+    }
+}
@@ -0,0 +1,105 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FRIENDLISTMODEL_H
+#define FRIENDLISTMODEL_H
+
+#include "friendlistwidget.h"
+#include <QAbstractListModel>
+#include <QHash>
+#include <QSet>
+#include <QVector>
+
+class Friend;
+class FriendWidget;
+class QTimer;
+
+class FriendListModel : public QAbstractListModel
+{
+    Q_OBJECT
+public:
+    enum RowType
+    {
+        FriendRow,
+        CircleRow,
+        CategoryRow
+    };
+
+    enum Role
+    {
+        TypeRole = Qt::UserRole, ///< RowType of the row
+        FriendIdRole,            ///< Friend id of a friend row
+        SectionIdRole,           ///< Circle id or activity category of a header row
+        ExpandedRole,            ///< Whether the friends of a header row are shown
+        CountRole                ///< "online / total" text of a header row
+    };
+
+    explicit FriendListModel(FriendListWidget* parent);
+
+    int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
+
+    void setMode(FriendListWidget::Mode mode);
+    void setFilter(const QString& searchString, bool hideOnline, bool hideOffline);
+    void toggleExpanded(const QModelIndex& index);
+
+    FriendWidget* getFriendWidget(const QModelIndex& index) const;
+    FriendWidget* nextFriendWidget(int friendId, bool forward) const;
+
+public slots:
+    void invalidate();
+
+private slots:
+    void rebuild();
+
+private:
+    struct Entry
+    {
+        Friend* contact;
+        QString name;
+        bool online;
+    };
+
+    struct Row
+    {
+        RowType type;
+        int id;
+        QString title;
+        int online;
+        int total;
+        bool expanded;
+    };
+
+    bool accepts(const Entry& entry) const;
+    void appendSection(RowType type, int id, const QString& title, bool expanded, const QVector<Entry>& entries);
+
+private:
+    FriendListWidget* listWidget;
+    FriendListWidget::Mode mode;
+    QString searchString;
+    bool hideOnline;
+    bool hideOffline;
+    QVector<int> searchMatches; ///< Sorted ids of the friends matching searchString
+    QSet<int> collapsedCategories;
+    QVector<Row> rows;
+    QHash<int, int> friendRows;
+    QTimer* rebuildTimer;
+};
+
+#endif // FRIENDLISTMODEL_H
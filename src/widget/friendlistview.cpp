@@ -0,0 +1,317 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "friendlistview.h"
+#include "friendlistmodel.h"
+#include "friendwidget.h"
+#include "style.h"
+#include "src/friend.h"
+#include "src/persistence/settings.h"
+#include <QContextMenuEvent>
+#include <QMouseEvent>
+#include <QPainter>
+#include <QPixmapCache>
+#include <QStyledItemDelegate>
+
+namespace
+{
+
+QPixmap cachedPixmap(const QString& path)
+{
+    QPixmap pixmap;
+
+    if (!QPixmapCache::find(path, &pixmap))
+    {
+        pixmap = QPixmap(path);
+        QPixmapCache::insert(path, pixmap);
+    }
+
+    return pixmap;
+}
+
+QString statusLightPath(Status status, bool event)
+{
+    QString name;
+
+    switch (status)
+    {
+    case Status::Online:
+        name = QStringLiteral("online");
+        break;
+    case Status::Away:
+        name = QStringLiteral("away");
+        break;
+    case Status::Busy:
+        name = QStringLiteral("busy");
+        break;
+    default:
+        name = QStringLiteral("offline");
+        break;
+    }
+
+    if (event)
+        name += QStringLiteral("_notification");
+
+    return QStringLiteral(":img/status/dot_") + name + QStringLiteral(".svg");
+}
+
+/**
+@brief Paints the rows of FriendListModel like FriendWidget and CategoryWidget look.
+*/
+class FriendListDelegate : public QStyledItemDelegate
+{
+public:
+    explicit FriendListDelegate(QObject* parent)
+        : QStyledItemDelegate(parent)
+        , compact(Settings::getInstance().getCompactLayout())
+    {
+    }
+
+    void setCompact(bool compact)
+    {
+        this->compact = compact;
+    }
+
+    QSize sizeHint(const QStyleOptionViewItem& option, const QModelIndex& index) const override
+    {
+        bool isFriend = index.data(FriendListModel::TypeRole).toInt() == FriendListModel::FriendRow;
+        return QSize(option.rect.width(), isFriend && !compact ? 55 : 25);
+    }
+
+    void paint(QPainter* painter, const QStyleOptionViewItem& option, const QModelIndex& index) const override
+    {
+        painter->save();
+        painter->setRenderHint(QPainter::SmoothPixmapTransform);
+
+        if (index.data(FriendListModel::TypeRole).toInt() == FriendListModel::FriendRow)
+            paintFriend(painter, option, index);
+        else
+            paintHeader(painter, option, index);
+
+        painter->restore();
+    }
+
+private:
+    void paintFriend(QPainter* painter, const QStyleOptionViewItem& option, const QModelIndex& index) const
+    {
+        const FriendListModel* model = static_cast<const FriendListModel*>(index.model());
+        FriendWidget* widget = model->getFriendWidget(index);
+        Friend* contact = widget != nullptr ? widget->getFriend() : nullptr;
+        if (contact == nullptr)
+            return;
+
+        bool active = widget->isActive();
+        QRect rect = option.rect;
+
+        if (active)
+            painter->fillRect(rect, Style::getColor(Style::White));
+        else if (option.state & QStyle::State_MouseOver)
+            painter->fillRect(rect, Style::getColor(Style::ThemeLight));
+
+        QColor nameColor = Style::getColor(active ? Style::DarkGrey : Style::White);
+        QColor statusColor = Style::getColor(active ? Style::MediumGrey : Style::LightGrey);
+
+        QPixmap light = cachedPixmap(statusLightPath(contact->getStatus(), contact->getEventFlag()));
+        int margin = compact ? 5 : 10;
+        QRect lightRect(QPoint(0, 0), light.size());
+        lightRect.moveCenter(QPoint(rect.right() - margin - light.width() / 2, rect.center().y()));
+        painter->drawPixmap(lightRect, light);
+
+        int avatarSize = compact ? 20 : 40;
+        QRect avatarRect(rect.left() + (compact ? 18 : 20), rect.center().y() - avatarSize / 2 + 1,
+                         avatarSize, avatarSize);
+        painter->drawPixmap(avatarRect, widget->getAvatar());
+
+        int textLeft = avatarRect.right() + (compact ? 6 : 11);
+        QRect textRect(textLeft, rect.top(), lightRect.left() - margin - textLeft, rect.height());
+        if (textRect.width() <= 0)
+            return;
+
+        QFont nameFont = Style::getFont(compact ? Style::Medium : Style::Big);
+        QFont statusFont = Style::getFont(compact ? Style::Small : Style::Medium);
+        QString name = index.data(Qt::DisplayRole).toString();
+        QString statusMessage = widget->getStatusMsg();
+
+        if (compact)
+        {
+            QFontMetrics nameMetrics(nameFont);
+            QString elidedName = nameMetrics.elidedText(name, Qt::ElideRight, textRect.width());
+            int nameWidth = nameMetrics.width(elidedName);
+
+            painter->setFont(nameFont);
+            painter->setPen(nameColor);
+            painter->drawText(textRect, Qt::AlignLeft | Qt::AlignVCenter, elidedName);
+
+            QRect statusRect = textRect.adjusted(nameWidth + 5, 0, 0, 0);
+            if (statusRect.width() > 0)
+            {
+                painter->setFont(statusFont);
+                painter->setPen(statusColor);
+                painter->drawText(statusRect, Qt::AlignLeft | Qt::AlignVCenter,
+                                  QFontMetrics(statusFont).elidedText(statusMessage, Qt::ElideRight, statusRect.width()));
+            }
+        }
+        else
+        {
+            QRect nameRect = textRect;
+            QRect statusRect = textRect;
+            nameRect.setBottom(rect.center().y());
+            statusRect.setTop(rect.center().y() + 1);
+
+            painter->setFont(nameFont);
+            painter->setPen(nameColor);
+            painter->drawText(nameRect, Qt::AlignLeft | Qt::AlignBottom,
+                              QFontMetrics(nameFont).elidedText(name, Qt::ElideRight, nameRect.width()));
+
+            painter->setFont(statusFont);
+            painter->setPen(statusColor);
+            painter->drawText(statusRect, Qt::AlignLeft | Qt::AlignTop,
+                              QFontMetrics(statusFont).elidedText(statusMessage, Qt::ElideRight, statusRect.width()));
+        }
+    }
+
+    void paintHeader(QPainter* painter, const QStyleOptionViewItem& option, const QModelIndex& index) const
+    {
+        QRect rect = option.rect;
+
+        if (option.state & QStyle::State_MouseOver)
+            painter->fillRect(rect, Style::getColor(Style::ThemeLight));
+
+        bool expanded = index.data(FriendListModel::ExpandedRole).toBool();
+        QPixmap arrow = cachedPixmap(expanded ? QStringLiteral(":/ui/chatArea/scrollBarDownArrow.svg")
+                                              : QStringLiteral(":/ui/chatArea/scrollBarRightArrow.svg"));
+        QRect arrowRect(QPoint(0, 0), arrow.size());
+        arrowRect.moveCenter(QPoint(rect.left() + (compact ? 18 : 10) + arrow.width() / 2, rect.center().y()));
+        painter->drawPixmap(arrowRect, arrow);
+
+        QFont font = Style::getFont(Style::Medium);
+        QFontMetrics metrics(font);
+        QString count = index.data(FriendListModel::CountRole).toString();
+        int countWidth = metrics.width(count);
+        QRect countRect(rect.right() - 5 - countWidth, rect.top(), countWidth, rect.height());
+
+        int textLeft = arrowRect.right() + (compact ? 6 : 11);
+        QRect nameRect(textLeft, rect.top(), countRect.left() - 5 - textLeft, rect.height());
+        QString name = metrics.elidedText(index.data(Qt::DisplayRole).toString(), Qt::ElideRight, nameRect.width());
+
+        painter->setFont(font);
+        painter->setPen(Style::getColor(Style::White));
+        painter->drawText(nameRect, Qt::AlignLeft | Qt::AlignVCenter, name);
+        painter->setPen(Style::getColor(Style::LightGrey));
+        painter->drawText(countRect, Qt::AlignRight | Qt::AlignVCenter, count);
+
+        int lineLeft = nameRect.left() + metrics.width(name) + 5;
+        if (lineLeft < countRect.left() - 5)
+            painter->drawLine(lineLeft, rect.center().y(), countRect.left() - 5, rect.center().y());
+    }
+
+private:
+    bool compact;
+};
+
+}
+
+/**
+@class FriendListView
+@brief Friend list which paints only the rows in view.
+
+Used by FriendListWidget instead of laying out a FriendWidget per friend when
+Settings::getVirtualFriendList() is set. The FriendWidgets still exist and keep
+their state, they are just never shown: clicks and context menus are forwarded
+to them.
+
+The view has no scroll bars of its own, it's as high as all its rows and
+scrolls inside the friend list's scroll area. Qt only paints what the scroll
+area exposes, so drawing stays proportional to the visible rows.
+*/
+
+FriendListView::FriendListView(FriendListModel* model, QWidget* parent)
+    : QListView(parent)
+    , friendModel(model)
+{
+    setItemDelegate(new FriendListDelegate(this));
+    setModel(model);
+
+    setFrameShape(QFrame::NoFrame);
+    setSelectionMode(QAbstractItemView::NoSelection);
+    setFocusPolicy(Qt::NoFocus);
+    setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+    setVerticalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+    setSizePolicy(QSizePolicy::Preferred, QSizePolicy::Fixed);
+    setMouseTracking(true);
+    viewport()->setAttribute(Qt::WA_Hover);
+    viewport()->setAutoFillBackground(false);
+    setAutoFillBackground(false);
+
+    connect(model, &QAbstractItemModel::modelReset, this, &FriendListView::updateHeight);
+    updateHeight();
+}
+
+void FriendListView::onCompactChanged(bool compact)
+{
+    static_cast<FriendListDelegate*>(itemDelegate())->setCompact(compact);
+    scheduleDelayedItemsLayout();
+    updateHeight();
+}
+
+void FriendListView::mouseReleaseEvent(QMouseEvent* event)
+{
+    QModelIndex index = indexAt(event->pos());
+
+    if (event->button() != Qt::LeftButton || !index.isValid())
+    {
+        QListView::mouseReleaseEvent(event);
+        return;
+    }
+
+    FriendWidget* widget = friendModel->getFriendWidget(index);
+
+    if (widget != nullptr)
+        emit widget->chatroomWidgetClicked(widget);
+    else
+        friendModel->toggleExpanded(index);
+}
+
+void FriendListView::contextMenuEvent(QContextMenuEvent* event)
+{
+    FriendWidget* widget = friendModel->getFriendWidget(indexAt(event->pos()));
+    if (widget == nullptr)
+        return;
+
+    QContextMenuEvent forwarded(event->reason(), widget->mapFromGlobal(event->globalPos()), event->globalPos());
+    widget->contextMenuEvent(&forwarded);
+
+    // The menu may have moved the friend to another circle.
+    friendModel->invalidate();
+}
+
+/**
+@brief Resizes the view to fit all rows, so the scroll area around it does the scrolling.
+*/
+void FriendListView::updateHeight()
+{
+    QStyleOptionViewItem option = viewOptions();
+    int height = 0;
+
+    for (int i = 0; i < friendModel->rowCount(); ++i)
+        height += itemDelegate()->sizeHint(option, friendModel->index(i)).height();
+
+    if (height != this->height())
+        setFixedHeight(height);
+}
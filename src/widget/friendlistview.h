@@ -0,0 +1,47 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FRIENDLISTVIEW_H
+#define FRIENDLISTVIEW_H
+
+#include <QListView>
+
+class FriendListModel;
+
+class FriendListView : public QListView
+{
+    Q_OBJECT
+public:
+    explicit FriendListView(FriendListModel* model, QWidget* parent = nullptr);
+
+public slots:
+    void onCompactChanged(bool compact);
+
+protected:
+    void mouseReleaseEvent(QMouseEvent* event) override;
+    void contextMenuEvent(QContextMenuEvent* event) override;
+
+private slots:
+    void updateHeight();
+
+private:
+    FriendListModel* friendModel;
+};
+
+#endif // FRIENDLISTVIEW_H
@@ -19,8 +19,11 @@
 
 #include "friendlistwidget.h"
 #include "friendlistlayout.h"
+#include "friendlistmodel.h"
+#include "friendlistview.h"
 #include "src/friend.h"
 #include "src/friendlist.h"
+#include "src/friendsearchindex.h"
 #include "src/persistence/settings.h"
 #include "friendwidget.h"
 #include "groupwidget.h"
@@ -31,7 +34,9 @@
 #include <QDragEnterEvent>
 #include <QDragLeaveEvent>
 #include <QTimer>
+#include <algorithm>
 #include <cassert>
+#include <iterator>
 
 enum Time : int
 {
@@ -140,6 +145,18 @@ FriendListWidget::FriendListWidget(Widget* parent, bool groupsOnTop)
     listLayout->removeItem(listLayout->getLayoutOnline());
     listLayout->removeItem(listLayout->getLayoutOffline());
 
+    if (Settings::getInstance().getVirtualFriendList())
+    {
+        // Friend widgets are kept as controllers, but never laid out or shown.
+        hiddenWidgets = new QWidget(this);
+        hiddenWidgets->hide();
+
+        friendModel = new FriendListModel(this);
+        friendView = new FriendListView(friendModel, this);
+        connect(this, &FriendListWidget::onCompactChanged, friendView, &FriendListView::onCompactChanged);
+        listLayout->addWidget(friendView);
+    }
+
     setMode(Name);
 
     onGroupchatPositionChanged(groupsOnTop);
@@ -182,6 +199,13 @@ void FriendListWidget::setMode(Mode mode)
         return;
 
     this->mode = mode;
+    searchValid = false;
+
+    if (friendModel != nullptr)
+    {
+        friendModel->setMode(mode);
+        return;
+    }
 
     if (mode == Name)
     {
@@ -229,74 +253,17 @@ void FriendListWidget::setMode(Mode mode)
     {
         activityLayout = new QVBoxLayout();
 
-        CategoryWidget* categoryToday = new CategoryWidget(this);
-        categoryToday->setObjectName("Todddd");
-        categoryToday->setName(tr("Today", "Category for sorting friends by activity"));
-        activityLayout->addWidget(categoryToday);
-
-        CategoryWidget* categoryYesterday = new CategoryWidget(this);
-        categoryYesterday->setName(tr("Yesterday", "Category for sorting friends by activity"));
-        activityLayout->addWidget(categoryYesterday);
-
-        CategoryWidget* categoryLastWeek = new CategoryWidget(this);
-        categoryLastWeek->setName(tr("Last 7 days", "Category for sorting friends by activity"));
-        activityLayout->addWidget(categoryLastWeek);
-
-        QDate currentDate = QDate::currentDate();
-        //if (last7DaysWasLastMonth())
+        for (int i = Today; i <= Never; ++i)
         {
-            CategoryWidget* categoryThisMonth = new CategoryWidget(this);
-            categoryThisMonth->setName(tr("This month", "Category for sorting friends by activity"));
-            activityLayout->addWidget(categoryThisMonth);
-            categoryThisMonth->setVisible(last7DaysWasLastMonth());
-
-            if (categoryThisMonth->isVisible())
-                currentDate = currentDate.addMonths(-1);
+            CategoryWidget* categoryWidget = new CategoryWidget(this);
+            categoryWidget->setName(activityCategoryName(i));
+            activityLayout->addWidget(categoryWidget);
         }
 
-        QLocale *ql = new QLocale(Settings::getInstance().getTranslation());
-
-        CategoryWidget* categoryLast1Month = new CategoryWidget(this);
-        categoryLast1Month->setName(ql->monthName(currentDate.month()));
-        activityLayout->addWidget(categoryLast1Month);
-
-        currentDate = currentDate.addMonths(-1);
-        CategoryWidget* categoryLast2Month = new CategoryWidget(this);
-        categoryLast2Month->setName(ql->monthName(currentDate.month()));
-        activityLayout->addWidget(categoryLast2Month);
-
-        currentDate = currentDate.addMonths(-1);
-        CategoryWidget* categoryLast3Month = new CategoryWidget(this);
-        categoryLast3Month->setName(ql->monthName(currentDate.month()));
-        activityLayout->addWidget(categoryLast3Month);
-
-        currentDate = currentDate.addMonths(-1);
-        CategoryWidget* categoryLast4Month = new CategoryWidget(this);
-        categoryLast4Month->setName(ql->monthName(currentDate.month()));
-        activityLayout->addWidget(categoryLast4Month);
-
-        currentDate = currentDate.addMonths(-1);
-        CategoryWidget* categoryLast5Month = new CategoryWidget(this);
-        categoryLast5Month->setName(ql->monthName(currentDate.month()));
-        activityLayout->addWidget(categoryLast5Month);
-
-        CategoryWidget* categoryOlder = new CategoryWidget(this);
-        categoryOlder->setName(tr("Older than 6 Months", "Category for sorting friends by activity"));
-        activityLayout->addWidget(categoryOlder);
-
-        CategoryWidget* categoryNever = new CategoryWidget(this);
-        categoryNever->setName(tr("Unknown", "Category for sorting friends by activity"));
-        activityLayout->addWidget(categoryNever);
-
-        delete ql;
-        ql = nullptr;
-
         QList<Friend*> friendList = FriendList::getAllFriends();
         for (Friend* contact : friendList)
         {
-            QDate activityDate = getDateFriend(contact);
-            Time time = getTime(activityDate);
-            CategoryWidget* categoryWidget = dynamic_cast<CategoryWidget*>(activityLayout->itemAt(time)->widget());
+            CategoryWidget* categoryWidget = dynamic_cast<CategoryWidget*>(activityLayout->itemAt(activityCategory(contact))->widget());
             categoryWidget->addFriendWidget(contact->getFriendWidget(), contact->getStatus());
         }
 
@@ -340,6 +307,14 @@ void FriendListWidget::addGroupWidget(GroupWidget* widget)
 
 void FriendListWidget::addFriendWidget(FriendWidget* w, Status s, int circleIndex)
 {
+    if (friendModel != nullptr)
+    {
+        w->setParent(hiddenWidgets);
+        connect(w, &GenericChatroomWidget::displayChanged, friendModel, &FriendListModel::invalidate, Qt::UniqueConnection);
+        friendModel->invalidate();
+        return;
+    }
+
     CircleWidget* circleWidget = CircleWidget::getFromID(circleIndex);
     if (circleWidget == nullptr)
         moveWidget(w, s, true);
@@ -349,12 +324,17 @@ void FriendListWidget::addFriendWidget(FriendWidget* w, Status s, int circleInde
 
 void FriendListWidget::removeFriendWidget(FriendWidget* w)
 {
+    if (friendModel != nullptr)
+    {
+        activityCategories.remove(w->friendId);
+        friendModel->invalidate();
+        return;
+    }
+
     Friend* contact = FriendList::findFriend(w->friendId);
     if (mode == Activity)
     {
-        QDate activityDate = getDateFriend(contact);
-        Time time = getTime(activityDate);
-        CategoryWidget* categoryWidget = dynamic_cast<CategoryWidget*>(activityLayout->itemAt(time)->widget());
+        CategoryWidget* categoryWidget = dynamic_cast<CategoryWidget*>(activityLayout->itemAt(activityCategory(contact))->widget());
         categoryWidget->removeFriendWidget(w, contact->getStatus());
         categoryWidget->setVisible(categoryWidget->hasChatrooms());
     }
@@ -368,6 +348,8 @@ void FriendListWidget::removeFriendWidget(FriendWidget* w)
             Widget::getInstance()->searchCircle(circleWidget);
         }
     }
+
+    activityCategories.remove(w->friendId);
 }
 
 void FriendListWidget::addCircleWidget(int id)
@@ -377,6 +359,19 @@ void FriendListWidget::addCircleWidget(int id)
 
 void FriendListWidget::addCircleWidget(FriendWidget* friendWidget)
 {
+    if (friendModel != nullptr)
+    {
+        int id = Settings::getInstance().addCircle();
+        if (friendWidget != nullptr)
+        {
+            Settings::getInstance().setFriendCircleID(FriendList::findFriend(friendWidget->friendId)->getToxId(), id);
+            Settings::getInstance().setCircleExpanded(id, true);
+        }
+
+        friendModel->invalidate();
+        return;
+    }
+
     CircleWidget* circleWidget = createCircleWidget();
     if (circleWidget != nullptr)
     {
@@ -409,14 +404,46 @@ void FriendListWidget::removeCircleWidget(CircleWidget* widget)
 void FriendListWidget::searchChatrooms(const QString &searchString, bool hideOnline, bool hideOffline, bool hideGroups)
 {
     groupLayout.search(searchString, hideGroups);
-    listLayout->searchChatrooms(searchString, hideOnline, hideOffline);
+
+    if (friendModel != nullptr)
+    {
+        friendModel->setFilter(searchString, hideOnline, hideOffline);
+        return;
+    }
+
+    FriendSearchIndex& index = FriendList::getSearchIndex();
+    QVector<int> matches = index.find(searchString);
+
+    // When only the text changed, only the friends entering or leaving the matches change.
+    // Status filters depend on statuses that may have changed since, so they take a full pass.
+    if (searchValid && searchRevision == index.getRevision() && !hideOnline && !hideOffline)
+    {
+        QVector<int> changed;
+        std::set_symmetric_difference(searchMatches.begin(), searchMatches.end(),
+                                      matches.begin(), matches.end(), std::back_inserter(changed));
+
+        for (int friendId : changed)
+            setFriendVisible(friendId, std::binary_search(matches.begin(), matches.end(), friendId), false, false);
+    }
+    else
+    {
+        for (Friend* contact : FriendList::getAllFriends())
+        {
+            int friendId = static_cast<int>(contact->getFriendID());
+            setFriendVisible(friendId, std::binary_search(matches.begin(), matches.end(), friendId), hideOnline, hideOffline);
+        }
+    }
+
+    searchMatches = matches;
+    searchRevision = index.getRevision();
+    searchValid = !hideOnline && !hideOffline;
 
     if (circleLayout != nullptr)
     {
         for (int i = 0; i != circleLayout->getLayout()->count(); ++i)
         {
             CircleWidget* circleWidget = static_cast<CircleWidget*>(circleLayout->getLayout()->itemAt(i)->widget());
-            circleWidget->search(searchString, true, hideOnline, hideOffline);
+            circleWidget->search(searchString, false, hideOnline, hideOffline);
         }
     }
     else if (activityLayout != nullptr)
@@ -424,12 +451,22 @@ void FriendListWidget::searchChatrooms(const QString &searchString, bool hideOnl
         for (int i = 0; i != activityLayout->count(); ++i)
         {
             CategoryWidget* categoryWidget = static_cast<CategoryWidget*>(activityLayout->itemAt(i)->widget());
-            categoryWidget->search(searchString, true, hideOnline, hideOffline);
+            categoryWidget->search(searchString, false, hideOnline, hideOffline);
             categoryWidget->setVisible(categoryWidget->hasChatrooms());
         }
     }
 }
 
+void FriendListWidget::setFriendVisible(int friendId, bool match, bool hideOnline, bool hideOffline)
+{
+    Friend* contact = FriendList::findFriend(friendId);
+    if (contact == nullptr)
+        return;
+
+    bool hide = contact->getStatus() == Status::Offline ? hideOffline : hideOnline;
+    contact->getFriendWidget()->setVisible(match && !hide);
+}
+
 void FriendListWidget::renameGroupWidget(GroupWidget* groupWidget, const QString &newName)
 {
     groupLayout.removeSortedWidget(groupWidget);
@@ -469,13 +506,24 @@ void FriendListWidget::cycleContacts(GenericChatroomWidget* activeChatroomWidget
     int index = -1;
     FriendWidget* friendWidget = dynamic_cast<FriendWidget*>(activeChatroomWidget);
 
+    if (friendModel != nullptr)
+    {
+        if (friendWidget == nullptr)
+            return;
+
+        FriendWidget* nextWidget = friendModel->nextFriendWidget(friendWidget->friendId, forward);
+        if (nextWidget != nullptr)
+            emit nextWidget->chatroomWidgetClicked(nextWidget);
+
+        return;
+    }
+
     if (mode == Activity)
     {
         if (friendWidget == nullptr)
             return;
 
-        QDate activityDate = getDateFriend(FriendList::findFriend(friendWidget->friendId));
-        index = getTime(activityDate);
+        index = activityCategory(FriendList::findFriend(friendWidget->friendId));
         CategoryWidget* categoryWidget = dynamic_cast<CategoryWidget*>(activityLayout->itemAt(index)->widget());
 
         if (categoryWidget == nullptr || categoryWidget->cycleContacts(friendWidget, forward))
@@ -632,6 +680,10 @@ void FriendListWidget::dropEvent(QDropEvent* event)
 
 void FriendListWidget::dayTimeout()
 {
+    // Yesterday's friends are now two days old, and the month names may have moved.
+    activityCategories.clear();
+    activityNames.clear();
+
     if (mode == Activity)
     {
         setMode(Name);
@@ -643,6 +695,16 @@ void FriendListWidget::dayTimeout()
 
 void FriendListWidget::moveWidget(FriendWidget* w, Status s, bool add)
 {
+    if (friendModel != nullptr)
+    {
+        const ToxId& id = FriendList::findFriend(w->friendId)->getToxId();
+        if (add && Settings::getInstance().getFriendCircleID(id) != -1)
+            Settings::getInstance().setFriendCircleID(id, -1);
+
+        friendModel->invalidate();
+        return;
+    }
+
     if (mode == Name)
     {
         int circleId = Settings::getInstance().getFriendCircleID(FriendList::findFriend(w->friendId)->getToxId());
@@ -662,23 +724,114 @@ void FriendListWidget::moveWidget(FriendWidget* w, Status s, bool add)
     else
     {
         Friend* contact = FriendList::findFriend(w->friendId);
-        QDate activityDate = getDateFriend(contact);
-        Time time = getTime(activityDate);
-        CategoryWidget* categoryWidget = dynamic_cast<CategoryWidget*>(activityLayout->itemAt(time)->widget());
+        CategoryWidget* categoryWidget = dynamic_cast<CategoryWidget*>(activityLayout->itemAt(activityCategory(contact))->widget());
         categoryWidget->addFriendWidget(contact->getFriendWidget(), contact->getStatus());
         categoryWidget->show();
     }
 }
 
-void FriendListWidget::updateActivityDate(const QDate& date)
+/**
+@brief Moves a friend to the category of its new activity date.
+
+Call after changing the date in the settings, the category is only looked up again here.
+*/
+void FriendListWidget::updateFriendActivity(Friend* contact)
 {
+    int friendId = static_cast<int>(contact->getFriendID());
+    int oldCategory = activityCategories.value(friendId, -1);
+    int newCategory = getTime(getDateFriend(contact));
+
+    if (oldCategory == newCategory)
+        return;
+
+    activityCategories.insert(friendId, newCategory);
+
+    if (friendModel != nullptr)
+    {
+        friendModel->invalidate();
+        return;
+    }
+
     if (mode != Activity)
         return;
 
-    CategoryWidget* categoryWidget = static_cast<CategoryWidget*>(activityLayout->itemAt(getTime(date))->widget());
-    categoryWidget->updateStatus();
+    FriendWidget* widget = contact->getFriendWidget();
+
+    if (oldCategory != -1)
+    {
+        CategoryWidget* oldWidget = static_cast<CategoryWidget*>(activityLayout->itemAt(oldCategory)->widget());
+        oldWidget->removeFriendWidget(widget, contact->getStatus());
+        oldWidget->setVisible(oldWidget->hasChatrooms());
+    }
+
+    CategoryWidget* newWidget = static_cast<CategoryWidget*>(activityLayout->itemAt(newCategory)->widget());
+    newWidget->addFriendWidget(widget, contact->getStatus());
+    newWidget->show();
+}
+
+/**
+@brief Activity category the friend is sorted into, by the date of the last chat.
+
+Categories are cached until the friend's activity changes or the day rolls over,
+so this doesn't read the settings once the friend was categorized.
+*/
+int FriendListWidget::activityCategory(Friend* contact)
+{
+    int friendId = static_cast<int>(contact->getFriendID());
+    auto it = activityCategories.find(friendId);
+
+    if (it == activityCategories.end())
+        it = activityCategories.insert(friendId, getTime(getDateFriend(contact)));
+
+    return *it;
+}
+
+int FriendListWidget::activityCategoryCount()
+{
+    return Never + 1;
+}
+
+QString FriendListWidget::activityCategoryName(int category)
+{
+    if (activityNames.isEmpty())
+    {
+        QLocale locale(Settings::getInstance().getTranslation());
+        QDate date = QDate::currentDate();
 
-    categoryWidget->setVisible(categoryWidget->hasChatrooms());
+        if (last7DaysWasLastMonth())
+            date = date.addMonths(-1);
+
+        for (int i = Today; i <= Never; ++i)
+        {
+            if (i >= Month1Ago && i <= Month5Ago)
+                activityNames.append(locale.monthName(date.addMonths(Month1Ago - i).month()));
+            else
+                activityNames.append(activityCategoryTitle(i));
+        }
+    }
+
+    return activityNames.value(category);
+}
+
+QString FriendListWidget::activityCategoryTitle(int category)
+{
+    switch (category)
+    {
+    case Today:
+        return tr("Today", "Category for sorting friends by activity");
+    case Yesterday:
+        return tr("Yesterday", "Category for sorting friends by activity");
+    case ThisWeek:
+        return tr("Last 7 days", "Category for sorting friends by activity");
+    case ThisMonth:
+        return tr("This month", "Category for sorting friends by activity");
+    case LongAgo:
+        return tr("Older than 6 Months", "Category for sorting friends by activity");
+    case Never:
+        return tr("Unknown", "Category for sorting friends by activity");
+    default:
+        return QString();
+    }
 }
 
 // update widget after add/delete/hide/show
@@ -694,6 +847,12 @@ CircleWidget* FriendListWidget::createCircleWidget(int id)
     if (id == -1)
         id = Settings::getInstance().addCircle();
 
+    if (friendModel != nullptr)
+    {
+        friendModel->invalidate();
+        return nullptr;
+    }
+
     // Stop, after it has been created. Code after this is for displaying.
     if (mode == Activity)
         return nullptr;
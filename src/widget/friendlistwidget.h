@@ -21,6 +21,9 @@
 #define FRIENDLISTWIDGET_H
 
 #include <QWidget>
+#include <QVector>
+#include <QHash>
+#include <QStringList>
 #include "src/core/corestructs.h"
 #include "genericchatitemlayout.h"
 
@@ -32,7 +35,10 @@ class FriendWidget;
 class GroupWidget;
 class CircleWidget;
 class FriendListLayout;
+class FriendListModel;
+class FriendListView;
 class GenericChatroomWidget;
+class Friend;
 
 class FriendListWidget : public QWidget
 {
@@ -59,9 +65,13 @@ public:
 
     void cycleContacts(GenericChatroomWidget* activeChatroomWidget, bool forward);
 
-    void updateActivityDate(const QDate& date);
+    void updateFriendActivity(Friend* contact);
     void reDraw();
 
+    int activityCategory(Friend* contact);
+    QString activityCategoryName(int category);
+    static int activityCategoryCount();
+
 signals:
     void onCompactChanged(bool compact);
 
@@ -80,6 +90,8 @@ private slots:
 
 private:
     CircleWidget* createCircleWidget(int id = -1);
+    void setFriendVisible(int friendId, bool match, bool hideOnline, bool hideOffline);
+    static QString activityCategoryTitle(int category);
     QLayout* nextLayout(QLayout* layout, bool forward) const;
 
     Mode mode;
@@ -88,6 +100,14 @@ private:
     GenericChatItemLayout* circleLayout = nullptr;
     GenericChatItemLayout groupLayout;
     QVBoxLayout* activityLayout = nullptr;
+    FriendListModel* friendModel = nullptr;
+    FriendListView* friendView = nullptr;
+    QWidget* hiddenWidgets = nullptr;
+    QHash<int, int> activityCategories; ///< Category of each friend by friend id
+    QStringList activityNames;
+    QVector<int> searchMatches;
+    quint64 searchRevision = 0;
+    bool searchValid = false;
     QTimer* dayTimer;
 };
 
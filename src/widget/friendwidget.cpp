@@ -22,6 +22,7 @@
 #include "circlewidget.h"
 #include "friendlistwidget.h"
 #include "src/friendlist.h"
+#include "src/friendsearchindex.h"
 #include "src/friend.h"
 #include "src/core/core.h"
 #include "form/chatform.h"
@@ -114,6 +115,10 @@ void FriendWidget::contextMenuEvent(QContextMenuEvent * event)
     else
         friendList = dynamic_cast<FriendListWidget*>(circleWidget->parentWidget());
 
+    // The virtual friend list keeps its friend widgets in a hidden container.
+    if (friendList == nullptr && circleWidget == nullptr && parentWidget() != nullptr)
+        friendList = dynamic_cast<FriendListWidget*>(parentWidget()->parentWidget());
+
     circleMenu = menu.addMenu(tr("Move to circle...", "Menu to move a friend into a different circle"));
 
     newCircleAction = circleMenu->addAction(tr("To new circle"));
@@ -272,7 +277,10 @@ void FriendWidget::setAsActiveChatroom()
     setActive(true);
 
     if (isDefaultAvatar)
+    {
         avatar->setPixmap(QPixmap(":img/contact_dark.svg"));
+        emit displayChanged();
+    }
 }
 
 void FriendWidget::setAsInactiveChatroom()
@@ -280,7 +288,10 @@ void FriendWidget::setAsInactiveChatroom()
     setActive(false);
 
     if (isDefaultAvatar)
+    {
         avatar->setPixmap(QPixmap(":img/contact.svg"));
+        emit displayChanged();
+    }
 }
 
 void FriendWidget::updateStatusLight()
@@ -318,6 +329,8 @@ void FriendWidget::updateStatusLight()
         statusPic.setMargin(3);
     else
         statusPic.setMargin(0);
+
+    emit displayChanged();
 }
 
 QString FriendWidget::getStatusString() const
@@ -343,6 +356,11 @@ Friend* FriendWidget::getFriend() const
     return FriendList::findFriend(friendId);
 }
 
+void FriendWidget::searchName(const QString &searchString, bool hideAll)
+{
+    setVisible(!hideAll && FriendList::getSearchIndex().matches(friendId, searchString));
+}
+
 void FriendWidget::search(const QString &searchString, bool hide)
 {
     searchName(searchString, hide);
@@ -354,7 +372,7 @@ void FriendWidget::search(const QString &searchString, bool hide)
 bool FriendWidget::chatFormIsSet(bool focus) const
 {
     Friend* f = FriendList::findFriend(friendId);
-    return ContentDialog::existsFriendWidget(friendId, focus) || f->getChatForm()->isVisible();
+    return ContentDialog::existsFriendWidget(friendId, focus) || (f->findChatForm() && f->findChatForm()->isVisible());
 }
 
 void FriendWidget::setChatForm(ContentLayout* contentLayout)
@@ -376,6 +394,7 @@ void FriendWidget::onAvatarChange(int FriendId, const QPixmap& pic)
 
     isDefaultAvatar = false;
     avatar->setPixmap(pic);
+    emit displayChanged();
 }
 
 void FriendWidget::onAvatarRemoved(int FriendId)
@@ -389,6 +408,8 @@ void FriendWidget::onAvatarRemoved(int FriendId)
         avatar->setPixmap(QPixmap(":/img/contact_dark.svg"));
     else
         avatar->setPixmap(QPixmap(":/img/contact.svg"));
+
+    emit displayChanged();
 }
 
 void FriendWidget::mousePressEvent(QMouseEvent *ev)
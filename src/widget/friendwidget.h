@@ -37,6 +37,7 @@ public:
     virtual void resetEventFlags() override;
     virtual QString getStatusString() const override;
     virtual Friend* getFriend() const override;
+    virtual void searchName(const QString &searchString, bool hideAll) override;
     void search(const QString &searchString, bool hide = false);
 
 signals:
@@ -18,6 +18,29 @@
 #include <QCollator>
 #include <cassert>
 
+namespace
+{
+
+/**
+ * @brief Collator shared by all sorted layouts.
+ *
+ * Setting up a collator is far more expensive than a comparison, and a single
+ * insertion compares log(n) times.
+ */
+const QCollator& nameCollator()
+{
+    static const QCollator collator = []()
+    {
+        QCollator c;
+        c.setNumericMode(true);
+        return c;
+    }();
+
+    return collator;
+}
+
+}
+
 // As this layout sorts widget, extra care must be taken when inserting widgets.
 // Prefer using the build in add and remove functions for modifying widgets.
 // Inserting widgets other ways would cause this layout to be unable to sort.
@@ -76,8 +99,9 @@ void GenericChatItemLayout::removeSortedWidget(GenericChatItemWidget* widget)
     GenericChatItemWidget* atMid = dynamic_cast<GenericChatItemWidget*>(layout->itemAt(index)->widget());
     assert(atMid != nullptr);
 
+    // The index is known, don't let removeWidget() look for it again.
     if (atMid == widget)
-        layout->removeWidget(widget);
+        delete layout->takeAt(index);
 }
 
 void GenericChatItemLayout::search(const QString &searchString, bool hideAll)
@@ -108,10 +132,7 @@ int GenericChatItemLayout::indexOfClosestSortedWidget(GenericChatItemWidget* wid
 
         bool lessThan = false;
 
-        QCollator collator;
-        collator.setNumericMode(true);
-
-        int compareValue = collator.compare(atMid->getName(), widget->getName());
+        int compareValue = nameCollator().compare(atMid->getName(), widget->getName());
 
         if (compareValue < 0)
             lessThan = true;
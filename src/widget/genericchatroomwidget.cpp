@@ -133,16 +133,20 @@ void GenericChatroomWidget::setActive(bool _active)
         statusMessageLabel->setForegroundRole(QPalette::WindowText);
         nameLabel->setForegroundRole(QPalette::WindowText);
     }
+
+    emit displayChanged();
 }
 
 void GenericChatroomWidget::setName(const QString &name)
 {
     nameLabel->setText(name);
+    emit displayChanged();
 }
 
 void GenericChatroomWidget::setStatusMsg(const QString &status)
 {
     statusMessageLabel->setText(status);
+    emit displayChanged();
 }
 
 QString GenericChatroomWidget::getStatusMsg() const
@@ -160,6 +164,11 @@ QString GenericChatroomWidget::getTitle() const
     return title;
 }
 
+QPixmap GenericChatroomWidget::getAvatar() const
+{
+    return avatar->getPixmap();
+}
+
 void GenericChatroomWidget::reloadTheme()
 {
     QPalette p;
@@ -55,6 +55,7 @@ public:
     void setStatusMsg(const QString& status);
     QString getStatusMsg() const;
     QString getTitle() const;
+    QPixmap getAvatar() const;
 
 	void reloadTheme();
 
@@ -63,6 +64,7 @@ public slots:
 
 signals:
     void chatroomWidgetClicked(GenericChatroomWidget* widget, bool group = false);
+    void displayChanged(); ///< Name, status, avatar or active state changed
 
 protected:
     virtual void mouseReleaseEvent(QMouseEvent* event) override;
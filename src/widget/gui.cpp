@@ -49,6 +49,9 @@ GUI& GUI::getInstance()
 
 void GUI::clearContacts()
 {
+    if (Nexus::isHeadless())
+        return;
+
     if (QThread::currentThread() == qApp->thread())
         getInstance()._clearContacts();
     else
@@ -57,6 +60,9 @@ void GUI::clearContacts()
 
 void GUI::setEnabled(bool state)
 {
+    if (Nexus::isHeadless())
+        return;
+
     if (QThread::currentThread() == qApp->thread())
     {
         getInstance()._setEnabled(state);
@@ -70,6 +76,9 @@ void GUI::setEnabled(bool state)
 
 void GUI::setWindowTitle(const QString& title)
 {
+    if (Nexus::isHeadless())
+        return;
+
     if (QThread::currentThread() == qApp->thread())
     {
         getInstance()._setWindowTitle(title);
@@ -83,6 +92,9 @@ void GUI::setWindowTitle(const QString& title)
 
 void GUI::reloadTheme()
 {
+    if (Nexus::isHeadless())
+        return;
+
     if (QThread::currentThread() == qApp->thread())
     {
         getInstance()._reloadTheme();
@@ -95,6 +107,9 @@ void GUI::reloadTheme()
 
 void GUI::showUpdateDownloadProgress()
 {
+    if (Nexus::isHeadless())
+        return;
+
     if (QThread::currentThread() == qApp->thread())
     {
         getInstance()._showUpdateDownloadProgress();
@@ -107,6 +122,12 @@ void GUI::showUpdateDownloadProgress()
 
 void GUI::showInfo(const QString& title, const QString& msg)
 {
+    if (Nexus::isHeadless())
+    {
+        qDebug() << title << ":" << msg;
+        return;
+    }
+
     if (QThread::currentThread() == qApp->thread())
     {
         getInstance()._showInfo(title, msg);
@@ -120,6 +141,12 @@ void GUI::showInfo(const QString& title, const QString& msg)
 
 void GUI::showWarning(const QString& title, const QString& msg)
 {
+    if (Nexus::isHeadless())
+    {
+        qWarning() << title << ":" << msg;
+        return;
+    }
+
     if (QThread::currentThread() == qApp->thread())
     {
         getInstance()._showWarning(title, msg);
@@ -133,6 +160,12 @@ void GUI::showWarning(const QString& title, const QString& msg)
 
 void GUI::showError(const QString& title, const QString& msg)
 {
+    if (Nexus::isHeadless())
+    {
+        qCritical() << title << ":" << msg;
+        return;
+    }
+
     if (QThread::currentThread() == qApp->thread())
     {
         // If the GUI hasn't started yet and we're on the main thread,
@@ -153,6 +186,12 @@ bool GUI::askQuestion(const QString& title, const QString& msg,
                       bool defaultAns, bool warning,
                       bool yesno)
 {
+    if (Nexus::isHeadless())
+    {
+        qWarning() << "Answering" << defaultAns << "to" << title << ":" << msg;
+        return defaultAns;
+    }
+
     if (QThread::currentThread() == qApp->thread())
     {
         return getInstance()._askQuestion(title, msg, defaultAns, warning, yesno);
@@ -173,6 +212,12 @@ bool GUI::askQuestion(const QString& title, const QString& msg,
                       const QString& button1, const QString& button2,
                       bool defaultAns, bool warning)
 {
+    if (Nexus::isHeadless())
+    {
+        qWarning() << "Answering" << (defaultAns ? button1 : button2) << "to" << title << ":" << msg;
+        return defaultAns;
+    }
+
     if (QThread::currentThread() == qApp->thread())
     {
         return getInstance()._askQuestion(title, msg, button1, button2, defaultAns, warning);
@@ -194,6 +239,13 @@ QString GUI::itemInputDialog(QWidget * parent, const QString & title,
                     Qt::WindowFlags flags,
                     Qt::InputMethodHints hints)
 {
+    if (Nexus::isHeadless())
+    {
+        if (ok)
+            *ok = false;
+        return QString();
+    }
+
     if (QThread::currentThread() == qApp->thread())
     {
         return getInstance()._itemInputDialog(parent, title, label, items, current, editable, ok, flags, hints);
@@ -213,6 +265,12 @@ QString GUI::itemInputDialog(QWidget * parent, const QString & title,
 
 QString GUI::passwordDialog(const QString& cancel, const QString& body)
 {
+    if (Nexus::isHeadless())
+    {
+        qWarning() << "Can't ask for a password without a GUI:" << body;
+        return QString();
+    }
+
     if (QThread::currentThread() == qApp->thread())
     {
         return getInstance()._passwordDialog(cancel, body);
@@ -28,6 +28,7 @@ class QWidget;
 /// Abstracts the GUI from the target backend (DesktopGUI, ...)
 /// All the functions exposed here are thread-safe
 /// Prefer calling this class to calling a GUI backend directly
+/// In headless mode messages are only logged, and questions get their default answer
 class GUI : public QObject
 {
     Q_OBJECT
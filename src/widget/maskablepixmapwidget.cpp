@@ -18,6 +18,7 @@
 */
 
 #include "maskablepixmapwidget.h"
+#include "src/chatlog/pixmapcache.h"
 #include <QPainter>
 
 MaskablePixmapWidget::MaskablePixmapWidget(QWidget *parent, QSize size, QString maskName)
@@ -30,7 +31,6 @@ MaskablePixmapWidget::MaskablePixmapWidget(QWidget *parent, QSize size, QString
 
 MaskablePixmapWidget::~MaskablePixmapWidget()
 {
-    delete renderTarget;
 }
 
 void MaskablePixmapWidget::setClickable(bool clickable)
@@ -48,48 +48,68 @@ void MaskablePixmapWidget::setPixmap(const QPixmap &pmap)
     if (!pmap.isNull())
     {
         unscaled = pmap;
-        pixmap = pmap.scaled(width() - 2, height() - 2, Qt::KeepAspectRatioByExpanding, Qt::SmoothTransformation);
+        updateRendered();
         update();
     }
 }
 
 QPixmap MaskablePixmapWidget::getPixmap() const
 {
-    return *renderTarget;
+    return rendered;
 }
 
 void MaskablePixmapWidget::setSize(QSize size)
 {
     setFixedSize(size);
-    delete renderTarget;
-    renderTarget = new QPixmap(size);
+    updateRendered();
+    update();
+}
 
-    QPixmap pmapMask = QPixmap(maskName);
-    if (!pmapMask.isNull())
-        mask = pmapMask.scaled(size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+void MaskablePixmapWidget::paintEvent(QPaintEvent *)
+{
+    // we were moved to a screen with another pixel ratio
+    if (rendered.devicePixelRatio() != devicePixelRatio())
+        updateRendered();
 
-    if (!unscaled.isNull())
-    {
-        pixmap = unscaled.scaled(width() - 2, height() - 2, Qt::KeepAspectRatioByExpanding, Qt::SmoothTransformation);
-        update();
-    }
+    QPainter painter(this);
+    painter.drawPixmap(0, 0, rendered);
 }
 
-void MaskablePixmapWidget::paintEvent(QPaintEvent *)
+/**
+@brief Scales the pixmap to our size and masks it, once per pixmap, size and pixel ratio.
+*/
+void MaskablePixmapWidget::updateRendered()
 {
-    renderTarget->fill(Qt::transparent);
+    const int pixelRatio = devicePixelRatio();
+    const QSize target = size() * pixelRatio;
+
+    // every avatar uses the same mask, the cache renders it once per size
+    if (maskName.endsWith(QStringLiteral(".svg")))
+        mask = PixmapCache::getInstance().getStretchedSvg(maskName, size(), pixelRatio);
+    else if (!maskName.isEmpty())
+        mask = QPixmap(maskName).scaled(target, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
 
-    QPoint offset((width() - pixmap.size().width())/2,(height() - pixmap.size().height())/2); // centering the pixmap
+    rendered = QPixmap(target);
+    rendered.fill(Qt::transparent);
 
-    QPainter painter(renderTarget);
-    painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
-    painter.drawPixmap(offset,pixmap);
-    painter.setCompositionMode(QPainter::CompositionMode_DestinationIn);
-    painter.drawPixmap(0,0,mask);
-    painter.end();
+    if (!unscaled.isNull())
+    {
+        QPixmap scaled = unscaled.scaled(target - QSize(2, 2) * pixelRatio, Qt::KeepAspectRatioByExpanding,
+                                         Qt::SmoothTransformation);
+        scaled.setDevicePixelRatio(1);
+        QPoint offset((target.width() - scaled.width()) / 2, (target.height() - scaled.height()) / 2); // centering the pixmap
+
+        QPainter painter(&rendered);
+        painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
+        painter.drawPixmap(offset, scaled);
+        if (!mask.isNull())
+        {
+            painter.setCompositionMode(QPainter::CompositionMode_DestinationIn);
+            painter.drawPixmap(rendered.rect(), mask, mask.rect());
+        }
+    }
 
-    painter.begin(this);
-    painter.drawPixmap(0,0,*renderTarget);
+    rendered.setDevicePixelRatio(pixelRatio);
 }
 
 void MaskablePixmapWidget::mousePressEvent(QMouseEvent*)
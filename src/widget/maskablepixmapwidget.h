@@ -42,9 +42,11 @@ protected:
     virtual void mousePressEvent(QMouseEvent *) final override;
 
 private:
-    QPixmap pixmap, mask, unscaled; // a lot of memory...
-    QPixmap* renderTarget = nullptr; // pointer to dynamically call the constructor
-    QSize size;
+    void updateRendered();
+
+private:
+    QPixmap mask, unscaled;
+    QPixmap rendered; ///< The masked and scaled pixmap, at our device pixel ratio, so painting is a single blit
     QString maskName;
     bool clickable;
 };
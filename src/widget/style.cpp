@@ -20,16 +20,16 @@
 #include "style.h"
 #include "src/persistence/settings.h"
 #include "src/widget/gui.h"
+#include "src/chatlog/pixmapcache.h"
 
 #include <QFile>
 #include <QDebug>
+#include <QHash>
 #include <QMap>
 #include <QRegularExpression>
 #include <QWidget>
 #include <QStyle>
 #include <QFontInfo>
-#include <QSvgRenderer>
-#include <QPainter>
 
 // helper functions
 QFont appFont(int pixelSize, int weight)
@@ -70,6 +70,8 @@ static QColor palette[] = {
 };
 
 static QMap<QString, QString> dict;
+// Resolved stylesheets by file name, cleared whenever the placeholders change
+static QHash<QString, QString> stylesheetCache;
 
 QStringList Style::getThemeColorNames()
 {
@@ -78,8 +80,17 @@ QStringList Style::getThemeColorNames()
 
 QList<QColor> Style::themeColorColors = {QColor(), QColor("#004aa4"), QColor("#97ba00"), QColor("#c23716"), QColor("#4617b5")};
 
+/**
+@brief Returns the stylesheet with its placeholders resolved.
+Every chat form and file transfer asks for the same few files, so each one is only read and resolved once
+per theme.
+*/
 QString Style::getStylesheet(const QString &filename)
 {
+    auto it = stylesheetCache.constFind(filename);
+    if (it != stylesheetCache.constEnd())
+        return it.value();
+
     QFile file(filename);
     if (!file.open(QFile::ReadOnly | QFile::Text))
     {
@@ -87,7 +98,9 @@ QString Style::getStylesheet(const QString &filename)
         return QString();
     }
 
-    return resolve(file.readAll());
+    QString qss = resolve(file.readAll());
+    stylesheetCache.insert(filename, qss);
+    return qss;
 }
 
 QColor Style::getColor(Style::ColorPalette entry)
@@ -147,12 +160,26 @@ QString Style::resolve(QString qss)
         };
     }
 
-    for (const QString& key : dict.keys())
+    // One pass over the text instead of a regex per placeholder, unknown placeholders are left alone
+    static const QRegularExpression placeholder(QStringLiteral("@[A-Za-z]+\\b"));
+    QString result;
+    result.reserve(qss.size());
+    int last = 0;
+    QRegularExpressionMatchIterator it = placeholder.globalMatch(qss);
+    while (it.hasNext())
     {
-        qss.replace(QRegularExpression(QString("%1\\b").arg(key)), dict[key]);
+        QRegularExpressionMatch match = it.next();
+        auto value = dict.constFind(match.captured());
+        if (value == dict.constEnd())
+            continue;
+
+        result += qss.midRef(last, match.capturedStart() - last);
+        result += value.value();
+        last = match.capturedEnd();
     }
 
-    return qss;
+    result += qss.midRef(last);
+    return result;
 }
 
 void Style::repolish(QWidget *w)
@@ -201,6 +228,7 @@ void Style::setThemeColor(const QColor &color)
     dict["@themeMediumDark"] = getColor(ThemeMediumDark).name();
     dict["@themeMedium"] = getColor(ThemeMedium).name();
     dict["@themeLight"] = getColor(ThemeLight).name();
+    stylesheetCache.clear();
 }
 
 void Style::applyTheme()
@@ -210,10 +238,5 @@ void Style::applyTheme()
 
 QPixmap Style::scaleSvgImage(const QString& path, uint32_t width, uint32_t height)
 {
-    QSvgRenderer render(path);
-    QPixmap pixmap(width, height);
-    pixmap.fill(QColor(0, 0, 0, 0));
-    QPainter painter(&pixmap);
-    render.render(&painter, pixmap.rect());
-    return pixmap;
+    return PixmapCache::getInstance().getStretchedSvg(path, QSize(width, height), 1.0);
 }
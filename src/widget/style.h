@@ -67,6 +67,7 @@ public:
     static void setThemeColor(int color);
     static void setThemeColor(const QColor &color); ///< Pass an invalid QColor to reset to defaults
     static void applyTheme(); ///< Reloads some CCS
+    /// Rendered once per path and size by the PixmapCache, in exactly width by height pixels
     static QPixmap scaleSvgImage(const QString& path, uint32_t width, uint32_t height);
 
     static QList<QColor> themeColorColors;
@@ -20,6 +20,7 @@
 #include "chattextedit.h"
 #include "src/widget/translator.h"
 #include <QKeyEvent>
+#include <QMimeData>
 
 ChatTextEdit::ChatTextEdit(QWidget *parent) :
     QTextEdit(parent)
@@ -63,6 +64,27 @@ void ChatTextEdit::keyPressEvent(QKeyEvent * event)
     }
 }
 
+/**
+@brief Inserts pastes and drops as plain text, the large ones are handed to largePasted.
+
+Laying out megabytes of text in the edit freezes the GUI, and only to send it away right after,
+so a large paste never makes it into the document.
+*/
+void ChatTextEdit::insertFromMimeData(const QMimeData* source)
+{
+    if (!source->hasText())
+    {
+        QTextEdit::insertFromMimeData(source);
+        return;
+    }
+
+    QString text = source->text();
+    if (text.length() > largePasteLength)
+        emit largePasted(text);
+    else
+        insertPlainText(text);
+}
+
 void ChatTextEdit::setLastMessage(QString lm)
 {
     lastMessage = lm;
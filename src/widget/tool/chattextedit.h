@@ -31,13 +31,19 @@ public:
     void setLastMessage(QString lm);
     void sendKeyEvent(QKeyEvent * event);
 
+    /// Pastes longer than this many characters aren't inserted, largePasted is emitted instead
+    static constexpr int largePasteLength = 64 * 1024;
+
 signals:
     void enterPressed();
     void tabPressed();
     void keyPressed();
+    /// The user pasted or dropped text too long to be laid out in the edit
+    void largePasted(const QString& text);
 
 protected:
     virtual void keyPressEvent(QKeyEvent * event) final override;
+    virtual void insertFromMimeData(const QMimeData* source) final override;
 
 private:
     void retranslateUi();
@@ -22,6 +22,7 @@
 #include <QLineEdit>
 #include <QKeyEvent>
 #include <QTextDocument> 
+#include <QRegularExpression>
 
 CroppingLabel::CroppingLabel(QWidget* parent)
     : QLabel(parent)
@@ -166,7 +167,8 @@ void CroppingLabel::minimizeMaximumWidth()
 void CroppingLabel::editingFinished()
 {
     hideTextEdit();
-    QString newText = textEdit->text().trimmed().remove(QRegExp("[\\t\\n\\v\\f\\r\\x0000]"));
+    static const QRegularExpression controlChars("[\\t\\n\\v\\f\\r\\x{0000}]");
+    QString newText = textEdit->text().trimmed().remove(controlChars);
 
     if (origText != newText)
         emit editFinished(textEdit->text());
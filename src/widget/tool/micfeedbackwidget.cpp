@@ -21,11 +21,17 @@
 #include "src/audio/audio.h"
 #include <QPainter>
 #include <QLinearGradient>
+#include <QTimer>
 
 MicFeedbackWidget::MicFeedbackWidget(QWidget *parent)
-    : QWidget(parent), mMeterListener(nullptr)
+    : QWidget(parent), current(0), meterTimer(new QTimer(this))
 {
     setFixedHeight(20);
+
+    // Audio meters whatever it captures for whoever opened the input, we only poll
+    // the levels at a rate the eye can follow
+    meterTimer->setInterval(1000 / 30);
+    connect(meterTimer, &QTimer::timeout, this, &MicFeedbackWidget::updateMeter);
 }
 
 void MicFeedbackWidget::paintEvent(QPaintEvent*)
@@ -60,26 +66,22 @@ void MicFeedbackWidget::paintEvent(QPaintEvent*)
 
 void MicFeedbackWidget::showEvent(QShowEvent*)
 {
-#if 0
-    mMeterListener = Audio::getInstance().createAudioMeterListener();
-    connect(mMeterListener, &AudioMeterListener::gainChanged,
-            this, &MicFeedbackWidget::onGainMetered);
-    mMeterListener->start();
-#endif
+    meterTimer->start();
 }
 
 void MicFeedbackWidget::hideEvent(QHideEvent*)
 {
-#if 0
-    mMeterListener->stop();
-#endif
+    meterTimer->stop();
+    current = 0;
 }
 
-void MicFeedbackWidget::onGainMetered(qreal value)
+void MicFeedbackWidget::updateMeter()
 {
-#if 0
-    current = value;
+    qreal peak, rms;
+    Audio::getInstance().inputLevels(peak, rms);
+    if (qFuzzyCompare(peak + 1, current + 1))
+        return;
+
+    current = peak;
     update();
-    mMeterListener->processed();
-#endif
 }
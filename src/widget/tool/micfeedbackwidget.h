@@ -22,7 +22,7 @@
 
 #include <QWidget>
 
-class AudioMeterListener;
+class QTimer;
 
 class MicFeedbackWidget : public QWidget
 {
@@ -36,11 +36,11 @@ protected:
     void hideEvent(QHideEvent* event) override;
 
 private slots:
-    void onGainMetered(qreal value);
+    void updateMeter();
 
 private:
     qreal current;
-    AudioMeterListener* mMeterListener;
+    QTimer* meterTimer;
 };
 
 #endif // MICFEEDBACKWIDGET_H
@@ -53,6 +53,7 @@
 #include "src/widget/form/settingswidget.h"
 #include "tool/removefrienddialog.h"
 #include "src/widget/tool/activatedialog.h"
+#include "src/trace.h"
 #include <cassert>
 #include <QMessageBox>
 #include <QDebug>
@@ -75,6 +76,9 @@
 #include <QProcess>
 #include <QSvgRenderer>
 #include <QWindow>
+#include <QElapsedTimer>
+#include <QFutureWatcher>
+#include <QRegularExpression>
 #include <tox/tox.h>
 
 #ifdef Q_OS_MAC
@@ -101,6 +105,10 @@ Widget::Widget(QWidget *parent)
       icon{nullptr},
       trayMenu{nullptr},
       ui(new Ui::MainWindow),
+      addFriendForm{nullptr},
+      groupInviteForm{nullptr},
+      profileForm{nullptr},
+      filesForm{nullptr},
       activeChatroomWidget{nullptr},
       eventFlag(false),
       eventIcon(false)
@@ -111,6 +119,8 @@ Widget::Widget(QWidget *parent)
 
 void Widget::init()
 {
+    QElapsedTimer initTime;
+    initTime.start();
     ui->setupUi(this);
 
     QIcon themeIcon = QIcon::fromTheme("qtox");
@@ -119,8 +129,6 @@ void Widget::init()
 
     timer = new QTimer();
     timer->start(1000);
-    offlineMsgTimer = new QTimer();
-    offlineMsgTimer->start(15000);
 
     icon_size = 15;
     statusOnline = new QAction(this);
@@ -146,7 +154,6 @@ void Widget::init()
     connect(actionQuit, &QAction::triggered, qApp, &QApplication::quit);
 
     layout()->setContentsMargins(0, 0, 0, 0);
-    ui->friendList->setStyleSheet(Style::resolve(Style::getStylesheet(":/ui/friendList/friendList.css")));
 
     profilePicture = new MaskablePixmapWidget(this, QSize(40, 40), ":/img/avatar_mask.svg");
     profilePicture->setPixmap(QPixmap(":/img/contact_dark.svg"));
@@ -193,10 +200,6 @@ void Widget::init()
 
     ui->searchContactFilterBox->setMenu(filterMenu);
 
-#ifndef Q_OS_MAC
-    ui->statusHead->setStyleSheet(Style::getStylesheet(":/ui/window/statusPanel.css"));
-#endif
-
     contactListWidget = new FriendListWidget(this, Settings::getInstance().getGroupchatPosition());
     ui->friendList->setWidget(contactListWidget);
     ui->friendList->setLayoutDirection(Qt::RightToLeft);
@@ -204,8 +207,6 @@ void Widget::init()
 
     ui->statusLabel->setEditable(true);
 
-    ui->statusPanel->setStyleSheet(Style::getStylesheet(":/ui/window/statusPanel.css"));
-
     QMenu *statusButtonMenu = new QMenu(ui->statusButton);
     statusButtonMenu->addAction(statusOnline);
     statusButtonMenu->addAction(statusAway);
@@ -225,20 +226,25 @@ void Widget::init()
     reloadTheme();
     updateIcons();
 
-    filesForm = new FilesForm();
-    addFriendForm = new AddFriendForm;
-    groupInviteForm = new GroupInviteForm;
-    profileForm = new ProfileForm();
+    // The other forms are created on first use, the settings pages only when they're first shown
     settingsWidget = new SettingsWidget();
 
     //connect logout tray menu action
-    connect(actionLogout, &QAction::triggered, profileForm, &ProfileForm::onLogoutClicked);
+    connect(actionLogout, &QAction::triggered, this, [this]()
+    {
+        getProfileForm()->onLogoutClicked();
+    });
 
     Core* core = Nexus::getCore();
-    connect(core, &Core::fileDownloadFinished, filesForm, &FilesForm::onFileDownloadComplete);
-    connect(core, &Core::fileUploadFinished, filesForm, &FilesForm::onFileUploadComplete);
+    connect(core, &Core::fileDownloadFinished, this, [this](const QString& path)
+    {
+        getFilesForm()->onFileDownloadComplete(path);
+    });
+    connect(core, &Core::fileUploadFinished, this, [this](const QString& path)
+    {
+        getFilesForm()->onFileUploadComplete(path);
+    });
     connect(settingsWidget, &SettingsWidget::setShowSystemTray, this, &Widget::onSetShowSystemTray);
-    connect(core, &Core::selfAvatarChanged, profileForm, &ProfileForm::onSelfAvatarLoaded);
     connect(ui->addButton, &QPushButton::clicked, this, &Widget::onAddClicked);
     connect(ui->groupButton, &QPushButton::clicked, this, &Widget::onGroupClicked);
     connect(ui->transferButton, &QPushButton::clicked, this, &Widget::onTransferClicked);
@@ -247,12 +253,9 @@ void Widget::init()
     connect(ui->nameLabel, &CroppingLabel::clicked, this, &Widget::showProfile);
     connect(ui->statusLabel, &CroppingLabel::editFinished, this, &Widget::onStatusMessageChanged);
     connect(ui->mainSplitter, &QSplitter::splitterMoved, this, &Widget::onSplitterMoved);
-    connect(addFriendForm, &AddFriendForm::friendRequested, this, &Widget::friendRequested);
-    connect(groupInviteForm, &GroupInviteForm::groupCreate, Core::getInstance(), &Core::createGroup);
     connect(timer, &QTimer::timeout, this, &Widget::onUserAwayCheck);
     connect(timer, &QTimer::timeout, this, &Widget::onEventIconTick);
     connect(timer, &QTimer::timeout, this, &Widget::onTryCreateTrayIcon);
-    connect(offlineMsgTimer, &QTimer::timeout, this, &Widget::processOfflineMsgs);
     connect(ui->searchContactText, &QLineEdit::textChanged, this, &Widget::searchContacts);
     connect(filterGroup, &QActionGroup::triggered, this, &Widget::searchContacts);
     connect(filterDisplayGroup, &QActionGroup::triggered, this, &Widget::changeDisplayMode);
@@ -386,12 +389,6 @@ void Widget::init()
     groupInvitesButton = nullptr;
     unreadGroupInvites = 0;
 
-    connect(addFriendForm, &AddFriendForm::friendRequested, this, &Widget::friendRequestsUpdate);
-    connect(addFriendForm, &AddFriendForm::friendRequestsSeen, this, &Widget::friendRequestsUpdate);
-    connect(addFriendForm, &AddFriendForm::friendRequestAccepted, this, &Widget::friendRequestAccepted);
-    connect(groupInviteForm, &GroupInviteForm::groupInvitesSeen, this, &Widget::groupInvitesClear);
-    connect(groupInviteForm, &GroupInviteForm::groupInviteAccepted, this, &Widget::onGroupInviteAccepted);
-
     retranslateUi();
     Translator::registerHandler(std::bind(&Widget::retranslateUi, this), this);
 
@@ -401,6 +398,8 @@ void Widget::init()
 #ifdef Q_OS_MAC
     Nexus::getInstance().updateWindows();
 #endif
+
+    qDebug() << "Main window initialized in" << initTime.elapsed() << "ms";
 }
 
 bool Widget::eventFilter(QObject *obj, QEvent *event)
@@ -512,7 +511,6 @@ Widget::~Widget()
     delete groupInviteForm;
     delete filesForm;
     delete timer;
-    delete offlineMsgTimer;
     delete contentLayout;
 
     FriendList::clear();
@@ -714,7 +712,8 @@ void Widget::setWindowTitle(const QString& title)
     {
         QString tmp = title;
         /// <[^>]*> Regexp to remove HTML tags, in case someone used them in title
-        QMainWindow::setWindowTitle(QApplication::applicationName() + QStringLiteral(" - ") + tmp.remove(QRegExp("<[^>]*>")));
+        static const QRegularExpression htmlTags("<[^>]*>");
+        QMainWindow::setWindowTitle(QApplication::applicationName() + QStringLiteral(" - ") + tmp.remove(htmlTags));
     }
 }
 
@@ -729,7 +728,7 @@ void Widget::onAddClicked()
 {
     if (Settings::getInstance().getSeparateWindow())
     {
-        if (!addFriendForm->isShown())
+        if (!getAddFriendForm()->isShown())
             addFriendForm->show(createContentDialog(AddDialog));
 
         setActiveToolMenuButton(Widget::None);
@@ -737,7 +736,7 @@ void Widget::onAddClicked()
     else
     {
         hideMainForms(nullptr);
-        addFriendForm->show(contentLayout);
+        getAddFriendForm()->show(contentLayout);
         setWindowTitle(fromDialogType(AddDialog));
         setActiveToolMenuButton(Widget::AddButton);
     }
@@ -747,7 +746,7 @@ void Widget::onGroupClicked()
 {
     if (Settings::getInstance().getSeparateWindow())
     {
-        if (!groupInviteForm->isShown())
+        if (!getGroupInviteForm()->isShown())
             groupInviteForm->show(createContentDialog(GroupDialog));
 
         setActiveToolMenuButton(Widget::None);
@@ -755,7 +754,7 @@ void Widget::onGroupClicked()
     else
     {
         hideMainForms(nullptr);
-        groupInviteForm->show(contentLayout);
+        getGroupInviteForm()->show(contentLayout);
         setWindowTitle(fromDialogType(GroupDialog));
         setActiveToolMenuButton(Widget::GroupButton);
     }
@@ -765,7 +764,7 @@ void Widget::onTransferClicked()
 {
     if (Settings::getInstance().getSeparateWindow())
     {
-        if (!filesForm->isShown())
+        if (!getFilesForm()->isShown())
             filesForm->show(createContentDialog(TransferDialog));
 
         setActiveToolMenuButton(Widget::None);
@@ -773,7 +772,7 @@ void Widget::onTransferClicked()
     else
     {
         hideMainForms(nullptr);
-        filesForm->show(contentLayout);
+        getFilesForm()->show(contentLayout);
         setWindowTitle(fromDialogType(TransferDialog));
         setActiveToolMenuButton(Widget::TransferButton);
     }
@@ -851,7 +850,7 @@ void Widget::showProfile() // onAvatarClicked, onUsernameClicked
 {
     if (Settings::getInstance().getSeparateWindow())
     {
-        if (!profileForm->isShown())
+        if (!getProfileForm()->isShown())
             profileForm->show(createContentDialog(ProfileDialog));
 
         setActiveToolMenuButton(Widget::None);
@@ -860,7 +859,7 @@ void Widget::showProfile() // onAvatarClicked, onUsernameClicked
     else
     {
         hideMainForms(nullptr);
-        profileForm->show(contentLayout);
+        getProfileForm()->show(contentLayout);
         setWindowTitle(fromDialogType(ProfileDialog));
         setActiveToolMenuButton(Widget::None);
     }
@@ -892,10 +891,10 @@ void Widget::setUsername(const QString& username)
         ui->nameLabel->setToolTip(Qt::convertFromPlainText(username, Qt::WhiteSpaceNormal)); // for overlength names
     }
 
+    static const QRegularExpression controlChars("[\\t\\n\\v\\f\\r\\x{0000}]");
     QString sanename = username;
-    sanename.remove(QRegExp("[\\t\\n\\v\\f\\r\\x0000]"));
-             nameMention = QRegExp("\\b" + QRegExp::escape(username) + "\\b", Qt::CaseInsensitive);
-    sanitizedNameMention = QRegExp("\\b" + QRegExp::escape(sanename) + "\\b", Qt::CaseInsensitive);
+    sanename.remove(controlChars);
+    nameMention.setKeywords({username, sanename});
 }
 
 void Widget::onStatusMessageChanged(const QString& newStatusMessage)
@@ -921,19 +920,41 @@ void Widget::setStatusMessage(const QString &statusMessage)
 void Widget::reloadHistory()
 {
     for (auto f : FriendList::getAllFriends())
-        f->getChatForm()->loadHistory(QDateTime::currentDateTime().addDays(-7), true);
+        if (ChatForm* chatForm = f->findChatForm())
+            chatForm->loadHistory(QDateTime::currentDateTime().addDays(-7));
 }
 
 void Widget::addFriend(int friendId, const QString &userId)
 {
-    ToxId userToxId = ToxId(userId);
-    Friend* newfriend = FriendList::addFriend(friendId, userToxId);
+    createFriend(friendId, userId, QString(), QString());
+}
 
-    QDate activityDate = Settings::getInstance().getFriendActivity(newfriend->getToxId());
-    QDate chatDate = newfriend->getChatForm()->getLatestDate();
+/**
+@brief Adds the whole friend list Core loaded at startup.
 
-    if (chatDate > activityDate && chatDate.isValid())
-        Settings::getInstance().setFriendActivity(newfriend->getToxId(), chatDate);
+Each friend gets its name before its widget goes in the list, so it's placed once
+instead of being moved again when the name arrives. Nothing is repainted until the end.
+*/
+void Widget::onFriendsLoaded(const QVector<FriendSnapshot>& friends)
+{
+    contactListWidget->setUpdatesEnabled(false);
+    for (const FriendSnapshot& snapshot : friends)
+        createFriend(snapshot.friendId, snapshot.userId, snapshot.name, snapshot.statusMessage);
+    contactListWidget->setUpdatesEnabled(true);
+    contactListWidget->reDraw();
+}
+
+/**
+@brief Creates a friend and its widgets, name and statusMessage are left alone if empty.
+*/
+Friend* Widget::createFriend(int friendId, const QString& userId, const QString& name, const QString& statusMessage)
+{
+    ToxId userToxId = ToxId(userId);
+    Friend* newfriend = FriendList::addFriend(friendId, userToxId);
+    if (!name.isEmpty())
+        onFriendUsernameChanged(friendId, name);
+    if (!statusMessage.isEmpty())
+        onFriendStatusMessageChanged(friendId, statusMessage);
 
     contactListWidget->addFriendWidget(newfriend->getFriendWidget(), Status::Offline, Settings::getInstance().getFriendCircleID(newfriend->getToxId()));
 
@@ -944,31 +965,85 @@ void Widget::addFriend(int friendId, const QString &userId)
     connect(newfriend->getFriendWidget(), SIGNAL(chatroomWidgetClicked(GenericChatroomWidget*, bool)), this, SLOT(onChatroomWidgetClicked(GenericChatroomWidget*, bool)));
     connect(newfriend->getFriendWidget(), SIGNAL(removeFriend(int)), this, SLOT(removeFriend(int)));
     connect(newfriend->getFriendWidget(), SIGNAL(copyFriendIdToClipboard(int)), this, SLOT(copyFriendIdToClipboard(int)));
-    connect(newfriend->getFriendWidget(), SIGNAL(chatroomWidgetClicked(GenericChatroomWidget*)), newfriend->getChatForm(), SLOT(focusInput()));
-    connect(newfriend->getChatForm(), &GenericChatForm::sendMessage, core, &Core::sendMessage);
-    connect(newfriend->getChatForm(), &GenericChatForm::sendAction, core, &Core::sendAction);
-    connect(newfriend->getChatForm(), &ChatForm::sendFile, core, &Core::sendFile);
-    connect(newfriend->getChatForm(), &ChatForm::aliasChanged, newfriend->getFriendWidget(), &FriendWidget::setAlias);
-    connect(core, &Core::fileReceiveRequested, newfriend->getChatForm(), &ChatForm::onFileRecvRequest);
-    connect(coreav, &CoreAV::avInvite, newfriend->getChatForm(), &ChatForm::onAvInvite, Qt::BlockingQueuedConnection);
-    connect(coreav, &CoreAV::avStart, newfriend->getChatForm(), &ChatForm::onAvStart, Qt::BlockingQueuedConnection);
-    connect(coreav, &CoreAV::avEnd, newfriend->getChatForm(), &ChatForm::onAvEnd, Qt::BlockingQueuedConnection);
-    connect(core, &Core::friendAvatarChanged, newfriend->getChatForm(), &ChatForm::onAvatarChange);
+    connect(newfriend->getFriendWidget(), &GenericChatroomWidget::chatroomWidgetClicked, newfriend, [newfriend]()
+    {
+        newfriend->getChatForm()->focusInput();
+    });
+    connect(newfriend, &Friend::chatFormCreated, this, [this, newfriend](ChatForm* chatForm)
+    {
+        connectChatForm(newfriend, chatForm);
+    });
     connect(core, &Core::friendAvatarChanged, newfriend->getFriendWidget(), &FriendWidget::onAvatarChange);
-    connect(core, &Core::friendAvatarRemoved, newfriend->getChatForm(), &ChatForm::onAvatarRemoved);
     connect(core, &Core::friendAvatarRemoved, newfriend->getFriendWidget(), &FriendWidget::onAvatarRemoved);
 
-    // Try to get the avatar from the cache
-    QPixmap avatar = Nexus::getProfile()->loadAvatar(userId);
-    if (!avatar.isNull())
+    // the chat form is created when it's needed, what needs one creates it
+    connect(core, &Core::fileReceiveRequested, newfriend, [newfriend](const ToxFile::Ptr& file)
     {
-        newfriend->getChatForm()->onAvatarChange(friendId, avatar);
-        newfriend->getFriendWidget()->onAvatarChange(friendId, avatar);
-    }
+        if (file->friendId == newfriend->getFriendID())
+            newfriend->getChatForm()->onFileRecvRequest(file);
+    });
+    connect(coreav, &CoreAV::avInvite, newfriend, [newfriend](uint32_t friendId, bool video)
+    {
+        if (friendId == newfriend->getFriendID())
+            newfriend->getChatForm()->onAvInvite(friendId, video);
+    }, Qt::BlockingQueuedConnection);
+    connect(coreav, &CoreAV::avStart, newfriend, [newfriend](uint32_t friendId, bool video)
+    {
+        if (friendId == newfriend->getFriendID())
+            newfriend->getChatForm()->onAvStart(friendId, video);
+    }, Qt::BlockingQueuedConnection);
+    connect(coreav, &CoreAV::avEnd, newfriend, [newfriend](uint32_t friendId)
+    {
+        if (ChatForm* chatForm = newfriend->findChatForm())
+            chatForm->onAvEnd(friendId);
+    }, Qt::BlockingQueuedConnection);
+
+    // Try to get the avatar from the cache, the placeholder stays until it's decrypted in the background
+    FriendWidget* friendWidget = newfriend->getFriendWidget();
+    QFutureWatcher<QImage>* avatarWatcher = new QFutureWatcher<QImage>(friendWidget);
+    connect(avatarWatcher, &QFutureWatcher<QImage>::finished, friendWidget, [=]()
+    {
+        QPixmap avatar = QPixmap::fromImage(avatarWatcher->result());
+        if (!avatar.isNull())
+        {
+            if (ChatForm* chatForm = newfriend->findChatForm())
+                chatForm->onAvatarChange(friendId, avatar);
+            friendWidget->onAvatarChange(friendId, avatar);
+        }
+        avatarWatcher->deleteLater();
+    });
+    avatarWatcher->setFuture(Nexus::getProfile()->loadAvatarAsync(userId));
 
     int filter = getFilterCriteria();
     newfriend->getFriendWidget()->search(ui->searchContactText->text(), filterOffline(filter));
 
+    return newfriend;
+}
+
+/**
+@brief Wires a friend's chat form when it's created, on first use.
+*/
+void Widget::connectChatForm(Friend* f, ChatForm* chatForm)
+{
+    Core* core = Nexus::getCore();
+    connect(chatForm, &GenericChatForm::sendMessage, core, &Core::sendMessage);
+    connect(chatForm, &GenericChatForm::sendAction, core, &Core::sendAction);
+    connect(chatForm, &ChatForm::sendFile, core, &Core::sendFile);
+    connect(chatForm, &ChatForm::aliasChanged, f->getFriendWidget(), &FriendWidget::setAlias);
+    connect(core, &Core::friendAvatarChanged, chatForm, &ChatForm::onAvatarChange);
+    connect(core, &Core::friendAvatarRemoved, chatForm, &ChatForm::onAvatarRemoved);
+
+    // the friend widget has the avatar already, but scaled down
+    const uint32_t friendId = f->getFriendID();
+    QFutureWatcher<QImage>* avatarWatcher = new QFutureWatcher<QImage>(chatForm);
+    connect(avatarWatcher, &QFutureWatcher<QImage>::finished, chatForm, [=]()
+    {
+        QPixmap avatar = QPixmap::fromImage(avatarWatcher->result());
+        if (!avatar.isNull())
+            chatForm->onAvatarChange(friendId, avatar);
+        avatarWatcher->deleteLater();
+    });
+    avatarWatcher->setFuture(Nexus::getProfile()->loadAvatarAsync(f->getToxId().publicKey));
 }
 
 void Widget::addFriendFailed(const QString&, const QString& errorInfo)
@@ -987,6 +1062,43 @@ void Widget::onFriendshipChanged(int friendId)
     updateFriendActivity(who);
 }
 
+/**
+@brief Hands a batch of Core's events to their handlers.
+
+Statuses and group peers go first, so the messages after them show up with the current
+names, typing goes last as a message usually ends it.
+*/
+void Widget::onCoreEvents(const CoreEvents& events)
+{
+    // A reconnect brings hundreds of statuses at once, move all widgets before painting.
+    if (!events.friendStatuses.isEmpty())
+    {
+        contactListWidget->setUpdatesEnabled(false);
+        for (const CoreEvents::FriendStatus& status : events.friendStatuses)
+            onFriendStatusChanged(status.friendId, status.status);
+        contactListWidget->setUpdatesEnabled(true);
+    }
+
+    // regenerating a peer list also picks up the new names, the peer number doesn't matter
+    for (int groupId : events.groupPeerLists)
+        onGroupNamelistChanged(groupId, 0, TOX_CHAT_CHANGE_PEER_ADD);
+
+    for (const QPair<int, int>& peer : events.groupPeerNames)
+    {
+        if (!events.groupPeerLists.contains(peer.first))
+            onGroupNamelistChanged(peer.first, peer.second, TOX_CHAT_CHANGE_PEER_NAME);
+    }
+
+    for (const CoreEvents::FriendMessage& message : events.friendMessages)
+        onFriendMessageReceived(message.friendId, message.message, message.isAction);
+
+    for (const CoreEvents::GroupMessage& message : events.groupMessages)
+        onGroupMessageReceived(message.groupId, message.peerId, message.message, message.isAction);
+
+    for (auto it = events.friendTyping.constBegin(); it != events.friendTyping.constEnd(); ++it)
+        onFriendTypingChanged(it.key(), it.value());
+}
+
 void Widget::onFriendStatusChanged(int friendId, Status status)
 {
     Friend* f = FriendList::findFriend(friendId);
@@ -994,6 +1106,7 @@ void Widget::onFriendStatusChanged(int friendId, Status status)
         return;
 
     bool isActualChange = f->getStatus() != status;
+    bool cameOnline = isActualChange && f->getStatus() == Status::Offline;
 
     if (isActualChange)
     {
@@ -1005,6 +1118,14 @@ void Widget::onFriendStatusChanged(int friendId, Status status)
 
     f->setStatus(status);
     f->getFriendWidget()->updateStatusLight();
+    if (cameOnline)
+    {
+        // the undelivered messages need the chat form's receipts, it's created only if there are some
+        Profile* profile = Nexus::getProfile();
+        if (f->findChatForm() || (profile->isHistoryEnabled()
+                                  && profile->getHistory()->hasPendingMessages(f->getToxId().publicKey)))
+            f->getChatForm()->sendPendingMessages();
+    }
     if(f->getFriendWidget()->isActive())
         setWindowTitle(f->getFriendWidget()->getTitle());
 
@@ -1021,20 +1142,16 @@ void Widget::onFriendStatusChanged(int friendId, Status status)
             fStatus = tr("busy", "contact status"); break;
         case Status::Offline:
             fStatus = tr("offline", "contact status");
-            f->getChatForm()->setFriendTyping(false); // Hide the "is typing" message when a friend goes offline
+            if (ChatForm* chatForm = f->findChatForm())
+                chatForm->setFriendTyping(false); // Hide the "is typing" message when a friend goes offline
             break;
         default:
             fStatus = tr("online", "contact status"); break;
         }
-        if (isActualChange)
-            f->getChatForm()->addSystemInfoMessage(tr("%1 is now %2", "e.g. \"Dubslow is now online\"").arg(f->getDisplayedName()).arg(fStatus),
+        if (isActualChange && f->findChatForm())
+            f->findChatForm()->addSystemInfoMessage(tr("%1 is now %2", "e.g. \"Dubslow is now online\"").arg(f->getDisplayedName()).arg(fStatus),
                                                    ChatMessage::INFO, QDateTime::currentDateTime());
     }
-
-    if (isActualChange && status != Status::Offline)
-    { // wait a little
-        QTimer::singleShot(250, f->getChatForm()->getOfflineMsgEngine(), SLOT(deliverOfflineMsgs()));
-    }
 }
 
 void Widget::onFriendStatusMessageChanged(int friendId, const QString& message)
@@ -1077,6 +1194,7 @@ void Widget::onFriendDisplayChanged(FriendWidget *friendWidget, Status s)
 
 void Widget::onChatroomWidgetClicked(GenericChatroomWidget *widget, bool group)
 {
+    TraceSpan span{"Widget::onChatroomWidgetClicked"};
     widget->resetEventFlags();
     widget->updateStatusLight();
 
@@ -1141,7 +1259,9 @@ void Widget::onReceiptRecieved(int friendId, int receipt)
     if (!f)
         return;
 
-    f->getChatForm()->getOfflineMsgEngine()->dischargeReceipt(receipt);
+    // receipts are only registered by a chat form
+    if (ChatForm* chatForm = f->findChatForm())
+        chatForm->getOfflineMsgEngine()->dischargeReceipt(receipt);
 }
 
 void Widget::addFriendDialog(Friend *frnd, ContentDialog *dialog)
@@ -1159,9 +1279,16 @@ void Widget::addFriendDialog(Friend *frnd, ContentDialog *dialog)
     connect(Core::getInstance(), &Core::friendAvatarChanged, friendWidget, &FriendWidget::onAvatarChange);
     connect(Core::getInstance(), &Core::friendAvatarRemoved, friendWidget, &FriendWidget::onAvatarRemoved);
 
-    QPixmap avatar = Nexus::getProfile()->loadAvatar(frnd->getToxId().toString());
-    if (!avatar.isNull())
-        friendWidget->onAvatarChange(frnd->getFriendID(), avatar);
+    QFutureWatcher<QImage>* avatarWatcher = new QFutureWatcher<QImage>(friendWidget);
+    int friendId = frnd->getFriendID();
+    connect(avatarWatcher, &QFutureWatcher<QImage>::finished, friendWidget, [=]()
+    {
+        QPixmap avatar = QPixmap::fromImage(avatarWatcher->result());
+        if (!avatar.isNull())
+            friendWidget->onAvatarChange(friendId, avatar);
+        avatarWatcher->deleteLater();
+    });
+    avatarWatcher->setFuture(Nexus::getProfile()->loadAvatarAsync(frnd->getToxId().toString()));
 }
 
 void Widget::addGroupDialog(Group *group, ContentDialog *dialog)
@@ -1307,7 +1434,10 @@ bool Widget::newMessageAlert(QWidget* currentWindow, bool isActive, bool sound,
 
 void Widget::onFriendRequestReceived(const QString& userId, const QString& message)
 {
-    if(addFriendForm->addFriendRequest(userId, message))
+    // Without the form, the request only needs to be stored, the form loads the stored ones when it's created
+    bool added = addFriendForm ? addFriendForm->addFriendRequest(userId, message)
+                               : Settings::getInstance().addFriendRequest(userId, message);
+    if (added)
     {
         friendRequestsUpdate();
         newMessageAlert(window(), isActiveWindow(), true, true);
@@ -1319,11 +1449,8 @@ void Widget::updateFriendActivity(Friend *frnd)
     QDate date = Settings::getInstance().getFriendActivity(frnd->getToxId());
     if (date != QDate::currentDate())
     {
-        // Update old activity before after new one. Store old date first.
-        QDate oldDate = Settings::getInstance().getFriendActivity(frnd->getToxId());
         Settings::getInstance().setFriendActivity(frnd->getToxId(), QDate::currentDate());
-        contactListWidget->moveWidget(frnd->getFriendWidget(), frnd->getStatus());
-        contactListWidget->updateActivityDate(oldDate);
+        contactListWidget->updateFriendActivity(frnd);
     }
 }
 
@@ -1487,7 +1614,7 @@ void Widget::onGroupInviteReceived(int32_t friendId, uint8_t type, QByteArray in
         ++unreadGroupInvites;
         groupInvitesUpdate();
         newMessageAlert(window(), isActiveWindow(), true, true);
-        groupInviteForm->addGroupInvite(friendId, type, invite);
+        getGroupInviteForm()->addGroupInvite(friendId, type, invite);
     }
     else
     {
@@ -1513,12 +1640,24 @@ void Widget::onGroupMessageReceived(int groupnumber, int peernumber, const QStri
         return;
 
     ToxId author = Core::getInstance()->getGroupPeerToxId(groupnumber, peernumber);
+    QDateTime timestamp = QDateTime::currentDateTime();
 
-    bool targeted = !author.isSelf() && (message.contains(nameMention) || message.contains(sanitizedNameMention));
+    bool targeted = !author.isSelf() && nameMention.matches(message);
     if (targeted && !isAction)
-        g->getChatForm()->addAlertMessage(author, message, QDateTime::currentDateTime());
+        g->getChatForm()->addAlertMessage(author, message, timestamp);
     else
-        g->getChatForm()->addMessage(author, message, isAction, QDateTime::currentDateTime(), true);
+        g->getChatForm()->addMessage(author, message, isAction, timestamp, true);
+
+    // Until a group has a title, we have nothing to find its history with on the next run,
+    // the default name only has the group number, which the next session gives to another group
+    Profile* profile = Nexus::getProfile();
+    if (profile->isHistoryEnabled() && g->hasTitle())
+    {
+        QString name = Core::getInstance()->getGroupPeerName(groupnumber, peernumber);
+        profile->getHistory()->addNewGroupMessage(History::groupChatKey(g->getName()),
+                                                  isAction ? "/me " + name + " " + message : message,
+                                                  author.publicKey, timestamp, name);
+    }
 
     newGroupMessageAlert(g->getGroupId(), targeted || Settings::getInstance().getGroupAlwaysNotify());
 }
@@ -1854,7 +1993,8 @@ void Widget::onFriendTypingChanged(int friendId, bool isTyping)
     if (!f)
         return;
 
-    f->getChatForm()->setFriendTyping(isTyping);
+    if (ChatForm* chatForm = f->findChatForm())
+        chatForm->setFriendTyping(isTyping);
 }
 
 void Widget::onSetShowSystemTray(bool newValue)
@@ -1922,23 +2062,12 @@ bool Widget::filterOnline(int index)
     }
 }
 
-void Widget::processOfflineMsgs()
-{
-    if (OfflineMsgEngine::globalMutex.tryLock())
-    {
-        QList<Friend*> frnds = FriendList::getAllFriends();
-        for (Friend *f : frnds)
-            f->getChatForm()->getOfflineMsgEngine()->deliverOfflineMsgs();
-
-        OfflineMsgEngine::globalMutex.unlock();
-    }
-}
-
 void Widget::clearAllReceipts()
 {
     QList<Friend*> frnds = FriendList::getAllFriends();
     for (Friend *f : frnds)
-        f->getChatForm()->getOfflineMsgEngine()->removeAllReceipts();
+        if (ChatForm* chatForm = f->findChatForm())
+            chatForm->getOfflineMsgEngine()->removeAllReceipts();
 }
 
 void Widget::reloadTheme()
@@ -2155,7 +2284,7 @@ void Widget::friendRequestsUpdate()
         connect(friendRequestsButton, &QPushButton::released, [this]()
         {
             onAddClicked();
-            addFriendForm->setMode(AddFriendForm::Mode::FriendRequest);
+            getAddFriendForm()->setMode(AddFriendForm::Mode::FriendRequest);
         });
     }
 
@@ -2259,3 +2388,79 @@ void Widget::focusChatInput()
             g->getChatForm()->focusInput();
     }
 }
+
+/**
+@brief Creates the add friend form on first use.
+*/
+AddFriendForm* Widget::getAddFriendForm()
+{
+    if (!addFriendForm)
+    {
+        QElapsedTimer elapsed;
+        elapsed.start();
+        addFriendForm = new AddFriendForm;
+        connect(addFriendForm, &AddFriendForm::friendRequested, this, &Widget::friendRequested);
+        connect(addFriendForm, &AddFriendForm::friendRequested, this, &Widget::friendRequestsUpdate);
+        connect(addFriendForm, &AddFriendForm::friendsRequested, this, &Widget::friendsRequested);
+        connect(addFriendForm, &AddFriendForm::friendsRequested, this, &Widget::friendRequestsUpdate);
+        connect(addFriendForm, &AddFriendForm::friendRequestsSeen, this, &Widget::friendRequestsUpdate);
+        connect(addFriendForm, &AddFriendForm::friendRequestAccepted, this, &Widget::friendRequestAccepted);
+        qDebug() << "Created the add friend form in" << elapsed.elapsed() << "ms";
+    }
+
+    return addFriendForm;
+}
+
+/**
+@brief Creates the group invite form on first use, or when the first invite arrives.
+*/
+GroupInviteForm* Widget::getGroupInviteForm()
+{
+    if (!groupInviteForm)
+    {
+        QElapsedTimer elapsed;
+        elapsed.start();
+        groupInviteForm = new GroupInviteForm;
+        connect(groupInviteForm, &GroupInviteForm::groupCreate, Core::getInstance(), &Core::createGroup);
+        connect(groupInviteForm, &GroupInviteForm::groupInvitesSeen, this, &Widget::groupInvitesClear);
+        connect(groupInviteForm, &GroupInviteForm::groupInviteAccepted, this, &Widget::onGroupInviteAccepted);
+        qDebug() << "Created the group invite form in" << elapsed.elapsed() << "ms";
+    }
+
+    return groupInviteForm;
+}
+
+/**
+@brief Creates the profile form on first use.
+*/
+ProfileForm* Widget::getProfileForm()
+{
+    if (!profileForm)
+    {
+        QElapsedTimer elapsed;
+        elapsed.start();
+        profileForm = new ProfileForm();
+        if (Nexus::getCore()->isReady())
+            profileForm->onSelfAvatarLoaded(Nexus::getProfile()->loadAvatar());
+        connect(Nexus::getCore(), &Core::selfAvatarChanged, profileForm, &ProfileForm::onSelfAvatarLoaded);
+        qDebug() << "Created the profile form in" << elapsed.elapsed() << "ms";
+    }
+
+    return profileForm;
+}
+
+/**
+@brief Creates the file transfers form on first use, or when the first transfer finishes.
+*/
+FilesForm* Widget::getFilesForm()
+{
+    if (!filesForm)
+    {
+        QElapsedTimer elapsed;
+        elapsed.start();
+        filesForm = new FilesForm();
+        qDebug() << "Created the files form in" << elapsed.elapsed() << "ms";
+    }
+
+    return filesForm;
+}
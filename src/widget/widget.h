@@ -24,6 +24,8 @@
 #include <QSystemTrayIcon>
 #include <QFileInfo>
 #include "src/core/corestructs.h"
+#include "src/core/coreevents.h"
+#include "src/chatlog/mentionmatcher.h"
 #include "genericchatitemwidget.h"
 
 #define PIXELS_TO_ACT 7
@@ -36,6 +38,7 @@ class GenericChatroomWidget;
 class FriendWidget;
 class Group;
 class Friend;
+class ChatForm;
 class QSplitter;
 class VideoSurface;
 class QMenu;
@@ -124,8 +127,10 @@ public slots:
     void setUsername(const QString& username);
     void setStatusMessage(const QString &statusMessage);
     void addFriend(int friendId, const QString& userId);
+    void onFriendsLoaded(const QVector<FriendSnapshot>& friends);
     void addFriendFailed(const QString& userId, const QString& errorInfo = QString());
     void onFriendshipChanged(int friendId);
+    void onCoreEvents(const CoreEvents& events);
     void onFriendStatusChanged(int friendId, Status status);
     void onFriendStatusMessageChanged(int friendId, const QString& message);
     void onFriendUsernameChanged(int friendId, const QString& username);
@@ -150,6 +155,7 @@ public slots:
 signals:
     void friendRequestAccepted(const QString& userId);
     void friendRequested(const QString& friendAddress, const QString& message);
+    void friendsRequested(const QStringList& friendAddresses, const QString& message);
     void statusSet(Status status);
     void statusSelected(Status status);
     void usernameChanged(const QString& username);
@@ -186,7 +192,6 @@ private slots:
     void onTryCreateTrayIcon();
     void onSetShowSystemTray(bool newValue);
     void onSplitterMoved(int pos, int index);
-    void processOfflineMsgs();
     void friendListContextMenu(const QPoint &pos);
     void friendRequestsUpdate();
     void groupInvitesUpdate();
@@ -218,6 +223,8 @@ private:
     void setActiveToolMenuButton(ActiveToolMenuButton newActiveButton);
     void hideMainForms(GenericChatroomWidget* chatroomWidget);
     Group *createGroup(int groupId);
+    Friend* createFriend(int friendId, const QString& userId, const QString& name, const QString& statusMessage);
+    void connectChatForm(Friend* f, ChatForm* chatForm);
     void removeFriend(Friend* f, bool fake = false);
     void removeGroup(Group* g, bool fake = false);
     void saveWindowGeometry();
@@ -232,6 +239,10 @@ private:
     static bool filterOffline(int index);
     void retranslateUi();
     void focusChatInput();
+    AddFriendForm* getAddFriendForm();
+    GroupInviteForm* getGroupInviteForm();
+    ProfileForm* getProfileForm();
+    FilesForm* getFilesForm();
 
 private:
     SystemTrayIcon *icon;
@@ -270,8 +281,8 @@ private:
     MaskablePixmapWidget *profilePicture;
     bool notify(QObject *receiver, QEvent *event);
     bool autoAwayActive = false;
-    QTimer *timer, *offlineMsgTimer;
-    QRegExp nameMention, sanitizedNameMention;
+    QTimer *timer;
+    MentionMatcher nameMention; ///< Matched against every group message
     bool eventFlag;
     bool eventIcon;
     bool wasMaximized = false;
@@ -0,0 +1,144 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "audiobench.h"
+#include "src/audio/audiojitterbuffer.h"
+#include "src/audio/audioresampler.h"
+#include "src/audio/samplekernels.h"
+#include "src/audio/voicedetector.h"
+
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <QtTest>
+
+namespace
+{
+const int sampleRate = 48000;
+const int channels = 2;
+const int frameSamples = sampleRate / 50; ///< Per channel, in the 20 ms frames we capture
+}
+
+void AudioBench::initTestCase()
+{
+    std::mt19937 random(1);
+    std::normal_distribution<double> noise(0.0, 300.0);
+
+    speech.resize(sampleRate * channels);
+    for (int i = 0; i < sampleRate; ++i)
+    {
+        // 200 ms of a 220 Hz tone, then 200 ms of background noise
+        const bool talking = (i / (sampleRate / 5)) % 2 == 0;
+        double sample = noise(random);
+        if (talking)
+            sample += 8000.0 * std::sin(2.0 * M_PI * 220.0 * i / sampleRate);
+
+        const int16_t value = static_cast<int16_t>(qBound(-32768.0, sample, 32767.0));
+        speech[channels * i] = value;
+        speech[channels * i + 1] = value;
+    }
+}
+
+void AudioBench::applyGainAccuracy_data()
+{
+    QTest::addColumn<double>("gain");
+    QTest::newRow("0.5") << 0.5;
+    QTest::newRow("1") << 1.0;
+    QTest::newRow("1.7") << 1.7;
+    QTest::newRow("8, saturating") << 8.0;
+}
+
+/// The vectorized path must give the same samples and levels as the scalar one
+void AudioBench::applyGainAccuracy()
+{
+    QFETCH(double, gain);
+
+    std::mt19937 random(2);
+    std::uniform_int_distribution<int> sampleValue(-32768, 32767);
+    QVector<int16_t> samples(1003);
+    for (int16_t& sample : samples)
+        sample = static_cast<int16_t>(sampleValue(random));
+
+    // One sample at a time never reaches the vector loop
+    QVector<int16_t> expected = samples;
+    int expectedPeak = 0;
+    uint64_t expectedSumSquares = 0;
+    for (int16_t& sample : expected)
+    {
+        int peak;
+        uint64_t sumSquares;
+        SampleKernels::applyGain(&sample, 1, gain, peak, sumSquares);
+        expectedPeak = qMax(expectedPeak, peak);
+        expectedSumSquares += sumSquares;
+    }
+
+    int peak;
+    uint64_t sumSquares;
+    SampleKernels::applyGain(samples.data(), samples.size(), gain, peak, sumSquares);
+
+    QCOMPARE(samples, expected);
+    // NEON's absolute value saturates, so a -32768 sample has a peak of 32767 there
+    QVERIFY(qAbs(peak - expectedPeak) <= 1);
+    QCOMPARE(sumSquares, expectedSumSquares);
+}
+
+/// What the send thread does to each captured frame, without the echo cancelling
+void AudioBench::captureFrame()
+{
+    VoiceDetector voiceDetector;
+    QVector<int16_t> frame(frameSamples * channels);
+    const int frames = speech.size() / frame.size();
+    int next = 0;
+    QBENCHMARK
+    {
+        memcpy(frame.data(), speech.constData() + next * frame.size(), frame.size() * sizeof(int16_t));
+        next = (next + 1) % frames;
+
+        int peak;
+        uint64_t sumSquares;
+        SampleKernels::applyGain(frame.data(), frame.size(), 1.5, peak, sumSquares);
+        voiceDetector.isVoice(frame.constData(), frame.size(), sumSquares, 20);
+    }
+}
+
+/// A frame of a 44.1 kHz device to our 48 kHz
+void AudioBench::resample()
+{
+    AudioResampler resampler(channels, 44100, sampleRate);
+    const int inFrames = 44100 / 50;
+    QVector<int16_t> out;
+    int written = 0;
+    QBENCHMARK
+    {
+        written = resampler.process(speech.constData(), inFrames, out);
+    }
+    QVERIFY(qAbs(written - frameSamples) <= frameSamples / 10);
+}
+
+/// A steady stream of frames through the playback buffer of a call
+void AudioBench::jitterBuffer()
+{
+    AudioJitterBuffer buffer;
+    AudioJitterBuffer::Frame frame;
+    QBENCHMARK
+    {
+        buffer.push(speech.constData(), frameSamples, channels, sampleRate);
+        buffer.pop(frame);
+    }
+}
@@ -0,0 +1,43 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef AUDIOBENCH_H
+#define AUDIOBENCH_H
+
+#include <QObject>
+#include <QVector>
+
+/// Runs the capture DSP and the playback buffers on synthetic PCM, no audio device needed
+class AudioBench : public QObject
+{
+    Q_OBJECT
+private slots:
+    void initTestCase();
+
+    void applyGainAccuracy_data();
+    void applyGainAccuracy();
+    void captureFrame();
+    void resample();
+    void jitterBuffer();
+
+private:
+    QVector<int16_t> speech; ///< A second of stereo 48 kHz, tone bursts over noise
+};
+
+#endif // AUDIOBENCH_H
@@ -0,0 +1,61 @@
+#-------------------------------------------------
+#
+# qtox-bench, checks and benchmarks of qTox's hot paths
+#
+#-------------------------------------------------
+
+#    This file is part of qTox, a Qt-based graphical interface for Tox.
+#
+#    This program is libre software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+#
+#    See the COPYING file for more details.
+
+# Builds all of qTox, with the same options, except its main()
+QTOX_ROOT = $$clean_path($$PWD/../..)
+include($$QTOX_ROOT/qtox.pro)
+
+# qtox.pro's paths are relative to the root of the repository, ours to this directory
+SOURCES -= src/main.cpp
+for(var, $$list(SOURCES HEADERS FORMS RESOURCES OBJECTIVE_SOURCES SMILEY_PACKS TRANSLATIONS INCLUDEPATH)) {
+    files = $$eval($$var)
+    $$var =
+    for(file, files): $$var += $$absolute_path($$file, $$QTOX_ROOT)
+}
+!isEmpty(RC_FILE): RC_FILE = $$absolute_path($$RC_FILE, $$QTOX_ROOT)
+INCLUDEPATH += $$QTOX_ROOT
+
+# res.qrc needs the qm files
+system($$QMAKE_LRELEASE -silent $$TRANSLATIONS)
+
+# Nothing to install or bundle
+INSTALLS =
+QMAKE_POST_LINK =
+QMAKE_BUNDLE_DATA =
+
+QT += testlib
+
+TARGET = qtox-bench
+
+CONFIG += console
+CONFIG -= app_bundle
+
+SOURCES += main.cpp \
+    historybench.cpp \
+    chatbench.cpp \
+    settingsbench.cpp \
+    videobench.cpp \
+    audiobench.cpp \
+    corebench.cpp
+
+HEADERS += historybench.h \
+    chatbench.h \
+    settingsbench.h \
+    videobench.h \
+    audiobench.h \
+    corebench.h
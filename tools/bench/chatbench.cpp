@@ -0,0 +1,175 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "chatbench.h"
+#include "src/chatlog/chatlog.h"
+#include "src/chatlog/chatmessage.h"
+#include "src/chatlog/messageformatter.h"
+#include "src/persistence/smileypack.h"
+
+#include <QCoreApplication>
+#include <QtTest>
+
+namespace
+{
+const int logSize = 2000;
+const QString smileyText = QStringLiteral("good morning :) did you get my file? :D see you later ;) <3");
+
+QList<ChatLine::Ptr> makeLines(int count)
+{
+    QList<ChatLine::Ptr> lines;
+    const QDateTime start = QDateTime::currentDateTime();
+    for (int i = 0; i < count; ++i)
+    {
+        lines.append(ChatMessage::createChatMessage(i % 3 ? "Alice" : "Bob",
+                                                    QString("message %1, *bold* and https://tox.chat :)").arg(i),
+                                                    ChatMessage::NORMAL, i % 3 == 0, start.addSecs(i)));
+    }
+    return lines;
+}
+
+/// Waits until the log has laid out all of its lines
+void waitForLayout(ChatLog& log)
+{
+    while (log.isLayingOut())
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+}
+}
+
+void ChatBench::formatRules_data()
+{
+    QTest::addColumn<QString>("message");
+    QTest::addColumn<int>("markdown");
+    QTest::addColumn<QString>("expected");
+
+    QTest::newRow("escaping") << QString("a < b & \"c\" > d") << int(WITHOUT_CHARS)
+                              << QString("a &lt; b &amp; &quot;c&quot; &gt; d");
+    QTest::newRow("link") << QString("see https://tox.chat now") << int(WITHOUT_CHARS)
+                          << QString("see <a href=\"https://tox.chat\">https://tox.chat</a> now");
+    QTest::newRow("www link") << QString("www.tox.chat") << int(WITHOUT_CHARS)
+                              << QString("<a href=\"http://www.tox.chat\">www.tox.chat</a>");
+    QTest::newRow("italic") << QString("*it* is") << int(WITHOUT_CHARS) << QString("<i>it</i> is");
+    QTest::newRow("bold") << QString("**bold**") << int(WITHOUT_CHARS) << QString("<b>bold</b>");
+    QTest::newRow("with chars") << QString("*it*") << int(WITH_CHARS) << QString("<i>*it*</i>");
+    QTest::newRow("no markdown") << QString("*it*") << int(NONE) << QString("*it*");
+    QTest::newRow("inside a word") << QString("x*ab*") << int(WITHOUT_CHARS) << QString("x*ab*");
+    QTest::newRow("not ending at a space") << QString("*ab*c") << int(WITHOUT_CHARS) << QString("*ab*c");
+    QTest::newRow("across lines") << QString("*ab\ncd*") << int(WITHOUT_CHARS) << QString("*ab<br/>cd*");
+    QTest::newRow("link in markdown") << QString("_see https://tox.chat_") << int(WITHOUT_CHARS)
+                                      << QString("<i>see <a href=\"https://tox.chat\">https://tox.chat</a></i>");
+    QTest::newRow("quote") << QString("> quoted\nnext") << int(WITHOUT_CHARS)
+                           << QString("<span class=quote>&gt; quoted</span><br/>next");
+}
+
+/// The single pass formatter keeps the rules of the old regexes
+void ChatBench::formatRules()
+{
+    QFETCH(QString, message);
+    QFETCH(int, markdown);
+    QFETCH(QString, expected);
+
+    MessageFormatter formatter{false, static_cast<MarkdownType>(markdown)};
+    QCOMPARE(formatter.format(message), expected);
+}
+
+void ChatBench::formatMessage_data()
+{
+    QTest::addColumn<QString>("text");
+    QTest::newRow("plain") << QString("just a few words of plain text, nothing to format in them");
+    QTest::newRow("markdown") << QString("*bold* _italic_ ~strike~ `code` and *more bold*");
+    QTest::newRow("links") << QString("see https://tox.chat and https://github.com/qTox/qTox/issues/1 too");
+    QTest::newRow("smileys") << smileyText;
+    QTest::newRow("long") << QString("a fairly long line of text that goes on ").repeated(50);
+}
+
+void ChatBench::formatMessage()
+{
+    QFETCH(QString, text);
+    const QDateTime now = QDateTime::currentDateTime();
+    QBENCHMARK
+    {
+        ChatMessage::createChatMessage("Alice", text, ChatMessage::NORMAL, false, now);
+    }
+}
+
+void ChatBench::smileyfied()
+{
+    SmileyPack& pack = SmileyPack::getInstance();
+    QBENCHMARK
+    {
+        pack.smileyfied(smileyText);
+    }
+}
+
+void ChatBench::chatLogInsert()
+{
+    ChatLog log;
+    log.resize(800, 600);
+    log.show();
+
+    const QList<ChatLine::Ptr> lines = makeLines(logSize);
+    QBENCHMARK
+    {
+        log.clear();
+        for (const ChatLine::Ptr& line : lines)
+            log.insertChatlineAtBottom(line);
+        log.forceRelayout();
+        waitForLayout(log);
+    }
+    QCOMPARE(log.getStatistics().lines, logSize);
+}
+
+void ChatBench::chatLogRelayout()
+{
+    ChatLog log;
+    log.resize(800, 600);
+    log.show();
+
+    log.insertChatlineOnTop(makeLines(logSize));
+    waitForLayout(log);
+
+    // Alternate between two widths, a relayout to the same width is skipped
+    int width = 800;
+    QBENCHMARK
+    {
+        width = width == 800 ? 600 : 800;
+        log.resize(width, 600);
+        log.forceRelayout();
+        waitForLayout(log);
+    }
+}
+
+void ChatBench::chatLogScroll()
+{
+    ChatLog log;
+    log.resize(800, 600);
+    log.show();
+
+    const QList<ChatLine::Ptr> lines = makeLines(logSize);
+    log.insertChatlineOnTop(lines);
+    waitForLayout(log);
+
+    int row = 0;
+    QBENCHMARK
+    {
+        row = (row + logSize / 10) % logSize;
+        log.scrollToLine(lines[row]);
+        QCoreApplication::processEvents();
+    }
+}
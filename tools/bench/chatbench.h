@@ -0,0 +1,40 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CHATBENCH_H
+#define CHATBENCH_H
+
+#include <QObject>
+
+/// Formats chat messages and lays them out in a chat log
+class ChatBench : public QObject
+{
+    Q_OBJECT
+private slots:
+    void formatRules_data();
+    void formatRules();
+    void formatMessage_data();
+    void formatMessage();
+    void smileyfied();
+    void chatLogInsert();
+    void chatLogRelayout();
+    void chatLogScroll();
+};
+
+#endif // CHATBENCH_H
@@ -0,0 +1,189 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "corebench.h"
+#include "src/core/core.h"
+#include "src/core/indexedlist.h"
+
+#include <QtTest>
+
+namespace
+{
+/// Stands in for a ToxCall, move-only and indexed by its id
+struct Item
+{
+    Item() = default;
+    Item(int id, int payload) : id{id}, payload{payload} {}
+    Item(Item&&) noexcept = default;
+    Item& operator=(Item&&) noexcept = default;
+    Item(const Item&) = delete;
+    Item& operator=(const Item&) = delete;
+
+    explicit operator int() const { return id; }
+
+    int id = -1;
+    int payload = 0;
+};
+
+/// Every id in ids is found with its own value, in the list's order, and nothing else is
+bool checkIndex(IndexedList<Item>& list, const QVector<int>& ids)
+{
+    int pos = 0;
+    for (const Item& item : list)
+    {
+        if (pos >= ids.size() || item.id != ids[pos++])
+            return false;
+    }
+    if (pos != ids.size())
+        return false;
+
+    for (int id = 0; id < 20; ++id)
+    {
+        const Item* item = list.find(id);
+        if (list.contains(id) != ids.contains(id) || (item != nullptr) != ids.contains(id))
+            return false;
+        if (item && (item->id != id || item->payload != id * 10))
+            return false;
+    }
+    return true;
+}
+}
+
+void CoreBench::splitMessage_data()
+{
+    QTest::addColumn<QString>("message");
+    QTest::addColumn<int>("maxLen");
+    QTest::addColumn<int>("pieces"); ///< -1 to only check the invariants
+
+    QTest::newRow("short") << QString("hello") << 10 << 1;
+    QTest::newRow("exact") << QString("0123456789") << 10 << 1;
+    QTest::newRow("empty") << QString() << 10 << 1;
+    QTest::newRow("at spaces") << QString("aaaa bbbb cccc dddd") << 10 << 2;
+    QTest::newRow("no spaces") << QString("x").repeated(25) << 10 << 3;
+    QTest::newRow("leading space") << QString(" ") + QString("y").repeated(20) << 10 << 3;
+    QTest::newRow("two byte") << QString::fromUtf8("\xc3\xa9").repeated(20) << 7 << -1;
+    QTest::newRow("three byte") << QString::fromUtf8("\xe2\x82\xac").repeated(20) << 10 << -1;
+    QTest::newRow("four byte") << QString::fromUtf8("\xf0\x9f\x98\x80").repeated(20) << 6 << -1;
+    QTest::newRow("mixed") << QString::fromUtf8("caf\xc3\xa9 \xe2\x82\xac\xe2\x82\xac "
+                                                "\xf0\x9f\x98\x80x").repeated(30) << 13 << -1;
+}
+
+void CoreBench::splitMessage()
+{
+    QFETCH(QString, message);
+    QFETCH(int, maxLen);
+    QFETCH(int, pieces);
+
+    const QByteArray utf8 = message.toUtf8();
+    const QVector<Core::MessageSpan> spans = Core::splitMessage(utf8, maxLen);
+    if (pieces != -1)
+        QCOMPARE(spans.size(), pieces);
+
+    // The spans follow each other, are short enough, and don't cut characters
+    QString joined;
+    int offset = 0;
+    for (const Core::MessageSpan& span : spans)
+    {
+        QCOMPARE(span.offset, offset);
+        QVERIFY(span.length <= maxLen);
+        QVERIFY(span.length > 0 || utf8.isEmpty());
+        if (span.offset < utf8.size())
+            QVERIFY((utf8[span.offset] & 0xC0) != 0x80);
+
+        joined += QString::fromUtf8(utf8.constData() + span.offset, span.length);
+        offset += span.length;
+    }
+    QCOMPARE(offset, utf8.size());
+    QCOMPARE(joined, message);
+
+    // A piece that ends before the last one ends after a space, if it had any
+    for (int i = 0; i + 1 < spans.size(); ++i)
+    {
+        const QByteArray piece = utf8.mid(spans[i].offset, spans[i].length);
+        if (piece.indexOf(' ', 1) != -1)
+            QVERIFY(piece.endsWith(' '));
+    }
+}
+
+void CoreBench::splitLongMessage()
+{
+    const QByteArray message = QString::fromUtf8("a rather long message, with \xe2\x82\xac signs, "
+                                                 "sent in one go ").repeated(2000).toUtf8();
+    QBENCHMARK
+    {
+        Core::splitMessage(message, TOX_MAX_MESSAGE_LENGTH);
+    }
+}
+
+/// Erasing moves the values after the gap, their positions in the index must follow
+void CoreBench::indexedListReindex()
+{
+    IndexedList<Item> list;
+    QVector<int> ids;
+    for (int id = 0; id < 10; ++id)
+    {
+        list.insert(Item{id, id * 10});
+        ids.append(id);
+    }
+    QVERIFY(checkIndex(list, ids));
+
+    list.erase(list.begin() + 3);
+    ids.remove(3);
+    QVERIFY(checkIndex(list, ids));
+
+    list.erase(list.begin() + 1, list.begin() + 4);
+    ids.remove(1, 3);
+    QVERIFY(checkIndex(list, ids));
+
+    list.remove(8);
+    ids.removeOne(8);
+    QVERIFY(checkIndex(list, ids));
+
+    list.remove(8);
+    QVERIFY(checkIndex(list, ids));
+
+    list.erase(list.end() - 1);
+    ids.removeLast();
+    QVERIFY(checkIndex(list, ids));
+
+    list.insert(Item{15, 150});
+    ids.append(15);
+    QVERIFY(checkIndex(list, ids));
+
+    list.erase(list.begin(), list.end());
+    ids.clear();
+    QVERIFY(checkIndex(list, ids));
+    QVERIFY(list.isEmpty());
+}
+
+/// The per-frame lookups of the calls, with a hundred of them going on
+void CoreBench::indexedListFind()
+{
+    IndexedList<Item> list;
+    for (int id = 0; id < 100; ++id)
+        list.insert(Item{id * 7, id});
+
+    int found = 0;
+    QBENCHMARK
+    {
+        for (int id = 0; id < 700; id += 7)
+            found += list.find(id) != nullptr;
+    }
+    QVERIFY(found > 0);
+}
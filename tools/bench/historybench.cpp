@@ -0,0 +1,148 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "historybench.h"
+#include "src/persistence/history.h"
+#include "src/persistence/db/rawdatabase.h"
+
+#include <QFile>
+#include <QSemaphore>
+#include <QTemporaryDir>
+#include <QtTest>
+
+namespace
+{
+const QString profileName = QStringLiteral("qtox-bench");
+const int insertCount = 1000;
+const int historySize = 20000;
+const QStringList words = QStringList() << "hello" << "tox" << "how" << "are" << "you" << "link"
+                                        << "https://tox.chat" << "file" << "call" << "tomorrow" << ":)";
+
+QString makeMessage(int i)
+{
+    QString message;
+    for (int w = 0; w < 4 + i % 12; ++w)
+        message += words[(i * 7 + w * 3) % words.size()] + ' ';
+    return message;
+}
+}
+
+void HistoryBench::initTestCase()
+{
+    QFile::remove(History::getDbPath(profileName));
+    history.reset(new History(profileName, QString()));
+    QVERIFY(history->isValid());
+
+    friendPk = QString(64, 'A');
+    addMessages(historySize);
+}
+
+void HistoryBench::cleanupTestCase()
+{
+    history->remove();
+    history.reset();
+}
+
+void HistoryBench::addMessages(int count)
+{
+    QSemaphore written;
+    const QDateTime start = QDateTime::currentDateTime();
+    for (int i = 0; i < count; ++i)
+    {
+        std::function<void(int64_t)> callback;
+        if (i == count - 1)
+            callback = [&written](int64_t) { written.release(); };
+
+        history->addNewMessage(friendPk, makeMessage(i), i % 2 ? friendPk : QString(64, 'B'),
+                               start.addMSecs(i), true, "Alice", callback);
+    }
+    written.acquire();
+}
+
+void HistoryBench::insert()
+{
+    QBENCHMARK
+    {
+        addMessages(insertCount);
+    }
+}
+
+void HistoryBench::chatHistory()
+{
+    const QDateTime from = QDateTime::currentDateTime().addDays(-1);
+    const QDateTime to = QDateTime::currentDateTime().addDays(1);
+    QList<History::HistMessage> messages;
+    QBENCHMARK
+    {
+        messages = history->getChatHistory(friendPk, from, to);
+    }
+    QVERIFY(messages.size() >= historySize);
+}
+
+void HistoryBench::chatHistoryPage()
+{
+    const QDateTime before = QDateTime::currentDateTime().addDays(1);
+    QList<History::HistMessage> messages;
+    QBENCHMARK
+    {
+        messages = history->getChatHistoryPage(friendPk, before, 0, 100);
+    }
+    QCOMPARE(messages.size(), 100);
+}
+
+void HistoryBench::search()
+{
+    QList<History::HistMessage> messages;
+    QBENCHMARK
+    {
+        messages = history->search("tomorrow call", QString(), 50);
+    }
+    QVERIFY(!messages.isEmpty());
+}
+
+void HistoryBench::execNow_data()
+{
+    QTest::addColumn<QString>("statement");
+    QTest::addColumn<bool>("interactive");
+    QTest::newRow("select") << QString("SELECT value FROM bench WHERE id = 1;") << false;
+    QTest::newRow("interactive select") << QString("SELECT value FROM bench WHERE id = 1;") << true;
+    QTest::newRow("update") << QString("UPDATE bench SET value = value + 1 WHERE id = 1;") << false;
+}
+
+/// The round trip of a small transaction through the database thread, which execNow callers wait for
+void HistoryBench::execNow()
+{
+    QFETCH(QString, statement);
+    QFETCH(bool, interactive);
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    RawDatabase db{dir.path() + "/execnow.sqlite", QString(), RawDatabase::OpenOptions{}};
+    QVERIFY(db.isOpen());
+    QVERIFY(db.execNow("CREATE TABLE bench (id INTEGER PRIMARY KEY, value INTEGER);"
+                       "INSERT INTO bench (id, value) VALUES (1, 0);"));
+
+    const RawDatabase::Priority priority = interactive ? RawDatabase::Priority::Interactive
+                                                       : RawDatabase::Priority::Background;
+    const RawDatabase::Query query{statement};
+    QBENCHMARK
+    {
+        QVERIFY(db.execNow(query, priority));
+    }
+}
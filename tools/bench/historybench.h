@@ -0,0 +1,53 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef HISTORYBENCH_H
+#define HISTORYBENCH_H
+
+#include <memory>
+#include <QObject>
+#include <QString>
+
+class History;
+
+/// Inserts into and reads from a history database of its own
+class HistoryBench : public QObject
+{
+    Q_OBJECT
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void insert();
+    void chatHistory();
+    void chatHistoryPage();
+    void search();
+    void execNow_data();
+    void execNow();
+
+private:
+    /// Writes count messages with the friend, and waits until they're committed
+    void addMessages(int count);
+
+private:
+    std::unique_ptr<History> history;
+    QString friendPk;
+};
+
+#endif // HISTORYBENCH_H
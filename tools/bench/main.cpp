@@ -0,0 +1,92 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "audiobench.h"
+#include "historybench.h"
+#include "chatbench.h"
+#include "corebench.h"
+#include "settingsbench.h"
+#include "videobench.h"
+#include "src/persistence/settings.h"
+
+#include <QApplication>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QStandardPaths>
+#include <QtTest>
+
+#include <sodium.h>
+
+/*
+ * qtox-bench runs each group of checks and benchmarks of qTox's hot paths in turn,
+ * and takes the QtTest options, like -csv for results that are easy to compare.
+ * If the first argument is the name of a group, like VideoBench, only that group runs,
+ * and the arguments after it can pick its test functions.
+ * It runs portable from its build directory, so it never touches the real profiles.
+ */
+int main(int argc, char* argv[])
+{
+    // The chat log benchmarks don't need a display
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+
+    QApplication app(argc, argv);
+    app.setApplicationName("qTox");
+    app.setOrganizationName("Tox");
+    QStandardPaths::setTestModeEnabled(true);
+
+    if (sodium_init() < 0)
+    {
+        qCritical() << "Can't init libsodium";
+        return EXIT_FAILURE;
+    }
+
+    // Settings read this before anything else, the databases and settings files then go next to us
+    QFile portable(QDir(app.applicationDirPath()).filePath("qtox.ini"));
+    if (!portable.exists() && portable.open(QIODevice::WriteOnly))
+    {
+        portable.write("[General]\nmakeToxPortable=true\n");
+        portable.close();
+    }
+    Settings::getInstance();
+
+    HistoryBench historyBench;
+    ChatBench chatBench;
+    SettingsBench settingsBench;
+    VideoBench videoBench;
+    AudioBench audioBench;
+    CoreBench coreBench;
+
+    const QList<QObject*> benches{&historyBench, &chatBench, &settingsBench, &videoBench, &audioBench, &coreBench};
+    for (QObject* bench : benches)
+    {
+        if (argc > 1 && bench->metaObject()->className() == QByteArray(argv[1]))
+        {
+            argv[1] = argv[0];
+            return QTest::qExec(bench, argc - 1, argv + 1) ? EXIT_FAILURE : EXIT_SUCCESS;
+        }
+    }
+
+    int failures = 0;
+    for (QObject* bench : benches)
+        failures += QTest::qExec(bench, argc, argv);
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
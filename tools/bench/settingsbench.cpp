@@ -0,0 +1,249 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "settingsbench.h"
+#include "src/persistence/settingsserializer.h"
+
+#include <QDate>
+#include <QSettings>
+#include <QtTest>
+
+namespace
+{
+QString friendAddress(int i)
+{
+    return QString("%1").arg(i, 76, 16, QChar('0')).toUpper();
+}
+}
+
+void SettingsBench::writeSettings(const QString& path, int friends)
+{
+    SettingsSerializer ps(path);
+    ps.beginGroup("Friends");
+        ps.beginWriteArray("Friend", friends);
+        for (int i = 0; i < friends; ++i)
+        {
+            ps.setArrayIndex(i);
+            ps.setValue("addr", friendAddress(i));
+            ps.setValue("alias", QString("Friend %1").arg(i));
+            ps.setValue("note", QString());
+            ps.setValue("autoAcceptDir", QString());
+            ps.setValue("circle", i % 5 - 1);
+            ps.setValue("historyMaxAge", -1);
+            ps.setValue("historyMaxRows", -1);
+            ps.setValue("activity", QDate(2016, 1, 1).addDays(i % 365));
+        }
+        ps.endArray();
+    ps.endGroup();
+
+    ps.beginGroup("Privacy");
+        ps.setValue("typingNotification", true);
+        ps.setValue("enableLogging", true);
+    ps.endGroup();
+
+    ps.save();
+}
+
+void SettingsBench::writeIndexValues(SettingsSerializer& ps)
+{
+    ps.setValue("addr", "top");
+    ps.beginGroup("A");
+        ps.setValue("addr", "a");
+        ps.setValue("note", "first");
+        ps.setValue("note", "second");
+    ps.endGroup();
+    ps.beginGroup("Friends");
+        ps.setValue("addr", "friends");
+        ps.beginWriteArray("Friend", 3);
+        for (int i = 0; i < 3; ++i)
+        {
+            ps.setArrayIndex(i);
+            ps.setValue("addr", friendAddress(i));
+        }
+        ps.endArray();
+        ps.beginWriteArray("Other", 1);
+            ps.setArrayIndex(0);
+            ps.setValue("addr", "other");
+        ps.endArray();
+    ps.endGroup();
+}
+
+void SettingsBench::writeIndexValues(QSettings& s)
+{
+    // The same values, as the old ini settings had them
+    s.setValue("addr", "top");
+    s.beginGroup("A");
+        s.setValue("addr", "a");
+        s.setValue("note", "second");
+    s.endGroup();
+    s.beginGroup("Friends");
+        s.setValue("addr", "friends");
+        s.beginWriteArray("Friend", 3);
+        for (int i = 0; i < 3; ++i)
+        {
+            s.setArrayIndex(i);
+            s.setValue("addr", friendAddress(i));
+        }
+        s.endArray();
+        s.beginWriteArray("Other", 1);
+            s.setArrayIndex(0);
+            s.setValue("addr", "other");
+        s.endArray();
+    s.endGroup();
+    s.sync();
+}
+
+void SettingsBench::indexRoundTrip_data()
+{
+    QTest::addColumn<QString>("source");
+    QTest::newRow("written") << QString("written");
+    QTest::newRow("serialized") << QString("serialized");
+    QTest::newRow("ini") << QString("ini");
+}
+
+/// Each value is found under its own group, array and index, however it was read
+void SettingsBench::indexRoundTrip()
+{
+    QFETCH(QString, source);
+    QVERIFY(dir.isValid());
+    const QString path = dir.path() + "/index-" + source + ".ini";
+
+    SettingsSerializer ps(path);
+    if (source == "written")
+    {
+        writeIndexValues(ps);
+    }
+    else if (source == "serialized")
+    {
+        SettingsSerializer out(path);
+        writeIndexValues(out);
+        out.save();
+        ps.load();
+    }
+    else
+    {
+        QSettings ini(path, QSettings::IniFormat);
+        writeIndexValues(ini);
+        ps.load();
+    }
+
+    QCOMPARE(ps.value("addr").toString(), QString("top"));
+    QCOMPARE(ps.value("note", "none").toString(), QString("none"));
+    ps.beginGroup("A");
+        QCOMPARE(ps.value("addr").toString(), QString("a"));
+        QCOMPARE(ps.value("note").toString(), QString("second"));
+    ps.endGroup();
+    ps.beginGroup("Friends");
+        QCOMPARE(ps.value("addr").toString(), QString("friends"));
+        QCOMPARE(ps.childKeys(), QStringList() << "addr");
+        QCOMPARE(ps.beginReadArray("Friend"), 3);
+        for (int i = 0; i < 3; ++i)
+        {
+            ps.setArrayIndex(i);
+            QCOMPARE(ps.value("addr").toString(), friendAddress(i));
+        }
+        ps.endArray();
+        QCOMPARE(ps.beginReadArray("Other"), 1);
+            ps.setArrayIndex(0);
+            QCOMPARE(ps.value("addr").toString(), QString("other"));
+        ps.endArray();
+    ps.endGroup();
+    ps.beginGroup("Missing");
+        QVERIFY(!ps.value("addr").isValid());
+    ps.endGroup();
+}
+
+/// Saving what was loaded writes the same file again, so the groups keep their records
+void SettingsBench::saveRoundTrip()
+{
+    QVERIFY(dir.isValid());
+    const QString first = dir.path() + "/first.ini";
+    const QString second = dir.path() + "/second.ini";
+    writeSettings(first, 1000);
+    QFile::remove(second);
+    QVERIFY(QFile::copy(first, second));
+
+    SettingsSerializer ps(second);
+    ps.load();
+    ps.save();
+
+    QFile a(first), b(second);
+    QVERIFY(a.open(QIODevice::ReadOnly));
+    QVERIFY(b.open(QIODevice::ReadOnly));
+    QCOMPARE(b.readAll(), a.readAll());
+}
+
+void SettingsBench::save_data()
+{
+    QTest::addColumn<int>("friends");
+    QTest::newRow("100 friends") << 100;
+    QTest::newRow("1000 friends") << 1000;
+    QTest::newRow("10000 friends") << 10000;
+}
+
+void SettingsBench::save()
+{
+    QFETCH(int, friends);
+    QVERIFY(dir.isValid());
+    const QString path = dir.path() + "/save.ini";
+    QBENCHMARK
+    {
+        writeSettings(path, friends);
+    }
+    QVERIFY(SettingsSerializer::isSerializedFormat(path));
+}
+
+void SettingsBench::load_data()
+{
+    save_data();
+}
+
+void SettingsBench::load()
+{
+    QFETCH(int, friends);
+    QVERIFY(dir.isValid());
+    const QString path = dir.path() + QString("/load%1.ini").arg(friends);
+    writeSettings(path, friends);
+
+    int found = 0;
+    QBENCHMARK
+    {
+        SettingsSerializer ps(path);
+        ps.load();
+        ps.beginGroup("Friends");
+            int size = ps.beginReadArray("Friend");
+            found = 0;
+            for (int i = 0; i < size; ++i)
+            {
+                ps.setArrayIndex(i);
+                if (ps.value("addr").toString() == friendAddress(i))
+                    ++found;
+                ps.value("alias");
+                ps.value("note");
+                ps.value("autoAcceptDir");
+                ps.value("circle", -1);
+                ps.value("historyMaxAge", -1);
+                ps.value("historyMaxRows", -1);
+                ps.value("activity", QDate());
+            }
+            ps.endArray();
+        ps.endGroup();
+    }
+    QCOMPARE(found, friends);
+}
@@ -0,0 +1,53 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SETTINGSBENCH_H
+#define SETTINGSBENCH_H
+
+#include <QObject>
+#include <QTemporaryDir>
+
+class QSettings;
+class SettingsSerializer;
+
+/// Saves and loads personal settings files of different sizes
+class SettingsBench : public QObject
+{
+    Q_OBJECT
+private slots:
+    void indexRoundTrip_data();
+    void indexRoundTrip();
+    void saveRoundTrip();
+    void save_data();
+    void save();
+    void load_data();
+    void load();
+
+private:
+    /// Writes the groups and values of a profile with this many friends, like Settings::savePersonal
+    void writeSettings(const QString& path, int friends);
+    /// Sets the values indexRoundTrip reads, with the same keys in different groups and arrays
+    static void writeIndexValues(SettingsSerializer& ps);
+    static void writeIndexValues(QSettings& s);
+
+private:
+    QTemporaryDir dir;
+};
+
+#endif // SETTINGSBENCH_H
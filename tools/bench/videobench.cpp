@@ -0,0 +1,171 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "videobench.h"
+#include "src/video/framebufferpool.h"
+#include "src/video/planekernels.h"
+#include "src/video/videoframe.h"
+
+#include <random>
+#include <vector>
+#include <QImage>
+#include <QtTest>
+#include <vpx/vpx_image.h>
+extern "C" {
+#include <libavutil/imgutils.h>
+#include <libavutil/pixfmt.h>
+}
+
+void VideoBench::initTestCase()
+{
+    pool = std::make_shared<FrameBufferPool>();
+}
+
+void VideoBench::addSizes()
+{
+    QTest::addColumn<QSize>("size");
+    QTest::newRow("640x480") << QSize(640, 480);
+    QTest::newRow("1280x720") << QSize(1280, 720);
+    QTest::newRow("1920x1080") << QSize(1920, 1080);
+}
+
+std::unique_ptr<VideoFrame> VideoBench::makeFrame(QSize size)
+{
+    AVFrame* frame = pool->acquire(size.width(), size.height(), AV_PIX_FMT_YUV420P);
+
+    // The buffer is contiguous, see FrameBufferPool. A recycled one already has the pattern, but that's cheap to check
+    const int bytes = av_image_get_buffer_size(AV_PIX_FMT_YUV420P, size.width(), size.height(), 1);
+    uint8_t* data = frame->data[0];
+    if (data[bytes - 1] != static_cast<uint8_t>((bytes - 1) * 7))
+    {
+        for (int i = 0; i < bytes; ++i)
+            data[i] = static_cast<uint8_t>(i * 7);
+    }
+
+    return std::unique_ptr<VideoFrame>{new VideoFrame(frame, nullptr, pool)};
+}
+
+void VideoBench::toQImage_data()
+{
+    addSizes();
+}
+
+void VideoBench::toQImage()
+{
+    QFETCH(QSize, size);
+    QBENCHMARK
+    {
+        std::unique_ptr<VideoFrame> frame = makeFrame(size);
+        QImage image = frame->toQImage();
+        QCOMPARE(image.size(), size);
+    }
+}
+
+void VideoBench::toVpxImage_data()
+{
+    addSizes();
+}
+
+void VideoBench::toVpxImage()
+{
+    QFETCH(QSize, size);
+    QBENCHMARK
+    {
+        std::unique_ptr<VideoFrame> frame = makeFrame(size);
+        vpx_image* image = frame->toVpxImage();
+        QVERIFY(image);
+        QCOMPARE(static_cast<int>(image->d_w), size.width());
+        delete image;
+    }
+}
+
+void VideoBench::toVpxImageHalved_data()
+{
+    addSizes();
+}
+
+void VideoBench::toVpxImageHalved()
+{
+    QFETCH(QSize, size);
+    QBENCHMARK
+    {
+        std::unique_ptr<VideoFrame> frame = makeFrame(size);
+        vpx_image* image = frame->toVpxImage(size / 2);
+        QVERIFY(image);
+        QCOMPARE(static_cast<int>(image->d_w), size.width() / 2);
+        delete image;
+    }
+}
+
+void VideoBench::halvePlaneAccuracy_data()
+{
+    QTest::addColumn<int>("dstWidth");
+    QTest::addColumn<int>("dstHeight");
+    QTest::addColumn<int>("padding");
+    // Narrower than a vector, a vector and a tail, and strides wider than the rows
+    QTest::newRow("7x3") << 7 << 3 << 0;
+    QTest::newRow("16x2") << 16 << 2 << 0;
+    QTest::newRow("37x5") << 37 << 5 << 3;
+    QTest::newRow("320x240") << 320 << 240 << 32;
+}
+
+/// The vectorized path may be one step above the exact average, the end of each row is exact
+void VideoBench::halvePlaneAccuracy()
+{
+    QFETCH(int, dstWidth);
+    QFETCH(int, dstHeight);
+    QFETCH(int, padding);
+
+    const int srcStride = 2 * dstWidth + padding;
+    const int dstStride = dstWidth + padding;
+    std::vector<uint8_t> src(srcStride * 2 * dstHeight);
+    std::vector<uint8_t> dst(dstStride * dstHeight);
+    std::mt19937 random(dstWidth);
+    std::uniform_int_distribution<int> byte(0, 255);
+    for (uint8_t& pixel : src)
+        pixel = static_cast<uint8_t>(byte(random));
+
+    PlaneKernels::halvePlane(src.data(), srcStride, dst.data(), dstStride, dstWidth, dstHeight);
+
+    const int tail = dstWidth - dstWidth % 16;
+    for (int y = 0; y < dstHeight; ++y)
+    {
+        const uint8_t* row0 = &src[2 * y * srcStride];
+        const uint8_t* row1 = row0 + srcStride;
+        for (int x = 0; x < dstWidth; ++x)
+        {
+            const int sum = row0[2 * x] + row0[2 * x + 1] + row1[2 * x] + row1[2 * x + 1];
+            const int error = dst[y * dstStride + x] - ((sum + 2) >> 2);
+            if (error < 0 || error > 1 || (x >= tail && error))
+                QFAIL(qPrintable(QString("pixel %1,%2 is off by %3").arg(x).arg(y).arg(error)));
+        }
+    }
+}
+
+void VideoBench::halvePlane()
+{
+    // The luma plane of a 1080p frame
+    const int dstWidth = 960, dstHeight = 540;
+    std::vector<uint8_t> src(4 * dstWidth * dstHeight, 128);
+    std::vector<uint8_t> dst(dstWidth * dstHeight);
+    QBENCHMARK
+    {
+        PlaneKernels::halvePlane(src.data(), 2 * dstWidth, dst.data(), dstWidth, dstWidth, dstHeight);
+    }
+}
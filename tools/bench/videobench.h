@@ -0,0 +1,57 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef VIDEOBENCH_H
+#define VIDEOBENCH_H
+
+#include <memory>
+#include <QObject>
+#include <QSize>
+
+class FrameBufferPool;
+class VideoFrame;
+
+/// Converts camera frames of the usual sizes, like the video sources and renderers do
+class VideoBench : public QObject
+{
+    Q_OBJECT
+private slots:
+    void initTestCase();
+
+    void toQImage_data();
+    void toQImage();
+    void toVpxImage_data();
+    void toVpxImage();
+    void toVpxImageHalved_data();
+    void toVpxImageHalved();
+    void halvePlaneAccuracy_data();
+    void halvePlaneAccuracy();
+    void halvePlane();
+
+private:
+    /// Adds the frame sizes of the usual cameras as data rows
+    void addSizes();
+    /// Returns a new I420 frame of this size with a test pattern, from our pool like a camera's
+    std::unique_ptr<VideoFrame> makeFrame(QSize size);
+
+private:
+    std::shared_ptr<FrameBufferPool> pool;
+};
+
+#endif // VIDEOBENCH_H
@@ -0,0 +1,27 @@
+#-------------------------------------------------
+#
+# qtox-loadgen, drives a qTox instance with local Tox nodes
+#
+#-------------------------------------------------
+
+QT       += core
+QT       -= gui
+
+TARGET = qtox-loadgen
+TEMPLATE = app
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+QMAKE_CXXFLAGS += -fno-exceptions
+
+SOURCES += main.cpp \
+    loadnode.cpp \
+    loadgenerator.cpp
+
+HEADERS += loadnode.h \
+    loadgenerator.h
+
+INCLUDEPATH += ../../libs/include
+
+LIBS += -L$$PWD/../../libs/lib -ltoxav -ltoxcore -lsodium -lvpx -lopus -lpthread
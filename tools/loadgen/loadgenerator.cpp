@@ -0,0 +1,375 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "loadgenerator.h"
+
+#include <algorithm>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTextStream>
+
+namespace
+{
+const int tickInterval = 5; // ms, toxcore usually wants 20 to 50
+const int inviteInterval = 2000; // ms, between the invites of the nodes that didn't join yet
+const int invitePeriod = 10000; // ms, nodes missing the group after that only come back through churn
+const int callRetry = 5000; // ms, before calling again once a call ended
+
+/// Mean, median, tail and maximum of latencies in us, reported in ms
+QJsonObject distribution(QVector<qint64> samples)
+{
+    QJsonObject json;
+    json.insert("count", samples.size());
+    if (samples.isEmpty())
+        return json;
+
+    std::sort(samples.begin(), samples.end());
+    auto percentile = [&samples](double p)
+    {
+        const int i = qMin(samples.size() - 1, static_cast<int>(p * samples.size()));
+        return samples[i] / 1000.0;
+    };
+
+    qint64 sum = 0;
+    for (qint64 sample : samples)
+        sum += sample;
+
+    json.insert("mean", sum / 1000.0 / samples.size());
+    json.insert("p50", percentile(0.50));
+    json.insert("p95", percentile(0.95));
+    json.insert("p99", percentile(0.99));
+    json.insert("max", samples.last() / 1000.0);
+    return json;
+}
+}
+
+LoadGenerator::LoadGenerator(const LoadConfig& config)
+    : config(config), random(config.seed)
+{
+    timer.setInterval(tickInterval);
+    timer.setTimerType(Qt::PreciseTimer);
+    connect(&timer, &QTimer::timeout, this, &LoadGenerator::tick);
+}
+
+LoadGenerator::~LoadGenerator()
+{
+}
+
+/**
+@brief Starts the nodes, the first one is the private bootstrap of the others.
+
+They send a friend request to the target, unless their save says it's a friend already.
+*/
+bool LoadGenerator::start()
+{
+    clock.start();
+    QDir().mkpath(config.dataDir);
+
+    QTextStream out(stdout);
+    for (int i = 0; i < config.nodes; ++i)
+    {
+        std::unique_ptr<LoadNode> node{new LoadNode(i, results, clock, random)};
+        if (!node->start(QDir(config.dataDir).filePath(QString("node%1.tox").arg(i))))
+            return false;
+
+        if (!node->addTarget(config.target))
+            return false;
+
+        nodes.push_back(std::move(node));
+    }
+
+    LoadNode& bootstrap = *nodes.front();
+    out << "Private bootstrap node: 127.0.0.1 " << bootstrap.getUdpPort() << ' '
+        << bootstrap.getDhtId().toHex().toUpper() << endl;
+
+    for (const std::unique_ptr<LoadNode>& node : nodes)
+    {
+        if (node.get() != &bootstrap)
+        {
+            node->bootstrap("127.0.0.1", bootstrap.getUdpPort(), bootstrap.getDhtId());
+            node->befriend(bootstrap.getPublicKey());
+            bootstrap.befriend(node->getPublicKey());
+        }
+
+        if (!config.bootstrapHost.isEmpty())
+            node->bootstrap(config.bootstrapHost, config.bootstrapPort, config.bootstrapKey);
+
+        // the friendships are saved right away, the target may accept them before we're done
+        node->save();
+        out << "Node " << node->getIndex() << ": " << node->getPublicKey().toHex().toUpper() << endl;
+    }
+
+    messageCredit.resize(nodes.size());
+    nextFile.assign(nodes.size(), 0);
+    nextCall.assign(nodes.size(), 0);
+
+    // spread the nodes' messages and files over their interval, so they don't all go at once
+    std::uniform_real_distribution<double> phase(0.0, 1.0);
+    for (size_t i = 0; i < nodes.size(); ++i)
+    {
+        messageCredit[i] = phase(random);
+        nextFile[i] = static_cast<qint64>(phase(random) * config.fileInterval * 1000);
+    }
+
+    out << "Waiting for the target to accept the friend requests" << endl;
+    lastTick = elapsed();
+    timer.start();
+    return true;
+}
+
+void LoadGenerator::tick()
+{
+    for (const std::unique_ptr<LoadNode>& node : nodes)
+        node->iterate();
+
+    const qint64 now = elapsed();
+    const qint64 delta = now - lastTick;
+    lastTick = now;
+
+    if (loadStart < 0)
+    {
+        const bool allOnline = std::all_of(nodes.begin(), nodes.end(),
+                                           [](const std::unique_ptr<LoadNode>& node) { return node->isTargetOnline(); });
+        if (allOnline || now >= config.onlineTimeout * 1000)
+            startLoad();
+        return;
+    }
+
+    if (now - loadStart >= config.duration * 1000)
+    {
+        finish();
+        return;
+    }
+
+    drive(now - loadStart, delta);
+}
+
+qint64 LoadGenerator::elapsed() const
+{
+    return clock.elapsed();
+}
+
+void LoadGenerator::startLoad()
+{
+    loadStart = elapsed();
+
+    int online = 0;
+    for (const std::unique_ptr<LoadNode>& node : nodes)
+        online += node->isTargetOnline();
+
+    QTextStream(stdout) << "Starting the load with " << online << " of " << nodes.size()
+                        << " nodes online" << endl;
+
+    if ((config.groupRate > 0 || config.groupChurn > 0) && !nodes.front()->createGroup())
+        qWarning() << "Can't create the group, there won't be any group load";
+
+    nodes.front()->inviteTargetToGroup();
+}
+
+/**
+@brief Sends what's due since the last tick, now is in ms since the load started.
+*/
+void LoadGenerator::drive(qint64 now, qint64 delta)
+{
+    const double seconds = delta / 1000.0;
+    LoadNode& creator = *nodes.front();
+
+    for (size_t i = 0; i < nodes.size(); ++i)
+    {
+        LoadNode& node = *nodes[i];
+
+        messageCredit[i] += config.messageRate * seconds;
+        while (messageCredit[i] >= 1.0)
+        {
+            messageCredit[i] -= 1.0;
+            node.sendMessage(config.messageSize);
+        }
+
+        if (config.fileSize && now >= nextFile[i])
+        {
+            node.sendFile(config.fileSize);
+            nextFile[i] = now + config.fileInterval * 1000;
+        }
+
+        if (static_cast<int>(i) < config.calls)
+        {
+            if (!node.isInCall() && now >= nextCall[i])
+            {
+                node.call(config.video);
+                nextCall[i] = now + callRetry;
+            }
+            node.sendCallFrames();
+        }
+    }
+
+    if (!creator.isInGroup())
+        return;
+
+    // the other nodes join once they're connected to the group's creator
+    if (now < invitePeriod && now >= nextInvites)
+    {
+        for (const std::unique_ptr<LoadNode>& node : nodes)
+        {
+            if (!node->isInGroup())
+                creator.inviteToGroup(node->getPublicKey());
+        }
+        nextInvites = now + inviteInterval;
+    }
+
+    groupCredit += config.groupRate * seconds;
+    churnCredit += config.groupChurn / 60.0 * seconds;
+    std::uniform_int_distribution<size_t> pick(0, nodes.size() - 1);
+
+    while (groupCredit >= 1.0)
+    {
+        groupCredit -= 1.0;
+        LoadNode& node = *nodes[pick(random)];
+        if (node.isInGroup())
+            node.sendGroupMessage(config.messageSize);
+        else
+            creator.sendGroupMessage(config.messageSize);
+    }
+
+    while (churnCredit >= 1.0 && nodes.size() > 1)
+    {
+        churnCredit -= 1.0;
+        LoadNode& node = *nodes[1 + pick(random) % (nodes.size() - 1)];
+        if (node.isInGroup())
+            node.leaveGroup();
+        else
+            creator.inviteToGroup(node.getPublicKey());
+    }
+}
+
+void LoadGenerator::finish()
+{
+    timer.stop();
+    const qint64 loadTime = elapsed() - loadStart;
+
+    for (const std::unique_ptr<LoadNode>& node : nodes)
+    {
+        node->hangUp();
+        node->iterate();
+        node->save();
+    }
+
+    printSummary(loadTime);
+    emit finished(writeResults(loadTime));
+}
+
+/**
+@brief Appends the results of the run to the output, one JSON object per line.
+
+Each run carries its configuration, so runs of the same scenario can be compared over time.
+*/
+bool LoadGenerator::writeResults(qint64 loadTime)
+{
+    if (config.output.isEmpty())
+        return true;
+
+    const double seconds = loadTime / 1000.0;
+
+    QJsonObject setup;
+    setup.insert("nodes", config.nodes);
+    setup.insert("duration", config.duration);
+    setup.insert("messageRate", config.messageRate);
+    setup.insert("messageSize", config.messageSize);
+    setup.insert("groupRate", config.groupRate);
+    setup.insert("groupChurn", config.groupChurn);
+    setup.insert("fileSize", static_cast<double>(config.fileSize));
+    setup.insert("fileInterval", config.fileInterval);
+    setup.insert("calls", config.calls);
+    setup.insert("video", config.video);
+    setup.insert("seed", static_cast<double>(config.seed));
+
+    QJsonObject messages;
+    messages.insert("sent", static_cast<double>(results.messagesSent));
+    messages.insert("failed", static_cast<double>(results.messagesFailed));
+    messages.insert("confirmed", results.messageLatencies.size());
+    messages.insert("throughput", results.messageLatencies.size() / seconds);
+    messages.insert("latency", distribution(results.messageLatencies));
+
+    QJsonObject groups;
+    groups.insert("sent", static_cast<double>(results.groupMessagesSent));
+    groups.insert("failed", static_cast<double>(results.groupMessagesFailed));
+    groups.insert("joins", static_cast<double>(results.groupJoins));
+    groups.insert("leaves", static_cast<double>(results.groupLeaves));
+    groups.insert("namelistChanges", static_cast<double>(results.groupNamelistChanges));
+
+    QJsonObject files;
+    files.insert("started", static_cast<double>(results.filesStarted));
+    files.insert("completed", static_cast<double>(results.filesCompleted));
+    files.insert("failed", static_cast<double>(results.filesFailed));
+    files.insert("bytes", static_cast<double>(results.fileBytes));
+    files.insert("throughput", results.fileBytes / seconds);
+    files.insert("duration", distribution(results.fileDurations));
+
+    QJsonObject calls;
+    calls.insert("started", static_cast<double>(results.callsStarted));
+    calls.insert("answered", static_cast<double>(results.callsAnswered));
+    calls.insert("failed", static_cast<double>(results.callsFailed));
+    calls.insert("setup", distribution(results.callSetupLatencies));
+    calls.insert("audioFramesSent", static_cast<double>(results.audioFramesSent));
+    calls.insert("videoFramesSent", static_cast<double>(results.videoFramesSent));
+    calls.insert("framesFailed", static_cast<double>(results.framesFailed));
+    calls.insert("audioFramesReceived", static_cast<double>(results.audioFramesReceived));
+    calls.insert("videoFramesReceived", static_cast<double>(results.videoFramesReceived));
+
+    QJsonObject run;
+    run.insert("time", QDateTime::currentDateTimeUtc().toString(Qt::ISODate));
+    run.insert("config", setup);
+    run.insert("seconds", seconds);
+    run.insert("messages", messages);
+    run.insert("groups", groups);
+    run.insert("files", files);
+    run.insert("calls", calls);
+
+    QFile file(config.output);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append))
+    {
+        qCritical() << "Can't write the results to" << config.output;
+        return false;
+    }
+
+    file.write(QJsonDocument(run).toJson(QJsonDocument::Compact) + '\n');
+    return true;
+}
+
+void LoadGenerator::printSummary(qint64 loadTime) const
+{
+    const QJsonObject latency = distribution(results.messageLatencies);
+    const QJsonObject setup = distribution(results.callSetupLatencies);
+
+    QTextStream out(stdout);
+    out << "Ran for " << loadTime / 1000.0 << " s" << endl;
+    out << "Messages: " << results.messagesSent << " sent, " << results.messageLatencies.size()
+        << " confirmed, " << results.messagesFailed << " failed, latency "
+        << latency.value("p50").toDouble() << " ms median, " << latency.value("p99").toDouble() << " ms p99" << endl;
+    out << "Groups: " << results.groupMessagesSent << " messages, " << results.groupJoins << " joins, "
+        << results.groupLeaves << " leaves" << endl;
+    out << "Files: " << results.filesCompleted << " of " << results.filesStarted << " completed, "
+        << results.fileBytes / 1024.0 / (loadTime / 1000.0) << " KiB/s" << endl;
+    out << "Calls: " << results.callsAnswered << " of " << results.callsStarted << " answered, setup "
+        << setup.value("p50").toDouble() << " ms median, " << results.audioFramesSent << " audio and "
+        << results.videoFramesSent << " video frames sent" << endl;
+}
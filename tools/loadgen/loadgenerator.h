@@ -0,0 +1,95 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LOADGENERATOR_H
+#define LOADGENERATOR_H
+
+#include "loadnode.h"
+
+#include <memory>
+#include <random>
+#include <vector>
+#include <QElapsedTimer>
+#include <QObject>
+#include <QTimer>
+
+struct LoadConfig
+{
+    QByteArray target; ///< Tox address of the qTox under test
+    int nodes = 8;
+    int duration = 60; ///< In s, of load once the target is online
+    int onlineTimeout = 120; ///< In s, the load starts with the nodes that are online by then
+    double messageRate = 1.0; ///< Per node and second
+    int messageSize = 100;
+    double groupRate = 0.0; ///< Group messages per second, over all the nodes
+    double groupChurn = 0.0; ///< Nodes leaving or joining the group per minute
+    quint64 fileSize = 0; ///< 0 sends no files
+    int fileInterval = 30; ///< In s, between the files of a node
+    int calls = 0; ///< How many nodes call the target
+    bool video = false;
+    quint32 seed = 1;
+    QString dataDir; ///< Where the nodes keep their tox saves, so the target knows them from run to run
+    QString output; ///< The results are appended to it, one JSON object per line
+    QString bootstrapHost; ///< A node of the target's network, if it doesn't find us on the LAN
+    quint16 bootstrapPort = 0;
+    QByteArray bootstrapKey;
+};
+
+/// Runs the nodes and drives the load, then writes what they measured
+class LoadGenerator : public QObject
+{
+    Q_OBJECT
+public:
+    explicit LoadGenerator(const LoadConfig& config);
+    ~LoadGenerator();
+
+    bool start();
+
+signals:
+    void finished(bool success);
+
+private slots:
+    void tick();
+
+private:
+    qint64 elapsed() const; ///< In ms
+    void startLoad();
+    void drive(qint64 now, qint64 delta);
+    void finish();
+    bool writeResults(qint64 loadTime);
+    void printSummary(qint64 loadTime) const;
+
+private:
+    LoadConfig config;
+    QElapsedTimer clock;
+    std::mt19937 random;
+    LoadResults results;
+    std::vector<std::unique_ptr<LoadNode>> nodes;
+    QTimer timer;
+    qint64 lastTick = 0;
+    qint64 loadStart = -1; ///< In ms, -1 while we wait for the target
+    qint64 nextInvites = 0;
+    std::vector<double> messageCredit; ///< Messages due per node, sent once they reach 1
+    std::vector<qint64> nextFile;
+    std::vector<qint64> nextCall;
+    double groupCredit = 0.0;
+    double churnCredit = 0.0;
+};
+
+#endif // LOADGENERATOR_H
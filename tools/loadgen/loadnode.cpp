@@ -0,0 +1,500 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "loadnode.h"
+
+#include <cmath>
+#include <cstring>
+#include <QDebug>
+#include <QFile>
+#include <QSaveFile>
+
+namespace
+{
+const uint32_t audioBitrate = 48; // kb/s, as qTox calls
+const uint32_t videoBitrate = 5000;
+const int audioRate = 48000;
+const int audioFrameMs = 20;
+const int videoWidth = 640;
+const int videoHeight = 480;
+const int videoFrameMs = 1000 / 15;
+const char requestMessage[] = "qtox-loadgen";
+}
+
+LoadNode::LoadNode(int index, LoadResults& results, const QElapsedTimer& clock, std::mt19937& random)
+    : index{index}, results(results), clock(clock), random(random)
+{
+}
+
+LoadNode::~LoadNode()
+{
+    if (av)
+        toxav_kill(av);
+    if (tox)
+        tox_kill(tox);
+}
+
+bool LoadNode::start(const QString& path)
+{
+    savePath = path;
+
+    QByteArray savedata;
+    QFile saveFile(savePath);
+    if (saveFile.open(QIODevice::ReadOnly))
+        savedata = saveFile.readAll();
+
+    Tox_Options options;
+    tox_options_default(&options);
+    options.ipv6_enabled = false;
+    options.start_port = 33445;
+    options.end_port = 33445 + 1000;
+    options.savedata_type = savedata.isEmpty() ? TOX_SAVEDATA_TYPE_NONE : TOX_SAVEDATA_TYPE_TOX_SAVE;
+    options.savedata_data = reinterpret_cast<const uint8_t*>(savedata.constData());
+    options.savedata_length = savedata.size();
+
+    TOX_ERR_NEW error;
+    tox = tox_new(&options, &error);
+    if (!tox)
+    {
+        qCritical() << "Node" << index << "can't start toxcore, error" << error;
+        return false;
+    }
+
+    TOXAV_ERR_NEW avError;
+    av = toxav_new(tox, &avError);
+    if (!av)
+    {
+        qCritical() << "Node" << index << "can't start toxav, error" << avError;
+        return false;
+    }
+
+    tox_callback_friend_connection_status(tox, onFriendConnectionStatus, this);
+    tox_callback_friend_read_receipt(tox, onReadReceipt, this);
+    tox_callback_file_chunk_request(tox, onFileChunkRequest, this);
+    tox_callback_file_recv_control(tox, onFileControl, this);
+    tox_callback_group_invite(tox, onGroupInvite, this);
+    tox_callback_group_namelist_change(tox, onGroupNamelistChange, this);
+    toxav_callback_call_state(av, onCallState, this);
+    toxav_callback_audio_receive_frame(av, onAudioFrame, this);
+    toxav_callback_video_receive_frame(av, onVideoFrame, this);
+
+    const QByteArray name = QString("loadgen %1").arg(index).toUtf8();
+    tox_self_set_name(tox, reinterpret_cast<const uint8_t*>(name.constData()), name.size(), nullptr);
+
+    pcm.resize(audioRate * audioFrameMs / 1000);
+    yPlane.resize(videoWidth * videoHeight);
+    uPlane.fill(char(128), videoWidth * videoHeight / 4);
+    vPlane.fill(char(128), videoWidth * videoHeight / 4);
+    return true;
+}
+
+bool LoadNode::save() const
+{
+    QByteArray savedata(tox_get_savedata_size(tox), Qt::Uninitialized);
+    tox_get_savedata(tox, reinterpret_cast<uint8_t*>(savedata.data()));
+
+    QSaveFile file(savePath);
+    if (!file.open(QIODevice::WriteOnly) || file.write(savedata) != savedata.size() || !file.commit())
+    {
+        qWarning() << "Node" << index << "can't write its save to" << savePath;
+        return false;
+    }
+
+    return true;
+}
+
+void LoadNode::bootstrap(const QString& host, quint16 port, const QByteArray& dhtId)
+{
+    const QByteArray cHost = host.toLatin1();
+    const uint8_t* key = reinterpret_cast<const uint8_t*>(dhtId.constData());
+    if (!tox_bootstrap(tox, cHost.constData(), port, key, nullptr))
+        qWarning() << "Node" << index << "can't bootstrap from" << host << port;
+    tox_add_tcp_relay(tox, cHost.constData(), port, key, nullptr);
+}
+
+int LoadNode::getIndex() const
+{
+    return index;
+}
+
+quint16 LoadNode::getUdpPort() const
+{
+    return tox_self_get_udp_port(tox, nullptr);
+}
+
+QByteArray LoadNode::getDhtId() const
+{
+    QByteArray id(TOX_PUBLIC_KEY_SIZE, Qt::Uninitialized);
+    tox_self_get_dht_id(tox, reinterpret_cast<uint8_t*>(id.data()));
+    return id;
+}
+
+QByteArray LoadNode::getPublicKey() const
+{
+    QByteArray key(TOX_PUBLIC_KEY_SIZE, Qt::Uninitialized);
+    tox_self_get_public_key(tox, reinterpret_cast<uint8_t*>(key.data()));
+    return key;
+}
+
+bool LoadNode::addTarget(const QByteArray& address)
+{
+    const uint8_t* key = reinterpret_cast<const uint8_t*>(address.constData());
+    target = tox_friend_by_public_key(tox, key, nullptr);
+    if (target != UINT32_MAX)
+        return true;
+
+    TOX_ERR_FRIEND_ADD error;
+    target = tox_friend_add(tox, key, reinterpret_cast<const uint8_t*>(requestMessage),
+                            sizeof(requestMessage) - 1, &error);
+    if (target == UINT32_MAX)
+    {
+        qCritical() << "Node" << index << "can't befriend the target, error" << error;
+        return false;
+    }
+
+    return true;
+}
+
+void LoadNode::befriend(const QByteArray& publicKey)
+{
+    const uint8_t* key = reinterpret_cast<const uint8_t*>(publicKey.constData());
+    if (tox_friend_by_public_key(tox, key, nullptr) == UINT32_MAX)
+        tox_friend_add_norequest(tox, key, nullptr);
+}
+
+bool LoadNode::isTargetOnline() const
+{
+    return targetOnline;
+}
+
+unsigned LoadNode::iterate()
+{
+    tox_iterate(tox);
+    toxav_iterate(av);
+    return qMin(tox_iteration_interval(tox), toxav_iteration_interval(av));
+}
+
+/**
+@brief Sends a message of random text to the target, its latency is measured once it's confirmed.
+*/
+bool LoadNode::sendMessage(int size)
+{
+    if (!targetOnline)
+        return false;
+
+    const QByteArray text = randomText(qBound(1, size, static_cast<int>(TOX_MAX_MESSAGE_LENGTH)));
+    TOX_ERR_FRIEND_SEND_MESSAGE error;
+    uint32_t receipt = tox_friend_send_message(tox, target, TOX_MESSAGE_TYPE_NORMAL,
+                                               reinterpret_cast<const uint8_t*>(text.constData()),
+                                               text.size(), &error);
+    if (error != TOX_ERR_FRIEND_SEND_MESSAGE_OK)
+    {
+        ++results.messagesFailed;
+        return false;
+    }
+
+    ++results.messagesSent;
+    receipts.insert(receipt, now());
+    return true;
+}
+
+bool LoadNode::sendFile(quint64 size)
+{
+    if (!targetOnline)
+        return false;
+
+    const QByteArray name = QString("loadgen-%1-%2.bin").arg(index).arg(results.filesStarted).toUtf8();
+    TOX_ERR_FILE_SEND error;
+    uint32_t fileId = tox_file_send(tox, target, TOX_FILE_KIND_DATA, size, nullptr,
+                                    reinterpret_cast<const uint8_t*>(name.constData()), name.size(), &error);
+    if (error != TOX_ERR_FILE_SEND_OK)
+    {
+        ++results.filesFailed;
+        return false;
+    }
+
+    ++results.filesStarted;
+    files.insert(fileId, {size, now()});
+    return true;
+}
+
+bool LoadNode::createGroup()
+{
+    group = tox_add_groupchat(tox);
+    createdGroup = group >= 0;
+    return createdGroup;
+}
+
+void LoadNode::inviteToGroup(const QByteArray& publicKey)
+{
+    uint32_t friendId = tox_friend_by_public_key(tox, reinterpret_cast<const uint8_t*>(publicKey.constData()), nullptr);
+    if (group < 0 || friendId == UINT32_MAX)
+        return;
+
+    tox_invite_friend(tox, friendId, group);
+}
+
+void LoadNode::inviteTargetToGroup()
+{
+    if (group >= 0 && targetOnline)
+        tox_invite_friend(tox, target, group);
+}
+
+bool LoadNode::isInGroup() const
+{
+    return group >= 0;
+}
+
+void LoadNode::leaveGroup()
+{
+    if (group < 0 || createdGroup)
+        return;
+
+    tox_del_groupchat(tox, group);
+    group = -1;
+    ++results.groupLeaves;
+}
+
+bool LoadNode::sendGroupMessage(int size)
+{
+    if (group < 0)
+        return false;
+
+    const QByteArray text = randomText(qBound(1, size, 1024));
+    if (tox_group_message_send(tox, group, reinterpret_cast<const uint8_t*>(text.constData()), text.size()) == -1)
+    {
+        ++results.groupMessagesFailed;
+        return false;
+    }
+
+    ++results.groupMessagesSent;
+    return true;
+}
+
+bool LoadNode::call(bool video)
+{
+    if (!targetOnline || calling)
+        return false;
+
+    TOXAV_ERR_CALL error;
+    if (!toxav_call(av, target, audioBitrate, video ? videoBitrate : 0, &error))
+    {
+        ++results.callsFailed;
+        return false;
+    }
+
+    ++results.callsStarted;
+    calling = true;
+    answered = false;
+    callVideo = video;
+    callStart = now();
+    return true;
+}
+
+void LoadNode::hangUp()
+{
+    if (!calling)
+        return;
+
+    toxav_call_control(av, target, TOXAV_CALL_CONTROL_CANCEL, nullptr);
+    if (!answered)
+        ++results.callsFailed;
+    calling = false;
+    answered = false;
+}
+
+bool LoadNode::isInCall() const
+{
+    return calling;
+}
+
+void LoadNode::sendCallFrames()
+{
+    if (!calling || !answered)
+        return;
+
+    const qint64 ms = now() / 1000;
+    while (nextAudioFrame <= ms)
+    {
+        // a tone, silence would be encoded to almost nothing
+        for (int16_t& sample : pcm)
+            sample = static_cast<int16_t>(8000 * std::sin(2 * M_PI * 440 * (audioPhase++) / audioRate));
+
+        if (toxav_audio_send_frame(av, target, pcm.constData(), pcm.size(), 1, audioRate, nullptr))
+            ++results.audioFramesSent;
+        else
+            ++results.framesFailed;
+        nextAudioFrame += audioFrameMs;
+    }
+
+    if (!callVideo || nextVideoFrame > ms)
+        return;
+
+    // a moving bar, so every frame has something for the encoder to do
+    yPlane.fill(char(64));
+    barPosition = (barPosition + 8) % videoWidth;
+    for (int row = 0; row < videoHeight; ++row)
+        memset(yPlane.data() + row * videoWidth + barPosition, 235, qMin(32, videoWidth - barPosition));
+
+    if (toxav_video_send_frame(av, target, videoWidth, videoHeight,
+                               reinterpret_cast<const uint8_t*>(yPlane.constData()),
+                               reinterpret_cast<const uint8_t*>(uPlane.constData()),
+                               reinterpret_cast<const uint8_t*>(vPlane.constData()), nullptr))
+        ++results.videoFramesSent;
+    else
+        ++results.framesFailed;
+    nextVideoFrame = ms + videoFrameMs;
+}
+
+qint64 LoadNode::now() const
+{
+    return clock.nsecsElapsed() / 1000;
+}
+
+QByteArray LoadNode::randomText(int size)
+{
+    static const char letters[] = "abcdefghijklmnopqrstuvwxyz ";
+    std::uniform_int_distribution<int> letter(0, sizeof(letters) - 2);
+
+    QByteArray text(size, Qt::Uninitialized);
+    for (char& c : text)
+        c = letters[letter(random)];
+    return text;
+}
+
+void LoadNode::onFriendConnectionStatus(Tox*, uint32_t friendId, TOX_CONNECTION status, void* _node)
+{
+    LoadNode* node = static_cast<LoadNode*>(_node);
+    if (friendId != node->target)
+        return;
+
+    node->targetOnline = status != TOX_CONNECTION_NONE;
+    if (node->targetOnline)
+        return;
+
+    // toxcore won't confirm what it didn't deliver, nor finish the transfers and the call
+    node->results.messagesFailed += node->receipts.size();
+    node->receipts.clear();
+    node->results.filesFailed += node->files.size();
+    node->files.clear();
+    node->calling = false;
+}
+
+void LoadNode::onReadReceipt(Tox*, uint32_t friendId, uint32_t receipt, void* _node)
+{
+    LoadNode* node = static_cast<LoadNode*>(_node);
+    if (friendId != node->target)
+        return;
+
+    auto it = node->receipts.find(receipt);
+    if (it == node->receipts.end())
+        return;
+
+    node->results.messageLatencies.append(node->now() - it.value());
+    node->receipts.erase(it);
+}
+
+void LoadNode::onFileChunkRequest(Tox* tox, uint32_t friendId, uint32_t fileId, uint64_t position,
+                                  size_t length, void* _node)
+{
+    LoadNode* node = static_cast<LoadNode*>(_node);
+    auto it = node->files.find(fileId);
+    if (friendId != node->target || it == node->files.end())
+        return;
+
+    if (!length)
+    {
+        ++node->results.filesCompleted;
+        node->results.fileBytes += it->size;
+        node->results.fileDurations.append(node->now() - it->start);
+        node->files.erase(it);
+        return;
+    }
+
+    if (static_cast<size_t>(node->chunk.size()) < length)
+        node->chunk.fill('q', static_cast<int>(length));
+    if (!tox_file_send_chunk(tox, friendId, fileId, position,
+                             reinterpret_cast<const uint8_t*>(node->chunk.constData()), length, nullptr))
+        qWarning() << "Node" << node->index << "can't send a chunk of file" << fileId;
+}
+
+void LoadNode::onFileControl(Tox*, uint32_t friendId, uint32_t fileId, TOX_FILE_CONTROL control, void* _node)
+{
+    LoadNode* node = static_cast<LoadNode*>(_node);
+    if (friendId != node->target || control != TOX_FILE_CONTROL_CANCEL)
+        return;
+
+    if (node->files.remove(fileId))
+        ++node->results.filesFailed;
+}
+
+void LoadNode::onGroupInvite(Tox* tox, int32_t friendId, uint8_t type, const uint8_t* data, uint16_t length,
+                             void* _node)
+{
+    LoadNode* node = static_cast<LoadNode*>(_node);
+    if (static_cast<uint32_t>(friendId) == node->target || type != TOX_GROUPCHAT_TYPE_TEXT || node->group >= 0)
+        return;
+
+    node->group = tox_join_groupchat(tox, friendId, data, length);
+    if (node->group >= 0)
+        ++node->results.groupJoins;
+}
+
+void LoadNode::onGroupNamelistChange(Tox*, int groupId, int, uint8_t change, void* _node)
+{
+    LoadNode* node = static_cast<LoadNode*>(_node);
+    // the group's creator sees every change once, the others would count them again
+    if (groupId == node->group && node->createdGroup && change != TOX_CHAT_CHANGE_PEER_NAME)
+        ++node->results.groupNamelistChanges;
+}
+
+void LoadNode::onCallState(ToxAV*, uint32_t friendId, uint32_t state, void* _node)
+{
+    LoadNode* node = static_cast<LoadNode*>(_node);
+    if (friendId != node->target || !node->calling)
+        return;
+
+    if (state & (TOXAV_FRIEND_CALL_STATE_ERROR | TOXAV_FRIEND_CALL_STATE_FINISHED))
+    {
+        if (!node->answered)
+            ++node->results.callsFailed;
+        node->calling = false;
+        node->answered = false;
+        return;
+    }
+
+    if (!node->answered)
+    {
+        node->answered = true;
+        ++node->results.callsAnswered;
+        node->results.callSetupLatencies.append(node->now() - node->callStart);
+        node->nextAudioFrame = node->nextVideoFrame = node->now() / 1000;
+    }
+}
+
+void LoadNode::onAudioFrame(ToxAV*, uint32_t, const int16_t*, size_t, uint8_t, uint32_t, void* _node)
+{
+    ++static_cast<LoadNode*>(_node)->results.audioFramesReceived;
+}
+
+void LoadNode::onVideoFrame(ToxAV*, uint32_t, uint16_t, uint16_t, const uint8_t*, const uint8_t*, const uint8_t*,
+                            int32_t, int32_t, int32_t, void* _node)
+{
+    ++static_cast<LoadNode*>(_node)->results.videoFramesReceived;
+}
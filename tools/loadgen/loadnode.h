@@ -0,0 +1,163 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LOADNODE_H
+#define LOADNODE_H
+
+#include <cstdint>
+#include <random>
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QString>
+#include <QVector>
+#include <tox/tox.h>
+#include <tox/toxav.h>
+
+/// What the nodes measured, times are in us of the generator's clock
+struct LoadResults
+{
+    quint64 messagesSent = 0;
+    quint64 messagesFailed = 0; ///< Refused by toxcore, they're never retried
+    QVector<qint64> messageLatencies; ///< From the send to the target's receipt
+
+    quint64 groupMessagesSent = 0;
+    quint64 groupMessagesFailed = 0;
+    quint64 groupJoins = 0;
+    quint64 groupLeaves = 0;
+    quint64 groupNamelistChanges = 0; ///< Seen by the nodes, the target sees as many
+
+    quint64 filesStarted = 0;
+    quint64 filesCompleted = 0;
+    quint64 filesFailed = 0; ///< Cancelled by the target, or refused by toxcore
+    quint64 fileBytes = 0; ///< Of the completed files
+    QVector<qint64> fileDurations; ///< From the offer to the last chunk
+
+    quint64 callsStarted = 0;
+    quint64 callsAnswered = 0;
+    quint64 callsFailed = 0; ///< Refused by toxav, or ended before being answered
+    QVector<qint64> callSetupLatencies; ///< From the call to the target answering
+    quint64 audioFramesSent = 0;
+    quint64 videoFramesSent = 0;
+    quint64 framesFailed = 0;
+    quint64 audioFramesReceived = 0;
+    quint64 videoFramesReceived = 0;
+};
+
+/// One local Tox instance of the load generator, everything runs on the generator's thread
+class LoadNode
+{
+public:
+    LoadNode(int index, LoadResults& results, const QElapsedTimer& clock, std::mt19937& random);
+    ~LoadNode();
+    LoadNode(const LoadNode&) = delete;
+    LoadNode& operator=(const LoadNode&) = delete;
+
+    /// Loads the node's tox save if there's one, so the target knows it from the previous runs
+    bool start(const QString& savePath);
+    bool save() const;
+    void bootstrap(const QString& host, quint16 port, const QByteArray& dhtId);
+
+    int getIndex() const;
+    quint16 getUdpPort() const;
+    QByteArray getDhtId() const;
+    QByteArray getPublicKey() const;
+
+    /// Sends a friend request to the target, unless it's a friend already
+    bool addTarget(const QByteArray& address);
+    /// Befriends another node, both sides call it so no request is needed
+    void befriend(const QByteArray& publicKey);
+    bool isTargetOnline() const;
+
+    /// Runs toxcore and toxav, returns how many ms they may wait before the next call
+    unsigned iterate();
+
+    bool sendMessage(int size);
+    bool sendFile(quint64 size);
+
+    /// Creates the group the other nodes and the target are invited to
+    bool createGroup();
+    /// Only for the node that created the group
+    void inviteToGroup(const QByteArray& publicKey);
+    void inviteTargetToGroup();
+    bool isInGroup() const;
+    void leaveGroup();
+    bool sendGroupMessage(int size);
+
+    bool call(bool video);
+    void hangUp();
+    bool isInCall() const; ///< Including a call that's ringing
+    /// Sends the audio and video that's due by now, a tone and a moving bar
+    void sendCallFrames();
+
+private:
+    qint64 now() const;
+    QByteArray randomText(int size);
+
+    static void onFriendConnectionStatus(Tox*, uint32_t friendId, TOX_CONNECTION status, void* node);
+    static void onReadReceipt(Tox*, uint32_t friendId, uint32_t receipt, void* node);
+    static void onFileChunkRequest(Tox*, uint32_t friendId, uint32_t fileId, uint64_t position,
+                                   size_t length, void* node);
+    static void onFileControl(Tox*, uint32_t friendId, uint32_t fileId, TOX_FILE_CONTROL control, void* node);
+    static void onGroupInvite(Tox*, int32_t friendId, uint8_t type, const uint8_t* data, uint16_t length, void* node);
+    static void onGroupNamelistChange(Tox*, int groupId, int peerId, uint8_t change, void* node);
+    static void onCallState(ToxAV*, uint32_t friendId, uint32_t state, void* node);
+    static void onAudioFrame(ToxAV*, uint32_t friendId, const int16_t* pcm, size_t sampleCount,
+                             uint8_t channels, uint32_t samplingRate, void* node);
+    static void onVideoFrame(ToxAV*, uint32_t friendId, uint16_t w, uint16_t h,
+                             const uint8_t* y, const uint8_t* u, const uint8_t* v,
+                             int32_t ystride, int32_t ustride, int32_t vstride, void* node);
+
+private:
+    struct OutgoingFile
+    {
+        quint64 size;
+        qint64 start;
+    };
+
+    int index;
+    LoadResults& results;
+    const QElapsedTimer& clock;
+    std::mt19937& random;
+    Tox* tox = nullptr;
+    ToxAV* av = nullptr;
+    QString savePath;
+
+    uint32_t target = UINT32_MAX; ///< Our friend number of the target
+    bool targetOnline = false;
+    QHash<uint32_t, qint64> receipts; ///< Send times of the messages the target didn't confirm yet
+    QHash<uint32_t, OutgoingFile> files;
+    QByteArray chunk; ///< The data of every file we send, as large as the largest chunk toxcore asked for
+
+    int group = -1;
+    bool createdGroup = false;
+
+    bool calling = false;
+    bool answered = false;
+    bool callVideo = false;
+    qint64 callStart = 0;
+    qint64 nextAudioFrame = 0;
+    qint64 nextVideoFrame = 0;
+    quint64 audioPhase = 0;
+    int barPosition = 0;
+    QVector<int16_t> pcm;
+    QByteArray yPlane, uPlane, vPlane;
+};
+
+#endif // LOADNODE_H
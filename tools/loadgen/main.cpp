@@ -0,0 +1,111 @@
+/*
+    Copyright © 2016 by The qTox Project
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    qTox is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qTox is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qTox.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "loadgenerator.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDebug>
+#include <QStandardPaths>
+#include <QStringList>
+
+/*
+ * qtox-loadgen runs a few local Tox nodes against a qTox instance under test.
+ * They befriend it, then send it messages, group traffic, files and calls at fixed rates,
+ * and measure how long it takes to confirm them. The nodes keep their saves in the data
+ * directory, so the friendships only need to be accepted on the first run.
+ */
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    app.setApplicationName("qtox-loadgen");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Drives a qTox instance with reproducible load, and measures it.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("target", "Tox ID of the qTox under test.");
+    parser.addOption(QCommandLineOption("nodes", "Local Tox nodes to run.", "count", "8"));
+    parser.addOption(QCommandLineOption("duration", "Seconds of load, once the target is online.", "seconds", "60"));
+    parser.addOption(QCommandLineOption("online-timeout", "Seconds to wait for the target before starting anyway.", "seconds", "120"));
+    parser.addOption(QCommandLineOption("message-rate", "Messages per node and second.", "rate", "1"));
+    parser.addOption(QCommandLineOption("message-size", "Bytes per message.", "bytes", "100"));
+    parser.addOption(QCommandLineOption("group-rate", "Group messages per second, over all the nodes.", "rate", "0"));
+    parser.addOption(QCommandLineOption("group-churn", "Nodes leaving or joining the group per minute.", "count", "0"));
+    parser.addOption(QCommandLineOption("file-size", "Bytes per file, 0 sends none.", "bytes", "0"));
+    parser.addOption(QCommandLineOption("file-interval", "Seconds between the files of a node.", "seconds", "30"));
+    parser.addOption(QCommandLineOption("calls", "Nodes calling the target.", "count", "0"));
+    parser.addOption(QCommandLineOption("video", "Make video calls instead of audio calls."));
+    parser.addOption(QCommandLineOption("seed", "Seed of the random text and group churn.", "seed", "1"));
+    parser.addOption(QCommandLineOption("data", "Directory of the nodes' tox saves.", "dir",
+                                        QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + "/qtox-loadgen"));
+    parser.addOption(QCommandLineOption("output", "Appends the results to this file, one JSON object per run.", "file"));
+    parser.addOption(QCommandLineOption("bootstrap", "A node of the target's network, as host:port:key.", "node"));
+    parser.process(app);
+
+    if (parser.positionalArguments().size() != 1)
+        parser.showHelp(1);
+
+    LoadConfig config;
+    config.target = QByteArray::fromHex(parser.positionalArguments().first().toLatin1());
+    if (config.target.size() != TOX_ADDRESS_SIZE)
+    {
+        qCritical() << "The target must be a Tox ID of" << TOX_ADDRESS_SIZE * 2 << "hex digits";
+        return 1;
+    }
+
+    config.nodes = qMax(1, parser.value("nodes").toInt());
+    config.duration = parser.value("duration").toInt();
+    config.onlineTimeout = parser.value("online-timeout").toInt();
+    config.messageRate = parser.value("message-rate").toDouble();
+    config.messageSize = parser.value("message-size").toInt();
+    config.groupRate = parser.value("group-rate").toDouble();
+    config.groupChurn = parser.value("group-churn").toDouble();
+    config.fileSize = parser.value("file-size").toULongLong();
+    config.fileInterval = qMax(1, parser.value("file-interval").toInt());
+    config.calls = parser.value("calls").toInt();
+    config.video = parser.isSet("video");
+    config.seed = parser.value("seed").toUInt();
+    config.dataDir = parser.value("data");
+    config.output = parser.value("output");
+
+    if (parser.isSet("bootstrap"))
+    {
+        const QStringList node = parser.value("bootstrap").split(':');
+        if (node.size() != 3 || QByteArray::fromHex(node[2].toLatin1()).size() != TOX_PUBLIC_KEY_SIZE)
+        {
+            qCritical() << "The bootstrap node must be given as host:port:key";
+            return 1;
+        }
+
+        config.bootstrapHost = node[0];
+        config.bootstrapPort = node[1].toUShort();
+        config.bootstrapKey = QByteArray::fromHex(node[2].toLatin1());
+    }
+
+    LoadGenerator generator(config);
+    QObject::connect(&generator, &LoadGenerator::finished, &app, [&app](bool success)
+    {
+        app.exit(success ? 0 : 1);
+    });
+
+    if (!generator.start())
+        return 1;
+
+    return app.exec();
+}